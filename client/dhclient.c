@@ -5064,6 +5064,10 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 	struct client_state *client;
 	struct timeval tv;
 
+	/* Only the server can reload its configuration. */
+	if (newstate == server_reload)
+		return DHCP_R_INVALIDARG;
+
 	if (newstate == server_shutdown) {
 		/* Re-entry */
 		if (shutdown_signal == SIGUSR1)
@@ -5109,6 +5113,9 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 		  case server_awaken:
 		    state_reboot (client);
 		    break;
+
+		  case server_reload:
+		    break;
 		}
 	    }
 	}
@@ -0,0 +1,1218 @@
+/* dhcpload.c
+
+   DHCP and DHCPv6 load generator. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * dhcpload plays a crowd of clients against a server so that the server
+ * can be measured without outside tools.   Each virtual client has a
+ * hardware address (and, for DHCPv6, a DUID-LL) made from its number,
+ * and goes through the four message exchange to get a lease; with -n
+ * every client that got one then does that many two message exchanges
+ * (INIT-REBOOT REQUESTs for DHCPv4, RENEWs for DHCPv6).   Exchanges are
+ * started at a fixed rate, and the replies, refusals, losses and the
+ * latency of each stage are reported at the end.
+ *
+ * Clients are either broadcast on an interface (-i), which needs the
+ * server on the other end of a link such as a veth pair, or relayed to
+ * a server address (-s) with giaddr or a Relay-Forw, which also works
+ * over the loopback.   With -p the relay uses a port of its own and asks
+ * the server to answer there with the relay-port sub-option or the
+ * relay-source-port option, so that it can share a host with the server.
+ *
+ * The messages are built once with the same option code dhclient uses
+ * and only the per client fields are patched in for each send, so the
+ * generator can keep up with a server on a fast machine.
+ */
+
+#include "dhcpd.h"
+#include <sys/time.h>
+#include <poll.h>
+#include <net/if.h>
+
+#define DHCPLOAD_USAGE \
+"Usage: %s [-4|-6] (-i <interface> | -s <server>) [-g <address>]\n" \
+"                [-p <port>] [-c <clients>] [-r <rate>] [-w <window>]\n" \
+"                [-n <rounds>] [-t <timeout>]\n"
+
+/* The stages of an exchange, each of which is timed on its own. */
+enum {
+	STAGE_SELECT,		/* DISCOVER/OFFER or SOLICIT/ADVERTISE */
+	STAGE_REQUEST,		/* REQUEST/ACK or REQUEST/REPLY */
+	STAGE_RENEW,		/* INIT-REBOOT REQUEST/ACK or RENEW/REPLY */
+	STAGE_COUNT
+};
+
+static const char *stage_names[2][STAGE_COUNT] = {
+	{ "DISCOVER/OFFER", "REQUEST/ACK", "REBOOT/ACK" },
+	{ "SOLICIT/ADVERTISE", "REQUEST/REPLY", "RENEW/REPLY" }
+};
+
+/* Latencies are kept in microseconds in a log-linear histogram: exact
+   below 64, then 32 buckets for every power of two, which is good to
+   about 3%. */
+#define HIST_SUB	32
+#define HIST_BUCKETS	(HIST_SUB * 28)
+
+struct stage_stats {
+	unsigned long sent;
+	unsigned long replies;
+	unsigned long refused;		/* NAKs, or no address offered. */
+	unsigned long lost;		/* No reply before the timeout. */
+	u_int64_t first, last;
+	u_int32_t max;
+	u_int32_t hist[HIST_BUCKETS];
+};
+
+static struct stage_stats stats[STAGE_COUNT];
+static unsigned long unexpected;
+
+/* What a virtual client is waiting for. */
+enum {
+	CS_IDLE,
+	CS_SELECTING,
+	CS_REQUESTING,
+	CS_BOUND,
+	CS_RENEWING,
+	CS_FAILED
+};
+
+/* Kept small, as there may be millions of them. */
+struct vclient {
+	u_int64_t sent;			/* When the last message went. */
+	unsigned char addr[16];		/* The address offered or leased. */
+	u_int8_t state;
+	u_int8_t server;		/* Index into server_ids. */
+};
+
+static struct vclient *clients;
+
+/* The servers that have answered, by server identifier.   A client
+   keeps the index of the one it is talking to. */
+#define MAX_SERVER_IDS	16
+
+static struct server_id {
+	unsigned len;
+	unsigned char data[128];
+} server_ids[MAX_SERVER_IDS];
+static unsigned server_id_count;
+
+/* Messages waiting for a reply, oldest first.   Every one has the same
+   timeout, so the head is always the next to expire; entries for
+   clients that have since moved on are skipped. */
+struct waiting {
+	u_int32_t client;
+	u_int64_t sent;
+};
+
+static struct waiting *wait_ring;
+static unsigned wait_size, wait_head, wait_tail;
+static unsigned outstanding;
+
+/* A prebuilt message, with the offsets of the fields that differ from
+   client to client or -1 when it has no such field. */
+struct template {
+	union {
+		struct dhcp_packet raw;
+		unsigned char buf[1024];
+	} msg;
+	unsigned len;
+	int id_off;			/* Client identifier or DUID data. */
+	int addr_off;			/* Requested address or IAADDR. */
+	int sid_off;			/* DHCPv4 server identifier data. */
+	int ia_off;			/* DHCPv6 IA_NA data. */
+};
+
+static struct template templates[STAGE_COUNT];
+
+static int relaying;
+static const char *ifname;
+static int sock = -1;
+static union {
+	struct sockaddr sa;
+	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
+} dest;
+static socklen_t dest_len;
+static struct iaddr link_addr;
+static u_int16_t relay_local_port;
+static unsigned client_count = 1000;
+static unsigned rate = 1000;
+static unsigned window;
+static unsigned rounds;
+static u_int64_t timeout_usec = 2000000;
+
+static void usage(const char *sfmt, const char *sarg);
+static u_int64_t now_usec(void);
+static void client_hw(unsigned n, unsigned char *hw);
+static int find_option_offset(const unsigned char *options, unsigned len,
+			      unsigned tag_size, unsigned code,
+			      unsigned *dlen);
+static int intern_server_id(const unsigned char *data, unsigned len);
+static void save_const_option(struct universe *universe,
+			      struct option_state *options, unsigned code,
+			      const unsigned char *data, unsigned len);
+static void build_template4(struct template *t, u_int8_t type,
+			    int reqaddr, int sid);
+static void send4(unsigned n, int stage);
+static void receive4(void);
+#ifdef DHCPv6
+static void append_const_option(struct data_string *ds, unsigned code,
+				const unsigned char *data, unsigned len);
+static void build_template6(struct template *t, u_int8_t type, int addr);
+static void send6(unsigned n, int stage);
+static void receive6(void);
+#endif
+static void open_socket(void);
+static void start_exchange(unsigned n, int stage);
+static void got_reply(unsigned n, int stage, u_int64_t now);
+static void refused(unsigned n, int stage, u_int64_t now);
+static void expire(u_int64_t now);
+static void run_phase(int stage);
+static u_int32_t percentile(struct stage_stats *st, double fraction);
+static void report(void);
+
+static void
+usage(const char *sfmt, const char *sarg) {
+	if (sfmt != NULL)
+		log_error(sfmt, sarg);
+	log_fatal(DHCPLOAD_USAGE, "dhcpload");
+}
+
+int
+main(int argc, char **argv) {
+	const char *server = NULL, *giaddr = NULL;
+	int i, round;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-4")) {
+			local_family = AF_INET;
+		} else if (!strcmp(argv[i], "-6")) {
+#ifdef DHCPv6
+			local_family = AF_INET6;
+#else
+			usage("DHCPv6 support is not compiled in: %s",
+			      argv[i]);
+#endif
+		} else if (!strcmp(argv[i], "-i")) {
+			if (++i == argc)
+				usage("-i requires an interface", NULL);
+			ifname = argv[i];
+		} else if (!strcmp(argv[i], "-s")) {
+			if (++i == argc)
+				usage("-s requires a server address", NULL);
+			server = argv[i];
+		} else if (!strcmp(argv[i], "-g")) {
+			if (++i == argc)
+				usage("-g requires an address", NULL);
+			giaddr = argv[i];
+		} else if (!strcmp(argv[i], "-p")) {
+			if (++i == argc)
+				usage("-p requires a port", NULL);
+			relay_local_port = atoi(argv[i]);
+			if (relay_local_port == 0)
+				usage("bad port: %s", argv[i]);
+		} else if (!strcmp(argv[i], "-c")) {
+			if (++i == argc)
+				usage("-c requires a count", NULL);
+			client_count = atoi(argv[i]);
+			if (client_count == 0)
+				usage("bad client count: %s", argv[i]);
+		} else if (!strcmp(argv[i], "-r")) {
+			if (++i == argc)
+				usage("-r requires a rate", NULL);
+			rate = atoi(argv[i]);
+		} else if (!strcmp(argv[i], "-w")) {
+			if (++i == argc)
+				usage("-w requires a count", NULL);
+			window = atoi(argv[i]);
+		} else if (!strcmp(argv[i], "-n")) {
+			if (++i == argc)
+				usage("-n requires a count", NULL);
+			rounds = atoi(argv[i]);
+		} else if (!strcmp(argv[i], "-t")) {
+			if (++i == argc)
+				usage("-t requires a timeout", NULL);
+			timeout_usec = (u_int64_t)atoi(argv[i]) * 1000;
+			if (timeout_usec == 0)
+				usage("bad timeout: %s", argv[i]);
+		} else {
+			usage("Unknown command: %s", argv[i]);
+		}
+	}
+
+	if ((ifname == NULL) == (server == NULL))
+		usage("Exactly one of -i and -s is required", NULL);
+	if (relay_local_port != 0 && server == NULL)
+		usage("-p is only used with -s", NULL);
+	relaying = server != NULL;
+
+	/* The transaction ID is the client number, and DHCPv6 only has
+	   24 bits of it. */
+	if (local_family == AF_INET6 && client_count > 0xffffff)
+		usage("At most 16777215 DHCPv6 clients: %s", "-c");
+	if (rate == 0 && window == 0)
+		window = 256;
+
+	memset(&dest, 0, sizeof dest);
+	memset(&link_addr, 0, sizeof link_addr);
+	if (local_family == AF_INET) {
+		dest.sin.sin_family = AF_INET;
+		dest.sin.sin_port = htons(67);
+		if (server == NULL)
+			dest.sin.sin_addr.s_addr = INADDR_BROADCAST;
+		else if (inet_pton(AF_INET, server,
+				   &dest.sin.sin_addr) != 1)
+			usage("bad server address: %s", server);
+		dest_len = sizeof dest.sin;
+		link_addr.len = 4;
+	} else {
+		dest.sin6.sin6_family = AF_INET6;
+		dest.sin6.sin6_port = htons(547);
+		if (server == NULL) {
+			inet_pton(AF_INET6, "ff02::1:2", &dest.sin6.sin6_addr);
+			dest.sin6.sin6_scope_id = if_nametoindex(ifname);
+			if (dest.sin6.sin6_scope_id == 0)
+				log_fatal("No such interface: %s", ifname);
+		} else if (inet_pton(AF_INET6, server,
+				     &dest.sin6.sin6_addr) != 1)
+			usage("bad server address: %s", server);
+		dest_len = sizeof dest.sin6;
+		link_addr.len = 16;
+	}
+
+	/* The relay address defaults to the one we'd reach the server
+	   from. */
+	if (giaddr != NULL) {
+		if (inet_pton(local_family, giaddr, link_addr.iabuf) != 1)
+			usage("bad address: %s", giaddr);
+	} else if (relaying) {
+		union {
+			struct sockaddr sa;
+			struct sockaddr_in sin;
+			struct sockaddr_in6 sin6;
+		} local;
+		socklen_t len = sizeof local;
+		int fd;
+
+		fd = socket(local_family, SOCK_DGRAM, IPPROTO_UDP);
+		if (fd < 0 || connect(fd, &dest.sa, dest_len) < 0 ||
+		    getsockname(fd, &local.sa, &len) < 0)
+			log_fatal("Can't find an address to reach %s: %m",
+				  server);
+		close(fd);
+		if (local_family == AF_INET)
+			memcpy(link_addr.iabuf, &local.sin.sin_addr, 4);
+		else
+			memcpy(link_addr.iabuf, &local.sin6.sin6_addr, 16);
+	}
+
+	/* Set up the option universes and build the messages. */
+	initialize_common_option_spaces();
+	if (local_family == AF_INET) {
+		build_template4(&templates[STAGE_SELECT], DHCPDISCOVER, 0, 0);
+		build_template4(&templates[STAGE_REQUEST], DHCPREQUEST, 1, 1);
+		build_template4(&templates[STAGE_RENEW], DHCPREQUEST, 1, 0);
+#ifdef DHCPv6
+	} else {
+		build_template6(&templates[STAGE_SELECT], DHCPV6_SOLICIT, 0);
+		build_template6(&templates[STAGE_REQUEST], DHCPV6_REQUEST, 1);
+		build_template6(&templates[STAGE_RENEW], DHCPV6_RENEW, 1);
+#endif
+	}
+
+	clients = dmalloc(client_count * sizeof *clients, MDL);
+	wait_size = 2 * client_count + 1;
+	wait_ring = dmalloc(wait_size * sizeof *wait_ring, MDL);
+	if (clients == NULL || wait_ring == NULL)
+		log_fatal("No memory for %u clients.", client_count);
+
+	open_socket();
+
+	run_phase(STAGE_SELECT);
+	for (round = 0; round < rounds; round++)
+		run_phase(STAGE_RENEW);
+
+	printf("%u clients, %s %s, %u %s, ", client_count,
+	       relaying ? "relayed to" : "on", relaying ? server : ifname,
+	       rounds, rounds == 1 ? "round" : "rounds");
+	if (rate != 0)
+		printf("target rate %u/s\n", rate);
+	else
+		printf("%u at a time\n", window);
+	report();
+	close(sock);
+	return (0);
+}
+
+static u_int64_t
+now_usec(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((u_int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* A locally administered hardware address made from the client
+   number. */
+static void
+client_hw(unsigned n, unsigned char *hw) {
+	hw[0] = 0x02;
+	hw[1] = 0x00;
+	putULong(hw + 2, n);
+}
+
+/*
+ * Returns the offset of the data of the first option with the given code
+ * in a run of options with 1 or 2 byte tags and lengths, and its length
+ * in *dlen, or -1 if there isn't one.   DHCPv4 pad and end are handled.
+ */
+static int
+find_option_offset(const unsigned char *options, unsigned len,
+		   unsigned tag_size, unsigned code, unsigned *dlen) {
+	unsigned i = 0, tag, olen;
+
+	while (i < len) {
+		if (tag_size == 1) {
+			tag = options[i];
+			if (tag == DHO_PAD) {
+				i++;
+				continue;
+			}
+			if (tag == DHO_END || i + 2 > len)
+				break;
+			olen = options[i + 1];
+			i += 2;
+		} else {
+			if (i + 4 > len)
+				break;
+			tag = getUShort(options + i);
+			olen = getUShort(options + i + 2);
+			i += 4;
+		}
+		if (i + olen > len)
+			break;
+		if (tag == code) {
+			*dlen = olen;
+			return (i);
+		}
+		i += olen;
+	}
+	return (-1);
+}
+
+/* Returns the index for a server identifier, or -1 if there are too
+   many servers answering. */
+static int
+intern_server_id(const unsigned char *data, unsigned len) {
+	unsigned i;
+
+	if (len > sizeof server_ids[0].data)
+		return (-1);
+	for (i = 0; i < server_id_count; i++)
+		if (server_ids[i].len == len &&
+		    !memcmp(server_ids[i].data, data, len))
+			return (i);
+	if (server_id_count == MAX_SERVER_IDS)
+		return (-1);
+	server_ids[i].len = len;
+	memcpy(server_ids[i].data, data, len);
+	return (server_id_count++);
+}
+
+static void
+save_const_option(struct universe *universe, struct option_state *options,
+		  unsigned code, const unsigned char *data, unsigned len) {
+	struct option *option = NULL;
+	struct option_cache *oc = NULL;
+
+	if (!(option_code_hash_lookup(&option, universe->code_hash, &code,
+				      0, MDL) &&
+	      make_const_option_cache(&oc, NULL, (u_int8_t *)data, len,
+				      option, MDL)))
+		log_fatal("Can't make option %u.", code);
+	save_option(universe, options, oc);
+	option_cache_dereference(&oc, MDL);
+	option_dereference(&option, MDL);
+}
+
+/*
+ * Builds a DHCPv4 message the way make_client_options() and
+ * make_discover() do, with space for a client identifier and, if asked,
+ * a requested address and server identifier to be filled in later.
+ */
+static void
+build_template4(struct template *t, u_int8_t type, int reqaddr, int sid) {
+	static const unsigned char prl[] = {
+		DHO_SUBNET_MASK, DHO_ROUTERS, DHO_DOMAIN_NAME_SERVERS,
+		DHO_DOMAIN_NAME
+	};
+	struct option_state *options = NULL;
+	struct client_state client;
+	unsigned char id[7], zero[4];
+	unsigned dlen, olen;
+	int end;
+
+	option_state_allocate(&options, MDL);
+	save_const_option(&dhcp_universe, options, DHO_DHCP_MESSAGE_TYPE,
+			  &type, 1);
+	memset(id, 0, sizeof id);
+	id[0] = HTYPE_ETHER;
+	save_const_option(&dhcp_universe, options,
+			  DHO_DHCP_CLIENT_IDENTIFIER, id, sizeof id);
+	memset(zero, 0, sizeof zero);
+	if (reqaddr)
+		save_const_option(&dhcp_universe, options,
+				  DHO_DHCP_REQUESTED_ADDRESS, zero, 4);
+	if (sid)
+		save_const_option(&dhcp_universe, options,
+				  DHO_DHCP_SERVER_IDENTIFIER, zero, 4);
+	save_const_option(&dhcp_universe, options,
+			  DHO_DHCP_PARAMETER_REQUEST_LIST, prl, sizeof prl);
+
+	/* Without a client state cons_options() would take this for a
+	   server reply and look for relay agent options to echo. */
+	memset(&client, 0, sizeof client);
+	memset(&t->msg, 0, sizeof t->msg);
+	t->len = cons_options(NULL, &t->msg.raw, NULL, &client, 1500, NULL,
+			      options, &global_scope, 0, 0, 0, NULL, NULL);
+	option_state_dereference(&options, MDL);
+
+	/* Ask the server to answer the relay's own port. */
+	olen = t->len - DHCP_FIXED_NON_UDP;
+	if (relay_local_port != 0) {
+		end = 4;
+		while (end < olen && t->msg.raw.options[end] != DHO_END)
+			end += t->msg.raw.options[end] == DHO_PAD ? 1 :
+			       2 + t->msg.raw.options[end + 1];
+		if (end + 5 > DHCP_MAX_OPTION_LEN)
+			log_fatal("No room for the relay-port sub-option.");
+		t->msg.raw.options[end++] = DHO_DHCP_AGENT_OPTIONS;
+		t->msg.raw.options[end++] = 2;
+		t->msg.raw.options[end++] = RAI_RELAY_PORT;
+		t->msg.raw.options[end++] = 0;
+		t->msg.raw.options[end++] = DHO_END;
+		olen = end;
+		t->len = DHCP_FIXED_NON_UDP + olen;
+	}
+	if (t->len < BOOTP_MIN_LEN)
+		t->len = BOOTP_MIN_LEN;
+
+	t->msg.raw.op = BOOTREQUEST;
+	t->msg.raw.htype = HTYPE_ETHER;
+	t->msg.raw.hlen = 6;
+	if (relaying) {
+		t->msg.raw.hops = 1;
+		memcpy(&t->msg.raw.giaddr, link_addr.iabuf, 4);
+	} else {
+		/* We can't take unicasts to addresses we don't have. */
+		t->msg.raw.flags = htons(BOOTP_BROADCAST);
+	}
+
+	/* Skip the cookie when looking for the fields. */
+	t->id_off = find_option_offset(t->msg.raw.options + 4, olen - 4, 1,
+				       DHO_DHCP_CLIENT_IDENTIFIER, &dlen) + 4;
+	t->addr_off = -1;
+	t->sid_off = -1;
+	t->ia_off = -1;
+	if (reqaddr)
+		t->addr_off = find_option_offset(t->msg.raw.options + 4,
+						 olen - 4, 1,
+						 DHO_DHCP_REQUESTED_ADDRESS,
+						 &dlen) + 4;
+	if (sid)
+		t->sid_off = find_option_offset(t->msg.raw.options + 4,
+						olen - 4, 1,
+						DHO_DHCP_SERVER_IDENTIFIER,
+						&dlen) + 4;
+	if (t->id_off < 4 || (reqaddr && t->addr_off < 4) ||
+	    (sid && t->sid_off < 4))
+		log_fatal("Can't find the client fields in a message.");
+}
+
+static void
+send4(unsigned n, int stage) {
+	struct template *t = &templates[stage];
+	struct vclient *c = &clients[n];
+	struct dhcp_packet raw;
+
+	memcpy(&raw, &t->msg.raw, t->len);
+	raw.xid = htonl(n);
+	client_hw(n, raw.chaddr);
+	client_hw(n, raw.options + t->id_off + 1);
+	if (t->addr_off >= 0)
+		memcpy(raw.options + t->addr_off, c->addr, 4);
+	if (t->sid_off >= 0)
+		memcpy(raw.options + t->sid_off,
+		       server_ids[c->server].data, 4);
+	if (sendto(sock, &raw, t->len, 0, &dest.sa, dest_len) < 0 &&
+	    errno != EAGAIN && errno != ENOBUFS)
+		log_error("sendto: %m");
+}
+
+static void
+receive4(void) {
+	struct dhcp_packet raw;
+	struct vclient *c;
+	unsigned char hw[6];
+	unsigned n, dlen, olen;
+	u_int64_t now;
+	ssize_t len;
+	int off, type, sid;
+
+	for (;;) {
+		len = recv(sock, &raw, sizeof raw, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				log_error("recv: %m");
+			return;
+		}
+		now = now_usec();
+		if (len < DHCP_FIXED_NON_UDP + 4 || raw.op != BOOTREPLY ||
+		    memcmp(raw.options, DHCP_OPTIONS_COOKIE, 4))
+			continue;
+		n = ntohl(raw.xid);
+		client_hw(n, hw);
+		if (n >= client_count || memcmp(raw.chaddr, hw, 6)) {
+			unexpected++;
+			continue;
+		}
+		c = &clients[n];
+
+		olen = len - DHCP_FIXED_NON_UDP - 4;
+		off = find_option_offset(raw.options + 4, olen, 1,
+					 DHO_DHCP_MESSAGE_TYPE, &dlen);
+		type = off >= 0 && dlen == 1 ? raw.options[4 + off] : 0;
+
+		if (c->state == CS_SELECTING && type == DHCPOFFER) {
+			off = find_option_offset(raw.options + 4, olen, 1,
+						 DHO_DHCP_SERVER_IDENTIFIER,
+						 &dlen);
+			sid = off >= 0 && dlen == 4 ?
+			      intern_server_id(raw.options + 4 + off, 4) : -1;
+			if (sid < 0) {
+				unexpected++;
+				continue;
+			}
+			got_reply(n, STAGE_SELECT, now);
+			memcpy(c->addr, &raw.yiaddr, 4);
+			c->server = sid;
+			start_exchange(n, STAGE_REQUEST);
+		} else if (c->state == CS_REQUESTING && type == DHCPACK) {
+			got_reply(n, STAGE_REQUEST, now);
+			c->state = CS_BOUND;
+		} else if (c->state == CS_RENEWING && type == DHCPACK) {
+			got_reply(n, STAGE_RENEW, now);
+			c->state = CS_BOUND;
+		} else if (c->state == CS_REQUESTING && type == DHCPNAK) {
+			refused(n, STAGE_REQUEST, now);
+		} else if (c->state == CS_RENEWING && type == DHCPNAK) {
+			refused(n, STAGE_RENEW, now);
+		} else {
+			unexpected++;
+		}
+	}
+}
+
+#ifdef DHCPv6
+static void
+append_const_option(struct data_string *ds, unsigned code,
+		    const unsigned char *data, unsigned len) {
+	struct option *option = NULL;
+	struct data_string src;
+
+	memset(&src, 0, sizeof src);
+	src.data = data;
+	src.len = len;
+	if (!option_code_hash_lookup(&option, dhcpv6_universe.code_hash,
+				     &code, 0, MDL) ||
+	    !append_option(ds, &dhcpv6_universe, option, &src))
+		log_fatal("Can't make option %u.", code);
+	option_dereference(&option, MDL);
+}
+
+/*
+ * Builds a DHCPv6 message as dhc6.c does, with a DUID-LL, elapsed time,
+ * option request and one IA_NA, holding an address to be filled in if
+ * asked.   The server identifier goes on the end when it's sent.
+ */
+static void
+build_template6(struct template *t, u_int8_t type, int addr) {
+	static const unsigned char oro[] = {
+		0, D6O_NAME_SERVERS, 0, D6O_DOMAIN_SEARCH
+	};
+	struct data_string ds, iaaddr;
+	unsigned char duid[10], zero[24], ia[12 + 4 + 24];
+	unsigned dlen;
+
+	memset(&ds, 0, sizeof ds);
+	memset(&iaaddr, 0, sizeof iaaddr);
+	memset(zero, 0, sizeof zero);
+
+	memset(duid, 0, sizeof duid);
+	putUShort(duid, DUID_LL);
+	putUShort(duid + 2, HTYPE_ETHER);
+	append_const_option(&ds, D6O_CLIENTID, duid, sizeof duid);
+	append_const_option(&ds, D6O_ELAPSED_TIME, zero, 2);
+	append_const_option(&ds, D6O_ORO, oro, sizeof oro);
+
+	/* The IA_NA's IAID and times, then the IAADDR if there is one. */
+	memset(ia, 0, sizeof ia);
+	if (addr) {
+		append_const_option(&iaaddr, D6O_IAADDR, zero, 24);
+		memcpy(ia + 12, iaaddr.data, iaaddr.len);
+		data_string_forget(&iaaddr, MDL);
+	}
+	append_const_option(&ds, D6O_IA_NA, ia, addr ? sizeof ia : 12);
+	if (ds.len + 4 > sizeof t->msg.buf)
+		log_fatal("DHCPv6 message too big.");
+
+	memset(&t->msg, 0, sizeof t->msg);
+	t->msg.buf[0] = type;
+	memcpy(t->msg.buf + 4, ds.data, ds.len);
+	t->len = 4 + ds.len;
+	data_string_forget(&ds, MDL);
+
+	t->id_off = find_option_offset(t->msg.buf + 4, t->len - 4, 2,
+				       D6O_CLIENTID, &dlen) + 4;
+	t->ia_off = find_option_offset(t->msg.buf + 4, t->len - 4, 2,
+				       D6O_IA_NA, &dlen) + 4;
+	t->addr_off = addr ? t->ia_off + 12 + 4 : -1;
+	t->sid_off = -1;
+	if (t->id_off < 4 || t->ia_off < 4)
+		log_fatal("Can't find the client fields in a message.");
+}
+
+static void
+send6(unsigned n, int stage) {
+	struct template *t = &templates[stage];
+	struct vclient *c = &clients[n];
+	struct server_id *sid;
+	unsigned char msg[sizeof t->msg.buf + 4 + sizeof sid->data];
+	unsigned char relay[34 + 6 + 4];
+	unsigned char hw[6];
+	struct iovec iov[2];
+	struct msghdr mh;
+	unsigned len, rlen;
+
+	memcpy(msg, t->msg.buf, t->len);
+	len = t->len;
+	msg[1] = n >> 16;
+	msg[2] = n >> 8;
+	msg[3] = n;
+	client_hw(n, msg + t->id_off + 4);
+	putULong(msg + t->ia_off, n);
+	if (t->addr_off >= 0)
+		memcpy(msg + t->addr_off, c->addr, 16);
+	if (stage != STAGE_SELECT) {
+		sid = &server_ids[c->server];
+		putUShort(msg + len, D6O_SERVERID);
+		putUShort(msg + len + 2, sid->len);
+		memcpy(msg + len + 4, sid->data, sid->len);
+		len += 4 + sid->len;
+	}
+
+	memset(&mh, 0, sizeof mh);
+	mh.msg_name = &dest.sa;
+	mh.msg_namelen = dest_len;
+	mh.msg_iov = iov;
+	iov[0].iov_base = msg;
+	iov[0].iov_len = len;
+	mh.msg_iovlen = 1;
+
+	/* Wrap it in a Relay-Forw from a link-local peer address made
+	   from the hardware address. */
+	if (relaying) {
+		relay[0] = DHCPV6_RELAY_FORW;
+		relay[1] = 0;
+		memcpy(relay + 2, link_addr.iabuf, 16);
+		memset(relay + 18, 0, 16);
+		relay[18] = 0xfe;
+		relay[19] = 0x80;
+		client_hw(n, hw);
+		relay[26] = hw[0] ^ 0x02;
+		relay[27] = hw[1];
+		relay[28] = hw[2];
+		relay[29] = 0xff;
+		relay[30] = 0xfe;
+		memcpy(relay + 31, hw + 3, 3);
+		rlen = 34;
+		if (relay_local_port != 0) {
+			putUShort(relay + rlen, D6O_RELAY_SOURCE_PORT);
+			putUShort(relay + rlen + 2, 2);
+			putUShort(relay + rlen + 4, 0);
+			rlen += 6;
+		}
+		putUShort(relay + rlen, D6O_RELAY_MSG);
+		putUShort(relay + rlen + 2, len);
+		rlen += 4;
+		iov[1] = iov[0];
+		iov[0].iov_base = relay;
+		iov[0].iov_len = rlen;
+		mh.msg_iovlen = 2;
+	}
+
+	if (sendmsg(sock, &mh, 0) < 0 && errno != EAGAIN && errno != ENOBUFS)
+		log_error("sendmsg: %m");
+}
+
+static void
+receive6(void) {
+	unsigned char buf[4096], hw[6];
+	const unsigned char *msg, *ia;
+	struct vclient *c;
+	unsigned n, dlen, len, ialen, status;
+	u_int64_t now;
+	ssize_t result;
+	int off, sid, type, addr;
+
+	for (;;) {
+		result = recv(sock, buf, sizeof buf, MSG_DONTWAIT);
+		if (result < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				log_error("recv: %m");
+			return;
+		}
+		now = now_usec();
+		msg = buf;
+		len = result;
+		if (relaying) {
+			if (len < 34 || buf[0] != DHCPV6_RELAY_REPL)
+				continue;
+			off = find_option_offset(buf + 34, len - 34, 2,
+						 D6O_RELAY_MSG, &dlen);
+			if (off < 0)
+				continue;
+			msg = buf + 34 + off;
+			len = dlen;
+		}
+		if (len < 4)
+			continue;
+		type = msg[0];
+		n = msg[1] << 16 | msg[2] << 8 | msg[3];
+
+		/* It must be for one of ours. */
+		client_hw(n, hw);
+		off = find_option_offset(msg + 4, len - 4, 2, D6O_CLIENTID,
+					 &dlen);
+		if (n >= client_count || off < 0 || dlen != 10 ||
+		    memcmp(msg + 4 + off + 4, hw, 6)) {
+			unexpected++;
+			continue;
+		}
+		c = &clients[n];
+
+		/* Refusals come as a status code, either for the whole
+		   message or in the IA_NA. */
+		status = STATUS_Success;
+		off = find_option_offset(msg + 4, len - 4, 2, D6O_STATUS_CODE,
+					 &dlen);
+		if (off >= 0 && dlen >= 2)
+			status = getUShort(msg + 4 + off);
+		addr = -1;
+		off = find_option_offset(msg + 4, len - 4, 2, D6O_IA_NA,
+					 &ialen);
+		if (off >= 0 && ialen >= 12) {
+			ia = msg + 4 + off + 12;
+			ialen -= 12;
+			off = find_option_offset(ia, ialen, 2,
+						 D6O_STATUS_CODE, &dlen);
+			if (off >= 0 && dlen >= 2 &&
+			    status == STATUS_Success)
+				status = getUShort(ia + off);
+			off = find_option_offset(ia, ialen, 2, D6O_IAADDR,
+						 &dlen);
+			if (off >= 0 && dlen >= 24)
+				addr = ia + off - msg;
+		}
+		if (addr < 0 && status == STATUS_Success)
+			status = STATUS_NoAddrsAvail;
+
+		if (c->state == CS_SELECTING && type == DHCPV6_ADVERTISE) {
+			if (status != STATUS_Success) {
+				refused(n, STAGE_SELECT, now);
+				continue;
+			}
+			off = find_option_offset(msg + 4, len - 4, 2,
+						 D6O_SERVERID, &dlen);
+			sid = off >= 0 ?
+			      intern_server_id(msg + 4 + off, dlen) : -1;
+			if (sid < 0) {
+				unexpected++;
+				continue;
+			}
+			got_reply(n, STAGE_SELECT, now);
+			memcpy(c->addr, msg + addr, 16);
+			c->server = sid;
+			start_exchange(n, STAGE_REQUEST);
+		} else if ((c->state == CS_REQUESTING ||
+			    c->state == CS_RENEWING) &&
+			   type == DHCPV6_REPLY) {
+			if (status != STATUS_Success) {
+				refused(n, c->state == CS_REQUESTING ?
+					   STAGE_REQUEST : STAGE_RENEW, now);
+				continue;
+			}
+			got_reply(n, c->state == CS_REQUESTING ?
+				     STAGE_REQUEST : STAGE_RENEW, now);
+			c->state = CS_BOUND;
+		} else {
+			unexpected++;
+		}
+	}
+}
+#endif /* DHCPv6 */
+
+/*
+ * All the clients share one socket: bound to the client port on the
+ * interface, or as a relay to the server port or the one given with -p.
+ */
+static void
+open_socket(void) {
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} local;
+	socklen_t len;
+	int flag = 1, size = 4 * 1024 * 1024;
+
+	sock = socket(local_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0)
+		log_fatal("Can't create socket: %m");
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag,
+		       sizeof flag) < 0)
+		log_fatal("Can't set SO_REUSEADDR option on socket: %m");
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof size) < 0 ||
+	    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof size) < 0)
+		log_error("Can't size the socket buffers: %m");
+
+	memset(&local, 0, sizeof local);
+	if (local_family == AF_INET) {
+		local.sin.sin_family = AF_INET;
+		if (relaying) {
+			local.sin.sin_port = htons(relay_local_port ? relay_local_port :
+						   67);
+			memcpy(&local.sin.sin_addr, link_addr.iabuf, 4);
+		} else
+			local.sin.sin_port = htons(68);
+		len = sizeof local.sin;
+	} else {
+		local.sin6.sin6_family = AF_INET6;
+		local.sin6.sin6_port = htons(relaying ?
+					     (relay_local_port ? relay_local_port : 547) :
+					     546);
+		len = sizeof local.sin6;
+	}
+
+	if (ifname != NULL) {
+		if (local_family == AF_INET &&
+		    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &flag,
+			       sizeof flag) < 0)
+			log_fatal("Can't set SO_BROADCAST option on "
+				  "socket: %m");
+#if defined(SO_BINDTODEVICE)
+		if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, ifname,
+			       strlen(ifname) + 1) < 0)
+			log_fatal("Can't bind to %s: %m", ifname);
+#endif
+	}
+
+	if (bind(sock, &local.sa, len) < 0)
+		log_fatal("Can't bind to dhcp address: %m");
+}
+
+/* Sends the first message of a stage and waits for its reply. */
+static void
+start_exchange(unsigned n, int stage) {
+	struct vclient *c = &clients[n];
+	struct waiting *w;
+	u_int64_t now;
+
+	/* Timed from before the send, as on the loopback the reply can
+	   be back before sendto() returns. */
+	now = now_usec();
+	if (local_family == AF_INET)
+		send4(n, stage);
+#ifdef DHCPv6
+	else
+		send6(n, stage);
+#endif
+	c->sent = now;
+	c->state = stage == STAGE_SELECT ? CS_SELECTING :
+		   stage == STAGE_REQUEST ? CS_REQUESTING : CS_RENEWING;
+	if (stats[stage].sent++ == 0)
+		stats[stage].first = now;
+
+	w = &wait_ring[wait_tail];
+	w->client = n;
+	w->sent = now;
+	wait_tail = (wait_tail + 1) % wait_size;
+	outstanding++;
+}
+
+static unsigned
+hist_bucket(u_int32_t usec) {
+	unsigned shift = 0;
+
+	while ((usec >> shift) >= 2 * HIST_SUB)
+		shift++;
+	return (shift * HIST_SUB + (usec >> shift));
+}
+
+/* The largest latency that falls in a bucket. */
+static u_int32_t
+hist_value(unsigned bucket) {
+	unsigned shift;
+
+	if (bucket < 2 * HIST_SUB)
+		return (bucket);
+	shift = bucket / HIST_SUB - 1;
+	return (((bucket - shift * HIST_SUB + 1) << shift) - 1);
+}
+
+static void
+got_reply(unsigned n, int stage, u_int64_t now) {
+	struct stage_stats *st = &stats[stage];
+	u_int64_t latency = now - clients[n].sent;
+
+	if (latency > 0xffffffffU)
+		latency = 0xffffffffU;
+	st->replies++;
+	st->hist[hist_bucket(latency)]++;
+	if (latency > st->max)
+		st->max = latency;
+	st->last = now;
+	outstanding--;
+}
+
+static void
+refused(unsigned n, int stage, u_int64_t now) {
+	stats[stage].refused++;
+	stats[stage].last = now;
+	clients[n].state = CS_FAILED;
+	outstanding--;
+}
+
+/* Gives up on messages that have waited too long.   A client that
+   loses a renewal still has its lease and will try the next round. */
+static void
+expire(u_int64_t now) {
+	struct waiting *w;
+	struct vclient *c;
+	int stage;
+
+	while (wait_head != wait_tail) {
+		w = &wait_ring[wait_head];
+		if (w->sent + timeout_usec > now)
+			break;
+		wait_head = (wait_head + 1) % wait_size;
+		c = &clients[w->client];
+		if (c->sent != w->sent)
+			continue;
+		switch (c->state) {
+		      case CS_SELECTING:
+			stage = STAGE_SELECT;
+			c->state = CS_FAILED;
+			break;
+		      case CS_REQUESTING:
+			stage = STAGE_REQUEST;
+			c->state = CS_FAILED;
+			break;
+		      case CS_RENEWING:
+			stage = STAGE_RENEW;
+			c->state = CS_BOUND;
+			break;
+		      default:
+			continue;
+		}
+		stats[stage].lost++;
+		stats[stage].last = now;
+		outstanding--;
+	}
+}
+
+/*
+ * Starts an exchange for every client that can have one, at the target
+ * rate and with no more than the window outstanding, and waits until all
+ * of them have finished one way or the other.
+ */
+static void
+run_phase(int stage) {
+	struct pollfd pfd;
+	u_int64_t start, now, next;
+	unsigned next_client = 0, burst;
+	int wait;
+
+	wait_head = wait_tail = 0;
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	start = now_usec();
+
+	while (next_client < client_count || outstanding > 0) {
+		now = now_usec();
+		for (burst = 0; next_client < client_count && burst < 256;
+		     burst++) {
+			if (rate != 0 &&
+			    (now - start) * rate < (u_int64_t)next_client *
+						   1000000)
+				break;
+			if (window != 0 && outstanding >= window)
+				break;
+			if (stage == STAGE_SELECT ||
+			    clients[next_client].state == CS_BOUND)
+				start_exchange(next_client, stage);
+			next_client++;
+		}
+
+		if (local_family == AF_INET)
+			receive4();
+#ifdef DHCPv6
+		else
+			receive6();
+#endif
+		expire(now);
+
+		/* Sleep until the next send is due, something expires or
+		   a reply comes in. */
+		if (next_client == client_count && outstanding == 0)
+			break;
+		wait = 100;
+		if (next_client < client_count &&
+		    (window == 0 || outstanding < window)) {
+			next = start + (rate != 0 ? (u_int64_t)next_client *
+						    1000000 / rate : 0);
+			wait = next > now ? (next - now) / 1000 : 0;
+		}
+		if (wait_head != wait_tail) {
+			next = wait_ring[wait_head].sent + timeout_usec;
+			if (next <= now)
+				wait = 0;
+			else if ((next - now) / 1000 + 1 < wait)
+				wait = (next - now) / 1000 + 1;
+		}
+		if (wait > 0 && poll(&pfd, 1, wait) < 0 && errno != EINTR)
+			log_fatal("poll: %m");
+	}
+}
+
+/* The latency below which the given fraction of the replies came. */
+static u_int32_t
+percentile(struct stage_stats *st, double fraction) {
+	unsigned long count = 0, target;
+	unsigned i;
+
+	target = st->replies * fraction;
+	if (target < 1)
+		target = 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		count += st->hist[i];
+		if (count >= target)
+			return (hist_value(i) < st->max ?
+				hist_value(i) : st->max);
+	}
+	return (st->max);
+}
+
+static void
+report(void) {
+	struct stage_stats *st;
+	double secs;
+	int i;
+
+	printf("%-18s %9s %9s %8s %8s %9s %8s %8s %8s %8s\n", "stage",
+	       "sent", "replies", "refused", "lost", "rate/s",
+	       "p50 ms", "p90 ms", "p99 ms", "max ms");
+	for (i = 0; i < STAGE_COUNT; i++) {
+		st = &stats[i];
+		if (st->sent == 0)
+			continue;
+		secs = (st->last - st->first) / 1000000.0;
+		printf("%-18s %9lu %9lu %8lu %8lu %9.0f %8.3f %8.3f %8.3f "
+		       "%8.3f\n", stage_names[local_family == AF_INET6][i],
+		       st->sent, st->replies, st->refused, st->lost,
+		       secs > 0 ? st->replies / secs : 0.0,
+		       percentile(st, 0.50) / 1000.0,
+		       percentile(st, 0.90) / 1000.0,
+		       percentile(st, 0.99) / 1000.0, st->max / 1000.0);
+	}
+	if (unexpected != 0)
+		printf("%lu unexpected replies ignored\n", unexpected);
+}
+
+/* Stub routines needed for linking with DHCP libraries. */
+void
+bootp(struct packet *packet) {
+	return;
+}
+
+void
+dhcp(struct packet *packet) {
+	return;
+}
+
+#ifdef DHCPv6
+void
+dhcpv6(struct packet *packet) {
+	return;
+}
+
+#ifdef DHCP4o6
+isc_result_t
+dhcpv4o6_handler(omapi_object_t *h) {
+	return ISC_R_NOTIMPLEMENTED;
+}
+#endif
+#endif /* DHCPv6 */
+
+void
+classify(struct packet *p, struct class *c) {
+	return;
+}
+
+int
+check_collection(struct packet *p, struct lease *l, struct collection *c) {
+	return 0;
+}
+
+isc_result_t
+find_class(struct class **class, const char *c1, const char *c2, int i) {
+	return ISC_R_NOTFOUND;
+}
+
+int
+parse_allow_deny(struct option_cache **oc, struct parse *p, int i) {
+	return 0;
+}
+
+isc_result_t
+dhcp_set_control_state(control_object_state_t oldstate,
+		       control_object_state_t newstate) {
+	if (newstate == server_shutdown)
+		exit(0);
+	return ISC_R_SUCCESS;
+}
@@ -944,6 +944,9 @@ int option_state_dereference (ptr, file, line)
 #endif
 	}
 
+	if (options -> pending)
+		free_option_index (&options -> pending);
+
 	/* Loop through the per-universe state. */
 	for (i = 0; i < options -> universe_count; i++)
 		if (options -> universes [i] &&
@@ -409,7 +409,7 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	struct iovec iov [3];
 	int result;
 
-	if (!strcmp (interface -> name, "fallback"))
+	if (interface -> flags & INTERFACE_FALLBACK)
 		return send_fallback (interface, packet, raw,
 				      len, from, to, hto);
 
@@ -32,11 +32,25 @@
 static int get_char (struct parse *);
 static void unget_char(struct parse *, int);
 static void skip_to_eol (struct parse *);
+static void skip_whitespace (struct parse *);
 static enum dhcp_token read_whitespace(int c, struct parse *cfile);
 static enum dhcp_token read_string (struct parse *);
 static enum dhcp_token read_number (int, struct parse *);
 static enum dhcp_token read_num_or_name (int, struct parse *);
-static enum dhcp_token intern (char *, enum dhcp_token);
+static enum dhcp_token intern (char *, unsigned, enum dhcp_token);
+static void lex_init (void);
+
+/* Character classes, so that the scanner looks at a table rather than
+   calling the ctype functions for each character.  Only ASCII characters
+   have classes; EOF and other characters have none. */
+#define LEX_SPACE	1
+#define LEX_DIGIT	2
+#define LEX_XDIGIT	4
+#define LEX_ALPHA	8
+#define LEX_NAME	16	/* can be in a name: alphanumerics, - and _ */
+
+static unsigned char lex_class [128];
+#define LEX_CLASS(c) ((unsigned)(c) < 128 ? lex_class [(c)] : 0)
 
 isc_result_t new_parse (cfile, file, inbuf, buflen, name, eolp)
 	struct parse **cfile;
@@ -49,6 +63,8 @@ isc_result_t new_parse (cfile, file, inbuf, buflen, name, eolp)
 	isc_result_t status = ISC_R_SUCCESS;
 	struct parse *tmp;
 
+	lex_init();
+
 	tmp = dmalloc(sizeof(struct parse), MDL);
 	if (tmp == NULL) {
 		return (ISC_R_NOMEMORY);
@@ -59,11 +75,8 @@ isc_result_t new_parse (cfile, file, inbuf, buflen, name, eolp)
 	 * dmalloc() returns memory that is set to zero.
 	 */
 	tmp->tlname = name;
-	tmp->lpos = tmp -> line = 1;
-	tmp->cur_line = tmp->line1;
-	tmp->prev_line = tmp->line2;
-	tmp->token_line = tmp->cur_line;
-	tmp->cur_line[0] = tmp->prev_line[0] = 0;
+	tmp->line = 1;
+	tmp->token_line = tmp->line1;
 	tmp->file = file;
 	tmp->eol_token = eolp;
 
@@ -198,28 +211,6 @@ static int get_char (cfile)
 		c = cfile->inbuf [cfile->bufix];
 		cfile->bufix++;
 	}
-
-	if (!cfile->ugflag) {
-		if (c == EOL) {
-			if (cfile->cur_line == cfile->line1) {
-				cfile->cur_line = cfile->line2;
-				cfile->prev_line = cfile->line1;
-			} else {
-				cfile->cur_line = cfile->line1;
-				cfile->prev_line = cfile->line2;
-			}
-			cfile->line++;
-			cfile->lpos = 1;
-			cfile->cur_line [0] = 0;
-		} else if (c != EOF) {
-			if (cfile->lpos <= 80) {
-				cfile->cur_line [cfile->lpos - 1] = c;
-				cfile->cur_line [cfile->lpos] = 0;
-			}
-			cfile->lpos++;
-		}
-	} else
-		cfile->ugflag = 0;
 	return c;
 }
 
@@ -228,12 +219,8 @@ static int get_char (cfile)
  */
 static void
 unget_char(struct parse *cfile, int c) {
-	if (c != EOF) {
+	if (c != EOF)
 		cfile->bufix--;
-		cfile->ugflag = 1;	/* do not put characters into
-					   our error buffer on the next
-					   call to get_char() */
-	}
 }
 
 /*
@@ -258,19 +245,21 @@ unget_char(struct parse *cfile, int c) {
  */
 
 static enum dhcp_token
-get_raw_token(struct parse *cfile) {
+get_raw_token(struct parse *cfile, isc_boolean_t raw) {
 	int c;
 	enum dhcp_token ttok;
-	static char tb [2];
-	int l, p;
+	size_t ofs;
 
 	do {
-		l = cfile -> line;
-		p = cfile -> lpos;
+		/* Whitespace the caller doesn't want to see is skipped
+		   without making a token of it. */
+		if (!raw)
+			skip_whitespace (cfile);
 
 		c = get_char (cfile);
+		ofs = cfile -> bufix - 1;
 		if (!((c == '\n') && cfile->eol_token) &&
-		    isascii(c) && isspace(c)) {
+		    (LEX_CLASS (c) & LEX_SPACE)) {
 		    	ttok = read_whitespace(c, cfile);
 			break;
 		}
@@ -279,19 +268,16 @@ get_raw_token(struct parse *cfile) {
 			continue;
 		}
 		if (c == '"') {
-			cfile -> lexline = l;
-			cfile -> lexchar = p;
+			cfile -> lexofs = ofs;
 			ttok = read_string (cfile);
 			break;
 		}
-		if ((isascii (c) && isdigit (c)) || c == '-') {
-			cfile -> lexline = l;
-			cfile -> lexchar = p;
+		if ((LEX_CLASS (c) & LEX_DIGIT) || c == '-') {
+			cfile -> lexofs = ofs;
 			ttok = read_number (c, cfile);
 			break;
-		} else if (isascii (c) && isalpha (c)) {
-			cfile -> lexline = l;
-			cfile -> lexchar = p;
+		} else if (LEX_CLASS (c) & LEX_ALPHA) {
+			cfile -> lexofs = ofs;
 			ttok = read_num_or_name (c, cfile);
 			break;
 		} else if (c == EOF) {
@@ -299,11 +285,10 @@ get_raw_token(struct parse *cfile) {
 			cfile -> tlen = 0;
 			break;
 		} else {
-			cfile -> lexline = l;
-			cfile -> lexchar = p;
-			tb [0] = c;
-			tb [1] = 0;
-			cfile -> tval = tb;
+			cfile -> lexofs = ofs;
+			cfile -> tb [0] = c;
+			cfile -> tb [1] = 0;
+			cfile -> tval = cfile -> tb;
 			cfile -> tlen = 1;
 			ttok = c;
 			break;
@@ -326,22 +311,16 @@ get_next_token(const char **rval, unsigned *rlen,
 	int rv;
 
 	if (cfile -> token) {
-		if (cfile -> lexline != cfile -> tline)
-			cfile -> token_line = cfile -> cur_line;
-		cfile -> lexchar = cfile -> tlpos;
-		cfile -> lexline = cfile -> tline;
+		cfile -> lexofs = cfile -> peekofs;
 		rv = cfile -> token;
 		cfile -> token = 0;
 	} else {
-		rv = get_raw_token(cfile);
-		cfile -> token_line = cfile -> cur_line;
+		rv = get_raw_token(cfile, raw);
 	}
 
 	if (!raw) {
-		while (rv == WHITESPACE) {
-			rv = get_raw_token(cfile);
-			cfile->token_line = cfile->cur_line;
-		}
+		while (rv == WHITESPACE)
+			rv = get_raw_token(cfile, raw);
 	}
 
 	if (rval)
@@ -394,26 +373,19 @@ next_raw_token(const char **rval, unsigned *rlen, struct parse *cfile) {
 enum dhcp_token
 do_peek_token(const char **rval, unsigned int *rlen,
 	      struct parse *cfile, isc_boolean_t raw) {
-	int x;
+	size_t ofs;
 
+	/* The current token is still the last one consumed, so put its
+	   position back after reading ahead. */
 	if (!cfile->token || (!raw && (cfile->token == WHITESPACE))) {
-		cfile -> tlpos = cfile -> lexchar;
-		cfile -> tline = cfile -> lexline;
+		ofs = cfile -> lexofs;
 
 		do {
-			cfile->token = get_raw_token(cfile);
+			cfile->token = get_raw_token(cfile, raw);
 		} while (!raw && (cfile->token == WHITESPACE));
 
-		if (cfile -> lexline != cfile -> tline)
-			cfile -> token_line = cfile -> prev_line;
-
-		x = cfile -> lexchar;
-		cfile -> lexchar = cfile -> tlpos;
-		cfile -> tlpos = x;
-
-		x = cfile -> lexline;
-		cfile -> lexline = cfile -> tline;
-		cfile -> tline = x;
+		cfile -> peekofs = cfile -> lexofs;
+		cfile -> lexofs = ofs;
 	}
 	if (rval)
 		*rval = cfile -> tval;
@@ -458,7 +430,20 @@ peek_raw_token(const char **rval, unsigned *rlen, struct parse *cfile) {
 static void skip_to_eol (cfile)
 	struct parse *cfile;
 {
+	const char *p;
 	int c;
+
+	/* memchr() is usually a lot quicker than going a character at a
+	   time; if the line runs on past the buffer, get_char() fetches
+	   more (with LDAP). */
+	p = memchr (cfile -> inbuf + cfile -> bufix, EOL,
+		    cfile -> buflen - cfile -> bufix);
+	if (p) {
+		cfile -> bufix = p - cfile -> inbuf + 1;
+		return;
+	}
+	cfile -> bufix = cfile -> buflen;
+
 	do {
 		c = get_char (cfile);
 		if (c == EOF)
@@ -469,6 +454,23 @@ static void skip_to_eol (cfile)
 	} while (1);
 }
 
+/*
+ * Skip whitespace in the buffer.  Not being a token, it doesn't need to be
+ * copied anywhere.
+ */
+static void
+skip_whitespace(struct parse *cfile) {
+	int c;
+
+	while (cfile->bufix < cfile->buflen) {
+		c = (unsigned char)cfile->inbuf[cfile->bufix];
+		if (!(LEX_CLASS(c) & LEX_SPACE) ||
+		    ((c == '\n') && cfile->eol_token))
+			break;
+		cfile->bufix++;
+	}
+}
+
 static enum dhcp_token
 read_whitespace(int c, struct parse *cfile) {
 	int ofs;
@@ -493,7 +495,7 @@ read_whitespace(int c, struct parse *cfile) {
 		if (c == EOF)
 			return END_OF_FILE;
 	} while (!((c == '\n') && cfile->eol_token) &&
-		 isascii(c) && isspace(c));
+		 (LEX_CLASS(c) & LEX_SPACE));
 
 	/*
 	 * Put the last (non-whitespace) character back.
@@ -517,6 +519,22 @@ static enum dhcp_token read_string (cfile)
 	int c;
 	int value = 0;
 	int hex = 0;
+	const char *start, *end;
+
+	/* Most strings have no escapes in them and end in the buffer: find
+	   the end with memchr() and copy them in one go. */
+	start = cfile -> inbuf + cfile -> bufix;
+	end = memchr (start, '"', cfile -> buflen - cfile -> bufix);
+	if (end && end - start < sizeof cfile -> tokbuf &&
+	    !memchr (start, '\\', end - start)) {
+		i = end - start;
+		memcpy (cfile -> tokbuf, start, i);
+		cfile -> tokbuf [i] = 0;
+		cfile -> tlen = i;
+		cfile -> tval = cfile -> tokbuf;
+		cfile -> bufix += i + 1;
+		return STRING;
+	}
 
 	for (i = 0; i < sizeof cfile -> tokbuf; i++) {
 	      again:
@@ -699,6 +717,20 @@ static enum dhcp_token read_num_or_name (c, cfile)
 	int i = 0;
 	enum dhcp_token rv = NUMBER_OR_NAME;
 	cfile -> tokbuf [i++] = c;
+
+	/* Go through the buffer directly as far as it goes... */
+	for (; i < sizeof cfile -> tokbuf &&
+	       cfile -> bufix < cfile -> buflen; i++) {
+		c = (unsigned char)cfile -> inbuf [cfile -> bufix];
+		if (!(LEX_CLASS (c) & LEX_NAME))
+			goto done;
+		if (!(LEX_CLASS (c) & LEX_XDIGIT))
+			rv = NAME;
+		cfile -> tokbuf [i] = c;
+		cfile -> bufix++;
+	}
+
+	/* ...and on from there a character at a time. */
 	for (; i < sizeof cfile -> tokbuf; i++) {
 		c = get_char (cfile);
 		if (!isascii (c) ||
@@ -714,858 +746,510 @@ static enum dhcp_token read_num_or_name (c, cfile)
 		parse_warn (cfile, "token larger than internal buffer");
 		--i;
 	}
+      done:
 	cfile -> tokbuf [i] = 0;
 	cfile -> tlen = i;
 	cfile -> tval = cfile -> tokbuf;
-	return intern(cfile->tval, rv);
+	return intern(cfile->tval, cfile->tlen, rv);
 }
 
-static enum dhcp_token
-intern(char *atom, enum dhcp_token dfv) {
-	if (!isascii(atom[0]))
-		return dfv;
+/*
+ * The keywords, each with the token it stands for.  The lexer finds them
+ * in a perfect hash built from this table the first time it's needed
+ * (see lex_init()): each keyword gets a slot of its own, so looking up a
+ * name costs one hash and at most one string comparison.  Keywords are
+ * matched without regard to case.
+ */
+static const struct keyword {
+	const char *name;
+	enum dhcp_token token;
+} keywords [] = {
+	{ "-",                                MINUS },
+	{ "abandoned",                        TOKEN_ABANDONED },
+	{ "active",                           TOKEN_ACTIVE },
+	{ "add",                              TOKEN_ADD },
+	{ "address",                          ADDRESS },
+	{ "after",                            AFTER },
+	{ "algorithm",                        ALGORITHM },
+	{ "alias",                            ALIAS },
+	{ "all",                              ALL },
+	{ "allow",                            ALLOW },
+	{ "also",                             TOKEN_ALSO },
+	{ "and",                              AND },
+	{ "anycast-mac",                      ANYCAST_MAC },
+	{ "append",                           APPEND },
+	{ "array",                            ARRAY },
+	{ "at",                               AT },
+	{ "atsfp",                            ATSFP },
+	{ "authenticated",                    AUTHENTICATED },
+	{ "authentication",                   AUTHENTICATION },
+	{ "authoring-byte-order",             AUTHORING_BYTE_ORDER },
+	{ "authoritative",                    AUTHORITATIVE },
+	{ "auto-partner-down",                AUTO_PARTNER_DOWN },
+	{ "backoff-cutoff",                   BACKOFF_CUTOFF },
+	{ "backup",                           TOKEN_BACKUP },
+	{ "balance",                          BALANCE },
+	{ "big-endian",                       TOKEN_BIG_ENDIAN },
+	{ "billing",                          BILLING },
+	{ "binary-to-ascii",                  BINARY_TO_ASCII },
+	{ "binding",                          BINDING },
+	{ "boolean",                          BOOLEAN },
+	{ "boot-unknown-clients",             BOOT_UNKNOWN_CLIENTS },
+	{ "booting",                          BOOTING },
+	{ "bootp",                            TOKEN_BOOTP },
+	{ "bound",                            BOUND },
+	{ "break",                            BREAK },
+	{ "case",                             CASE },
+	{ "check",                            CHECK },
+	{ "ciaddr",                           CIADDR },
+	{ "class",                            CLASS },
+	{ "client-hostname",                  CLIENT_HOSTNAME },
+	{ "client-identifier",                CLIENT_IDENTIFIER },
+	{ "client-state",                     CLIENT_STATE },
+	{ "client-updates",                   CLIENT_UPDATES },
+	{ "clients",                          CLIENTS },
+	{ "close",                            TOKEN_CLOSE },
+	{ "cltt",                             CLTT },
+	{ "code",                             CODE },
+	{ "commit",                           COMMIT },
+	{ "communications-interrupted",       COMMUNICATIONS_INTERRUPTED },
+	{ "compressed",                       COMPRESSED },
+	{ "concat",                           CONCAT },
+	{ "config-option",                    CONFIG_OPTION },
+	{ "conflict-done",                    CONFLICT_DONE },
+	{ "connect",                          CONNECT },
+	{ "create",                           TOKEN_CREATE },
+	{ "db-time-format",                   DB_TIME_FORMAT },
+	{ "debug",                            TOKEN_DEBUG },
+	{ "declines",                         DECLINES },
+	{ "default",                          DEFAULT },
+	{ "default-duid",                     DEFAULT_DUID },
+	{ "default-lease-time",               DEFAULT_LEASE_TIME },
+	{ "define",                           DEFINE },
+	{ "defined",                          DEFINED },
+	{ "delete",                           TOKEN_DELETE },
+	{ "deleted",                          TOKEN_DELETED },
+	{ "deny",                             DENY },
+	{ "disconnect",                       DISCONNECT },
+	{ "do-forward-update",                DO_FORWARD_UPDATE },
+	{ "do-forward-updates",               DO_FORWARD_UPDATE },
+	{ "domain",                           DOMAIN },
+	{ "domain-list",                      DOMAIN_LIST },
+	{ "domain-name",                      DOMAIN_NAME },
+	{ "duplicates",                       DUPLICATES },
+	{ "dynamic",                          DYNAMIC },
+	{ "dynamic-bootp",                    DYNAMIC_BOOTP },
+	{ "dynamic-bootp-lease-cutoff",       DYNAMIC_BOOTP_LEASE_CUTOFF },
+	{ "dynamic-bootp-lease-length",       DYNAMIC_BOOTP_LEASE_LENGTH },
+	{ "else",                             ELSE },
+	{ "elsif",                            ELSIF },
+	{ "en",                               EN },
+	{ "encapsulate",                      ENCAPSULATE },
+	{ "encode-int",                       ENCODE_INT },
+	{ "ends",                             ENDS },
+	{ "epoch",                            EPOCH },
+	{ "error",                            ERROR },
+	{ "ethernet",                         ETHERNET },
+	{ "eval",                             EVAL },
+	{ "execute",                          EXECUTE },
+	{ "exists",                           EXISTS },
+	{ "expire",                           EXPIRE },
+	{ "expired",                          TOKEN_EXPIRED },
+	{ "expiry",                           EXPIRY },
+	{ "extract-int",                      EXTRACT_INT },
+	{ "failover",                         FAILOVER },
+	{ "fatal",                            FATAL },
+	{ "fddi",                             TOKEN_FDDI },
+	{ "filename",                         FILENAME },
+	{ "fixed-address",                    FIXED_ADDR },
+	{ "fixed-address6",                   FIXED_ADDR6 },
+	{ "fixed-prefix6",                    FIXED_PREFIX6 },
+	{ "formerr",                          NS_FORMERR },
+	{ "free",                             TOKEN_FREE },
+	{ "function",                         FUNCTION },
+	{ "get-lease-hostnames",              GET_LEASE_HOSTNAMES },
+	{ "gethostbyname",                    GETHOSTBYNAME },
+	{ "gethostname",                      GETHOSTNAME },
+	{ "giaddr",                           GIADDR },
+	{ "group",                            GROUP },
+	{ "hardware",                         HARDWARE },
+	{ "hash",                             HASH },
+	{ "hba",                              HBA },
+	{ "help",                             TOKEN_HELP },
+	{ "hex",                              TOKEN_HEX },
+	{ "host",                             HOST },
+	{ "host-decl-name",                   HOST_DECL_NAME },
+	{ "host-identifier",                  HOST_IDENTIFIER },
+	{ "hostname",                         HOSTNAME },
+	{ "ia-na",                            IA_NA },
+	{ "ia-pd",                            IA_PD },
+	{ "ia-ta",                            IA_TA },
+	{ "iaaddr",                           IAADDR },
+	{ "iaprefix",                         IAPREFIX },
+	{ "identifier",                       IDENTIFIER },
+	{ "if",                               IF },
+	{ "ignore",                           IGNORE },
+	{ "include",                          INCLUDE },
+	{ "infiniband",                       TOKEN_INFINIBAND },
+	{ "infinite",                         INFINITE },
+	{ "info",                             INFO },
+	{ "initial-delay",                    INITIAL_DELAY },
+	{ "initial-interval",                 INITIAL_INTERVAL },
+	{ "integer",                          INTEGER },
+	{ "interface",                        INTERFACE },
+	{ "ip-address",                       IP_ADDRESS },
+	{ "ip6-address",                      IP6_ADDRESS },
+	{ "is",                               IS },
+	{ "key",                              KEY },
+	{ "key-algorithm",                    KEY_ALGORITHM },
+	{ "known",                            KNOWN },
+	{ "known-clients",                    KNOWN_CLIENTS },
+	{ "lcase",                            LCASE },
+	{ "lease",                            LEASE },
+	{ "lease-id-format",                  LEASE_ID_FORMAT },
+	{ "lease-time",                       LEASE_TIME },
+	{ "lease6",                           LEASE6 },
+	{ "leased-address",                   LEASED_ADDRESS },
+	{ "leasequery",                       LEASEQUERY },
+	{ "length",                           LENGTH },
+	{ "let",                              LET },
+	{ "limit",                            LIMIT },
+	{ "little-endian",                    TOKEN_LITTLE_ENDIAN },
+	{ "ll",                               LL },
+	{ "llt",                              LLT },
+	{ "load",                             LOAD },
+	{ "local",                            LOCAL },
+	{ "log",                              LOG },
+	{ "match",                            MATCH },
+	{ "max",                              TOKEN_MAX },
+	{ "max-balance",                      MAX_BALANCE },
+	{ "max-lease-misbalance",             MAX_LEASE_MISBALANCE },
+	{ "max-lease-ownership",              MAX_LEASE_OWNERSHIP },
+	{ "max-lease-time",                   MAX_LEASE_TIME },
+	{ "max-life",                         MAX_LIFE },
+	{ "max-response-delay",               MAX_RESPONSE_DELAY },
+	{ "max-transmit-idle",                MAX_TRANSMIT_IDLE },
+	{ "max-unacked-updates",              MAX_UNACKED_UPDATES },
+	{ "mclt",                             MCLT },
+	{ "media",                            MEDIA },
+	{ "medium",                           MEDIUM },
+	{ "members",                          MEMBERS },
+	{ "min-balance",                      MIN_BALANCE },
+	{ "min-lease-time",                   MIN_LEASE_TIME },
+	{ "min-secs",                         MIN_SECS },
+	{ "my",                               MY },
+	{ "nameserver",                       NAMESERVER },
+	{ "netmask",                          NETMASK },
+	{ "never",                            NEVER },
+	{ "new",                              TOKEN_NEW },
+	{ "next",                             TOKEN_NEXT },
+	{ "next-server",                      NEXT_SERVER },
+	{ "no",                               TOKEN_NO },
+	{ "noerror",                          NS_NOERROR },
+	{ "normal",                           NORMAL },
+	{ "not",                              TOKEN_NOT },
+	{ "notauth",                          NS_NOTAUTH },
+	{ "notimp",                           NS_NOTIMP },
+	{ "notzone",                          NS_NOTZONE },
+	{ "null",                             TOKEN_NULL },
+	{ "nxdomain",                         NS_NXDOMAIN },
+	{ "nxrrset",                          NS_NXRRSET },
+	{ "octal",                            TOKEN_OCTAL },
+	{ "of",                               OF },
+	{ "omapi",                            OMAPI },
+	{ "on",                               ON },
+	{ "one-lease-per-client",             ONE_LEASE_PER_CLIENT },
+	{ "open",                             TOKEN_OPEN },
+	{ "option",                           OPTION },
+	{ "or",                               OR },
+	{ "owner",                            OWNER },
+	{ "packet",                           PACKET },
+	{ "parse-vendor-option",              PARSE_VENDOR_OPT },
+	{ "partner",                          PARTNER },
+	{ "partner-down",                     PARTNER_DOWN },
+	{ "paused",                           PAUSED },
+	{ "peer",                             PEER },
+	{ "pick",                             PICK },
+	{ "pick-first-value",                 PICK },
+	{ "pool",                             POOL },
+	{ "pool6",                            POOL6 },
+	{ "port",                             PORT },
+	{ "potential-conflict",               POTENTIAL_CONFLICT },
+	{ "preferred-life",                   PREFERRED_LIFE },
+	{ "prefix6",                          PREFIX6 },
+	{ "prepend",                          PREPEND },
+	{ "primary",                          PRIMARY },
+	{ "primary6",                         PRIMARY6 },
+	{ "pseudo",                           PSEUDO },
+	{ "range",                            RANGE },
+	{ "range6",                           RANGE6 },
+	{ "rebind",                           REBIND },
+	{ "reboot",                           REBOOT },
+	{ "recontact-interval",               RECONTACT_INTERVAL },
+	{ "recover",                          RECOVER },
+	{ "recover-done",                     RECOVER_DONE },
+	{ "recover-wait",                     RECOVER_WAIT },
+	{ "refresh",                          REFRESH },
+	{ "refused",                          NS_REFUSED },
+	{ "reject",                           REJECT },
+	{ "release",                          RELEASE },
+	{ "released",                         TOKEN_RELEASED },
+	{ "remove",                           REMOVE },
+	{ "renew",                            RENEW },
+	{ "request",                          REQUEST },
+	{ "require",                          REQUIRE },
+	{ "reserved",                         TOKEN_RESERVED },
+	{ "reset",                            TOKEN_RESET },
+	{ "resolution-interrupted",           RESOLUTION_INTERRUPTED },
+	{ "retry",                            RETRY },
+	{ "return",                           RETURN },
+	{ "reverse",                          REVERSE },
+	{ "rewind",                           REWIND },
+	{ "script",                           SCRIPT },
+	{ "search",                           SEARCH },
+	{ "secondary",                        SECONDARY },
+	{ "secondary6",                       SECONDARY6 },
+	{ "seconds",                          SECONDS },
+	{ "secret",                           SECRET },
+	{ "select",                           SELECT },
+	{ "select-timeout",                   SELECT_TIMEOUT },
+	{ "send",                             SEND },
+	{ "server",                           TOKEN_SERVER },
+	{ "server-duid",                      SERVER_DUID },
+	{ "server-identifier",                SERVER_IDENTIFIER },
+	{ "server-name",                      SERVER_NAME },
+	{ "servfail",                         NS_SERVFAIL },
+	{ "set",                              TOKEN_SET },
+	{ "shared-network",                   SHARED_NETWORK },
+	{ "shutdown",                         SHUTDOWN },
+	{ "siaddr",                           SIADDR },
+	{ "signed",                           SIGNED },
+	{ "size",                             SIZE },
+	{ "space",                            SPACE },
+	{ "sparse",                           SPARSE },
+	{ "spawn",                            SPAWN },
+	{ "split",                            SPLIT },
+	{ "starts",                           STARTS },
+	{ "startup",                          STARTUP },
+	{ "state",                            STATE },
+	{ "static",                           STATIC },
+	{ "string",                           STRING_TOKEN },
+	{ "subclass",                         SUBCLASS },
+	{ "subnet",                           SUBNET },
+	{ "subnet6",                          SUBNET6 },
+	{ "substring",                        SUBSTRING },
+	{ "suffix",                           SUFFIX },
+	{ "supersede",                        SUPERSEDE },
+	{ "switch",                           SWITCH },
+	{ "temporary",                        TEMPORARY },
+	{ "text",                             TEXT },
+	{ "timeout",                          TIMEOUT },
+	{ "timestamp",                        TIMESTAMP },
+	{ "token-ring",                       TOKEN_RING },
+	{ "transmission",                     TRANSMISSION },
+	{ "tsfp",                             TSFP },
+	{ "tstp",                             TSTP },
+	{ "ucase",                            UCASE },
+	{ "uid",                              UID },
+	{ "unauthenticated",                  UNAUTHENTICATED },
+	{ "unknown",                          UNKNOWN },
+	{ "unknown-clients",                  UNKNOWN_CLIENTS },
+	{ "unknown-state",                    UNKNOWN_STATE },
+	{ "unset",                            UNSET },
+	{ "unsigned",                         UNSIGNED },
+	{ "update",                           UPDATE },
+	{ "use-host-decl-names",              USE_HOST_DECL_NAMES },
+	{ "use-lease-addr-for-default-route", USE_LEASE_ADDR_FOR_DEFAULT_ROUTE },
+	{ "user-class",                       USER_CLASS },
+	{ "v6relay",                          V6RELAY },
+	{ "v6relopt",                         V6RELOPT },
+	{ "vendor",                           VENDOR },
+	{ "vendor-class",                     VENDOR_CLASS },
+	{ "width",                            WIDTH },
+	{ "with",                             WITH },
+	{ "yiaddr",                           YIADDR },
+	{ "yxdomain",                         NS_YXDOMAIN },
+	{ "yxrrset",                          NS_YXRRSET },
+	{ "zerolen",                          ZEROLEN },
+	{ "zone",                             ZONE },
+};
+
+#define KEYWORD_COUNT	(sizeof keywords / sizeof keywords [0])
+#define KEYWORD_BUCKETS	128	/* a power of two */
+#define KEYWORD_SLOTS	512	/* a power of two */
+
+/* For each bucket, the number that moves its keywords into free slots. */
+static unsigned keyword_displace [KEYWORD_BUCKETS];
+/* The index in keywords[] of the keyword in each slot, or -1. */
+static short keyword_slot [KEYWORD_SLOTS];
+static int lex_ready;
+
+static u_int32_t
+keyword_hash(const char *name, unsigned len) {
+	u_int32_t h = 2166136261U;
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)tolower((unsigned char)name [i]);
+		h *= 16777619U;
+	}
+	return h;
+}
 
-	switch (tolower((unsigned char)atom[0])) {
-	      case '-':
-		if (atom [1] == 0)
-			return MINUS;
-		break;
-
-	      case 'a':
-		if (!strcasecmp(atom + 1, "bandoned"))
-			return TOKEN_ABANDONED;
-		if (!strcasecmp(atom + 1, "ctive"))
-			return TOKEN_ACTIVE;
-		if (!strncasecmp(atom + 1, "dd", 2)) {
-			if (atom[3] == '\0')
-				return TOKEN_ADD;
-			else if (!strcasecmp(atom + 3, "ress"))
-				return ADDRESS;
-			break;
-		}
-		if (!strcasecmp(atom + 1, "fter"))
-			return AFTER;
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 'l')) {
-			if (!strcasecmp(atom + 2, "gorithm"))
-				return ALGORITHM;
-			if (!strcasecmp(atom + 2, "ias"))
-				return ALIAS;
-			if (isascii(atom[2]) &&
-			    (tolower((unsigned char)atom[2]) == 'l')) {
-				if (atom[3] == '\0')
-					return ALL;
-				else if (!strcasecmp(atom + 3, "ow"))
-					return ALLOW;
-				break;
-			}
-			if (!strcasecmp(atom + 2, "so"))
-				return TOKEN_ALSO;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 'n')) {
-			if (!strcasecmp(atom + 2, "d"))
-				return AND;
-			if (!strcasecmp(atom + 2, "ycast-mac"))
-				return ANYCAST_MAC;
-			break;
-		}
-		if (!strcasecmp(atom + 1, "ppend"))
-			return APPEND;
-		if (!strcasecmp(atom + 1, "rray"))
-			return ARRAY;
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 't')) {
-			if (atom[2] == '\0')
-				return AT;
-			if (!strcasecmp(atom + 2, "sfp"))
-				return ATSFP;
-			break;
-		}
-		if (!strcasecmp(atom + 1, "uthoring-byte-order"))
-			return AUTHORING_BYTE_ORDER;
-		if (!strncasecmp(atom + 1, "ut", 2)) {
-			if (isascii(atom[3]) &&
-			    (tolower((unsigned char)atom[3]) == 'h')) {
-				if (!strncasecmp(atom + 4, "enticat", 7)) {
-					if (!strcasecmp(atom + 11, "ed"))
-						return AUTHENTICATED;
-					if (!strcasecmp(atom + 11, "ion"))
-						return AUTHENTICATION;
-					break;
-				}
-				if (!strcasecmp(atom + 4, "oritative"))
-					return AUTHORITATIVE;
-				break;
-			}
-			if (!strcasecmp(atom + 3, "o-partner-down"))
-				return AUTO_PARTNER_DOWN;
-			break;
-		}
-		break;
-	      case 'b':
-		if (!strcasecmp (atom + 1, "ackup"))
-			return TOKEN_BACKUP;
-		if (!strcasecmp (atom + 1, "ootp"))
-			return TOKEN_BOOTP;
-		if (!strcasecmp (atom + 1, "inding"))
-			return BINDING;
-		if (!strcasecmp (atom + 1, "inary-to-ascii"))
-			return BINARY_TO_ASCII;
-		if (!strcasecmp (atom + 1, "ackoff-cutoff"))
-			return BACKOFF_CUTOFF;
-		if (!strcasecmp (atom + 1, "ooting"))
-			return BOOTING;
-		if (!strcasecmp (atom + 1, "oot-unknown-clients"))
-			return BOOT_UNKNOWN_CLIENTS;
-		if (!strcasecmp (atom + 1, "reak"))
-			return BREAK;
-		if (!strcasecmp (atom + 1, "illing"))
-			return BILLING;
-		if (!strcasecmp (atom + 1, "oolean"))
-			return BOOLEAN;
-		if (!strcasecmp (atom + 1, "alance"))
-			return BALANCE;
-		if (!strcasecmp (atom + 1, "ound"))
-			return BOUND;
-		if (!strcasecmp(atom+1, "ig-endian")) {
-			return TOKEN_BIG_ENDIAN;
-		}
-		break;
-	      case 'c':
-		if (!strcasecmp(atom + 1, "ase"))
-			return CASE;
-		if (!strcasecmp(atom + 1, "heck"))
-			return CHECK;
-		if (!strcasecmp(atom + 1, "iaddr"))
-			return CIADDR;
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'l') {
-			if (!strcasecmp(atom + 2, "ass"))
-				return CLASS;
-			if (!strncasecmp(atom + 2, "ient", 4)) {
-				if (!strcasecmp(atom + 6, "s"))
-					return CLIENTS;
-				if (atom[6] == '-') {
-					if (!strcasecmp(atom + 7, "hostname"))
-						return CLIENT_HOSTNAME;
-					if (!strcasecmp(atom + 7, "identifier"))
-						return CLIENT_IDENTIFIER;
-					if (!strcasecmp(atom + 7, "state"))
-						return CLIENT_STATE;
-					if (!strcasecmp(atom + 7, "updates"))
-						return CLIENT_UPDATES;
-					break;
-				}
-				break;
-			}
-			if (!strcasecmp(atom + 2, "ose"))
-				return TOKEN_CLOSE;
-			if (!strcasecmp(atom + 2, "tt"))
-				return CLTT;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'o') {
-			if (!strcasecmp(atom + 2, "de"))
-				return CODE;
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'm') {
-				if (!strcasecmp(atom + 3, "mit"))
-					return COMMIT;
-				if (!strcasecmp(atom + 3,
-						"munications-interrupted"))
-					return COMMUNICATIONS_INTERRUPTED;
-				if (!strcasecmp(atom + 3, "pressed"))
-					return COMPRESSED;
-				break;
-			}
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'n') {
-				if (!strcasecmp(atom + 3, "cat"))
-					return CONCAT;
-				if (!strcasecmp(atom + 3, "fig-option"))
-					return CONFIG_OPTION;
-				if (!strcasecmp(atom + 3, "flict-done"))
-					return CONFLICT_DONE;
-				if (!strcasecmp(atom + 3, "nect"))
-					return CONNECT;
-				break;
-			}
-			break;
-		}
-		if (!strcasecmp(atom + 1, "reate"))
-			return TOKEN_CREATE;
-		break;
-	      case 'd':
-		if (!strcasecmp(atom + 1, "b-time-format"))
-			return DB_TIME_FORMAT;
-		if (!strcasecmp (atom + 1, "omain"))
-			return DOMAIN;
-		if (!strncasecmp (atom + 1, "omain-", 6)) {
-			if (!strcasecmp(atom + 7, "name"))
-				return DOMAIN_NAME;
-			if (!strcasecmp(atom + 7, "list"))
-				return DOMAIN_LIST;
-		}
-		if (!strcasecmp (atom + 1, "o-forward-updates"))
-			return DO_FORWARD_UPDATE;
-		/* do-forward-update is included for historical reasons */
-		if (!strcasecmp (atom + 1, "o-forward-update"))
-			return DO_FORWARD_UPDATE;
-		if (!strcasecmp (atom + 1, "ebug"))
-			return TOKEN_DEBUG;
-		if (!strcasecmp (atom + 1, "eny"))
-			return DENY;
-		if (!strcasecmp (atom + 1, "eleted"))
-			return TOKEN_DELETED;
-		if (!strcasecmp (atom + 1, "elete"))
-			return TOKEN_DELETE;
-		if (!strncasecmp (atom + 1, "efault", 6)) {
-			if (!atom [7])
-				return DEFAULT;
-			if (!strcasecmp(atom + 7, "-duid"))
-				return DEFAULT_DUID;
-			if (!strcasecmp (atom + 7, "-lease-time"))
-				return DEFAULT_LEASE_TIME;
-			break;
-		}
-		if (!strncasecmp (atom + 1, "ynamic", 6)) {
-			if (!atom [7])
-				return DYNAMIC;
-			if (!strncasecmp (atom + 7, "-bootp", 6)) {
-				if (!atom [13])
-					return DYNAMIC_BOOTP;
-				if (!strcasecmp (atom + 13, "-lease-cutoff"))
-					return DYNAMIC_BOOTP_LEASE_CUTOFF;
-				if (!strcasecmp (atom + 13, "-lease-length"))
-					return DYNAMIC_BOOTP_LEASE_LENGTH;
-				break;
-			}
-		}
-		if (!strcasecmp (atom + 1, "uplicates"))
-			return DUPLICATES;
-		if (!strcasecmp (atom + 1, "eclines"))
-			return DECLINES;
-		if (!strncasecmp (atom + 1, "efine", 5)) {
-			if (!strcasecmp (atom + 6, "d"))
-				return DEFINED;
-			if (!atom [6])
-				return DEFINE;
-		}
-		if (!strcasecmp (atom + 1, "isconnect"))
-			return DISCONNECT;
-		break;
-	      case 'e':
-		if (isascii (atom [1]) &&
-		    tolower((unsigned char)atom[1]) == 'x') {
-			if (!strcasecmp (atom + 2, "tract-int"))
-				return EXTRACT_INT;
-			if (!strcasecmp (atom + 2, "ists"))
-				return EXISTS;
-			if (!strcasecmp (atom + 2, "piry"))
-				return EXPIRY;
-			if (!strcasecmp (atom + 2, "pire"))
-				return EXPIRE;
-			if (!strcasecmp (atom + 2, "pired"))
-				return TOKEN_EXPIRED;
-		}
-		if (!strcasecmp (atom + 1, "ncode-int"))
-			return ENCODE_INT;
-		if (!strcasecmp(atom + 1, "poch"))
-			return EPOCH;
-		if (!strcasecmp (atom + 1, "thernet"))
-			return ETHERNET;
-		if (!strcasecmp (atom + 1, "nds"))
-			return ENDS;
-		if (!strncasecmp (atom + 1, "ls", 2)) {
-			if (!strcasecmp (atom + 3, "e"))
-				return ELSE;
-			if (!strcasecmp (atom + 3, "if"))
-				return ELSIF;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "rror"))
-			return ERROR;
-		if (!strcasecmp (atom + 1, "val"))
-			return EVAL;
-		if (!strcasecmp (atom + 1, "ncapsulate"))
-			return ENCAPSULATE;
-		if (!strcasecmp(atom + 1, "xecute"))
-			return EXECUTE;
-		if (!strcasecmp(atom+1, "n")) {
-			return EN;
-		}
-		break;
-	      case 'f':
-		if (!strcasecmp (atom + 1, "atal"))
-			return FATAL;
-		if (!strcasecmp (atom + 1, "ilename"))
-			return FILENAME;
-		if (!strcasecmp (atom + 1, "ixed-address"))
-			return FIXED_ADDR;
-		if (!strcasecmp (atom + 1, "ixed-address6"))
-			return FIXED_ADDR6;
-		if (!strcasecmp (atom + 1, "ixed-prefix6"))
-			return FIXED_PREFIX6;
-		if (!strcasecmp (atom + 1, "ddi"))
-			return TOKEN_FDDI;
-		if (!strcasecmp (atom + 1, "ormerr"))
-			return NS_FORMERR;
-		if (!strcasecmp (atom + 1, "unction"))
-			return FUNCTION;
-		if (!strcasecmp (atom + 1, "ailover"))
-			return FAILOVER;
-		if (!strcasecmp (atom + 1, "ree"))
-			return TOKEN_FREE;
-		break;
-	      case 'g':
-		if (!strncasecmp(atom + 1, "et", 2)) {
-			if (!strcasecmp(atom + 3, "-lease-hostnames"))
-				return GET_LEASE_HOSTNAMES;
-			if (!strcasecmp(atom + 3, "hostbyname"))
-				return GETHOSTBYNAME;
-			if (!strcasecmp(atom + 3, "hostname"))
-				return GETHOSTNAME;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "iaddr"))
-			return GIADDR;
-		if (!strcasecmp (atom + 1, "roup"))
-			return GROUP;
-		break;
-	      case 'h':
-		if (!strcasecmp(atom + 1, "ash"))
-			return HASH;
-		if (!strcasecmp (atom + 1, "ba"))
-			return HBA;
-		if (!strcasecmp (atom + 1, "ost"))
-			return HOST;
-		if (!strcasecmp (atom + 1, "ost-decl-name"))
-			return HOST_DECL_NAME;
-		if (!strcasecmp(atom + 1, "ost-identifier"))
-			return HOST_IDENTIFIER;
-		if (!strcasecmp (atom + 1, "ardware"))
-			return HARDWARE;
-		if (!strcasecmp (atom + 1, "ostname"))
-			return HOSTNAME;
-		if (!strcasecmp (atom + 1, "elp"))
-			return TOKEN_HELP;
-		if (!strcasecmp (atom + 1, "ex")) {
-			return TOKEN_HEX;
-		}
-		break;
-	      case 'i':
-	      	if (!strcasecmp(atom+1, "a-na"))
-			return IA_NA;
-	      	if (!strcasecmp(atom+1, "a-ta"))
-			return IA_TA;
-	      	if (!strcasecmp(atom+1, "a-pd"))
-			return IA_PD;
-	      	if (!strcasecmp(atom+1, "aaddr"))
-			return IAADDR;
-	      	if (!strcasecmp(atom+1, "aprefix"))
-			return IAPREFIX;
-		if (!strcasecmp (atom + 1, "nclude"))
-			return INCLUDE;
-		if (!strcasecmp (atom + 1, "nteger"))
-			return INTEGER;
-		if (!strcasecmp (atom  + 1, "nfiniband"))
-			return TOKEN_INFINIBAND;
-		if (!strcasecmp (atom + 1, "nfinite"))
-			return INFINITE;
-		if (!strcasecmp (atom + 1, "nfo"))
-			return INFO;
-		if (!strcasecmp (atom + 1, "p-address"))
-			return IP_ADDRESS;
-		if (!strcasecmp (atom + 1, "p6-address"))
-			return IP6_ADDRESS;
-		if (!strcasecmp (atom + 1, "nitial-interval"))
-			return INITIAL_INTERVAL;
-		if (!strcasecmp (atom + 1, "nitial-delay"))
-			return INITIAL_DELAY;
-		if (!strcasecmp (atom + 1, "nterface"))
-			return INTERFACE;
-		if (!strcasecmp (atom + 1, "dentifier"))
-			return IDENTIFIER;
-		if (!strcasecmp (atom + 1, "f"))
-			return IF;
-		if (!strcasecmp (atom + 1, "s"))
-			return IS;
-		if (!strcasecmp (atom + 1, "gnore"))
-			return IGNORE;
-		break;
-	      case 'k':
-		if (!strncasecmp (atom + 1, "nown", 4)) {
-			if (!strcasecmp (atom + 5, "-clients"))
-				return KNOWN_CLIENTS;
-			if (!atom[5])
-				return KNOWN;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "ey"))
-			return KEY;
-		if (!strcasecmp (atom + 1, "ey-algorithm"))
-			return KEY_ALGORITHM;
-		break;
-	      case 'l':
-		if (!strcasecmp (atom + 1, "case"))
-			return LCASE;
-		if (!strcasecmp (atom + 1, "ease"))
-			return LEASE;
-		if (!strcasecmp(atom + 1, "ease6"))
-			return LEASE6;
-		if (!strcasecmp (atom + 1, "eased-address"))
-			return LEASED_ADDRESS;
-		if (!strcasecmp (atom + 1, "ease-time"))
-			return LEASE_TIME;
-		if (!strcasecmp(atom + 1, "easequery"))
-			return LEASEQUERY;
-		if (!strcasecmp(atom + 1, "ength"))
-			return LENGTH;
-		if (!strcasecmp (atom + 1, "imit"))
-			return LIMIT;
-		if (!strcasecmp (atom + 1, "et"))
-			return LET;
-		if (!strcasecmp (atom + 1, "oad"))
-			return LOAD;
-		if (!strcasecmp(atom + 1, "ocal"))
-			return LOCAL;
-		if (!strcasecmp (atom + 1, "og"))
-			return LOG;
-		if (!strcasecmp(atom+1, "lt")) {
-			return LLT;
-		}
-		if (!strcasecmp(atom+1, "l")) {
-			return LL;
-		}
-		if (!strcasecmp(atom+1, "ittle-endian")) {
-			return TOKEN_LITTLE_ENDIAN;
-		}
-		if (!strcasecmp (atom + 1, "ease-id-format")) {
-			return LEASE_ID_FORMAT;
-		}
-		break;
-	      case 'm':
-		if (!strncasecmp (atom + 1, "ax", 2)) {
-			if (!atom [3])
-				return TOKEN_MAX;
-			if (!strcasecmp (atom + 3, "-balance"))
-				return MAX_BALANCE;
-			if (!strncasecmp (atom + 3, "-lease-", 7)) {
-				if (!strcasecmp(atom + 10, "misbalance"))
-					return MAX_LEASE_MISBALANCE;
-				if (!strcasecmp(atom + 10, "ownership"))
-					return MAX_LEASE_OWNERSHIP;
-				if (!strcasecmp(atom + 10, "time"))
-					return MAX_LEASE_TIME;
-			}
-			if (!strcasecmp(atom + 3, "-life"))
-				return MAX_LIFE;
-			if (!strcasecmp (atom + 3, "-transmit-idle"))
-				return MAX_TRANSMIT_IDLE;
-			if (!strcasecmp (atom + 3, "-response-delay"))
-				return MAX_RESPONSE_DELAY;
-			if (!strcasecmp (atom + 3, "-unacked-updates"))
-				return MAX_UNACKED_UPDATES;
-		}
-		if (!strncasecmp (atom + 1, "in-", 3)) {
-			if (!strcasecmp (atom + 4, "balance"))
-				return MIN_BALANCE;
-			if (!strcasecmp (atom + 4, "lease-time"))
-				return MIN_LEASE_TIME;
-			if (!strcasecmp (atom + 4, "secs"))
-				return MIN_SECS;
-			break;
-		}
-		if (!strncasecmp (atom + 1, "edi", 3)) {
-			if (!strcasecmp (atom + 4, "a"))
-				return MEDIA;
-			if (!strcasecmp (atom + 4, "um"))
-				return MEDIUM;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "atch"))
-			return MATCH;
-		if (!strcasecmp (atom + 1, "embers"))
-			return MEMBERS;
-		if (!strcasecmp (atom + 1, "y"))
-			return MY;
-		if (!strcasecmp (atom + 1, "clt"))
-			return MCLT;
-		break;
-	      case 'n':
-		if (!strcasecmp (atom + 1, "ormal"))
-			return NORMAL;
-		if (!strcasecmp (atom + 1, "ameserver"))
-			return NAMESERVER;
-		if (!strcasecmp (atom + 1, "etmask"))
-			return NETMASK;
-		if (!strcasecmp (atom + 1, "ever"))
-			return NEVER;
-		if (!strcasecmp (atom + 1, "ext-server"))
-			return NEXT_SERVER;
-		if (!strcasecmp (atom + 1, "ot"))
-			return TOKEN_NOT;
-		if (!strcasecmp (atom + 1, "o"))
-			return TOKEN_NO;
-		if (!strcasecmp (atom + 1, "oerror"))
-			return NS_NOERROR;
-		if (!strcasecmp (atom + 1, "otauth"))
-			return NS_NOTAUTH;
-		if (!strcasecmp (atom + 1, "otimp"))
-			return NS_NOTIMP;
-		if (!strcasecmp (atom + 1, "otzone"))
-			return NS_NOTZONE;
-		if (!strcasecmp (atom + 1, "xdomain"))
-			return NS_NXDOMAIN;
-		if (!strcasecmp (atom + 1, "xrrset"))
-			return NS_NXRRSET;
-		if (!strcasecmp (atom + 1, "ull"))
-			return TOKEN_NULL;
-		if (!strcasecmp (atom + 1, "ext"))
-			return TOKEN_NEXT;
-		if (!strcasecmp (atom + 1, "ew"))
-			return TOKEN_NEW;
-		break;
-	      case 'o':
-		if (!strcasecmp (atom + 1, "mapi"))
-			return OMAPI;
-		if (!strcasecmp (atom + 1, "r"))
-			return OR;
-		if (!strcasecmp (atom + 1, "n"))
-			return ON;
-		if (!strcasecmp (atom + 1, "pen"))
-			return TOKEN_OPEN;
-		if (!strcasecmp (atom + 1, "ption"))
-			return OPTION;
-		if (!strcasecmp (atom + 1, "ne-lease-per-client"))
-			return ONE_LEASE_PER_CLIENT;
-		if (!strcasecmp (atom + 1, "f"))
-			return OF;
-		if (!strcasecmp (atom + 1, "wner"))
-			return OWNER;
-		if (!strcasecmp (atom + 1, "ctal")) {
-			return TOKEN_OCTAL;
-		}
-		break;
-	      case 'p':
-		if (!strcasecmp (atom + 1, "arse-vendor-option"))
-			return PARSE_VENDOR_OPT;
-		if (!strcasecmp (atom + 1, "repend"))
-			return PREPEND;
-		if (!strcasecmp(atom + 1, "referred-life"))
-			return PREFERRED_LIFE;
-		if (!strcasecmp (atom + 1, "acket"))
-			return PACKET;
-		if (!strcasecmp (atom + 1, "ool"))
-			return POOL;
-		if (!strcasecmp (atom + 1, "ool6"))
-			return POOL6;
-		if (!strcasecmp (atom + 1, "refix6"))
-			return PREFIX6;
-		if (!strcasecmp (atom + 1, "seudo"))
-			return PSEUDO;
-		if (!strcasecmp (atom + 1, "eer"))
-			return PEER;
-		if (!strcasecmp (atom + 1, "rimary"))
-			return PRIMARY;
-		if (!strcasecmp (atom + 1, "rimary6"))
-			return PRIMARY6;
-		if (!strncasecmp (atom + 1, "artner", 6)) {
-			if (!atom [7])
-				return PARTNER;
-			if (!strcasecmp (atom + 7, "-down"))
-				return PARTNER_DOWN;
-		}
-		if (!strcasecmp (atom + 1, "ort"))
-			return PORT;
-		if (!strcasecmp (atom + 1, "otential-conflict"))
-			return POTENTIAL_CONFLICT;
-		if (!strcasecmp (atom + 1, "ick-first-value") ||
-		    !strcasecmp (atom + 1, "ick"))
-			return PICK;
-		if (!strcasecmp (atom + 1, "aused"))
-			return PAUSED;
-		break;
-	      case 'r':
-		if (!strcasecmp(atom + 1, "ange"))
-			return RANGE;
-		if (!strcasecmp(atom + 1, "ange6"))
-			return RANGE6;
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 'e')) {
-			if (!strcasecmp(atom + 2, "bind"))
-				return REBIND;
-			if (!strcasecmp(atom + 2, "boot"))
-				return REBOOT;
-			if (!strcasecmp(atom + 2, "contact-interval"))
-				return RECONTACT_INTERVAL;
-			if (!strncasecmp(atom + 2, "cover", 5)) {
-				if (atom[7] == '\0')
-					return RECOVER;
-				if (!strcasecmp(atom + 7, "-done"))
-					return RECOVER_DONE;
-				if (!strcasecmp(atom + 7, "-wait"))
-					return RECOVER_WAIT;
-				break;
-			}
-			if (!strcasecmp(atom + 2, "fresh"))
-				return REFRESH;
-			if (!strcasecmp(atom + 2, "fused"))
-				return NS_REFUSED;
-			if (!strcasecmp(atom + 2, "ject"))
-				return REJECT;
-			if (!strcasecmp(atom + 2, "lease"))
-				return RELEASE;
-			if (!strcasecmp(atom + 2, "leased"))
-				return TOKEN_RELEASED;
-			if (!strcasecmp(atom + 2, "move"))
-				return REMOVE;
-			if (!strcasecmp(atom + 2, "new"))
-				return RENEW;
-			if (!strcasecmp(atom + 2, "quest"))
-				return REQUEST;
-			if (!strcasecmp(atom + 2, "quire"))
-				return REQUIRE;
-			if (isascii(atom[2]) &&
-			    (tolower((unsigned char)atom[2]) == 's')) {
-				if (!strcasecmp(atom + 3, "erved"))
-					return TOKEN_RESERVED;
-				if (!strcasecmp(atom + 3, "et"))
-					return TOKEN_RESET;
-				if (!strcasecmp(atom + 3,
-						"olution-interrupted"))
-					return RESOLUTION_INTERRUPTED;
-				break;
-			}
-			if (!strcasecmp(atom + 2, "try"))
-				return RETRY;
-			if (!strcasecmp(atom + 2, "turn"))
-				return RETURN;
-			if (!strcasecmp(atom + 2, "verse"))
-				return REVERSE;
-			if (!strcasecmp(atom + 2, "wind"))
-				return REWIND;
-			break;
-		}
-		break;
-	      case 's':
-		if (!strcasecmp(atom + 1, "cript"))
-			return SCRIPT;
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'e') {
-			if (!strcasecmp(atom + 2, "arch"))
-				return SEARCH;
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'c') {
-				if (!strncasecmp(atom + 3, "ond", 3)) {
-                                        if (!strcasecmp(atom + 6, "ary"))
-						return SECONDARY;
-                                        if (!strcasecmp(atom + 6, "ary6"))
-						return SECONDARY6;
-                                        if (!strcasecmp(atom + 6, "s"))
-                                                return SECONDS;
+static u_int32_t
+keyword_mix(u_int32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#define KEYWORD_BUCKET(h) (keyword_mix (h) & (KEYWORD_BUCKETS - 1))
+#define KEYWORD_SLOT(h, d) \
+	(keyword_mix ((h) ^ ((d) * 0x9e3779b9U)) & (KEYWORD_SLOTS - 1))
+
+/*
+ * Set up the character classes and the keyword hash.  The keywords are
+ * put in buckets by their hash, and the buckets, fullest first, each look
+ * for a displacement that puts all of their keywords in free slots.  This
+ * is done once, before any parsing, so it needs no locking when lease
+ * files are parsed on several threads.
+ */
+static void
+lex_init(void) {
+	unsigned char count [KEYWORD_BUCKETS];
+	unsigned short order [KEYWORD_BUCKETS];
+	u_int32_t hash [KEYWORD_COUNT];
+	unsigned slots [8];
+	unsigned b, d, i, j, k, n, t;
+	int c;
+
+	if (lex_ready)
+		return;
+
+	for (c = 0; c < 128; c++) {
+		lex_class [c] = 0;
+		if (isspace(c))
+			lex_class [c] |= LEX_SPACE;
+		if (isdigit(c))
+			lex_class [c] |= LEX_DIGIT;
+		if (isxdigit(c))
+			lex_class [c] |= LEX_XDIGIT;
+		if (isalpha(c))
+			lex_class [c] |= LEX_ALPHA;
+		if (isalnum(c) || c == '-' || c == '_')
+			lex_class [c] |= LEX_NAME;
+	}
+
+	memset (count, 0, sizeof count);
+	for (i = 0; i < KEYWORD_COUNT; i++) {
+		hash [i] = keyword_hash(keywords [i].name,
+					strlen(keywords [i].name));
+		count [KEYWORD_BUCKET(hash [i])]++;
+	}
+	for (b = 0; b < KEYWORD_BUCKETS; b++)
+		order [b] = b;
+	for (i = 1; i < KEYWORD_BUCKETS; i++) {
+		t = order [i];
+		for (j = i; j > 0 && count [order [j - 1]] < count [t]; j--)
+			order [j] = order [j - 1];
+		order [j] = t;
+	}
+
+	memset (keyword_slot, -1, sizeof keyword_slot);
+	for (b = 0; b < KEYWORD_BUCKETS && count [order [b]]; b++) {
+		if (count [order [b]] > sizeof slots / sizeof slots [0])
+			log_fatal ("lex_init: too many keywords in a bucket.");
+		for (d = 1; d < 100000; d++) {
+			n = 0;
+			for (i = 0; i < KEYWORD_COUNT; i++) {
+				if (KEYWORD_BUCKET(hash [i]) != order [b])
+					continue;
+				t = KEYWORD_SLOT(hash [i], d);
+				if (keyword_slot [t] != -1)
 					break;
-				}
-                                if (!strcasecmp(atom + 3, "ret"))
-                                        return SECRET;
-				break;
-			}
-			if (!strncasecmp(atom + 2, "lect", 4)) {
-                                if (atom[6] == '\0')
-                                        return SELECT;
-                                if (!strcasecmp(atom + 6, "-timeout"))
-                                        return SELECT_TIMEOUT;
-				break;
-			}
-                        if (!strcasecmp(atom + 2, "nd"))
-                                return SEND;
-			if (!strncasecmp(atom + 2, "rv", 2)) {
-				if (!strncasecmp(atom + 4, "er", 2)) {
-                                        if (atom[6] == '\0')
-                                                return TOKEN_SERVER;
-					if (atom[6] == '-') {
-						if (!strcasecmp(atom + 7,
-								"duid"))
-							return SERVER_DUID;
-                                                if (!strcasecmp(atom + 7,
-								"name"))
-                                                        return SERVER_NAME;
-                                                if (!strcasecmp(atom + 7,
-								"identifier"))
-                                                      return SERVER_IDENTIFIER;
+				for (k = 0; k < n; k++)
+					if (slots [k] == t)
 						break;
-					}
+				if (k < n)
 					break;
-				}
-                                if (!strcasecmp(atom + 4, "fail"))
-                                        return NS_SERVFAIL;
-				break;
+				slots [n++] = t;
 			}
-                        if (!strcasecmp(atom + 2, "t"))
-                                return TOKEN_SET;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'h') {
-                        if (!strcasecmp(atom + 2, "ared-network"))
-                                return SHARED_NETWORK;
-                        if (!strcasecmp(atom + 2, "utdown"))
-                                return SHUTDOWN;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'i') {
-                        if (!strcasecmp(atom + 2, "addr"))
-                                return SIADDR;
-                        if (!strcasecmp(atom + 2, "gned"))
-                                return SIGNED;
-                        if (!strcasecmp(atom + 2, "ze"))
-                                return SIZE;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'p') {
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'a') {
-                                if (!strcasecmp(atom + 3, "ce"))
-                                        return SPACE;
-                                if (!strcasecmp(atom + 3, "wn"))
-                                        return SPAWN;
+			if (i == KEYWORD_COUNT)
 				break;
-			}
-                        if (!strcasecmp(atom + 2, "lit"))
-                                return SPLIT;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 't') {
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'a') {
-				if(!strncasecmp(atom + 3, "rt", 2)) {
-                                         if (!strcasecmp(atom + 5, "s"))
-                                                 return STARTS;
-                                         if (!strcasecmp(atom + 5, "up"))
-                                                 return STARTUP;
-					break;
-				}
-				if (isascii(atom[3]) &&
-				    tolower((unsigned char)atom[3]) == 't') {
-                                        if (!strcasecmp(atom + 4, "e"))
-                                                return STATE;
-                                        if (!strcasecmp(atom + 4, "ic"))
-                                                return STATIC;
-					break;
-				}
-			}
-                        if (!strcasecmp(atom + 2, "ring"))
-                                return STRING_TOKEN;
-			break;
-		}
-                if (!strncasecmp(atom + 1, "ub", 2)) {
-                        if (!strcasecmp(atom + 3, "class"))
-                                return SUBCLASS;
-                        if (!strcasecmp(atom + 3, "net"))
-                                return SUBNET;
-                        if (!strcasecmp(atom + 3, "net6"))
-                                return SUBNET6;
-                        if (!strcasecmp(atom + 3, "string"))
-                                return SUBSTRING;
-                        break;
-                }
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'u') {
-                        if (!strcasecmp(atom + 2, "ffix"))
-                                return SUFFIX;
-                        if (!strcasecmp(atom + 2, "persede"))
-                                return SUPERSEDE;
-		}
-                if (!strcasecmp(atom + 1, "witch"))
-                        return SWITCH;
-		break;
-	      case 't':
-		if (!strcasecmp (atom + 1, "imestamp"))
-			return TIMESTAMP;
-		if (!strcasecmp (atom + 1, "imeout"))
-			return TIMEOUT;
-		if (!strcasecmp (atom + 1, "oken-ring"))
-			return TOKEN_RING;
-		if (!strcasecmp (atom + 1, "ext"))
-			return TEXT;
-		if (!strcasecmp (atom + 1, "stp"))
-			return TSTP;
-		if (!strcasecmp (atom + 1, "sfp"))
-			return TSFP;
-		if (!strcasecmp (atom + 1, "ransmission"))
-			return TRANSMISSION;
-		if (!strcasecmp(atom + 1, "emporary"))
-			return TEMPORARY;
-		break;
-	      case 'u':
-		if (!strcasecmp (atom + 1, "case"))
-			return UCASE;
-		if (!strcasecmp (atom + 1, "nset"))
-			return UNSET;
-		if (!strcasecmp (atom + 1, "nsigned"))
-			return UNSIGNED;
-		if (!strcasecmp (atom + 1, "id"))
-			return UID;
-		if (!strncasecmp (atom + 1, "se", 2)) {
-			if (!strcasecmp (atom + 3, "r-class"))
-				return USER_CLASS;
-			if (!strcasecmp (atom + 3, "-host-decl-names"))
-				return USE_HOST_DECL_NAMES;
-			if (!strcasecmp (atom + 3,
-					 "-lease-addr-for-default-route"))
-				return USE_LEASE_ADDR_FOR_DEFAULT_ROUTE;
-			break;
 		}
-		if (!strncasecmp (atom + 1, "nknown", 6)) {
-			if (!strcasecmp (atom + 7, "-clients"))
-				return UNKNOWN_CLIENTS;
-			if (!strcasecmp (atom + 7, "-state"))
-				return UNKNOWN_STATE;
-			if (!atom [7])
-				return UNKNOWN;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "nauthenticated"))
-			return UNAUTHENTICATED;
-		if (!strcasecmp (atom + 1, "pdate"))
-			return UPDATE;
-		break;
-	      case 'v':
-		if (!strcasecmp (atom + 1, "6relay"))
-			return V6RELAY;
-		if (!strcasecmp (atom + 1, "6relopt"))
-			return V6RELOPT;
-		if (!strcasecmp (atom + 1, "endor-class"))
-			return VENDOR_CLASS;
-		if (!strcasecmp (atom + 1, "endor"))
-			return VENDOR;
-		break;
-	      case 'w':
-		if (!strcasecmp (atom + 1, "ith"))
-			return WITH;
-		if (!strcasecmp(atom + 1, "idth"))
-			return WIDTH;
-		break;
-	      case 'y':
-		if (!strcasecmp (atom + 1, "iaddr"))
-			return YIADDR;
-		if (!strcasecmp (atom + 1, "xdomain"))
-			return NS_YXDOMAIN;
-		if (!strcasecmp (atom + 1, "xrrset"))
-			return NS_YXRRSET;
-		break;
-	      case 'z':
-		if (!strcasecmp (atom + 1, "erolen"))
-			return ZEROLEN;
-		if (!strcasecmp (atom + 1, "one"))
-			return ZONE;
-		break;
+		if (d == 100000)
+			log_fatal ("lex_init: can't build the keyword table.");
+		keyword_displace [order [b]] = d;
+		n = 0;
+		for (i = 0; i < KEYWORD_COUNT; i++)
+			if (KEYWORD_BUCKET(hash [i]) == order [b])
+				keyword_slot [slots [n++]] = i;
 	}
+	lex_ready = 1;
+}
+
+static enum dhcp_token
+intern(char *atom, unsigned len, enum dhcp_token dfv) {
+	u_int32_t h;
+	int i;
+
+	if (!isascii(atom[0]))
+		return dfv;
+
+	/* Parse structures made without new_parse() get here first. */
+	if (!lex_ready)
+		lex_init();
+
+	h = keyword_hash(atom, len);
+	i = keyword_slot [KEYWORD_SLOT(h, keyword_displace [KEYWORD_BUCKET(h)])];
+	if (i != -1 && !strcasecmp(atom, keywords [i].name))
+		return keywords [i].token;
 	return dfv;
 }
+
+/*
+ * Work out the line and column of the last token read, and copy its line
+ * for error messages.  The lexer itself only remembers where in the buffer
+ * the token started, so this is only done when a message is to be printed.
+ * Lines are counted on from the last token located, or from the start of
+ * the buffer if the buffer has moved on past it.
+ */
+void
+lex_locate(struct parse *cfile) {
+	size_t ofs, start;
+	int line;
+	unsigned len;
+
+	ofs = cfile -> lexofs;
+	if (ofs > cfile -> buflen)
+		ofs = cfile -> buflen;
+	if (ofs >= cfile -> countofs) {
+		start = cfile -> countofs;
+		line = cfile -> countline;
+	} else {
+		start = 0;
+		line = 0;
+	}
+	for (; start < ofs; start++)
+		if (cfile -> inbuf [start] == EOL)
+			line++;
+	cfile -> countofs = ofs;
+	cfile -> countline = line;
+	cfile -> lexline = cfile -> line + line;
+
+	for (start = ofs; start > 0; start--)
+		if (cfile -> inbuf [start - 1] == EOL)
+			break;
+	cfile -> lexchar = ofs - start + 1;
+
+	for (len = 0; len < sizeof cfile -> line1 - 1 &&
+		      start + len < cfile -> buflen; len++)
+		if (cfile -> inbuf [start + len] == EOL)
+			break;
+	memcpy (cfile -> line1, cfile -> inbuf + start, len);
+	cfile -> line1 [len] = 0;
+	cfile -> token_line = cfile -> line1;
+}
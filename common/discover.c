@@ -45,6 +45,7 @@ struct interface_info *fallback_interface = 0;
 
 int interfaces_invalidated;
 int quiet_interface_discovery;
+int send_batching;
 u_int16_t local_port = 0;
 u_int16_t remote_port = 0;
 u_int16_t relay_port = 0;
@@ -1063,6 +1064,7 @@ int setup_fallback (struct interface_info **fp, const char *file, int line)
 		log_fatal ("Error allocating fallback interface: %s",
 			   isc_result_totext (status));
 	strcpy (fallback_interface -> name, "fallback");
+	fallback_interface -> flags |= INTERFACE_FALLBACK;
 	if (dhcp_interface_setup_hook)
 		(*dhcp_interface_setup_hook) (fallback_interface,
 					      (struct iaddr *)0);
@@ -1088,8 +1090,57 @@ void reinitialize_interfaces ()
 	interfaces_invalidated = 1;
 }
 
+/* Between send_batch_begin() and send_batch_end(), send_packet() may
+   queue packets on their interface rather than sending them at once, so
+   that everything sent in one turn of the dispatch loop goes to the
+   kernel together.   Batches can nest; the packets go out when the
+   outermost one ends. */
+void send_batch_begin ()
+{
+	send_batching++;
+}
+
+void send_batch_end ()
+{
+#if defined (USE_SEND_BATCH)
+	struct interface_info *ip;
+#endif
+
+	if (--send_batching > 0)
+		return;
+	send_batching = 0;
+
+#if defined (USE_SEND_BATCH)
+	for (ip = interfaces; ip; ip = ip -> next)
+		if (ip -> tbuf_len != 0)
+			if_flush_send (ip);
+
+	if (fallback_interface && fallback_interface -> tbuf_len != 0) {
+#if defined (USE_SOCKET_FALLBACK) && !defined (USE_SOCKET_SEND)
+		if_flush_fallback (fallback_interface);
+#else
+		if_flush_send (fallback_interface);
+#endif
+	}
+#endif
+}
+
+static isc_result_t got_packets (omapi_object_t *);
+
+/* Replies to the packets read in one go are sent in one batch. */
 isc_result_t got_one (h)
 	omapi_object_t *h;
+{
+	isc_result_t status;
+
+	send_batch_begin ();
+	status = got_packets (h);
+	send_batch_end ();
+	return status;
+}
+
+static isc_result_t got_packets (h)
+	omapi_object_t *h;
 {
 	struct sockaddr_in from;
 	struct hardware hfrom;
@@ -1125,8 +1176,11 @@ isc_result_t got_one (h)
 	 * complained, it seems rational to tighten up that
 	 * restriction.
 	 */
-	if (result < DHCP_FIXED_NON_UDP)
+	if (result < DHCP_FIXED_NON_UDP) {
+		if (ip -> rbuf_offset != ip -> rbuf_len)
+			goto again;
 		return ISC_R_UNEXPECTED;
+	}
 
 #if defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && defined(USE_V4_PKTINFO)
 	{
@@ -1156,7 +1210,8 @@ isc_result_t got_one (h)
 	}
 
 	/* If there is buffered data, read again.    This is for, e.g.,
-	   bpf, which may return two packets at once. */
+	   bpf, which may return two packets at once, or lpf when it reads
+	   a batch of packets with recvmmsg(). */
 	if (ip -> rbuf_offset != ip -> rbuf_len)
 		goto again;
 	return ISC_R_SUCCESS;
@@ -1284,6 +1339,10 @@ isc_result_t dhcp_interface_destroy (omapi_object_t *h,
 		dfree (interface -> rbuf, file, line);
 		interface -> rbuf = (unsigned char *)0;
 	}
+	if (interface -> tbuf) {
+		dfree (interface -> tbuf, file, line);
+		interface -> tbuf = (unsigned char *)0;
+	}
 	if (interface -> client)
 		interface -> client = (struct client_state *)0;
 
@@ -544,7 +544,7 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	unsigned addrlen;
 	int result;
 
-	if (!strcmp (interface -> name, "fallback"))
+	if (interface -> flags & INTERFACE_FALLBACK)
 		return send_fallback (interface, packet, raw,
 				      len, from, to, hto);
 
@@ -68,11 +68,14 @@
  * addresses used.  Currently this limit is 3.
  *
  * The DHCP server tries to find an existing zone for any given name by
- * trying to look up a local zone structure for each domain containing
+ * looking for the closest local zone structure for a domain containing
  * that name, all the way up to '.'.   If it finds one cached, it tries
  * to use that one to do the update.   That's why it tries to update
  * "FOO.COM" above, even though theoretically it should try GAZANGA...
- * and TOPANGA... first.
+ * and TOPANGA... first.  The zones are kept in a trie of labels so this
+ * search is a single walk from '.' down towards the name, and the
+ * nameserver addresses for a zone are only evaluated when the zone is
+ * entered or its addresses may have changed.
  *
  * If the update fails with a predefined zone the zone is marked as bad
  * and another search of the predefined zones is done.  If no predefined
@@ -622,6 +625,197 @@ ddns_cb_forget_zone(dhcp_ddns_cb_t *ddns_cb)
 }
 #endif
 
+/*
+ * Zone suffix trie
+ *
+ * find_cached_zone() wants the most specific zone that covers a name.
+ * Rather than probing dns_zone_hash once for every suffix of the name,
+ * the zones are also kept in a trie keyed by label, starting with the
+ * rightmost label, so the closest enclosing zone is found in a single
+ * walk.  Each node also holds the zone's nameserver addresses, evaluated
+ * once from the primary/secondary option caches and kept until the zone
+ * is replaced, times out or the addresses need to be re-evaluated.  The
+ * hash is still used for exact name lookups via dns_zone_lookup().
+ */
+
+/* How long to keep nameserver addresses that came from an expression
+ * (such as a hostname lookup) rather than from a list of addresses. */
+#define DNS_ZONE_NS_REFRESH 60
+
+/* Deepest name we will walk, a wire format name can't have more. */
+#define DNS_ZONE_MAX_LABELS 128
+
+struct dns_zone_node {
+	struct dns_zone_node *child;	/* first child */
+	struct dns_zone_node *sibling;	/* next child of our parent */
+	struct dns_zone_node *parent;
+	struct dns_zone *zone;
+#if defined (NSUPDATE)
+	isc_sockaddr_t ns_addrs[DHCP_MAXNS];
+	int ns_count;
+	int ns_valid;
+	TIME ns_expiry;			/* 0 if the addresses don't expire */
+#endif
+	unsigned len;
+	char label[1];
+};
+
+static struct dns_zone_node *dns_zone_trie;
+
+/*
+ * Split name into labels.  The label starts and lengths are filled in
+ * from the leftmost label, empty labels (including the one implied by
+ * a trailing '.') are skipped.  Returns the number of labels or -1 if
+ * the name has too many labels.
+ */
+static int
+zone_name_labels(const char *name, const char **labels, unsigned *lens)
+{
+	const char *s, *dot;
+	int count = 0;
+
+	for (s = name; *s != '\0'; s = dot + 1) {
+		dot = strchr(s, '.');
+		if (dot == NULL)
+			dot = s + strlen(s);
+		if (dot != s) {
+			if (count == DNS_ZONE_MAX_LABELS)
+				return (-1);
+			labels[count] = s;
+			lens[count] = dot - s;
+			count++;
+		}
+		if (*dot == '\0')
+			break;
+	}
+	return (count);
+}
+
+static struct dns_zone_node *
+zone_node_child(struct dns_zone_node *node, const char *label, unsigned len)
+{
+	struct dns_zone_node *cp;
+
+	for (cp = node->child; cp != NULL; cp = cp->sibling) {
+		if ((cp->len == len) && (strncasecmp(cp->label, label, len) == 0))
+			return (cp);
+	}
+	return (NULL);
+}
+
+/*
+ * Find the node for exactly the given name.  If create is set any
+ * missing nodes are added on the way down.
+ */
+static struct dns_zone_node *
+zone_trie_find(const char *name, int create)
+{
+	const char *labels[DNS_ZONE_MAX_LABELS];
+	unsigned lens[DNS_ZONE_MAX_LABELS];
+	struct dns_zone_node *node, *cp;
+	int i;
+
+	if (dns_zone_trie == NULL) {
+		if (!create)
+			return (NULL);
+		dns_zone_trie = dmalloc(sizeof(*dns_zone_trie), MDL);
+		if (dns_zone_trie == NULL)
+			return (NULL);
+	}
+
+	i = zone_name_labels(name, labels, lens);
+	if (i < 0)
+		return (NULL);
+
+	node = dns_zone_trie;
+	while (i-- > 0) {
+		cp = zone_node_child(node, labels[i], lens[i]);
+		if (cp == NULL) {
+			if (!create)
+				return (NULL);
+			cp = dmalloc(sizeof(*cp) + lens[i], MDL);
+			if (cp == NULL)
+				return (NULL);
+			memcpy(cp->label, labels[i], lens[i]);
+			cp->len = lens[i];
+			cp->parent = node;
+			cp->sibling = node->child;
+			node->child = cp;
+		}
+		node = cp;
+	}
+	return (node);
+}
+
+/* Drop any nameserver addresses we have evaluated for this node. */
+static void
+zone_node_flush(struct dns_zone_node *node)
+{
+#if defined (NSUPDATE)
+	node->ns_valid = 0;
+	node->ns_count = 0;
+	node->ns_expiry = 0;
+#endif
+}
+
+/* Free empty nodes from node back up towards the root. */
+static void
+zone_node_prune(struct dns_zone_node *node)
+{
+	struct dns_zone_node *parent, **cpp;
+
+	while ((node != dns_zone_trie) &&
+	       (node->zone == NULL) && (node->child == NULL)) {
+		parent = node->parent;
+		for (cpp = &parent->child; *cpp != NULL;
+		     cpp = &(*cpp)->sibling) {
+			if (*cpp == node) {
+				*cpp = node->sibling;
+				break;
+			}
+		}
+		dfree(node, MDL);
+		node = parent;
+	}
+}
+
+/* Remove zone from the trie, if it is the zone we hold for its name. */
+static void
+zone_trie_remove(struct dns_zone *zone)
+{
+	struct dns_zone_node *node;
+
+	node = zone_trie_find(zone->name, 0);
+	if ((node == NULL) || (node->zone != zone))
+		return;
+
+	dns_zone_dereference(&node->zone, MDL);
+	zone_node_flush(node);
+	zone_node_prune(node);
+}
+
+static void
+zone_node_free(struct dns_zone_node *node)
+{
+	struct dns_zone_node *cp, *next;
+
+	for (cp = node->child; cp != NULL; cp = next) {
+		next = cp->sibling;
+		zone_node_free(cp);
+	}
+	if (node->zone != NULL)
+		dns_zone_dereference(&node->zone, MDL);
+	dfree(node, MDL);
+}
+
+void
+dns_zone_trie_free(void)
+{
+	if (dns_zone_trie != NULL)
+		zone_node_free(dns_zone_trie);
+	dns_zone_trie = NULL;
+}
+
 isc_result_t remove_dns_zone (struct dns_zone *zone)
 {
 	struct dns_zone *tz = NULL;
@@ -630,6 +824,7 @@ isc_result_t remove_dns_zone (struct dns_zone *zone)
 		dns_zone_hash_lookup(&tz, dns_zone_hash, zone->name, 0, MDL);
 		if (tz != NULL) {
 			dns_zone_hash_delete(dns_zone_hash, tz->name, 0, MDL);
+			zone_trie_remove(tz);
 			dns_zone_dereference(&tz, MDL);
 		}
 	}
@@ -640,6 +835,19 @@ isc_result_t remove_dns_zone (struct dns_zone *zone)
 isc_result_t enter_dns_zone (struct dns_zone *zone)
 {
 	struct dns_zone *tz = (struct dns_zone *)0;
+	struct dns_zone_node *node;
+
+	/* The zone's addresses may have changed even if the zone itself
+	 * is already entered, so always start the trie node afresh. */
+	node = zone_trie_find (zone -> name, 1);
+	if (!node)
+		return ISC_R_NOMEMORY;
+	if (node -> zone != zone) {
+		if (node -> zone)
+			dns_zone_dereference (&node -> zone, MDL);
+		dns_zone_reference (&node -> zone, zone, MDL);
+	}
+	zone_node_flush (node);
 
 	if (dns_zone_hash) {
 		dns_zone_hash_lookup (&tz,
@@ -685,6 +893,7 @@ isc_result_t dns_zone_lookup (struct dns_zone **zone, const char *name)
 		status = ISC_R_NOTFOUND;
 	else if ((*zone)->timeout && (*zone)->timeout < cur_time) {
 		dns_zone_hash_delete(dns_zone_hash, (*zone)->name, 0, MDL);
+		zone_trie_remove(*zone);
 		dns_zone_dereference(zone, MDL);
 		status = ISC_R_NOTFOUND;
 	} else
@@ -1197,15 +1406,121 @@ find_zone_start(dhcp_ddns_cb_t *ddns_cb, int direction)
 }
 #endif
 
-isc_result_t
-find_cached_zone(dhcp_ddns_cb_t *ddns_cb, int direction)
+/*
+ * Walk the trie for name and return the node of the closest enclosing
+ * zone, or NULL if no zone covers the name.  Dynamic zones that have
+ * timed out are dropped as we pass them.
+ */
+static struct dns_zone_node *
+zone_trie_closest(const char *name)
+{
+	const char *labels[DNS_ZONE_MAX_LABELS];
+	unsigned lens[DNS_ZONE_MAX_LABELS];
+	struct dns_zone_node *node, *found = NULL;
+	struct dns_zone *tz;
+	int i;
+
+	if (dns_zone_trie == NULL)
+		return (NULL);
+
+	i = zone_name_labels(name, labels, lens);
+	if (i < 0)
+		return (NULL);
+
+	node = dns_zone_trie;
+	for (;;) {
+		tz = node->zone;
+		if ((tz != NULL) && (tz->timeout != 0) &&
+		    (tz->timeout < cur_time)) {
+			if (dns_zone_hash)
+				dns_zone_hash_delete(dns_zone_hash,
+						     tz->name, 0, MDL);
+			dns_zone_dereference(&node->zone, MDL);
+			zone_node_flush(node);
+		}
+		if (node->zone != NULL)
+			found = node;
+
+		if (i-- == 0)
+			break;
+		node = zone_node_child(node, labels[i], lens[i]);
+		if (node == NULL)
+			break;
+	}
+
+	return (found);
+}
+
+/* Add the addresses from one of the zone's server option caches. */
+static void
+zone_node_add_ns(struct dns_zone_node *node, struct option_cache *oc,
+		 int family)
 {
-	isc_result_t status = ISC_R_NOTFOUND;
-	const char *np;
-	struct dns_zone *zone = NULL;
 	struct data_string nsaddrs;
 	struct in_addr zone_addr;
 	struct in6_addr zone_addr6;
+	unsigned ip, alen;
+
+	if (oc == NULL)
+		return;
+
+	/* Addresses that have to be looked up get re-evaluated now
+	 * and then, a plain list of addresses never changes. */
+	if ((oc->expression != NULL) &&
+	    ((node->ns_expiry == 0) ||
+	     (node->ns_expiry > cur_time + DNS_ZONE_NS_REFRESH)))
+		node->ns_expiry = cur_time + DNS_ZONE_NS_REFRESH;
+
+	memset(&nsaddrs, 0, sizeof(nsaddrs));
+	if (!evaluate_option_cache(&nsaddrs, NULL, NULL, NULL, NULL, NULL,
+				   &global_scope, oc, MDL))
+		return;
+
+	alen = (family == AF_INET) ? 4 : 16;
+	for (ip = 0;
+	     (node->ns_count < DHCP_MAXNS) && (ip + alen <= nsaddrs.len);
+	     ip += alen) {
+		if (family == AF_INET) {
+			memcpy(&zone_addr, &nsaddrs.data[ip], 4);
+			isc_sockaddr_fromin(&node->ns_addrs[node->ns_count],
+					    &zone_addr, NS_DEFAULTPORT);
+		} else {
+			memcpy(&zone_addr6, &nsaddrs.data[ip], 16);
+			isc_sockaddr_fromin6(&node->ns_addrs[node->ns_count],
+					     &zone_addr6, NS_DEFAULTPORT);
+		}
+		node->ns_count++;
+	}
+	data_string_forget(&nsaddrs, MDL);
+}
+
+/* (Re)build the nameserver address list for a node if needed. */
+static void
+zone_node_resolve(struct dns_zone_node *node)
+{
+	struct dns_zone *zone = node->zone;
+
+	if (node->ns_valid &&
+	    ((node->ns_expiry == 0) || (node->ns_expiry >= cur_time)))
+		return;
+
+	node->ns_count = 0;
+	node->ns_expiry = zone->timeout;
+
+	zone_node_add_ns(node, zone->primary, AF_INET);
+	zone_node_add_ns(node, zone->primary6, AF_INET6);
+	zone_node_add_ns(node, zone->secondary, AF_INET);
+	zone_node_add_ns(node, zone->secondary6, AF_INET6);
+
+	node->ns_valid = 1;
+}
+
+isc_result_t
+find_cached_zone(dhcp_ddns_cb_t *ddns_cb, int direction)
+{
+	const char *np;
+	struct dns_zone_node *node;
+	struct dns_zone *zone;
 	int ix;
 
 	if (direction == FIND_FORWARD) {
@@ -1220,131 +1535,36 @@ find_cached_zone(dhcp_ddns_cb_t *ddns_cb, int direction)
 	}
 
 	/*
-	 * For each subzone, try to find a cached zone.
+	 * Find the closest enclosing cached zone.
 	 */
-	for (;;) {
-		status = dns_zone_lookup(&zone, np);
-		if (status == ISC_R_SUCCESS)
-			break;
-
-		np = strchr(np, '.');
-		if (np == NULL)
-			break;
-		np++;
-	}
-
-	if (status != ISC_R_SUCCESS)
-		return (status);
+	node = zone_trie_closest(np);
+	if (node == NULL)
+		return (ISC_R_NOTFOUND);
+	zone = node->zone;
 
 	/* Make sure the zone is valid, we've already gotten
 	 * rid of expired dynamic zones.  Check to see if
 	 * we repudiated this zone.  If so give up.
 	 */
 	if ((zone->flags & DNS_ZONE_INACTIVE) != 0) {
-		dns_zone_dereference(&zone, MDL);
 		return (ISC_R_FAILURE);
 	}
 
 	/* Make sure the zone name will fit. */
 	if (strlen(zone->name) >= sizeof(ddns_cb->zone_name)) {
-		dns_zone_dereference(&zone, MDL);
 		return (ISC_R_NOSPACE);
 	}
 	strcpy((char *)&ddns_cb->zone_name[0], zone->name);
 
-	memset (&nsaddrs, 0, sizeof nsaddrs);
-	ix = 0;
-
-	if (zone->primary) {
-		if (evaluate_option_cache(&nsaddrs, NULL, NULL, NULL,
-					  NULL, NULL, &global_scope,
-					  zone->primary, MDL)) {
-			int ip = 0;
-			while (ix < DHCP_MAXNS) {
-				if (ip + 4 > nsaddrs.len)
-					break;
-				memcpy(&zone_addr, &nsaddrs.data[ip], 4);
-				isc_sockaddr_fromin(&ddns_cb->zone_addrs[ix],
-						    &zone_addr,
-						    NS_DEFAULTPORT);
-				ISC_LIST_APPEND(ddns_cb->zone_server_list,
-						&ddns_cb->zone_addrs[ix],
-						link);
-				ip += 4;
-				ix++;
-			}
-			data_string_forget(&nsaddrs, MDL);
-		}
-	}
-
-	if (zone->primary6) {
-		if (evaluate_option_cache(&nsaddrs, NULL, NULL, NULL,
-					  NULL, NULL, &global_scope,
-					  zone->primary6, MDL)) {
-			int ip = 0;
-			while (ix < DHCP_MAXNS) {
-				if (ip + 16 > nsaddrs.len)
-					break;
-				memcpy(&zone_addr6, &nsaddrs.data[ip], 16);
-				isc_sockaddr_fromin6(&ddns_cb->zone_addrs[ix],
-						    &zone_addr6,
-						    NS_DEFAULTPORT);
-				ISC_LIST_APPEND(ddns_cb->zone_server_list,
-						&ddns_cb->zone_addrs[ix],
-						link);
-				ip += 16;
-				ix++;
-			}
-			data_string_forget(&nsaddrs, MDL);
-		}
-	}
-
-	if (zone->secondary) {
-		if (evaluate_option_cache(&nsaddrs, NULL, NULL, NULL,
-					  NULL, NULL, &global_scope,
-					  zone->secondary, MDL)) {
-			int ip = 0;
-			while (ix < DHCP_MAXNS) {
-				if (ip + 4 > nsaddrs.len)
-					break;
-				memcpy(&zone_addr, &nsaddrs.data[ip], 4);
-				isc_sockaddr_fromin(&ddns_cb->zone_addrs[ix],
-						    &zone_addr,
-						    NS_DEFAULTPORT);
-				ISC_LIST_APPEND(ddns_cb->zone_server_list,
-						&ddns_cb->zone_addrs[ix],
-						link);
-				ip += 4;
-				ix++;
-			}
-			data_string_forget (&nsaddrs, MDL);
-		}
-	}
-
-	if (zone->secondary6) {
-		if (evaluate_option_cache(&nsaddrs, NULL, NULL, NULL,
-					  NULL, NULL, &global_scope,
-					  zone->secondary6, MDL)) {
-			int ip = 0;
-			while (ix < DHCP_MAXNS) {
-				if (ip + 16 > nsaddrs.len)
-					break;
-				memcpy(&zone_addr6, &nsaddrs.data[ip], 16);
-				isc_sockaddr_fromin6(&ddns_cb->zone_addrs[ix],
-						    &zone_addr6,
-						    NS_DEFAULTPORT);
-				ISC_LIST_APPEND(ddns_cb->zone_server_list,
-						&ddns_cb->zone_addrs[ix],
-						link);
-				ip += 16;
-				ix++;
-			}
-			data_string_forget (&nsaddrs, MDL);
-		}
+	zone_node_resolve(node);
+	for (ix = 0; ix < node->ns_count; ix++) {
+		ddns_cb->zone_addrs[ix] = node->ns_addrs[ix];
+		ISC_LINK_INIT(&ddns_cb->zone_addrs[ix], link);
+		ISC_LIST_APPEND(ddns_cb->zone_server_list,
+				&ddns_cb->zone_addrs[ix], link);
 	}
 
 	dns_zone_reference(&ddns_cb->zone, zone, MDL);
-	dns_zone_dereference (&zone, MDL);
 	return ISC_R_SUCCESS;
 }
 
@@ -35,6 +35,14 @@ struct icmp_state *icmp_state;
 static omapi_object_type_t *dhcp_type_icmp;
 static int no_icmp;
 
+/* Echo requests queued by icmp_echo_enqueue() and not yet sent. */
+#define ICMP_SEND_BATCH 64
+static struct icmp icmp_sendq [ICMP_SEND_BATCH];
+static struct sockaddr_in icmp_sendq_to [ICMP_SEND_BATCH];
+static int icmp_sendq_len;
+
+static void icmp_flush_timeout (void *);
+
 OMAPI_OBJECT_ALLOC (icmp_state, struct icmp_state, dhcp_type_icmp)
 
 #if defined (TRACING)
@@ -125,6 +133,19 @@ int icmp_readsocket (h)
 	return state -> socket;
 }
 
+static void icmp_echo_build (struct icmp *icmp, u_int16_t id, u_int16_t seq)
+{
+	icmp -> icmp_type = ICMP_ECHO;
+	icmp -> icmp_code = 0;
+	icmp -> icmp_cksum = 0;
+	icmp -> icmp_seq = seq;
+	icmp -> icmp_id = id;
+	memset (&icmp -> icmp_dun, 0, sizeof icmp -> icmp_dun);
+
+	icmp -> icmp_cksum = wrapsum (checksum ((unsigned char *)icmp,
+						sizeof *icmp, 0));
+}
+
 int icmp_echorequest (addr)
 	struct iaddr *addr;
 {
@@ -148,20 +169,12 @@ int icmp_echorequest (addr)
 	to.sin_port = 0; /* unused. */
 	memcpy (&to.sin_addr, addr -> iabuf, sizeof to.sin_addr); /* XXX */
 
-	icmp.icmp_type = ICMP_ECHO;
-	icmp.icmp_code = 0;
-	icmp.icmp_cksum = 0;
-	icmp.icmp_seq = 0;
 #if SIZEOF_STRUCT_IADDR_P == 8
-	icmp.icmp_id = (((u_int32_t)(u_int64_t)addr) ^
-  			(u_int32_t)(((u_int64_t)addr) >> 32));
+	icmp_echo_build (&icmp, (((u_int32_t)(u_int64_t)addr) ^
+				 (u_int32_t)(((u_int64_t)addr) >> 32)), 0);
 #else
-	icmp.icmp_id = (u_int32_t)addr;
+	icmp_echo_build (&icmp, (u_int32_t)addr, 0);
 #endif
-	memset (&icmp.icmp_dun, 0, sizeof icmp.icmp_dun);
-
-	icmp.icmp_cksum = wrapsum (checksum ((unsigned char *)&icmp,
-					     sizeof icmp, 0));
 
 #if defined (TRACING)
 	if (trace_playback ()) {
@@ -201,6 +214,133 @@ int icmp_echorequest (addr)
 	return 1;
 }
 
+/* Queue an ICMP Echo request with the given identifier and sequence
+   number.  Requests queued while we handle one batch of events are sent
+   together by icmp_flush(), which runs from a timeout that expires as
+   soon as we get back to the dispatch loop, or when the queue fills. */
+
+int icmp_echo_enqueue (struct iaddr *addr, u_int16_t id, u_int16_t seq)
+{
+	struct sockaddr_in *to;
+	struct icmp *icmp;
+	struct timeval tv;
+#if defined (TRACING)
+	trace_iov_t iov [2];
+	struct icmp trace_icmp;
+	isc_result_t status;
+#endif
+
+	if (no_icmp)
+		return 1;
+	if (!icmp_state)
+		log_fatal ("ICMP protocol used before initialization.");
+
+#if defined (TRACING)
+	if (trace_playback ()) {
+		char *buf = (char *)0;
+		unsigned buflen = 0;
+
+		/* Consume the ICMP event. */
+		status = trace_get_packet (&trace_icmp_output, &buflen, &buf);
+		if (status != ISC_R_SUCCESS)
+			log_error ("icmp_echo_enqueue: %s",
+				   isc_result_totext (status));
+		if (buf)
+			dfree (buf, MDL);
+		return 1;
+	}
+	if (trace_record ()) {
+		icmp_echo_build (&trace_icmp, id, seq);
+		iov [0].buf = (char *)addr;
+		iov [0].len = sizeof *addr;
+		iov [1].buf = (char *)&trace_icmp;
+		iov [1].len = sizeof trace_icmp;
+		trace_write_packet_iov (trace_icmp_output, 2, iov, MDL);
+	}
+#endif
+
+	if (icmp_sendq_len == ICMP_SEND_BATCH)
+		icmp_flush ();
+
+	to = &icmp_sendq_to [icmp_sendq_len];
+	memset (to, 0, sizeof *to);
+#ifdef HAVE_SA_LEN
+	to -> sin_len = sizeof *to;
+#endif
+	to -> sin_family = AF_INET;
+	memcpy (&to -> sin_addr, addr -> iabuf, sizeof to -> sin_addr);
+
+	icmp = &icmp_sendq [icmp_sendq_len];
+	icmp_echo_build (icmp, id, seq);
+
+	/* The first request in a batch arranges for the batch to be sent. */
+	if (icmp_sendq_len++ == 0) {
+		tv = cur_tv;
+		add_timeout (&tv, icmp_flush_timeout, icmp_state, 0, 0);
+	}
+	return 1;
+}
+
+static void icmp_flush_timeout (void *vp)
+{
+	icmp_flush ();
+}
+
+/* Send any queued ICMP Echo requests, using a single sendmmsg() call
+   where we can. */
+
+void icmp_flush (void)
+{
+	int i, status;
+#if defined (HAVE_SENDMMSG)
+	struct mmsghdr msgs [ICMP_SEND_BATCH];
+	struct iovec iov [ICMP_SEND_BATCH];
+#endif
+
+	if (icmp_sendq_len == 0)
+		return;
+	cancel_timeout (icmp_flush_timeout, icmp_state);
+
+#if defined (HAVE_SENDMMSG)
+	memset (msgs, 0, sizeof msgs);
+	for (i = 0; i < icmp_sendq_len; i++) {
+		iov [i].iov_base = &icmp_sendq [i];
+		iov [i].iov_len = sizeof icmp_sendq [i];
+		msgs [i].msg_hdr.msg_name = &icmp_sendq_to [i];
+		msgs [i].msg_hdr.msg_namelen = sizeof icmp_sendq_to [i];
+		msgs [i].msg_hdr.msg_iov = &iov [i];
+		msgs [i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* sendmmsg() stops at the first message it can't send, so log that
+	   one and carry on with the rest. */
+	for (i = 0; i < icmp_sendq_len; ) {
+		status = sendmmsg (icmp_state -> socket, &msgs [i],
+				   icmp_sendq_len - i, 0);
+		if (status > 0) {
+			i += status;
+			continue;
+		}
+		log_error ("icmp_echorequest %s: %m",
+			   inet_ntoa (icmp_sendq_to [i].sin_addr));
+		i++;
+	}
+#else
+	for (i = 0; i < icmp_sendq_len; i++) {
+		status = sendto (icmp_state -> socket,
+				 (char *)&icmp_sendq [i],
+				 sizeof icmp_sendq [i], 0,
+				 (struct sockaddr *)&icmp_sendq_to [i],
+				 sizeof icmp_sendq_to [i]);
+		if (status < 0)
+			log_error ("icmp_echorequest %s: %m",
+				   inet_ntoa (icmp_sendq_to [i].sin_addr));
+	}
+#endif
+
+	icmp_sendq_len = 0;
+}
+
 isc_result_t icmp_echoreply (h)
 	omapi_object_t *h;
 {
@@ -254,13 +394,13 @@ isc_result_t icmp_echoreply (h)
 			ia.len = htonl(ia.len);
 			iov [0].buf = (char *)&ia;
 			iov [0].len = sizeof ia;
-			iov [1].buf = (char *)icbuf;
+			iov [1].buf = (char *)icfrom;
 			iov [1].len = len;
 			trace_write_packet_iov (trace_icmp_input, 2, iov, MDL);
 			ia.len = ntohl(ia.len);
 		}
 #endif
-		(*state -> icmp_handler) (ia, icbuf, len);
+		(*state -> icmp_handler) (ia, (u_int8_t *)icfrom, len);
 	}
 	return ISC_R_SUCCESS;
 }
@@ -48,6 +48,13 @@
 #endif
 
 #if defined (USE_LPF_SEND) || defined (USE_LPF_RECEIVE)
+/* What to call the interface's socket when logging. */
+#if defined (USE_AF_XDP)
+#define lpf_kind(info)	((info) -> xdp != NULL ? "XDP" : "LPF")
+#else
+#define lpf_kind(info)	"LPF"
+#endif
+
 /* Reinitializes the specified interface after an address change.   This
    is not required for packet-filter APIs. */
 
@@ -63,6 +70,25 @@ void if_reinitialize_receive (info)
 	struct interface_info *info;
 {
 }
+
+#if defined(HAVE_RECVMMSG)
+/* Packets are read from the socket in batches of up to LPF_RECV_BATCH
+   with a single recvmmsg() call.   The batch hangs off the interface's
+   rbuf; rbuf_len is the number of packets read and rbuf_offset is the
+   next one to hand out, so got_one() keeps calling receive_packet()
+   until the batch is used up, just as it does for bpf buffers. */
+#define LPF_RECV_BATCH	16
+
+struct lpf_recv_batch {
+	struct mmsghdr msgs [LPF_RECV_BATCH];
+	struct iovec iov [LPF_RECV_BATCH];
+	unsigned char buf [LPF_RECV_BATCH][1536];
+#ifdef PACKET_AUXDATA
+	unsigned char cmsgbuf [LPF_RECV_BATCH]
+			      [CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+#endif
+};
+#endif /* HAVE_RECVMMSG */
 #endif
 
 /* Called by get_interface_list for each interface that's discovered.
@@ -138,8 +164,8 @@ void if_register_send (info)
 	info -> wfdesc = info -> rfdesc;
 #endif
 	if (!quiet_interface_discovery)
-		log_info ("Sending on   LPF/%s/%s%s%s",
-		      info -> name,
+		log_info ("Sending on   %s/%s/%s%s%s",
+		      lpf_kind (info), info -> name,
 		      print_hw_addr (info -> hw_address.hbuf [0],
 				     info -> hw_address.hlen - 1,
 				     &info -> hw_address.hbuf [1]),
@@ -151,6 +177,13 @@ void if_register_send (info)
 void if_deregister_send (info)
 	struct interface_info *info;
 {
+#if defined (USE_SEND_BATCH)
+	if_flush_send (info);
+	if (info -> tbuf != NULL) {
+		dfree (info -> tbuf, MDL);
+		info -> tbuf = NULL;
+	}
+#endif
 	/* don't need to close twice if we are using lpf for sending and
 	   receiving */
 #ifndef USE_LPF_RECEIVE
@@ -160,8 +193,8 @@ void if_deregister_send (info)
 #endif
 	info -> wfdesc = -1;
 	if (!quiet_interface_discovery)
-		log_info ("Disabling output on LPF/%s/%s%s%s",
-		      info -> name,
+		log_info ("Disabling output on %s/%s/%s%s%s",
+		      lpf_kind (info), info -> name,
 		      print_hw_addr (info -> hw_address.hbuf [0],
 				     info -> hw_address.hlen - 1,
 				     &info -> hw_address.hbuf [1]),
@@ -193,6 +226,28 @@ static void lpf_gen_filter_setup (struct interface_info *);
 void if_register_receive (info)
 	struct interface_info *info;
 {
+#if defined (USE_AF_XDP)
+	/* Use an AF_XDP socket if we were asked to and can... */
+	if (info -> flags & INTERFACE_XDP) {
+		if (if_register_xdp (info)) {
+			info -> rbuf_offset = 0;
+			info -> rbuf_len = 0;
+			if (!quiet_interface_discovery)
+				log_info ("Listening on XDP/%s/%s%s%s",
+					  info -> name,
+					  print_hw_addr (info -> hw_address.hbuf [0],
+							 info -> hw_address.hlen - 1,
+							 &info -> hw_address.hbuf [1]),
+					  (info -> shared_network ? "/" : ""),
+					  (info -> shared_network ?
+					   info -> shared_network -> name : ""));
+			return;
+		}
+		log_error ("Using LPF on %s instead.", info -> name);
+		info -> flags &= ~INTERFACE_XDP;
+	}
+#endif
+
 	/* Open a LPF device and hang it on this interface... */
 	info -> rfdesc = if_register_lpf (info);
 
@@ -209,6 +264,17 @@ void if_register_receive (info)
 	}
 #endif
 
+#if defined(HAVE_RECVMMSG)
+	if (info->rbuf == NULL) {
+		info->rbuf = dmalloc(sizeof(struct lpf_recv_batch), MDL);
+		if (info->rbuf == NULL)
+			log_fatal("No memory for %s receive batch.",
+				  info->name);
+	}
+	info->rbuf_max = LPF_RECV_BATCH;
+	info->rbuf_offset = 0;
+	info->rbuf_len = 0;
+#endif
 
 #if defined (HAVE_TR_SUPPORT)
 	if (info -> hw_address.hbuf [0] == HTYPE_IEEE802)
@@ -231,13 +297,29 @@ void if_register_receive (info)
 void if_deregister_receive (info)
 	struct interface_info *info;
 {
+	const char *kind = lpf_kind (info);
+
 	/* for LPF this is simple, packet filters are removed when sockets
 	   are closed */
+#if defined (USE_AF_XDP)
+	if (info -> xdp != NULL)
+		xdp_socket_close (&info -> xdp);
+	else
+#endif
 	close (info -> rfdesc);
 	info -> rfdesc = -1;
+#if defined(HAVE_RECVMMSG)
+	/* Anything still batched came from the socket we just closed. */
+	if (info->rbuf != NULL) {
+		dfree(info->rbuf, MDL);
+		info->rbuf = NULL;
+	}
+	info->rbuf_offset = 0;
+	info->rbuf_len = 0;
+#endif
 	if (!quiet_interface_discovery)
-		log_info ("Disabling input on LPF/%s/%s%s%s",
-			  info -> name,
+		log_info ("Disabling input on %s/%s/%s%s%s",
+			  kind, info -> name,
 			  print_hw_addr (info -> hw_address.hbuf [0],
 					 info -> hw_address.hlen - 1,
 					 &info -> hw_address.hbuf [1]),
@@ -330,6 +412,94 @@ static void lpf_tr_filter_setup (info)
 #endif /* USE_LPF_RECEIVE */
 
 #ifdef USE_LPF_SEND
+#if defined (USE_SEND_BATCH)
+/* While a send batch is open, send_packet() assembles each frame in a
+   slot of the interface's tbuf instead of writing it, and
+   if_flush_send() hands them all to the kernel in one sendmmsg().   An
+   AF_XDP socket already holds its frames in the TX ring, so for that we
+   only count them and put off waking the kernel. */
+#define LPF_SEND_BATCH	32
+
+struct lpf_send_batch {
+	struct mmsghdr msgs [LPF_SEND_BATCH];
+	struct iovec iov [LPF_SEND_BATCH];
+	double buf [LPF_SEND_BATCH][1536 / sizeof (double)];
+};
+
+/* Returns the buffer for the next frame in the batch. */
+static unsigned char *lpf_send_slot (struct interface_info *interface)
+{
+	struct lpf_send_batch *sb;
+
+	if (interface -> tbuf == NULL) {
+		interface -> tbuf = dmalloc (sizeof *sb, MDL);
+		if (interface -> tbuf == NULL)
+			log_fatal ("No memory for %s send batch.",
+				   interface -> name);
+	}
+	sb = (struct lpf_send_batch *)interface -> tbuf;
+	return (unsigned char *)sb -> buf [interface -> tbuf_len];
+}
+
+/* Adds the len bytes at frame, which is in the slot lpf_send_slot()
+   returned, to the batch. */
+static void lpf_send_queue (struct interface_info *interface,
+			    unsigned char *frame, unsigned len)
+{
+	struct lpf_send_batch *sb;
+	struct msghdr *msg;
+	unsigned i;
+
+	sb = (struct lpf_send_batch *)interface -> tbuf;
+	i = interface -> tbuf_len++;
+	sb -> iov [i].iov_base = frame;
+	sb -> iov [i].iov_len = len;
+	msg = &sb -> msgs [i].msg_hdr;
+	memset (msg, 0, sizeof *msg);
+	msg -> msg_iov = &sb -> iov [i];
+	msg -> msg_iovlen = 1;
+
+	if (interface -> tbuf_len == LPF_SEND_BATCH)
+		if_flush_send (interface);
+}
+
+/* Send the frames queued on the interface. */
+void if_flush_send (interface)
+	struct interface_info *interface;
+{
+	struct lpf_send_batch *sb;
+	unsigned count = interface -> tbuf_len;
+	unsigned i;
+	int status;
+
+	if (count == 0)
+		return;
+	interface -> tbuf_len = 0;
+
+#if defined (USE_AF_XDP)
+	if (interface -> xdp != NULL) {
+		if (xdp_tx_kick (interface -> xdp) < 0)
+			log_error ("send_packet: %m");
+		return;
+	}
+#endif
+
+	/* sendmmsg() stops at the first frame it can't send, so log that
+	   one and carry on with the rest. */
+	sb = (struct lpf_send_batch *)interface -> tbuf;
+	for (i = 0; i < count; ) {
+		status = sendmmsg (interface -> wfdesc, &sb -> msgs [i],
+				   count - i, 0);
+		if (status > 0) {
+			i += status;
+			continue;
+		}
+		log_error ("send_packet: %m");
+		i++;
+	}
+}
+#endif /* USE_SEND_BATCH */
+
 ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	struct interface_info *interface;
 	struct packet *packet;
@@ -339,30 +509,63 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	struct sockaddr_in *to;
 	struct hardware *hto;
 {
-	unsigned hbufp = 0, ibufp = 0;
-	double hh [16];
+	unsigned ibufp = 0;
 	double ih [1536 / sizeof (double)];
 	unsigned char *buf = (unsigned char *)ih;
+	unsigned length;
 	int result;
 	int fudge;
 
-	if (!strcmp (interface -> name, "fallback"))
+	if (interface -> flags & INTERFACE_FALLBACK)
 		return send_fallback (interface, packet, raw,
 				      len, from, to, hto);
 
 	if (hto == NULL && interface->anycast_mac_addr.hlen)
 		hto = &interface->anycast_mac_addr;
 
+#if defined (USE_AF_XDP)
+	/* Build the packet straight into a frame of the socket's UMEM. */
+	if (interface -> xdp != NULL) {
+		buf = xdp_tx_frame (interface -> xdp);
+		if (buf == NULL) {
+			errno = ENOBUFS;
+			log_error ("send_packet: %m");
+			return -1;
+		}
+	} else
+#endif
+#if defined (USE_SEND_BATCH)
+	if (send_batching)
+		buf = lpf_send_slot (interface);
+#endif
+
 	/* Assemble the headers... */
-	assemble_hw_header (interface, (unsigned char *)hh, &hbufp, hto);
-	fudge = hbufp % 4;	/* IP header must be word-aligned. */
-	memcpy (buf + fudge, (unsigned char *)hh, hbufp);
-	ibufp = hbufp + fudge;
-	assemble_udp_ip_header (interface, buf, &ibufp, from.s_addr,
-				to -> sin_addr.s_addr, to -> sin_port,
-				(unsigned char *)raw, len);
+	fudge = assemble_headers (interface, buf, &ibufp, hto, from.s_addr,
+				  to -> sin_addr.s_addr, to -> sin_port,
+				  (unsigned char *)raw, len);
 	memcpy (buf + ibufp, raw, len);
-	result = write(interface->wfdesc, buf + fudge, ibufp + len - fudge);
+	length = ibufp + len - fudge;
+
+#if defined (USE_AF_XDP)
+	if (interface -> xdp != NULL) {
+		xdp_tx_queue (interface -> xdp, buf, fudge, length);
+#if defined (USE_SEND_BATCH)
+		if (send_batching) {
+			if (++interface -> tbuf_len == LPF_SEND_BATCH)
+				if_flush_send (interface);
+			return length;
+		}
+#endif
+		result = xdp_tx_kick (interface -> xdp) < 0 ? -1 : length;
+	} else
+#endif
+#if defined (USE_SEND_BATCH)
+	if (send_batching) {
+		lpf_send_queue (interface, buf + fudge, length);
+		return length;
+	} else
+#endif
+	result = write(interface->wfdesc, buf + fudge, length);
 	if (result < 0)
 		log_error ("send_packet: %m");
 	return result;
@@ -370,47 +573,60 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 #endif /* USE_LPF_SEND */
 
 #ifdef USE_LPF_RECEIVE
-ssize_t receive_packet (interface, buf, len, from, hfrom)
-	struct interface_info *interface;
-	unsigned char *buf;
-	size_t len;
-	struct sockaddr_in *from;
-	struct hardware *hfrom;
+/* Strip the link, IP and UDP headers from a received frame and copy
+   the payload into buf.   Returns the payload length, or zero if the
+   packet should be ignored. */
+static ssize_t lpf_decode_frame (struct interface_info *interface,
+				 unsigned char *ibuf, int length,
+				 int csum_ready, unsigned char *buf,
+				 struct sockaddr_in *from,
+				 struct hardware *hfrom)
 {
-	int length = 0;
 	int offset = 0;
-	int csum_ready = 1;
-	unsigned char ibuf [1536];
 	unsigned bufix = 0;
 	unsigned paylen;
-	struct iovec iov = {
-		.iov_base = ibuf,
-		.iov_len = sizeof ibuf,
-	};
-#ifdef PACKET_AUXDATA
-	/*
-	 * We only need cmsgbuf if we are getting the aux data and we
-	 * only get the auxdata if it is actually defined
-	 */
-	unsigned char cmsgbuf[CMSG_LEN(sizeof(struct tpacket_auxdata))];
-	struct msghdr msg = {
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-		.msg_control = cmsgbuf,
-		.msg_controllen = sizeof(cmsgbuf),
-	};
-#else
-	struct msghdr msg = {
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-		.msg_control = NULL,
-		.msg_controllen = 0,
-	};
-#endif /* PACKET_AUXDATA */
 
-	length = recvmsg (interface->rfdesc, &msg, 0);
-	if (length <= 0)
-		return length;
+	bufix = 0;
+	/* Decode the physical header... */
+	offset = decode_hw_header (interface, ibuf, bufix, hfrom);
+
+	/* If a physical layer checksum failed (dunno of any
+	   physical layer that supports this, but WTH), skip this
+	   packet. */
+	if (offset < 0) {
+		return 0;
+	}
+
+	bufix += offset;
+	length -= offset;
+
+	/* Decode the IP and UDP headers... */
+	offset = decode_udp_ip_header (interface, ibuf, bufix, from,
+				       (unsigned)length, &paylen, csum_ready);
+
+	/* If the IP or UDP checksum was bad, skip the packet... */
+	if (offset < 0)
+		return 0;
+
+	bufix += offset;
+	length -= offset;
+
+	if (length < paylen)
+		log_fatal("Internal inconsistency at %s:%d.", MDL);
+
+	/* Copy out the data in the packet... */
+	memcpy(buf, &ibuf[bufix], paylen);
+	return paylen;
+}
+
+/* Decode a packet read off the LPF socket, as lpf_decode_frame(). */
+static ssize_t lpf_decode_packet (struct interface_info *interface,
+				  struct msghdr *msg, int length,
+				  unsigned char *buf,
+				  struct sockaddr_in *from,
+				  struct hardware *hfrom)
+{
+	int csum_ready = 1;
 
 #ifdef PACKET_AUXDATA
 	{
@@ -433,7 +649,7 @@ ssize_t receive_packet (interface, buf, len, from, hfrom)
 	 *  checksum offloading is enabled on the interface.  */
 	struct cmsghdr *cmsg;
 
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_PACKET &&
 		    cmsg->cmsg_type == PACKET_AUXDATA) {
 			struct tpacket_auxdata *aux = (void *)CMSG_DATA(cmsg);
@@ -452,37 +668,149 @@ ssize_t receive_packet (interface, buf, len, from, hfrom)
 	}
 #endif /* PACKET_AUXDATA */
 
-	bufix = 0;
-	/* Decode the physical header... */
-	offset = decode_hw_header (interface, ibuf, bufix, hfrom);
+	return lpf_decode_frame(interface, msg->msg_iov->iov_base, length,
+				csum_ready, buf, from, hfrom);
+}
 
-	/* If a physical layer checksum failed (dunno of any
-	   physical layer that supports this, but WTH), skip this
-	   packet. */
-	if (offset < 0) {
-		return 0;
+#if defined(HAVE_RECVMMSG)
+static ssize_t lpf_receive_batch (struct interface_info *interface,
+				  unsigned char *buf,
+				  struct sockaddr_in *from,
+				  struct hardware *hfrom)
+{
+	struct lpf_recv_batch *rb = (struct lpf_recv_batch *)interface->rbuf;
+	struct msghdr *msg;
+	ssize_t result;
+	int count, i;
+
+	/* If the last batch has been used up, read a new one.   We are
+	   only called when the socket is readable, so wait for the first
+	   packet but take just those already queued behind it. */
+	if (interface->rbuf_offset == interface->rbuf_len) {
+		interface->rbuf_offset = 0;
+		interface->rbuf_len = 0;
+
+		for (i = 0; i < LPF_RECV_BATCH; i++) {
+			rb->iov[i].iov_base = rb->buf[i];
+			rb->iov[i].iov_len = sizeof rb->buf[i];
+
+			msg = &rb->msgs[i].msg_hdr;
+			memset(msg, 0, sizeof *msg);
+			msg->msg_iov = &rb->iov[i];
+			msg->msg_iovlen = 1;
+#ifdef PACKET_AUXDATA
+			msg->msg_control = rb->cmsgbuf[i];
+			msg->msg_controllen = sizeof rb->cmsgbuf[i];
+#endif
+		}
+
+		count = recvmmsg(interface->rfdesc, rb->msgs, LPF_RECV_BATCH,
+				 MSG_WAITFORONE, NULL);
+		if (count <= 0)
+			return count;
+		interface->rbuf_len = count;
 	}
 
-	bufix += offset;
-	length -= offset;
+	/* Hand out the next packet that survives decoding.   A packet that
+	   gets dropped here mustn't strand the rest of the batch, since
+	   got_one() stops reading when we return zero. */
+	result = 0;
+	while (result == 0 && interface->rbuf_offset < interface->rbuf_len) {
+		i = interface->rbuf_offset++;
+		if (rb->msgs[i].msg_len == 0)
+			continue;
+		result = lpf_decode_packet(interface, &rb->msgs[i].msg_hdr,
+					   (int)rb->msgs[i].msg_len,
+					   buf, from, hfrom);
+	}
+	return result;
+}
+#endif /* HAVE_RECVMMSG */
+
+#if defined (USE_AF_XDP)
+/* Packets are decoded where they sit in the socket's receive ring.
+   As with a recvmmsg() batch, rbuf_len is the number of packets that
+   were waiting when we looked and rbuf_offset is the number handed out,
+   so that got_one() comes back for the rest.
+
+   AF_XDP doesn't tell us whether the kernel left the UDP checksum for
+   the hardware to fill in, as a sender on the same host may, so it
+   isn't checked; the IP header checksum still is. */
+static ssize_t lpf_receive_xdp (struct interface_info *interface,
+				unsigned char *buf,
+				struct sockaddr_in *from,
+				struct hardware *hfrom)
+{
+	struct xdp_socket *xs = interface->xdp;
+	unsigned char *frame;
+	unsigned length;
+	ssize_t result;
+
+	if (interface->rbuf_offset == interface->rbuf_len) {
+		interface->rbuf_offset = 0;
+		interface->rbuf_len = xdp_rx_pending(xs);
+	}
 
-	/* Decode the IP and UDP headers... */
-	offset = decode_udp_ip_header (interface, ibuf, bufix, from,
-				       (unsigned)length, &paylen, csum_ready);
+	result = 0;
+	while (result == 0 && interface->rbuf_offset < interface->rbuf_len) {
+		interface->rbuf_offset++;
+		frame = xdp_rx_peek(xs, &length);
+		result = lpf_decode_frame(interface, frame, (int)length, 0,
+					  buf, from, hfrom);
+		xdp_rx_release(xs);
+	}
+	return result;
+}
+#endif /* USE_AF_XDP */
 
-	/* If the IP or UDP checksum was bad, skip the packet... */
-	if (offset < 0)
-		return 0;
+ssize_t receive_packet (interface, buf, len, from, hfrom)
+	struct interface_info *interface;
+	unsigned char *buf;
+	size_t len;
+	struct sockaddr_in *from;
+	struct hardware *hfrom;
+{
+	int length = 0;
+	unsigned char ibuf [1536];
+	struct iovec iov = {
+		.iov_base = ibuf,
+		.iov_len = sizeof ibuf,
+	};
+#ifdef PACKET_AUXDATA
+	/*
+	 * We only need cmsgbuf if we are getting the aux data and we
+	 * only get the auxdata if it is actually defined
+	 */
+	unsigned char cmsgbuf[CMSG_LEN(sizeof(struct tpacket_auxdata))];
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsgbuf,
+		.msg_controllen = sizeof(cmsgbuf),
+	};
+#else
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = NULL,
+		.msg_controllen = 0,
+	};
+#endif /* PACKET_AUXDATA */
 
-	bufix += offset;
-	length -= offset;
+#if defined (USE_AF_XDP)
+	if (interface->xdp != NULL)
+		return lpf_receive_xdp(interface, buf, from, hfrom);
+#endif
+#if defined(HAVE_RECVMMSG)
+	if (interface->rbuf != NULL)
+		return lpf_receive_batch(interface, buf, from, hfrom);
+#endif
 
-	if (length < paylen)
-		log_fatal("Internal inconsistency at %s:%d.", MDL);
+	length = recvmsg (interface->rfdesc, &msg, 0);
+	if (length <= 0)
+		return length;
 
-	/* Copy out the data in the packet... */
-	memcpy(buf, &ibuf[bufix], paylen);
-	return paylen;
+	return lpf_decode_packet(interface, &msg, length, buf, from, hfrom);
 }
 
 int can_unicast_without_arp (ip)
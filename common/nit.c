@@ -292,7 +292,7 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	struct sockaddr_in foo;
 	int result;
 
-	if (!strcmp (interface -> name, "fallback"))
+	if (interface -> flags & INTERFACE_FALLBACK)
 		return send_fallback (interface, packet, raw,
 				      len, from, to, hto);
 
@@ -30,6 +30,7 @@
 #include "dhcpd.h"
 #include <omapip/omapip_p.h>
 #include <limits.h>
+#include <strings.h>
 
 struct option *vendor_cfg_option;
 
@@ -43,6 +44,20 @@ static int prepare_option_buffer(struct universe *universe, struct buffer *bp,
 				 unsigned char *buffer, unsigned length,
 				 unsigned code, int terminatep,
 				 struct option_cache **opp);
+static int concat_option_buffer(struct option_cache *op,
+				const unsigned char *buffer, unsigned length);
+static int index_options(struct packet *packet);
+static void decode_pending_option(struct option_state *options,
+				  unsigned code);
+
+/* If set, parse_options() only notes where each option is, and decodes
+   it when it's first looked up. */
+int lazy_option_decode = 1;
+
+#define option_pending(options, universe, code)			\
+	((options)->pending != NULL &&					\
+	 (options)->pending->universe == (universe) &&			\
+	 (code) < 256 && (options)->pending->first[(code)] != 0)
 
 /* Parse all available options out of the specified packet. */
 /* Note, the caller is responsible for allocating packet->options. */
@@ -57,6 +72,14 @@ int parse_options (packet)
 		return 1;
 	}
 
+	/* Packets that can't be indexed, such as malformed ones, are
+	   parsed the usual way so they're dealt with as they always
+	   were. */
+	if (lazy_option_decode && index_options (packet)) {
+		packet -> options_valid = 1;
+		return 1;
+	}
+
 	/* Go through the options field, up to the end of the packet
 	   or the End field. */
 	if (!parse_option_buffer (packet -> options,
@@ -231,27 +254,12 @@ int parse_option_buffer (options, buffer, length, universe)
 		} else if (universe->concat_duplicates) {
 			/* If we do have an option either concat with
 			   what is there ...*/
-			struct data_string new;
-			memset(&new, 0, sizeof new);
-			if (!buffer_allocate(&new.buffer, op->data.len + len,
-					     MDL)) {
-				log_error("parse_option_buffer: No memory.");
+			if (!concat_option_buffer(op, bp->data + offset,
+						  len)) {
 				buffer_dereference(&bp, MDL);
 				option_dereference(&option, MDL);
 				return (0);
 			}
-			/* Copy old option to new data object. */
-			memcpy(new.buffer->data, op->data.data,
-			       op->data.len);
-			/* Concat new option behind old. */
-			memcpy(new.buffer->data + op->data.len,
-			       bp->data + offset, len);
-			new.len = op->data.len + len;
-			new.data = new.buffer->data;
-			/* Save new concat'd object. */
-			data_string_forget(&op->data, MDL);
-			data_string_copy(&op->data, &new, MDL);
-			data_string_forget(&new, MDL);
 		} else  {
 			/* ... or we must append this statement onto the
 			 * end of the list.
@@ -284,6 +292,220 @@ int parse_option_buffer (options, buffer, length, universe)
 	return (1);
 }
 
+/* Add a piece of an option split by RFC 3396 to the end of what we have
+   of it so far. */
+static int
+concat_option_buffer(struct option_cache *op, const unsigned char *buffer,
+		     unsigned length)
+{
+	struct data_string new;
+
+	memset(&new, 0, sizeof new);
+	if (!buffer_allocate(&new.buffer, op->data.len + length, MDL)) {
+		log_error("parse_option_buffer: No memory.");
+		return (0);
+	}
+	/* Copy old option to new data object. */
+	memcpy(new.buffer->data, op->data.data, op->data.len);
+	/* Concat new option behind old. */
+	memcpy(new.buffer->data + op->data.len, buffer, length);
+	new.len = op->data.len + length;
+	new.data = new.buffer->data;
+	/* Save new concat'd object. */
+	data_string_forget(&op->data, MDL);
+	data_string_copy(&op->data, &new, MDL);
+	data_string_forget(&new, MDL);
+	return (1);
+}
+
+/* Note where each option in the length bytes at base in the index's
+   buffer is.   last[] holds the last entry of each code so far, so that
+   the pieces of an option are chained in the order RFC 3396 says to
+   put them together in.   Returns zero if the options are malformed or
+   there are too many of them to index. */
+static int
+index_option_area(struct option_index *ix, unsigned char *last,
+		  unsigned base, unsigned length, unsigned *count)
+{
+	const unsigned char *buffer = ix->buffer->data + base;
+	unsigned offset, code, len, e;
+
+	for (offset = 0;
+	     offset < length && (code = buffer[offset]) != DHO_END; ) {
+		offset++;
+		if (code == DHO_PAD)
+			continue;
+		if (offset == length)
+			return (0);
+		len = buffer[offset++];
+		if (offset + len > length || *count == OPTION_INDEX_MAX)
+			return (0);
+
+		e = (*count)++;
+		ix->entry[e].offset = base + offset;
+		ix->entry[e].len = len;
+		ix->entry[e].next = 0;
+		if (last[code] != 0)
+			ix->entry[last[code] - 1].next = e + 1;
+		else
+			ix->first[code] = e + 1;
+		last[code] = e + 1;
+		offset += len;
+	}
+	return (1);
+}
+
+/* Index the options of a packet instead of parsing them: copy the
+   options field, and the file and sname fields if the overload option
+   says they hold options too, and note where each option is.   Options
+   that encapsulate other spaces are decoded straight away, since the
+   server looks at the relay agent options directly.   Returns zero, leaving the
+   packet's options alone, if the options can't be indexed. */
+static int
+index_options(struct packet *packet)
+{
+	struct option_index *ix;
+	struct option *option;
+	unsigned char last[256];
+	unsigned length, total, count = 0, overload = 0, e;
+	int i;
+
+	/* Options already in the state would have to be merged with these,
+	   so leave that to parse_option_buffer(). */
+	if (packet->options->pending != NULL ||
+	    packet->options->universes[dhcp_universe.index] != NULL ||
+	    packet->packet_length < DHCP_FIXED_NON_UDP + 4)
+		return (0);
+	length = packet->packet_length - DHCP_FIXED_NON_UDP - 4;
+	total = length + sizeof(packet->raw->file) +
+		sizeof(packet->raw->sname);
+
+	ix = dmalloc(sizeof(*ix), MDL);
+	if (ix == NULL)
+		return (0);
+	if (!buffer_allocate(&ix->buffer, total, MDL)) {
+		dfree(ix, MDL);
+		return (0);
+	}
+	ix->universe = &dhcp_universe;
+	memcpy(ix->buffer->data, &packet->raw->options[4], length);
+	memset(last, 0, sizeof(last));
+	if (!index_option_area(ix, last, 0, length, &count))
+		goto fail;
+
+	/* The overload option is the first byte of all its pieces. */
+	for (e = ix->first[DHO_DHCP_OPTION_OVERLOAD]; e != 0;
+	     e = ix->entry[e - 1].next) {
+		if (ix->entry[e - 1].len != 0) {
+			overload = ix->buffer->data[ix->entry[e - 1].offset];
+			break;
+		}
+	}
+	if (overload & 1) {
+		memcpy(ix->buffer->data + length, packet->raw->file,
+		       sizeof(packet->raw->file));
+		if (!index_option_area(ix, last, length,
+				       sizeof(packet->raw->file), &count))
+			goto fail;
+		length += sizeof(packet->raw->file);
+	}
+	if (overload & 2) {
+		memcpy(ix->buffer->data + length, packet->raw->sname,
+		       sizeof(packet->raw->sname));
+		if (!index_option_area(ix, last, length,
+				       sizeof(packet->raw->sname), &count))
+			goto fail;
+	}
+
+	/* The options that encapsulate other spaces are the ones that
+	   are those spaces' enc_opt, as cons_options() knows. */
+	packet->options->pending = ix;
+	for (i = 0; i < universe_count; i++) {
+		option = universes[i]->enc_opt;
+		if (option != NULL && option->universe == &dhcp_universe &&
+		    option->code < 256 && ix->first[option->code] != 0)
+			decode_pending_option(packet->options, option->code);
+	}
+	return (1);
+
+      fail:
+	free_option_index(&ix);
+	return (0);
+}
+
+/* Decode the option with the given code from the index it's waiting in,
+   the way parse_option_buffer() would have. */
+static void
+decode_pending_option(struct option_state *options, unsigned code)
+{
+	struct option_index *ix = options->pending;
+	struct universe *universe = ix->universe;
+	struct option *option = NULL;
+	struct option_cache *op;
+	unsigned char *data;
+	unsigned e, len;
+
+	/* It's not pending any more, whatever happens. */
+	e = ix->first[code];
+	ix->first[code] = 0;
+
+	option_code_hash_lookup(&option, universe->code_hash, &code, 0, MDL);
+	for (; e != 0; e = ix->entry[e - 1].next) {
+		data = ix->buffer->data + ix->entry[e - 1].offset;
+		len = ix->entry[e - 1].len;
+
+		if (option &&
+		    (option->format[0] == 'e' || option->format[0] == 'E')) {
+			(void) parse_encapsulated_suboptions(options, option,
+							     data, len,
+							     universe, NULL);
+		}
+
+		if (code == DHO_HOST_NAME && len == 0) {
+			log_debug ("Ignoring empty DHO_HOST_NAME option");
+			continue;
+		}
+
+		op = lookup_option(universe, options, code);
+		if (op == NULL) {
+			if (save_option_buffer(universe, options, ix->buffer,
+					       data, len, code, 1) == 0) {
+				log_error("decode_pending_option: "
+					  "save_option_buffer failed");
+				break;
+			}
+		} else if (!concat_option_buffer(op, data, len))
+			break;
+	}
+	option_dereference(&option, MDL);
+}
+
+/* Decode every option still waiting in the index, for the functions that
+   need to see all of them. */
+void
+decode_pending_options(struct option_state *options)
+{
+	unsigned code;
+
+	if (options == NULL || options->pending == NULL)
+		return;
+	for (code = 0; code < 256; code++)
+		if (options->pending->first[code] != 0)
+			decode_pending_option(options, code);
+	free_option_index(&options->pending);
+}
+
+void
+free_option_index(struct option_index **ixp)
+{
+	struct option_index *ix = *ixp;
+
+	*ixp = NULL;
+	if (ix->buffer != NULL)
+		buffer_dereference(&ix->buffer, MDL);
+	dfree(ix, MDL);
+}
+
 /* If an option in an option buffer turns out to be an encapsulation,
    figure out what to do.   If we don't know how to de-encapsulate it,
    or it's not well-formed, return zero; otherwise, return 1, indicating
@@ -527,6 +749,33 @@ int fqdn_universe_decode (struct option_state *options,
 	return 1;
 }
 
+#define PRIORITY_COUNT 300
+
+/* The codes cons_options() sends when the client doesn't ask for any in
+   particular, collected by add_priority_option(). */
+struct priority_list {
+	unsigned *list;
+	int *len;
+	unsigned min, max;	/* Only codes from min up to max. */
+};
+
+static void
+add_priority_option(struct option_cache *oc, struct packet *packet,
+		    struct lease *lease, struct client_state *client_state,
+		    struct option_state *in_options,
+		    struct option_state *cfg_options,
+		    struct binding_scope **scope,
+		    struct universe *u, void *stuff)
+{
+	struct priority_list *pl = stuff;
+	unsigned code = oc->option->code;
+
+	if (code >= pl->min && code < pl->max &&
+	    *pl->len < PRIORITY_COUNT &&
+	    code != DHO_DHCP_AGENT_OPTIONS)
+		pl->list[(*pl->len)++] = code;
+}
+
 /*
  * Load all options into a buffer, and then split them out into the three
  * separate fields in the dhcp packet (options, file, and sname) where
@@ -543,7 +792,6 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 	     int overload_avail, int terminate, int bootpp,
 	     struct data_string *prl, const char *vuname)
 {
-#define PRIORITY_COUNT 300
 	unsigned priority_list[PRIORITY_COUNT];
 	int priority_len;
 	unsigned char buffer[4096], agentopts[1024];
@@ -554,12 +802,15 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 	int i;
 	struct option_cache *op;
 	struct data_string ds;
-	pair pp, *hash;
+	struct priority_list pl;
 	int overload_used = 0;
 	int of1 = 0, of2 = 0;
 
 	memset(&ds, 0, sizeof ds);
 
+	/* The options to send are looked at all together below. */
+	decode_pending_options(cfg_options);
+
 	/*
 	 * If there's a Maximum Message Size option in the incoming packet
 	 * and no alternate maximum message size has been specified, or
@@ -748,21 +999,15 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 		 * it's slightly more general to do it this way,
 		 * taking the 1Q99 DHCP futures work into account.
 		 */
+		pl.list = priority_list;
+		pl.len = &priority_len;
 		if (cfg_options->site_code_min) {
-		    for (i = 0; i < OPTION_HASH_SIZE; i++) {
-			hash = cfg_options->universes[dhcp_universe.index];
-			if (hash) {
-			    for (pp = hash[i]; pp; pp = pp->cdr) {
-				op = (struct option_cache *)(pp->car);
-				if (op->option->code <
-				     cfg_options->site_code_min &&
-				    priority_len < PRIORITY_COUNT &&
-				    op->option->code != DHO_DHCP_AGENT_OPTIONS)
-					priority_list[priority_len++] =
-						op->option->code;
-			    }
-			}
-		    }
+			pl.min = 0;
+			pl.max = cfg_options->site_code_min;
+			option_space_foreach(inpacket, lease, client_state,
+					     in_options, cfg_options, scope,
+					     &dhcp_universe, &pl,
+					     add_priority_option);
 		}
 
 		/*
@@ -770,19 +1015,12 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 		 * is no site option space, we'll be cycling through the
 		 * dhcp option space.
 		 */
-		for (i = 0; i < OPTION_HASH_SIZE; i++) {
-		    hash = cfg_options->universes[cfg_options->site_universe];
-		    if (hash != NULL)
-			for (pp = hash[i]; pp; pp = pp->cdr) {
-				op = (struct option_cache *)(pp->car);
-				if (op->option->code >=
-				     cfg_options->site_code_min &&
-				    priority_len < PRIORITY_COUNT &&
-				    op->option->code != DHO_DHCP_AGENT_OPTIONS)
-					priority_list[priority_len++] =
-						op->option->code;
-			}
-		}
+		pl.min = cfg_options->site_code_min;
+		pl.max = UINT_MAX;
+		option_space_foreach(inpacket, lease, client_state,
+				     in_options, cfg_options, scope,
+				     universes[cfg_options->site_universe],
+				     &pl, add_priority_option);
 
 		/*
 		 * Put any spaces that are encapsulated on the list,
@@ -2477,6 +2715,9 @@ struct option_cache *lookup_hashed_option (universe, options, code)
 	pair bptr;
 	pair *hash;
 
+	if (option_pending (options, universe, code))
+		decode_pending_option (options, code);
+
 	/* Make sure there's a hash table. */
 	if (universe -> index >= options -> universe_count ||
 	    !(options -> universes [universe -> index]))
@@ -2794,12 +3035,18 @@ save_hashed_option(struct universe *universe, struct option_state *options,
 {
 	int hashix;
 	pair bptr;
-	pair *hash = options -> universes [universe -> index];
+	pair *hash;
 	struct option_cache **ocloc;
 
 	if (oc -> refcnt == 0)
 		abort ();
 
+	/* Decode any of the same option still waiting, so that it's
+	   replaced or appended to as it would have been. */
+	if (option_pending (options, universe, oc -> option -> code))
+		decode_pending_option (options, oc -> option -> code);
+	hash = options -> universes [universe -> index];
+
 	/* Compute the hash. */
 	hashix = compute_option_hash (oc -> option -> code);
 
@@ -2877,6 +3124,9 @@ void delete_hashed_option (universe, options, code)
 	pair bptr, prev = (pair)0;
 	pair *hash = options -> universes [universe -> index];
 
+	if (option_pending (options, universe, code))
+		options -> pending -> first [code] = 0;
+
 	/* There may not be any options in this space. */
 	if (!hash)
 		return;
@@ -3217,6 +3467,9 @@ int hashed_option_space_encapsulate (result, packet, lease, client_state,
 	if (universe -> index >= cfg_options -> universe_count)
 		return 0;
 
+	if (cfg_options -> pending &&
+	    cfg_options -> pending -> universe == universe)
+		decode_pending_options (cfg_options);
 	hash = cfg_options -> universes [universe -> index];
 	if (!hash)
 		return 0;
@@ -3804,6 +4057,8 @@ void hashed_option_space_foreach (struct packet *packet, struct lease *lease,
 	if (cfg_options -> universe_count <= u -> index)
 		return;
 
+	if (cfg_options -> pending && cfg_options -> pending -> universe == u)
+		decode_pending_options (cfg_options);
 	hash = cfg_options -> universes [u -> index];
 	if (!hash)
 		return;
@@ -3818,6 +4073,320 @@ void hashed_option_space_foreach (struct packet *packet, struct lease *lease,
 	}
 }
 
+/* Option tables whose options have all been let go of are kept here,
+   cleared, for the next option state to use. */
+static struct option_table *free_option_tables;
+
+static struct option_table *
+new_option_table(const char *file, int line)
+{
+	struct option_table *table;
+
+	if (free_option_tables) {
+		table = free_option_tables;
+		free_option_tables = table -> next;
+		table -> next = (struct option_table *)0;
+		dmalloc_reuse (table, file, line, 1);
+		return table;
+	}
+	table = dmalloc (sizeof *table, file, line);
+	if (table)
+		memset (table, 0, sizeof *table);
+	return table;
+}
+
+#if defined (DEBUG_MEMORY_LEAKAGE) || \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void relinquish_free_option_tables ()
+{
+	struct option_table *t, *n;
+
+	for (t = free_option_tables; t; t = n) {
+		n = t -> next;
+		dfree (t, MDL);
+	}
+	free_option_tables = (struct option_table *)0;
+}
+#endif
+
+/* Return the option in the table with the lowest code at or above *code,
+   setting *code to its code, or null if there are none in the slots. */
+static struct option_cache *
+next_direct_option(struct option_table *table, unsigned *code)
+{
+	u_int32_t bits;
+	unsigned w;
+
+	for (w = *code / 32; w < OPTION_TABLE_SIZE / 32; w++) {
+		bits = table -> present [w];
+		if (w == *code / 32)
+			bits &= ~(u_int32_t)0 << (*code % 32);
+		if (bits) {
+			*code = w * 32 + ffs ((int)bits) - 1;
+			return table -> slot [*code];
+		}
+	}
+	return (struct option_cache *)0;
+}
+
+struct option_cache *lookup_direct_option (universe, options, code)
+	struct universe *universe;
+	struct option_state *options;
+	unsigned code;
+{
+	struct option_table *table;
+	pair bptr;
+
+	if (option_pending (options, universe, code))
+		decode_pending_option (options, code);
+
+	/* Make sure there's a table. */
+	if (universe -> index >= options -> universe_count ||
+	    !(table = options -> universes [universe -> index]))
+		return (struct option_cache *)0;
+
+	if (code < OPTION_TABLE_SIZE)
+		return table -> slot [code];
+	for (bptr = table -> other; bptr; bptr = bptr -> cdr) {
+		if (((struct option_cache *)(bptr -> car)) -> option -> code ==
+		    code)
+			return (struct option_cache *)(bptr -> car);
+	}
+	return (struct option_cache *)0;
+}
+
+void
+save_direct_option(struct universe *universe, struct option_state *options,
+		   struct option_cache *oc, isc_boolean_t appendp)
+{
+	struct option_table *table;
+	struct option_cache **ocloc;
+	unsigned code = oc -> option -> code;
+	pair bptr;
+
+	if (oc -> refcnt == 0)
+		abort ();
+
+	/* Decode any of the same option still waiting, so that it's
+	   replaced or appended to as it would have been. */
+	if (option_pending (options, universe, code))
+		decode_pending_option (options, code);
+	table = options -> universes [universe -> index];
+
+	/* If there's no table, make one. */
+	if (!table) {
+		table = new_option_table (MDL);
+		if (!table) {
+			log_error ("no memory to store %s.%s",
+				   universe -> name, oc -> option -> name);
+			return;
+		}
+		options -> universes [universe -> index] = (void *)table;
+	}
+
+	if (code < OPTION_TABLE_SIZE) {
+		ocloc = &table -> slot [code];
+		table -> present [code / 32] |= (u_int32_t)1 << (code % 32);
+	} else {
+		for (bptr = table -> other; bptr; bptr = bptr -> cdr) {
+			if (((struct option_cache *)
+			     (bptr -> car)) -> option -> code == code)
+				break;
+		}
+		if (!bptr) {
+			bptr = new_pair (MDL);
+			if (!bptr) {
+				log_error ("No memory for option_cache "
+					   "reference.");
+				return;
+			}
+			bptr -> cdr = table -> other;
+			bptr -> car = 0;
+			table -> other = bptr;
+		}
+		ocloc = (struct option_cache **)&bptr -> car;
+	}
+
+	/*
+	 * If there's one there already and appendp is set, append it onto
+	 * the tail of the ->next list.  If it is not set, replace it.
+	 */
+	if (*ocloc) {
+		if (appendp) {
+			do {
+				ocloc = &(*ocloc)->next;
+			} while (*ocloc != NULL);
+		} else {
+			option_cache_dereference(ocloc, MDL);
+		}
+	}
+	option_cache_reference(ocloc, oc, MDL);
+}
+
+void delete_direct_option (universe, options, code)
+	struct universe *universe;
+	struct option_state *options;
+	int code;
+{
+	struct option_table *table = options -> universes [universe -> index];
+	pair bptr, prev = (pair)0;
+
+	if (option_pending (options, universe, code))
+		options -> pending -> first [code] = 0;
+
+	/* There may not be any options in this space. */
+	if (!table)
+		return;
+
+	if (code < OPTION_TABLE_SIZE) {
+		if (table -> slot [code]) {
+			option_cache_dereference (&table -> slot [code], MDL);
+			table -> present [code / 32] &=
+				~((u_int32_t)1 << (code % 32));
+		}
+		return;
+	}
+
+	for (bptr = table -> other; bptr; bptr = bptr -> cdr) {
+		if (((struct option_cache *)(bptr -> car)) -> option -> code
+		    == code)
+			break;
+		prev = bptr;
+	}
+	if (bptr) {
+		if (prev)
+			prev -> cdr = bptr -> cdr;
+		else
+			table -> other = bptr -> cdr;
+		option_cache_dereference
+			((struct option_cache **)(&bptr -> car), MDL);
+		free_pair (bptr, MDL);
+	}
+}
+
+int direct_option_state_dereference (universe, state, file, line)
+	struct universe *universe;
+	struct option_state *state;
+	const char *file;
+	int line;
+{
+	struct option_table *table;
+	unsigned code;
+	pair cp, next;
+
+	table = (struct option_table *)(state -> universes [universe -> index]);
+	if (!table)
+		return 0;
+
+	/* Let go of the options, leaving the table cleared for its next
+	   user. */
+	for (code = 0; next_direct_option (table, &code); code++)
+		option_cache_dereference (&table -> slot [code], file, line);
+	memset (table -> present, 0, sizeof table -> present);
+	for (cp = table -> other; cp; cp = next) {
+		next = cp -> cdr;
+		option_cache_dereference ((struct option_cache **)&cp -> car,
+					  file, line);
+		free_pair (cp, file, line);
+	}
+	table -> other = (pair)0;
+
+	table -> next = free_option_tables;
+	free_option_tables = table;
+	dmalloc_reuse (free_option_tables, (char *)0, 0, 0);
+	state -> universes [universe -> index] = (void *)0;
+	return 1;
+}
+
+int direct_option_space_encapsulate (result, packet, lease, client_state,
+				     in_options, cfg_options, scope, universe)
+	struct data_string *result;
+	struct packet *packet;
+	struct lease *lease;
+	struct client_state *client_state;
+	struct option_state *in_options;
+	struct option_state *cfg_options;
+	struct binding_scope **scope;
+	struct universe *universe;
+{
+	struct option_table *table;
+	struct option_cache *oc;
+	unsigned code;
+	int status;
+	pair p;
+
+	if (universe -> index >= cfg_options -> universe_count)
+		return 0;
+
+	if (cfg_options -> pending &&
+	    cfg_options -> pending -> universe == universe)
+		decode_pending_options (cfg_options);
+	table = cfg_options -> universes [universe -> index];
+	if (!table)
+		return 0;
+
+	/* Append each configured option onto the buffer in encapsulated
+	 * format appropriate to the universe, in order of code.
+	 */
+	status = 0;
+	for (code = 0; (oc = next_direct_option (table, &code)); code++) {
+		if (store_option(result, universe, packet, lease,
+				 client_state, in_options, cfg_options,
+				 scope, oc))
+			status = 1;
+	}
+	for (p = table -> other; p; p = p -> cdr) {
+		if (store_option(result, universe, packet, lease,
+				 client_state, in_options, cfg_options,
+				 scope, (struct option_cache *)p->car))
+			status = 1;
+	}
+
+	if (search_subencapsulation(result, packet, lease, client_state,
+				    in_options, cfg_options, scope, universe))
+		status = 1;
+
+	return status;
+}
+
+void direct_option_space_foreach (struct packet *packet, struct lease *lease,
+				  struct client_state *client_state,
+				  struct option_state *in_options,
+				  struct option_state *cfg_options,
+				  struct binding_scope **scope,
+				  struct universe *u, void *stuff,
+				  void (*func) (struct option_cache *,
+						struct packet *,
+						struct lease *,
+						struct client_state *,
+						struct option_state *,
+						struct option_state *,
+						struct binding_scope **,
+						struct universe *, void *))
+{
+	struct option_table *table;
+	struct option_cache *oc;
+	unsigned code;
+	pair p;
+
+	if (cfg_options -> universe_count <= u -> index)
+		return;
+
+	if (cfg_options -> pending && cfg_options -> pending -> universe == u)
+		decode_pending_options (cfg_options);
+	table = cfg_options -> universes [u -> index];
+	if (!table)
+		return;
+	for (code = 0; (oc = next_direct_option (table, &code)); code++)
+		(*func) (oc, packet, lease, client_state,
+			 in_options, cfg_options, scope, u, stuff);
+	for (p = table -> other; p; p = p -> cdr) {
+		oc = (struct option_cache *)p -> car;
+		(*func) (oc, packet, lease, client_state,
+			 in_options, cfg_options, scope, u, stuff);
+	}
+}
+
 void
 save_linked_option(struct universe *universe, struct option_state *options,
 		   struct option_cache *oc, isc_boolean_t appendp)
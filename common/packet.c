@@ -39,25 +39,58 @@
 #include "includes/netinet/if_ether.h"
 #endif /* PACKET_ASSEMBLY || PACKET_DECODING */
 
-/* Compute the easy part of the checksum on a range of bytes. */
+#if defined (HAVE_AVX2_CHECKSUM)
+#include <immintrin.h>
+#endif
 
-u_int32_t checksum (buf, nbytes, sum)
-	unsigned char *buf;
-	unsigned nbytes;
-	u_int32_t sum;
-{
-	unsigned i;
+/* The one's complement sum of a range of bytes, folded to sixteen bits
+   and in host byte order, can be worked out a few ways: a pair of bytes
+   at a time as this code always did, a word at a time, or on CPUs with
+   AVX2 thirty-two bytes at a time.   Which is used is picked the first
+   time a checksum is needed, or with checksum_select(). */
 
-#ifdef DEBUG_CHECKSUM
-	log_debug ("checksum (%x %d %x)", (unsigned)buf, nbytes, sum);
+static u_int32_t checksum_pairs (const unsigned char *, unsigned);
+static u_int32_t checksum_words (const unsigned char *, unsigned);
+#if defined (HAVE_AVX2_CHECKSUM)
+static u_int32_t checksum_avx2 (const unsigned char *, unsigned);
+#endif
+static u_int32_t checksum_first (const unsigned char *, unsigned);
+
+static struct checksum_kernel {
+	const char *name;
+	u_int32_t (*sum) (const unsigned char *, unsigned);
+} checksum_kernels [] = {
+#if defined (HAVE_AVX2_CHECKSUM)
+	{ "avx2", checksum_avx2 },
 #endif
+	{ "words", checksum_words },
+	{ "pairs", checksum_pairs },
+	{ NULL, NULL }
+};
+
+static struct checksum_kernel *checksum_kernel;
+static u_int32_t (*checksum_sum) (const unsigned char *,
+				  unsigned) = checksum_first;
+
+/* Add the carries back in until the sum fits in sixteen bits. */
+
+static u_int32_t add_carry (u_int32_t sum)
+{
+	while (sum > 0xFFFF)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+static u_int32_t checksum_pairs (const unsigned char *buf, unsigned nbytes)
+{
+	u_int32_t sum = 0;
+	u_int16_t word;
+	unsigned i;
 
 	/* Checksum all the pairs of bytes first... */
 	for (i = 0; i < (nbytes & ~1U); i += 2) {
-#ifdef DEBUG_CHECKSUM_VERBOSE
-		log_debug ("sum = %x", sum);
-#endif
-		sum += (u_int16_t) ntohs(*((u_int16_t *)(buf + i)));
+		memcpy (&word, buf + i, sizeof word);
+		sum += (u_int16_t) ntohs (word);
 		/* Add carry. */
 		if (sum > 0xFFFF)
 			sum -= 0xFFFF;
@@ -66,9 +99,6 @@ u_int32_t checksum (buf, nbytes, sum)
 	/* If there's a single byte left over, checksum it, too.   Network
 	   byte order is big-endian, so the remaining byte is the high byte. */
 	if (i < nbytes) {
-#ifdef DEBUG_CHECKSUM_VERBOSE
-		log_debug ("sum = %x", sum);
-#endif
 		sum += buf [i] << 8;
 		/* Add carry. */
 		if (sum > 0xFFFF)
@@ -78,6 +108,146 @@ u_int32_t checksum (buf, nbytes, sum)
 	return sum;
 }
 
+/* Adds up the bytes as host byte order words.   Swapping the bytes of
+   the folded sum afterwards gives the same answer as adding up the
+   network byte order pairs (RFC 1071), so there's no need to swap each
+   word. */
+
+static u_int64_t checksum_native (const unsigned char *buf, unsigned nbytes)
+{
+	u_int64_t sum = 0;
+	u_int32_t words [4];
+	u_int16_t half;
+	unsigned char last [2];
+
+	while (nbytes >= sizeof words) {
+		memcpy (words, buf, sizeof words);
+		sum += (u_int64_t)words [0] + words [1] + words [2] + words [3];
+		buf += sizeof words;
+		nbytes -= sizeof words;
+	}
+	while (nbytes >= sizeof half) {
+		memcpy (&half, buf, sizeof half);
+		sum += half;
+		buf += sizeof half;
+		nbytes -= sizeof half;
+	}
+	/* The odd byte is the first of a pair, padded with zero. */
+	if (nbytes) {
+		last [0] = *buf;
+		last [1] = 0;
+		memcpy (&half, last, sizeof half);
+		sum += half;
+	}
+	return sum;
+}
+
+/* Fold a sum from checksum_native() and put it in host byte order. */
+
+static u_int32_t checksum_fold (u_int64_t sum)
+{
+	u_int16_t half;
+
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	half = add_carry ((u_int32_t)sum);
+	return ntohs (half);
+}
+
+static u_int32_t checksum_words (const unsigned char *buf, unsigned nbytes)
+{
+	return checksum_fold (checksum_native (buf, nbytes));
+}
+
+#if defined (HAVE_AVX2_CHECKSUM)
+/* Widens each sixteen bit word of thirty-two bytes to a 32 bit lane
+   and adds them up; every lane takes two words a round, so the lanes
+   are added into the total before 32768 rounds can overflow them. */
+
+__attribute__ ((target ("avx2")))
+static u_int32_t checksum_avx2 (const unsigned char *buf, unsigned nbytes)
+{
+	__m256i zero = _mm256_setzero_si256 ();
+	__m256i acc, v;
+	u_int32_t lanes [8];
+	u_int64_t sum = 0;
+	unsigned rounds, i;
+
+	while (nbytes >= sizeof v) {
+		rounds = nbytes / sizeof v;
+		if (rounds > 16384)
+			rounds = 16384;
+		acc = zero;
+		for (i = 0; i < rounds; i++) {
+			v = _mm256_loadu_si256 ((const __m256i *)buf);
+			acc = _mm256_add_epi32 (acc,
+						_mm256_unpacklo_epi16 (v, zero));
+			acc = _mm256_add_epi32 (acc,
+						_mm256_unpackhi_epi16 (v, zero));
+			buf += sizeof v;
+		}
+		nbytes -= rounds * sizeof v;
+		_mm256_storeu_si256 ((__m256i *)lanes, acc);
+		for (i = 0; i < 8; i++)
+			sum += lanes [i];
+	}
+	/* The compiler doesn't always clear the upper halves of the
+	   registers itself, and SSE code run with them dirty is slow. */
+	_mm256_zeroupper ();
+	return checksum_fold (sum + checksum_native (buf, nbytes));
+}
+#endif /* HAVE_AVX2_CHECKSUM */
+
+static u_int32_t checksum_first (const unsigned char *buf, unsigned nbytes)
+{
+	checksum_select (NULL);
+	return checksum_sum (buf, nbytes);
+}
+
+/* Use the named way of working out checksums, or with a null name the
+   quickest one this CPU can do.   Returns zero if there's no such way
+   or the CPU can't do it. */
+
+int checksum_select (const char *name)
+{
+	struct checksum_kernel *ck;
+
+	for (ck = checksum_kernels; ck -> name != NULL; ck++) {
+		if (name != NULL && strcmp (name, ck -> name))
+			continue;
+#if defined (HAVE_AVX2_CHECKSUM)
+		if (ck -> sum == checksum_avx2 &&
+		    !__builtin_cpu_supports ("avx2"))
+			continue;
+#endif
+		checksum_kernel = ck;
+		checksum_sum = ck -> sum;
+		return 1;
+	}
+	return 0;
+}
+
+const char *checksum_selected (void)
+{
+	if (checksum_kernel == NULL)
+		checksum_select (NULL);
+	return checksum_kernel -> name;
+}
+
+/* Compute the easy part of the checksum on a range of bytes. */
+
+u_int32_t checksum (buf, nbytes, sum)
+	unsigned char *buf;
+	unsigned nbytes;
+	u_int32_t sum;
+{
+#ifdef DEBUG_CHECKSUM
+	log_debug ("checksum (%x %d %x)", (unsigned)buf, nbytes, sum);
+#endif
+
+	return add_carry (sum + checksum_sum (buf, nbytes));
+}
+
 /* Finish computing the checksum, and then put it into network byte order. */
 
 u_int32_t wrapsum (sum)
@@ -193,6 +363,124 @@ void assemble_udp_ip_header (interface, buf, bufix,
 	memcpy (&buf [*bufix], &udp, sizeof udp);
 	*bufix += sizeof udp;
 }
+
+/* Make the header template for an Ethernet interface. */
+
+static void make_header_template (struct interface_info *interface)
+{
+	struct header_template *ht = &interface -> send_template;
+	struct ip ip;
+	struct udphdr udp;
+	unsigned bufix = 0;
+
+	assemble_ethernet_header (interface, ht -> frame, &bufix, NULL);
+
+	memset (&ip, 0, sizeof ip);
+	IP_V_SET (&ip, 4);
+	IP_HL_SET (&ip, 20);
+	ip.ip_tos = IPTOS_LOWDELAY;
+	ip.ip_ttl = 128;
+	ip.ip_p = IPPROTO_UDP;
+	ht -> ip_sum = checksum ((unsigned char *)&ip, sizeof ip, 0);
+	memcpy (&ht -> frame [bufix], &ip, sizeof ip);
+	bufix += sizeof ip;
+
+	memset (&udp, 0, sizeof udp);
+	udp.uh_sport = local_port;
+	memcpy (&ht -> frame [bufix], &udp, sizeof udp);
+
+	ht -> hw_address = interface -> hw_address;
+	ht -> sport = local_port;
+}
+
+/* Assemble the link, IP and UDP headers for a packet as
+   assemble_hw_header() and assemble_udp_ip_header() would, leaving the
+   IP header word-aligned in buf.   Returns the offset in buf at which
+   the frame starts, with *bufix set past the UDP header.
+
+   On Ethernet the headers are copied from the interface's template,
+   remade if its hardware address or local_port has changed, and only
+   the lengths, addresses and ports are filled in; the IP header
+   checksum is finished from the template's sum of the rest. */
+
+unsigned assemble_headers (interface, buf, bufix, hto,
+			   from, to, port, data, len)
+	struct interface_info *interface;
+	unsigned char *buf;
+	unsigned *bufix;
+	struct hardware *hto;
+	u_int32_t from;
+	u_int32_t to;
+	u_int32_t port;
+	unsigned char *data;
+	unsigned len;
+{
+	struct header_template *ht = &interface -> send_template;
+	unsigned char hh [32];
+	unsigned char *ip, *udp;
+	unsigned hbufp = 0, fudge;
+	u_int32_t sum, addrs;
+	u_int16_t ip_len, ulen, sport, word;
+
+	if (interface -> hw_address.hbuf [0] != HTYPE_ETHER) {
+		assemble_hw_header (interface, hh, &hbufp, hto);
+		fudge = hbufp % 4;	/* IP header must be word-aligned. */
+		memcpy (buf + fudge, hh, hbufp);
+		*bufix = hbufp + fudge;
+		assemble_udp_ip_header (interface, buf, bufix,
+					from, to, port, data, len);
+		return fudge;
+	}
+
+	if (ht -> sport != local_port ||
+	    memcmp (&ht -> hw_address, &interface -> hw_address,
+		    sizeof ht -> hw_address))
+		make_header_template (interface);
+
+	fudge = ETHER_HEADER_SIZE % 4;
+	memcpy (buf + fudge, ht -> frame, sizeof ht -> frame);
+	if (hto && hto -> hlen == 7) /* XXX */
+		memcpy (buf + fudge, &hto -> hbuf [1], ETHER_ADDR_LEN);
+	ip = buf + fudge + ETHER_HEADER_SIZE;
+	udp = ip + sizeof (struct ip);
+	*bufix = fudge + sizeof ht -> frame;
+
+	/* The addresses go in both checksums. */
+	addrs = add_carry ((ntohl (from) >> 16) + (ntohl (from) & 0xFFFF) +
+			   (ntohl (to) >> 16) + (ntohl (to) & 0xFFFF));
+
+	ip_len = sizeof (struct ip) + sizeof (struct udphdr) + len;
+	word = htons (ip_len);
+	memcpy (ip + offsetof (struct ip, ip_len), &word, sizeof word);
+	memcpy (ip + offsetof (struct ip, ip_src), &from, sizeof from);
+	memcpy (ip + offsetof (struct ip, ip_dst), &to, sizeof to);
+	word = wrapsum (add_carry (ht -> ip_sum + ip_len + addrs));
+	memcpy (ip + offsetof (struct ip, ip_sum), &word, sizeof word);
+
+	sport = local_port;
+#if defined(RELAY_PORT)
+	/* Change to relay port defined if sending to server */
+	if (relay_port && (port == htons(67))) {
+		sport = relay_port;
+		memcpy (udp + offsetof (struct udphdr, uh_sport),
+			&sport, sizeof sport);
+	}
+#endif
+	ulen = sizeof (struct udphdr) + len;
+	word = port;
+	memcpy (udp + offsetof (struct udphdr, uh_dport), &word, sizeof word);
+	word = htons (ulen);
+	memcpy (udp + offsetof (struct udphdr, uh_ulen), &word, sizeof word);
+
+	/* The ``pseudo-header'' counts the UDP length once and the UDP
+	   header counts it again. */
+	sum = addrs + IPPROTO_UDP + 2 * (u_int32_t)ulen +
+	      ntohs (sport) + ntohs ((u_int16_t)port);
+	word = wrapsum (checksum (data, len, add_carry (sum)));
+	memcpy (udp + offsetof (struct udphdr, uh_sum), &word, sizeof word);
+
+	return fudge;
+}
 #endif /* PACKET_ASSEMBLY */
 
 #ifdef PACKET_DECODING
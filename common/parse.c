@@ -5595,6 +5595,14 @@ int parse_warn (struct parse *cfile, const char *fmt, ...)
 	char final[4096];
 	unsigned i, lix;
 
+	if (cfile -> quiet) {
+		cfile -> warnings_occurred = 1;
+		return 0;
+	}
+
+	/* Find out where the token the message is about is. */
+	lex_locate (cfile);
+
 	/* Replace %m in fmt with errno error text */
 	do_percentm (mbuf, sizeof(mbuf), fmt);
 
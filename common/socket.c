@@ -54,6 +54,7 @@
 #  define if_register_send if_register_fallback
 #  define send_packet send_fallback
 #  define if_reinitialize_send if_reinitialize_fallback
+#  define if_flush_send if_flush_fallback
 # endif
 #endif
 
@@ -379,6 +380,13 @@ void if_register_send (info)
 void if_deregister_send (info)
 	struct interface_info *info;
 {
+#if defined (USE_SEND_BATCH)
+	if_flush_send (info);
+	if (info -> tbuf != NULL) {
+		dfree (info -> tbuf, MDL);
+		info -> tbuf = NULL;
+	}
+#endif
 #ifndef USE_SOCKET_RECEIVE
 	close (info -> wfdesc);
 #endif
@@ -712,6 +720,90 @@ if_deregister6(struct interface_info *info) {
 #endif /* DHCPv6 */
 
 #if defined (USE_SOCKET_SEND) || defined (USE_SOCKET_FALLBACK)
+#if defined (USE_SEND_BATCH)
+/* While a send batch is open, send_packet() copies each packet into
+   the interface's tbuf, and they all go to the kernel in one sendmmsg()
+   when the batch ends or the queue fills.   The interface index that
+   USE_V4_PKTINFO sets on the socket applies to every packet after it,
+   so that case isn't batched. */
+#if !(defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && \
+      defined(USE_V4_PKTINFO))
+#define SOCKET_SEND_BATCHING
+#endif
+
+#define SOCKET_SEND_BATCH	32
+
+struct socket_send_batch {
+	struct mmsghdr msgs [SOCKET_SEND_BATCH];
+	struct iovec iov [SOCKET_SEND_BATCH];
+	struct sockaddr_in to [SOCKET_SEND_BATCH];
+	struct dhcp_packet raw [SOCKET_SEND_BATCH];
+};
+
+#if defined (SOCKET_SEND_BATCHING)
+static void socket_send_queue (struct interface_info *interface,
+			       struct dhcp_packet *raw, size_t len,
+			       struct sockaddr_in *to)
+{
+	struct socket_send_batch *sb;
+	struct msghdr *msg;
+	unsigned i;
+
+	if (interface -> tbuf == NULL) {
+		interface -> tbuf = dmalloc (sizeof *sb, MDL);
+		if (interface -> tbuf == NULL)
+			log_fatal ("No memory for %s send batch.",
+				   interface -> name);
+	}
+	sb = (struct socket_send_batch *)interface -> tbuf;
+
+	i = interface -> tbuf_len++;
+	memcpy (&sb -> raw [i], raw, len);
+	sb -> to [i] = *to;
+	sb -> iov [i].iov_base = &sb -> raw [i];
+	sb -> iov [i].iov_len = len;
+	msg = &sb -> msgs [i].msg_hdr;
+	memset (msg, 0, sizeof *msg);
+	msg -> msg_name = &sb -> to [i];
+	msg -> msg_namelen = sizeof sb -> to [i];
+	msg -> msg_iov = &sb -> iov [i];
+	msg -> msg_iovlen = 1;
+
+	if (interface -> tbuf_len == SOCKET_SEND_BATCH)
+		if_flush_send (interface);
+}
+#endif /* SOCKET_SEND_BATCHING */
+
+/* Send the packets queued on the interface. */
+void if_flush_send (interface)
+	struct interface_info *interface;
+{
+	struct socket_send_batch *sb;
+	unsigned count = interface -> tbuf_len;
+	unsigned i;
+	int status;
+
+	if (count == 0)
+		return;
+	interface -> tbuf_len = 0;
+	sb = (struct socket_send_batch *)interface -> tbuf;
+
+	/* sendmmsg() stops at the first packet it can't send, so log that
+	   one and carry on with the rest. */
+	for (i = 0; i < count; ) {
+		status = sendmmsg (interface -> wfdesc, &sb -> msgs [i],
+				   count - i, 0);
+		if (status > 0) {
+			i += status;
+			continue;
+		}
+		log_error ("send_packet %s: %m",
+			   inet_ntoa (sb -> to [i].sin_addr));
+		i++;
+	}
+}
+#endif /* USE_SEND_BATCH */
+
 ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	struct interface_info *interface;
 	struct packet *packet;
@@ -722,6 +814,12 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	struct hardware *hto;
 {
 	int result;
+#if defined (SOCKET_SEND_BATCHING)
+	if (send_batching) {
+		socket_send_queue (interface, raw, len, to);
+		return len;
+	}
+#endif
 #ifdef IGNORE_HOSTUNREACH
 	int retry = 0;
 	do {
@@ -757,6 +855,70 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	return result;
 }
 
+/* Send the same packet to each of count destinations through the
+   interface's socket, which must be an ordinary UDP socket (the
+   fallback interface, or any interface when sockets are used for
+   sending).   Where the system has sendmmsg() the destinations are
+   handed to the kernel in batches rather than one sendto() each.
+   Returns the number of destinations the packet was sent to. */
+
+#define SEND_MULTI_BATCH 16
+
+int send_packet_multi (struct interface_info *interface,
+		       struct dhcp_packet *raw, size_t len,
+		       struct sockaddr_in *to, int count)
+{
+	int sent = 0;
+	int i;
+#if defined (HAVE_SENDMMSG)
+	struct mmsghdr msgs [SEND_MULTI_BATCH];
+	struct iovec iov;
+	int base, n, status;
+
+	iov.iov_base = raw;
+	iov.iov_len = len;
+
+	for (base = 0; base < count; base += n) {
+		n = count - base;
+		if (n > SEND_MULTI_BATCH)
+			n = SEND_MULTI_BATCH;
+
+		memset (msgs, 0, n * sizeof msgs [0]);
+		for (i = 0; i < n; i++) {
+			msgs [i].msg_hdr.msg_name = &to [base + i];
+			msgs [i].msg_hdr.msg_namelen = sizeof to [base + i];
+			msgs [i].msg_hdr.msg_iov = &iov;
+			msgs [i].msg_hdr.msg_iovlen = 1;
+		}
+
+		/* sendmmsg() stops at the first message it can't send, so
+		   log that one and carry on with the rest. */
+		for (i = 0; i < n; ) {
+			status = sendmmsg (interface -> wfdesc, &msgs [i],
+					   n - i, 0);
+			if (status > 0) {
+				sent += status;
+				i += status;
+				continue;
+			}
+			log_error ("send_packet_multi %s: %m",
+				   inet_ntoa (to [base + i].sin_addr));
+			i++;
+		}
+	}
+#else
+	for (i = 0; i < count; i++) {
+		if (sendto (interface -> wfdesc, (char *)raw, len, 0,
+			    (struct sockaddr *)&to [i], sizeof to [i]) < 0)
+			log_error ("send_packet_multi %s: %m",
+				   inet_ntoa (to [i].sin_addr));
+		else
+			sent++;
+	}
+#endif
+	return sent;
+}
+
 #endif /* USE_SOCKET_SEND || USE_SOCKET_FALLBACK */
 
 #ifdef DHCPv6
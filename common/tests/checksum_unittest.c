@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+/*
+ * Check that each way of working out checksums gets the same answers as
+ * the byte pair loop, and that the headers assemble_headers() makes from
+ * an interface's template are the ones assemble_hw_header() and
+ * assemble_udp_ip_header() make.   dhcpd_bench times them.
+ */
+
+static const char *kernels[] = { "pairs", "words", "avx2", NULL };
+
+static void
+fill(unsigned char *buf, unsigned len)
+{
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = random();
+}
+
+ATF_TC(checksum_kernels);
+
+ATF_TC_HEAD(checksum_kernels, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Check every checksum implementation "
+			  "against the byte pair loop.");
+}
+
+ATF_TC_BODY(checksum_kernels, tc)
+{
+	/* An IP header whose checksum is known. */
+	unsigned char ip[20] = {
+		0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00,
+		0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x00, 0x01,
+		0xc0, 0xa8, 0x00, 0xc7
+	};
+	unsigned char buf[2048 + 4];
+	u_int32_t want[2048 + 1], sum;
+	unsigned len, off, i;
+	int k;
+
+	srandom(1);
+	for (k = 0; kernels[k] != NULL; k++) {
+		if (!checksum_select(kernels[k]))
+			continue;
+		if (wrapsum(checksum(ip, sizeof ip, 0)) != htons(0xb861))
+			atf_tc_fail("%s: IP header checksum wrong", kernels[k]);
+
+		/* All ones and all zeroes are the awkward ones. */
+		memset(buf, 0xff, sizeof buf);
+		if (checksum(buf, 2048, 0) != 0xffff)
+			atf_tc_fail("%s: sum of all ones wrong", kernels[k]);
+		memset(buf, 0, sizeof buf);
+		if (checksum(buf, 2048, 0) != 0)
+			atf_tc_fail("%s: sum of all zeroes wrong", kernels[k]);
+	}
+
+	for (i = 0; i < 20; i++) {
+		fill(buf, sizeof buf);
+		for (off = 0; off < 4; off++) {
+			checksum_select("pairs");
+			for (len = 0; len <= 2048; len++)
+				want[len] = checksum(buf + off, len, off * 77);
+			for (k = 1; kernels[k] != NULL; k++) {
+				if (!checksum_select(kernels[k]))
+					continue;
+				for (len = 0; len <= 2048; len++) {
+					sum = checksum(buf + off, len,
+						       off * 77);
+					if (sum == want[len])
+						continue;
+					atf_tc_fail("%s: %u bytes at %u "
+						    "summed to %x, not %x",
+						    kernels[k], len, off,
+						    sum, want[len]);
+				}
+			}
+		}
+	}
+
+	if (checksum_select("no-such-checksum"))
+		atf_tc_fail("selected a checksum that doesn't exist");
+	if (!checksum_select(NULL) || checksum_selected() == NULL)
+		atf_tc_fail("can't select the default checksum");
+}
+
+static struct interface_info *
+make_interface(u_int8_t htype)
+{
+	struct interface_info *ip = NULL;
+
+	if (interface_allocate(&ip, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate an interface");
+	strcpy(ip->name, "ck0");
+	ip->hw_address.hlen = 7;
+	ip->hw_address.hbuf[0] = htype;
+	fill(&ip->hw_address.hbuf[1], 6);
+	return ip;
+}
+
+/* The headers the old way, as send_packet() used to put them together. */
+static unsigned
+old_headers(struct interface_info *ip, unsigned char *buf, unsigned *bufix,
+	    struct hardware *hto, u_int32_t from, u_int32_t to,
+	    u_int32_t port, unsigned char *data, unsigned len)
+{
+	unsigned char hh[32];
+	unsigned hbufp = 0, fudge;
+
+	assemble_hw_header(ip, hh, &hbufp, hto);
+	fudge = hbufp % 4;
+	memcpy(buf + fudge, hh, hbufp);
+	*bufix = hbufp + fudge;
+	assemble_udp_ip_header(ip, buf, bufix, from, to, port, data, len);
+	return fudge;
+}
+
+ATF_TC(header_template);
+
+ATF_TC_HEAD(header_template, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Check that headers made from the "
+			  "template match the ones made field by field.");
+}
+
+ATF_TC_BODY(header_template, tc)
+{
+	struct interface_info *ip;
+	struct hardware hto;
+	unsigned char data[1500], want[1600], got[1600];
+	unsigned wfudge, gfudge, wix, gix, len, i;
+	u_int32_t from, to, port;
+
+	srandom(2);
+	dhcp_common_objects_setup();
+	ip = make_interface(HTYPE_ETHER);
+	hto.hlen = 7;
+	hto.hbuf[0] = HTYPE_ETHER;
+	fill(data, sizeof data);
+
+	for (i = 0; i < 20000; i++) {
+		/* Now and then change what the template depends on. */
+		if (i % 1000 == 0)
+			fill(&ip->hw_address.hbuf[1], 6);
+		local_port = htons(i % 3000 < 1500 ? 67 : 547);
+#if defined (RELAY_PORT)
+		relay_port = i % 5 == 0 ? htons(1067) : 0;
+#endif
+		fill(&hto.hbuf[1], 6);
+		from = random();
+		to = i % 7 ? random() : INADDR_BROADCAST;
+		port = htons(i % 2 ? 68 : 67);
+		len = random() % sizeof data;
+
+		memset(want, 0, sizeof want);
+		memset(got, 0, sizeof got);
+		wfudge = old_headers(ip, want, &wix, i % 3 ? &hto : NULL,
+				     from, to, port, data, len);
+		gfudge = assemble_headers(ip, got, &gix, i % 3 ? &hto : NULL,
+					  from, to, port, data, len);
+		if (wfudge != gfudge || wix != gix ||
+		    memcmp(want, got, wix))
+			atf_tc_fail("headers %u differ", i);
+	}
+	interface_dereference(&ip, MDL);
+	local_port = 0;
+#if defined (RELAY_PORT)
+	relay_port = 0;
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, checksum_kernels);
+	ATF_TP_ADD_TC(tp, header_template);
+
+	return (atf_no_error());
+}
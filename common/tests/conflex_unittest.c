@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+/* Makes a parse struct for a string. */
+static struct parse *
+lex_string(char *text)
+{
+	struct parse *cfile = NULL;
+
+	if ((new_parse(&cfile, -1, text, strlen(text), "test", 0) !=
+	     ISC_R_SUCCESS) || (cfile == NULL))
+		atf_tc_fail("new_parse failed");
+	return (cfile);
+}
+
+struct token_test {
+	const char *text;
+	enum dhcp_token token;
+};
+
+ATF_TC(conflex_keywords);
+
+ATF_TC_HEAD(conflex_keywords, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify keyword lookup.");
+}
+
+ATF_TC_BODY(conflex_keywords, tc)
+{
+	static struct token_test tests[] = {
+		{ "subnet", SUBNET },
+		{ "NetMask", NETMASK },
+		{ "hardware", HARDWARE },
+		{ "ethernet", ETHERNET },
+		{ "abandoned", TOKEN_ABANDONED },
+		{ "pick-first-value", PICK },
+		{ "do-forward-updates", DO_FORWARD_UPDATE },
+		{ "ZONE", ZONE },
+		{ "zerolen", ZEROLEN },
+		{ "subnets", NAME },
+		{ "zon", NAME },
+		{ "lease-times", NAME },
+		{ "cafe", NUMBER_OR_NAME },
+		{ "a-b_c", NAME },
+		{ "10", NUMBER },
+		{ "\"range\"", STRING },
+		{ NULL, 0 }};
+	struct token_test *t;
+	struct parse *cfile;
+	const char *val;
+	char text[64];
+	enum dhcp_token token;
+
+	for (t = tests; t->text != NULL; t++) {
+		strcpy(text, t->text);
+		cfile = lex_string(text);
+		token = next_token(&val, NULL, cfile);
+		if (token != t->token)
+			atf_tc_fail("\"%s\" is token %d, not %d",
+				    t->text, token, t->token);
+		if (next_token(&val, NULL, cfile) != END_OF_FILE)
+			atf_tc_fail("\"%s\" is more than one token", t->text);
+		end_parse(&cfile);
+	}
+}
+
+ATF_TC(conflex_locate);
+
+ATF_TC_HEAD(conflex_locate, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+			  "Verify the line and column of tokens.");
+}
+
+ATF_TC_BODY(conflex_locate, tc)
+{
+	char text[] = "# comment\n"
+		      "subnet 10.0.0.0 netmask 255.0.0.0 {\n"
+		      "\trange \"a\\\"b\"  foo;\n"
+		      "}\n";
+	struct parse *cfile;
+	const char *val;
+
+	cfile = lex_string(text);
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == SUBNET);
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexline == 2);
+	ATF_CHECK(cfile->lexchar == 1);
+
+	while (next_token(&val, NULL, cfile) != LBRACE)
+		;
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexline == 2);
+	ATF_CHECK(cfile->lexchar == 35);
+	ATF_CHECK(strcmp(cfile->token_line,
+			 "subnet 10.0.0.0 netmask 255.0.0.0 {") == 0);
+
+	/* Peeking doesn't move the position of the current token. */
+	ATF_REQUIRE(peek_token(&val, NULL, cfile) == RANGE);
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexline == 2);
+	ATF_CHECK(cfile->lexchar == 35);
+
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == RANGE);
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexline == 3);
+	ATF_CHECK(cfile->lexchar == 2);
+
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == STRING);
+	ATF_CHECK(strcmp(val, "a\"b") == 0);
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexchar == 8);
+
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == NAME);
+	ATF_CHECK(strcmp(val, "foo") == 0);
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexline == 3);
+	ATF_CHECK(cfile->lexchar == 16);
+
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == SEMI);
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == RBRACE);
+	lex_locate(cfile);
+	ATF_CHECK(cfile->lexline == 4);
+	ATF_CHECK(strcmp(cfile->token_line, "}") == 0);
+	ATF_REQUIRE(next_token(&val, NULL, cfile) == END_OF_FILE);
+	end_parse(&cfile);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, conflex_keywords);
+	ATF_TP_ADD_TC(tp, conflex_locate);
+
+	return (atf_no_error());
+}
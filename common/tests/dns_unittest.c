@@ -20,9 +20,9 @@
 
 /*
  * This file provides unit tests for the dns and ddns code.
- * Currently this is limited to verifying the dhcid code is
- * working properly.  In time we may be able to expand the
- * tests to cover other areas.
+ * Currently this is limited to verifying the dhcid code and
+ * the lookup of cached zones are working properly.  In time we
+ * may be able to expand the tests to cover other areas.
  *
  * The tests for the interim txt records comapre to previous
  * internally generated values.
@@ -165,6 +165,111 @@ ATF_TC_BODY(interim_dhcid, tc)
 
 }
 
+/* Enter a zone with a single primary server address */
+void make_zone(const char *name, const char *addr, TIME timeout)
+{
+    struct dns_zone *zone = NULL;
+    struct option_cache *oc;
+
+    if (!dns_zone_allocate(&zone, MDL))
+        atf_tc_fail("Unable to allocate zone %s", name);
+    zone->name = dmalloc(strlen(name) + 1, MDL);
+    if (zone->name == NULL)
+        atf_tc_fail("Unable to allocate name for zone %s", name);
+    strcpy(zone->name, name);
+    zone->timeout = timeout;
+
+    if (!option_cache_allocate(&zone->primary, MDL))
+        atf_tc_fail("Unable to allocate primary for zone %s", name);
+    oc = zone->primary;
+    if (!buffer_allocate(&oc->data.buffer, 4, MDL))
+        atf_tc_fail("Unable to allocate buffer for zone %s", name);
+    inet_pton(AF_INET, addr, oc->data.buffer->data);
+    oc->data.data = oc->data.buffer->data;
+    oc->data.len = 4;
+
+    if (enter_dns_zone(zone) != ISC_R_SUCCESS)
+        atf_tc_fail("Unable to enter zone %s", name);
+    dns_zone_dereference(&zone, MDL);
+}
+
+/* Look up the zone for fqdn and check we got the expected one */
+void check_zone(const char *fqdn, const char *zone_name, const char *addr)
+{
+    dhcp_ddns_cb_t *ddns_cb;
+    struct data_string *id;
+    isc_sockaddr_t *sa;
+    struct in_addr expected;
+    isc_result_t status;
+
+    ddns_cb = ddns_cb_alloc(MDL);
+    if (ddns_cb == NULL)
+        atf_tc_fail("Unable to allocate ddns_cb for %s", fqdn);
+
+    id = &ddns_cb->fwd_name;
+    if (!buffer_allocate(&id->buffer, strlen(fqdn) + 1, MDL))
+        atf_tc_fail("Unable to allocate name for %s", fqdn);
+    id->data = id->buffer->data;
+    strcpy((char *)id->buffer->data, fqdn);
+    id->len = strlen(fqdn);
+
+    status = find_cached_zone(ddns_cb, FIND_FORWARD);
+    if (zone_name == NULL) {
+        if (status == ISC_R_SUCCESS)
+            atf_tc_fail("Unexpected zone %s found for %s",
+                        ddns_cb->zone_name, fqdn);
+    } else if (status != ISC_R_SUCCESS) {
+        atf_tc_fail("No zone found for %s: %s", fqdn,
+                    isc_result_totext(status));
+    } else if (strcmp((char *)ddns_cb->zone_name, zone_name) != 0) {
+        atf_tc_fail("Wrong zone %s found for %s, expected %s",
+                    ddns_cb->zone_name, fqdn, zone_name);
+    } else {
+        sa = ISC_LIST_HEAD(ddns_cb->zone_server_list);
+        inet_pton(AF_INET, addr, &expected);
+        if ((sa == NULL) ||
+            (memcmp(&sa->type.sin.sin_addr, &expected, 4) != 0))
+            atf_tc_fail("Wrong server for zone %s", zone_name);
+    }
+
+    ddns_cb_free(ddns_cb, MDL);
+}
+
+ATF_TC(cached_zone);
+
+ATF_TC_HEAD(cached_zone, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify lookup of cached zones.");
+}
+
+ATF_TC_BODY(cached_zone, tc)
+{
+    cur_time = 1000;
+
+    make_zone("example.com.", "192.0.2.1", 0);
+    make_zone("sub.EXAMPLE.com.", "192.0.2.2", 0);
+    make_zone("dyn.example.com.", "192.0.2.3", cur_time + 10);
+
+    /* The closest enclosing zone wins, case doesn't matter */
+    check_zone("host.example.com", "example.com.", "192.0.2.1");
+    check_zone("host.a.sub.example.com.", "sub.EXAMPLE.com.", "192.0.2.2");
+    check_zone("Host.Sub.Example.Com", "sub.EXAMPLE.com.", "192.0.2.2");
+    check_zone("example.com", "example.com.", "192.0.2.1");
+    check_zone("host.dyn.example.com", "dyn.example.com.", "192.0.2.3");
+    check_zone("host.example.org", NULL, NULL);
+    check_zone("com", NULL, NULL);
+
+    /* Re-entering a zone picks up its new addresses */
+    make_zone("sub.example.com.", "192.0.2.4", 0);
+    check_zone("host.sub.example.com", "sub.example.com.", "192.0.2.4");
+
+    /* Once a dynamic zone times out its parent is used */
+    cur_time += 20;
+    check_zone("host.dyn.example.com", "example.com.", "192.0.2.1");
+
+    dns_zone_trie_free();
+}
+
 /* This macro defines main() method that will call specified
    test cases. tp and simple_test_case names can be whatever you want
    as long as it is a valid variable identifier. */
@@ -172,6 +277,7 @@ ATF_TP_ADD_TCS(tp)
 {
     ATF_TP_ADD_TC(tp, interim_dhcid);
     ATF_TP_ADD_TC(tp, standard_dhcid);
+    ATF_TP_ADD_TC(tp, cached_zone);
 
     return (atf_no_error());
 }
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+
+#include <sys/socket.h>
+
+/*
+ * Push data through an OMAPI connection's buffers to and from the other
+ * end of a socket pair, with normal and bulk sized buffers, and check
+ * that what comes out is what went in.   The connection's writer is
+ * called by the test, as the socket code would call it.   dhcpd_bench
+ * times how fast output queues up and drains.
+ */
+
+static omapi_connection_object_t *conn;
+static int peer = -1;
+
+static void
+setup(int bulk)
+{
+	int sv[2];
+
+	if (conn == NULL && omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	if (conn != NULL) {
+		if (conn->outbufs != NULL)
+			omapi_buffer_dereference(&conn->outbufs, MDL);
+		conn->outbufs_tail = NULL;
+		conn->out_bytes = 0;
+		close(conn->socket);
+		close(peer);
+		omapi_connection_dereference(&conn, MDL);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+	    fcntl(sv[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(sv[1], F_SETFL, O_NONBLOCK) < 0)
+		atf_tc_fail("can't make a socket pair");
+	peer = sv[1];
+
+	if (omapi_connection_allocate(&conn, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate a connection");
+	conn->socket = sv[0];
+	conn->state = omapi_connection_connected;
+	if (bulk &&
+	    omapi_connection_set_bulk((omapi_object_t *)conn) != ISC_R_SUCCESS)
+		atf_tc_fail("can't make the connection bulk");
+}
+
+/* The n'th byte of what's sent. */
+static unsigned char
+stream(unsigned long n)
+{
+	return (n * 7 + (n >> 9)) & 255;
+}
+
+/* Check that the tail pointer and byte count agree with the chain. */
+static void
+check_chain(void)
+{
+	omapi_buffer_t *b, *last = NULL;
+	unsigned long bytes = 0;
+
+	for (b = conn->outbufs; b != NULL; b = b->next) {
+		bytes += BYTES_IN_BUFFER(b);
+		last = b;
+	}
+	if (conn->outbufs_tail != last)
+		atf_tc_fail("the tail pointer isn't the last buffer");
+	if (bytes != conn->out_bytes)
+		atf_tc_fail("%lu bytes in the buffers, but out_bytes is %lu",
+			    bytes, (unsigned long)conn->out_bytes);
+}
+
+/* Read up to max bytes at the other end, checking them against the
+   stream, and return how many there were. */
+static unsigned long
+drain(unsigned long *got, unsigned long max)
+{
+	unsigned char buf[65536];
+	unsigned long total = 0;
+	ssize_t n, i;
+
+	while (total < max) {
+		n = read(peer, buf, (max - total < sizeof buf
+				     ? max - total : sizeof buf));
+		if (n <= 0)
+			break;
+		for (i = 0; i < n; i++)
+			if (buf[i] != stream(*got + i))
+				atf_tc_fail("byte %lu is wrong", *got + i);
+		*got += n;
+		total += n;
+	}
+	return total;
+}
+
+ATF_TC(omapi_buffer_chain);
+
+ATF_TC_HEAD(omapi_buffer_chain, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Check that output copied in and put "
+			  "together in place comes out at the other end.");
+}
+
+ATF_TC_BODY(omapi_buffer_chain, tc)
+{
+	unsigned char chunk[8192], *bufp;
+	unsigned long sent, got;
+	unsigned len, i, round;
+	isc_result_t status;
+	int bulk;
+
+	srandom(1);
+	for (bulk = 0; bulk < 2; bulk++) {
+		setup(bulk);
+		sent = got = 0;
+		for (round = 0; round < 20000; round++) {
+			len = random() % (bulk ? sizeof chunk : 3000) + 1;
+			if (random() % 3) {
+				for (i = 0; i < len; i++)
+					chunk[i] = stream(sent + i);
+				status = omapi_connection_copyin
+					((omapi_object_t *)conn, chunk, len);
+			} else {
+				status = omapi_connection_reserve
+					((omapi_object_t *)conn, len, &bufp);
+				if (status != ISC_R_SUCCESS)
+					atf_tc_fail("can't reserve %u", len);
+				for (i = 0; i < len; i++)
+					bufp[i] = stream(sent + i);
+				status = omapi_connection_commit
+					((omapi_object_t *)conn, len);
+			}
+			if (status != ISC_R_SUCCESS)
+				atf_tc_fail("can't queue %u bytes", len);
+			sent += len;
+			check_chain();
+
+			/* Write out now and then, reading some of it at
+			   the other end, so that the socket sometimes
+			   fills and the writer stops part way through. */
+			if (random() % 8 == 0) {
+				status = omapi_connection_writer
+					((omapi_object_t *)conn);
+				if (status != ISC_R_SUCCESS &&
+				    status != ISC_R_INPROGRESS)
+					atf_tc_fail("can't write: %s",
+						    isc_result_totext(status));
+				check_chain();
+				drain(&got, random() % 100000);
+			}
+		}
+
+		while (conn->out_bytes != 0) {
+			status = omapi_connection_writer((omapi_object_t *)conn);
+			if (status != ISC_R_SUCCESS &&
+			    status != ISC_R_INPROGRESS)
+				atf_tc_fail("can't write: %s",
+					    isc_result_totext(status));
+			drain(&got, sent);
+		}
+		drain(&got, sent);
+		if (got != sent)
+			atf_tc_fail("sent %lu bytes, got %lu", sent, got);
+		if (conn->outbufs != NULL || conn->outbufs_tail != NULL)
+			atf_tc_fail("buffers left after everything was sent");
+	}
+}
+
+ATF_TC(omapi_buffer_input);
+
+ATF_TC_HEAD(omapi_buffer_input, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Check that input read in through the "
+			  "buffers is copied out as it was sent.");
+}
+
+ATF_TC_BODY(omapi_buffer_input, tc)
+{
+	unsigned char chunk[20000];
+	unsigned long sent, got;
+	unsigned len, i, round;
+	ssize_t n;
+	int bulk;
+
+	srandom(2);
+	for (bulk = 0; bulk < 2; bulk++) {
+		setup(bulk);
+		sent = got = 0;
+		for (round = 0; round < 5000; round++) {
+			len = random() % sizeof chunk + 1;
+			for (i = 0; i < len; i++)
+				chunk[i] = stream(sent + i);
+			n = write(peer, chunk, len);
+			if (n > 0)
+				sent += n;
+
+			if (omapi_connection_reader((omapi_object_t *)conn) !=
+			    ISC_R_SUCCESS)
+				atf_tc_fail("can't read");
+			while (conn->in_bytes != 0) {
+				len = random() % 5000 + 1;
+				if (len > conn->in_bytes)
+					len = conn->in_bytes;
+				if (omapi_connection_copyout
+				    (chunk, (omapi_object_t *)conn, len) !=
+				    ISC_R_SUCCESS)
+					atf_tc_fail("can't copy out %u", len);
+				for (i = 0; i < len; i++)
+					if (chunk[i] != stream(got + i))
+						atf_tc_fail("byte %lu is wrong",
+							    got + i);
+				got += len;
+				if (random() % 4 == 0)
+					break;
+			}
+		}
+		if (got > sent || sent < 1000000)
+			atf_tc_fail("sent %lu bytes, got %lu", sent, got);
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, omapi_buffer_chain);
+	ATF_TP_ADD_TC(tp, omapi_buffer_input);
+
+	return (atf_no_error());
+}
@@ -141,11 +141,8 @@ ATF_TC_HEAD(parse_X, tc)
 static void init_parse(struct parse *cfile, char* name, char *input) {
     memset(cfile, 0, sizeof(struct parse));
     cfile->tlname = name;
-    cfile->lpos = cfile->line = 1;
-    cfile->cur_line = cfile->line1;
-    cfile->prev_line = cfile->line2;
-    cfile->token_line = cfile->cur_line;
-    cfile->cur_line[0] = cfile->prev_line[0] = 0;
+    cfile->line = 1;
+    cfile->token_line = cfile->line1;
     cfile->file = -1;
     cfile->eol_token = 0;
 
@@ -266,6 +263,440 @@ ATF_TC_BODY(add_option_ref_cnt, tc)
     }
 }
 
+/* A DHCPREQUEST with the options a typical client sends, plus a
+ * domain-name split in two as RFC 3396 allows, an empty host-name piece,
+ * an FQDN option (an encapsulation), and more options in the file field.
+ */
+static void
+build_request(struct packet *packet, struct dhcp_packet *raw)
+{
+    static const unsigned char options[] = {
+	99, 130, 83, 99,
+	53, 1, DHCPREQUEST,
+	52, 1, 1,
+	61, 7, 1, 0, 0x0c, 0x29, 0x12, 0x34, 0x56,
+	50, 4, 10, 0, 0, 7,
+	54, 4, 10, 0, 0, 1,
+	57, 2, 0x05, 0xdc,
+	51, 4, 0, 0, 0x0e, 0x10,
+	12, 4, 'h', 'o', 's', 't',
+	12, 0,
+	60, 8, 'M', 'S', 'F', 'T', ' ', '5', '.', '0',
+	81, 7, 0, 0, 0, 'h', 'o', 's', 't',
+	55, 20, 1, 3, 6, 15, 31, 33, 43, 44, 46, 47,
+		119, 121, 249, 252, 42, 2, 12, 26, 28, 40,
+	116, 1, 1,
+	145, 1, 1,
+	77, 4, 'u', 's', 'e', 'r',
+	93, 2, 0, 0,
+	94, 3, 1, 2, 1,
+	97, 17, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+	43, 6, 1, 4, 0, 0, 0, 1,
+	15, 3, 'e', 'x', 'a',
+	15, 8, 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+	255
+    };
+    static const unsigned char file[] = {
+	15, 4, '.', 'o', 'r', 'g',
+	66, 4, 't', 'f', 't', 'p',
+	255
+    };
+
+    memset(raw, 0, sizeof(*raw));
+    raw->op = BOOTREQUEST;
+    memcpy(raw->options, options, sizeof(options));
+    memcpy(raw->file, file, sizeof(file));
+
+    memset(packet, 0, sizeof(*packet));
+    packet->raw = raw;
+    packet->packet_length = DHCP_FIXED_NON_UDP + sizeof(options);
+    if (!option_state_allocate(&packet->options, MDL)) {
+	atf_tc_fail("can't allocate option state");
+    }
+}
+
+static void
+parse_request(struct packet *packet, struct dhcp_packet *raw, int lazy)
+{
+    build_request(packet, raw);
+    lazy_option_decode = lazy;
+    if (!parse_options(packet) || !packet->options_valid) {
+	atf_tc_fail("can't parse the options");
+    }
+    lazy_option_decode = 1;
+}
+
+/* Check code is the same in both option states. */
+static void
+compare_option(struct universe *universe, struct option_state *eager,
+	       struct option_state *lazy, unsigned code)
+{
+    struct option_cache *e, *l;
+
+    e = lookup_option(universe, eager, code);
+    l = lookup_option(universe, lazy, code);
+    if ((e == NULL) != (l == NULL)) {
+	atf_tc_fail("%s option %u %s when decoded lazily", universe->name,
+		    code, e == NULL ? "appears" : "is missing");
+    }
+    if (e == NULL) {
+	return;
+    }
+    if (e->data.len != l->data.len ||
+	memcmp(e->data.data, l->data.data, e->data.len) ||
+	e->flags != l->flags) {
+	atf_tc_fail("%s option %u differs when decoded lazily",
+		    universe->name, code);
+    }
+}
+
+ATF_TC(lazy_decode);
+
+ATF_TC_HEAD(lazy_decode, tc)
+{
+    atf_tc_set_md_var(tc, "descr",
+		      "Verify options decoded lazily are the same as those "
+		      "decoded at once.");
+}
+
+ATF_TC_BODY(lazy_decode, tc)
+{
+    struct dhcp_packet eraw, lraw;
+    struct packet eager, lazy;
+    struct option *option = NULL;
+    struct option_cache *oc;
+    unsigned code = DHO_DOMAIN_NAME;
+    int refcnt;
+
+    initialize_common_option_spaces();
+    if (!option_code_hash_lookup(&option, dhcp_universe.code_hash,
+				 &code, 0, MDL)) {
+	atf_tc_fail("can't find option 15");
+    }
+    refcnt = option->refcnt;
+
+    parse_request(&eager, &eraw, 0);
+    parse_request(&lazy, &lraw, 1);
+    if (lazy.options->pending == NULL) {
+	atf_tc_fail("the options weren't indexed");
+    }
+
+    /* The encapsulated FQDN option is decoded straight away. */
+    if (lookup_option(&fqdn_universe, lazy.options, FQDN_HOSTNAME) == NULL) {
+	atf_tc_fail("the FQDN option wasn't decoded");
+    }
+
+    oc = lookup_option(&dhcp_universe, lazy.options, DHO_DOMAIN_NAME);
+    if (oc == NULL || oc->data.len != 15 ||
+	memcmp(oc->data.data, "example.com.org", 15)) {
+	atf_tc_fail("domain-name wasn't put back together");
+    }
+    for (code = 0; code < 256; code++) {
+	compare_option(&dhcp_universe, eager.options, lazy.options, code);
+    }
+    for (code = 0; code < 256; code++) {
+	compare_option(&fqdn_universe, eager.options, lazy.options, code);
+    }
+
+    /* Deleting or replacing an option that hasn't been decoded yet
+     * works as it would have otherwise. */
+    option_state_dereference(&lazy.options, MDL);
+    parse_request(&lazy, &lraw, 1);
+    delete_option(&dhcp_universe, lazy.options, DHO_HOST_NAME);
+    if (lookup_option(&dhcp_universe, lazy.options, DHO_HOST_NAME)) {
+	atf_tc_fail("deleted host-name is still there");
+    }
+    if (!add_option(lazy.options, DHO_VENDOR_CLASS_IDENTIFIER, "x", 1) ||
+	(oc = lookup_option(&dhcp_universe, lazy.options,
+			    DHO_VENDOR_CLASS_IDENTIFIER)) == NULL ||
+	oc->expression == NULL) {
+	atf_tc_fail("vendor-class-identifier wasn't replaced");
+    }
+
+    option_state_dereference(&eager.options, MDL);
+    option_state_dereference(&lazy.options, MDL);
+    if (option->refcnt != refcnt) {
+	atf_tc_fail("refcnt changed from %d to %d", refcnt, option->refcnt);
+    }
+    option_dereference(&option, MDL);
+}
+
+/* The options a server might send in reply to a request. */
+static struct option_state *
+make_reply_options(void)
+{
+    static const struct {
+	unsigned code;
+	const char *data;
+	unsigned len;
+    } reply[] = {
+	{ DHO_SUBNET_MASK, "\xff\xff\xff\0", 4 },
+	{ DHO_ROUTERS, "\x0a\0\0\x01", 4 },
+	{ DHO_DOMAIN_NAME_SERVERS, "\x0a\0\0\x02\x0a\0\0\x03", 8 },
+	{ DHO_DOMAIN_NAME, "example.com", 11 },
+	{ DHO_BROADCAST_ADDRESS, "\x0a\0\0\xff", 4 },
+	{ DHO_NTP_SERVERS, "\x0a\0\0\x04", 4 },
+	{ DHO_NETBIOS_NAME_SERVERS, "\x0a\0\0\x05", 4 },
+	{ DHO_TIME_OFFSET, "\0\0\x0e\x10", 4 },
+	{ DHO_DHCP_LEASE_TIME, "\0\0\x0e\x10", 4 },
+	{ DHO_DHCP_RENEWAL_TIME, "\0\0\x07\x08", 4 },
+	{ DHO_DHCP_REBINDING_TIME, "\0\0\x0c\x4e", 4 },
+	{ DHO_DHCP_SERVER_IDENTIFIER, "\x0a\0\0\x01", 4 },
+	{ DHO_DHCP_MESSAGE_TYPE, "\x05", 1 },
+	{ DHO_HOST_NAME, "host", 4 },
+	{ DHO_INTERFACE_MTU, "\x05\xdc", 2 },
+	{ DHO_NIS_DOMAIN, "nis", 3 },
+	{ DHO_ROOT_PATH, "/export/root", 12 },
+	{ DHO_LOG_SERVERS, "\x0a\0\0\x06", 4 },
+	{ DHO_IP_FORWARDING, "\0", 1 },
+	{ DHO_DEFAULT_IP_TTL, "\x40", 1 },
+    };
+    struct option_state *options = NULL;
+    unsigned i;
+
+    if (!option_state_allocate(&options, MDL)) {
+	atf_tc_fail("can't allocate option state");
+    }
+    for (i = 0; i < sizeof(reply) / sizeof(reply[0]); i++) {
+	if (!add_option(options, reply[i].code, (void *)reply[i].data,
+			reply[i].len)) {
+	    atf_tc_fail("can't add option %u", reply[i].code);
+	}
+    }
+    return options;
+}
+
+/* Keep the dhcp option space's options in a hash, as they were kept
+ * before option tables, or in a table. */
+static void
+use_option_tables(int tables)
+{
+    dhcp_universe.lookup_func =
+	tables ? lookup_direct_option : lookup_hashed_option;
+    dhcp_universe.option_state_dereference =
+	tables ? direct_option_state_dereference
+	       : hashed_option_state_dereference;
+    dhcp_universe.save_func =
+	tables ? save_direct_option : save_hashed_option;
+    dhcp_universe.delete_func =
+	tables ? delete_direct_option : delete_hashed_option;
+    dhcp_universe.encapsulate =
+	tables ? direct_option_space_encapsulate
+	       : hashed_option_space_encapsulate;
+    dhcp_universe.foreach =
+	tables ? direct_option_space_foreach : hashed_option_space_foreach;
+}
+
+#define TABLE_CODES 300
+#define TABLE_CACHES 1000
+
+/* The code of the n'th option in the option table test; some are too
+ * big for the table. */
+#define TABLE_CODE(n) ((n) < 250 ? (n) : (n) * 97)
+
+/* Note which cache foreach visits for each option; caches are told apart
+ * by data.len. */
+static void
+note_option(struct option_cache *oc, struct packet *packet,
+	    struct lease *lease, struct client_state *client_state,
+	    struct option_state *in_options, struct option_state *cfg_options,
+	    struct binding_scope **scope, struct universe *u, void *stuff)
+{
+    int *seen = stuff;
+    unsigned n = oc->option->code;
+
+    if (n >= 250) {
+	n /= 97;
+    }
+    if (seen[n] != -1) {
+	atf_tc_fail("option %u visited twice", oc->option->code);
+    }
+    seen[n] = oc->data.len;
+}
+
+/* Let go of a cache's ->next list, if it isn't in an option state. */
+static int
+cache_unused(struct option_cache *oc)
+{
+    if (oc->refcnt != 1) {
+	return 0;
+    }
+    if (oc->next != NULL) {
+	option_cache_dereference(&oc->next, MDL);
+    }
+    return 1;
+}
+
+ATF_TC(option_table);
+
+ATF_TC_HEAD(option_table, tc)
+{
+    atf_tc_set_md_var(tc, "descr",
+		      "Verify options kept in a table behave as they did "
+		      "in a hash.");
+}
+
+ATF_TC_BODY(option_table, tc)
+{
+    struct option *options[TABLE_CODES];
+    struct option_cache *dcaches[TABLE_CACHES], *hcaches[TABLE_CACHES];
+    struct option_cache *d, *h;
+    struct option_state *direct = NULL, *hashed = NULL;
+    int dseen[TABLE_CODES], hseen[TABLE_CODES];
+    struct universe shadow;
+    unsigned code, i, n, round;
+    struct dhcp_packet raw;
+    struct packet packet;
+    struct dhcp_packet out[2];
+    struct data_string prl;
+    struct option_state *cfg;
+    struct option_cache *oc;
+    int len[2], t;
+
+    initialize_common_option_spaces();
+
+    /* The DHCPv6 space in a table, and a copy of it in a hash.   Each
+     * state gets its own caches, as their ->next lists are changed when
+     * they're appended to. */
+    shadow = dhcpv6_universe;
+    shadow.lookup_func = lookup_hashed_option;
+    shadow.save_func = save_hashed_option;
+    shadow.delete_func = delete_hashed_option;
+    shadow.foreach = hashed_option_space_foreach;
+    for (n = 0; n < TABLE_CODES; n++) {
+	options[n] = NULL;
+	option_reference(&options[n], new_option("test", MDL), MDL);
+	options[n]->universe = &dhcpv6_universe;
+	options[n]->code = TABLE_CODE(n);
+	options[n]->format = default_option_format;
+    }
+    srandom(1);
+    for (i = 0; i < TABLE_CACHES; i++) {
+	n = random() % TABLE_CODES;
+	dcaches[i] = hcaches[i] = NULL;
+	if (!option_cache_allocate(&dcaches[i], MDL) ||
+	    !option_cache_allocate(&hcaches[i], MDL)) {
+	    atf_tc_fail("can't allocate an option cache");
+	}
+	option_reference(&dcaches[i]->option, options[n], MDL);
+	option_reference(&hcaches[i]->option, options[n], MDL);
+	dcaches[i]->data.len = hcaches[i]->data.len = i;
+    }
+    if (!option_state_allocate(&direct, MDL) ||
+	!option_state_allocate(&hashed, MDL)) {
+	atf_tc_fail("can't allocate option states");
+    }
+
+    for (round = 0; round < 50000; round++) {
+	i = random() % TABLE_CACHES;
+	code = dcaches[i]->option->code;
+	switch (random() % 4) {
+	  case 0:
+	    delete_option(&dhcpv6_universe, direct, code);
+	    delete_option(&shadow, hashed, code);
+	    break;
+	  case 1:
+	    if (cache_unused(dcaches[i]) && cache_unused(hcaches[i])) {
+		save_direct_option(&dhcpv6_universe, direct, dcaches[i],
+				   ISC_TRUE);
+		save_hashed_option(&shadow, hashed, hcaches[i], ISC_TRUE);
+	    }
+	    break;
+	  default:
+	    if (cache_unused(dcaches[i]) && cache_unused(hcaches[i])) {
+		save_option(&dhcpv6_universe, direct, dcaches[i]);
+		save_option(&shadow, hashed, hcaches[i]);
+	    }
+	    break;
+	}
+
+	if (round % 100 != 0) {
+	    continue;
+	}
+	for (n = 0; n < TABLE_CODES; n++) {
+	    d = lookup_option(&dhcpv6_universe, direct, TABLE_CODE(n));
+	    h = lookup_option(&shadow, hashed, TABLE_CODE(n));
+	    for (; d != NULL && h != NULL; d = d->next, h = h->next) {
+		if (d->data.len != h->data.len) {
+		    break;
+		}
+	    }
+	    if (d != NULL || h != NULL) {
+		atf_tc_fail("option %u differs after %u changes",
+			    TABLE_CODE(n), round);
+	    }
+	}
+	memset(dseen, -1, sizeof(dseen));
+	memset(hseen, -1, sizeof(hseen));
+	option_space_foreach(NULL, NULL, NULL, NULL, direct, NULL,
+			     &dhcpv6_universe, dseen, note_option);
+	option_space_foreach(NULL, NULL, NULL, NULL, hashed, NULL,
+			     &shadow, hseen, note_option);
+	if (memcmp(dseen, hseen, sizeof(dseen))) {
+	    atf_tc_fail("different options visited after %u changes", round);
+	}
+    }
+
+    /* Everything is let go of. */
+    hashed_option_state_dereference(&shadow, hashed, MDL);
+    option_state_dereference(&hashed, MDL);
+    option_state_dereference(&direct, MDL);
+    for (i = 0; i < TABLE_CACHES; i++) {
+	if (dcaches[i]->next != NULL) {
+	    option_cache_dereference(&dcaches[i]->next, MDL);
+	}
+	if (hcaches[i]->next != NULL) {
+	    option_cache_dereference(&hcaches[i]->next, MDL);
+	}
+    }
+    for (i = 0; i < TABLE_CACHES; i++) {
+	if (dcaches[i]->refcnt != 1 || hcaches[i]->refcnt != 1) {
+	    atf_tc_fail("option cache %u is still referenced", i);
+	}
+	option_cache_dereference(&dcaches[i], MDL);
+	option_cache_dereference(&hcaches[i], MDL);
+    }
+    for (n = 0; n < TABLE_CODES; n++) {
+	if (options[n]->refcnt != 1) {
+	    atf_tc_fail("option %u is still referenced", TABLE_CODE(n));
+	}
+	option_dereference(&options[n], MDL);
+    }
+
+    /* cons_options() makes the same reply either way when the client
+     * asks for particular options, and one the same size (in code order
+     * rather than hash order) when it doesn't. */
+    for (t = 0; t < 2; t++) {
+	use_option_tables(t);
+	parse_request(&packet, &raw, 1);
+	packet.packet_type = DHCPREQUEST;
+	cfg = make_reply_options();
+	memset(&prl, 0, sizeof(prl));
+	oc = lookup_option(&dhcp_universe, packet.options,
+			   DHO_DHCP_PARAMETER_REQUEST_LIST);
+	data_string_copy(&prl, &oc->data, MDL);
+	len[t] = cons_options(&packet, &out[t], NULL, NULL, 0,
+			      packet.options, cfg, NULL, 0, 0, 0, &prl, NULL);
+	data_string_forget(&prl, MDL);
+	option_state_dereference(&cfg, MDL);
+	option_state_dereference(&packet.options, MDL);
+    }
+    if (len[0] == 0 || len[0] != len[1] ||
+	memcmp(out[0].options, out[1].options, len[0] - DHCP_FIXED_NON_UDP)) {
+	atf_tc_fail("cons_options() made a different reply");
+    }
+    for (t = 0; t < 2; t++) {
+	use_option_tables(t);
+	cfg = make_reply_options();
+	len[t] = cons_options(NULL, &out[t], NULL, NULL, 0, NULL, cfg, NULL,
+			      0, 0, 0, NULL, NULL);
+	option_state_dereference(&cfg, MDL);
+    }
+    if (len[0] == 0 || len[0] != len[1]) {
+	atf_tc_fail("cons_options() made a different sized reply");
+    }
+}
+
 /* This macro defines main() method that will call specified
    test cases. tp and simple_test_case names can be whatever you want
    as long as it is a valid variable identifier. */
@@ -275,6 +706,8 @@ ATF_TP_ADD_TCS(tp)
     ATF_TP_ADD_TC(tp, pretty_print_option);
     ATF_TP_ADD_TC(tp, parse_X);
     ATF_TP_ADD_TC(tp, add_option_ref_cnt);
+    ATF_TP_ADD_TC(tp, lazy_decode);
+    ATF_TP_ADD_TC(tp, option_table);
 
     return (atf_no_error());
 }
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+#include <poll.h>
+
+/*
+ * Send DHCPACKs across a veth pair the way delayed_acks_timer() does
+ * with delayed-ack enabled: a group of them at a time once the leases
+ * are committed.   They are sent once one by one and once inside a send
+ * batch, and every one is checked on the other end; dhcpd_bench times
+ * the two.   Making the veth pair needs root and the ip command; the
+ * test is skipped without them.
+ */
+
+#if defined (USE_SEND_BATCH) && defined (USE_LPF_SEND)
+#include <errno.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define SERVER_IF	"dbat0"
+#define CLIENT_IF	"dbat1"
+#define ACK_GROUP	28	/* The default delayed-ack. */
+#define COUNT		1000
+
+static void
+veth_down(void)
+{
+	if (system("ip link del " SERVER_IF " 2>/dev/null")) {
+		/* It may not have been there. */
+	}
+}
+
+/* Makes the pair, or returns zero if we can't. */
+static int
+veth_up(void)
+{
+	veth_down();
+	return system("ip link add " SERVER_IF " type veth peer name "
+		      CLIENT_IF " && ip link set " SERVER_IF " up && "
+		      "ip link set " CLIENT_IF " up") == 0;
+}
+
+static struct interface_info *
+make_interface(const char *name)
+{
+	struct interface_info *ip = NULL;
+
+	if (interface_allocate(&ip, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate an interface");
+	strcpy(ip->name, name);
+	ip->ifp = dmalloc(sizeof (struct ifreq), MDL);
+	if (ip->ifp == NULL)
+		atf_tc_fail("can't allocate an ifreq");
+	strcpy(ip->ifp->ifr_name, name);
+	ip->rfdesc = ip->wfdesc = -1;
+	ip->flags = INTERFACE_REQUESTED;
+	return ip;
+}
+
+/* A packet socket capturing IP on the client end. */
+static int
+client_socket(void)
+{
+	struct sockaddr_ll sll;
+	int fd, size = 4 * 1024 * 1024;
+
+	fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if (fd < 0)
+		atf_tc_fail("can't open a packet socket: %s", strerror(errno));
+	memset(&sll, 0, sizeof sll);
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_ifindex = if_nametoindex(CLIENT_IF);
+	if (bind(fd, (struct sockaddr *)&sll, sizeof sll) < 0)
+		atf_tc_fail("can't bind the packet socket: %s",
+			    strerror(errno));
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size) < 0)
+		atf_tc_fail("can't size the packet socket: %s",
+			    strerror(errno));
+	return fd;
+}
+
+/* Makes the DHCPACK for client n, returning its length. */
+static unsigned
+build_ack(struct dhcp_packet *raw, unsigned n)
+{
+	memset(raw, 0, sizeof *raw);
+	raw->op = BOOTREPLY;
+	raw->htype = HTYPE_ETHER;
+	raw->hlen = 6;
+	raw->xid = htonl(n);
+	raw->yiaddr.s_addr = htonl(0x0a000000 + (n & 0xffff));
+	memcpy(raw->options, DHCP_OPTIONS_COOKIE, 4);
+	raw->options[4] = DHO_DHCP_MESSAGE_TYPE;
+	raw->options[5] = 1;
+	raw->options[6] = DHCPACK;
+	raw->options[7] = DHO_END;
+	return DHCP_FIXED_NON_UDP + 8;
+}
+
+/* Reads ACKs from the client end until the ones numbered up to last
+   have all turned up, checking they come in order. */
+static void
+drain(int cfd, unsigned *next, unsigned last)
+{
+	unsigned char frame[1536];
+	struct dhcp_packet raw;
+	struct pollfd pfd;
+	unsigned len;
+	ssize_t n;
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	while (*next < last) {
+		if (poll(&pfd, 1, 1000) != 1)
+			atf_tc_fail("timed out waiting for ACK %u", *next);
+		n = read(cfd, frame, sizeof frame);
+		len = build_ack(&raw, *next);
+		/* Skip anything else that turns up. */
+		if (n != 14 + 28 + len || frame[14 + 9] != IPPROTO_UDP ||
+		    (frame[14 + 22] << 8 | frame[14 + 23]) != 68)
+			continue;
+		if (memcmp(frame + 14 + 28, &raw, len))
+			atf_tc_fail("ACK %u came in wrong", *next);
+		(*next)++;
+	}
+}
+
+/* Sends COUNT ACKs from the server end in groups, batched or not, and
+   checks that they all get to the client end. */
+static void
+run(struct interface_info *server, int cfd, int batch)
+{
+	struct dhcp_packet raw;
+	struct sockaddr_in to;
+	struct in_addr from;
+	unsigned len, sent, got, i;
+
+	memset(&to, 0, sizeof to);
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = INADDR_BROADCAST;
+	to.sin_port = htons(68);
+	from.s_addr = htonl(0x0a000001);
+
+	for (sent = got = 0; sent < COUNT; ) {
+		if (batch)
+			send_batch_begin();
+		for (i = 0; i < ACK_GROUP && sent < COUNT; i++, sent++) {
+			len = build_ack(&raw, sent);
+			if (send_packet(server, NULL, &raw, len, from,
+					&to, NULL) < 0)
+				atf_tc_fail("send_packet: %s",
+					    strerror(errno));
+		}
+		if (batch)
+			send_batch_end();
+		drain(cfd, &got, sent);
+	}
+}
+
+#endif /* USE_SEND_BATCH && USE_LPF_SEND */
+
+ATF_TC(ack_batch);
+
+ATF_TC_HEAD(ack_batch, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Delayed ACKs arrive intact and in "
+			  "order when sent one by one and in a batch.");
+	atf_tc_set_md_var(tc, "require.user", "root");
+}
+
+#if defined (USE_SEND_BATCH) && defined (USE_LPF_SEND)
+ATF_TC_BODY(ack_batch, tc)
+{
+	struct interface_info *server;
+	int cfd;
+
+	if (!veth_up())
+		atf_tc_skip("can't make a veth pair");
+	local_port = htons(67);
+	remote_port = htons(68);
+	quiet_interface_discovery = 1;
+	dhcp_common_objects_setup();
+
+	/* send_batch_end() flushes the interfaces on the list. */
+	cfd = client_socket();
+	server = make_interface(SERVER_IF);
+	interface_reference(&interfaces, server, MDL);
+	if_register_receive(server);
+	if_register_send(server);
+
+	run(server, cfd, 0);
+	run(server, cfd, 1);
+	if (server->tbuf_len != 0 || send_batching != 0)
+		atf_tc_fail("ACKs left queued after the batch");
+
+	if_deregister_send(server);
+	if_deregister_receive(server);
+	close(cfd);
+	interface_dereference(&interfaces, MDL);
+	interface_dereference(&server, MDL);
+	veth_down();
+}
+#else
+ATF_TC_BODY(ack_batch, tc)
+{
+	atf_tc_skip("built without batched sending");
+}
+#endif /* USE_SEND_BATCH && USE_LPF_SEND */
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, ack_batch);
+
+	return (atf_no_error());
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+#include <poll.h>
+
+/*
+ * Send DHCPDISCOVERs across a veth pair to an interface listening with
+ * LPF and then with AF_XDP, and check that every one arrives intact and
+ * that a reply sent back comes out the other end.  dhcpd_bench times
+ * the two.  Making the veth pair needs root and the ip command; the test
+ * is skipped without them.
+ */
+
+#if defined (USE_AF_XDP)
+#include <errno.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define SERVER_IF	"dxdp0"
+#define CLIENT_IF	"dxdp1"
+#define BURST		64
+#define COUNT		1000
+
+static void
+veth_down(void)
+{
+	if (system("ip link del " SERVER_IF " 2>/dev/null")) {
+		/* It may not have been there. */
+	}
+}
+
+/* Makes the pair, or returns zero if we can't. */
+static int
+veth_up(void)
+{
+	veth_down();
+	return system("ip link add " SERVER_IF " type veth peer name "
+		      CLIENT_IF " && ip link set " SERVER_IF " up && "
+		      "ip link set " CLIENT_IF " up") == 0;
+}
+
+static struct interface_info *
+make_interface(const char *name, u_int32_t flags)
+{
+	struct interface_info *ip = NULL;
+
+	if (interface_allocate(&ip, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate an interface");
+	strcpy(ip->name, name);
+	ip->ifp = dmalloc(sizeof (struct ifreq), MDL);
+	if (ip->ifp == NULL)
+		atf_tc_fail("can't allocate an ifreq");
+	strcpy(ip->ifp->ifr_name, name);
+	ip->rfdesc = ip->wfdesc = -1;
+	ip->flags = INTERFACE_REQUESTED | flags;
+	return ip;
+}
+
+/* A packet socket on the client end, to send frames or, given a
+   protocol, to capture them as well. */
+static int
+client_socket(int protocol)
+{
+	struct sockaddr_ll sll;
+	int fd;
+
+	fd = socket(PF_PACKET, SOCK_RAW, htons(protocol));
+	if (fd < 0)
+		atf_tc_fail("can't open a packet socket: %s", strerror(errno));
+	memset(&sll, 0, sizeof sll);
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(protocol);
+	sll.sll_ifindex = if_nametoindex(CLIENT_IF);
+	if (bind(fd, (struct sockaddr *)&sll, sizeof sll) < 0)
+		atf_tc_fail("can't bind the packet socket: %s",
+			    strerror(errno));
+	return fd;
+}
+
+/* Builds a DHCPDISCOVER frame from the client end, as a client would,
+   returning its length; the payload and its length are left in raw and
+   *len. */
+static unsigned
+build_discover(struct interface_info *client, unsigned char *frame,
+	      struct dhcp_packet *raw, unsigned *len)
+{
+	unsigned bufix = 0;
+
+	memset(raw, 0, sizeof *raw);
+	raw->op = BOOTREQUEST;
+	raw->htype = HTYPE_ETHER;
+	raw->hlen = 6;
+	raw->xid = htonl(0x12345678);
+	memcpy(raw->chaddr, &client->hw_address.hbuf[1], 6);
+	memcpy(raw->options, DHCP_OPTIONS_COOKIE, 4);
+	raw->options[4] = DHO_DHCP_MESSAGE_TYPE;
+	raw->options[5] = 1;
+	raw->options[6] = DHCPDISCOVER;
+	raw->options[7] = DHO_END;
+	*len = DHCP_FIXED_NON_UDP + 8;
+
+	assemble_hw_header(client, frame, &bufix, NULL);
+	assemble_udp_ip_header(client, frame, &bufix, INADDR_ANY,
+			       INADDR_BROADCAST, htons(67),
+			       (unsigned char *)raw, *len);
+	memcpy(frame + bufix, raw, *len);
+	return bufix + *len;
+}
+
+/* Waits for something to read on fd. */
+static void
+wait_for(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 1000) != 1)
+		atf_tc_fail("timed out waiting for packets");
+}
+
+/* Sends COUNT DHCPDISCOVERs to the server end and checks that each one
+   is read there intact. */
+static void
+run(struct interface_info *server, struct interface_info *client, int sfd)
+{
+	unsigned char frame[1536], buf[1536];
+	struct dhcp_packet raw;
+	struct sockaddr_in from;
+	struct hardware hfrom;
+	unsigned len, paylen, sent, got, i;
+	ssize_t result;
+
+	len = build_discover(client, frame, &raw, &paylen);
+
+	for (sent = got = 0; sent < COUNT; ) {
+		for (i = 0; i < BURST && sent < COUNT; i++, sent++)
+			if (write(sfd, frame, len) != len)
+				atf_tc_fail("can't send: %s", strerror(errno));
+		while (got < sent) {
+			if (server->rbuf_offset == server->rbuf_len)
+				wait_for(server->rfdesc);
+			result = receive_packet(server, buf, sizeof buf,
+						&from, &hfrom);
+			if (result < 0)
+				atf_tc_fail("receive_packet: %s",
+					    strerror(errno));
+			if (result == 0)
+				continue;
+			if (result != paylen || memcmp(buf, &raw, paylen) ||
+			    memcmp(&hfrom.hbuf[1], &client->hw_address.hbuf[1], 6))
+				atf_tc_fail("packet %u came in wrong", got);
+			got++;
+		}
+	}
+}
+
+/* Sends a DHCPOFFER from the server end and checks it comes out of the
+   client end. */
+static void
+reply(struct interface_info *server)
+{
+	unsigned char frame[1536];
+	struct dhcp_packet raw;
+	struct sockaddr_in to;
+	struct in_addr from;
+	unsigned len;
+	ssize_t n;
+	int cfd;
+
+	memset(&raw, 0, sizeof raw);
+	raw.op = BOOTREPLY;
+	raw.xid = htonl(0x87654321);
+	memcpy(raw.options, DHCP_OPTIONS_COOKIE, 4);
+	raw.options[4] = DHO_END;
+	len = DHCP_FIXED_NON_UDP + 5;
+
+	memset(&to, 0, sizeof to);
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = INADDR_BROADCAST;
+	to.sin_port = htons(68);
+	from.s_addr = htonl(0x0a000001);
+	cfd = client_socket(ETH_P_IP);
+	if (send_packet(server, NULL, &raw, len, from, &to, NULL) < 0)
+		atf_tc_fail("send_packet: %s", strerror(errno));
+
+	/* Skip anything else that turns up. */
+	for (;;) {
+		wait_for(cfd);
+		n = read(cfd, frame, sizeof frame);
+		if (n == 14 + 28 + len &&
+		    !memcmp(frame + 14 + 28, &raw, len))
+			break;
+	}
+	close(cfd);
+}
+
+#endif /* USE_AF_XDP */
+
+ATF_TC(xdp_receive);
+
+ATF_TC_HEAD(xdp_receive, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Packets are received and sent "
+			  "intact with LPF and with AF_XDP.");
+	atf_tc_set_md_var(tc, "require.user", "root");
+}
+
+#if defined (USE_AF_XDP)
+ATF_TC_BODY(xdp_receive, tc)
+{
+	struct interface_info *server, *client;
+	int sfd;
+
+	if (!veth_up())
+		atf_tc_skip("can't make a veth pair");
+	local_port = htons(67);
+	remote_port = htons(68);
+	quiet_interface_discovery = 1;
+	dhcp_common_objects_setup();
+
+	client = make_interface(CLIENT_IF, 0);
+	get_hw_addr(CLIENT_IF, &client->hw_address);
+	sfd = client_socket(0);
+
+	server = make_interface(SERVER_IF, 0);
+	if_register_receive(server);
+	if_register_send(server);
+	run(server, client, sfd);
+	reply(server);
+	if_deregister_send(server);
+	if_deregister_receive(server);
+
+	server->flags |= INTERFACE_XDP;
+	if_register_receive(server);
+	if_register_send(server);
+	if (server->xdp == NULL) {
+		veth_down();
+		atf_tc_skip("can't set up AF_XDP on " SERVER_IF);
+	}
+	run(server, client, sfd);
+	reply(server);
+	if_deregister_send(server);
+	if_deregister_receive(server);
+
+	close(sfd);
+	interface_dereference(&server, MDL);
+	interface_dereference(&client, MDL);
+	veth_down();
+}
+#else
+ATF_TC_BODY(xdp_receive, tc)
+{
+	atf_tc_skip("built without AF_XDP support");
+}
+#endif /* USE_AF_XDP */
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, xdp_receive);
+
+	return (atf_no_error());
+}
@@ -253,7 +253,7 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	int result;
 	int fudge;
 
-	if (!strcmp (interface -> name, "fallback"))
+	if (interface -> flags & INTERFACE_FALLBACK)
 		return send_fallback (interface, packet, raw,
 				      len, from, to, hto);
 
@@ -0,0 +1,546 @@
+/* xdp.c
+
+   AF_XDP sockets for the Linux packet filter code. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * An interface given to dhcpd with -xdp gets an AF_XDP socket in place
+ * of its LPF socket.  A small XDP program attached to the interface
+ * redirects DHCP packets for our port into the socket's receive ring,
+ * and lets everything else carry on into the kernel.  The socket owns
+ * a region of memory (the UMEM) cut into frames; frames travel between
+ * us and the kernel on four rings:
+ *
+ *	fill		frames we give the kernel to receive into
+ *	rx		frames the kernel has received a packet into
+ *	tx		frames we want sent
+ *	completion	frames the kernel has finished sending
+ *
+ * The first half of the frames start out on the fill ring and go back
+ * onto it as soon as a packet has been copied out of them; the second
+ * half are kept on a free list for sending.  lpf.c decodes packets in
+ * place in their frames and assembles replies directly into them, so
+ * the only copy left is that of the DHCP payload into got_one()'s
+ * buffer.
+ *
+ * Everything is done with plain system calls, so there is no need for
+ * libbpf.  The program is attached with a bpf link, which the kernel
+ * takes down when the link is closed or the server exits.  Native
+ * (driver) mode is tried first and generic (SKB) mode after that, and
+ * the socket is bound without asking for zero copy, so that any
+ * interface, veth pairs included, will do.  If anything fails the
+ * interface goes back to LPF.
+ *
+ * Only receive queue 0 is bound.  On an interface with several queues,
+ * DHCP packets arriving on the others aren't redirected and never
+ * reach us, so either run it with one queue or steer DHCP to queue 0.
+ */
+
+#include "dhcpd.h"
+
+#if defined (USE_AF_XDP)
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include "includes/netinet/if_ether.h"
+
+#ifndef AF_XDP
+#define AF_XDP		44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP		283
+#endif
+
+#define XDP_FRAME_SIZE	2048
+#define XDP_RING_SIZE	512
+#define XDP_NUM_FRAMES	(2 * XDP_RING_SIZE)
+#define XDP_TX_KICKS	(XDP_RING_SIZE / 32)	/* Copy mode sends 32 a time. */
+
+struct xdp_ring {
+	u_int32_t *producer;
+	u_int32_t *consumer;
+	void *descs;
+	void *map;
+	size_t map_len;
+};
+
+struct xdp_socket {
+	int fd;
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+	unsigned char *umem;
+	struct xdp_ring fill;
+	struct xdp_ring comp;
+	struct xdp_ring rx;
+	struct xdp_ring tx;
+	u_int64_t tx_free [XDP_NUM_FRAMES - XDP_RING_SIZE];
+	unsigned tx_free_count;
+};
+
+/* The rings are shared with the kernel: read the other side's index
+   before looking at the descriptors it covers, and write ours after
+   we're done with them. */
+#define ring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ring_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* The XDP program.   Packets are passed to the kernel unless they are
+   unfragmented IPv4 UDP to our port, which are redirected to whatever
+   socket the map has for the queue they came in on.   Loads from the
+   packet are converted from network byte order, so the constants we
+   compare them with are in host order.
+
+   The program is built when it's loaded, with the ports and the map
+   filled in as it goes.   Jumps that give the packet to the kernel are
+   emitted with XDP_JUMP_PASS and pointed at the end of the program once
+   that is known, so instructions can be added without counting. */
+
+#define XDP_INSN(code, dst, src, off, imm)	\
+	{ (code), (dst), (src), (off), (imm) }
+
+#define XDP_MAX_INSNS	40
+
+#define XDP_EMIT(code, dst, src, off, imm)				\
+	do {								\
+		struct bpf_insn insn_ = XDP_INSN(code, dst, src, off, imm); \
+		prog [len++] = insn_;					\
+	} while (0)
+#define XDP_JUMP_PASS(code, dst, src, imm)				\
+	do {								\
+		pass_jumps [npass++] = len;				\
+		XDP_EMIT(code, dst, src, 0, imm);			\
+	} while (0)
+
+static unsigned xdp_build_program (struct bpf_insn *prog, int map_fd)
+{
+	unsigned pass_jumps [8];
+	unsigned len = 0, npass = 0, i;
+	u_int16_t other_port = ntohs(local_port);
+
+#if defined (RELAY_PORT)
+	if (relay_port)
+		other_port = ntohs(relay_port);
+#endif
+
+	/* r6 = ctx; r2 = data; r3 = data_end */
+	XDP_EMIT(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0);
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0);
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0);
+
+	/* Room for the Ethernet header and the smallest IP header? */
+	XDP_EMIT(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0);
+	XDP_EMIT(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 34);
+	XDP_JUMP_PASS(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0);
+
+	/* Make sure this is an IP packet... */
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0);
+	XDP_EMIT(BPF_ALU | BPF_END | BPF_TO_BE, 5, 0, 0, 16);
+	XDP_JUMP_PASS(BPF_JMP | BPF_JNE | BPF_K, 5, 0, ETHERTYPE_IP);
+
+	/* Make sure it's a UDP packet... */
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0);
+	XDP_JUMP_PASS(BPF_JMP | BPF_JNE | BPF_K, 5, 0, IPPROTO_UDP);
+
+	/* Make sure this isn't a fragment... */
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 20, 0);
+	XDP_EMIT(BPF_ALU | BPF_END | BPF_TO_BE, 5, 0, 0, 16);
+	XDP_JUMP_PASS(BPF_JMP | BPF_JSET | BPF_K, 5, 0, 0x1fff);
+
+	/* Skip over the IP header, and make sure the UDP header is there. */
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0);
+	XDP_EMIT(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, 0x0f);
+	XDP_EMIT(BPF_ALU64 | BPF_LSH | BPF_K, 5, 0, 0, 2);
+	XDP_JUMP_PASS(BPF_JMP | BPF_JLT | BPF_K, 5, 0, 20);
+	XDP_EMIT(BPF_ALU64 | BPF_ADD | BPF_X, 2, 5, 0, 0);
+	XDP_EMIT(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0);
+	XDP_EMIT(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 22);
+	XDP_JUMP_PASS(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0);
+
+	/* Make sure it's to the right port (or the relay port)... */
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 16, 0);
+	XDP_EMIT(BPF_ALU | BPF_END | BPF_TO_BE, 5, 0, 0, 16);
+	XDP_EMIT(BPF_JMP | BPF_JEQ | BPF_K, 5, 0, 1, ntohs(local_port));
+	XDP_JUMP_PASS(BPF_JMP | BPF_JNE | BPF_K, 5, 0, other_port);
+
+	/* Redirect it to the socket for its queue, or pass it if there
+	   isn't one.   Loading the map takes two instructions. */
+	XDP_EMIT(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+	XDP_EMIT(0, 0, 0, 0, 0);
+	XDP_EMIT(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0);
+	XDP_EMIT(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS);
+	XDP_EMIT(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+	XDP_EMIT(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	/* Otherwise, let the kernel have it. */
+	for (i = 0; i < npass; i++)
+		prog [pass_jumps [i]].off = len - (pass_jumps [i] + 1);
+	XDP_EMIT(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);
+	XDP_EMIT(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	return len;
+}
+
+static int sys_bpf (int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof *attr);
+}
+
+static int xdp_load_program (int map_fd)
+{
+	struct bpf_insn prog [XDP_MAX_INSNS];
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (unsigned long)prog;
+	attr.insn_cnt = xdp_build_program(prog, map_fd);
+	attr.license = (unsigned long)"MPL-2.0";
+	return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int xdp_map_ring (struct xdp_socket *xs, struct xdp_ring *ring,
+			 struct xdp_ring_offset *off, off_t pgoff,
+			 size_t desc_size)
+{
+	unsigned char *map;
+
+	ring->map_len = off->desc + XDP_RING_SIZE * desc_size;
+	map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, xs->fd, pgoff);
+	if (map == MAP_FAILED) {
+		ring->map = NULL;
+		return 0;
+	}
+	ring->map = map;
+	ring->producer = (u_int32_t *)(map + off->producer);
+	ring->consumer = (u_int32_t *)(map + off->consumer);
+	ring->descs = map + off->desc;
+	return 1;
+}
+
+/* The program only redirects packets from queues that have a socket in
+   the map, and we only bind to queue 0. */
+static void xdp_check_queues (struct interface_info *info)
+{
+	struct ethtool_channels ch;
+	struct ifreq ifr;
+
+	memset(&ch, 0, sizeof ch);
+	ch.cmd = ETHTOOL_GCHANNELS;
+	memset(&ifr, 0, sizeof ifr);
+	strncpy(ifr.ifr_name, info->name, sizeof ifr.ifr_name);
+	ifr.ifr_name[IFNAMSIZ-1] = '\0';
+	ifr.ifr_data = (void *)&ch;
+	if (ioctl(info->xdp->fd, SIOCETHTOOL, &ifr) < 0)
+		return;
+	if (ch.rx_count + ch.combined_count > 1)
+		log_error("%s has %u receive queues but XDP only reads "
+			  "queue 0; DHCP packets on the others are lost.",
+			  info->name, ch.rx_count + ch.combined_count);
+}
+
+void xdp_socket_close (struct xdp_socket **xsp)
+{
+	struct xdp_socket *xs = *xsp;
+	struct xdp_ring *ring;
+	struct xdp_ring *rings [4];
+	int i;
+
+	if (xs == NULL)
+		return;
+	*xsp = NULL;
+
+	/* Closing the link takes the program off the interface. */
+	if (xs->link_fd >= 0)
+		close(xs->link_fd);
+	if (xs->prog_fd >= 0)
+		close(xs->prog_fd);
+	if (xs->map_fd >= 0)
+		close(xs->map_fd);
+
+	rings [0] = &xs->fill;
+	rings [1] = &xs->comp;
+	rings [2] = &xs->rx;
+	rings [3] = &xs->tx;
+	for (i = 0; i < 4; i++) {
+		ring = rings [i];
+		if (ring->map != NULL)
+			munmap(ring->map, ring->map_len);
+	}
+	if (xs->fd >= 0)
+		close(xs->fd);
+	if (xs->umem != NULL)
+		munmap(xs->umem, XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+	dfree(xs, MDL);
+}
+
+/* Sets up an AF_XDP socket on the interface and attaches the program
+   that feeds it.   Returns nonzero on success, with the socket hung
+   on the interface and its descriptor in rfdesc.   On failure the
+   reason is logged, and the caller should fall back to LPF. */
+int if_register_xdp (struct interface_info *info)
+{
+	struct xdp_socket *xs;
+	struct xdp_umem_reg mr;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	union bpf_attr attr;
+	socklen_t optlen;
+	u_int64_t *fill;
+	const char *what;
+	unsigned ifindex;
+	int size = XDP_RING_SIZE;
+	int key = 0;
+	int i;
+
+	ifindex = if_nametoindex(info->name);
+	if (ifindex == 0) {
+		log_error("XDP: can't get the index of %s: %m", info->name);
+		return 0;
+	}
+
+	xs = dmalloc(sizeof *xs, MDL);
+	if (xs == NULL) {
+		log_error("XDP: no memory for %s.", info->name);
+		return 0;
+	}
+	xs->fd = xs->map_fd = xs->prog_fd = xs->link_fd = -1;
+	info->xdp = xs;
+
+	what = "allocate the UMEM";
+	xs->umem = mmap(NULL, XDP_NUM_FRAMES * XDP_FRAME_SIZE,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0);
+	if (xs->umem == MAP_FAILED) {
+		xs->umem = NULL;
+		goto fail;
+	}
+
+	what = "open an AF_XDP socket";
+	xs->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xs->fd < 0)
+		goto fail;
+
+	what = "register the UMEM";
+	memset(&mr, 0, sizeof mr);
+	mr.addr = (unsigned long)xs->umem;
+	mr.len = XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	mr.chunk_size = XDP_FRAME_SIZE;
+	if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof mr) < 0)
+		goto fail;
+
+	what = "size the rings";
+	if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+		       &size, sizeof size) < 0 ||
+	    setsockopt(xs->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+		       &size, sizeof size) < 0 ||
+	    setsockopt(xs->fd, SOL_XDP, XDP_RX_RING,
+		       &size, sizeof size) < 0 ||
+	    setsockopt(xs->fd, SOL_XDP, XDP_TX_RING,
+		       &size, sizeof size) < 0)
+		goto fail;
+
+	what = "map the rings";
+	optlen = sizeof off;
+	if (getsockopt(xs->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0 ||
+	    !xdp_map_ring(xs, &xs->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING,
+			  sizeof (u_int64_t)) ||
+	    !xdp_map_ring(xs, &xs->comp, &off.cr,
+			  XDP_UMEM_PGOFF_COMPLETION_RING,
+			  sizeof (u_int64_t)) ||
+	    !xdp_map_ring(xs, &xs->rx, &off.rx, XDP_PGOFF_RX_RING,
+			  sizeof (struct xdp_desc)) ||
+	    !xdp_map_ring(xs, &xs->tx, &off.tx, XDP_PGOFF_TX_RING,
+			  sizeof (struct xdp_desc)))
+		goto fail;
+
+	/* Half the frames to receive into, half to send from. */
+	fill = xs->fill.descs;
+	for (i = 0; i < XDP_RING_SIZE; i++)
+		fill [i] = (u_int64_t)i * XDP_FRAME_SIZE;
+	ring_store(xs->fill.producer, XDP_RING_SIZE);
+	for (i = 0; i < XDP_NUM_FRAMES - XDP_RING_SIZE; i++)
+		xs->tx_free [i] = (u_int64_t)(XDP_RING_SIZE + i) *
+				  XDP_FRAME_SIZE;
+	xs->tx_free_count = XDP_NUM_FRAMES - XDP_RING_SIZE;
+
+	what = "bind the AF_XDP socket";
+	memset(&sxdp, 0, sizeof sxdp);
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = 0;
+	if (bind(xs->fd, (struct sockaddr *)&sxdp, sizeof sxdp) < 0)
+		goto fail;
+
+	what = "create the socket map";
+	memset(&attr, 0, sizeof attr);
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof key;
+	attr.value_size = sizeof xs->fd;
+	attr.max_entries = 1;
+	xs->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (xs->map_fd < 0)
+		goto fail;
+
+	memset(&attr, 0, sizeof attr);
+	attr.map_fd = xs->map_fd;
+	attr.key = (unsigned long)&key;
+	attr.value = (unsigned long)&xs->fd;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+		goto fail;
+
+	what = "load the XDP program";
+	xs->prog_fd = xdp_load_program(xs->map_fd);
+	if (xs->prog_fd < 0)
+		goto fail;
+
+	/* Native mode if the driver has it, otherwise generic. */
+	what = "attach the XDP program";
+	memset(&attr, 0, sizeof attr);
+	attr.link_create.prog_fd = xs->prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	xs->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (xs->link_fd < 0) {
+		attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+		xs->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		if (xs->link_fd < 0)
+			goto fail;
+	}
+
+	xdp_check_queues(info);
+	get_hw_addr(info->name, &info->hw_address);
+	info->rfdesc = xs->fd;
+	return 1;
+
+      fail:
+	log_error("XDP: can't %s on %s: %m", what, info->name);
+	xdp_socket_close(&info->xdp);
+	return 0;
+}
+
+/* The number of received packets waiting to be read. */
+unsigned xdp_rx_pending (struct xdp_socket *xs)
+{
+	return ring_load(xs->rx.producer) - *xs->rx.consumer;
+}
+
+/* Returns the frame holding the next received packet and its length.
+   There must be one; see xdp_rx_pending(). */
+unsigned char *xdp_rx_peek (struct xdp_socket *xs, unsigned *len)
+{
+	struct xdp_desc *desc;
+
+	desc = (struct xdp_desc *)xs->rx.descs +
+	       (*xs->rx.consumer & (XDP_RING_SIZE - 1));
+	*len = desc->len;
+	return xs->umem + desc->addr;
+}
+
+/* Done with the packet from xdp_rx_peek(): give its frame back to the
+   kernel to receive into again. */
+void xdp_rx_release (struct xdp_socket *xs)
+{
+	struct xdp_desc *desc;
+	u_int64_t *fill;
+	u_int32_t cons, prod;
+
+	cons = *xs->rx.consumer;
+	desc = (struct xdp_desc *)xs->rx.descs + (cons & (XDP_RING_SIZE - 1));
+
+	/* The fill ring can't be full: it has room for every frame we
+	   receive into, and this one isn't on it. */
+	prod = *xs->fill.producer;
+	fill = xs->fill.descs;
+	fill [prod & (XDP_RING_SIZE - 1)] =
+		desc->addr - desc->addr % XDP_FRAME_SIZE;
+	ring_store(xs->fill.producer, prod + 1);
+	ring_store(xs->rx.consumer, cons + 1);
+}
+
+/* Returns a frame to assemble a packet in, or NULL if every frame is
+   still waiting to be sent. */
+unsigned char *xdp_tx_frame (struct xdp_socket *xs)
+{
+	u_int64_t *comp, addr;
+	u_int32_t cons, prod;
+
+	/* Take back the frames the kernel has finished sending.   What
+	   comes back is the address we sent from, which is past the start
+	   of the frame by the header offset. */
+	cons = *xs->comp.consumer;
+	prod = ring_load(xs->comp.producer);
+	if (cons != prod) {
+		comp = xs->comp.descs;
+		while (cons != prod) {
+			addr = comp [cons++ & (XDP_RING_SIZE - 1)];
+			xs->tx_free [xs->tx_free_count++] =
+				addr - addr % XDP_FRAME_SIZE;
+		}
+		ring_store(xs->comp.consumer, cons);
+	}
+
+	if (xs->tx_free_count == 0)
+		return NULL;
+	return xs->umem + xs->tx_free [--xs->tx_free_count];
+}
+
+/* Queues the len bytes at offset in a frame from xdp_tx_frame() to be
+   sent by the next xdp_tx_kick(). */
+void xdp_tx_queue (struct xdp_socket *xs, unsigned char *frame,
+		   unsigned offset, unsigned len)
+{
+	struct xdp_desc *desc;
+	u_int32_t prod;
+
+	prod = *xs->tx.producer;
+	desc = (struct xdp_desc *)xs->tx.descs + (prod & (XDP_RING_SIZE - 1));
+	desc->addr = (frame - xs->umem) + offset;
+	desc->len = len;
+	desc->options = 0;
+	ring_store(xs->tx.producer, prod + 1);
+}
+
+/* Kicks the kernel into sending whatever is queued.   In copy mode it
+   only sends a few dozen frames each time and says EAGAIN if there are
+   more, so keep at it until the ring is empty; if it stays busy the
+   rest go out with the next kick.   Returns zero, or -1 with errno
+   set. */
+int xdp_tx_kick (struct xdp_socket *xs)
+{
+	int tries;
+
+	for (tries = 0; tries < XDP_TX_KICKS; tries++) {
+		if (sendto(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+			return -1;
+		if (ring_load(xs->tx.consumer) == *xs->tx.producer)
+			break;
+	}
+	return 0;
+}
+#endif /* USE_AF_XDP */
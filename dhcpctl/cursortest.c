@@ -0,0 +1,241 @@
+/* cursortest.c
+
+   Walks the server's leases with a cursor and, for comparison, by
+   opening each lease by its address, and reports how long each took. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+#include "config.h"
+
+#include <time.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "omapip/result.h"
+#include "dhcpctl.h"
+#include "dhcpd.h"
+
+/* Fixups */
+isc_result_t find_class (struct class **c, const char *n, const char *f, int l)
+{
+	return 0;
+}
+int parse_allow_deny (struct option_cache **oc, struct parse *cfile, int flag)
+{
+	return 0;
+}
+void dhcp (struct packet *packet) { }
+void bootp (struct packet *packet) { }
+
+#ifdef DHCPv6
+/* XXX: should we warn or something here? */
+void dhcpv6(struct packet *packet) { }
+#ifdef DHCP4o6
+isc_result_t dhcpv4o6_handler(omapi_object_t *h)
+{
+	return ISC_R_NOTIMPLEMENTED;
+}
+#endif /* DHCP4o6 */
+#endif /* DHCPv6 */
+
+int check_collection (struct packet *p, struct lease *l, struct collection *c)
+{
+	return 0;
+}
+void classify (struct packet *packet, struct class *class) { }
+
+isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
+				     control_object_state_t newstate)
+{
+	return ISC_R_SUCCESS;
+}
+
+int main (int, char **);
+
+static void usage (char *s) {
+	fprintf (stderr,
+		 "Usage: %s [-s <server>] [-p <port>] [-b <batch-size>] "
+		 "[-t lease|host|pool] [-c]\n", s);
+	exit (1);
+}
+
+static void fail (const char *what, isc_result_t status)
+{
+	fprintf (stderr, "%s: %s\n", what, isc_result_totext (status));
+	exit (1);
+}
+
+static double elapsed (struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday (&now, (struct timezone *)0);
+	return ((now.tv_sec - start -> tv_sec) +
+		(now.tv_usec - start -> tv_usec) / 1000000.0);
+}
+
+/* Open a lease by address and wait for the server to send it. */
+
+static void open_lease (dhcpctl_handle connection, dhcpctl_data_string addr)
+{
+	dhcpctl_handle lease = dhcpctl_null_handle;
+	isc_result_t status, waitstatus;
+
+	status = dhcpctl_new_object (&lease, connection, "lease");
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_new_object", status);
+	status = dhcpctl_set_value (lease, addr, "ip-address");
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_set_value", status);
+	status = dhcpctl_open_object (lease, connection, 0);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_open_object", status);
+	status = dhcpctl_wait_for_completion (lease, &waitstatus);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_wait_for_completion", status);
+	if (waitstatus != ISC_R_SUCCESS)
+		fail ("lease open", waitstatus);
+	omapi_object_dereference (&lease, MDL);
+}
+
+int main (argc, argv)
+	int argc;
+	char **argv;
+{
+	isc_result_t status, waitstatus;
+	dhcpctl_handle connection;
+	dhcpctl_handle cursor;
+	dhcpctl_handle record;
+	dhcpctl_data_string addr;
+	dhcpctl_data_string *addrs = (dhcpctl_data_string *)0;
+	const char *server = "127.0.0.1";
+	const char *type = "lease";
+	int port = 7911;
+	int batch = 0;
+	int compare = 0;
+	unsigned count = 0, max = 0, i;
+	struct timeval start;
+	double secs;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv [i], "-s") && i + 1 < argc) {
+			server = argv [++i];
+		} else if (!strcmp (argv [i], "-p") && i + 1 < argc) {
+			port = atoi (argv [++i]);
+		} else if (!strcmp (argv [i], "-b") && i + 1 < argc) {
+			batch = atoi (argv [++i]);
+		} else if (!strcmp (argv [i], "-t") && i + 1 < argc) {
+			type = argv [++i];
+		} else if (!strcmp (argv [i], "-c")) {
+			compare = 1;
+		} else
+			usage (argv [0]);
+	}
+	if (compare && strcmp (type, "lease"))
+		usage (argv [0]);
+
+	status = dhcpctl_initialize ();
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_initialize", status);
+
+	connection = dhcpctl_null_handle;
+	status = dhcpctl_connect (&connection, server, port,
+				  dhcpctl_null_handle);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_connect", status);
+
+	gettimeofday (&start, (struct timezone *)0);
+
+	cursor = dhcpctl_null_handle;
+	status = dhcpctl_new_object (&cursor, connection, "cursor");
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_new_object", status);
+	status = dhcpctl_set_string_value (cursor, type, "object-type");
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_set_string_value", status);
+	if (batch) {
+		status = dhcpctl_set_int_value (cursor, batch, "batch-size");
+		if (status != ISC_R_SUCCESS)
+			fail ("dhcpctl_set_int_value", status);
+	}
+	status = dhcpctl_open_object (cursor, connection, DHCPCTL_CREATE);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_open_object", status);
+	status = dhcpctl_wait_for_completion (cursor, &waitstatus);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_wait_for_completion", status);
+	if (waitstatus != ISC_R_SUCCESS)
+		fail ("cursor open", waitstatus);
+
+	for (;;) {
+		record = dhcpctl_null_handle;
+		status = dhcpctl_cursor_next (&record, connection, cursor);
+		if (status == ISC_R_NOMORE)
+			break;
+		if (status != ISC_R_SUCCESS)
+			fail ("dhcpctl_cursor_next", status);
+
+		/* Keep the addresses to open one at a time afterwards. */
+		if (compare) {
+			if (count == max) {
+				max = max ? max * 2 : 1024;
+				addrs = realloc (addrs, max * sizeof *addrs);
+				if (!addrs)
+					fail ("realloc", ISC_R_NOMEMORY);
+			}
+			addrs [count] = (dhcpctl_data_string)0;
+			status = dhcpctl_get_value (&addrs [count], record,
+						    "ip-address");
+			if (status != ISC_R_SUCCESS)
+				fail ("dhcpctl_get_value", status);
+		}
+		count++;
+		omapi_object_dereference (&record, MDL);
+	}
+
+	secs = elapsed (&start);
+	printf ("cursor: %u %ss in %.3f seconds (%.0f/sec)\n",
+		count, type, secs, secs > 0 ? count / secs : 0.0);
+
+	dhcpctl_object_remove (connection, cursor);
+	dhcpctl_wait_for_completion (cursor, &waitstatus);
+	omapi_object_dereference (&cursor, MDL);
+
+	if (compare && count) {
+		gettimeofday (&start, (struct timezone *)0);
+		for (i = 0; i < count; i++) {
+			addr = addrs [i];
+			open_lease (connection, addr);
+			dhcpctl_data_string_dereference (&addrs [i], MDL);
+		}
+		secs = elapsed (&start);
+		printf ("open:   %u leases in %.3f seconds (%.0f/sec)\n",
+			count, secs, secs > 0 ? count / secs : 0.0);
+		free (addrs);
+	}
+
+	exit (0);
+}
@@ -749,6 +749,140 @@ dhcpctl_status dhcpctl_object_remove (dhcpctl_handle connection,
 	return status;
 }
 
+/* Parse the record at the current position in the cursor's batch into
+   a new generic object. */
+
+static dhcpctl_status cursor_parse_record (dhcpctl_handle *record,
+					   dhcpctl_remote_object_t *ro)
+{
+	omapi_object_t *obj = (omapi_object_t *)0;
+	omapi_data_string_t *name = (omapi_data_string_t *)0;
+	omapi_typed_data_t *value = (omapi_typed_data_t *)0;
+	const unsigned char *bp = ro -> records -> value;
+	unsigned len = ro -> records -> len;
+	unsigned off = ro -> records_offset;
+	unsigned nlen, vlen;
+	isc_result_t status;
+
+	status = omapi_generic_new (&obj, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	for (;;) {
+		if (off + 2 > len)
+			goto bad;
+		nlen = getUShort (bp + off);
+		off += 2;
+		if (!nlen)
+			break;
+		if (off + nlen + 4 > len)
+			goto bad;
+		vlen = getULong (bp + off + nlen);
+		if (vlen > len - (off + nlen + 4))
+			goto bad;
+
+		status = omapi_data_string_new (&name, nlen, MDL);
+		if (status != ISC_R_SUCCESS)
+			goto out;
+		memcpy (name -> value, bp + off, nlen);
+		off += nlen + 4;
+
+		status = omapi_typed_data_new (MDL, &value,
+					       omapi_datatype_data, vlen);
+		if (status != ISC_R_SUCCESS)
+			goto out;
+		if (vlen)
+			memcpy (value -> u.buffer.value, bp + off, vlen);
+		off += vlen;
+
+		status = omapi_set_value (obj, (omapi_object_t *)0,
+					  name, value);
+		omapi_data_string_dereference (&name, MDL);
+		omapi_typed_data_dereference (&value, MDL);
+		if (status != ISC_R_SUCCESS)
+			goto out;
+	}
+
+	ro -> records_offset = off;
+	status = omapi_object_reference (record, obj, MDL);
+	goto out;
+
+      bad:
+	status = DHCP_R_PROTOCOLERROR;
+      out:
+	if (name)
+		omapi_data_string_dereference (&name, MDL);
+	if (value)
+		omapi_typed_data_dereference (&value, MDL);
+	omapi_object_dereference (&obj, MDL);
+	return status;
+}
+
+/* dhcpctl_cursor_next
+
+   synchronous
+   Returns the next object from a cursor that has been opened on the
+   server, as a new object whose values can be read with
+   dhcpctl_get_value.   The records arrive from the server in batches;
+   when the current batch has been used up, the next one is asked for
+   and waited for.   Returns ISC_R_NOMORE once the cursor is done. */
+
+dhcpctl_status dhcpctl_cursor_next (dhcpctl_handle *record,
+				    dhcpctl_handle connection,
+				    dhcpctl_handle h)
+{
+	dhcpctl_remote_object_t *ro;
+	dhcpctl_data_string remaining = (dhcpctl_data_string)0;
+	isc_result_t status, waitstatus;
+	u_int32_t left;
+#ifdef DEBUG_DHCPCTL
+	log_debug("dhcpctl_cursor_next");
+#endif
+
+	if (h -> type != dhcpctl_remote_type)
+		return DHCP_R_INVALIDARG;
+	ro = (dhcpctl_remote_object_t *)h;
+
+	for (;;) {
+		if (!ro -> records) {
+			/* An empty batch arrives as no value at all. */
+			status = dhcpctl_get_value (&ro -> records,
+						    h, "records");
+			if (status == ISC_R_NOTFOUND)
+				status = omapi_data_string_new (&ro -> records,
+								0, MDL);
+			if (status != ISC_R_SUCCESS)
+				return status;
+			ro -> records_offset = 0;
+		}
+
+		if (ro -> records_offset < ro -> records -> len)
+			return cursor_parse_record (record, ro);
+
+		/* This batch is used up; see if there's another. */
+		omapi_data_string_dereference (&ro -> records, MDL);
+
+		status = dhcpctl_get_value (&remaining, h, "remaining");
+		if (status != ISC_R_SUCCESS)
+			return status;
+		left = 0;
+		if (remaining -> len == sizeof left)
+			left = getULong (remaining -> value);
+		dhcpctl_data_string_dereference (&remaining, MDL);
+		if (!left)
+			return ISC_R_NOMORE;
+
+		status = dhcpctl_object_refresh (connection, h);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		status = dhcpctl_wait_for_completion (h, &waitstatus);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		if (waitstatus != ISC_R_SUCCESS)
+			return waitstatus;
+	}
+}
+
 isc_result_t dhcpctl_data_string_dereference (dhcpctl_data_string *vp,
 					      const char *file, int line)
 {
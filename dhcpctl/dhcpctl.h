@@ -54,6 +54,8 @@ typedef struct {
 	isc_result_t waitstatus;
 	omapi_typed_data_t *message;
 	omapi_handle_t remote_handle;
+	omapi_data_string_t *records;	/* Current batch, for cursors. */
+	unsigned records_offset;
 } dhcpctl_remote_object_t;
 
 extern omapi_object_type_t *dhcpctl_callback_type;
@@ -87,6 +89,8 @@ dhcpctl_status dhcpctl_set_int_value (dhcpctl_handle, int, const char *);
 dhcpctl_status dhcpctl_object_update (dhcpctl_handle, dhcpctl_handle);
 dhcpctl_status dhcpctl_object_refresh (dhcpctl_handle, dhcpctl_handle);
 dhcpctl_status dhcpctl_object_remove (dhcpctl_handle, dhcpctl_handle);
+dhcpctl_status dhcpctl_cursor_next (dhcpctl_handle *,
+				    dhcpctl_handle, dhcpctl_handle);
 
 dhcpctl_status dhcpctl_set_callback (dhcpctl_handle, void *,
 				     void (*) (dhcpctl_handle,
@@ -0,0 +1,263 @@
+/* querytest.c
+
+   Opens leases by address as fast as the server answers, from one or
+   more connections at once, and reports how many were answered a second
+   and how long each took. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+#include "config.h"
+
+#include <time.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "omapip/result.h"
+#include "dhcpctl.h"
+#include "dhcpd.h"
+
+/* Fixups */
+isc_result_t find_class (struct class **c, const char *n, const char *f, int l)
+{
+	return 0;
+}
+int parse_allow_deny (struct option_cache **oc, struct parse *cfile, int flag)
+{
+	return 0;
+}
+void dhcp (struct packet *packet) { }
+void bootp (struct packet *packet) { }
+
+#ifdef DHCPv6
+/* XXX: should we warn or something here? */
+void dhcpv6(struct packet *packet) { }
+#ifdef DHCP4o6
+isc_result_t dhcpv4o6_handler(omapi_object_t *h)
+{
+	return ISC_R_NOTIMPLEMENTED;
+}
+#endif /* DHCP4o6 */
+#endif /* DHCPv6 */
+
+int check_collection (struct packet *p, struct lease *l, struct collection *c)
+{
+	return 0;
+}
+void classify (struct packet *packet, struct class *class) { }
+
+isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
+				     control_object_state_t newstate)
+{
+	return ISC_R_SUCCESS;
+}
+
+int main (int, char **);
+
+static void usage (char *s) {
+	fprintf (stderr,
+		 "Usage: %s [-s <server>] [-p <port>] [-a <first-address>] "
+		 "[-r <range>] [-n <lookups>] [-c <connections>]\n", s);
+	exit (1);
+}
+
+static void fail (const char *what, isc_result_t status)
+{
+	fprintf (stderr, "%s: %s\n", what, isc_result_totext (status));
+	exit (1);
+}
+
+static double elapsed (struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday (&now, (struct timezone *)0);
+	return ((now.tv_sec - start -> tv_sec) +
+		(now.tv_usec - start -> tv_usec) / 1000000.0);
+}
+
+/* What each connection sends back to be added up. */
+struct result {
+	unsigned found, missing;
+	double total, worst;
+};
+
+/* Open the lease on an address and wait for the answer; a lease that
+   isn't there is an answer too. */
+
+static int open_lease (dhcpctl_handle connection, u_int32_t ip)
+{
+	dhcpctl_handle lease = dhcpctl_null_handle;
+	dhcpctl_data_string addr = (dhcpctl_data_string)0;
+	isc_result_t status, waitstatus;
+
+	status = dhcpctl_new_object (&lease, connection, "lease");
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_new_object", status);
+	status = omapi_data_string_new (&addr, 4, MDL);
+	if (status != ISC_R_SUCCESS)
+		fail ("omapi_data_string_new", status);
+	putULong (addr -> value, ip);
+	status = dhcpctl_set_value (lease, addr, "ip-address");
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_set_value", status);
+	dhcpctl_data_string_dereference (&addr, MDL);
+	status = dhcpctl_open_object (lease, connection, 0);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_open_object", status);
+	status = dhcpctl_wait_for_completion (lease, &waitstatus);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_wait_for_completion", status);
+	omapi_object_dereference (&lease, MDL);
+	if (waitstatus == ISC_R_NOTFOUND)
+		return 0;
+	if (waitstatus != ISC_R_SUCCESS)
+		fail ("lease open", waitstatus);
+	return 1;
+}
+
+static void run (struct result *r, const char *server, int port,
+		 u_int32_t first, unsigned range, unsigned count,
+		 unsigned offset)
+{
+	isc_result_t status;
+	dhcpctl_handle connection;
+	struct timeval start;
+	unsigned i;
+	double secs;
+
+	status = dhcpctl_initialize ();
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_initialize", status);
+
+	connection = dhcpctl_null_handle;
+	status = dhcpctl_connect (&connection, server, port,
+				  dhcpctl_null_handle);
+	if (status != ISC_R_SUCCESS)
+		fail ("dhcpctl_connect", status);
+
+	memset (r, 0, sizeof *r);
+	for (i = 0; i < count; i++) {
+		gettimeofday (&start, (struct timezone *)0);
+		if (open_lease (connection, first + (offset + i) % range))
+			r -> found++;
+		else
+			r -> missing++;
+		secs = elapsed (&start);
+		r -> total += secs;
+		if (secs > r -> worst)
+			r -> worst = secs;
+	}
+}
+
+int main (argc, argv)
+	int argc;
+	char **argv;
+{
+	const char *server = "127.0.0.1";
+	struct in_addr ia;
+	u_int32_t first;
+	int port = 7911;
+	unsigned range = 256, count = 10000, conns = 1, i;
+	struct result r, sum;
+	struct timeval start;
+	int fds [2], status;
+	double secs;
+	pid_t pid;
+
+	inet_aton ("10.0.0.1", &ia);
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv [i], "-s") && i + 1 < argc) {
+			server = argv [++i];
+		} else if (!strcmp (argv [i], "-p") && i + 1 < argc) {
+			port = atoi (argv [++i]);
+		} else if (!strcmp (argv [i], "-a") && i + 1 < argc) {
+			if (!inet_aton (argv [++i], &ia))
+				usage (argv [0]);
+		} else if (!strcmp (argv [i], "-r") && i + 1 < argc) {
+			range = atoi (argv [++i]);
+		} else if (!strcmp (argv [i], "-n") && i + 1 < argc) {
+			count = atoi (argv [++i]);
+		} else if (!strcmp (argv [i], "-c") && i + 1 < argc) {
+			conns = atoi (argv [++i]);
+		} else
+			usage (argv [0]);
+	}
+	if (!range || !count || !conns)
+		usage (argv [0]);
+	first = ntohl (ia.s_addr);
+
+	/* Each connection is a process of its own, since a dhcpctl
+	   connection waits for each answer before asking again. */
+	if (pipe (fds) < 0) {
+		perror ("pipe");
+		exit (1);
+	}
+	gettimeofday (&start, (struct timezone *)0);
+	for (i = 0; i < conns; i++) {
+		pid = fork ();
+		if (pid < 0) {
+			perror ("fork");
+			exit (1);
+		}
+		if (pid == 0) {
+			close (fds [0]);
+			run (&r, server, port, first, range,
+			     count / conns + (i < count % conns),
+			     i * (range / conns));
+			if (write (fds [1], &r, sizeof r) != sizeof r)
+				exit (1);
+			exit (0);
+		}
+	}
+	close (fds [1]);
+
+	memset (&sum, 0, sizeof sum);
+	for (i = 0; i < conns; i++) {
+		if (read (fds [0], &r, sizeof r) != sizeof r) {
+			fprintf (stderr, "a connection failed.\n");
+			exit (1);
+		}
+		sum.found += r.found;
+		sum.missing += r.missing;
+		sum.total += r.total;
+		if (r.worst > sum.worst)
+			sum.worst = r.worst;
+	}
+	secs = elapsed (&start);
+	while (wait (&status) > 0)
+		;
+
+	printf ("%u lookups (%u not found) on %u connection%s in %.3f "
+		"seconds: %.0f/sec, %.1f usec average, %.1f usec worst\n",
+		sum.found + sum.missing, sum.missing, conns,
+		conns == 1 ? "" : "s", secs,
+		secs > 0 ? (sum.found + sum.missing) / secs : 0.0,
+		sum.total * 1000000.0 / (sum.found + sum.missing),
+		sum.worst * 1000000.0);
+	exit (0);
+}
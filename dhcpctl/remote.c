@@ -334,6 +334,8 @@ isc_result_t dhcpctl_remote_destroy (omapi_object_t *h,
 	if (p -> rtype)
 		omapi_typed_data_dereference ((omapi_typed_data_t **)&p->rtype,
 					      file, line);
+	if (p -> records)
+		omapi_data_string_dereference (&p -> records, file, line);
 	return ISC_R_SUCCESS;
 }
 
@@ -230,10 +230,23 @@ typedef time_t TIME;
 	 (((x) >> OPTION_HASH_EXP) & \
 	  (OPTION_HASH_PTWO - 1))) % OPTION_HASH_SIZE;
 
+/* The DHCP, DHCPv6 and server option spaces use codes that almost all
+   fit in a byte, so their options are kept in a table indexed by code
+   rather than in a hash, with a bitmap of the codes that are there for
+   going through them.   Options with bigger codes go on a list. */
+#define OPTION_TABLE_SIZE 256
+
+struct option_table {
+	u_int32_t present [OPTION_TABLE_SIZE / 32];
+	struct option_cache *slot [OPTION_TABLE_SIZE];
+	pair other;			/* Codes past the end of slot. */
+	struct option_table *next;	/* On the free list. */
+};
+
 /* Lease queue information.  We have two ways of storing leases.
  * The original is a linear linked list which is slower but uses
- * less memory while the other adds a binary array on top of that
- * list to make insertions faster.  We define several macros
+ * less memory while the other adds a search tree on top of that
+ * list to make insertions and removals faster.  We define several macros
  * based on which is in use to allow the code to be cleaner by
  * avoiding #ifdefs.
  *
@@ -289,41 +302,35 @@ struct parse {
 	int lexline;
 	int lexchar;
 	char *token_line;
-	char *prev_line;
-	char *cur_line;
 	const char *tlname;
 	int eol_token;
 
 	/*
 	 * In order to give nice output when we have a parsing error
-	 * in our file, we keep track of where we are in the line so
-	 * that we can show the user.
-	 *
-	 * We need to keep track of two lines, because we can look
-	 * ahead, via the "peek" function, to the next line sometimes.
-	 *
-	 * The "line1" and "line2" variables act as buffers for this
-	 * information. The "lpos" variable tells us where we are in the
-	 * line.
+	 * in our file, we show the user the line the error is on.
 	 *
-	 * When we "put back" a character from the parsing context, we
-	 * do not want to have the character appear twice in the error
-	 * output. So, we set a flag, the "ugflag", which the
-	 * get_char() function uses to check for this condition.
+	 * The lexer doesn't keep track of lines as it goes: it just
+	 * remembers where in the buffer the current token starts
+	 * ("lexofs"; "peekofs" is where a token we've peeked at starts).
+	 * When there's something to report, lex_locate() works out
+	 * "lexline" and "lexchar" from that by counting lines from the
+	 * last place it counted to ("countofs" and "countline"), and
+	 * copies the line into "line1" for "token_line" to point at.
+	 * "line" is the number of the first line in the buffer.
 	 */
 	char line1 [81];
-	char line2 [81];
-	int lpos;
 	int line;
-	int tlpos;
-	int tline;
+	size_t lexofs, peekofs;
+	size_t countofs;
+	int countline;
 	enum dhcp_token token;
-	int ugflag;
 	char *tval;
 	int tlen;
 	char tokbuf [1500];
+	char tb [2];		/* single character tokens */
 
 	int warnings_occurred;
+	int quiet;		/* count warnings but don't log them */
 	int file;
 	char *inbuf;
 	size_t bufix, buflen;
@@ -393,11 +400,28 @@ struct option_cache {
 	u_int32_t flags;
 };
 
+/* Where the options of a received packet are in a copy of its option
+   buffers, so that each is only decoded the first time it's looked up.
+   Pieces of an option split by RFC 3396 are chained in order. */
+#define OPTION_INDEX_MAX	255
+
+struct option_index {
+	struct universe *universe;
+	struct buffer *buffer;
+	unsigned char first [256];	/* Each code's first entry + 1. */
+	struct option_index_entry {
+		u_int16_t offset;
+		u_int8_t len;
+		u_int8_t next;		/* Next piece of the code + 1. */
+	} entry [OPTION_INDEX_MAX];
+};
+
 struct option_state {
 	int refcnt;
 	int universe_count;
 	int site_universe;
 	int site_code_min;
+	struct option_index *pending;	/* Options not decoded yet. */
 	void *universes [1];
 };
 
@@ -521,7 +545,8 @@ typedef enum {
 	server_running = 1,
 	server_shutdown = 2,
 	server_hibernate = 3,
-	server_awaken = 4
+	server_awaken = 4,
+	server_reload = 5
 } control_object_state_t;
 
 typedef struct {
@@ -552,37 +577,64 @@ struct on_star {
 	struct executable_statement *on_release;
 };
 
-/* A dhcp lease declaration structure. */
+/* The cold part of a lease: fields that few leases ever use, and then
+ * only for a while.  It is allocated the first time one of them is set,
+ * by lease_cold(), and freed with the lease; LEASE_COLD() reads a field
+ * without allocating it, giving 0 for a lease that has no cold part. */
+struct lease_cold {
+	/*
+	 * A pointer to the state of the ddns update for this lease.
+	 * It should be set while the update is in progress and cleared
+	 * when the update finishes.  It can be used to cancel the
+	 * update if we want to do a different update.
+	 */
+	struct dhcp_ddns_cb *ddns_cb;
+
+	struct lease *next_pending;	/* failover update or ack queue */
+};
+
+#define LEASE_COLD(lease, field) \
+	((lease)->cold != NULL ? (lease)->cold->field : 0)
+
+/* A dhcp lease declaration structure.
+ *
+ * A server can have millions of these, and the queue code, pool_timer()
+ * and allocate_lease() go through them looking at the same few fields.
+ * Those come first, right after the OMAPI preamble, so that they share
+ * as few cache lines as possible; fields used when a lease changes
+ * state follow, and fields most leases never use live in the cold part.
+ * Keep it that way when adding fields.
+ */
 struct lease {
 	OMAPI_OBJECT_PREAMBLE;
+
+	/* Hot: queue links and the fields the queues are sorted on
+	 * and walked for. */
 	struct lease *next;
 #if defined (BINARY_LEASES)
 	struct lease *prev;
-	struct leasechain *lc;
-#endif
-	struct lease *n_uid, *n_hw;
-
-	struct iaddr ip_addr;
-	TIME starts, ends, sort_time;
-#if defined (BINARY_LEASES)
+	struct lease *lc_parent, *lc_left, *lc_right;	/* search tree */
 	long int sort_tiebreaker;
+	u_int32_t lc_priority;
 #endif
-	char *client_hostname;
-	struct binding_scope *scope;
-	struct host_decl *host;
-	struct subnet *subnet;
-	struct pool *pool;
-	struct class *billing_class;
-	struct option_chain_head *agent_options;
 
-	/* insert the structure directly */
-	struct on_star on_star;
-
-	unsigned char *uid;
-	unsigned short uid_len;
-	unsigned short uid_max;
-	unsigned char uid_buf [7];
-	struct hardware hardware_addr;
+	/*
+	 * The lease's binding state is its current state.  The next binding
+	 * state is the next state this lease will move into by expiration,
+	 * or timers in general.  The desired binding state is used on lease
+	 * updates; the caller is attempting to move the lease to the desired
+	 * binding state (and this may either succeed or fail, so the binding
+	 * state must be preserved).
+	 *
+	 * The 'rewind' binding state is used in failover processing.  It
+	 * is used for an optimization when out of communications; it allows
+	 * the server to "rewind" a lease to the previous state acknowledged
+	 * by the peer, and progress forward from that point.
+	 */
+	binding_state_t binding_state;
+	binding_state_t next_binding_state;
+	binding_state_t desired_binding_state;
+	binding_state_t rewind_binding_state;
 
 	u_int8_t flags;
 #       define STATIC_LEASE		1
@@ -603,25 +655,15 @@ struct lease {
 					 RESERVED_LEASE | \
 					 BOOTP_LEASE)
 
-	/*
-	 * The lease's binding state is its current state.  The next binding
-	 * state is the next state this lease will move into by expiration,
-	 * or timers in general.  The desired binding state is used on lease
-	 * updates; the caller is attempting to move the lease to the desired
-	 * binding state (and this may either succeed or fail, so the binding
-	 * state must be preserved).
-	 *
-	 * The 'rewind' binding state is used in failover processing.  It
-	 * is used for an optimization when out of communications; it allows
-	 * the server to "rewind" a lease to the previous state acknowledged
-	 * by the peer, and progress forward from that point.
-	 */
-	binding_state_t binding_state;
-	binding_state_t next_binding_state;
-	binding_state_t desired_binding_state;
-	binding_state_t rewind_binding_state;
+	unsigned short uid_len;
+	u_int32_t last_xid; /* XID we sent in this lease's BNDUPD */
+	TIME sort_time;
+	TIME ends;
+	struct pool *pool;
+	struct iaddr ip_addr;
 
-	struct lease_state *state;
+	/* Set when a lease has been disqualified for cache-threshold reuse */
+	unsigned short cannot_reuse;
 
 	/*
 	 * 'tsfp' is more of an 'effective' tsfp.  It may be calculated from
@@ -630,23 +672,39 @@ struct lease {
 	 * updated - and only set when the peer acknowledges it.  This
 	 * ensures every state change is transmitted.
 	 */
-	TIME tstp;	/* Time sent to partner. */
 	TIME tsfp;	/* Time sent from partner. */
+	TIME tstp;	/* Time sent to partner. */
 	TIME atsfp;	/* Actual time sent from partner. */
+
+	/* Warm: used when the lease is allocated, renewed or changes
+	 * state. */
+	TIME starts;
 	TIME cltt;	/* Client last transaction time. */
-	u_int32_t last_xid; /* XID we sent in this lease's BNDUPD */
-	struct lease *next_pending;
+	struct subnet *subnet;
+	struct lease *n_uid, *n_hw;
+	unsigned char *uid;
+	unsigned short uid_max;
+	unsigned char uid_buf [7];
+	struct hardware hardware_addr;
 
-	/*
-	 * A pointer to the state of the ddns update for this lease.
-	 * It should be set while the update is in progress and cleared
-	 * when the update finishes.  It can be used to cancel the
-	 * update if we want to do a different update.
-	 */
-	struct dhcp_ddns_cb *ddns_cb;
+	struct host_decl *host;
+	struct class *billing_class;
+	struct binding_scope *scope;
+	char *client_hostname;
 
-	/* Set when a lease has been disqualified for cache-threshold reuse */
-	unsigned short cannot_reuse;
+	/* insert the structure directly */
+	struct on_star on_star;
+
+	struct lease_state *state;
+#if defined (BINARY_LEASES)
+	struct leasechain *lc;
+#endif
+
+	/* Read for every packet from a relayed client. */
+	struct option_chain_head *agent_options;
+
+	/* Cold, see above. */
+	struct lease_cold *cold;
 };
 
 struct lease_state {
@@ -817,6 +875,11 @@ struct lease_state {
 #define SV_BIND_LOCAL_ADDRESS6		98
 #define SV_PING_CLTT_SECS		99
 #define SV_PING_TIMEOUT_MS		100
+#define SV_PING_CACHE_SECS		101
+#define SV_EXPIRY_SLICE_LEASES		102
+#define SV_EXPIRY_SLICE_USECS		103
+#define SV_LEASE_LOAD_THREADS		104
+#define SV_OMAPI_QUERY_PORT		105
 
 #if !defined (DEFAULT_PING_TIMEOUT)
 # define DEFAULT_PING_TIMEOUT 1
@@ -830,6 +893,22 @@ struct lease_state {
 # define DEFAULT_PING_CLTT_SECS 60  /* in seconds */
 #endif
 
+#if !defined (DEFAULT_PING_CACHE_SECS)
+# define DEFAULT_PING_CACHE_SECS 0  /* default 0 disables the cache */
+#endif
+
+#if !defined (DEFAULT_EXPIRY_SLICE_LEASES)
+# define DEFAULT_EXPIRY_SLICE_LEASES 1000  /* 0 means no limit */
+#endif
+
+#if !defined (DEFAULT_EXPIRY_SLICE_USECS)
+# define DEFAULT_EXPIRY_SLICE_USECS 50000  /* 1/20 second, 0 means no limit */
+#endif
+
+#if !defined (DEFAULT_LEASE_LOAD_THREADS)
+# define DEFAULT_LEASE_LOAD_THREADS 0  /* 0 means one per CPU */
+#endif
+
 #if !defined (DEFAULT_DELAYED_ACK)
 # define DEFAULT_DELAYED_ACK 0  /* default 0 disables delayed acking */
 #endif
@@ -1012,13 +1091,10 @@ struct permit {
 
 #if defined (BINARY_LEASES)
 struct leasechain {
-	struct lease **list; /* lease list */
-	size_t total;	     /* max number of elements in this list,
-			      * including free pointers at the end if any */
-	size_t nelem;	     /* the number of elements, also the next index to use */
-	size_t growth;	     /* the growth factor to use when increase an array
-			      * this is set after parsing the pools and before
-			      * creatin an array.  */
+	struct lease *root;  /* search tree of the leases, see leasechain.c */
+	struct lease *head;  /* first lease, the one with the lowest sort_time */
+	struct lease *tail;  /* last lease */
+	size_t nelem;	     /* the number of leases */
 };
 #endif
 
@@ -1045,9 +1121,40 @@ struct pool {
 
 #if defined (FAILOVER_PROTOCOL)
 	dhcp_failover_state_t *failover_peer;
+	struct pool *balance_next;	/* next on the peer's balance queue */
+	int balance_queued;	/* on the balance queue */
 #endif
 	int logged;		/* already logged a message */
 	int low_threshold;	/* low threshold to restart logging */
+
+	struct sparse_range *sparse;	/* sparse ranges in this pool */
+	int sparse_leases;	/* addresses in them with no lease yet,
+				 * these are included in free_leases */
+};
+
+/* An address range declared sparse has no lease structure for an address
+ * until the address is allocated, looked up or read from the lease file.
+ * Until then the address is free and never used, and the only record of it
+ * is a clear bit in the used bitmap. */
+struct sparse_range {
+	struct sparse_range *next;	/* all sparse ranges */
+	struct sparse_range *pool_next;	/* sparse ranges in the same pool */
+	struct subnet *subnet;
+	struct pool *pool;
+	unsigned min, max;		/* first and last host number */
+	u_int32_t first, last;		/* and their addresses */
+	u_int32_t reach;		/* furthest last of this and of the
+					 * ranges before it, by first */
+	unsigned left;			/* host numbers with no lease */
+	unsigned hint;			/* all below this have a lease */
+	unsigned char *used;		/* one bit per host number */
+};
+
+/* A bounded piece of work done from a timer, so that packets get handled
+ * in between (see work_slice_over()). */
+struct work_slice {
+	int count;			/* leases dealt with so far */
+	struct timeval start;
 };
 
 struct shared_network {
@@ -1135,6 +1242,23 @@ struct class {
 	int flags;
 };
 
+/* Everything the server builds from its configuration file, as opposed to
+ * the lease file.  A configuration reload parses the new file into a fresh
+ * config_state and then moves the leases over from the running one. */
+struct config_state {
+	struct group *root_group;
+	struct shared_network *shared_networks;
+	struct subnet *subnets;
+	struct class *classes;		/* of the default collection */
+	host_hash_t *host_hw_addr_hash;
+	host_hash_t *host_uid_hash;
+	host_hash_t *host_name_hash;
+	struct host_id_info *host_id_info;
+	lease_ip_hash_t *lease_ip_addr_hash;
+	struct sparse_range *sparse_ranges;
+	int sparse_ranges_queued;
+};
+
 /* DHCP client lease structure... */
 struct client_lease {
 	struct client_lease *next;		      /* Next lease in list. */
@@ -1369,6 +1493,18 @@ struct dns_update_state {
 	int dns_update_timeout;
 };
 
+/* The link, IP and UDP headers of the packets sent from an Ethernet
+   interface, with the fields that change left zero; assemble_headers()
+   copies it and fills those in.   The sum of the fixed IP header fields
+   is kept so the IP header checksum can be finished off from the rest. */
+
+struct header_template {
+	struct hardware hw_address;	/* Source address it was made for. */
+	u_int16_t sport;		/* And the local_port. */
+	u_int16_t ip_sum;		/* Sum of the fixed IP header fields. */
+	unsigned char frame [14 + 20 + 8];
+};
+
 /* Information about each network interface. */
 
 struct interface_info {
@@ -1407,6 +1543,13 @@ struct interface_info {
 	unsigned int rbuf_max;		/* Size of read buffer. */
 	size_t rbuf_offset;		/* Current offset into buffer. */
 	size_t rbuf_len;		/* Length of data in buffer. */
+	unsigned char *tbuf;		/* Queued replies, if batching. */
+	unsigned int tbuf_len;		/* Number of replies queued. */
+#if defined (USE_AF_XDP)
+	struct xdp_socket *xdp;		/* AF_XDP socket, if in use. */
+#endif
+	struct header_template send_template;
+					/* Headers for send_packet(). */
 
 	struct ifreq *ifp;		/* Pointer to ifreq struct. */
 	int configured;			/* If set to 1, interface has at least
@@ -1419,6 +1562,8 @@ struct interface_info {
 #define INTERFACE_DOWNSTREAM 8
 #define INTERFACE_UPSTREAM 16
 #define INTERFACE_STREAMS (INTERFACE_DOWNSTREAM | INTERFACE_UPSTREAM)
+#define INTERFACE_XDP 32		/* Use AF_XDP rather than LPF. */
+#define INTERFACE_FALLBACK 64		/* The fallback interface. */
 
 	/* Only used by DHCP client code. */
 	struct client_state *client;
@@ -1630,7 +1775,7 @@ typedef unsigned char option_mask [16];
 #define DHCP_LOG_OPTIONS LOG_NDELAY
 #endif
 						/* these are referenced */
-typedef struct hash_table ia_hash_t;
+typedef struct ia_table ia_hash_t;
 typedef struct hash_table iasubopt_hash_t;
 
 						/* IAADDR/IAPREFIX lease */
@@ -1673,11 +1818,32 @@ struct iasubopt {
 struct ia_xx {
 	int refcnt;			/* reference count */
 	struct data_string iaid_duid;	/* from the client */
+	isc_uint64_t hash;		/* of iaid_duid, see ia_key_init() */
 	u_int16_t ia_type;		/* IA_XX */
 	int num_iasubopt;		/* number of IAADDR/PREFIX */
 	int max_iasubopt;		/* space available for IAADDR/PREFIX */
 	time_t cltt;			/* client last transaction time */
 	struct iasubopt **iasubopt;	/* pointers to the IAADDR/IAPREFIXs */
+	struct ia_table *table;		/* the table the IA is in, if any */
+	struct ia_xx *hash_next;	/* and the next IA in its bucket */
+};
+
+/* The IAs of one type, by IAID and DUID.  Each IA keeps its own hash
+ * and bucket link, so adding one doesn't allocate and growing the table
+ * doesn't hash anything again. */
+struct ia_table {
+	struct ia_xx **buckets;
+	unsigned size;			/* a power of two */
+	unsigned count;
+};
+
+/* What an IA is looked up by.  The DUID is the caller's own, not a
+ * copy, so a key can be made on the stack for each lookup. */
+struct ia_key {
+	isc_uint64_t hash;
+	u_int32_t iaid;
+	const unsigned char *duid;
+	unsigned duid_len;
 };
 
 extern ia_hash_t *ia_na_active;
@@ -1865,9 +2031,12 @@ HASH_FUNCTIONS_DECL (class, const char *, struct class, class_hash_t)
 /* options.c */
 
 extern struct option *vendor_cfg_option;
+extern int lazy_option_decode;
 int parse_options (struct packet *);
 int parse_option_buffer (struct option_state *, const unsigned char *,
 			 unsigned, struct universe *);
+void decode_pending_options (struct option_state *);
+void free_option_index (struct option_index **);
 struct universe *find_option_universe (struct option *, const char *);
 int parse_encapsulated_suboptions (struct option_state *, struct option *,
 				   const unsigned char *, unsigned,
@@ -1956,6 +2125,9 @@ struct option_cache *lookup_hashed_option (struct universe *,
 struct option_cache *next_hashed_option(struct universe *,
 					struct option_state *,
 					struct option_cache *);
+struct option_cache *lookup_direct_option (struct universe *,
+					   struct option_state *,
+					   unsigned);
 int save_option_buffer (struct universe *, struct option_state *,
 			struct buffer *, unsigned char *, unsigned,
 			unsigned, int);
@@ -1970,14 +2142,25 @@ void also_save_option(struct universe *, struct option_state *,
 		      struct option_cache *);
 void save_hashed_option(struct universe *, struct option_state *,
 			struct option_cache *, isc_boolean_t appendp);
+void save_direct_option(struct universe *, struct option_state *,
+			struct option_cache *, isc_boolean_t appendp);
 void delete_option (struct universe *, struct option_state *, int);
 void delete_hashed_option (struct universe *,
 			   struct option_state *, int);
+void delete_direct_option (struct universe *,
+			   struct option_state *, int);
 int option_cache_dereference (struct option_cache **,
 			      const char *, int);
 int hashed_option_state_dereference (struct universe *,
 				     struct option_state *,
 				     const char *, int);
+int direct_option_state_dereference (struct universe *,
+				     struct option_state *,
+				     const char *, int);
+#if defined (DEBUG_MEMORY_LEAKAGE) || \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void relinquish_free_option_tables (void);
+#endif
 int store_option (struct data_string *,
 		  struct universe *, struct packet *, struct lease *,
 		  struct client_state *,
@@ -1997,6 +2180,13 @@ int hashed_option_space_encapsulate (struct data_string *,
 				     struct option_state *,
 				     struct binding_scope **,
 				     struct universe *);
+int direct_option_space_encapsulate (struct data_string *,
+				     struct packet *, struct lease *,
+				     struct client_state *,
+				     struct option_state *,
+				     struct option_state *,
+				     struct binding_scope **,
+				     struct universe *);
 int nwip_option_space_encapsulate (struct data_string *,
 				   struct packet *, struct lease *,
 				   struct client_state *,
@@ -2047,6 +2237,20 @@ void hashed_option_space_foreach (struct packet *, struct lease *,
 					    struct option_state *,
 					    struct binding_scope **,
 					    struct universe *, void *));
+void direct_option_space_foreach (struct packet *, struct lease *,
+				  struct client_state *,
+				  struct option_state *,
+				  struct option_state *,
+				  struct binding_scope **,
+				  struct universe *, void *,
+				  void (*) (struct option_cache *,
+					    struct packet *,
+					    struct lease *,
+					    struct client_state *,
+					    struct option_state *,
+					    struct option_state *,
+					    struct binding_scope **,
+					    struct universe *, void *));
 int linked_option_get (struct data_string *, struct universe *,
 		       struct packet *, struct lease *,
 		       struct client_state *,
@@ -2153,13 +2357,12 @@ int main(int, char **);
 void postconf_initialization(int);
 void postdb_startup(void);
 void cleanup (void);
-void lease_pinged (struct iaddr, u_int8_t *, int);
-void lease_ping_timeout (void *);
 int dhcpd_interface_setup_hook (struct interface_info *ip, struct iaddr *ia);
 extern enum dhcp_shutdown_state shutdown_state;
 isc_result_t dhcp_io_shutdown (omapi_object_t *, void *);
 isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 				     control_object_state_t newstate);
+void root_group_setup (void);
 
 #if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
 void relinquish_ackqueue(void);
@@ -2177,6 +2380,7 @@ enum dhcp_token next_raw_token(const char **rval, unsigned *rlen,
 			       struct parse *cfile);
 enum dhcp_token peek_raw_token(const char **rval, unsigned *rlen,
 			       struct parse *cfile);
+void lex_locate (struct parse *);
 /*
  * Use skip_token when we are skipping a token we have previously
  * used peek_token on as we know what the result will be in this case.
@@ -2218,6 +2422,7 @@ void parse_group_declaration (struct parse *, struct group *);
 int parse_fixed_addr_param (struct option_cache **,
 			    struct parse *, enum dhcp_token);
 int parse_lease_declaration (struct lease **, struct parse *);
+void lease_declaration_defaults (struct lease *, int);
 int parse_ip6_addr(struct parse *, struct iaddr *);
 int parse_ip6_addr_expr(struct expression **, struct parse *);
 int parse_ip6_prefix(struct parse *, struct iaddr *, u_int8_t *);
@@ -2432,6 +2637,8 @@ void ack_lease (struct packet *, struct lease *,
 		unsigned int, TIME, char *, int, struct host_decl *);
 void echo_client_id(struct packet*, struct lease*, struct option_state*,
 		    struct option_state*);
+int do_ping_check(struct packet *, struct lease_state *, struct lease *,
+		  TIME, int);
 
 void dhcp_reply (struct lease *);
 int find_lease (struct lease **, struct packet *,
@@ -2461,6 +2668,32 @@ void eval_network_statements(struct option_state **options,
 
 u_int16_t dhcp_check_relayport(struct packet *packet);
 
+/* ping.c */
+int ping_start(struct lease *, struct timeval *, TIME);
+int ping_recently_silent(struct iaddr *);
+void lease_pinged (struct iaddr, u_int8_t *, int);
+
+/* reload.c */
+void reload_config (void);
+isc_result_t reload_config_apply (void);
+isc_result_t reload_conf_file (const char *, char **, unsigned *);
+
+/* leaseload.c */
+extern int lease_load_threads;
+#if defined (PARALLEL_LEASE_LOAD)
+int lease_file_parallel_subparse (struct parse *);
+#endif
+
+/* omapiquery.c */
+extern int omapi_query_port;
+void omapi_query_start (void);
+#if defined (OMAPI_QUERY_THREAD)
+void omapi_query_lease (struct lease *);
+void omapi_query_host (struct host_decl *);
+void omapi_query_resync (void);
+void omapi_query_forget (void);
+#endif
+
 /* dhcpleasequery.c */
 void dhcpleasequery (struct packet *, int);
 void dhcpv6_leasequery (struct data_string *, struct packet *);
@@ -2660,6 +2893,11 @@ int if_register_socket(struct interface_info *, int, int *, struct in6_addr *);
 void set_multicast_hop_limit(struct interface_info* info, int hop_limit);
 #endif
 
+#if defined (USE_SOCKET_SEND) || defined (USE_SOCKET_FALLBACK)
+int send_packet_multi (struct interface_info *, struct dhcp_packet *, size_t,
+		       struct sockaddr_in *, int);
+#endif
+
 #if defined (USE_SOCKET_FALLBACK) && !defined (USE_SOCKET_SEND)
 void if_reinitialize_fallback (struct interface_info *);
 void if_register_fallback (struct interface_info *);
@@ -2670,6 +2908,9 @@ ssize_t send_fallback (struct interface_info *,
 ssize_t send_fallback6(struct interface_info *, struct packet *,
 		       struct dhcp_packet *, size_t, struct in6_addr *,
 		       struct sockaddr_in6 *, struct hardware *);
+#if defined (USE_SEND_BATCH)
+void if_flush_fallback (struct interface_info *);
+#endif
 #endif
 
 #ifdef USE_SOCKET_SEND
@@ -2680,6 +2921,9 @@ ssize_t send_packet (struct interface_info *,
 		     struct packet *, struct dhcp_packet *, size_t,
 		     struct in_addr,
 		     struct sockaddr_in *, struct hardware *);
+#if defined (USE_SEND_BATCH)
+void if_flush_send (struct interface_info *);
+#endif
 #endif
 ssize_t send_packet6(struct interface_info *, const unsigned char *, size_t,
 		     struct sockaddr_in6 *);
@@ -2752,6 +2996,9 @@ ssize_t send_packet (struct interface_info *,
 		     struct packet *, struct dhcp_packet *, size_t,
 		     struct in_addr,
 		     struct sockaddr_in *, struct hardware *);
+#if defined (USE_SEND_BATCH)
+void if_flush_send (struct interface_info *);
+#endif
 #endif
 #ifdef USE_LPF_RECEIVE
 void if_reinitialize_receive (struct interface_info *);
@@ -2768,6 +3015,19 @@ int supports_multiple_interfaces (struct interface_info *);
 void maybe_setup_fallback (void);
 #endif
 
+/* xdp.c */
+#if defined (USE_AF_XDP)
+int if_register_xdp (struct interface_info *);
+void xdp_socket_close (struct xdp_socket **);
+unsigned xdp_rx_pending (struct xdp_socket *);
+unsigned char *xdp_rx_peek (struct xdp_socket *, unsigned *);
+void xdp_rx_release (struct xdp_socket *);
+unsigned char *xdp_tx_frame (struct xdp_socket *);
+void xdp_tx_queue (struct xdp_socket *, unsigned char *,
+		   unsigned, unsigned);
+int xdp_tx_kick (struct xdp_socket *);
+#endif
+
 /* nit.c */
 #if defined (USE_NIT_SEND) || defined (USE_NIT_RECEIVE)
 int if_register_nit (struct interface_info *);
@@ -2884,6 +3144,9 @@ void discover_interfaces(int);
 int setup_fallback (struct interface_info **, const char *, int);
 int if_readsocket (omapi_object_t *);
 void reinitialize_interfaces (void);
+extern int send_batching;
+void send_batch_begin (void);
+void send_batch_end (void);
 
 /* dispatch.c */
 void set_time(TIME);
@@ -3081,6 +3344,7 @@ void start_selecting6(struct client_state *client);
 void unconfigure6(struct client_state *client, const char *reason);
 
 /* db.c */
+extern FILE *db_file;
 int write_lease (struct lease *);
 int write_host (struct host_decl *);
 int write_server_duid(void);
@@ -3103,11 +3367,16 @@ int write_ia(const struct ia_xx *);
 /* packet.c */
 u_int32_t checksum (unsigned char *, unsigned, u_int32_t);
 u_int32_t wrapsum (u_int32_t);
+int checksum_select (const char *);
+const char *checksum_selected (void);
 void assemble_hw_header (struct interface_info *, unsigned char *,
 			 unsigned *, struct hardware *);
 void assemble_udp_ip_header (struct interface_info *, unsigned char *,
 			     unsigned *, u_int32_t, u_int32_t,
 			     u_int32_t, unsigned char *, unsigned);
+unsigned assemble_headers (struct interface_info *, unsigned char *,
+			   unsigned *, struct hardware *, u_int32_t,
+			   u_int32_t, u_int32_t, unsigned char *, unsigned);
 ssize_t decode_hw_header (struct interface_info *, unsigned char *,
 			  unsigned, struct hardware *);
 ssize_t decode_udp_ip_header (struct interface_info *, unsigned char *,
@@ -3195,11 +3464,14 @@ extern struct icmp_state *icmp_state;
 void icmp_startup (int, void (*) (struct iaddr, u_int8_t *, int));
 int icmp_readsocket (omapi_object_t *);
 int icmp_echorequest (struct iaddr *);
+int icmp_echo_enqueue (struct iaddr *, u_int16_t, u_int16_t);
+void icmp_flush (void);
 isc_result_t icmp_echoreply (omapi_object_t *);
 
 /* dns.c */
 isc_result_t enter_dns_zone (struct dns_zone *);
 isc_result_t dns_zone_lookup (struct dns_zone **, const char *);
+void dns_zone_trie_free (void);
 int dns_zone_dereference (struct dns_zone **, const char *, int);
 #if defined (NSUPDATE)
 #define FIND_FORWARD 0
@@ -3258,6 +3530,7 @@ isc_result_t find_class (struct class **, const char *,
 			 const char *, int);
 void unbill_class (struct lease *);
 int bill_class (struct lease *, struct class *);
+int spawn_subclass (struct class **, struct class *, struct data_string *);
 
 /* execute.c */
 int execute_statements (struct binding_value **result,
@@ -3381,6 +3654,7 @@ extern omapi_object_type_t *dhcp_type_lease;
 extern omapi_object_type_t *dhcp_type_pool;
 extern omapi_object_type_t *dhcp_type_class;
 extern omapi_object_type_t *dhcp_type_subclass;
+extern omapi_object_type_t *dhcp_type_cursor;
 
 #if defined (FAILOVER_PROTOCOL)
 extern omapi_object_type_t *dhcp_type_failover_state;
@@ -3444,6 +3718,39 @@ isc_result_t dhcp_pool_create (omapi_object_t **,
 			       omapi_object_t *);
 isc_result_t dhcp_pool_remove (omapi_object_t *,
 			       omapi_object_t *);
+isc_result_t dhcp_cursor_set_value  (omapi_object_t *, omapi_object_t *,
+				     omapi_data_string_t *,
+				     omapi_typed_data_t *);
+isc_result_t dhcp_cursor_get_value (omapi_object_t *, omapi_object_t *,
+				    omapi_data_string_t *,
+				    omapi_value_t **);
+isc_result_t dhcp_cursor_destroy (omapi_object_t *, const char *, int);
+isc_result_t dhcp_cursor_signal_handler (omapi_object_t *,
+					 const char *, va_list);
+isc_result_t dhcp_cursor_stuff_values (omapi_object_t *,
+				       omapi_object_t *,
+				       omapi_object_t *);
+isc_result_t dhcp_cursor_lookup (omapi_object_t **,
+				 omapi_object_t *, omapi_object_t *);
+isc_result_t dhcp_cursor_create (omapi_object_t **,
+				 omapi_object_t *);
+isc_result_t dhcp_cursor_remove (omapi_object_t *,
+				 omapi_object_t *);
+
+/* Values encoded as on the wire, one record after another, as a cursor
+   sends them. */
+struct omapi_record {
+	unsigned char *buf;
+	unsigned len, max;
+};
+
+int omapi_record_put (struct omapi_record *, const char *,
+		      const void *, unsigned);
+int omapi_record_put_uint32 (struct omapi_record *, const char *, u_int32_t);
+int omapi_record_end (struct omapi_record *);
+int omapi_record_lease (struct omapi_record *, struct lease *);
+int omapi_record_host (struct omapi_record *, struct host_decl *);
+
 isc_result_t dhcp_class_set_value  (omapi_object_t *, omapi_object_t *,
 				    omapi_data_string_t *,
 				    omapi_typed_data_t *);
@@ -3533,6 +3840,8 @@ extern lease_id_hash_t *lease_hw_addr_hash;
 extern omapi_object_type_t *dhcp_type_host;
 
 extern int numclasseswritten;
+extern int expiry_slice_leases;
+extern int expiry_slice_usecs;
 
 
 isc_result_t enter_class (struct class *, int, int);
@@ -3551,8 +3860,12 @@ int find_host_for_network (struct subnet **, struct host_decl **,
 			   struct iaddr *, struct shared_network *);
 
 void new_address_range (struct parse *, struct iaddr, struct iaddr,
-			struct subnet *, struct pool *,
+			struct subnet *, struct pool *, int,
 			struct lease **);
+int sparse_range_allocate (struct lease **, struct pool *,
+			   const char *, int);
+struct lease *first_free_lease (struct pool *);
+struct pool *sparse_range_pool (struct iaddr);
 isc_result_t dhcp_lease_free (omapi_object_t *, const char *, int);
 isc_result_t dhcp_lease_get (omapi_object_t **, const char *, int);
 int find_grouped_subnet (struct subnet **, struct shared_network *,
@@ -3568,6 +3881,7 @@ void enter_lease (struct lease *);
 int supersede_lease (struct lease *, struct lease *, int, int, int, int);
 void make_binding_state_transition (struct lease *);
 int lease_copy (struct lease **, struct lease *, const char *, int);
+struct lease_cold *lease_cold (struct lease *);
 void release_lease (struct lease *, struct packet *);
 void abandon_lease (struct lease *, const char *);
 #if 0
@@ -3575,12 +3889,22 @@ void abandon_lease (struct lease *, const char *);
 void dissociate_lease (struct lease *);
 #endif
 void pool_timer (void *);
+void work_slice_begin (struct work_slice *);
+int work_slice_over (struct work_slice *);
+void expiry_slice_begin (void);
+int expiry_slice_over (void);
+void expiry_backlog_add (void (*) (void *), void *, tvref_t, tvunref_t,
+			 int, TIME);
+void expiry_backlog_run (void *);
+int expiry_backlog_gauge (TIME *);
 int find_lease_by_uid (struct lease **, const unsigned char *,
 		       unsigned, const char *, int);
 int find_lease_by_hw_addr (struct lease **, const unsigned char *,
 			   unsigned, const char *, int);
 int find_lease_by_ip_addr (struct lease **, struct iaddr,
 			   const char *, int);
+int find_or_make_lease_by_ip_addr (struct lease **, struct iaddr,
+				   const char *, int);
 void uid_hash_add (struct lease *);
 void uid_hash_delete (struct lease *);
 void hw_hash_add (struct lease *);
@@ -3595,6 +3919,9 @@ void lease_remove_all(struct lease **);
 int lease_enqueue (struct lease *);
 isc_result_t lease_instantiate(const void *, unsigned, void *);
 void expire_all_pools (void);
+void config_state_swap (struct config_state *);
+void config_state_merge (struct config_state *, int *, int *, int *);
+void config_state_release (struct config_state *);
 void dump_subnets (void);
 #if defined (DEBUG_MEMORY_LEAKAGE) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
@@ -3657,6 +3984,7 @@ isc_result_t dhcp_failover_peer_state_changed (dhcp_failover_state_t *,
 					       failover_message_t *);
 void dhcp_failover_pool_rebalance (void *);
 void dhcp_failover_pool_check (struct pool *);
+void dhcp_failover_pool_track (struct pool *);
 int dhcp_failover_state_pool_check (dhcp_failover_state_t *);
 void dhcp_failover_timeout (void *);
 void dhcp_failover_send_contact (void *);
@@ -3781,10 +4109,26 @@ int find_client_in_ldap (struct host_decl **, struct packet*,
 #endif
 
 /* mdb6.c */
-HASH_FUNCTIONS_DECL(ia, unsigned char *, struct ia_xx, ia_hash_t)
 HASH_FUNCTIONS_DECL(iasubopt, struct in6_addr *, struct iasubopt,
 		    iasubopt_hash_t)
 
+int ia_new_hash(ia_hash_t **table, unsigned size, const char *file, int line);
+void ia_free_hash_table(ia_hash_t **table, const char *file, int line);
+void ia_key_init(struct ia_key *key, u_int32_t iaid,
+		 const char *duid, unsigned int duid_len);
+int ia_key_lookup(struct ia_xx **ia, ia_hash_t *table,
+		  const struct ia_key *key, const char *file, int line);
+int ia_hash_lookup(struct ia_xx **ia, ia_hash_t *table,
+		   const unsigned char *iaid_duid, unsigned len,
+		   const char *file, int line);
+void ia_hash_add(ia_hash_t *table, struct ia_xx *ia,
+		 const char *file, int line);
+void ia_hash_remove(ia_hash_t *table, struct ia_xx *ia,
+		    const char *file, int line);
+void ia_hash_delete(ia_hash_t *table, const unsigned char *iaid_duid,
+		    unsigned len, const char *file, int line);
+int ia_hash_foreach(ia_hash_t *table, hash_foreach_func func);
+
 isc_result_t iasubopt_allocate(struct iasubopt **iasubopt,
 			       const char *file, int line);
 isc_result_t iasubopt_reference(struct iasubopt **iasubopt,
@@ -3893,7 +4237,6 @@ void lc_add_sorted_lease(struct leasechain *lc, struct lease *lp);
 void lc_unlink_lease(struct leasechain *lc, struct lease *lp);
 struct lease *lc_get_first_lease(struct leasechain *lc);
 struct lease *lc_get_next(struct leasechain *lc, struct lease *lp);
-void lc_init_growth(struct leasechain *lc, size_t growth);
 void lc_delete_all(struct leasechain *lc);
 #endif /* BINARY_LEASES */
 
@@ -348,6 +348,25 @@ typedef struct _dhcp_failover_state {
 	u_int32_t max_balance, min_balance;
 	TIME last_balance, sched_balance;
 
+	/* Pools that are out of balance, waiting to be balanced a slice at
+	   a time, and where balancing the one at the head has got to. */
+	struct pool *balance_head;
+	struct pool *balance_tail;
+	struct lease *balance_lease;	/* Next lease to look at. */
+	int balance_pass;		/* 0 if the pool at the head hasn't
+					   been started, 1 or 2 for the
+					   pass it's in. */
+	int balance_pending;		/* Pools on the queue. */
+	int balance_sendreq;		/* May send a POOLREQ this run. */
+	int balance_poolreq;		/* A pool needs one. */
+	struct timeval balance_start;	/* When this run started; zero if
+					   none is under way. */
+	int balance_pools;		/* Pools balanced in this run, or
+					   the last one. */
+	int balance_moved;		/* Leases given to the peer in this
+					   run, or the last one. */
+	u_int32_t balance_msecs;	/* How long the last run took. */
+
 	u_int32_t auto_partner_down;
 
 	enum service_state service_state;
@@ -27,9 +27,14 @@
  */
 
 isc_result_t omapi_buffer_new (omapi_buffer_t **, const char *, int);
+isc_result_t omapi_buffer_new_size (omapi_buffer_t **, unsigned,
+				    const char *, int);
 isc_result_t omapi_buffer_reference (omapi_buffer_t **,
 				     omapi_buffer_t *, const char *, int);
 isc_result_t omapi_buffer_dereference (omapi_buffer_t **, const char *, int);
+#if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void omapi_buffer_relinquish (void);
+#endif
 
 #if defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
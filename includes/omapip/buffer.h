@@ -46,23 +46,30 @@
    increase so that it's equal to the head (that would represent an empty
    buffer. */
 #define OMAPI_BUF_SIZE 4048
+
+/* Connections that carry a lot of data, such as failover links, can ask
+   for buffers this big instead (see omapi_connection_set_bulk()). */
+#define OMAPI_BULK_BUF_SIZE 65536
+
 typedef struct _omapi_buffer {
 	struct _omapi_buffer *next;	/* Buffers can be chained. */
 	u_int32_t refcnt;		/* Buffers are reference counted. */
-	u_int16_t head, tail;		/* Buffers are organized in a ring. */
-	char buf [OMAPI_BUF_SIZE];	/* The actual buffer is included in
-					   the buffer data structure. */
+	u_int32_t head, tail;		/* Buffers are organized in a ring. */
+	u_int32_t size;			/* Number of bytes in the ring. */
+	char *buf;			/* The actual buffer is allocated
+					   along with the buffer data
+					   structure, just after it. */
 } omapi_buffer_t;
 
 #define BUFFER_BYTES_FREE(x)	\
 	((x) -> tail > (x) -> head \
-	  ? sizeof ((x) -> buf) - ((x) -> tail - (x) -> head) \
+	  ? (x) -> size - ((x) -> tail - (x) -> head) \
 	  : (x) -> head - (x) -> tail)
 
 #define BYTES_IN_BUFFER(x)	\
 	((x) -> tail > (x) -> head \
 	 ? (x) -> tail - (x) -> head - 1 \
-	 : sizeof ((x) -> buf) - ((x) -> head - (x) -> tail) - 1)
+	 : (x) -> size - ((x) -> head - (x) -> tail) - 1)
 
 isc_result_t omapi_connection_require (omapi_object_t *, unsigned);
 isc_result_t omapi_connection_copyout (unsigned char *,
@@ -70,6 +77,12 @@ isc_result_t omapi_connection_copyout (unsigned char *,
 isc_result_t omapi_connection_copyin (omapi_object_t *,
 				      const unsigned char *, unsigned);
 isc_result_t omapi_connection_flush (omapi_object_t *);
+isc_result_t omapi_connection_reserve (omapi_object_t *, unsigned,
+				       unsigned char **);
+isc_result_t omapi_connection_commit (omapi_object_t *, unsigned);
+isc_result_t omapi_connection_cork (omapi_object_t *);
+isc_result_t omapi_connection_uncork (omapi_object_t *);
+isc_result_t omapi_connection_set_bulk (omapi_object_t *);
 isc_result_t omapi_connection_get_uint32 (omapi_object_t *, u_int32_t *);
 isc_result_t omapi_connection_put_uint32 (omapi_object_t *, u_int32_t);
 isc_result_t omapi_connection_get_uint16 (omapi_object_t *, u_int16_t *);
@@ -192,6 +192,10 @@ typedef struct __omapi_connection_object {
 	omapi_buffer_t *inbufs;
 	u_int32_t out_bytes;	/* Bytes of output in buffers. */
 	omapi_buffer_t *outbufs;
+	omapi_buffer_t *outbufs_tail;	/* Last of outbufs (not a
+					   reference). */
+	u_int32_t buf_size;	/* Size of new buffers; zero for
+				   OMAPI_BUF_SIZE. */
 	omapi_listener_object_t *listener;	/* Listener that accepted this
 						   connection, if any. */
 	dst_key_t *in_key;	/* Authenticator signing incoming
@@ -200,6 +204,7 @@ typedef struct __omapi_connection_object {
 	dst_key_t *out_key;	/* Authenticator signing outgoing
 				   data. */
 	void *out_context;	/* Output hash context. */
+	int corked;		/* Output waits for omapi_connection_uncork. */
 } omapi_connection_object_t;
 
 typedef struct __omapi_io_object {
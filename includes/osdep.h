@@ -123,6 +123,18 @@
 #  define USE_LPF_RECEIVE
 #endif
 
+/* Replies sent in a burst are queued and handed to the kernel together. */
+#if defined (HAVE_SENDMMSG) && \
+    (defined (USE_LPF_SEND) || defined (USE_SOCKET_SEND))
+#  define USE_SEND_BATCH
+#endif
+
+/* AF_XDP sockets stand in for LPF on the interfaces that ask for them. */
+#if defined (HAVE_AF_XDP) && defined (USE_LPF_SEND) && \
+    defined (USE_LPF_RECEIVE)
+#  define USE_AF_XDP
+#endif
+
 #ifdef USE_NIT
 #  define USE_NIT_SEND
 #  define USE_NIT_RECEIVE
@@ -1412,6 +1412,8 @@ intern(char *atom, enum dhcp_token dfv) {
                                         return SPACE;
                                 if (!strcasecmp(atom + 3, "wn"))
                                         return SPAWN;
+                                if (!strcasecmp(atom + 3, "rse"))
+                                        return SPARSE;
 				break;
 			}
                         if (!strcasecmp(atom + 2, "lit"))
@@ -465,14 +465,16 @@ static void
 post_process_option_definitions(struct parse *cfile)
 {
 	struct element *opt_def;
-	struct element *def, *ndef;
+	struct element *def;
+	size_t i;
 
 	opt_def = mapGet(cfile->stack[1], "option-def");
 	if (opt_def == NULL)
 		return;
-	TAILQ_FOREACH_SAFE(def, &opt_def->value.list_value, ndef) {
+	for (i = listSize(opt_def); i > 0; i--) {
+		def = listGet(opt_def, i - 1);
 		if (mapContains(def, "no-export"))
-			TAILQ_REMOVE(&opt_def->value.list_value, def);
+			listRemove(opt_def, i - 1);
 	}
 }
 
@@ -3091,7 +3093,9 @@ parse_binding_value(struct parse *cfile)
 #endif
 
 /* address-range-declaration :== ip-address ip-address SEMI
-			       | DYNAMIC_BOOTP ip-address ip-address SEMI */
+			       | DYNAMIC_BOOTP ip-address ip-address SEMI
+			       | [DYNAMIC_BOOTP] SPARSE ip-address ip-address SEMI
+*/
 
 void
 parse_address_range(struct parse *cfile, int type, size_t where)
@@ -3111,6 +3115,11 @@ parse_address_range(struct parse *cfile, int type, size_t where)
 		skip_token(&val, NULL, cfile);
 	}
 
+	/* Kea has no use for sparse, its pools never allocate leases
+	   in advance */
+	if (peek_token(&val, NULL, cfile) == SPARSE)
+		skip_token(&val, NULL, cfile);
+
 	/* Get the bottom address in the range... */
 	low = parse_numeric_aggregate(cfile, addr, &len, DOT, 10, 8);
 	if (low == NULL)
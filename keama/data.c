@@ -524,9 +524,256 @@ createMap(void)
 	return elem;
 }
 
+/*
+ * Lists and maps are chains, so listGet() and mapGet() have to walk
+ * them, which gets quadratic on large configs. Once a list or a map
+ * has INDEX_MIN elements an index is built beside the chain the first
+ * time it is searched: an array of the elements for a list, an open
+ * addressing hash table of the first element with each key for a map.
+ * The functions below keep the index up to date when that is cheap and
+ * drop it otherwise, to be built again by the next search.
+ */
+
+#define INDEX_MIN	16
+
+struct listindex {
+	size_t count;			/* number of elements */
+	size_t first;			/* offset of the first in base */
+	size_t size;			/* allocated size of base */
+	struct element **base;		/* allocated array */
+	struct element **elems;		/* elements in chain order */
+};
+
+struct mapindex {
+	size_t count;			/* number of elements */
+	size_t used;			/* number of used slots */
+	size_t size;			/* number of slots (power of 2) */
+	size_t dups;			/* elements with an already used key */
+	struct element **slots;		/* first element for each key */
+};
+
+static void
+dropListIndex(struct list *l)
+{
+	if (l->index == NULL)
+		return;
+	free(l->index->base);
+	free(l->index);
+	l->index = NULL;
+}
+
+static void
+listIndexAppend(struct listindex *idx, struct element *e)
+{
+	if (idx->first + idx->count == idx->size) {
+		if (idx->first >= idx->size / 2) {
+			/* reuse the room left by removals at the front */
+			memmove(idx->base, idx->elems,
+				idx->count * sizeof(*idx->elems));
+		} else {
+			idx->size *= 2;
+			idx->base = (struct element **)
+				realloc(idx->base,
+					idx->size * sizeof(*idx->base));
+			assert(idx->base != NULL);
+			memmove(idx->base, idx->base + idx->first,
+				idx->count * sizeof(*idx->base));
+		}
+		idx->first = 0;
+		idx->elems = idx->base;
+	}
+	idx->elems[idx->count++] = e;
+}
+
+static struct listindex *
+listIndex(struct element *l)
+{
+	struct list *lv = &l->value.list_value;
+	struct listindex *idx;
+	struct element *elem;
+	size_t cnt;
+
+	if (lv->index != NULL)
+		return lv->index;
+
+	cnt = 0;
+	TAILQ_FOREACH(elem, lv)
+		if (++cnt >= INDEX_MIN)
+			break;
+	if (cnt < INDEX_MIN)
+		return NULL;
+
+	idx = (struct listindex *)malloc(sizeof(*idx));
+	assert(idx != NULL);
+	idx->count = 0;
+	idx->first = 0;
+	idx->size = 2 * INDEX_MIN;
+	idx->base = (struct element **)
+		malloc(idx->size * sizeof(*idx->base));
+	assert(idx->base != NULL);
+	idx->elems = idx->base;
+	TAILQ_FOREACH(elem, lv) {
+		assert(elem->key == NULL);
+		listIndexAppend(idx, elem);
+	}
+	lv->index = idx;
+	return idx;
+}
+
+static size_t
+hashKey(const char *k)
+{
+	size_t h = 0;
+
+	while (*k != '\0')
+		h = h * 33 + (unsigned char)*k++;
+	return h;
+}
+
+static void
+dropMapIndex(struct map *m)
+{
+	if (m->index == NULL)
+		return;
+	free(m->index->slots);
+	free(m->index);
+	m->index = NULL;
+}
+
+/* Slot holding k or the empty slot where it would go */
+static size_t
+mapSlot(const struct mapindex *idx, const char *k)
+{
+	size_t mask = idx->size - 1;
+	size_t i;
+
+	for (i = hashKey(k) & mask;
+	     idx->slots[i] != NULL;
+	     i = (i + 1) & mask)
+		if (strcmp(idx->slots[i]->key, k) == 0)
+			break;
+	return i;
+}
+
+static void
+mapIndexAdd(struct mapindex *idx, struct element *e)
+{
+	struct element **old;
+	size_t oldsize;
+	size_t i;
+
+	idx->count++;
+	if (2 * (idx->used + 1) > idx->size) {
+		old = idx->slots;
+		oldsize = idx->size;
+		idx->size *= 2;
+		idx->slots = (struct element **)
+			calloc(idx->size, sizeof(*idx->slots));
+		assert(idx->slots != NULL);
+		for (i = 0; i < oldsize; i++)
+			if (old[i] != NULL)
+				idx->slots[mapSlot(idx, old[i]->key)] = old[i];
+		free(old);
+	}
+	i = mapSlot(idx, e->key);
+	if (idx->slots[i] != NULL) {
+		/* mapGet() returns the first one */
+		idx->dups++;
+		return;
+	}
+	idx->slots[i] = e;
+	idx->used++;
+}
+
+/* Remove a key from the table, moving back the following entries
+ * of its probe sequence so that they can still be found */
+static void
+mapIndexDelete(struct mapindex *idx, size_t i)
+{
+	size_t mask = idx->size - 1;
+	size_t j, k;
+
+	for (j = (i + 1) & mask;
+	     idx->slots[j] != NULL;
+	     j = (j + 1) & mask) {
+		k = hashKey(idx->slots[j]->key) & mask;
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && k <= i && k > j)) {
+			idx->slots[i] = idx->slots[j];
+			i = j;
+		}
+	}
+	idx->slots[i] = NULL;
+	idx->used--;
+}
+
+static struct mapindex *
+mapIndex(struct element *m)
+{
+	struct map *mv = &m->value.map_value;
+	struct mapindex *idx;
+	struct element *elem;
+	size_t cnt;
+
+	if (mv->index != NULL)
+		return mv->index;
+
+	cnt = 0;
+	TAILQ_FOREACH(elem, mv)
+		if (++cnt >= INDEX_MIN)
+			break;
+	if (cnt < INDEX_MIN)
+		return NULL;
+
+	idx = (struct mapindex *)malloc(sizeof(*idx));
+	assert(idx != NULL);
+	memset(idx, 0, sizeof(*idx));
+	idx->size = 4 * INDEX_MIN;
+	idx->slots = (struct element **)
+		calloc(idx->size, sizeof(*idx->slots));
+	assert(idx->slots != NULL);
+	TAILQ_FOREACH(elem, mv) {
+		assert(elem->key != NULL);
+		mapIndexAdd(idx, elem);
+	}
+	mv->index = idx;
+	return idx;
+}
+
+/* Append an element which already has its key */
+static void
+mapAppend(struct element *m, struct element *e)
+{
+	TAILQ_INSERT_TAIL(&m->value.map_value, e);
+	if (m->value.map_value.index != NULL)
+		mapIndexAdd(m->value.map_value.index, e);
+}
+
+/* Unlink the first element with its key */
+static void
+mapUnlink(struct element *m, struct element *e)
+{
+	struct mapindex *idx = m->value.map_value.index;
+
+	TAILQ_REMOVE(&m->value.map_value, e);
+	if (idx == NULL)
+		return;
+	if (idx->dups > 0) {
+		/* the next one with the key has to be found */
+		dropMapIndex(&m->value.map_value);
+		return;
+	}
+	idx->count--;
+	mapIndexDelete(idx, mapSlot(idx, e->key));
+}
+
 static void
 reset(struct element *e)
 {
+	if (e->type == ELEMENT_LIST)
+		dropListIndex(&e->value.list_value);
+	else if (e->type == ELEMENT_MAP)
+		dropMapIndex(&e->value.map_value);
 	e->type = 0;
 	e->kind = 0;
 	assert(e->key == NULL);
@@ -645,12 +892,19 @@ resetBy(struct element *e, struct element *o)
 struct element *
 listGet(struct element *l, int i)
 {
+	struct listindex *idx;
 	struct element *elem;
 
 	assert(l != NULL);
 	assert(l->type == ELEMENT_LIST);
 	assert(i >= 0);
 
+	idx = listIndex(l);
+	if (idx != NULL) {
+		assert((size_t)i < idx->count);
+		return idx->elems[i];
+	}
+
 	elem = TAILQ_FIRST(&l->value.list_value);
 	assert(elem != NULL);
 	assert(elem->key == NULL);
@@ -668,6 +922,8 @@ listGet(struct element *l, int i)
 void
 listSet(struct element *l, struct element *e, int i)
 {
+	struct listindex *idx;
+
 	assert(l != NULL);
 	assert(l->type == ELEMENT_LIST);
 	assert(e != NULL);
@@ -678,19 +934,18 @@ listSet(struct element *l, struct element *e, int i)
 	} else {
 		struct element *prev;
 
-		prev = TAILQ_FIRST(&l->value.list_value);
-		assert(prev != NULL);
-		assert(prev->key == NULL);
-
-		unsigned j;
-		for (j = i; j > 1; --j) {
-			prev = TAILQ_NEXT(prev);
-			assert(prev != NULL);
-			assert(prev->key == NULL);
-		}
-
+		prev = listGet(l, i - 1);
 		TAILQ_INSERT_AFTER(&l->value.list_value, prev, e);
 	}
+
+	idx = l->value.list_value.index;
+	if (idx != NULL) {
+		assert((size_t)i <= idx->count);
+		listIndexAppend(idx, e);
+		memmove(&idx->elems[i + 1], &idx->elems[i],
+			(idx->count - 1 - i) * sizeof(*idx->elems));
+		idx->elems[i] = e;
+	}
 }
 
 void
@@ -701,40 +956,54 @@ listPush(struct element *l, struct element *e)
 	assert(e != NULL);
 
 	TAILQ_INSERT_TAIL(&l->value.list_value, e);
+	if (l->value.list_value.index != NULL)
+		listIndexAppend(l->value.list_value.index, e);
 }
 
 void
 listRemove(struct element *l, int i)
 {
+	struct listindex *idx;
 	struct element *elem;
 
 	assert(l != NULL);
 	assert(l->type == ELEMENT_LIST);
 	assert(i >= 0);
 
-	elem = TAILQ_FIRST(&l->value.list_value);
-	assert(elem != NULL);
-	assert(elem->key == NULL);
+	elem = listGet(l, i);
+	TAILQ_REMOVE(&l->value.list_value, elem);
 
-	unsigned j;
-	for (j = i; j > 0; --j) {
-		elem = TAILQ_NEXT(elem);
-		assert(elem != NULL);
-		assert(elem->key == NULL);
+	idx = l->value.list_value.index;
+	if (idx != NULL) {
+		/* move the shorter side: lists are often emptied
+		 * by removing their first element */
+		idx->count--;
+		if ((size_t)i < idx->count / 2) {
+			memmove(&idx->elems[1], &idx->elems[0],
+				i * sizeof(*idx->elems));
+			idx->elems++;
+			idx->first++;
+		} else
+			memmove(&idx->elems[i], &idx->elems[i + 1],
+				(idx->count - i) * sizeof(*idx->elems));
 	}
-
-	TAILQ_REMOVE(&l->value.list_value, elem);
 }
 
 size_t
 listSize(const struct element *l)
 {
+	struct listindex *idx;
 	struct element *elem;
 	size_t cnt;
 
 	assert(l != NULL);
 	assert(l->type == ELEMENT_LIST);
 
+	/* the index is a cache so it can be built for a const list */
+	idx = listIndex((struct element *)l);
+	if (idx != NULL)
+		return idx->count;
+
 	cnt = 0;
 	TAILQ_FOREACH(elem, &l->value.list_value) {
 		assert(elem->key == NULL);
@@ -747,23 +1016,34 @@ listSize(const struct element *l)
 void
 concat(struct element *l, struct element *o)
 {
+	struct element *elem;
+
 	assert(l != NULL);
 	assert(l->type == ELEMENT_LIST);
 	assert(o != NULL);
 	assert(o->type == ELEMENT_LIST);
 
+	if (l->value.list_value.index != NULL)
+		TAILQ_FOREACH(elem, &o->value.list_value)
+			listIndexAppend(l->value.list_value.index, elem);
+	dropListIndex(&o->value.list_value);
 	TAILQ_CONCAT(&l->value.list_value, &o->value.list_value);
 }
 
 struct element *
 mapGet(struct element *m, const char *k)
 {
+	struct mapindex *idx;
 	struct element *elem;
 
 	assert(m != NULL);
 	assert(m->type == ELEMENT_MAP);
 	assert(k != NULL);
 
+	idx = mapIndex(m);
+	if (idx != NULL)
+		return idx->slots[mapSlot(idx, k)];
+
 	TAILQ_FOREACH(elem, &m->value.map_value) {
 		assert(elem->key != NULL);
 		if (strcmp(elem->key, k) == 0)
@@ -785,7 +1065,7 @@ mapSet(struct element *m, struct element *e, const char *k)
 #endif
 	e->key = strdup(k);
 	assert(e->key != NULL);
-	TAILQ_INSERT_TAIL(&m->value.map_value, e);
+	mapAppend(m, e);
 }
 
 void
@@ -797,32 +1077,20 @@ mapRemove(struct element *m, const char *k)
 	assert(m->type == ELEMENT_MAP);
 	assert(k != NULL);
 
-	TAILQ_FOREACH(elem, &m->value.map_value) {
-		assert(elem->key != NULL);
-		if (strcmp(elem->key, k) == 0)
-			break;
-	}
-
+	elem = mapGet(m, k);
 	assert(elem != NULL);
-	TAILQ_REMOVE(&m->value.map_value, elem);
+	mapUnlink(m, elem);
 }
 
 isc_boolean_t
 mapContains(const struct element *m, const char *k)
 {
-	struct element *elem;
-
 	assert(m != NULL);
 	assert(m->type == ELEMENT_MAP);
 	assert(k != NULL);
 
-	TAILQ_FOREACH(elem, &m->value.map_value) {
-		assert(elem->key != NULL);
-		if (strcmp(elem->key, k) == 0)
-			break;
-	}
-
-	return ISC_TF(elem != NULL);
+	/* the index is a cache so it can be built for a const map */
+	return ISC_TF(mapGet((struct element *)m, k) != NULL);
 }
 
 size_t
@@ -834,6 +1102,9 @@ mapSize(const struct element *m)
 	assert(m != NULL);
 	assert(m->type == ELEMENT_MAP);
 
+	if (m->value.map_value.index != NULL)
+		return m->value.map_value.index->count;
+
 	cnt = 0;
 	TAILQ_FOREACH(elem, &m->value.map_value) {
 		assert(elem->key != NULL);
@@ -854,11 +1125,12 @@ merge(struct element *m, struct element *o)
 	assert(o != NULL);
 	assert(o->type == ELEMENT_MAP);
 
+	dropMapIndex(&o->value.map_value);
 	TAILQ_FOREACH_SAFE(elem, &o->value.map_value, ne) {
 		assert(elem->key != NULL);
 		TAILQ_REMOVE(&o->value.map_value, elem);
 		if (!mapContains(m, elem->key)) {
-			TAILQ_INSERT_TAIL(&m->value.map_value, elem);
+			mapAppend(m, elem);
 		}
 	}
 }
@@ -957,19 +1229,40 @@ addIndent(FILE *fp, int skip, unsigned indent)
 	unsigned sp;
 
 	if (skip) {
-		fprintf(fp, "//");
+		fputs("//", fp);
 		if (indent > 2)
 			for (sp = 0; sp < indent - 2; ++sp)
-				fprintf(fp, " ");
+				putc(' ', fp);
 	} else
 		for (sp = 0; sp < indent; ++sp)
-			fprintf(fp, " ");
+			putc(' ', fp);
+}
+
+/*
+ * skip_to_end() for each element of a run of skipped elements walks
+ * the rest of the run each time, so printList() and printMap() keep
+ * the first element after the run which is not skipped.
+ */
+static isc_boolean_t
+skip_to_kept(const struct element *e, const struct element **kept)
+{
+	if (*kept == e) {
+		while (*kept != NULL && (*kept)->skip)
+			*kept = TAILQ_NEXT(*kept);
+		if (*kept == e) {
+			/* not skipped: look again from the next one */
+			*kept = TAILQ_NEXT(e);
+			return ISC_FALSE;
+		}
+	}
+	return ISC_TF(*kept == NULL);
 }
 
 void
 printList(FILE *fp, const struct list *l, isc_boolean_t skip, unsigned indent)
 {
 	struct element *elem;
+	const struct element *kept;
 	struct comment *comment;
 	isc_boolean_t first;
 
@@ -983,13 +1276,14 @@ printList(FILE *fp, const struct list *l, isc_boolean_t skip, unsigned indent)
 
 	fprintf(fp, "[\n");
 	first = ISC_TRUE;
+	kept = TAILQ_FIRST(l);
 	TAILQ_FOREACH(elem, l) {
 		isc_boolean_t skip_elem = skip;
 
 		assert(elem->key == NULL);
 		if (!skip) {
 			skip_elem = elem->skip;
-			if (skip_to_end(elem)) {
+			if (skip_to_kept(elem, &kept)) {
 				if (!first)
 					fprintf(fp, "\n");
 				first = ISC_TRUE;
@@ -1014,6 +1308,7 @@ void
 printMap(FILE *fp, const struct map *m, isc_boolean_t skip, unsigned indent)
 {
 	struct element *elem;
+	const struct element *kept;
 	struct comment *comment;
 	isc_boolean_t first;
 
@@ -1027,13 +1322,14 @@ printMap(FILE *fp, const struct map *m, isc_boolean_t skip, unsigned indent)
 
 	fprintf(fp, "{\n");
 	first = ISC_TRUE;
+	kept = TAILQ_FIRST(m);
 	TAILQ_FOREACH(elem, m) {
 		isc_boolean_t skip_elem = skip;
 
 		assert(elem->key != NULL);
 		if (!skip) {
 			skip_elem = elem->skip;
-			if (skip_to_end(elem)) {
+			if (skip_to_kept(elem, &kept)) {
 				if (!first)
 					fprintf(fp, "\n");
 				first = ISC_TRUE;
@@ -1063,41 +1359,41 @@ printString(FILE *fp, const struct string *s)
 	assert(fp != NULL);
 	assert(s != NULL);
 
-	fprintf(fp, "\"");
+	putc('"', fp);
 	for (i = 0; i < s->length; i++) {
 		char c = *(s->content + i);
 
 		switch (c) {
 		case '"':
-			fprintf(fp, "\\\"");
+			fputs("\\\"", fp);
 			break;
 		case '\\':
-			fprintf(fp, "\\\\");
+			fputs("\\\\", fp);
 			break;
 		case '\b':
-			fprintf(fp, "\\b");
+			fputs("\\b", fp);
 			break;
 		case '\f':
-			fprintf(fp, "\\f");
+			fputs("\\f", fp);
 			break;
 		case '\n':
-			fprintf(fp, "\\n");
+			fputs("\\n", fp);
 			break;
 		case '\r':
-			fprintf(fp, "\\r");
+			fputs("\\r", fp);
 			break;
 		case '\t':
-			fprintf(fp, "\\t");
+			fputs("\\t", fp);
 			break;
 		default:
 			if ((c >= 0) && (c < 0x20)) {
 				fprintf(fp, "\\u%04x", (unsigned)c & 0xff);
 			} else {
-				fprintf(fp, "%c", c);
+				putc(c, fp);
 			}
 		}
 	}
-	fprintf(fp, "\"");
+	putc('"', fp);
 }
 
 isc_boolean_t
@@ -1203,7 +1499,7 @@ mapPop(struct element *m)
 	assert(h->key != NULL);
 	h->value = item;
 
-	TAILQ_REMOVE(&m->value.map_value, item);
+	mapUnlink(m, item);
 
 	return h;
 }
@@ -195,11 +195,26 @@ TAILQ_HEAD(comments, comment);
 
 struct comment *createComment(const char *line);
 
+/* Element list and map: TAILQ heads, so the TAILQ macros can walk
+ * them, with an index built on demand for positional and keyed access.
+ * The index follows changes made through the list and map functions
+ * below, so use them rather than the TAILQ macros to change the chain. */
+struct listindex;
+struct mapindex;
+
 /* Element list */
-TAILQ_HEAD(list, element);
+struct list {
+	struct element *tqh_first;	/* first element */
+	struct element **tqh_last;	/* addr of last next element */
+	struct listindex *index;	/* array of elements or NULL */
+};
 
 /* Element map */
-TAILQ_HEAD(map, element);
+struct map {
+	struct element *tqh_first;	/* first element */
+	struct element **tqh_last;	/* addr of last next element */
+	struct mapindex *index;		/* hash table of keys or NULL */
+};
 
 /* Element value */
 union value {
@@ -393,6 +393,10 @@ struct option_def configs[] = {
         { "bind-local-address6", "f",           "server",  98, 0},
 	{ "ping-cltt-secs", "T",		"server",  99, 0},
 	{ "ping-timeout-ms", "T",		"server", 100, 0},
+	{ "ping-cache-secs", "T",		"server", 101, 0},
+	{ "expiry-slice-leases", "L",		"server", 102, 0},
+	{ "expiry-slice-usecs", "L",		"server", 103, 0},
+	{ "lease-load-threads", "L",		"server", 104, 0},
 	{ NULL, NULL, NULL, 0, 0 }
 };
 
@@ -1132,6 +1136,34 @@ get_config_comments(unsigned code)
 					"supported");
 		TAILQ_INSERT_TAIL(&comments, comment);
 		goto no_ping;
+	case 101: /* ping-cache-secs */
+		comment = createComment("/// ping-cache-secs is not "
+					"supported");
+		TAILQ_INSERT_TAIL(&comments, comment);
+		goto no_ping;
+	case 102: /* expiry-slice-leases */
+		comment = createComment("/// expiry-slice-leases is not "
+					"supported");
+		TAILQ_INSERT_TAIL(&comments, comment);
+		comment = createComment("/// Kea equivalent is "
+					"max-reclaim-leases in "
+					"expired-leases-processing");
+		TAILQ_INSERT_TAIL(&comments, comment);
+		break;
+	case 103: /* expiry-slice-usecs */
+		comment = createComment("/// expiry-slice-usecs is not "
+					"supported");
+		TAILQ_INSERT_TAIL(&comments, comment);
+		comment = createComment("/// Kea equivalent is "
+					"max-reclaim-time in "
+					"expired-leases-processing");
+		TAILQ_INSERT_TAIL(&comments, comment);
+		break;
+	case 104: /* lease-load-threads */
+		comment = createComment("/// lease-load-threads is not "
+					"supported");
+		TAILQ_INSERT_TAIL(&comments, comment);
+		break;
 	}
 	return &comments;
 }
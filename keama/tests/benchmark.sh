@@ -0,0 +1,52 @@
+#!/bin/sh
+
+#set -x
+
+# Time the conversion of a generated config with many subnets, hosts
+# and subclasses
+# usage: benchmark.sh [hosts [subnets [subclasses]]]
+
+hosts=${1:-100000}
+subnets=${2:-1000}
+subclasses=${3:-1000}
+
+cd "$(dirname "$0")"
+
+conf=/tmp/keama-bench$$.conf
+out=/tmp/keama-bench$$.json
+trap 'rm -f $conf $out' 0
+
+awk -v hosts=$hosts -v subnets=$subnets -v subclasses=$subclasses 'BEGIN {
+	printf "class \"vendor\" {\n"
+	printf "    match option vendor-class-identifier;\n}\n"
+	for (c = 0; c < subclasses; c++) {
+		printf "subclass \"vendor\" \"v%d\" {\n", c
+		printf "    option domain-name \"d%d.example.com\";\n}\n", c
+	}
+	for (s = 0; s < subnets; s++) {
+		a = int(s / 256); b = s % 256
+		printf "subnet 10.%d.%d.0 netmask 255.255.255.0 {\n", a, b
+		printf "    range 10.%d.%d.100 10.%d.%d.200;\n", a, b, a, b
+		printf "    option routers 10.%d.%d.1;\n}\n", a, b
+	}
+	for (h = 0; h < hosts; h++) {
+		s = h % subnets
+		printf "host h%d {\n", h
+		printf "    hardware ethernet 02:00:%02x:%02x:%02x:%02x;\n", \
+			int(h / 16777216) % 256, int(h / 65536) % 256, \
+			int(h / 256) % 256, h % 256
+		printf "    fixed-address 10.%d.%d.%d;\n}\n", \
+			int(s / 256), s % 256, 2 + int(h / subnets) % 96
+	}
+}' > $conf
+
+echo "$hosts hosts in $subnets subnets, $subclasses subclasses:"
+start=$(date +%s.%N)
+../keama -4 -i $conf -o $out
+status=$?
+end=$(date +%s.%N)
+if [ $status -eq 255 ]; then
+	echo "conversion failed" >&2
+	exit 1
+fi
+echo "$start $end" | awk '{ printf "converted in %.2f seconds\n", $2 - $1 }'
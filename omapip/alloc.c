@@ -724,20 +724,56 @@ isc_result_t omapi_object_dereference (omapi_object_t **h,
 	return ISC_R_SUCCESS;
 }
 
+/* Buffers of the two usual sizes are kept on free lists when they're
+   let go of, rather than being freed, since connections go through them
+   quickly; the lists are kept short so that a burst of output doesn't
+   hold on to memory for ever. */
+
+#define OMAPI_FREE_BUFFERS_MAX		64
+#define OMAPI_FREE_BULK_BUFFERS_MAX	4
+
+static omapi_buffer_t *free_buffers;
+static int free_buffer_count;
+static omapi_buffer_t *free_bulk_buffers;
+static int free_bulk_buffer_count;
+
 isc_result_t omapi_buffer_new (omapi_buffer_t **h,
 			       const char *file, int line)
+{
+	return omapi_buffer_new_size (h, OMAPI_BUF_SIZE, file, line);
+}
+
+isc_result_t omapi_buffer_new_size (omapi_buffer_t **h, unsigned size,
+				    const char *file, int line)
 {
 	omapi_buffer_t *t;
 	isc_result_t status;
 
-	t = (omapi_buffer_t *)dmalloc (sizeof *t, file, line);
-	if (!t)
-		return ISC_R_NOMEMORY;
+	if (size < 2)
+		return DHCP_R_INVALIDARG;
+
+	if (size == OMAPI_BUF_SIZE && free_buffers) {
+		t = free_buffers;
+		free_buffers = t -> next;
+		free_buffer_count--;
+		dmalloc_reuse (t, file, line, 1);
+	} else if (size == OMAPI_BULK_BUF_SIZE && free_bulk_buffers) {
+		t = free_bulk_buffers;
+		free_bulk_buffers = t -> next;
+		free_bulk_buffer_count--;
+		dmalloc_reuse (t, file, line, 1);
+	} else {
+		t = (omapi_buffer_t *)dmalloc (sizeof *t + size, file, line);
+		if (!t)
+			return ISC_R_NOMEMORY;
+	}
 	memset (t, 0, sizeof *t);
+	t -> size = size;
+	t -> buf = (char *)(t + 1);
+	t -> head = size - 1;
 	status = omapi_buffer_reference (h, t, file, line);
 	if (status != ISC_R_SUCCESS)
 		dfree (t, file, line);
-	(*h) -> head = sizeof ((*h) -> buf) - 1;
 	return status;
 }
 
@@ -763,9 +799,29 @@ isc_result_t omapi_buffer_reference (omapi_buffer_t **r,
 	return ISC_R_SUCCESS;
 }
 
+static void buffer_free (omapi_buffer_t *b, const char *file, int line)
+{
+	if (b -> size == OMAPI_BUF_SIZE &&
+	    free_buffer_count < OMAPI_FREE_BUFFERS_MAX) {
+		b -> next = free_buffers;
+		free_buffers = b;
+		free_buffer_count++;
+		dmalloc_reuse (b, (char *)0, 0, 0);
+	} else if (b -> size == OMAPI_BULK_BUF_SIZE &&
+		   free_bulk_buffer_count < OMAPI_FREE_BULK_BUFFERS_MAX) {
+		b -> next = free_bulk_buffers;
+		free_bulk_buffers = b;
+		free_bulk_buffer_count++;
+		dmalloc_reuse (b, (char *)0, 0, 0);
+	} else
+		dfree (b, file, line);
+}
+
 isc_result_t omapi_buffer_dereference (omapi_buffer_t **h,
 				       const char *file, int line)
 {
+	omapi_buffer_t *b, *n;
+
 	if (!h)
 		return DHCP_R_INVALIDARG;
 
@@ -794,12 +850,43 @@ isc_result_t omapi_buffer_dereference (omapi_buffer_t **h,
 
 	--(*h) -> refcnt;
 	rc_register (file, line, h, *h, (*h) -> refcnt, 1, RC_MISC);
-	if ((*h) -> refcnt == 0)
-		dfree (*h, file, line);
+	b = *h;
 	*h = 0;
+
+	/* Let go of the rest of the chain along with the buffer; output
+	   to a slow peer can make for a long one, so don't recurse. */
+	while (b && b -> refcnt == 0) {
+		n = b -> next;
+		buffer_free (b, file, line);
+		if ((b = n) != NULL) {
+			--b -> refcnt;
+			rc_register (file, line, &n, b, b -> refcnt, 1,
+				     RC_MISC);
+		}
+	}
 	return ISC_R_SUCCESS;
 }
 
+#if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void omapi_buffer_relinquish ()
+{
+	omapi_buffer_t *b, *n;
+
+	for (b = free_buffers; b; b = n) {
+		n = b -> next;
+		dfree (b, MDL);
+	}
+	free_buffers = (omapi_buffer_t *)0;
+	free_buffer_count = 0;
+	for (b = free_bulk_buffers; b; b = n) {
+		n = b -> next;
+		dfree (b, MDL);
+	}
+	free_bulk_buffers = (omapi_buffer_t *)0;
+	free_bulk_buffer_count = 0;
+}
+#endif
+
 isc_result_t omapi_typed_data_new (const char *file, int line,
 				   omapi_typed_data_t **t,
 				   omapi_datatype_t type, ...)
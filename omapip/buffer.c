@@ -30,6 +30,11 @@
 
 #include <omapip/omapip_p.h>
 #include <errno.h>
+#include <sys/uio.h>
+
+/* The size of the buffers a connection reads and writes through. */
+#define CONNECTION_BUF_SIZE(c) \
+	((c) -> buf_size ? (c) -> buf_size : OMAPI_BUF_SIZE)
 
 #if defined (TRACING)
 static void trace_connection_input_input (trace_type_t *, unsigned, char *);
@@ -152,7 +157,7 @@ static isc_result_t omapi_connection_reader_trace (omapi_object_t *h,
 	c = (omapi_connection_object_t *)h;
 
 	/* See if there are enough bytes. */
-	if (c -> in_bytes >= OMAPI_BUF_SIZE - 1 &&
+	if (c -> in_bytes >= CONNECTION_BUF_SIZE (c) - 1 &&
 	    c -> in_bytes > c -> bytes_needed)
 		return ISC_R_SUCCESS;
 
@@ -162,13 +167,15 @@ static isc_result_t omapi_connection_reader_trace (omapi_object_t *h,
 		     buffer = buffer -> next)
 			;
 		if (!BUFFER_BYTES_FREE (buffer)) {
-			status = omapi_buffer_new (&buffer -> next, MDL);
+			status = omapi_buffer_new_size
+				(&buffer -> next, CONNECTION_BUF_SIZE (c), MDL);
 			if (status != ISC_R_SUCCESS)
 				return status;
 			buffer = buffer -> next;
 		}
 	} else {
-		status = omapi_buffer_new (&c -> inbufs, MDL);
+		status = omapi_buffer_new_size (&c -> inbufs,
+						CONNECTION_BUF_SIZE (c), MDL);
 		if (status != ISC_R_SUCCESS)
 			return status;
 		buffer = c -> inbufs;
@@ -178,7 +185,7 @@ static isc_result_t omapi_connection_reader_trace (omapi_object_t *h,
 
 	while (bytes_to_read) {
 		if (buffer -> tail > buffer -> head)
-			read_len = sizeof (buffer -> buf) - buffer -> tail;
+			read_len = buffer -> size - buffer -> tail;
 		else
 			read_len = buffer -> head - buffer -> tail;
 
@@ -247,7 +254,7 @@ static isc_result_t omapi_connection_reader_trace (omapi_object_t *h,
 #endif
 		buffer -> tail += read_status;
 		c -> in_bytes += read_status;
-		if (buffer -> tail == sizeof buffer -> buf)
+		if (buffer -> tail == buffer -> size)
 			buffer -> tail = 0;
 		if (read_status < read_len)
 			break;
@@ -262,6 +269,63 @@ static isc_result_t omapi_connection_reader_trace (omapi_object_t *h,
 
 /* Put some bytes into the output buffer for a connection. */
 
+/*
+ * If we have any bytes to send and we have a proper io object
+ * inform the socket code that we would like to know when we
+ * can send more bytes.   While the connection is corked the
+ * bytes wait for omapi_connection_uncork() to write them.
+ */
+static void connection_poke (omapi_connection_object_t *c)
+{
+	if (c->out_bytes != 0 && !c->corked) {
+		if ((c->outer != NULL) &&
+		    (c->outer->type == omapi_type_io_object)) {
+			omapi_io_object_t *io = (omapi_io_object_t *)c->outer;
+			isc_socket_fdwatchpoke(io->fd,
+					       ISC_SOCKFDWATCH_WRITE);
+		}
+	}
+}
+
+/* Add an empty buffer to the end of a connection's output. */
+static isc_result_t connection_outbuf_add (omapi_connection_object_t *c)
+{
+	omapi_buffer_t **bp;
+	isc_result_t status;
+
+	if (c -> outbufs_tail)
+		bp = &c -> outbufs_tail -> next;
+	else
+		bp = &c -> outbufs;
+	status = omapi_buffer_new_size (bp, CONNECTION_BUF_SIZE (c), MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	c -> outbufs_tail = *bp;
+	return ISC_R_SUCCESS;
+}
+
+/* Get rid of any output buffers that have been written out. */
+static void connection_outbufs_trim (omapi_connection_object_t *c)
+{
+	omapi_buffer_t *buffer = (omapi_buffer_t *)0;
+
+	while (c -> outbufs &&
+	       !BYTES_IN_BUFFER (c -> outbufs)) {
+		if (c -> outbufs -> next) {
+			omapi_buffer_reference (&buffer,
+						c -> outbufs -> next, MDL);
+			omapi_buffer_dereference (&c -> outbufs -> next, MDL);
+		}
+		omapi_buffer_dereference (&c -> outbufs, MDL);
+		if (buffer) {
+			omapi_buffer_reference (&c -> outbufs, buffer, MDL);
+			omapi_buffer_dereference (&buffer, MDL);
+		}
+	}
+	if (!c -> outbufs)
+		c -> outbufs_tail = (omapi_buffer_t *)0;
+}
+
 isc_result_t omapi_connection_copyin (omapi_object_t *h,
 				      const unsigned char *bufp,
 				      unsigned len)
@@ -284,29 +348,25 @@ isc_result_t omapi_connection_copyin (omapi_object_t *h,
 	    c -> state == omapi_connection_closed)
 		return ISC_R_NOTCONNECTED;
 
-	if (c -> outbufs) {
-		for (buffer = c -> outbufs;
-		     buffer -> next; buffer = buffer -> next)
-			;
-	} else {
-		status = omapi_buffer_new (&c -> outbufs, MDL);
+	if (!c -> outbufs_tail) {
+		status = connection_outbuf_add (c);
 		if (status != ISC_R_SUCCESS)
 			goto leave;
-		buffer = c -> outbufs;
 	}
+	buffer = c -> outbufs_tail;
 
 	while (bytes_copied < len) {
 		/* If there is no space available in this buffer,
                    allocate a new one. */
 		if (!BUFFER_BYTES_FREE (buffer)) {
-			status = (omapi_buffer_new (&buffer -> next, MDL));
+			status = connection_outbuf_add (c);
 			if (status != ISC_R_SUCCESS)
 				goto leave;
-			buffer = buffer -> next;
+			buffer = c -> outbufs_tail;
 		}
 
 		if (buffer -> tail > buffer -> head)
-			copy_len = sizeof (buffer -> buf) - buffer -> tail;
+			copy_len = buffer -> size - buffer -> tail;
 		else
 			copy_len = buffer -> head - buffer -> tail;
 
@@ -329,33 +389,160 @@ isc_result_t omapi_connection_copyin (omapi_object_t *h,
 		buffer -> tail += copy_len;
 		c -> out_bytes += copy_len;
 		bytes_copied += copy_len;
-		if (buffer -> tail == sizeof buffer -> buf)
+		if (buffer -> tail == buffer -> size)
 			buffer -> tail = 0;
 	}
 
 	status = ISC_R_SUCCESS;
 
  leave:
-	/*
-	 * If we have any bytes to send and we have a proper io object
-	 * inform the socket code that we would like to know when we
-	 * can send more bytes.
-	 */
-	if (c->out_bytes != 0) {
-		if ((c->outer != NULL) &&
-		    (c->outer->type == omapi_type_io_object)) {
-			omapi_io_object_t *io = (omapi_io_object_t *)c->outer;
-			isc_socket_fdwatchpoke(io->fd,
-					       ISC_SOCKFDWATCH_WRITE);
-		}
-	}
-
+	connection_poke (c);
 	return (status);
 }
 
 /* Copy some bytes from the input buffer, and advance the input buffer
    pointer beyond the bytes copied out. */
 
+/* Find len contiguous bytes of free space at the end of the connection's
+   output, starting a new buffer if the last one doesn't have them, so
+   that a message can be put together in place.   Nothing is sent until
+   omapi_connection_commit() is called with the number of bytes filled
+   in; reserving again or copying in without committing abandons them. */
+
+isc_result_t omapi_connection_reserve (omapi_object_t *h, unsigned len,
+				       unsigned char **bufp)
+{
+	omapi_buffer_t *buffer;
+	omapi_connection_object_t *c;
+	unsigned room;
+	isc_result_t status;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+
+	if (c -> state == omapi_connection_disconnecting ||
+	    c -> state == omapi_connection_closed)
+		return ISC_R_NOTCONNECTED;
+	if (len > CONNECTION_BUF_SIZE (c) - 1)
+		return ISC_R_NOSPACE;
+
+	room = 0;
+	buffer = c -> outbufs_tail;
+	if (buffer) {
+		if (buffer -> tail > buffer -> head)
+			room = buffer -> size - buffer -> tail;
+		else
+			room = buffer -> head - buffer -> tail;
+	}
+	if (room < len) {
+		status = connection_outbuf_add (c);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		buffer = c -> outbufs_tail;
+	}
+
+	*bufp = (unsigned char *)&buffer -> buf [buffer -> tail];
+	return ISC_R_SUCCESS;
+}
+
+/* Add len bytes filled in after omapi_connection_reserve() to the
+   connection's output. */
+
+isc_result_t omapi_connection_commit (omapi_object_t *h, unsigned len)
+{
+	omapi_buffer_t *buffer;
+	omapi_connection_object_t *c;
+	int sig_flags = SIG_MODE_UPDATE;
+	isc_result_t status;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+	buffer = c -> outbufs_tail;
+	if (!buffer)
+		return DHCP_R_INVALIDARG;
+
+	if (c -> out_key) {
+		if (!c -> out_context)
+			sig_flags |= SIG_MODE_INIT;
+		status = omapi_connection_sign_data
+			(sig_flags, c -> out_key, &c -> out_context,
+			 (unsigned char *)&buffer -> buf [buffer -> tail], len,
+			 (omapi_typed_data_t **)0);
+		if (status != ISC_R_SUCCESS)
+			return status;
+	}
+
+	buffer -> tail += len;
+	if (buffer -> tail == buffer -> size)
+		buffer -> tail = 0;
+	c -> out_bytes += len;
+	connection_poke (c);
+	return ISC_R_SUCCESS;
+}
+
+/* While a connection is corked, output is only buffered; when the last
+   cork comes out, everything buffered is written at once, so that a
+   run of messages sent in one go leaves in as few writes as possible. */
+
+isc_result_t omapi_connection_cork (omapi_object_t *h)
+{
+	omapi_connection_object_t *c;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+	c -> corked++;
+	return ISC_R_SUCCESS;
+}
+
+isc_result_t omapi_connection_uncork (omapi_object_t *h)
+{
+	omapi_connection_object_t *c;
+	isc_result_t status;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+	if (!c -> corked)
+		return DHCP_R_INVALIDARG;
+	if (--c -> corked || !c -> out_bytes)
+		return ISC_R_SUCCESS;
+
+	/* Only write on a real socket; otherwise leave it to the socket
+	   code as usual. */
+	if (c -> state != omapi_connection_connected ||
+	    !c -> outer || c -> outer -> type != omapi_type_io_object) {
+		connection_poke (c);
+		return ISC_R_SUCCESS;
+	}
+
+	status = omapi_connection_writer (h);
+	if (status == ISC_R_INPROGRESS) {
+		connection_poke (c);
+		status = ISC_R_SUCCESS;
+	}
+	return status;
+}
+
+/* Read and write a connection that's expected to carry a lot of data,
+   such as a failover link, through bigger buffers, so that it takes
+   fewer system calls to move it.   Buffers already in use keep their
+   size. */
+
+isc_result_t omapi_connection_set_bulk (omapi_object_t *h)
+{
+	omapi_connection_object_t *c;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+
+	c -> buf_size = OMAPI_BULK_BUF_SIZE;
+	return ISC_R_SUCCESS;
+}
+
 isc_result_t omapi_connection_copyout (unsigned char *buf,
 				       omapi_object_t *h,
 				       unsigned size)
@@ -383,13 +570,13 @@ isc_result_t omapi_connection_copyout (unsigned char *buf,
 		if (!buffer)
 			return ISC_R_UNEXPECTED;
 		if (BYTES_IN_BUFFER (buffer)) {
-			if (buffer -> head == (sizeof buffer -> buf) - 1)
+			if (buffer -> head == buffer -> size - 1)
 				first_byte = 0;
 			else
 				first_byte = buffer -> head + 1;
 
 			if (first_byte > buffer -> tail) {
-				bytes_this_copy = (sizeof buffer -> buf -
+				bytes_this_copy = (buffer -> size -
 						   first_byte);
 			} else {
 				bytes_this_copy =
@@ -445,11 +632,16 @@ isc_result_t omapi_connection_copyout (unsigned char *buf,
 	return ISC_R_SUCCESS;
 }
 
+/* The most pieces of output handed to writev() at once. */
+#define OMAPI_WRITEV_MAX 16
+
 isc_result_t omapi_connection_writer (omapi_object_t *h)
 {
-	unsigned bytes_this_write;
+	struct iovec iov [OMAPI_WRITEV_MAX];
+	unsigned bytes_this_write, len, left;
 	int bytes_written;
 	unsigned first_byte;
+	int count;
 	omapi_buffer_t *buffer;
 	omapi_connection_object_t *c;
 
@@ -461,109 +653,135 @@ isc_result_t omapi_connection_writer (omapi_object_t *h)
 	if (!c -> out_bytes)
 		return ISC_R_SUCCESS;
 
-	buffer = c -> outbufs;
-
 	while (c -> out_bytes) {
-		if (!buffer)
-			return ISC_R_UNEXPECTED;
-		if (BYTES_IN_BUFFER (buffer)) {
-			if (buffer -> head == (sizeof buffer -> buf) - 1)
+		/* Gather what's in the buffers, each buffer's contents in
+		   one piece or, if they wrap around, two. */
+		count = 0;
+		bytes_this_write = 0;
+		for (buffer = c -> outbufs;
+		     buffer && count < OMAPI_WRITEV_MAX;
+		     buffer = buffer -> next) {
+			if (!BYTES_IN_BUFFER (buffer))
+				continue;
+			if (buffer -> head == buffer -> size - 1)
 				first_byte = 0;
 			else
 				first_byte = buffer -> head + 1;
 
 			if (first_byte > buffer -> tail) {
-				bytes_this_write = (sizeof buffer -> buf -
-						   first_byte);
+				len = buffer -> size - first_byte;
+				iov [count].iov_base =
+					&buffer -> buf [first_byte];
+				iov [count++].iov_len = len;
+				bytes_this_write += len;
+				if (buffer -> tail && count < OMAPI_WRITEV_MAX) {
+					iov [count].iov_base = buffer -> buf;
+					iov [count++].iov_len = buffer -> tail;
+					bytes_this_write += buffer -> tail;
+				}
 			} else {
-				bytes_this_write =
-					buffer -> tail - first_byte;
+				len = buffer -> tail - first_byte;
+				iov [count].iov_base =
+					&buffer -> buf [first_byte];
+				iov [count++].iov_len = len;
+				bytes_this_write += len;
 			}
-			bytes_written = write (c -> socket,
-					       &buffer -> buf [first_byte],
-					       bytes_this_write);
-			/* If the write failed with EWOULDBLOCK or we wrote
-			   zero bytes, a further write would block, so we have
-			   flushed as much as we can for now.   Other errors
-			   are really errors. */
-			if (bytes_written < 0) {
-				if (errno == EWOULDBLOCK || errno == EAGAIN)
-					return ISC_R_INPROGRESS;
-				else if (errno == EPIPE)
-					return ISC_R_NOCONN;
+		}
+		if (!count)
+			return ISC_R_UNEXPECTED;
+
+		bytes_written = writev (c -> socket, iov, count);
+		/* If the write failed with EWOULDBLOCK or we wrote
+		   zero bytes, a further write would block, so we have
+		   flushed as much as we can for now.   Other errors
+		   are really errors. */
+		if (bytes_written < 0) {
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				return ISC_R_INPROGRESS;
+			else if (errno == EPIPE)
+				return ISC_R_NOCONN;
 #ifdef EDQUOT
-				else if (errno == EFBIG || errno == EDQUOT)
+			else if (errno == EFBIG || errno == EDQUOT)
 #else
-				else if (errno == EFBIG)
+			else if (errno == EFBIG)
 #endif
-					return ISC_R_NORESOURCES;
-				else if (errno == ENOSPC)
-					return ISC_R_NOSPACE;
-				else if (errno == EIO)
-					return ISC_R_IOERROR;
-				else if (errno == EINVAL)
-					return DHCP_R_INVALIDARG;
-				else if (errno == ECONNRESET)
-					return ISC_R_SHUTTINGDOWN;
-				else
-					return ISC_R_UNEXPECTED;
-			}
-			if (bytes_written == 0)
-				return ISC_R_INPROGRESS;
+				return ISC_R_NORESOURCES;
+			else if (errno == ENOSPC)
+				return ISC_R_NOSPACE;
+			else if (errno == EIO)
+				return ISC_R_IOERROR;
+			else if (errno == EINVAL)
+				return DHCP_R_INVALIDARG;
+			else if (errno == ECONNRESET)
+				return ISC_R_SHUTTINGDOWN;
+			else
+				return ISC_R_UNEXPECTED;
+		}
+		if (bytes_written == 0)
+			return ISC_R_INPROGRESS;
 
 #if defined (TRACING)
-			if (trace_record ()) {
-				isc_result_t status;
-				trace_iov_t iov [2];
-				int32_t connect_index;
+		if (trace_record ()) {
+			isc_result_t status;
+			trace_iov_t tiov [2];
+			int32_t connect_index;
+			int i;
 
-				connect_index = htonl (c -> index);
+			connect_index = htonl (c -> index);
 
-				iov [0].buf = (char *)&connect_index;
-				iov [0].len = sizeof connect_index;
-				iov [1].buf = &buffer -> buf [buffer -> tail];
-				iov [1].len = bytes_written;
+			tiov [0].buf = (char *)&connect_index;
+			tiov [0].len = sizeof connect_index;
+			left = bytes_written;
+			for (i = 0; i < count && left; i++) {
+				tiov [1].buf = iov [i].iov_base;
+				tiov [1].len = (left < iov [i].iov_len
+						? left : iov [i].iov_len);
+				left -= tiov [1].len;
 
 				status = (trace_write_packet_iov
-					  (trace_connection_input, 2, iov,
+					  (trace_connection_input, 2, tiov,
 					   MDL));
 				if (status != ISC_R_SUCCESS) {
 					trace_stop ();
 					log_error ("trace %s output: %s",
 						   "connection",
 						   isc_result_totext (status));
+					break;
 				}
 			}
+		}
 #endif
 
-			buffer -> head = first_byte + bytes_written - 1;
-			c -> out_bytes -= bytes_written;
-
-			/* If we didn't finish out the write, we filled the
-			   O.S. output buffer and a further write would block,
-			   so stop trying to flush now. */
-			if (bytes_written != bytes_this_write)
-				return ISC_R_INPROGRESS;
+		/* Take what was written out of the buffers. */
+		c -> out_bytes -= bytes_written;
+		left = bytes_written;
+		for (buffer = c -> outbufs;
+		     buffer && left; buffer = buffer -> next) {
+			while (left && BYTES_IN_BUFFER (buffer)) {
+				if (buffer -> head == buffer -> size - 1)
+					first_byte = 0;
+				else
+					first_byte = buffer -> head + 1;
+				if (first_byte > buffer -> tail)
+					len = buffer -> size - first_byte;
+				else
+					len = buffer -> tail - first_byte;
+				if (len > left)
+					len = left;
+				buffer -> head = first_byte + len - 1;
+				left -= len;
+			}
 		}
 
-		if (!BYTES_IN_BUFFER (buffer))
-			buffer = buffer -> next;
-	}
+		/* Get rid of any output buffers we emptied, so that they
+		   can be used again while the rest waits to go. */
+		connection_outbufs_trim (c);
 
-	/* Get rid of any output buffers we emptied. */
-	buffer = (omapi_buffer_t *)0;
-	while (c -> outbufs &&
-	       !BYTES_IN_BUFFER (c -> outbufs)) {
-		if (c -> outbufs -> next) {
-			omapi_buffer_reference (&buffer,
-						c -> outbufs -> next, MDL);
-			omapi_buffer_dereference (&c -> outbufs -> next, MDL);
-		}
-		omapi_buffer_dereference (&c -> outbufs, MDL);
-		if (buffer) {
-			omapi_buffer_reference (&c -> outbufs, buffer, MDL);
-			omapi_buffer_dereference (&buffer, MDL);
-		}
+		/* If we didn't finish out the write, we filled the
+		   O.S. output buffer and a further write would block,
+		   so stop trying to flush now. */
+		if (bytes_written != bytes_this_write)
+			return ISC_R_INPROGRESS;
 	}
 
 	/* If we had data left to write when we're told to disconnect,
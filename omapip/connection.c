@@ -555,6 +555,7 @@ isc_result_t omapi_disconnect (omapi_object_t *h,
 	if (c->outbufs != NULL) {
 		omapi_buffer_dereference(&c->outbufs, MDL);
 	}
+	c->outbufs_tail = NULL;
 	c->out_bytes = 0;
 
 	return ISC_R_SUCCESS;
@@ -104,6 +104,34 @@ struct server_list {
 	struct sockaddr_in to;
 } *servers;
 
+#ifndef UNIT_TEST
+/* The same list as an array, so a request can be handed to all of the
+   servers with one call. */
+static struct sockaddr_in *server_addrs;
+static int server_count;
+#endif /* UNIT_TEST */
+
+/* Replies are mapped back to the interface they belong to by giaddr
+   or by the circuit ID we added to the request.   These index the
+   discovered interfaces by both so that doesn't mean a walk of the
+   interface list for every packet. */
+typedef struct hash_table interface_hash_t;
+
+HASH_FUNCTIONS_DECL(relay_giaddr, const unsigned char *,
+		    struct interface_info, interface_hash_t)
+HASH_FUNCTIONS_DECL(relay_circuit_id, const unsigned char *,
+		    struct interface_info, interface_hash_t)
+
+HASH_FUNCTIONS(relay_giaddr, const unsigned char *, struct interface_info,
+	       interface_hash_t, interface_reference, interface_dereference,
+	       do_ip4_hash)
+HASH_FUNCTIONS(relay_circuit_id, const unsigned char *, struct interface_info,
+	       interface_hash_t, interface_reference, interface_dereference,
+	       do_string_hash)
+
+static interface_hash_t *giaddr_hash;
+static interface_hash_t *circuit_id_hash;
+
 struct interface_info *uplink = NULL;
 isc_boolean_t use_fake_gw = ISC_FALSE;
 struct in_addr gw = {0};
@@ -143,6 +171,9 @@ extern int add_relay_agent_options(struct interface_info *,
 extern int find_interface_by_agent_option(struct dhcp_packet *,
 			                       struct interface_info **, u_int8_t *, int);
 
+extern void index_relay_interfaces(void);
+extern struct interface_info *find_interface_by_giaddr(struct in_addr);
+
 extern int strip_relay_agent_options(struct interface_info *,
 				              struct interface_info **,
 				              struct dhcp_packet *, unsigned);
@@ -738,7 +769,15 @@ main(int argc, char **argv) {
 #ifdef HAVE_SA_LEN
 			sp->to.sin_len = sizeof sp->to;
 #endif
+			server_count++;
 		}
+
+		server_addrs = dmalloc(server_count * sizeof *server_addrs,
+				       MDL);
+		if (server_addrs == NULL)
+			log_fatal("No memory for server addresses.");
+		for (sp = servers, i = 0; sp; sp = sp->next, i++)
+			server_addrs[i] = sp->to;
 	}
 #ifdef DHCPv6
 	else {
@@ -776,6 +815,9 @@ main(int argc, char **argv) {
 	/* Discover all the network interfaces. */
 	discover_interfaces(DISCOVER_RELAY);
 
+	if (local_family == AF_INET)
+		index_relay_interfaces();
+
 #ifdef DHCPv6
 	if (local_family == AF_INET6)
 		setup_streams();
@@ -855,6 +897,7 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 	struct sockaddr_in to;
 	struct interface_info *out;
 	struct hardware hto, *htop;
+	int sent;
 
 	if (packet->hlen > sizeof packet->chaddr) {
 		log_info("Discarding packet with invalid hlen, received on "
@@ -870,20 +913,7 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 	/* Find the interface that corresponds to the giaddr
 	   in the packet. */
 	if (packet->giaddr.s_addr) {
-		for (out = interfaces; out; out = out->next) {
-			int i;
-
-			for (i = 0 ; i < out->address_count ; i++ ) {
-				if (out->addresses[i].s_addr ==
-				    packet->giaddr.s_addr) {
-					i = -1;
-					break;
-				}
-			}
-
-			if (i == -1)
-				break;
-		}
+		out = find_interface_by_giaddr(packet->giaddr);
 	} else {
 		out = NULL;
 	}
@@ -982,7 +1012,20 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 		return;
 
 	/* Otherwise, it's a BOOTREQUEST, so forward it to all the
-	   servers. */
+	   servers.   They are all reached through the fallback socket
+	   when there is one, so hand it the whole list at once. */
+	if (fallback_interface) {
+		sent = send_packet_multi(fallback_interface, packet, length,
+					 server_addrs, server_count);
+		client_packets_relayed += sent;
+		client_packet_errors += server_count - sent;
+		log_debug("Forwarded BOOTREQUEST for %s to %d of %d servers",
+			  print_hw_addr(packet->htype, packet->hlen,
+					packet->chaddr),
+			  sent, server_count);
+		return;
+	}
+
 	for (sp = servers; sp; sp = sp->next) {
 		if (send_packet((fallback_interface
 				 ? fallback_interface : interfaces),
@@ -1002,6 +1045,85 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 
 #endif /* UNIT_TEST */
 
+/* Build the giaddr and circuit ID indexes over the interface list.
+   Where two interfaces share an address or circuit ID the first one
+   on the list wins, as it would have when the list was searched. */
+
+void
+index_relay_interfaces(void) {
+	struct interface_info *ip, *dup;
+	unsigned count = 0;
+	int i;
+
+	if (giaddr_hash != NULL)
+		relay_giaddr_free_hash_table(&giaddr_hash, MDL);
+	if (circuit_id_hash != NULL)
+		relay_circuit_id_free_hash_table(&circuit_id_hash, MDL);
+
+	for (ip = interfaces; ip; ip = ip->next)
+		count += ip->address_count + 1;
+
+	if (!relay_giaddr_new_hash(&giaddr_hash, count, MDL) ||
+	    !relay_circuit_id_new_hash(&circuit_id_hash, count, MDL))
+		log_fatal("Can't allocate interface lookup tables.");
+
+	for (ip = interfaces; ip; ip = ip->next) {
+		for (i = 0; i < ip->address_count; i++) {
+			dup = NULL;
+			if (relay_giaddr_hash_lookup(&dup, giaddr_hash,
+				     (unsigned char *)&ip->addresses[i],
+				     sizeof ip->addresses[i], MDL)) {
+				interface_dereference(&dup, MDL);
+				continue;
+			}
+			relay_giaddr_hash_add(giaddr_hash,
+					 (unsigned char *)&ip->addresses[i],
+					 sizeof ip->addresses[i], ip, MDL);
+		}
+
+		if (!ip->circuit_id || !ip->circuit_id_len)
+			continue;
+		dup = NULL;
+		if (relay_circuit_id_hash_lookup(&dup, circuit_id_hash,
+						 ip->circuit_id,
+						 ip->circuit_id_len, MDL)) {
+			interface_dereference(&dup, MDL);
+			continue;
+		}
+		relay_circuit_id_hash_add(circuit_id_hash, ip->circuit_id,
+					  ip->circuit_id_len, ip, MDL);
+	}
+}
+
+/* Find the interface that owns the given giaddr, if any. */
+
+struct interface_info *
+find_interface_by_giaddr(struct in_addr giaddr) {
+	struct interface_info *ip = NULL, *out;
+	int i;
+
+	if (giaddr_hash != NULL) {
+		if (!relay_giaddr_hash_lookup(&ip, giaddr_hash,
+					      (unsigned char *)&giaddr,
+					      sizeof giaddr, MDL))
+			return (NULL);
+
+		/* The interface list holds a reference for us. */
+		out = ip;
+		interface_dereference(&ip, MDL);
+		return (out);
+	}
+
+	/* No index yet; search the list. */
+	for (out = interfaces; out; out = out->next) {
+		for (i = 0 ; i < out->address_count ; i++ ) {
+			if (out->addresses[i].s_addr == giaddr.s_addr)
+				return (out);
+		}
+	}
+	return (NULL);
+}
+
 /* Strip any Relay Agent Information options from the DHCP packet
    option buffer.   If there is a circuit ID suboption, look up the
    outgoing interface based upon it. */
@@ -1181,20 +1303,34 @@ find_interface_by_agent_option(struct dhcp_packet *packet,
 		return (-1);
 	}
 
-	/* Scan the interface list looking for an interface whose
-	   name matches the one specified in circuit_id. */
-
-	for (ip = interfaces; ip; ip = ip->next) {
-		if (ip->circuit_id &&
-		    ip->circuit_id_len == circuit_id_len &&
-		    !memcmp(ip->circuit_id, circuit_id, circuit_id_len))
-			break;
-	}
+	/* Look for an interface whose name matches the one specified
+	   in circuit_id, using the index if it has been built. */
+
+	if (circuit_id_hash != NULL) {
+		ip = NULL;
+		if (circuit_id_len &&
+		    relay_circuit_id_hash_lookup(&ip, circuit_id_hash,
+						 circuit_id, circuit_id_len,
+						 MDL)) {
+			/* The interface list holds a reference for us. */
+			*out = ip;
+			interface_dereference(&ip, MDL);
+			return (1);
+		}
+	} else {
+		for (ip = interfaces; ip; ip = ip->next) {
+			if (ip->circuit_id &&
+			    ip->circuit_id_len == circuit_id_len &&
+			    !memcmp(ip->circuit_id, circuit_id,
+				    circuit_id_len))
+				break;
+		}
 
-	/* If we got a match, use it. */
-	if (ip) {
-		*out = ip;
-		return (1);
+		/* If we got a match, use it. */
+		if (ip) {
+			*out = ip;
+			return (1);
+		}
 	}
 
 	/* If we didn't get a match, the circuit ID was bogus. */
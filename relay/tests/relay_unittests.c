@@ -40,6 +40,9 @@ extern int strip_relay_agent_options(struct interface_info *,
                                      struct interface_info **,
                                      struct dhcp_packet *, unsigned);
 
+extern void index_relay_interfaces(void);
+extern struct interface_info *find_interface_by_giaddr(struct in_addr);
+
 /* @brief Add the given option data to a DHCPv4 packet
 *
 * It first fills the packet.options buffer with the given pad character.
@@ -422,10 +425,119 @@ ATF_TC_BODY(gwaddr_override_test, tc) {
     }
 }
 
+/* @brief Allocates an interface and puts it at the end of the interface list
+*
+* The interface's circuit ID is its name, as discover_interfaces() does.
+*
+* @param name name of the interface
+* @param addrs dotted quad addresses to assign to the interface
+* @param count number of addresses
+*
+* @return pointer to the new interface
+*/
+struct interface_info *add_test_interface(const char *name,
+                                          const char **addrs, int count) {
+    struct interface_info *ip = NULL;
+    struct interface_info **last;
+    int i;
+
+    if (interface_allocate(&ip, MDL) != ISC_R_SUCCESS) {
+        atf_tc_fail("unable to allocate interface %s", name);
+    }
+
+    strncpy(ip->name, name, sizeof(ip->name) - 1);
+    ip->circuit_id = (u_int8_t *)ip->name;
+    ip->circuit_id_len = strlen(ip->name);
+
+    ip->addresses = dmalloc(count * sizeof(struct in_addr), MDL);
+    for (i = 0; i < count; i++) {
+        ip->addresses[i].s_addr = inet_addr(addrs[i]);
+    }
+    ip->address_count = ip->address_max = count;
+
+    for (last = &interfaces; *last != NULL; last = &(*last)->next)
+        ;
+    interface_reference(last, ip, MDL);
+    interface_dereference(&ip, MDL);
+    return (*last);
+}
+
+ATF_TC(interface_index_test);
+
+ATF_TC_HEAD(interface_index_test, tc) {
+    atf_tc_set_md_var(tc, "descr", "tests giaddr and circuit id lookups");
+}
+
+/* This test checks that the giaddr and circuit id indexes find the same
+ * interface that a search of the interface list would. */
+ATF_TC_BODY(interface_index_test, tc) {
+    const char *addrs1[] = { "192.0.2.1", "192.0.3.1" };
+    const char *addrs2[] = { "192.0.2.1", "192.0.4.1" };
+    struct interface_info *ip1, *ip2, *out;
+    struct dhcp_packet packet;
+    struct in_addr giaddr;
+    int ret;
+
+    u_int8_t good_id[] = { RAI_CIRCUIT_ID, 0x07,
+                           'e', 't', 'h', '0', '.', '2', '0' };
+    u_int8_t bad_id[] = { RAI_CIRCUIT_ID, 0x07,
+                          'e', 't', 'h', '0', '.', '9', '9' };
+
+    dhcp_common_objects_setup();
+
+    ip1 = add_test_interface("eth0.10", addrs1, 2);
+    ip2 = add_test_interface("eth0.20", addrs2, 2);
+
+    /* Before the index is built the list is searched. */
+    giaddr.s_addr = inet_addr("192.0.4.1");
+    if (find_interface_by_giaddr(giaddr) != ip2) {
+        atf_tc_fail("unindexed lookup of 192.0.4.1 failed");
+    }
+
+    index_relay_interfaces();
+
+    /* An address shared by two interfaces belongs to the first. */
+    giaddr.s_addr = inet_addr("192.0.2.1");
+    if (find_interface_by_giaddr(giaddr) != ip1) {
+        atf_tc_fail("192.0.2.1 should map to the first interface");
+    }
+
+    giaddr.s_addr = inet_addr("192.0.3.1");
+    if (find_interface_by_giaddr(giaddr) != ip1) {
+        atf_tc_fail("192.0.3.1 should map to the first interface");
+    }
+
+    giaddr.s_addr = inet_addr("192.0.4.1");
+    if (find_interface_by_giaddr(giaddr) != ip2) {
+        atf_tc_fail("192.0.4.1 should map to the second interface");
+    }
+
+    giaddr.s_addr = inet_addr("198.51.100.1");
+    if (find_interface_by_giaddr(giaddr) != NULL) {
+        atf_tc_fail("unknown giaddr matched an interface");
+    }
+
+    memset(&packet, 0x0, sizeof(packet));
+    out = NULL;
+    ret = find_interface_by_agent_option(&packet, &out, good_id,
+                                         sizeof(good_id));
+    if (ret != 1 || out != ip2) {
+        atf_tc_fail("circuit id eth0.20 did not match, ret %d", ret);
+    }
+
+    out = NULL;
+    ret = find_interface_by_agent_option(&packet, &out, bad_id,
+                                         sizeof(bad_id));
+    if (ret != -1 || out != NULL) {
+        atf_tc_fail("unknown circuit id matched, ret %d", ret);
+    }
+}
+
 ATF_TP_ADD_TCS(tp) {
     ATF_TP_ADD_TC(tp, strip_relay_agent_options_test);
     ATF_TP_ADD_TC(tp, add_relay_agent_options_test);
     ATF_TP_ADD_TC(tp, gwaddr_override_test);
+    ATF_TP_ADD_TC(tp, interface_index_test);
 
     return (atf_no_error());
 }
@@ -82,6 +82,8 @@ isc_result_t read_conf_file (const char *filename, struct group *group,
 	int file;
 	struct parse *cfile;
 	isc_result_t status;
+	char *rbuf;
+	unsigned rlen;
 #if defined (TRACING)
 	char *fbuf, *dbuf;
 	off_t flen;
@@ -118,6 +120,23 @@ isc_result_t read_conf_file (const char *filename, struct group *group,
 	}
 #endif
 
+	/* During a reload, parse the copy of the file that the config
+	   check read, not what is on disk now. */
+	if (!leasep) {
+		status = reload_conf_file (filename, &rbuf, &rlen);
+		if (status == ISC_R_SUCCESS) {
+			cfile = (struct parse *)0;
+			status = new_parse (&cfile, -1, rbuf, rlen, filename, 0);
+			if (status != ISC_R_SUCCESS || cfile == NULL)
+				return status;
+			status = conf_file_subparse (cfile, group, group_type);
+			end_parse (&cfile);
+			return status;
+		}
+		if (status != ISC_R_NOTFOUND)
+			return status;
+	}
+
 	if ((file = open (filename, O_RDONLY)) < 0) {
 		if (leasep) {
 			log_error ("Can't open lease database %s: %m --",
@@ -272,6 +291,12 @@ isc_result_t lease_file_subparse (struct parse *cfile)
 	enum dhcp_token token;
 	isc_result_t status;
 
+#if defined (PARALLEL_LEASE_LOAD)
+	/* A big lease file is mostly parsed on several threads. */
+	if (lease_file_parallel_subparse (cfile))
+		goto out;
+#endif
+
 	do {
 		token = next_token (&val, (unsigned *)0, cfile);
 		if (token == END_OF_FILE)
@@ -318,6 +343,9 @@ isc_result_t lease_file_subparse (struct parse *cfile)
 
 	} while (1);
 
+#if defined (PARALLEL_LEASE_LOAD)
+      out:
+#endif
 	status = cfile->warnings_occurred ? DHCP_R_BADPARSE : ISC_R_SUCCESS;
 	return status;
 }
@@ -1733,6 +1761,8 @@ void parse_pool_statement (cfile, group, type)
 	int declaration = 0;
 	isc_result_t status;
 	struct lease *lpchain = NULL, *lp;
+	struct sparse_range *range;
+	int sparse;
 
 	pool = NULL;
 	status = pool_allocate(&pool, MDL);
@@ -1861,6 +1891,7 @@ void parse_pool_statement (cfile, group, type)
 	} while (!done);
 
 	/* See if there's already a pool into which we can merge this one. */
+	sparse = (pool->sparse != NULL);
 	for (pp = pool->shared_network->pools; pp; pp = pp->next) {
 		if (pp->group->statements != pool->group->statements)
 			continue;
@@ -1885,6 +1916,18 @@ void parse_pool_statement (cfile, group, type)
 			pool_reference(&lp->pool, pp, MDL);
 		}
 
+		/* And the sparse ranges, which will make their leases
+		   in the pool they point to. */
+		while ((range = pool->sparse) != NULL) {
+			pool->sparse = range->pool_next;
+			pool_dereference(&range->pool, MDL);
+			pool_reference(&range->pool, pp, MDL);
+			range->pool_next = pp->sparse;
+			pp->sparse = range;
+		}
+		pp->sparse_leases += pool->sparse_leases;
+		pool->sparse_leases = 0;
+
 #if defined (BINARY_LEASES)
 		/* If we are doing binary leases we also need to add the
 		 * addresses in for leasechain allocation.
@@ -1906,7 +1949,7 @@ void parse_pool_statement (cfile, group, type)
 
 	/* Don't allow a pool declaration with no addresses, since it is
 	   probably a configuration error. */
-	if (!lpchain) {
+	if (!lpchain && !sparse) {
 		parse_warn(cfile, "Pool declaration with no address range.");
 		log_error("Pool declarations must always contain at least");
 		log_error("one range statement.");
@@ -3651,6 +3694,18 @@ int parse_lease_declaration (struct lease **lp, struct parse *cfile)
 
 	} while (1);
 
+	lease_declaration_defaults (lease, seenmask);
+
+	lease_reference (lp, lease, MDL);
+	lease_dereference (&lease, MDL);
+	return 1;
+}
+
+/* Fill in what a lease declaration left out.  seenmask has a bit for each
+   statement the declaration had, as in parse_lease_declaration(). */
+
+void lease_declaration_defaults (struct lease *lease, int seenmask)
+{
 	/* If no binding state is specified, make one up. */
 	if (!(seenmask & 256)) {
 		if (lease->ends > cur_time ||
@@ -3678,10 +3733,6 @@ int parse_lease_declaration (struct lease **lp, struct parse *cfile)
 
 	if (!(seenmask & 65536))
 		lease->tstp = lease->ends;
-
-	lease_reference (lp, lease, MDL);
-	lease_dereference (&lease, MDL);
-	return 1;
 }
 
 /* Parse the right side of a 'binding value'.
@@ -3774,7 +3825,9 @@ parse_binding_value(struct parse *cfile, struct binding_value *value)
 }
 
 /* address-range-declaration :== ip-address ip-address SEMI
-			       | DYNAMIC_BOOTP ip-address ip-address SEMI */
+			       | DYNAMIC_BOOTP ip-address ip-address SEMI
+			       | [DYNAMIC_BOOTP] SPARSE ip-address ip-address SEMI
+*/
 
 void parse_address_range (cfile, group, type, inpool, lpchain)
 	struct parse *cfile;
@@ -3789,6 +3842,7 @@ void parse_address_range (cfile, group, type, inpool, lpchain)
 	enum dhcp_token token;
 	const char *val;
 	int dynamic = 0;
+	int sparse = 0;
 	struct subnet *subnet;
 	struct shared_network *share;
 	struct pool *pool;
@@ -3800,6 +3854,12 @@ void parse_address_range (cfile, group, type, inpool, lpchain)
 		dynamic = 1;
 	}
 
+	/* Sparse ranges only get a lease for an address when it's used. */
+	if (peek_token(&val, NULL, cfile) == SPARSE) {
+		skip_token(&val, NULL, cfile);
+		sparse = 1;
+	}
+
 	/* Get the bottom address in the range... */
 	if (!parse_numeric_aggregate (cfile, addr, &len, DOT, 10, 8))
 		return;
@@ -3934,7 +3994,7 @@ void parse_address_range (cfile, group, type, inpool, lpchain)
 #endif /* FAILOVER_PROTOCOL */
 
 	/* Create the new address range... */
-	new_address_range (cfile, low, high, subnet, pool, lpchain);
+	new_address_range (cfile, low, high, subnet, pool, sparse, lpchain);
 	pool_dereference (&pool, MDL);
 }
 
@@ -5170,9 +5230,7 @@ parse_ia_na_declaration(struct parse *cfile) {
 	if (ia_hash_lookup(&old_ia, ia_na_active,
 			   (unsigned char *)ia->iaid_duid.data,
 			   ia->iaid_duid.len, MDL)) {
-		ia_hash_delete(ia_na_active,
-			       (unsigned char *)ia->iaid_duid.data,
-			       ia->iaid_duid.len, MDL);
+		ia_hash_remove(ia_na_active, old_ia, MDL);
 		ia_dereference(&old_ia, MDL);
 	}
 
@@ -5180,9 +5238,7 @@ parse_ia_na_declaration(struct parse *cfile) {
 	 * If we have addresses, add this, otherwise don't bother.
 	 */
 	if (ia->num_iasubopt > 0) {
-		ia_hash_add(ia_na_active,
-			    (unsigned char *)ia->iaid_duid.data,
-			    ia->iaid_duid.len, ia, MDL);
+		ia_hash_add(ia_na_active, ia, MDL);
 	}
 	ia_dereference(&ia, MDL);
 #endif /* defined(DHCPv6) */
@@ -5607,9 +5663,7 @@ parse_ia_ta_declaration(struct parse *cfile) {
 	if (ia_hash_lookup(&old_ia, ia_ta_active,
 			   (unsigned char *)ia->iaid_duid.data,
 			   ia->iaid_duid.len, MDL)) {
-		ia_hash_delete(ia_ta_active,
-			       (unsigned char *)ia->iaid_duid.data,
-			       ia->iaid_duid.len, MDL);
+		ia_hash_remove(ia_ta_active, old_ia, MDL);
 		ia_dereference(&old_ia, MDL);
 	}
 
@@ -5617,9 +5671,7 @@ parse_ia_ta_declaration(struct parse *cfile) {
 	 * If we have addresses, add this, otherwise don't bother.
 	 */
 	if (ia->num_iasubopt > 0) {
-		ia_hash_add(ia_ta_active,
-			    (unsigned char *)ia->iaid_duid.data,
-			    ia->iaid_duid.len, ia, MDL);
+		ia_hash_add(ia_ta_active, ia, MDL);
 	}
 	ia_dereference(&ia, MDL);
 #endif /* defined(DHCPv6) */
@@ -6047,9 +6099,7 @@ parse_ia_pd_declaration(struct parse *cfile) {
 	if (ia_hash_lookup(&old_ia, ia_pd_active,
 			   (unsigned char *)ia->iaid_duid.data,
 			   ia->iaid_duid.len, MDL)) {
-		ia_hash_delete(ia_pd_active,
-			       (unsigned char *)ia->iaid_duid.data,
-			       ia->iaid_duid.len, MDL);
+		ia_hash_remove(ia_pd_active, old_ia, MDL);
 		ia_dereference(&old_ia, MDL);
 	}
 
@@ -6057,9 +6107,7 @@ parse_ia_pd_declaration(struct parse *cfile) {
 	 * If we have prefixes, add this, otherwise don't bother.
 	 */
 	if (ia->num_iasubopt > 0) {
-		ia_hash_add(ia_pd_active,
-			    (unsigned char *)ia->iaid_duid.data,
-			    ia->iaid_duid.len, ia, MDL);
+		ia_hash_add(ia_pd_active, ia, MDL);
 	}
 	ia_dereference(&ia, MDL);
 #endif /* defined(DHCPv6) */
@@ -234,7 +234,7 @@ int write_lease (lease)
 	    pair p;
 
 	    memset (&ds, 0, sizeof ds);
-	    for (p = lease -> agent_options -> first; p; p = p -> cdr) {
+	    for (p = lease -> agent_options -> first; p; p = p->cdr) {
 	        oc = (struct option_cache *)p -> car;
 	        if (oc -> data.len) {
 	    	errno = 0;
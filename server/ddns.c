@@ -130,9 +130,9 @@ ddns_updates(struct packet *packet, struct lease *lease, struct lease *old,
 	 */
 
 	if (lease != NULL) {
-		if ((old != NULL) && (old->ddns_cb != NULL)) {
-			ddns_cancel(old->ddns_cb, MDL);
-			old->ddns_cb = NULL;
+		if ((old != NULL) && (LEASE_COLD(old, ddns_cb) != NULL)) {
+			ddns_cancel(old->cold->ddns_cb, MDL);
+			old->cold->ddns_cb = NULL;
 		}
 	} else if (lease6 != NULL) {
 		if ((old6 != NULL) && (old6->ddns_cb != NULL)) {
@@ -1028,7 +1028,7 @@ safe_lease_update(struct lease *lease,
 			  MDL, file, line);
 	}
 
-	if ( (lease->ddns_cb == NULL) && (newcb == NULL) ) {
+	if ( (LEASE_COLD(lease, ddns_cb) == NULL) && (newcb == NULL) ) {
 		/*
 		 * Trying to clean up pointer that is already null. We
 		 * are most likely trying to update wrong lease here.
@@ -1055,7 +1055,8 @@ safe_lease_update(struct lease *lease,
 		return;
 	}
 
-	if ( (lease->ddns_cb != NULL) && (lease->ddns_cb != oldcb) ) {
+	if ( (LEASE_COLD(lease, ddns_cb) != NULL) &&
+	     (lease->cold->ddns_cb != oldcb) ) {
 		/*
 		 * There is existing cb structure, but it differs from
 		 * what we expected to see there. Most likely we are
@@ -1081,7 +1082,7 @@ safe_lease_update(struct lease *lease,
 	/* additional IPv4 specific checks may be added here */
 
 	/* update the lease */
-	lease->ddns_cb = newcb;
+	lease_cold(lease)->ddns_cb = newcb;
 }
 
 void
@@ -1961,8 +1962,8 @@ ddns_removals(struct lease    *lease,
 	 */
 
 	if (add_ddns_cb == NULL) {
-		if ((lease != NULL) && (lease->ddns_cb != NULL)) {
-			ddns_cb = lease->ddns_cb;
+		if ((lease != NULL) && (LEASE_COLD(lease, ddns_cb) != NULL)) {
+			ddns_cb = lease->cold->ddns_cb;
 
 			/*
 			 * Is the old request an update or did the
@@ -1974,8 +1975,8 @@ ddns_removals(struct lease    *lease,
 			    ((active == ISC_FALSE) &&
 			     ((ddns_cb->flags & DDNS_ACTIVE_LEASE) != 0))) {
 				/* Cancel the current request */
-				ddns_cancel(lease->ddns_cb, MDL);
-				lease->ddns_cb = NULL;
+				ddns_cancel(lease->cold->ddns_cb, MDL);
+				lease->cold->ddns_cb = NULL;
 			} else {
 				/* Remvoval, check and remove updates */
 				if (ddns_cb->next_op != NULL) {
@@ -38,10 +38,6 @@ static int reuse_lease (struct packet* packet, struct lease* new_lease,
 			struct lease* lease, struct lease_state *state,
 			int offer, int* same_client);
 
-static int do_ping_check(struct packet* packet, struct lease_state* state,
-                         struct lease* lease, TIME original_cltt,
-			 int same_client);
-
 #if defined(DHCPv6) && defined(DHCP4o6)
 static int locate_network6(struct packet *packet);
 #endif
@@ -3599,6 +3595,8 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
  *    owner
  *    d. The lease is being offered to its previous owner and more than
  *    cltt-secs have elapsed since CLTT of the original lease.
+ * 4. The address hasn't been pinged without an answer in the last
+ *    ping-cache-secs seconds.
  *
  * \param packet inbound packet received from the client
  * \param state lease options state
@@ -3613,6 +3611,7 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 		  int same_client) {
 	TIME ping_timeout = DEFAULT_PING_TIMEOUT;
 	TIME ping_timeout_ms = DEFAULT_PING_TIMEOUT_MS;
+	TIME cache_secs = DEFAULT_PING_CACHE_SECS;
 	struct option_cache *oc = NULL;
 	struct data_string ds;
 	struct timeval tv;
@@ -3659,8 +3658,25 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 		}
 	}
 
-	// Send the ping.
-	icmp_echorequest (&lease->ip_addr);
+	// If we pinged this address recently and heard nothing, we
+	// don't need to wait for another ping.
+	memset(&ds, 0, sizeof(ds));
+	oc = lookup_option (&server_universe, state->options,
+			    SV_PING_CACHE_SECS);
+	if (oc &&
+	    (evaluate_option_cache (&ds, packet, lease, 0,
+				    packet->options, state->options,
+				    &lease->scope, oc, MDL))) {
+		if (ds.len == sizeof (u_int32_t)) {
+			cache_secs = getULong (ds.data);
+		}
+
+		data_string_forget (&ds, MDL);
+	}
+
+	if (cache_secs > 0 && ping_recently_silent(&lease->ip_addr)) {
+		return (0);
+	}
 
 	/* Determine whether to use configured or default ping timeout. */
 	memset(&ds, 0, sizeof(ds));
@@ -3706,6 +3722,10 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 
 	tv.tv_sec = cur_tv.tv_sec + timeout_secs;
 	tv.tv_usec = cur_tv.tv_usec + (timeout_ms * 1000);
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
 
 #ifdef DEBUG
 	log_debug ("Pinging:%s, state: %d, same client? %s, "
@@ -3719,10 +3739,8 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 
 #endif
 
-	add_timeout (&tv, lease_ping_timeout, lease, (tvref_t)lease_reference,
-		     (tvunref_t)lease_dereference);
-
-	return (1);
+	// Send the ping.
+	return (ping_start(lease, &tv, cache_secs));
 }
 
 
@@ -3828,9 +3846,11 @@ delayed_acks_timer(void *foo)
 	 - update failover peer
 	 - send out the ACK packets
 	 - move the queue slots to the free list
+	 The replies are sent as one batch once they have all been built.
 	*/
 
 	/*  process from bottom to retain packet order */
+	send_batch_begin();
 	for (ack = ackqueue_tail ; ack ; ack = p) {
 		p = ack->prev;
 
@@ -3859,6 +3879,7 @@ delayed_acks_timer(void *foo)
 		ack->next = free_ackqueue;
 		free_ackqueue = ack;
 	}
+	send_batch_end();
 
 	ackqueue_head = NULL;
 	ackqueue_tail = NULL;
@@ -4504,7 +4525,7 @@ int find_lease (struct lease **lp,
 	if (ip_lease_in)
 		lease_reference (&ip_lease, ip_lease_in, MDL);
 	else if (cip.len)
-		find_lease_by_ip_addr (&ip_lease, cip, MDL);
+		find_or_make_lease_by_ip_addr (&ip_lease, cip, MDL);
 
 #if defined (DEBUG_FIND_LEASE)
 	if (ip_lease)
@@ -5012,7 +5033,7 @@ int allocate_lease (struct lease **lp, struct packet *packet,
 		if (pool->failover_peer != NULL) {
 			struct lease *peerl = NULL;
 			if (pool->failover_peer->i_am == primary) {
-				candl = LEASE_GET_FIRST(pool->free);
+				candl = first_free_lease(pool);
 
 				/*
 				 * In normal operation, we never want to touch
@@ -5033,7 +5054,7 @@ int allocate_lease (struct lease **lp, struct packet *packet,
 			} else {
 				candl = LEASE_GET_FIRST(pool->backup);
 
-				peerl = LEASE_GET_FIRST(pool->free);
+				peerl = first_free_lease(pool);
 				if (peerl != NULL) {
 					if (((candl == NULL) ||
 					     (candl->ends > peerl->ends)) &&
@@ -5053,9 +5074,8 @@ int allocate_lease (struct lease **lp, struct packet *packet,
 		} else
 #endif
 		{
-			if (LEASE_NOT_EMPTY(pool->free))
-				candl = LEASE_GET_FIRST(pool->free);
-			else
+			candl = first_free_lease(pool);
+			if (candl == NULL)
 				candl = LEASE_GET_FIRST(pool->abandoned);
 		}
 
@@ -5771,7 +5791,7 @@ reuse_lease (struct packet* packet,
 
 	if ((lease->cannot_reuse == 0) &&
 	    (lease->binding_state == FTS_ACTIVE) &&
-	    (new_lease->ddns_cb == NULL) && *same_client) {
+	    (LEASE_COLD(new_lease, ddns_cb) == NULL) && *same_client) {
 		int thresh = DEFAULT_CACHE_THRESHOLD;
 		struct option_cache* oc = NULL;
 		struct data_string d1;
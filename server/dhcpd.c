@@ -181,9 +181,15 @@ static void omapi_listener_start (void *foo)
 #define DHCPD_USAGET ""
 #endif /* TRACING */
 
+#if defined (USE_AF_XDP)
+#define DHCPD_USAGEC \
+"             [-pf pid-file] [--no-pid] [-s server]\n" \
+"             [if0 [...ifN]] [-xdp if0 [...-xdp ifN]]"
+#else
 #define DHCPD_USAGEC \
 "             [-pf pid-file] [--no-pid] [-s server]\n" \
 "             [if0 [...ifN]]"
+#endif /* USE_AF_XDP */
 
 #define DHCPD_USAGEH "{--version|--help|-h}"
 
@@ -232,6 +238,31 @@ usage(const char *sfmt, const char *sarg) {
  * need to be moved to be outside the ifndef UNIT_TEST block.
  */
 
+/* Add an interface named on the command line to the list of those to
+   listen on. */
+static void
+record_interface(const char *name, u_int32_t flags) {
+	struct interface_info *tmp = (struct interface_info *)0;
+	isc_result_t result;
+
+	if (strlen(name) >= sizeof(tmp->name))
+		log_fatal("%s: interface name too long (is %ld)",
+			  name, (long)strlen(name));
+	result = interface_allocate (&tmp, MDL);
+	if (result != ISC_R_SUCCESS)
+		log_fatal ("Insufficient memory to %s %s: %s",
+			   "record interface", name,
+			   isc_result_totext (result));
+	strcpy (tmp -> name, name);
+	if (interfaces) {
+		interface_reference (&tmp -> next, interfaces, MDL);
+		interface_dereference (&interfaces, MDL);
+	}
+	interface_reference (&interfaces, tmp, MDL);
+	tmp -> flags = INTERFACE_REQUESTED | flags;
+	interface_dereference (&tmp, MDL);
+}
+
 #if defined (PARANOIA)
 /* to be used in one of two possible scenarios */
 static void setup_chroot (char *chroot_dir) {
@@ -267,10 +298,6 @@ main(int argc, char **argv) {
 	isc_result_t result;
 	unsigned seed;
 	struct interface_info *ip;
-#if defined (NSUPDATE)
-	struct parse *parse;
-	int lose;
-#endif
 	int have_dhcpd_conf = 0;
 	int have_dhcpd_db = 0;
 	int have_dhcpd_pid = 0;
@@ -533,28 +560,16 @@ main(int argc, char **argv) {
 			traceinfile = argv [i];
 			trace_replay_init ();
 #endif /* TRACING */
+#if defined (USE_AF_XDP)
+		} else if (!strcmp (argv [i], "-xdp")) {
+			if (++i == argc)
+				usage(use_noarg, argv[i-1]);
+			record_interface (argv [i], INTERFACE_XDP);
+#endif /* USE_AF_XDP */
 		} else if (argv [i][0] == '-') {
 			usage("Unknown command %s", argv[i]);
 		} else {
-			struct interface_info *tmp =
-				(struct interface_info *)0;
-			if (strlen(argv[i]) >= sizeof(tmp->name))
-				log_fatal("%s: interface name too long "
-					  "(is %ld)",
-					  argv[i], (long)strlen(argv[i]));
-			result = interface_allocate (&tmp, MDL);
-			if (result != ISC_R_SUCCESS)
-				log_fatal ("Insufficient memory to %s %s: %s",
-					   "record interface", argv [i],
-					   isc_result_totext (result));
-			strcpy (tmp -> name, argv [i]);
-			if (interfaces) {
-				interface_reference (&tmp -> next,
-						     interfaces, MDL);
-				interface_dereference (&interfaces, MDL);
-			}
-			interface_reference (&interfaces, tmp, MDL);
-			tmp -> flags = INTERFACE_REQUESTED;
+			record_interface (argv [i], 0);
 		}
 	}
 
@@ -755,9 +770,7 @@ main(int argc, char **argv) {
 #endif
 #endif
 
-	if (!group_allocate (&root_group, MDL))
-		log_fatal ("Can't allocate root group!");
-	root_group -> authoritative = 0;
+	root_group_setup ();
 
 	/* Set up various hooks. */
 	dhcp_interface_setup_hook = dhcpd_interface_setup_hook;
@@ -767,25 +780,6 @@ main(int argc, char **argv) {
 	dhcpv6_packet_handler = do_packet6;
 #endif /* DHCPv6 */
 
-#if defined (NSUPDATE)
-	/* Set up the standard name service updater routine. */
-	parse = NULL;
-	status = new_parse(&parse, -1, std_nsupdate, sizeof(std_nsupdate) - 1,
-			    "standard name service update routine", 0);
-	if (status != ISC_R_SUCCESS)
-		log_fatal ("can't begin parsing name service updater!");
-
-	if (parse != NULL) {
-		lose = 0;
-		if (!(parse_executable_statements(&root_group->statements,
-						  parse, &lose, context_any))) {
-			end_parse(&parse);
-			log_fatal("can't parse standard name service updater!");
-		}
-		end_parse(&parse);
-	}
-#endif
-
 	/* Initialize icmp support... */
 	if (!cftest && !lftest)
 		icmp_startup (1, lease_pinged);
@@ -1068,6 +1062,42 @@ main(int argc, char **argv) {
 }
 #endif /* !UNIT_TEST */
 
+/* Allocate the root group the config file is read into, with the standard
+   name service updater routine in it.  Called at startup, and again for
+   each configuration reload. */
+
+void root_group_setup ()
+{
+#if defined (NSUPDATE)
+	struct parse *parse;
+	isc_result_t status;
+	int lose;
+#endif
+
+	if (!group_allocate (&root_group, MDL))
+		log_fatal ("Can't allocate root group!");
+	root_group -> authoritative = 0;
+
+#if defined (NSUPDATE)
+	/* Set up the standard name service updater routine. */
+	parse = NULL;
+	status = new_parse(&parse, -1, std_nsupdate, sizeof(std_nsupdate) - 1,
+			    "standard name service update routine", 0);
+	if (status != ISC_R_SUCCESS)
+		log_fatal ("can't begin parsing name service updater!");
+
+	if (parse != NULL) {
+		lose = 0;
+		if (!(parse_executable_statements(&root_group->statements,
+						  parse, &lose, context_any))) {
+			end_parse(&parse);
+			log_fatal("can't parse standard name service updater!");
+		}
+		end_parse(&parse);
+	}
+#endif
+}
+
 void postconf_initialization (int quiet)
 {
 	struct option_state *options = NULL;
@@ -1185,6 +1215,18 @@ void postconf_initialization (int quiet)
 		data_string_forget(&db, MDL);
 	}
 
+	omapi_query_port = -1;
+	oc = lookup_option(&server_universe, options, SV_OMAPI_QUERY_PORT);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 2) {
+			omapi_query_port = getUShort(db.data);
+		} else
+			log_fatal("invalid omapi query port data length");
+		data_string_forget(&db, MDL);
+	}
+
 	oc = lookup_option(&server_universe, options, SV_OMAPI_KEY);
 	if (oc &&
 	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
@@ -1392,6 +1434,36 @@ void postconf_initialization (int quiet)
 		log_error("Not using fsync() to flush lease writes");
 	}
 
+	oc = lookup_option(&server_universe, options, SV_EXPIRY_SLICE_LEASES);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len != 4)
+			log_fatal("invalid expiry-slice-leases");
+		expiry_slice_leases = (int)getULong(db.data);
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_EXPIRY_SLICE_USECS);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len != 4)
+			log_fatal("invalid expiry-slice-usecs");
+		expiry_slice_usecs = (int)getULong(db.data);
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_LEASE_LOAD_THREADS);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len != 4)
+			log_fatal("invalid lease-load-threads");
+		lease_load_threads = (int)getULong(db.data);
+		data_string_forget(&db, MDL);
+	}
+
        oc = lookup_option(&server_universe, options, SV_SERVER_ID_CHECK);
        if ((oc != NULL) &&
 	   evaluate_boolean_option_cache(NULL, NULL, NULL, NULL, options, NULL,
@@ -1480,6 +1552,16 @@ void postdb_startup (void)
 		omapi_listener_start (0);
 	}
 
+	/* The query port has no authentication of its own. */
+	if (omapi_query_port != -1) {
+		if (omapi_key)
+			log_error ("omapi-query-port can't be used with "
+				   "omapi-key: not listening on port %d.",
+				   omapi_query_port);
+		else
+			omapi_query_start ();
+	}
+
 #if defined (FAILOVER_PROTOCOL)
 	/* Initialize the failover listener state. */
 	dhcp_failover_startup ();
@@ -1491,78 +1573,6 @@ void postdb_startup (void)
 	schedule_all_ipv6_lease_timeouts();
 }
 
-void lease_pinged (from, packet, length)
-	struct iaddr from;
-	u_int8_t *packet;
-	int length;
-{
-	struct lease *lp;
-
-	/* Don't try to look up a pinged lease if we aren't trying to
-	   ping one - otherwise somebody could easily make us churn by
-	   just forging repeated ICMP EchoReply packets for us to look
-	   up. */
-	if (!outstanding_pings)
-		return;
-
-	lp = (struct lease *)0;
-	if (!find_lease_by_ip_addr (&lp, from, MDL)) {
-		log_debug ("unexpected ICMP Echo Reply from %s",
-			   piaddr (from));
-		return;
-	}
-
-	if (!lp -> state) {
-#if defined (FAILOVER_PROTOCOL)
-		if (!lp -> pool ||
-		    !lp -> pool -> failover_peer)
-#endif
-			log_debug ("ICMP Echo Reply for %s late or spurious.",
-				   piaddr (from));
-		goto out;
-	}
-
-	if (lp -> ends > cur_time) {
-		log_debug ("ICMP Echo reply while lease %s valid.",
-			   piaddr (from));
-	}
-
-	/* At this point it looks like we pinged a lease and got a
-	   response, which shouldn't have happened. */
-	data_string_forget (&lp -> state -> parameter_request_list, MDL);
-	free_lease_state (lp -> state, MDL);
-	lp -> state = (struct lease_state *)0;
-
-	abandon_lease (lp, "pinged before offer");
-	cancel_timeout (lease_ping_timeout, lp);
-	--outstanding_pings;
-      out:
-	lease_dereference (&lp, MDL);
-}
-
-void lease_ping_timeout (vlp)
-	void *vlp;
-{
-	struct lease *lp = vlp;
-
-#if defined (DEBUG_MEMORY_LEAKAGE)
-	unsigned long previous_outstanding = dmalloc_outstanding;
-#endif
-
-	--outstanding_pings;
-	dhcp_reply (lp);
-
-#if defined (DEBUG_MEMORY_LEAKAGE)
-	log_info ("generation %ld: %ld new, %ld outstanding, %ld long-term",
-		  dmalloc_generation,
-		  dmalloc_outstanding - previous_outstanding,
-		  dmalloc_outstanding, dmalloc_longterm);
-#endif
-#if defined (DEBUG_MEMORY_LEAKAGE)
-	dmalloc_dump_outstanding ();
-#endif
-}
-
 int dhcpd_interface_setup_hook (struct interface_info *ip, struct iaddr *ia)
 {
 	struct subnet *subnet;
@@ -1767,6 +1777,10 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 {
 	struct timeval tv;
 
+	if (newstate == server_reload) {
+		reload_config ();
+		return ISC_R_SUCCESS;
+	}
 	if (newstate != server_shutdown)
 		return DHCP_R_INVALIDARG;
 	/* Re-entry. */
@@ -364,7 +364,13 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 	/*
 	 * Figure our our return type.
 	 */
-	if (lease == NULL) {
+	if ((lease == NULL) && !want_associated_ip &&
+	    (sparse_range_pool(cip) != NULL)) {
+		/* A never used address of a sparse range, which has no
+		   lease yet but is ours. */
+		dhcpMsgType = DHCPLEASEUNASSIGNED;
+		dhcp_msg_type_name = "DHCPLEASEUNASSIGNED";
+	} else if (lease == NULL) {
 		dhcpMsgType = DHCPLEASEUNKNOWN;
 		dhcp_msg_type_name = "DHCPLEASEUNKNOWN";
 	} else {
@@ -2301,7 +2301,6 @@ reply_process_ia_na(struct reply_state *reply, struct option_cache *ia) {
 	    (reply->buf.reply.msg_type == DHCPV6_REPLY)) {
 		int must_commit = 0;
 		struct iasubopt *tmp;
-		struct data_string *ia_id;
 		int i;
 
 		for (i = 0 ; i < reply->ia->num_iasubopt ; i++) {
@@ -2358,10 +2357,8 @@ reply_process_ia_na(struct reply_state *reply, struct option_cache *ia) {
 		/* Remove any old ia from the hash. */
 		if (reply->old_ia != NULL) {
 			if (!release_on_roam(reply)) {
-				ia_id = &reply->old_ia->iaid_duid;
-				ia_hash_delete(ia_na_active,
-					       (unsigned char *)ia_id->data,
-					       ia_id->len, MDL);
+				ia_hash_remove(ia_na_active, reply->old_ia,
+					       MDL);
 			}
 
 			ia_dereference(&reply->old_ia, MDL);
@@ -2369,9 +2366,7 @@ reply_process_ia_na(struct reply_state *reply, struct option_cache *ia) {
 
 		/* Put new ia into the hash. */
 		reply->ia->cltt = cur_time;
-		ia_id = &reply->ia->iaid_duid;
-		ia_hash_add(ia_na_active, (unsigned char *)ia_id->data,
-			    ia_id->len, reply->ia, MDL);
+		ia_hash_add(ia_na_active, reply->ia, MDL);
 
 		/* If we couldn't reuse all of the iasubopts, we
 		* must update udpate the lease db */
@@ -3082,7 +3077,6 @@ reply_process_ia_ta(struct reply_state *reply, struct option_cache *ia) {
 	    (reply->buf.reply.msg_type == DHCPV6_REPLY)) {
 		int must_commit = 0;
 		struct iasubopt *tmp;
-		struct data_string *ia_id;
 		int i;
 
 		for (i = 0 ; i < reply->ia->num_iasubopt ; i++) {
@@ -3140,10 +3134,8 @@ reply_process_ia_ta(struct reply_state *reply, struct option_cache *ia) {
 		/* Remove any old ia from the hash. */
 		if (reply->old_ia != NULL) {
 			if (!release_on_roam(reply)) {
-				ia_id = &reply->old_ia->iaid_duid;
-				ia_hash_delete(ia_ta_active,
-					       (unsigned char *)ia_id->data,
-					       ia_id->len, MDL);
+				ia_hash_remove(ia_ta_active, reply->old_ia,
+					       MDL);
 			}
 
 			ia_dereference(&reply->old_ia, MDL);
@@ -3151,9 +3143,7 @@ reply_process_ia_ta(struct reply_state *reply, struct option_cache *ia) {
 
 		/* Put new ia into the hash. */
 		reply->ia->cltt = cur_time;
-		ia_id = &reply->ia->iaid_duid;
-		ia_hash_add(ia_ta_active, (unsigned char *)ia_id->data,
-			    ia_id->len, reply->ia, MDL);
+		ia_hash_add(ia_ta_active, reply->ia, MDL);
 
 		/* If we couldn't reuse all of the iasubopts, we
 		* must update udpate the lease db */
@@ -4326,7 +4316,6 @@ reply_process_ia_pd(struct reply_state *reply, struct option_cache *ia) {
 	    (reply->ia->num_iasubopt != 0)) {
 		int must_commit = 0;
 		struct iasubopt *tmp;
-		struct data_string *ia_id;
 		int i;
 
 		for (i = 0 ; i < reply->ia->num_iasubopt ; i++) {
@@ -4366,10 +4355,8 @@ reply_process_ia_pd(struct reply_state *reply, struct option_cache *ia) {
 		/* Remove any old ia from the hash. */
 		if (reply->old_ia != NULL) {
 			if (!release_on_roam(reply)) {
-				ia_id = &reply->old_ia->iaid_duid;
-				ia_hash_delete(ia_pd_active,
-					       (unsigned char *)ia_id->data,
-					       ia_id->len, MDL);
+				ia_hash_remove(ia_pd_active, reply->old_ia,
+					       MDL);
 			}
 
 			ia_dereference(&reply->old_ia, MDL);
@@ -4377,9 +4364,7 @@ reply_process_ia_pd(struct reply_state *reply, struct option_cache *ia) {
 
 		/* Put new ia into the hash. */
 		reply->ia->cltt = cur_time;
-		ia_id = &reply->ia->iaid_duid;
-		ia_hash_add(ia_pd_active, (unsigned char *)ia_id->data,
-			    ia_id->len, reply->ia, MDL);
+		ia_hash_add(ia_pd_active, reply->ia, MDL);
 
 		/* If we couldn't reuse all of the iasubopts, we
 		* must udpate the lease db */
@@ -5869,7 +5854,7 @@ iterate_over_ia_na(struct data_string *reply_ret,
 	struct iasubopt *lease;
 	struct ia_xx *existing_ia_na;
 	int i;
-	struct data_string key;
+	struct ia_key key;
 	u_int32_t iaid;
 
 	/*
@@ -6026,18 +6011,12 @@ iterate_over_ia_na(struct data_string *reply_ret,
 			/*
 			 * Find existing IA_NA.
 			 */
-			if (ia_make_key(&key, iaid,
-					(char *)client_id->data,
-					client_id->len,
-					MDL) != ISC_R_SUCCESS) {
-				log_fatal("iterate_over_ia_na: no memory for "
-					  "key.");
-			}
+			ia_key_init(&key, iaid, (char *)client_id->data,
+				    client_id->len);
 
 			existing_ia_na = NULL;
-			if (ia_hash_lookup(&existing_ia_na, ia_na_active,
-					   (unsigned char *)key.data,
-					   key.len, MDL)) {
+			if (ia_key_lookup(&existing_ia_na, ia_na_active,
+					  &key, MDL)) {
 				/*
 				 * Make sure this address is in the IA_NA.
 				 */
@@ -6054,9 +6033,8 @@ iterate_over_ia_na(struct data_string *reply_ret,
 						break;
 					}
 				}
+				ia_dereference(&existing_ia_na, MDL);
 			}
-
-			data_string_forget(&key, MDL);
 		}
 
 		if ((host != NULL) || (lease != NULL)) {
@@ -6370,7 +6348,7 @@ iterate_over_ia_pd(struct data_string *reply_ret,
 	struct iasubopt *prefix;
 	struct ia_xx *existing_ia_pd;
 	int i;
-	struct data_string key;
+	struct ia_key key;
 	u_int32_t iaid;
 
 	/*
@@ -6482,18 +6460,12 @@ iterate_over_ia_pd(struct data_string *reply_ret,
 			/*
 			 * Find existing IA_PD.
 			 */
-			if (ia_make_key(&key, iaid,
-					(char *)client_id->data,
-					client_id->len,
-					MDL) != ISC_R_SUCCESS) {
-				log_fatal("iterate_over_ia_pd: no memory for "
-					  "key.");
-			}
+			ia_key_init(&key, iaid, (char *)client_id->data,
+				    client_id->len);
 
 			existing_ia_pd = NULL;
-			if (ia_hash_lookup(&existing_ia_pd, ia_pd_active,
-					   (unsigned char *)key.data,
-					   key.len, MDL)) {
+			if (ia_key_lookup(&existing_ia_pd, ia_pd_active,
+					  &key, MDL)) {
 				/*
 				 * Make sure this prefix is in the IA_PD.
 				 */
@@ -6514,9 +6486,8 @@ iterate_over_ia_pd(struct data_string *reply_ret,
 						break;
 					}
 				}
+				ia_dereference(&existing_ia_pd, MDL);
 			}
-
-			data_string_forget(&key, MDL);
 		}
 
 		if ((host != NULL) || (prefix != NULL)) {
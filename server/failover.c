@@ -29,6 +29,7 @@
 #include "cdefs.h"
 #include "dhcpd.h"
 #include <omapip/omapip_p.h>
+#include <sys/time.h>
 
 #if defined (FAILOVER_PROTOCOL)
 dhcp_failover_state_t *failover_states;
@@ -44,11 +45,12 @@ static isc_result_t failover_message_dereference (failover_message_t **,
 
 static void dhcp_failover_pool_balance(dhcp_failover_state_t *state);
 static void dhcp_failover_pool_reqbalance(dhcp_failover_state_t *state);
-static int dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
-					isc_boolean_t *sendreq);
+static int dhcp_failover_pool_dobalance(dhcp_failover_state_t *state);
 static inline int secondary_not_hoarding(dhcp_failover_state_t *state,
 					 struct pool *p);
 static void scrub_lease(struct lease* lease, const char *file, int line);
+static void failover_cork (dhcp_failover_state_t *, omapi_object_t **);
+static void failover_uncork (omapi_object_t **);
 
 int check_secs_byte_order = 0; /* enables byte order check of secs field if 1 */
 
@@ -323,6 +325,10 @@ isc_result_t dhcp_failover_link_signal (omapi_object_t *h,
 	link = (dhcp_failover_link_t *)h;
 
 	if (!strcmp (name, "connect")) {
+	    /* Whole pools' worth of updates can go over a failover link,
+	       so give it big buffers. */
+	    omapi_connection_set_bulk (h -> outer);
+
 	    if (link -> state_object -> i_am == primary) {
 		status = dhcp_failover_send_connect (h);
 		if (status != ISC_R_SUCCESS) {
@@ -1763,12 +1769,12 @@ void dhcp_failover_rescind_updates (dhcp_failover_state_t *state)
 	    return;
 
     /* Zap the flags. */
-    for (lp = state->ack_queue_head; lp; lp = lp->next_pending)
+    for (lp = state->ack_queue_head; lp; lp = LEASE_COLD(lp, next_pending))
 	    lp->flags = ((lp->flags & ~ON_ACK_QUEUE) | ON_UPDATE_QUEUE);
 
     /* Now hook the ack queue to the beginning of the update queue. */
     if (state->update_queue_head) {
-	    lease_reference(&state->ack_queue_tail->next_pending,
+	    lease_reference(&lease_cold(state->ack_queue_tail)->next_pending,
 			    state->update_queue_head, MDL);
 	    lease_dereference(&state->update_queue_head, MDL);
     }
@@ -1776,7 +1782,7 @@ void dhcp_failover_rescind_updates (dhcp_failover_state_t *state)
 
     if (!state->update_queue_tail) {
 #if defined (POINTER_DEBUG)
-	    if (state->ack_queue_tail->next_pending) {
+	    if (LEASE_COLD(state->ack_queue_tail, next_pending)) {
 		    log_error("next pending on ack queue tail.");
 		    abort();
 	    }
@@ -2440,19 +2446,165 @@ isc_result_t dhcp_failover_peer_state_changed (dhcp_failover_state_t *state,
 	return ISC_R_SUCCESS;
 }
 
+/*
+ * Pool balancing works from a queue of the pools that need it.  The free
+ * and backup lease counts are kept up to date by lease_enqueue() and
+ * supersede_lease(), which call dhcp_failover_pool_track() whenever they
+ * change; that puts the pool on its peer's balance queue if the counts
+ * show it has more than its share of leases, or so few that the peer
+ * should be asked for some.  A balance run, started by the rebalance
+ * timer, a POOLREQ or entering the normal state, works through the queue
+ * in slices (see work_slice_over()), and while the peer has as many
+ * binding updates outstanding as it will take, it waits rather than
+ * piling more leases onto the update queue.  Pools that are in balance
+ * are never looked at.
+ */
+
+/* How long to wait for the peer to ack updates before giving it more. */
+#define BALANCE_WAIT_USECS 100000
+
+static void dhcp_failover_pool_balance_next(void *);
+
+/*
+ * Work out how many leases we should send the peer (lts, negative if
+ * the peer should send us some), how far out that may get before we
+ * bother (thresh), how far we may go past even to keep leases with the
+ * server that would answer their clients (hold), and when to ask the
+ * peer for leases (panic).
+ */
+static void
+dhcp_failover_pool_lts(struct pool *p, int *lts, int *thresh, int *hold,
+		       int *panic)
+{
+	dhcp_failover_state_t *state = p->failover_peer;
+	int total;
+
+	/* Right now we're giving the peer half of the free leases.
+	   If we have more leases than the peer (i.e., more than
+	   half), then the number of leases we have, less the number
+	   of leases the peer has, will be how many more leases we
+	   have than the peer has.   So if we send half that number
+	   to the peer, we should be even. */
+	if (state->i_am == primary)
+		*lts = (p->free_leases - p->backup_leases) / 2;
+	else
+		*lts = (p->backup_leases - p->free_leases) / 2;
+
+	total = p->backup_leases + p->free_leases;
+
+	*thresh = ((total * state->max_lease_misbalance) + 50) / 100;
+	*hold = ((total * state->max_lease_ownership) + 50) / 100;
+
+	/*
+	 * If we need leases (so lts is negative) more than negative
+	 * double the thresh%, panic and send poolreq to hopefully wake
+	 * up the peer (but more likely the db is inconsistent).  But,
+	 * if this comes out zero, switch to -1 so that the POOLREQ is
+	 * sent on lts == -2 rather than right away at -1.
+	 *
+	 * Note that we do not subtract -1 from panic all the time
+	 * because thresh% and hold% may come out to the same number,
+	 * and that is correct operation...where thresh% and hold% are
+	 * both -1, we want to send poolreq when lts reaches -3.  So,
+	 * "-3 < -2", lts < panic.
+	 */
+	*panic = *thresh * -2;
+	if (*panic == 0)
+		*panic = -1;
+}
+
+/*
+ * Called whenever the free or backup lease count of a pool changes: put
+ * the pool on the balance queue if it's out of balance.  A pool is out of
+ * balance if we have more than max-lease-misbalance of the free state
+ * leases to send the peer, and more than a balance run would leave us
+ * with, or if the peer has so many more than us that it should be asked
+ * for some.
+ */
+void
+dhcp_failover_pool_track(struct pool *pool)
+{
+	dhcp_failover_state_t *state = pool->failover_peer;
+	int lts, thresh, hold, panic;
+
+	if (!state || state->me.state != normal || pool->balance_queued)
+		return;
+
+	dhcp_failover_pool_lts(pool, &lts, &thresh, &hold, &panic);
+	if ((lts <= thresh || lts <= hold) && lts >= panic)
+		return;
+
+	pool->balance_queued = 1;
+	if (state->balance_tail)
+		pool_reference(&state->balance_tail->balance_next, pool, MDL);
+	else
+		pool_reference(&state->balance_head, pool, MDL);
+	state->balance_tail = pool;
+	state->balance_pending++;
+}
+
+/* Take the pool at the head off the balance queue. */
+static void
+dhcp_failover_pool_balance_pop(dhcp_failover_state_t *state)
+{
+	struct pool *p = state->balance_head;
+	struct pool *next = NULL;
+
+	if (p->balance_next) {
+		pool_reference(&next, p->balance_next, MDL);
+		pool_dereference(&p->balance_next, MDL);
+	}
+	p->balance_queued = 0;
+	pool_dereference(&state->balance_head, MDL);
+	if (next) {
+		pool_reference(&state->balance_head, next, MDL);
+		pool_dereference(&next, MDL);
+	} else
+		state->balance_tail = NULL;
+	state->balance_pending--;
+
+	if (state->balance_lease)
+		lease_dereference(&state->balance_lease, MDL);
+	state->balance_pass = 0;
+}
+
+/* Forget about balancing, for instance on leaving the normal state. */
+static void
+dhcp_failover_pool_balance_drop(dhcp_failover_state_t *state)
+{
+	cancel_timeout(dhcp_failover_pool_balance_next, state);
+	while (state->balance_head)
+		dhcp_failover_pool_balance_pop(state);
+	state->balance_start.tv_sec = 0;
+	state->balance_start.tv_usec = 0;
+	state->balance_sendreq = 0;
+	state->balance_poolreq = 0;
+}
+
 /*
  * Balance operation manual entry; startup, entrance to normal state.  No
  * sense sending a POOLREQ at this stage; the peer is likely about to schedule
- * their own rebalance event upon entering normal themselves.
+ * their own rebalance event upon entering normal themselves.  Pools aren't
+ * tracked outside the normal state, so look at all of them now.
  */
 static void
 dhcp_failover_pool_balance(dhcp_failover_state_t *state)
 {
+	struct shared_network *s;
+	struct pool *p;
+
 	/* Cancel pending event. */
 	cancel_timeout(dhcp_failover_pool_rebalance, state);
 	state->sched_balance = 0;
 
-	dhcp_failover_pool_dobalance(state, NULL);
+	for (s = shared_networks ; s ; s = s->next) {
+		for (p = s->pools ; p ; p = p->next) {
+			if (p->failover_peer == state)
+				dhcp_failover_pool_track(p);
+		}
+	}
+
+	dhcp_failover_pool_dobalance(state);
 }
 
 /*
@@ -2464,23 +2616,20 @@ void
 dhcp_failover_pool_rebalance(void *failover_state)
 {
 	dhcp_failover_state_t *state;
-	isc_boolean_t sendreq = ISC_FALSE;
 
 	state = (dhcp_failover_state_t *)failover_state;
 
 	/* Clear scheduled event indicator. */
 	state->sched_balance = 0;
 
-	if (dhcp_failover_pool_dobalance(state, &sendreq))
-		dhcp_failover_send_updates(state);
-
-	if (sendreq)
-		dhcp_failover_send_poolreq(state);
+	state->balance_sendreq = 1;
+	dhcp_failover_pool_dobalance(state);
 }
 
 /*
  * Balance operation entry from POOLREQ protocol message.  Do not permit a
- * POOLREQ to send back a POOLREQ.  Ping pong.
+ * POOLREQ to send back a POOLREQ.  Ping pong.  The answer gives the number
+ * of leases sent in the first slice.
  */
 static void
 dhcp_failover_pool_reqbalance(dhcp_failover_state_t *state)
@@ -2491,107 +2640,118 @@ dhcp_failover_pool_reqbalance(dhcp_failover_state_t *state)
 	cancel_timeout(dhcp_failover_pool_rebalance, state);
 	state->sched_balance = 0;
 
-	queued = dhcp_failover_pool_dobalance(state, NULL);
+	queued = dhcp_failover_pool_dobalance(state);
 
 	dhcp_failover_send_poolresp(state, queued);
 
-	if (queued)
-		dhcp_failover_send_updates(state);
-	else
+	if (!queued && !state->balance_head)
 		log_info("peer %s: Got POOLREQ, answering negatively!  "
 			 "Peer may be out of leases or database inconsistent.",
 			 state->name);
 }
 
+/* Timer to carry on with a balance run after a slice. */
+static void
+dhcp_failover_pool_balance_next(void *failover_state)
+{
+	dhcp_failover_pool_dobalance((dhcp_failover_state_t *)failover_state);
+}
+
 /*
- * Do the meat of the work common to all forms of pool rebalance.  If the
- * caller deems it appropriate to transmit POOLREQ messages, it can use the
- * sendreq pointer to pass in the address of a FALSE value which this function
- * will conditionally turn TRUE if a POOLREQ is determined to be necessary.
- * A NULL value may be passed, in which case no action is taken.
+ * Do a slice of the work common to all forms of pool rebalance, and
+ * return the number of leases given to the peer in it.  If there's more
+ * to do, a timer is set to carry on.  When the queue is empty, the run is
+ * over: a POOLREQ is sent if a pool needed one and the caller allowed it,
+ * and the next rebalance is scheduled.
  */
 static int
-dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
-			    isc_boolean_t *sendreq)
+dhcp_failover_pool_dobalance(dhcp_failover_state_t *state)
 {
-	int lts, total, thresh, hold, panic, pass;
+	int lts, thresh, hold, panic, i;
 	int leases_queued = 0;
+	int room;
 	struct lease *lp = NULL;
 	struct lease *next = NULL;
 	struct lease *ltemp = NULL;
-	struct shared_network *s;
 	struct pool *p;
-	binding_state_t peer_lease_state;
-	/* binding_state_t my_lease_state; */
-        /* XXX Why is this my_lease_state never used? */
+	binding_state_t peer_lease_state, my_lease_state;
 	LEASE_STRUCT_PTR lq;
 	int (*log_func)(const char *, ...);
 	const char *result, *reqlog;
+	struct work_slice slice;
+	struct timeval tv;
+
+	cancel_timeout(dhcp_failover_pool_balance_next, state);
 
-	if (state -> me.state != normal)
+	if (state -> me.state != normal) {
+		dhcp_failover_pool_balance_drop(state);
 		return 0;
+	}
 
-	state->last_balance = cur_time;
+	if (!state->balance_start.tv_sec) {
+		gettimeofday(&state->balance_start, NULL);
+		state->last_balance = cur_time;
+		state->balance_pools = 0;
+		state->balance_moved = 0;
+	}
 
-	for (s = shared_networks ; s ; s = s->next) {
-	    for (p = s->pools ; p ; p = p->next) {
-		if (p->failover_peer != state)
-		    continue;
+	/* Only make as many binding updates as the peer will take. */
+	room = -1;
+	if (state->partner.max_flying_updates) {
+		room = state->partner.max_flying_updates -
+		       state->cur_unacked_updates;
+		if (state->balance_head &&
+		    (state->update_queue_head || room <= 0))
+			goto wait;
+	}
 
-		/* Right now we're giving the peer half of the free leases.
-		   If we have more leases than the peer (i.e., more than
-		   half), then the number of leases we have, less the number
-		   of leases the peer has, will be how many more leases we
-		   have than the peer has.   So if we send half that number
-		   to the peer, we should be even. */
-		if (p->failover_peer->i_am == primary) {
-			lts = (p->free_leases - p->backup_leases) / 2;
+	work_slice_begin(&slice);
+	while ((p = state->balance_head) != NULL) {
+		if (state->i_am == primary) {
 			peer_lease_state = FTS_BACKUP;
-			/* my_lease_state = FTS_FREE; */
+			my_lease_state = FTS_FREE;
 			lq = &p->free;
 		} else {
-			lts = (p->backup_leases - p->free_leases) / 2;
 			peer_lease_state = FTS_FREE;
-			/* my_lease_state = FTS_BACKUP; */
+			my_lease_state = FTS_BACKUP;
 			lq = &p->backup;
 		}
-
-		total = p->backup_leases + p->free_leases;
-
-		thresh = ((total * state->max_lease_misbalance) + 50) / 100;
-		hold = ((total * state->max_lease_ownership) + 50) / 100;
-
-		/*
-		 * If we need leases (so lts is negative) more than negative
-		 * double the thresh%, panic and send poolreq to hopefully wake
-		 * up the peer (but more likely the db is inconsistent).  But,
-		 * if this comes out zero, switch to -1 so that the POOLREQ is
-		 * sent on lts == -2 rather than right away at -1.
-		 *
-		 * Note that we do not subtract -1 from panic all the time
-		 * because thresh% and hold% may come out to the same number,
-		 * and that is correct operation...where thresh% and hold% are
-		 * both -1, we want to send poolreq when lts reaches -3.  So,
-		 * "-3 < -2", lts < panic.
-		 */
-		panic = thresh * -2;
-
-		if (panic == 0)
-			panic = -1;
-
-		if ((sendreq != NULL) && (lts < panic)) {
-			reqlog = "  (requesting peer rebalance!)";
-			*sendreq = ISC_TRUE;
-		} else
-			reqlog = "";
-
-		log_info("balancing pool %lx %s  total %d  free %d  "
-			 "backup %d  lts %d  max-own (+/-)%d%s",
-			 (unsigned long)p,
-			 (p->shared_network ?
-			  p->shared_network->name : ""), p->lease_count,
-			 p->free_leases, p->backup_leases, lts, hold,
-			 reqlog);
+		dhcp_failover_pool_lts(p, &lts, &thresh, &hold, &panic);
+
+		if (!state->balance_pass) {
+			if (state->balance_sendreq && (lts < panic)) {
+				reqlog = "  (requesting peer rebalance!)";
+				state->balance_poolreq = 1;
+			} else
+				reqlog = "";
+
+			log_info("balancing pool %lx %s  total %d  free %d  "
+				 "backup %d  lts %d  max-own (+/-)%d%s",
+				 (unsigned long)p,
+				 (p->shared_network ?
+				  p->shared_network->name : ""),
+				 p->lease_count, p->free_leases,
+				 p->backup_leases, lts, hold, reqlog);
+
+			if (lts <= thresh)
+				goto done;
+			state->balance_pass = 1;
+			lease_reference(&lp, LEASE_GET_FIRSTP(lq), MDL);
+		} else if (!state->balance_lease) {
+			lease_reference(&lp, LEASE_GET_FIRSTP(lq), MDL);
+		} else {
+			/* Carry on where the last slice stopped, unless
+			   that lease has left the queue since. */
+			lease_reference(&lp, state->balance_lease, MDL);
+			lease_dereference(&state->balance_lease, MDL);
+			if (lp->pool != p ||
+			    lp->binding_state != my_lease_state ||
+			    (lp->flags & RESERVED_LEASE)) {
+				lease_dereference(&lp, MDL);
+				lease_reference(&lp, LEASE_GET_FIRSTP(lq),
+						MDL);
+			}
+		}
 
 		/* In the first pass, try to allocate leases to the
 		 * peer which it would normally be responsible for (if
@@ -2605,16 +2765,7 @@ dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
 		 * events, but preserving MAC possession should be
 		 * worth it.
 		 */
-		pass = 0;
-		lease_reference(&lp, LEASE_GET_FIRSTP(lq), MDL);
-
 		while (lp) {
-			if (next)
-			    lease_dereference(&next, MDL);
-			ltemp = LEASE_GET_NEXTP(lq, lp);
-			if (ltemp != NULL)
-			    lease_reference(&next, ltemp, MDL);
-
 			/*
 			 * Stop if the pool is 'balanced enough.'
 			 *
@@ -2632,7 +2783,7 @@ dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
 			 *
 			 * Note that this is implemented below in 3,2,1 order.
 			 */
-			if (pass) {
+			if (state->balance_pass == 2) {
 				if (lp->ends) {
 					if (lts <= hold)
 						break;
@@ -2643,7 +2794,11 @@ dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
 			} else if (lts <= -hold)
 				break;
 
-			if (pass || peer_wants_lease(lp)) {
+			ltemp = LEASE_GET_NEXTP(lq, lp);
+			if (ltemp != NULL)
+			    lease_reference(&next, ltemp, MDL);
+
+			if (state->balance_pass == 2 || peer_wants_lease(lp)) {
 			    --lts;
 			    ++leases_queued;
 			    lp->next_binding_state = peer_lease_state;
@@ -2658,19 +2813,39 @@ dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
 			}
 
 			lease_dereference(&lp, MDL);
-			if (next)
+			if (next) {
 				lease_reference(&lp, next, MDL);
-			else if (!pass) {
-				pass = 1;
+				lease_dereference(&next, MDL);
+			} else if (state->balance_pass == 1) {
+				state->balance_pass = 2;
+
+				/* Never used addresses of sparse ranges have
+				 * no lease yet.  Make enough of them to even
+				 * out the pool, they sort first on the free
+				 * queue so the second pass gives them away
+				 * before any lease that has been used.
+				 */
+				if (lq == &p->free) {
+					ltemp = NULL;
+					for (i = lts; (i > 0) &&
+					     sparse_range_allocate(&ltemp, p,
+								   MDL); i--)
+						lease_dereference(&ltemp, MDL);
+				}
 				lease_reference(&lp, LEASE_GET_FIRSTP(lq), MDL);
 			}
-		}
 
-		if (next)
-			lease_dereference(&next, MDL);
+			if (lp && (work_slice_over(&slice) ||
+				   (room >= 0 && leases_queued >= room))) {
+				lease_reference(&state->balance_lease, lp, MDL);
+				lease_dereference(&lp, MDL);
+				goto more;
+			}
+		}
 		if (lp)
 			lease_dereference(&lp, MDL);
 
+	      done:
 		if (lts > thresh) {
 			result = "IMBALANCED";
 			log_func = log_error;
@@ -2685,15 +2860,70 @@ dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
 			  p->shared_network->name : ""), p->lease_count,
 			 p->free_leases, p->backup_leases, lts, thresh);
 
-		/* Recalculate next rebalance event timer. */
-		dhcp_failover_pool_check(p);
-	    }
+		dhcp_failover_pool_balance_pop(state);
+		state->balance_pools++;
+		if (state->balance_head && work_slice_over(&slice))
+			goto more;
 	}
 
-	if (leases_queued)
+	state->balance_moved += leases_queued;
+	if (leases_queued) {
 		commit_leases();
+		dhcp_failover_send_updates(state);
+	}
+
+	gettimeofday(&tv, NULL);
+	state->balance_msecs =
+		(tv.tv_sec - state->balance_start.tv_sec) * 1000 +
+		(tv.tv_usec - state->balance_start.tv_usec) / 1000;
+	state->balance_start.tv_sec = 0;
+	state->balance_start.tv_usec = 0;
+	if (state->balance_pools)
+		log_info("peer %s: balanced %d pool%s, %d leases moved, "
+			 "in %lu ms.", state->name, state->balance_pools,
+			 state->balance_pools == 1 ? "" : "s",
+			 state->balance_moved,
+			 (unsigned long)state->balance_msecs);
+
+	if (state->balance_poolreq)
+		dhcp_failover_send_poolreq(state);
+	state->balance_sendreq = 0;
+	state->balance_poolreq = 0;
+
+	/* Recalculate next rebalance event timer, and queue the pools that
+	   are still out of balance for it. */
+	dhcp_failover_state_pool_check(state);
 
 	return leases_queued;
+
+      more:
+	state->balance_moved += leases_queued;
+	if (leases_queued) {
+		commit_leases();
+		dhcp_failover_send_updates(state);
+	}
+	if (state->partner.max_flying_updates &&
+	    (state->update_queue_head ||
+	     state->cur_unacked_updates >= state->partner.max_flying_updates))
+		goto wait;
+
+	tv = cur_tv;
+	add_timeout(&tv, dhcp_failover_pool_balance_next, state,
+		    (tvref_t)dhcp_failover_state_reference,
+		    (tvunref_t)dhcp_failover_state_dereference);
+	return leases_queued;
+
+      wait:
+	tv.tv_sec = cur_tv.tv_sec;
+	tv.tv_usec = cur_tv.tv_usec + BALANCE_WAIT_USECS;
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
+	add_timeout(&tv, dhcp_failover_pool_balance_next, state,
+		    (tvref_t)dhcp_failover_state_reference,
+		    (tvunref_t)dhcp_failover_state_dereference);
+	return leases_queued;
 }
 
 /* dhcp_failover_pool_check: Called whenever FREE or BACKUP leases change
@@ -2724,7 +2954,9 @@ dhcp_failover_pool_check(struct pool *pool)
 	 * the max_balance bounds check.
 	 */
 	ltemp = LEASE_GET_FIRST(pool->free);
-	if(ltemp && ltemp->ends < cur_time)
+	if (pool->sparse_leases > 0)	/* virgins with no lease yet */
+		est1 = cur_time - MIN_TIME;
+	else if(ltemp && ltemp->ends < cur_time)
 		est1 = cur_time - ltemp->ends;
 	else
 		est1 = 0;
@@ -2804,6 +3036,7 @@ int dhcp_failover_state_pool_check (dhcp_failover_state_t *state)
 			if (p -> failover_peer != state)
 				continue;
 			dhcp_failover_pool_check (p);
+			dhcp_failover_pool_track (p);
 		}
 	}
 	return 0;
@@ -2812,12 +3045,16 @@ int dhcp_failover_state_pool_check (dhcp_failover_state_t *state)
 isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 {
 	struct lease *lp = (struct lease *)0;
+	omapi_object_t *connection = (omapi_object_t *)0;
 	isc_result_t status;
 
 	/* Can't update peer if we're not talking to it! */
 	if (!state -> link_to_peer)
 		return ISC_R_SUCCESS;
 
+	/* Send the acks and updates together. */
+	failover_cork (state, &connection);
+
 	/* If there are acks pending, transmit them prior to potentially
 	 * sending new updates for the same lease.
 	 */
@@ -2833,6 +3070,7 @@ isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 		status = dhcp_failover_send_bind_update (state, lp);
 		if (status != ISC_R_SUCCESS) {
 			lease_dereference (&lp, MDL);
+			failover_uncork (&connection);
 			return status;
 		}
 		lp -> flags &= ~ON_UPDATE_QUEUE;
@@ -2840,24 +3078,24 @@ isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 		/* Take it off the head of the update queue and put the next
 		   item in the update queue at the head. */
 		lease_dereference (&state -> update_queue_head, MDL);
-		if (lp -> next_pending) {
+		if (LEASE_COLD(lp, next_pending)) {
 			lease_reference (&state -> update_queue_head,
-					 lp -> next_pending, MDL);
-			lease_dereference (&lp -> next_pending, MDL);
+					 lp->cold->next_pending, MDL);
+			lease_dereference (&lp->cold->next_pending, MDL);
 		} else {
 			lease_dereference (&state -> update_queue_tail, MDL);
 		}
 
 		if (state -> ack_queue_head) {
 			lease_reference
-				(&state -> ack_queue_tail -> next_pending,
+				(&lease_cold(state->ack_queue_tail)->next_pending,
 				 lp, MDL);
 			lease_dereference (&state -> ack_queue_tail, MDL);
 		} else {
 			lease_reference (&state -> ack_queue_head, lp, MDL);
 		}
 #if defined (POINTER_DEBUG)
-		if (lp -> next_pending) {
+		if (LEASE_COLD(lp, next_pending)) {
 			log_error ("ack_queue_tail: lp -> next_pending");
 			abort ();
 		}
@@ -2869,6 +3107,7 @@ isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 		/* Count the object as an unacked update. */
 		state -> cur_unacked_updates++;
 	}
+	failover_uncork (&connection);
 	return ISC_R_SUCCESS;
 }
 
@@ -2896,14 +3135,15 @@ int dhcp_failover_queue_update (struct lease *lease, int immediate)
 		dhcp_failover_ack_queue_remove (state, lease);
 
 	if (state -> update_queue_head) {
-		lease_reference (&state -> update_queue_tail -> next_pending,
-				 lease, MDL);
+		lease_reference
+			(&lease_cold(state->update_queue_tail)->next_pending,
+			 lease, MDL);
 		lease_dereference (&state -> update_queue_tail, MDL);
 	} else {
 		lease_reference (&state -> update_queue_head, lease, MDL);
 	}
 #if defined (POINTER_DEBUG)
-	if (lease -> next_pending) {
+	if (LEASE_COLD(lease, next_pending)) {
 		log_error ("next pending on update queue lease.");
 #if defined (DEBUG_RC_HISTORY)
 		dump_rc_history (lease);
@@ -2921,11 +3161,13 @@ int dhcp_failover_queue_update (struct lease *lease, int immediate)
 int dhcp_failover_send_acks (dhcp_failover_state_t *state)
 {
 	failover_message_t *msg = (failover_message_t *)0;
+	omapi_object_t *connection = (omapi_object_t *)0;
 
 	/* Must commit all leases prior to acking them. */
 	if (!commit_leases ())
 		return 0;
 
+	failover_cork (state, &connection);
 	while (state -> toack_queue_head) {
 		failover_message_reference
 			(&msg, state -> toack_queue_head, MDL);
@@ -2940,6 +3182,7 @@ int dhcp_failover_send_acks (dhcp_failover_state_t *state)
 
 		failover_message_dereference (&msg, MDL);
 	}
+	failover_uncork (&connection);
 
 	if (state -> toack_queue_tail)
 		failover_message_dereference (&state -> toack_queue_tail, MDL);
@@ -3012,30 +3255,30 @@ void dhcp_failover_ack_queue_remove (dhcp_failover_state_t *state,
 
 	if (state -> ack_queue_head == lease) {
 		lease_dereference (&state -> ack_queue_head, MDL);
-		if (lease -> next_pending) {
+		if (LEASE_COLD(lease, next_pending)) {
 			lease_reference (&state -> ack_queue_head,
-					 lease -> next_pending, MDL);
-			lease_dereference (&lease -> next_pending, MDL);
+					 lease->cold->next_pending, MDL);
+			lease_dereference (&lease->cold->next_pending, MDL);
 		} else {
 			lease_dereference (&state -> ack_queue_tail, MDL);
 		}
 	} else {
 		for (lp = state -> ack_queue_head;
-		     lp && lp -> next_pending != lease;
-		     lp = lp -> next_pending)
+		     lp && LEASE_COLD(lp, next_pending) != lease;
+		     lp = LEASE_COLD(lp, next_pending))
 			;
 
 		if (!lp)
 			return;
 
-		lease_dereference (&lp -> next_pending, MDL);
-		if (lease -> next_pending) {
-			lease_reference (&lp -> next_pending,
-					 lease -> next_pending, MDL);
-			lease_dereference (&lease -> next_pending, MDL);
+		lease_dereference (&lp->cold->next_pending, MDL);
+		if (LEASE_COLD(lease, next_pending)) {
+			lease_reference (&lp->cold->next_pending,
+					 lease->cold->next_pending, MDL);
+			lease_dereference (&lease->cold->next_pending, MDL);
 		} else {
 			lease_dereference (&state -> ack_queue_tail, MDL);
-			if (lp -> next_pending) {
+			if (LEASE_COLD(lp, next_pending)) {
 				log_error ("state -> ack_queue_tail");
 				abort ();
 			}
@@ -3118,6 +3361,14 @@ isc_result_t dhcp_failover_state_set_value (omapi_object_t *h,
 		return ISC_R_SUCCESS;
 	} else if (!omapi_ds_strcmp (name, "cur-unacked-updates")) {
 		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-pools-pending")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-pools-done")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-leases-moved")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "last-balance-msecs")) {
+		return ISC_R_SUCCESS;
 	}
 
 	if (h -> inner && h -> inner -> type -> set_value)
@@ -3316,6 +3567,18 @@ isc_result_t dhcp_failover_state_get_value (omapi_object_t *h,
 	} else if (!omapi_ds_strcmp (name, "cur-unacked-updates")) {
 		return omapi_make_int_value (value, name,
 					     s -> cur_unacked_updates, MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-pools-pending")) {
+		return omapi_make_int_value (value, name,
+					     s -> balance_pending, MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-pools-done")) {
+		return omapi_make_int_value (value, name,
+					     s -> balance_pools, MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-leases-moved")) {
+		return omapi_make_int_value (value, name,
+					     s -> balance_moved, MDL);
+	} else if (!omapi_ds_strcmp (name, "last-balance-msecs")) {
+		return omapi_make_uint_value (value, name,
+					      s -> balance_msecs, MDL);
 	}
 
 	if (h -> inner && h -> inner -> type -> get_value)
@@ -3584,6 +3847,29 @@ isc_result_t dhcp_failover_state_stuff (omapi_object_t *c,
 	if (status != ISC_R_SUCCESS)
 		return status;
 
+	status = omapi_connection_put_named_uint32 (c, "balance-pools-pending",
+						    (u_int32_t)
+						    s -> balance_pending);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	status = omapi_connection_put_named_uint32 (c, "balance-pools-done",
+						    (u_int32_t)
+						    s -> balance_pools);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	status = omapi_connection_put_named_uint32 (c, "balance-leases-moved",
+						    (u_int32_t)
+						    s -> balance_moved);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	status = omapi_connection_put_named_uint32 (c, "last-balance-msecs",
+						    s -> balance_msecs);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
 	if (h -> inner && h -> inner -> type -> stuff_values)
 		return (*(h -> inner -> type -> stuff_values)) (c, id,
 								h -> inner);
@@ -4242,6 +4528,215 @@ failover_option_t *dhcp_failover_make_option (unsigned code,
 	return op;
 }
 
+/* Having sent the peer something, put off sending it a CONTACT. */
+
+static void failover_contact_later (dhcp_failover_link_t *link)
+{
+	struct timeval tv;
+
+	if (link -> state_object &&
+	    link -> state_object -> link_to_peer == link) {
+#if defined (DEBUG_FAILOVER_CONTACT_TIMING)
+		log_info ("add_timeout +%d %s",
+			  (int)(link -> state_object ->
+				partner.max_response_delay) / 3,
+			  "dhcp_failover_send_contact");
+#endif
+		tv . tv_sec = cur_time +
+			(int)(link -> state_object ->
+			      partner.max_response_delay) / 3;
+		tv . tv_usec = 0;
+		add_timeout (&tv,
+			     dhcp_failover_send_contact, link -> state_object,
+			     (tvref_t)dhcp_failover_state_reference,
+			     (tvunref_t)dhcp_failover_state_dereference);
+	}
+}
+
+/* The messages sent for each lease, BNDUPD and BNDACK, are put together
+   in place rather than with dhcp_failover_make_option() and
+   dhcp_failover_put_message(), which allocate each option and then copy
+   them all into a buffer of their own.   The sender adds up the space
+   its options will take, failover_message_begin() reserves that much
+   in the connection's output and writes the header, each option is
+   written straight after the last, and failover_message_end() hands the
+   message to the connection. */
+
+typedef struct {
+	unsigned char *buf;
+	unsigned len, size;
+	int bad;
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	char *obuf;
+	unsigned *obufix;
+	unsigned obufmax;
+#endif
+} failover_encoder_t;
+
+/* The space an option will take: options of a fixed size take the size
+   of their type as many times as they have values. */
+
+static unsigned failover_option_space (unsigned code, unsigned len)
+{
+	struct failover_option_info *info = &ft_options [code];
+
+	if (info -> num_present)
+		len = ft_sizes [info -> type] * info -> num_present;
+	return len + 4;
+}
+
+static isc_result_t failover_message_begin (failover_encoder_t *enc,
+					    omapi_object_t *connection,
+					    int msg_type, u_int32_t xid,
+					    unsigned size,
+					    char *obuf, unsigned *obufix,
+					    unsigned obufmax)
+{
+	isc_result_t status;
+
+	size += 12;
+	status = omapi_connection_reserve (connection, size, &enc -> buf);
+	if (status != ISC_R_SUCCESS) {
+		log_info ("failover_message_begin: something went wrong.");
+		omapi_disconnect (connection, 1);
+		return status;
+	}
+
+	putUShort (enc -> buf, size);		/* Message length. */
+	enc -> buf [2] = msg_type;
+	enc -> buf [3] = 12;			/* Payload offset. */
+	putULong (enc -> buf + 4, (u_int32_t)cur_time);
+	putULong (enc -> buf + 8, xid);
+	enc -> len = 12;
+	enc -> size = size;
+	enc -> bad = 0;
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	enc -> obuf = obuf;
+	enc -> obufix = obufix;
+	enc -> obufmax = obufmax;
+#endif
+	return ISC_R_SUCCESS;
+}
+
+/* Start an option with room for len bytes of data, or return null if
+   the message wasn't given room for it. */
+
+static unsigned char *failover_put_option (failover_encoder_t *enc,
+					   unsigned code, unsigned len)
+{
+	unsigned char *op = enc -> buf + enc -> len;
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	char tbuf [64];
+#endif
+
+	if (enc -> bad || enc -> size - enc -> len < len + 4) {
+		enc -> bad = 1;
+		return (unsigned char *)0;
+	}
+	putUShort (op, code);
+	putUShort (op + 2, len);
+	enc -> len += len + 4;
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	snprintf (tbuf, sizeof tbuf, " (%s<%d>",
+		  ft_options [code].name, len + 4);
+	failover_print (enc -> obuf, enc -> obufix, enc -> obufmax, tbuf);
+#endif
+	return op + 4;
+}
+
+/* Add an option with a single number of whatever size its type is. */
+
+static void failover_put_uint (failover_encoder_t *enc, unsigned code,
+			       u_int32_t val)
+{
+	unsigned size = ft_sizes [ft_options [code].type];
+	unsigned char *op;
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	char tbuf [24];
+#endif
+
+	op = failover_put_option (enc, code, size);
+	if (!op)
+		return;
+	if (size == 1)
+		*op = val;
+	else if (size == 2)
+		putUShort (op, val);
+	else
+		putULong (op, val);
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	snprintf (tbuf, sizeof tbuf, " %u)", val);
+	failover_print (enc -> obuf, enc -> obufix, enc -> obufmax, tbuf);
+#endif
+}
+
+/* Add an option whose data is a string of bytes (or of text, or an
+   address, as long as it's the length the type calls for). */
+
+static void failover_put_bytes (failover_encoder_t *enc, unsigned code,
+				const void *data, unsigned len)
+{
+	unsigned char *op;
+
+	op = failover_put_option (enc, code, len);
+	if (!op)
+		return;
+	memcpy (op, data, len);
+#if defined (DEBUG_FAILOVER_MESSAGES)
+	failover_print (enc -> obuf, enc -> obufix, enc -> obufmax, ")");
+#endif
+}
+
+static isc_result_t failover_message_end (failover_encoder_t *enc,
+					  dhcp_failover_link_t *link,
+					  omapi_object_t *connection)
+{
+	isc_result_t status;
+
+	/* The options didn't come to what the sender said they would. */
+	if (enc -> bad || enc -> len != enc -> size) {
+		log_error ("failover message: %u bytes of options put in "
+			   "%u bytes.", enc -> len, enc -> size);
+		return ISC_R_UNEXPECTED;
+	}
+
+	status = omapi_connection_commit (connection, enc -> len);
+	if (status != ISC_R_SUCCESS) {
+		log_info ("failover_message_end: something went wrong.");
+		omapi_disconnect (connection, 1);
+		return status;
+	}
+	failover_contact_later (link);
+	return ISC_R_SUCCESS;
+}
+
+/* Hold back what's sent to the peer until failover_uncork(), so that a
+   run of messages leaves in one write.   The connection is held too, in
+   case sending something drops the link. */
+
+static void failover_cork (dhcp_failover_state_t *state,
+			   omapi_object_t **connection)
+{
+	dhcp_failover_link_t *link;
+
+	if (!state -> link_to_peer ||
+	    state -> link_to_peer -> type != dhcp_type_failover_link)
+		return;
+	link = (dhcp_failover_link_t *)state -> link_to_peer;
+	if (!link -> outer || link -> outer -> type != omapi_type_connection)
+		return;
+	if (omapi_connection_cork (link -> outer) == ISC_R_SUCCESS)
+		omapi_object_reference (connection, link -> outer, MDL);
+}
+
+static void failover_uncork (omapi_object_t **connection)
+{
+	if (!*connection)
+		return;
+	omapi_connection_uncork (*connection);
+	omapi_object_dereference (connection, MDL);
+}
+
 /* Send a failover message header. */
 
 isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
@@ -4256,7 +4751,6 @@ isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
 	unsigned char *opbuf;
 	isc_result_t status = ISC_R_SUCCESS;
 	unsigned char cbuf;
-	struct timeval tv;
 
 	/* Run through the argument list once to compute the length of
 	   the option portion of the message. */
@@ -4332,23 +4826,7 @@ isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
 			goto err;
 		dfree (opbuf, MDL);
 	}
-	if (link -> state_object &&
-	    link -> state_object -> link_to_peer == link) {
-#if defined (DEBUG_FAILOVER_CONTACT_TIMING)
-		log_info ("add_timeout +%d %s",
-			  (int)(link -> state_object ->
-				partner.max_response_delay) / 3,
-			  "dhcp_failover_send_contact");
-#endif
-		tv . tv_sec = cur_time +
-			(int)(link -> state_object ->
-			      partner.max_response_delay) / 3;
-		tv . tv_usec = 0;
-		add_timeout (&tv,
-			     dhcp_failover_send_contact, link -> state_object,
-			     (tvref_t)dhcp_failover_state_reference,
-			     (tvunref_t)dhcp_failover_state_dereference);
-	}
+	failover_contact_later (link);
 	return status;
 
       err:
@@ -4660,7 +5138,9 @@ isc_result_t dhcp_failover_send_bind_update (dhcp_failover_state_t *state,
 					     struct lease *lease)
 {
 	dhcp_failover_link_t *link;
+	failover_encoder_t enc;
 	isc_result_t status;
+	unsigned size;
 	int flags = 0;
 	binding_state_t transmit_state;
 #if defined (DEBUG_FAILOVER_MESSAGES)
@@ -4735,41 +5215,53 @@ isc_result_t dhcp_failover_send_bind_update (dhcp_failover_state_t *state,
 		commit_leases();
 	}
 
-	/* Send the update. */
-	status = (dhcp_failover_put_message
-		  (link, link -> outer,
-		   FTM_BNDUPD, lease->last_xid,
-		   dhcp_failover_make_option (FTO_ASSIGNED_IP_ADDRESS, FMA,
-					      lease -> ip_addr.len,
-					      lease -> ip_addr.iabuf),
-		   dhcp_failover_make_option (FTO_BINDING_STATUS, FMA,
-					      lease -> desired_binding_state),
-		   lease -> uid_len
-		   ? dhcp_failover_make_option (FTO_CLIENT_IDENTIFIER, FMA,
-						lease -> uid_len,
-						lease -> uid)
-		   : &skip_failover_option,
-		   lease -> hardware_addr.hlen
-		   ? dhcp_failover_make_option (FTO_CHADDR, FMA,
-						lease -> hardware_addr.hlen,
-						lease -> hardware_addr.hbuf)
-		   : &skip_failover_option,
-		   dhcp_failover_make_option (FTO_LEASE_EXPIRY, FMA,
-					      lease -> ends),
-		   dhcp_failover_make_option (FTO_POTENTIAL_EXPIRY, FMA,
-					      lease -> tstp),
-		   dhcp_failover_make_option (FTO_STOS, FMA,
-					      lease -> starts),
-		   (lease->cltt != 0) ?
-			dhcp_failover_make_option(FTO_CLTT, FMA, lease->cltt) :
-			&skip_failover_option, /* No CLTT */
-		   flags ? dhcp_failover_make_option(FTO_IP_FLAGS, FMA,
-						     flags) :
-			   &skip_failover_option, /* No IP_FLAGS */
-		   &skip_failover_option,	/* XXX DDNS */
-		   &skip_failover_option,	/* XXX request options */
-		   &skip_failover_option,	/* XXX reply options */
-		   (failover_option_t *)0));
+	if (lease -> ip_addr.len != 4) {
+		log_error ("IP addrlen=%d, should be 4.", lease -> ip_addr.len);
+		return DHCP_R_INVALIDARG;
+	}
+
+	/* Work out how big the update is... */
+	size = (failover_option_space (FTO_ASSIGNED_IP_ADDRESS, 0) +
+		failover_option_space (FTO_BINDING_STATUS, 0) +
+		failover_option_space (FTO_LEASE_EXPIRY, 0) +
+		failover_option_space (FTO_POTENTIAL_EXPIRY, 0) +
+		failover_option_space (FTO_STOS, 0));
+	if (lease -> uid_len)
+		size += failover_option_space (FTO_CLIENT_IDENTIFIER,
+					       lease -> uid_len);
+	if (lease -> hardware_addr.hlen)
+		size += failover_option_space (FTO_CHADDR,
+					       lease -> hardware_addr.hlen);
+	if (lease -> cltt != 0)
+		size += failover_option_space (FTO_CLTT, 0);
+	if (flags)
+		size += failover_option_space (FTO_IP_FLAGS, 0);
+	/* XXX DDNS, request options, reply options */
+
+	/* ...and send it. */
+	status = failover_message_begin (&enc, link -> outer, FTM_BNDUPD,
+					 lease->last_xid, size, FMA);
+	if (status == ISC_R_SUCCESS) {
+		failover_put_bytes (&enc, FTO_ASSIGNED_IP_ADDRESS,
+				    lease -> ip_addr.iabuf, 4);
+		failover_put_uint (&enc, FTO_BINDING_STATUS,
+				   lease -> desired_binding_state);
+		if (lease -> uid_len)
+			failover_put_bytes (&enc, FTO_CLIENT_IDENTIFIER,
+					    lease -> uid, lease -> uid_len);
+		if (lease -> hardware_addr.hlen)
+			failover_put_bytes (&enc, FTO_CHADDR,
+					    lease -> hardware_addr.hbuf,
+					    lease -> hardware_addr.hlen);
+		failover_put_uint (&enc, FTO_LEASE_EXPIRY, lease -> ends);
+		failover_put_uint (&enc, FTO_POTENTIAL_EXPIRY, lease -> tstp);
+		failover_put_uint (&enc, FTO_STOS, lease -> starts);
+		if (lease -> cltt != 0)
+			failover_put_uint (&enc, FTO_CLTT, lease -> cltt);
+		if (flags)
+			failover_put_uint (&enc, FTO_IP_FLAGS, flags);
+		status = failover_message_end (&enc, link, link -> outer);
+	}
 
 #if defined (DEBUG_FAILOVER_MESSAGES)
 	if (status != ISC_R_SUCCESS)
@@ -4789,7 +5281,9 @@ isc_result_t dhcp_failover_send_bind_ack (dhcp_failover_state_t *state,
 					  int reason, const char *message)
 {
 	dhcp_failover_link_t *link;
+	failover_encoder_t enc;
 	isc_result_t status;
+	unsigned size;
 #if defined (DEBUG_FAILOVER_MESSAGES)
 	char obuf [64];
 	unsigned obufix = 0;
@@ -4811,53 +5305,64 @@ isc_result_t dhcp_failover_send_bind_ack (dhcp_failover_state_t *state,
 	if (!message && reason)
 		message = dhcp_failover_reject_reason_print (reason);
 
-	/* Send the update. */
-	status = (dhcp_failover_put_message
-		  (link, link -> outer,
-		   FTM_BNDACK, msg->xid,
-		   dhcp_failover_make_option (FTO_ASSIGNED_IP_ADDRESS, FMA,
-					      sizeof msg -> assigned_addr,
-					      &msg -> assigned_addr),
+	size = failover_option_space (FTO_ASSIGNED_IP_ADDRESS, 0);
 #ifdef DO_BNDACK_SHOULD_NOT
-		   dhcp_failover_make_option (FTO_BINDING_STATUS, FMA,
-					      msg -> binding_status),
-		   (msg -> options_present & FTB_CLIENT_IDENTIFIER)
-		   ? dhcp_failover_make_option (FTO_CLIENT_IDENTIFIER, FMA,
-						msg -> client_identifier.count,
-						msg -> client_identifier.data)
-		   : &skip_failover_option,
-		   (msg -> options_present & FTB_CHADDR)
-		   ? dhcp_failover_make_option (FTO_CHADDR, FMA,
-						msg -> chaddr.count,
-						msg -> chaddr.data)
-		   : &skip_failover_option,
-		   dhcp_failover_make_option (FTO_LEASE_EXPIRY, FMA,
-					      msg -> expiry),
-		   dhcp_failover_make_option (FTO_POTENTIAL_EXPIRY, FMA,
-					      msg -> potential_expiry),
-		   dhcp_failover_make_option (FTO_STOS, FMA,
-					      msg -> stos),
-		   (msg->options_present & FTB_CLTT) ?
-			dhcp_failover_make_option(FTO_CLTT, FMA, msg->cltt) :
-			&skip_failover_option, /* No CLTT in the msg to ack. */
-		   ((msg->options_present & FTB_IP_FLAGS) && msg->ip_flags) ?
-			dhcp_failover_make_option(FTO_IP_FLAGS, FMA,
-						  msg->ip_flags)
-			: &skip_failover_option,
+	size += (failover_option_space (FTO_BINDING_STATUS, 0) +
+		 failover_option_space (FTO_LEASE_EXPIRY, 0) +
+		 failover_option_space (FTO_POTENTIAL_EXPIRY, 0) +
+		 failover_option_space (FTO_STOS, 0));
+	if (msg -> options_present & FTB_CLIENT_IDENTIFIER)
+		size += failover_option_space (FTO_CLIENT_IDENTIFIER,
+					       msg -> client_identifier.count);
+	if (msg -> options_present & FTB_CHADDR)
+		size += failover_option_space (FTO_CHADDR,
+					       msg -> chaddr.count);
+	if (msg -> options_present & FTB_CLTT)
+		size += failover_option_space (FTO_CLTT, 0);
+	if ((msg -> options_present & FTB_IP_FLAGS) && msg -> ip_flags)
+		size += failover_option_space (FTO_IP_FLAGS, 0);
 #endif /* DO_BNDACK_SHOULD_NOT */
-		   reason
-		    ? dhcp_failover_make_option(FTO_REJECT_REASON, FMA, reason)
-		    : &skip_failover_option,
-		   (reason && message)
-		    ? dhcp_failover_make_option (FTO_MESSAGE, FMA,
-						 strlen (message), message)
-		    : &skip_failover_option,
+	if (reason)
+		size += failover_option_space (FTO_REJECT_REASON, 0);
+	if (reason && message)
+		size += failover_option_space (FTO_MESSAGE, strlen (message));
+
+	/* Send the update. */
+	status = failover_message_begin (&enc, link -> outer, FTM_BNDACK,
+					 msg -> xid, size, FMA);
+	if (status == ISC_R_SUCCESS) {
+		failover_put_bytes (&enc, FTO_ASSIGNED_IP_ADDRESS,
+				    &msg -> assigned_addr,
+				    sizeof msg -> assigned_addr);
 #ifdef DO_BNDACK_SHOULD_NOT
-		   &skip_failover_option,	/* XXX DDNS */
-		   &skip_failover_option,	/* XXX request options */
-		   &skip_failover_option,	/* XXX reply options */
+		failover_put_uint (&enc, FTO_BINDING_STATUS,
+				   msg -> binding_status);
+		if (msg -> options_present & FTB_CLIENT_IDENTIFIER)
+			failover_put_bytes (&enc, FTO_CLIENT_IDENTIFIER,
+					    msg -> client_identifier.data,
+					    msg -> client_identifier.count);
+		if (msg -> options_present & FTB_CHADDR)
+			failover_put_bytes (&enc, FTO_CHADDR,
+					    msg -> chaddr.data,
+					    msg -> chaddr.count);
+		failover_put_uint (&enc, FTO_LEASE_EXPIRY, msg -> expiry);
+		failover_put_uint (&enc, FTO_POTENTIAL_EXPIRY,
+				   msg -> potential_expiry);
+		failover_put_uint (&enc, FTO_STOS, msg -> stos);
+		if (msg -> options_present & FTB_CLTT)
+			failover_put_uint (&enc, FTO_CLTT, msg -> cltt);
+		if ((msg -> options_present & FTB_IP_FLAGS) && msg -> ip_flags)
+			failover_put_uint (&enc, FTO_IP_FLAGS,
+					   msg -> ip_flags);
+		/* XXX DDNS, request options, reply options */
 #endif /* DO_BNDACK_SHOULD_NOT */
-		   (failover_option_t *)0));
+		if (reason)
+			failover_put_uint (&enc, FTO_REJECT_REASON, reason);
+		if (reason && message)
+			failover_put_bytes (&enc, FTO_MESSAGE,
+					    message, strlen (message));
+		status = failover_message_end (&enc, link, link -> outer);
+	}
 
 #if defined (DEBUG_FAILOVER_MESSAGES)
 	if (status != ISC_R_SUCCESS)
@@ -5191,7 +5696,7 @@ isc_result_t dhcp_failover_process_bind_update (dhcp_failover_state_t *state,
 	ia.len = sizeof msg -> assigned_addr;
 	memcpy (ia.iabuf, &msg -> assigned_addr, ia.len);
 
-	if (!find_lease_by_ip_addr (&lease, ia, MDL)) {
+	if (!find_or_make_lease_by_ip_addr (&lease, ia, MDL)) {
 		message = "unknown IP address";
 		reason = FTR_ILLEGAL_IP_ADDR;
 		goto bad;
@@ -0,0 +1,711 @@
+/* leaseload.c
+
+   Reading the lease file on several threads. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/leaseload.c
+ *
+ * \page leaseload parallel lease file loading
+ *
+ * With --enable-parallel-lease-load a big DHCPv4 lease file is parsed on
+ * lease-load-threads threads at startup.  The file is read a round at a
+ * time: each round is cut into one chunk per thread, at the end of a top
+ * level declaration (a close brace at the start of a line, which is how
+ * write_lease() ends a lease).  Each thread turns the lease declarations
+ * in its chunk into lease records, which need nothing but the lexer and
+ * memory; anything a record can't hold, such as a lease with an on
+ * statement or a billing class, or a declaration other than a lease, is
+ * recorded as a stretch of the file for the serial parser instead.
+ *
+ * The records are then entered by the main thread in file order, with
+ * the stretches of the file in between parsed by lease_file_subparse()
+ * as before, so a later declaration for an address replaces an earlier
+ * one exactly as it would without threads.  The hashes, the pools and
+ * the billing are only ever touched by the main thread.
+ *
+ * The threads allocate with dmalloc(), which is only safe without the
+ * memory debugging options, so those turn the threads off.
+ */
+
+#include "dhcpd.h"
+
+int lease_load_threads = DEFAULT_LEASE_LOAD_THREADS;
+
+#if defined (PARALLEL_LEASE_LOAD)
+#if defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL) || \
+    defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT) || defined (DEBUG_RC_HISTORY)
+
+int lease_file_parallel_subparse (struct parse *cfile)
+{
+	return 0;
+}
+
+#else /* !DEBUG_MEMORY_LEAKAGE ... */
+
+#include <pthread.h>
+#include <sys/time.h>
+
+/* How much of the file each thread parses per round.  A file smaller
+   than two chunks is parsed on the main thread. */
+#define LEASE_LOAD_CHUNK	(4 * 1024 * 1024)
+#define LEASE_LOAD_MAX_THREADS	32
+
+/* A set statement in a lease declaration. */
+struct lease_record_set {
+	struct lease_record_set *next;
+	char *name;
+	struct data_string data;
+};
+
+/* A lease declaration parsed by a thread, or a stretch of the file
+   (start to end) that has to be parsed by the serial parser. */
+struct lease_record {
+	size_t start, end;
+	int serial;
+
+	int seenmask;		/* as in parse_lease_declaration() */
+	unsigned char addr [4];
+	TIME starts, ends, tstp, tsfp, atsfp, cltt;
+	binding_state_t binding_state;
+	binding_state_t next_binding_state;
+	binding_state_t rewind_binding_state;
+	u_int8_t flags;
+	struct hardware hardware_addr;
+	unsigned char *uid;
+	unsigned uid_len;
+	char *client_hostname;
+	struct lease_record_set *sets;
+};
+
+struct lease_load_chunk {
+	struct parse *cfile;
+	size_t base;		/* where the chunk starts in the file */
+	struct lease_record *records;
+	int count, max;
+	int incomplete;		/* ends inside a declaration */
+	pthread_t thread;
+	int started;
+};
+
+/* What the main thread knows about where it is in the file. */
+struct lease_load_merge {
+	struct parse *cfile;
+	size_t counted;		/* lines are counted up to here */
+	int line;
+	unsigned long leases, serial;
+};
+
+/* Set while the main thread parses stretches of the file, which mustn't
+   be handed to the threads again. */
+static int lease_load_active;
+
+/* Return the end of the first top level declaration that ends at or after
+   ofs, or the end of the file. */
+
+static size_t lease_load_cut (const char *buf, size_t len, size_t ofs)
+{
+	const char *p;
+
+	while (ofs < len) {
+		p = memchr (buf + ofs, '}', len - ofs);
+		if (!p)
+			break;
+		ofs = p - buf;
+		if (ofs > 0 && buf [ofs - 1] == '\n' &&
+		    ofs + 1 < len && buf [ofs + 1] == '\n')
+			return ofs + 2;
+		ofs++;
+	}
+	return len;
+}
+
+static struct lease_record *lease_record_add (struct lease_load_chunk *chunk)
+{
+	struct lease_record *records;
+	int max;
+
+	if (chunk -> count == chunk -> max) {
+		max = chunk -> max ? chunk -> max * 2 : 1024;
+		records = dmalloc (max * sizeof *records, MDL);
+		if (!records)
+			log_fatal ("No memory for lease records.");
+		if (chunk -> records) {
+			memcpy (records, chunk -> records,
+				chunk -> count * sizeof *records);
+			dfree (chunk -> records, MDL);
+		}
+		chunk -> records = records;
+		chunk -> max = max;
+	}
+	return &chunk -> records [chunk -> count++];
+}
+
+static void lease_record_forget (struct lease_record *rec)
+{
+	struct lease_record_set *set, *next;
+
+	if (rec -> uid)
+		dfree (rec -> uid, MDL);
+	if (rec -> client_hostname)
+		dfree (rec -> client_hostname, MDL);
+	for (set = rec -> sets; set; set = next) {
+		next = set -> next;
+		if (set -> name)
+			dfree (set -> name, MDL);
+		data_string_forget (&set -> data, MDL);
+		dfree (set, MDL);
+	}
+	memset (rec, 0, sizeof *rec);
+}
+
+/* Parse a lease declaration, after the LEASE token, into a lease record.
+   This takes the statements write_lease() writes for most leases; for
+   anything else, or anything the serial parser would warn about, it
+   returns 0 and the declaration is left to the serial parser. */
+
+static int parse_lease_record (struct lease_record *rec, struct parse *cfile)
+{
+	const char *val;
+	enum dhcp_token token;
+	unsigned len = sizeof rec -> addr;
+	unsigned buflen;
+	int seenmask = 0;
+	int seenbit;
+	binding_state_t new_state;
+	struct lease_record_set *set, **tail;
+
+	cfile -> warnings_occurred = 0;
+	if (!parse_numeric_aggregate (cfile, rec -> addr, &len, DOT, 10, 8) ||
+	    len != sizeof rec -> addr)
+		return 0;
+	if (!parse_lbrace (cfile))
+		return 0;
+
+	tail = &rec -> sets;
+	do {
+		token = next_token (&val, (unsigned *)0, cfile);
+		if (token == RBRACE)
+			break;
+
+		switch (token) {
+		      case STARTS:
+			seenbit = 1;
+			rec -> starts = parse_date (cfile);
+			break;
+
+		      case ENDS:
+			seenbit = 2;
+			rec -> ends = parse_date (cfile);
+			break;
+
+		      case TSTP:
+			seenbit = 65536;
+			rec -> tstp = parse_date (cfile);
+			break;
+
+		      case TSFP:
+			seenbit = 131072;
+			rec -> tsfp = parse_date (cfile);
+			break;
+
+		      case ATSFP:
+			seenbit = 262144;
+			rec -> atsfp = parse_date (cfile);
+			break;
+
+		      case CLTT:
+			seenbit = 524288;
+			rec -> cltt = parse_date (cfile);
+			break;
+
+		      case UID:
+			seenbit = 8;
+			token = peek_token (&val, (unsigned *)0, cfile);
+			if (token == STRING) {
+				skip_token (&val, &buflen, cfile);
+				if (!buflen)
+					return 0;
+				rec -> uid = dmalloc (buflen, MDL);
+				if (!rec -> uid)
+					log_fatal ("No memory for lease uid");
+				memcpy (rec -> uid, val, buflen);
+			} else {
+				buflen = 0;
+				rec -> uid = (parse_numeric_aggregate
+					      (cfile, (unsigned char *)0,
+					       &buflen, ':', 16, 8));
+				if (!rec -> uid || !buflen)
+					return 0;
+			}
+			rec -> uid_len = buflen;
+			parse_semi (cfile);
+			break;
+
+		      case HARDWARE:
+			seenbit = 64;
+			parse_hardware_param (cfile, &rec -> hardware_addr);
+			break;
+
+		      case TOKEN_RESERVED:
+			seenbit = 0;
+			rec -> flags |= RESERVED_LEASE;
+			parse_semi (cfile);
+			break;
+
+		      case DYNAMIC_BOOTP:
+			seenbit = 0;
+			rec -> flags |= BOOTP_LEASE;
+			parse_semi (cfile);
+			break;
+
+		      case TOKEN_NEXT:
+			seenbit = 128;
+			if (next_token (&val, (unsigned *)0, cfile) != BINDING)
+				return 0;
+			goto do_binding_state;
+
+		      case REWIND:
+			seenbit = 512;
+			if (next_token (&val, (unsigned *)0, cfile) != BINDING)
+				return 0;
+			goto do_binding_state;
+
+		      case BINDING:
+			seenbit = 256;
+
+		      do_binding_state:
+			if (next_token (&val, (unsigned *)0, cfile) != STATE)
+				return 0;
+			token = next_token (&val, (unsigned *)0, cfile);
+			switch (token) {
+			      case TOKEN_ABANDONED:
+				new_state = FTS_ABANDONED;
+				break;
+			      case TOKEN_FREE:
+				new_state = FTS_FREE;
+				break;
+			      case TOKEN_ACTIVE:
+				new_state = FTS_ACTIVE;
+				break;
+			      case TOKEN_EXPIRED:
+				new_state = FTS_EXPIRED;
+				break;
+			      case TOKEN_RELEASED:
+				new_state = FTS_RELEASED;
+				break;
+			      case TOKEN_RESET:
+				new_state = FTS_RESET;
+				break;
+			      case TOKEN_BACKUP:
+				new_state = FTS_BACKUP;
+				break;
+			      case TOKEN_RESERVED:
+				new_state = FTS_ACTIVE;
+				rec -> flags |= RESERVED_LEASE;
+				break;
+			      case TOKEN_BOOTP:
+				new_state = FTS_ACTIVE;
+				rec -> flags |= BOOTP_LEASE;
+				break;
+			      default:
+				return 0;
+			}
+			if (seenbit == 256)
+				rec -> binding_state = new_state;
+			else if (seenbit == 128)
+				rec -> next_binding_state = new_state;
+			else
+				rec -> rewind_binding_state = new_state;
+			parse_semi (cfile);
+			break;
+
+		      case CLIENT_HOSTNAME:
+			seenbit = 1024;
+			token = peek_token (&val, (unsigned *)0, cfile);
+			if (token == STRING) {
+				if (!parse_string (cfile,
+						   &rec -> client_hostname,
+						   (unsigned *)0))
+					return 0;
+			} else {
+				rec -> client_hostname =
+					parse_host_name (cfile);
+				if (!rec -> client_hostname)
+					return 0;
+				parse_semi (cfile);
+			}
+			break;
+
+		      case TOKEN_SET:
+			/* Only string values; the others are rare. */
+			seenbit = 0;
+			token = next_token (&val, (unsigned *)0, cfile);
+			if (token != NAME && token != NUMBER_OR_NAME)
+				return 0;
+			set = dmalloc (sizeof *set, MDL);
+			if (!set)
+				log_fatal ("No memory for lease binding.");
+			*tail = set;
+			tail = &set -> next;
+			set -> name = dmalloc (strlen (val) + 1, MDL);
+			if (!set -> name)
+				log_fatal ("No memory for binding name.");
+			strcpy (set -> name, val);
+
+			if (next_token (&val, (unsigned *)0, cfile) != EQUAL)
+				return 0;
+			token = next_token (&val, &buflen, cfile);
+			if (token != STRING)
+				return 0;
+			if (!buffer_allocate (&set -> data.buffer,
+					      buflen + 1, MDL))
+				log_fatal ("No memory for binding.");
+			memcpy (set -> data.buffer -> data, val, buflen + 1);
+			set -> data.data = set -> data.buffer -> data;
+			set -> data.len = buflen;
+			set -> data.terminated = 1;
+			parse_semi (cfile);
+			break;
+
+		      default:
+			return 0;
+		}
+
+		if (cfile -> warnings_occurred || (seenmask & seenbit))
+			return 0;
+		seenmask |= seenbit;
+	} while (1);
+
+	rec -> seenmask = seenmask;
+	return 1;
+}
+
+/* Skip a declaration the serial parser will have to deal with, from its
+   first token.  Returns 0 if the chunk ends first. */
+
+static int lease_load_skip (struct parse *cfile)
+{
+	const char *val;
+	enum dhcp_token token;
+	int depth = 0;
+
+	do {
+		token = next_token (&val, (unsigned *)0, cfile);
+		if (token == END_OF_FILE)
+			return 0;
+		if (token == LBRACE)
+			depth++;
+		else if (token == RBRACE) {
+			if (--depth <= 0)
+				return 1;
+		} else if (token == SEMI && depth == 0)
+			return 1;
+	} while (1);
+}
+
+static void *lease_load_worker (void *arg)
+{
+	struct lease_load_chunk *chunk = arg;
+	struct parse *cfile = chunk -> cfile;
+	struct lease_record *rec;
+	enum dhcp_token token;
+	const char *val;
+	size_t start;
+
+	do {
+		/* No token is ever left peeked at between declarations, so
+		   bufix is where the next one starts. */
+		start = cfile -> bufix;
+		token = next_token (&val, (unsigned *)0, cfile);
+		if (token == END_OF_FILE)
+			break;
+
+		rec = lease_record_add (chunk);
+		memset (rec, 0, sizeof *rec);
+		rec -> start = chunk -> base + start;
+		if (token == LEASE && parse_lease_record (rec, cfile)) {
+			rec -> end = chunk -> base + cfile -> bufix;
+			continue;
+		}
+
+		/* Go back to the start of the declaration and find its end,
+		   for the serial parser. */
+		lease_record_forget (rec);
+		rec -> start = chunk -> base + start;
+		rec -> serial = 1;
+		cfile -> bufix = start;
+		cfile -> token = 0;
+		if (!lease_load_skip (cfile))
+			chunk -> incomplete = 1;
+		rec -> end = chunk -> base + cfile -> bufix;
+
+		/* The serial parser can take neighbouring stretches at once. */
+		if (chunk -> count > 1 && rec [-1].serial) {
+			rec [-1].end = rec -> end;
+			chunk -> count--;
+		}
+	} while (!chunk -> incomplete);
+
+	return NULL;
+}
+
+/* Parse a stretch of the file with the serial parser. */
+
+static void lease_load_serial (struct lease_load_merge *merge,
+			       size_t start, size_t end)
+{
+	struct parse *cfile = merge -> cfile;
+	struct parse *sub = (struct parse *)0;
+	const char *p, *stop;
+	isc_result_t status;
+
+	/* Count the lines before it, so that warnings say where they are. */
+	p = cfile -> inbuf + merge -> counted;
+	stop = cfile -> inbuf + start;
+	while (p < stop && (p = memchr (p, '\n', stop - p)) != NULL) {
+		merge -> line++;
+		p++;
+	}
+	merge -> counted = start;
+
+	status = new_parse (&sub, -1, cfile -> inbuf + start, end - start,
+			    cfile -> tlname, 0);
+	if (status != ISC_R_SUCCESS || sub == NULL)
+		log_fatal ("Can't parse %s: %s", cfile -> tlname,
+			   isc_result_totext (status));
+	sub -> line = merge -> line;
+	lease_file_subparse (sub);
+	if (sub -> warnings_occurred)
+		cfile -> warnings_occurred = 1;
+	end_parse (&sub);
+	merge -> serial++;
+}
+
+/* Enter the lease from a lease record, as lease_file_subparse() would
+   after parse_lease_declaration(). */
+
+static void lease_record_enter (struct lease_load_merge *merge,
+				struct lease_record *rec)
+{
+	struct lease *lease = (struct lease *)0;
+	struct lease_record_set *set;
+	struct binding *binding;
+
+	if (lease_allocate (&lease, MDL) != ISC_R_SUCCESS)
+		log_fatal ("No memory for lease.");
+
+	memcpy (lease -> ip_addr.iabuf, rec -> addr, sizeof rec -> addr);
+	lease -> ip_addr.len = sizeof rec -> addr;
+	lease -> starts = rec -> starts;
+	lease -> ends = rec -> ends;
+	lease -> tstp = rec -> tstp;
+	lease -> tsfp = rec -> tsfp;
+	lease -> atsfp = rec -> atsfp;
+	lease -> cltt = rec -> cltt;
+	lease -> flags = rec -> flags;
+
+	/* The binding state is the default for the next and rewind
+	   states, wherever they come in the declaration. */
+	if (rec -> seenmask & 256)
+		lease -> binding_state = rec -> binding_state;
+	if (rec -> seenmask & 128)
+		lease -> next_binding_state = rec -> next_binding_state;
+	else if (rec -> seenmask & 256)
+		lease -> next_binding_state = rec -> binding_state;
+	if (rec -> seenmask & 512)
+		lease -> rewind_binding_state = rec -> rewind_binding_state;
+	else if (rec -> seenmask & 256)
+		lease -> rewind_binding_state = rec -> binding_state;
+
+	lease -> hardware_addr = rec -> hardware_addr;
+	if (rec -> uid) {
+		if (rec -> uid_len < sizeof lease -> uid_buf) {
+			memcpy (lease -> uid_buf, rec -> uid, rec -> uid_len);
+			lease -> uid = lease -> uid_buf;
+			lease -> uid_max = sizeof lease -> uid_buf;
+			dfree (rec -> uid, MDL);
+		} else {
+			lease -> uid = rec -> uid;
+			lease -> uid_max = rec -> uid_len;
+		}
+		lease -> uid_len = rec -> uid_len;
+		rec -> uid = (unsigned char *)0;
+	}
+	lease -> client_hostname = rec -> client_hostname;
+	rec -> client_hostname = (char *)0;
+
+	for (set = rec -> sets; set; set = set -> next) {
+		if (lease -> scope)
+			binding = find_binding (lease -> scope, set -> name);
+		else
+			binding = (struct binding *)0;
+		if (!binding) {
+			if (!lease -> scope &&
+			    !binding_scope_allocate (&lease -> scope, MDL))
+				log_fatal ("no memory for scope");
+			binding = dmalloc (sizeof *binding, MDL);
+			if (!binding)
+				log_fatal ("No memory for lease %s.",
+					   "binding");
+			binding -> name = set -> name;
+			set -> name = (char *)0;
+			binding -> next = lease -> scope -> bindings;
+			lease -> scope -> bindings = binding;
+		} else
+			binding_value_dereference (&binding -> value, MDL);
+		if (!binding_value_allocate (&binding -> value, MDL))
+			log_fatal ("no memory for binding value.");
+		binding -> value -> type = binding_data;
+		binding -> value -> value.data = set -> data;
+		memset (&set -> data, 0, sizeof set -> data);
+	}
+
+	lease_declaration_defaults (lease, rec -> seenmask);
+	enter_lease (lease);
+	lease_dereference (&lease, MDL);
+	merge -> leases++;
+}
+
+/* Parse the lease file in cfile on lease-load-threads threads.  Returns 0,
+   having done nothing, if the file should be parsed the usual way. */
+
+int lease_file_parallel_subparse (struct parse *cfile)
+{
+	struct lease_load_chunk chunks [LEASE_LOAD_MAX_THREADS];
+	struct lease_load_chunk *chunk;
+	struct lease_load_merge merge;
+	struct lease_record *rec;
+	struct timeval start, end;
+	size_t ofs, cut;
+	int threads, nchunks, i, j;
+	isc_result_t status;
+
+	if (lease_load_active || local_family != AF_INET ||
+	    cfile -> bufix != 0 || cfile -> token ||
+	    cfile -> buflen < 2 * LEASE_LOAD_CHUNK)
+		return 0;
+
+	threads = lease_load_threads;
+	if (threads <= 0)
+		threads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+	if (threads > LEASE_LOAD_MAX_THREADS)
+		threads = LEASE_LOAD_MAX_THREADS;
+	if (threads < 2)
+		return 0;
+
+	gettimeofday (&start, NULL);
+	lease_load_active = 1;
+	memset (&merge, 0, sizeof merge);
+	merge.cfile = cfile;
+	merge.line = 1;
+
+	ofs = 0;
+	while (ofs < cfile -> buflen) {
+		/* Cut the next round into chunks and start a thread on each;
+		   if there are no more threads the main thread does it. */
+		memset (chunks, 0, sizeof chunks);
+		for (nchunks = 0;
+		     nchunks < threads && ofs < cfile -> buflen; nchunks++) {
+			chunk = &chunks [nchunks];
+			cut = ofs + LEASE_LOAD_CHUNK;
+			if (cut > cfile -> buflen)
+				cut = cfile -> buflen;
+			cut = lease_load_cut (cfile -> inbuf,
+					      cfile -> buflen, cut);
+			status = new_parse (&chunk -> cfile, -1,
+					    cfile -> inbuf + ofs, cut - ofs,
+					    cfile -> tlname, 0);
+			if (status != ISC_R_SUCCESS || chunk -> cfile == NULL)
+				log_fatal ("Can't parse %s: %s",
+					   cfile -> tlname,
+					   isc_result_totext (status));
+			chunk -> cfile -> quiet = 1;
+			chunk -> base = ofs;
+			ofs = cut;
+		}
+		for (i = 0; i < nchunks; i++) {
+			chunk = &chunks [i];
+			chunk -> started =
+				!pthread_create (&chunk -> thread, NULL,
+						 lease_load_worker, chunk);
+		}
+		for (i = 0; i < nchunks; i++) {
+			chunk = &chunks [i];
+			if (chunk -> started)
+				pthread_join (chunk -> thread, NULL);
+			else
+				lease_load_worker (chunk);
+		}
+
+		/* Enter them in file order. */
+		for (i = 0; i < nchunks; i++) {
+			chunk = &chunks [i];
+			for (j = 0; j < chunk -> count; j++) {
+				rec = &chunk -> records [j];
+				if (!rec -> serial) {
+					lease_record_enter (&merge, rec);
+					continue;
+				}
+
+				/* A declaration that runs on past the end of
+				   its chunk can't be trusted to have been cut
+				   in the right place, so the rest of the file
+				   goes to the serial parser. */
+				if (chunk -> incomplete &&
+				    j == chunk -> count - 1) {
+					lease_load_serial (&merge, rec -> start,
+							   cfile -> buflen);
+					ofs = cfile -> buflen;
+					break;
+				}
+				lease_load_serial (&merge,
+						   rec -> start, rec -> end);
+			}
+			if (chunk -> incomplete)
+				break;
+		}
+
+		for (i = 0; i < nchunks; i++) {
+			chunk = &chunks [i];
+			for (j = 0; j < chunk -> count; j++)
+				lease_record_forget (&chunk -> records [j]);
+			if (chunk -> records)
+				dfree (chunk -> records, MDL);
+			end_parse (&chunk -> cfile);
+		}
+	}
+	lease_load_active = 0;
+
+	gettimeofday (&end, NULL);
+	log_info ("Read %s on %d threads in %ld ms: %lu leases, "
+		  "%lu parts read serially.", cfile -> tlname, threads,
+		  (long)((end.tv_sec - start.tv_sec) * 1000 +
+			 (end.tv_usec - start.tv_usec) / 1000),
+		  merge.leases, merge.serial);
+	return 1;
+}
+
+#endif /* !DEBUG_MEMORY_LEAKAGE ... */
+#endif /* PARALLEL_LEASE_LOAD */
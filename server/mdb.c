@@ -28,6 +28,7 @@
 
 #include "dhcpd.h"
 #include "omapip/hash.h"
+#include <sys/time.h>
 
 struct subnet *subnets;
 struct shared_network *shared_networks;
@@ -65,8 +66,59 @@ typedef struct host_id_info {
 
 static host_id_info_t *host_id_info = NULL;
 
+/*
+ * Every key a host can be found by - hardware address, client identifier
+ * or host-identifier option value - is also set in a Bloom filter, so
+ * that a client without a reservation, which is most of them, costs a
+ * few bit tests rather than a probe of each host hash.  The key's hash
+ * is seeded with its type (for host-identifiers the option and relay
+ * count), so the same bytes under different types are different keys.
+ *
+ * Bits can't be taken out again, so a deleted host leaves its keys
+ * behind until the filter is rebuilt from the host hashes.  That's done
+ * lazily at the next lookup once the filter is full, once a quarter of
+ * its keys have been deleted, or after the configuration is replaced.
+ * A stale bit only costs the hash lookup the filter would have saved.
+ * If there's no memory for the filter, lookups go straight to the hashes
+ * until a host is added or deleted, and then building it is tried again.
+ */
+#define HOST_KEY_HWADDR		1
+#define HOST_KEY_UID		2
+#define HOST_KEY_OPTION(p)	(0x80000000 |			\
+				 (((p)->option->universe->index & 0x7f) << 24) | \
+				 (((p)->relays & 0xff) << 16) |		\
+				 ((p)->option->code & 0xffff))
+
+#define HOST_KEY_PROBES		4	/* bits set per key */
+#define HOST_KEY_BITS_PER_KEY	16	/* about 0.25% false positives */
+#define HOST_KEY_MIN_BITS	65536
+
+static u_int32_t *host_key_bits;
+static u_int32_t host_key_mask;		/* number of bits - 1 */
+static int host_key_count;		/* keys set since the last rebuild */
+static int host_key_deleted;		/* and deleted since then */
+static int host_key_stale = 1;
+static int host_key_disabled;		/* no memory for the filter */
+static u_int32_t host_key_rebuild_type;
+
+/* Sparse address ranges, and whether the pool queues have been filled
+ * yet: until they are a lease made for a sparse range only goes into
+ * lease_ip_addr_hash, and expire_all_pools() queues it. */
+static struct sparse_range *sparse_ranges;
+static int sparse_ranges_queued;
+
+/* The sparse ranges in order of their first address, for
+ * find_sparse_range().  Rebuilt when next needed after a range is added
+ * or the configuration is swapped. */
+static struct sparse_range **sparse_index;
+static unsigned sparse_index_count, sparse_index_max;
+static int sparse_index_stale = 1;
+
 int numclasseswritten;
 
+int expiry_slice_leases = DEFAULT_EXPIRY_SLICE_LEASES;
+int expiry_slice_usecs = DEFAULT_EXPIRY_SLICE_USECS;
+
 extern omapi_object_type_t *dhcp_type_host;
 
 isc_result_t enter_class(cd, dynamicp, commit)
@@ -159,6 +211,154 @@ find_host_id_info(unsigned int option_code, int relays) {
 	return p;
 }
 
+/* Hash a host key of the given type.  This is FNV-1a finished off with
+   the MurmurHash3 mixer, so that both halves are good enough to use as
+   the two hashes the filter's probes are made from. */
+static isc_uint64_t
+host_key_hash(u_int32_t type, const unsigned char *key, unsigned len)
+{
+	isc_uint64_t h = 14695981039346656037ULL;
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		h ^= (type >> (i * 8)) & 0xff;
+		h *= 1099511628211ULL;
+	}
+	for (i = 0; i < len; i++) {
+		h ^= key[i];
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void
+host_key_set(u_int32_t type, const unsigned char *key, unsigned len)
+{
+	isc_uint64_t h = host_key_hash(type, key, len);
+	u_int32_t h1 = (u_int32_t)h, h2 = (u_int32_t)(h >> 32) | 1;
+	int i;
+
+	for (i = 0; i < HOST_KEY_PROBES; i++, h1 += h2)
+		host_key_bits[(h1 & host_key_mask) >> 5] |= 1U << (h1 & 31);
+}
+
+/* Note a key that has just been added to one of the host hashes. */
+static void
+host_key_add(u_int32_t type, const unsigned char *key, unsigned len)
+{
+	if (host_key_stale) {
+		host_key_disabled = 0;
+		return;
+	}
+	if (host_key_count >= (host_key_mask + 1) / HOST_KEY_BITS_PER_KEY) {
+		host_key_stale = 1;
+		return;
+	}
+	host_key_set(type, key, len);
+	host_key_count++;
+}
+
+/* Note that a key has been taken out of the host hashes. */
+static void
+host_key_delete(void)
+{
+	if (host_key_stale)
+		host_key_disabled = 0;
+	else if (++host_key_deleted > host_key_count / 4)
+		host_key_stale = 1;
+}
+
+static isc_result_t
+host_key_count_one(const void *name, unsigned len, void *value)
+{
+	host_key_count++;
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t
+host_key_set_one(const void *name, unsigned len, void *value)
+{
+	host_key_set(host_key_rebuild_type, name, len);
+	return ISC_R_SUCCESS;
+}
+
+/* Rebuild the filter from the host hashes, with room for as many keys
+   again to be added before it fills up. */
+static void
+host_key_rebuild(void)
+{
+	host_id_info_t *p;
+	u_int32_t bits;
+
+	host_key_count = 0;
+	host_hash_foreach(host_hw_addr_hash, host_key_count_one);
+	host_hash_foreach(host_uid_hash, host_key_count_one);
+	for (p = host_id_info; p != NULL; p = p->next)
+		host_hash_foreach(p->values_hash, host_key_count_one);
+
+	for (bits = HOST_KEY_MIN_BITS;
+	     (bits < 0x80000000) &&
+	     (bits / HOST_KEY_BITS_PER_KEY < 2 * host_key_count); bits <<= 1)
+		;
+	if ((host_key_bits != NULL) && (bits == host_key_mask + 1)) {
+		memset(host_key_bits, 0, bits / 8);
+	} else {
+		if (host_key_bits != NULL)
+			dfree(host_key_bits, MDL);
+		host_key_bits = dmalloc(bits / 8, MDL);
+		if (host_key_bits == NULL) {
+			log_error("No memory for the host key filter.");
+			host_key_mask = 0;
+			host_key_disabled = 1;
+			return;
+		}
+		host_key_mask = bits - 1;
+	}
+
+	host_key_rebuild_type = HOST_KEY_HWADDR;
+	host_hash_foreach(host_hw_addr_hash, host_key_set_one);
+	host_key_rebuild_type = HOST_KEY_UID;
+	host_hash_foreach(host_uid_hash, host_key_set_one);
+	for (p = host_id_info; p != NULL; p = p->next) {
+		host_key_rebuild_type = HOST_KEY_OPTION(p);
+		host_hash_foreach(p->values_hash, host_key_set_one);
+	}
+	host_key_deleted = 0;
+	host_key_stale = 0;
+}
+
+/* Might some host have this key?  If not, there's no need to look. */
+static int
+host_key_maybe(u_int32_t type, const unsigned char *key, unsigned len)
+{
+	isc_uint64_t h;
+	u_int32_t h1, h2;
+	int i;
+
+	if (host_key_stale) {
+		if (host_key_disabled)
+			return 1;
+		host_key_rebuild();
+		if (host_key_stale)
+			return 1;
+	}
+
+	h = host_key_hash(type, key, len);
+	h1 = (u_int32_t)h;
+	h2 = (u_int32_t)(h >> 32) | 1;
+	for (i = 0; i < HOST_KEY_PROBES; i++, h1 += h2) {
+		if (!(host_key_bits[(h1 & host_key_mask) >> 5] &
+		      (1U << (h1 & 31))))
+			return 0;
+	}
+	return 1;
+}
+
 /* Debugging code */
 #if 0
 isc_result_t
@@ -196,6 +396,7 @@ change_host_uid(struct host_decl *host, const char *uid, int len) {
 				 host->client_identifier.data,
 				 host->client_identifier.len,
 				 MDL);
+		host_key_delete();
 		data_string_forget(&host->client_identifier, MDL);
 	}
 
@@ -215,6 +416,8 @@ change_host_uid(struct host_decl *host, const char *uid, int len) {
 	 */
 	host_hash_add(host_uid_hash, host->client_identifier.data,
 		      host->client_identifier.len, host, MDL);
+	host_key_add(HOST_KEY_UID, host->client_identifier.data,
+		     host->client_identifier.len);
 }
 
 isc_result_t enter_host (hd, dynamicp, commit)
@@ -293,10 +496,12 @@ isc_result_t enter_host (hd, dynamicp, commit)
 					  hd -> interface.hbuf,
 					  hd -> interface.hlen, MDL);
 		}
-		if (!hp)
+		if (!hp) {
 			host_hash_add (host_hw_addr_hash, hd -> interface.hbuf,
 				       hd -> interface.hlen, hd, MDL);
-		else {
+			host_key_add (HOST_KEY_HWADDR, hd -> interface.hbuf,
+				      hd -> interface.hlen);
+		} else {
 			/* If there was already a host declaration for
 			   this hardware address, add this one to the
 			   end of the list. */
@@ -355,6 +560,9 @@ isc_result_t enter_host (hd, dynamicp, commit)
 				       hd -> client_identifier.data,
 				       hd -> client_identifier.len,
 				       hd, MDL);
+			host_key_add (HOST_KEY_UID,
+				      hd -> client_identifier.data,
+				      hd -> client_identifier.len);
 		} else {
 			/* If there's already a host declaration for this
 			   client identifier, add this one to the end of the
@@ -380,6 +588,9 @@ isc_result_t enter_host (hd, dynamicp, commit)
 					       hd -> client_identifier.data,
 					       hd -> client_identifier.len,
 					       hd, MDL);
+				host_key_add (HOST_KEY_UID,
+					      hd -> client_identifier.data,
+					      hd -> client_identifier.len);
 			}
 		}
 	}
@@ -440,9 +651,15 @@ isc_result_t enter_host (hd, dynamicp, commit)
 				      hd->host_id.data,
 				      hd->host_id.len,
 				      hd, MDL);
+			host_key_add(HOST_KEY_OPTION(h_id_info),
+				     hd->host_id.data, hd->host_id.len);
 		}
 	}
 
+#if defined (OMAPI_QUERY_THREAD)
+	omapi_query_host (hd);
+#endif
+
 	if (dynamicp && commit) {
 		if (!write_host (hd))
 			return ISC_R_IOERROR;
@@ -502,6 +719,13 @@ isc_result_t delete_host (hd, commit)
 	/* But we do need to do it once!   :') */
 	hd -> flags |= HOST_DECL_DELETED;
 
+	if (hd -> interface.hlen)
+		host_key_delete ();
+	if (hd -> client_identifier.len)
+		host_key_delete ();
+	if (hd -> host_id_option)
+		host_key_delete ();
+
 	if (hd -> interface.hlen) {
 	    if (host_hw_addr_hash) {
 		if (host_hash_lookup (&hp, host_hw_addr_hash,
@@ -596,12 +820,19 @@ isc_result_t delete_host (hd, commit)
 				 hd -> n_ipaddr -> client_identifier.data,
 				 hd -> n_ipaddr -> client_identifier.len,
 				 hd -> n_ipaddr, MDL);
+			host_key_add
+				(HOST_KEY_UID,
+				 hd -> n_ipaddr -> client_identifier.data,
+				 hd -> n_ipaddr -> client_identifier.len);
 		}
 		if (hw_head && hd -> n_ipaddr -> interface.hlen) {
 			host_hash_add (host_hw_addr_hash,
 				       hd -> n_ipaddr -> interface.hbuf,
 				       hd -> n_ipaddr -> interface.hlen,
 				       hd -> n_ipaddr, MDL);
+			host_key_add (HOST_KEY_HWADDR,
+				      hd -> n_ipaddr -> interface.hbuf,
+				      hd -> n_ipaddr -> interface.hlen);
 		}
 		host_dereference (&hd -> n_ipaddr, MDL);
 	}
@@ -619,6 +850,10 @@ isc_result_t delete_host (hd, commit)
 		}
 	}
 
+#if defined (OMAPI_QUERY_THREAD)
+	omapi_query_host (hd);
+#endif
+
 	if (commit) {
 		if (!write_host (hd))
 			return ISC_R_IOERROR;
@@ -644,6 +879,8 @@ int find_hosts_by_haddr (struct host_decl **hp, int htype,
 	h.hbuf [0] = htype;
 	memcpy (&h.hbuf [1], haddr, hlen);
 
+	if (!host_key_maybe (HOST_KEY_HWADDR, h.hbuf, h.hlen))
+		return 0;
 	return host_hash_lookup (hp, host_hw_addr_hash,
 				 h.hbuf, h.hlen, file, line);
 }
@@ -652,6 +889,8 @@ int find_hosts_by_uid (struct host_decl **hp,
 		       const unsigned char *data, unsigned len,
 		       const char *file, int line)
 {
+	if (!host_key_maybe (HOST_KEY_UID, data, len))
+		return 0;
 	return host_hash_lookup (hp, host_uid_hash, data, len, file, line);
 }
 
@@ -699,7 +938,18 @@ find_hosts_by_option(struct host_decl **hp,
 
 		oc = lookup_option(p->option->universe,
 				   relay_state, p->option->code);
-		if (oc != NULL) {
+		if ((oc != NULL) && (oc->data.len != 0)) {
+			/* Options from the packet are already data, so
+			 * they can be looked up without making a copy.
+			 */
+			if (host_key_maybe(HOST_KEY_OPTION(p),
+					   oc->data.data, oc->data.len) &&
+			    host_hash_lookup(hp, p->values_hash,
+					     oc->data.data, oc->data.len,
+					     file, line)) {
+				return 1;
+			}
+		} else if (oc != NULL) {
 			memset(&data, 0, sizeof(data));
 
 			if (!evaluate_option_cache(&data, relay_packet, NULL,
@@ -710,7 +960,9 @@ find_hosts_by_option(struct host_decl **hp,
 				return 0;
 			}
 
-			found = host_hash_lookup(hp, p->values_hash,
+			found = host_key_maybe(HOST_KEY_OPTION(p),
+					       data.data, data.len) &&
+				host_hash_lookup(hp, p->values_hash,
 						 data.data, data.len,
 						 file, line);
 
@@ -778,11 +1030,296 @@ int find_host_for_network (struct subnet **sp, struct host_decl **host,
 	return 0;
 }
 
-void new_address_range (cfile, low, high, subnet, pool, lpchain)
+/* Fill in a lease for the given host number of an address range. */
+
+static void init_range_lease(struct lease *lp, struct subnet *subnet,
+			     struct pool *pool, unsigned host)
+{
+	lp->ip_addr = ip_addr(subnet->net, subnet->netmask, host);
+	lp->starts = MIN_TIME;
+	lp->ends = MIN_TIME;
+	subnet_reference(&lp->subnet, subnet, MDL);
+	pool_reference(&lp->pool, pool, MDL);
+	lp->binding_state = FTS_FREE;
+	lp->next_binding_state = FTS_FREE;
+	lp->rewind_binding_state = FTS_FREE;
+	lp->flags = 0;
+}
+
+static u_int32_t sparse_addr(struct iaddr addr)
+{
+	u_int32_t a;
+
+	memcpy(&a, addr.iabuf, sizeof(a));
+	return ntohl(a);
+}
+
+static int sparse_range_cmp(const void *a, const void *b)
+{
+	const struct sparse_range *ra = *(const struct sparse_range **)a;
+	const struct sparse_range *rb = *(const struct sparse_range **)b;
+
+	if (ra->first != rb->first)
+		return (ra->first < rb->first) ? -1 : 1;
+	return 0;
+}
+
+static int sparse_index_build(void)
+{
+	struct sparse_range *range;
+	struct sparse_range **index;
+	u_int32_t reach = 0;
+	unsigned count = 0, i;
+
+	for (range = sparse_ranges; range != NULL; range = range->next)
+		count++;
+	if (count > sparse_index_max) {
+		index = dmalloc(count * sizeof(*index), MDL);
+		if (index == NULL)
+			return 0;
+		if (sparse_index != NULL)
+			dfree(sparse_index, MDL);
+		sparse_index = index;
+		sparse_index_max = count;
+	}
+
+	i = 0;
+	for (range = sparse_ranges; range != NULL; range = range->next)
+		sparse_index[i++] = range;
+	qsort(sparse_index, count, sizeof(*sparse_index), sparse_range_cmp);
+
+	/* Ranges declared over each other are warned about but allowed,
+	 * so remember the furthest any range so far reaches. */
+	for (i = 0; i < count; i++) {
+		if (sparse_index[i]->last > reach)
+			reach = sparse_index[i]->last;
+		sparse_index[i]->reach = reach;
+	}
+
+	sparse_index_count = count;
+	sparse_index_stale = 0;
+	return 1;
+}
+
+/* Check whether an address of a sparse range has a lease yet. */
+
+static int sparse_range_unused(struct sparse_range *range, u_int32_t a)
+{
+	unsigned bit = a - range->first;
+
+	return !(range->used[bit / 8] & (1 << (bit % 8)));
+}
+
+/* Find the sparse range an address belongs to, if it has no lease yet. */
+
+static struct sparse_range *find_sparse_range(struct iaddr addr,
+					      unsigned *hostp)
+{
+	struct sparse_range *range;
+	u_int32_t a;
+	unsigned lo, hi, mid;
+
+	if ((sparse_ranges == NULL) || (addr.len != 4))
+		return NULL;
+	a = sparse_addr(addr);
+
+	if (sparse_index_stale && !sparse_index_build()) {
+		/* No memory for the index, look through them all. */
+		for (range = sparse_ranges; range != NULL;
+		     range = range->next) {
+			if ((a >= range->first) && (a <= range->last) &&
+			    sparse_range_unused(range, a)) {
+				*hostp = range->min + (a - range->first);
+				return range;
+			}
+		}
+		return NULL;
+	}
+
+	/* Find the ranges that start at or below the address, then look
+	 * back through those that reach it. */
+	lo = 0;
+	hi = sparse_index_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sparse_index[mid]->first <= a)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	while ((lo-- > 0) && (sparse_index[lo]->reach >= a)) {
+		range = sparse_index[lo];
+		if ((a <= range->last) && sparse_range_unused(range, a)) {
+			*hostp = range->min + (a - range->first);
+			return range;
+		}
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Find the pool of a sparse range address with no lease yet
+ *
+ * \param addr the address
+ * \return the pool, not referenced, or NULL if the address has a lease
+ * or isn't in a sparse range
+ */
+struct pool *sparse_range_pool(struct iaddr addr)
+{
+	struct sparse_range *range;
+	unsigned host;
+
+	range = find_sparse_range(addr, &host);
+	return (range != NULL) ? range->pool : NULL;
+}
+
+/* Make the lease for a host number of a sparse range that doesn't have
+ * one yet.  It starts out free, like the leases of any other range. */
+
+static int sparse_range_lease(struct lease **lp, struct sparse_range *range,
+			      unsigned host, const char *file, int line)
+{
+	struct lease *lease = NULL;
+	isc_result_t status;
+	unsigned bit = host - range->min;
+
+	status = lease_allocate(&lease, file, line);
+	if (status != ISC_R_SUCCESS) {
+		log_error("No memory for lease %s: %s",
+			  piaddr(ip_addr(range->subnet->net,
+					 range->subnet->netmask, host)),
+			  isc_result_totext(status));
+		return 0;
+	}
+	init_range_lease(lease, range->subnet, range->pool, host);
+
+	range->used[bit / 8] |= 1 << (bit % 8);
+	range->left--;
+	range->pool->sparse_leases--;
+
+	lease_ip_hash_add(lease_ip_addr_hash, lease->ip_addr.iabuf,
+			  lease->ip_addr.len, lease, MDL);
+	if (sparse_ranges_queued) {
+		/* It was already counted as free. */
+		range->pool->free_leases--;
+		lease_enqueue(lease);
+	}
+#if defined (OMAPI_QUERY_THREAD)
+	omapi_query_lease(lease);
+#endif
+
+	lease_reference(lp, lease, file, line);
+	lease_dereference(&lease, MDL);
+	return 1;
+}
+
+/* Record a sparse address range.  Addresses that already have a lease,
+ * from a range declared earlier, stay with that lease. */
+
+static void new_sparse_range(struct parse *cfile, struct subnet *subnet,
+			     struct pool *pool, unsigned min, unsigned max)
+{
+	struct sparse_range *range;
+	struct lease *lt = NULL;
+	struct iaddr addr;
+	unsigned host, bit, other;
+
+	range = dmalloc(sizeof(*range), MDL);
+	if (range != NULL)
+		range->used = dmalloc((max - min) / 8 + 1, MDL);
+	if ((range == NULL) || (range->used == NULL))
+		log_fatal("No memory for sparse address range %s-%s.",
+			  piaddr(ip_addr(subnet->net, subnet->netmask, min)),
+			  piaddr(ip_addr(subnet->net, subnet->netmask, max)));
+	subnet_reference(&range->subnet, subnet, MDL);
+	pool_reference(&range->pool, pool, MDL);
+	range->min = min;
+	range->max = max;
+	range->first = sparse_addr(ip_addr(subnet->net, subnet->netmask, min));
+	range->last = range->first + (max - min);
+	range->left = max - min + 1;
+
+	host = min;
+	do {
+		addr = ip_addr(subnet->net, subnet->netmask, host);
+		bit = host - min;
+		if (lease_ip_hash_lookup(&lt, lease_ip_addr_hash,
+					 addr.iabuf, addr.len, MDL)) {
+			if (lt->pool) {
+				parse_warn(cfile, "lease %s is declared twice!",
+					   piaddr(addr));
+			} else
+				pool_reference(&lt->pool, pool, MDL);
+			lease_dereference(&lt, MDL);
+			range->used[bit / 8] |= 1 << (bit % 8);
+			range->left--;
+		} else if (find_sparse_range(addr, &other) != NULL) {
+			parse_warn(cfile, "lease %s is declared twice!",
+				   piaddr(addr));
+			range->used[bit / 8] |= 1 << (bit % 8);
+			range->left--;
+		}
+	} while (host++ != max);
+
+	pool->sparse_leases += range->left;
+	range->pool_next = pool->sparse;
+	pool->sparse = range;
+	range->next = sparse_ranges;
+	sparse_ranges = range;
+	sparse_index_stale = 1;
+}
+
+/* Make a lease for the next never used address of the pool's sparse
+ * ranges, if there is one left. */
+
+int sparse_range_allocate(struct lease **lp, struct pool *pool,
+			  const char *file, int line)
+{
+	struct sparse_range *range;
+	unsigned bit;
+
+	for (range = pool->sparse; range != NULL; range = range->pool_next) {
+		if (range->left == 0)
+			continue;
+
+		/* Whole bytes first, there is a clear bit before max. */
+		bit = range->hint;
+		while (range->used[bit / 8] == 0xff)
+			bit = (bit & ~7) + 8;
+		while (range->used[bit / 8] & (1 << (bit % 8)))
+			bit++;
+		range->hint = bit;
+
+		return sparse_range_lease(lp, range, range->min + bit,
+					  file, line);
+	}
+	return 0;
+}
+
+/* Return the lease allocate_lease() should consider from a pool's free
+ * queue.  A never used address of a sparse range comes before any lease
+ * that has been used, as a new lease would on the queue. */
+
+struct lease *first_free_lease(struct pool *pool)
+{
+	struct lease *lp = LEASE_GET_FIRST(pool->free);
+	struct lease *lt = NULL;
+
+	if ((pool->sparse_leases > 0) &&
+	    ((lp == NULL) || (lp->ends > MIN_TIME)) &&
+	    sparse_range_allocate(&lt, pool, MDL)) {
+		lease_dereference(&lt, MDL);
+		lp = LEASE_GET_FIRST(pool->free);
+	}
+	return lp;
+}
+
+void new_address_range (cfile, low, high, subnet, pool, sparse, lpchain)
 	struct parse *cfile;
 	struct iaddr low, high;
 	struct subnet *subnet;
 	struct pool *pool;
+	int sparse;
 	struct lease **lpchain;
 {
 #if defined(COMPACT_LEASES)
@@ -854,6 +1391,12 @@ void new_address_range (cfile, low, high, subnet, pool, lpchain)
 	pool->lease_count += num_addrs;
 #endif
 
+	/* A sparse range gets its leases as they are needed. */
+	if (sparse) {
+		new_sparse_range(cfile, subnet, pool, min, max);
+		return;
+	}
+
 	/* Get a lease structure for each address in the range. */
 #if defined (COMPACT_LEASES)
 	s = (num_addrs + 1) * sizeof (struct lease);
@@ -894,18 +1437,10 @@ void new_address_range (cfile, low, high, subnet, pool, lpchain)
 						    i + min)),
 				   isc_result_totext (status));
 #endif
-		lp->ip_addr = ip_addr(subnet->net, subnet->netmask, i + min);
-		lp->starts = MIN_TIME;
-		lp->ends = MIN_TIME;
-		subnet_reference(&lp->subnet, subnet, MDL);
-		pool_reference(&lp->pool, pool, MDL);
-		lp->binding_state = FTS_FREE;
-		lp->next_binding_state = FTS_FREE;
-		lp->rewind_binding_state = FTS_FREE;
-		lp->flags = 0;
+		init_range_lease(lp, subnet, pool, i + min);
 
 		/* Remember the lease in the IP address hash. */
-		if (find_lease_by_ip_addr (&lt, lp -> ip_addr, MDL)) {
+		if (find_or_make_lease_by_ip_addr (&lt, lp -> ip_addr, MDL)) {
 			if (lt -> pool) {
 				parse_warn (cfile,
 					    "lease %s is declared twice!",
@@ -1113,7 +1648,7 @@ void enter_lease (lease)
 {
 	struct lease *comp = (struct lease *)0;
 
-	if (find_lease_by_ip_addr (&comp, lease -> ip_addr, MDL)) {
+	if (find_or_make_lease_by_ip_addr (&comp, lease -> ip_addr, MDL)) {
 		if (!comp -> pool) {
 			log_error ("undeclared lease found in database: %s",
 				   piaddr (lease -> ip_addr));
@@ -1269,10 +1804,11 @@ int supersede_lease (comp, lease, commit, propogate, pimmediate, from_pool)
 		   affirmatively associated with a client. */
 		if (lease -> next_binding_state == FTS_ACTIVE ||
 		    lease -> next_binding_state == FTS_EXPIRED)
-			option_chain_head_reference (&comp -> agent_options,
-						     lease -> agent_options,
-						     MDL);
-		option_chain_head_dereference (&lease -> agent_options, MDL);
+			option_chain_head_reference
+				(&comp -> agent_options,
+				 lease -> agent_options, MDL);
+		option_chain_head_dereference (&lease -> agent_options,
+					       MDL);
 	}
 
 	/* Record the hostname information in the lease. */
@@ -1330,8 +1866,8 @@ int supersede_lease (comp, lease, commit, propogate, pimmediate, from_pool)
 	 * old pointer with a new one as the old transaction
 	 * should have been cancelled before getting here.
 	 */
-	if (lease->ddns_cb != NULL)
-		comp->ddns_cb = lease->ddns_cb;
+	if (LEASE_COLD(lease, ddns_cb) != NULL)
+		lease_cold(comp)->ddns_cb = lease->cold->ddns_cb;
 
       just_move_it:
 #if defined (FAILOVER_PROTOCOL)
@@ -1422,6 +1958,10 @@ int supersede_lease (comp, lease, commit, propogate, pimmediate, from_pool)
 	if (!lease_enqueue (comp))
 		return 0;
 
+#if defined (OMAPI_QUERY_THREAD)
+	omapi_query_lease (comp);
+#endif
+
 	/* If this is the next lease that will timeout on the pool,
 	   zap the old timeout and set the timeout on this pool to the
 	   time that the lease's next event will happen.
@@ -1480,8 +2020,10 @@ int supersede_lease (comp, lease, commit, propogate, pimmediate, from_pool)
 		if (!dhcp_failover_queue_update (comp, pimmediate))
 			return 0;
 	}
-	if (do_pool_check && comp->pool->failover_peer)
+	if (do_pool_check && comp->pool->failover_peer) {
 		dhcp_failover_pool_check(comp->pool);
+		dhcp_failover_pool_track(comp->pool);
+	}
 #endif
 
 	/* If the current binding state has already expired and we haven't
@@ -1548,8 +2090,8 @@ void make_binding_state_transition (struct lease *lease)
 		if (lease->billing_class)
 			unbill_class(lease);
 		if (lease -> agent_options)
-			option_chain_head_dereference (&lease -> agent_options,
-						       MDL);
+			option_chain_head_dereference
+				(&lease -> agent_options, MDL);
 		if (lease -> client_hostname) {
 			dfree (lease -> client_hostname, MDL);
 			lease -> client_hostname = (char *)0;
@@ -1612,8 +2154,8 @@ void make_binding_state_transition (struct lease *lease)
 		if (lease->billing_class)
 			unbill_class(lease);
 		if (lease -> agent_options)
-			option_chain_head_dereference (&lease -> agent_options,
-						       MDL);
+			option_chain_head_dereference
+				(&lease -> agent_options, MDL);
 		if (lease -> client_hostname) {
 			dfree (lease -> client_hostname, MDL);
 			lease -> client_hostname = (char *)0;
@@ -1675,6 +2217,20 @@ void make_binding_state_transition (struct lease *lease)
 #endif
 }
 
+/* Return the cold part of a lease, allocating it if the lease doesn't
+   have one yet.   Callers are about to set one of its fields, so there's
+   nothing sensible to do if we can't get the memory. */
+struct lease_cold *lease_cold (struct lease *lease)
+{
+	if (lease -> cold == NULL) {
+		lease -> cold = dmalloc (sizeof (struct lease_cold), MDL);
+		if (lease -> cold == NULL)
+			log_fatal ("No memory for lease %s.",
+				   piaddr (lease -> ip_addr));
+	}
+	return lease -> cold;
+}
+
 /* Copy the contents of one lease into another, correctly maintaining
    reference counts. */
 int lease_copy (struct lease **lp,
@@ -1909,6 +2465,190 @@ void dissociate_lease (lease)
 }
 #endif
 
+/* Leases are expired in slices, so that a large block of them falling
+ * due together doesn't hold up packet service.  A timer routine that
+ * expires leases starts a slice with expiry_slice_begin() and checks
+ * expiry_slice_over() after each lease.  When the slice is used up it
+ * stops and puts the pool on the expiry backlog, which expiry_backlog_run()
+ * works through one slice at a time from a timer set to go off right away,
+ * so packets that arrived meanwhile get handled between slices.  The pool
+ * with the fewest addresses left goes first.
+ *
+ * Other long jobs, such as failover pool balancing, use the same limits
+ * with a work_slice of their own. */
+
+static struct work_slice expiry_slice;
+
+struct expiry_backlog {
+	struct expiry_backlog *next;
+	void (*expire) (void *);
+	void *pool;
+	tvunref_t unref;
+	int pressure;		/* addresses in use, per mille */
+	TIME due;		/* when the oldest lease left over fell due */
+};
+
+static struct expiry_backlog *expiry_backlog;
+static TIME expiry_report_next;
+
+#define EXPIRY_REPORT_INTERVAL 60
+
+void work_slice_begin (slice)
+	struct work_slice *slice;
+{
+	slice -> count = 0;
+	gettimeofday (&slice -> start, NULL);
+}
+
+/* Count a lease against a slice, and return nonzero if that uses it up.
+   Looking at the clock costs a system call, so only do it every so
+   often. */
+int work_slice_over (slice)
+	struct work_slice *slice;
+{
+	struct timeval now;
+	long usecs;
+
+	slice -> count++;
+	if (expiry_slice_leases > 0 &&
+	    slice -> count >= expiry_slice_leases)
+		return 1;
+	if (expiry_slice_usecs <= 0 || (slice -> count % 16) != 0)
+		return 0;
+
+	gettimeofday (&now, NULL);
+	usecs = (now.tv_sec - slice -> start.tv_sec) * 1000000 +
+		(now.tv_usec - slice -> start.tv_usec);
+	return usecs >= expiry_slice_usecs;
+}
+
+void expiry_slice_begin ()
+{
+	work_slice_begin (&expiry_slice);
+}
+
+int expiry_slice_over ()
+{
+	return work_slice_over (&expiry_slice);
+}
+
+/* Put a pool whose slice ran out on the backlog.   expire is the timer
+   routine to call for the next slice; the backlog holds a reference to
+   the pool until then. */
+void expiry_backlog_add (expire, pool, ref, unref, pressure, due)
+	void (*expire) (void *);
+	void *pool;
+	tvref_t ref;
+	tvunref_t unref;
+	int pressure;
+	TIME due;
+{
+	struct expiry_backlog *eb;
+	struct timeval tv;
+
+	for (eb = expiry_backlog; eb; eb = eb -> next) {
+		if (eb -> pool == pool && eb -> expire == expire) {
+			eb -> pressure = pressure;
+			if (due < eb -> due)
+				eb -> due = due;
+			return;
+		}
+	}
+
+	eb = dmalloc (sizeof *eb, MDL);
+	if (!eb)
+		log_fatal ("No memory for expiry backlog.");
+	eb -> expire = expire;
+	eb -> pool = NULL;
+	(*ref) (&eb -> pool, pool, MDL);
+	eb -> unref = unref;
+	eb -> pressure = pressure;
+	eb -> due = due;
+	eb -> next = expiry_backlog;
+	expiry_backlog = eb;
+
+	tv = cur_tv;
+	add_timeout (&tv, expiry_backlog_run, NULL, NULL, NULL);
+}
+
+/* Return the number of pools on the expiry backlog, and if there are any
+   and oldest isn't null, when the oldest lease waiting fell due. */
+int expiry_backlog_gauge (oldest)
+	TIME *oldest;
+{
+	struct expiry_backlog *eb;
+	int count = 0;
+
+	for (eb = expiry_backlog; eb; eb = eb -> next) {
+		if (oldest && (count == 0 || eb -> due < *oldest))
+			*oldest = eb -> due;
+		count++;
+	}
+	return count;
+}
+
+static void expiry_backlog_report ()
+{
+	TIME oldest = cur_time;
+	int count;
+
+	count = expiry_backlog_gauge (&oldest);
+	if (count == 0) {
+		if (expiry_report_next != 0)
+			log_info ("Expiry backlog cleared.");
+		expiry_report_next = 0;
+		return;
+	}
+
+	if (cur_time < expiry_report_next)
+		return;
+	log_info ("Expiry backlog: %d pool%s waiting, oldest lease "
+		  "due %ld seconds ago.", count, count == 1 ? "" : "s",
+		  (long)(cur_time - oldest));
+	expiry_report_next = cur_time + EXPIRY_REPORT_INTERVAL;
+}
+
+/* Run the next slice from the backlog, for the pool under the most
+   pressure.   If that doesn't clear the backlog, come back right away. */
+void expiry_backlog_run (vp)
+	void *vp;
+{
+	struct expiry_backlog *eb, **ebp, **best = NULL;
+	struct timeval tv;
+
+	for (ebp = &expiry_backlog; *ebp; ebp = &(*ebp) -> next) {
+		if (!best || (*ebp) -> pressure > (*best) -> pressure ||
+		    ((*ebp) -> pressure == (*best) -> pressure &&
+		     (*ebp) -> due < (*best) -> due))
+			best = ebp;
+	}
+	if (!best)
+		return;
+
+	eb = *best;
+	*best = eb -> next;
+	(*eb -> expire) (eb -> pool);
+	(*eb -> unref) (&eb -> pool, MDL);
+	dfree (eb, MDL);
+
+	expiry_backlog_report ();
+	if (expiry_backlog) {
+		tv = cur_tv;
+		add_timeout (&tv, expiry_backlog_run, NULL, NULL, NULL);
+	}
+}
+
+/* Addresses in use in a pool, per mille, for ordering the backlog. */
+static int pool_pressure (pool)
+	struct pool *pool;
+{
+	if (pool -> lease_count <= 0)
+		return 0;
+	return 1000 - (int)(((double)(pool -> free_leases +
+				      pool -> backup_leases) * 1000) /
+			    pool -> lease_count);
+}
+
 /* Timer called when a lease in a particular pool expires. */
 void pool_timer (vpool)
 	void *vpool;
@@ -1925,10 +2665,12 @@ void pool_timer (vpool)
 #define RESERVED_LEASES 5
 	LEASE_STRUCT_PTR lptr[RESERVED_LEASES+1];
 	TIME next_expiry = MAX_TIME;
+	TIME backlog = MAX_TIME;
 	int i;
 	struct timeval tv;
 
 	pool = (struct pool *)vpool;
+	expiry_slice_begin ();
 
 	lptr[FREE_LEASES] = &pool->free;
 	lptr[ACTIVE_LEASES] = &pool->active;
@@ -1937,7 +2679,7 @@ void pool_timer (vpool)
 	lptr[BACKUP_LEASES] = &pool->backup;
 	lptr[RESERVED_LEASES] = &pool->reserved;
 
-	for (i = FREE_LEASES; i <= RESERVED_LEASES; i++) {
+	for (i = FREE_LEASES; i <= RESERVED_LEASES && backlog == MAX_TIME; i++) {
 		/* If there's nothing on the queue, skip it. */
 		if (!(LEASE_NOT_EMPTYP(lptr[i])))
 			continue;
@@ -2015,6 +2757,15 @@ void pool_timer (vpool)
 						   lease->rewind_binding_state;
 #endif
 				supersede_lease(lease, NULL, 1, 1, 1, 1);
+
+				/* Leave the rest for another slice if
+				   this one is used up. */
+				if (expiry_slice_over() && next &&
+				    next->sort_time <= cur_time) {
+					backlog = next->sort_time;
+					lease_dereference(&lease, MDL);
+					break;
+				}
 			}
 
 			lease_dereference(&lease, MDL);
@@ -2027,6 +2778,17 @@ void pool_timer (vpool)
 			lease_dereference(&lease, MDL);
 	}
 
+	/* If the slice ran out, the backlog will run this again.  Until
+	 * then any lease that falls due sets the timer as usual.
+	 */
+	if (backlog != MAX_TIME) {
+		pool->next_event_time = MIN_TIME;
+		expiry_backlog_add(pool_timer, pool, (tvref_t)pool_reference,
+				   (tvunref_t)pool_dereference,
+				   pool_pressure(pool), backlog);
+		return;
+	}
+
 	/* If we found something to expire and its expiration time
 	 * is either less than the current expiration time or the
 	 * current expiration time is already expired update the
@@ -2055,6 +2817,27 @@ int find_lease_by_ip_addr (struct lease **lp, struct iaddr addr,
 				    addr.len, file, line);
 }
 
+/* Locate the lease for an IP address that is about to be offered to a
+ * client, or that a binding is being recorded for.  If it's a never used
+ * address of a sparse range its lease is made, free, as the lease of any
+ * other range would be.  Callers that only look at the lease use
+ * find_lease_by_ip_addr(), which never makes one. */
+
+int find_or_make_lease_by_ip_addr (struct lease **lp, struct iaddr addr,
+				   const char *file, int line)
+{
+	struct sparse_range *range;
+	unsigned host;
+
+	if (find_lease_by_ip_addr(lp, addr, file, line))
+		return 1;
+
+	range = find_sparse_range(addr, &host);
+	if (range == NULL)
+		return 0;
+	return sparse_range_lease(lp, range, host, file, line);
+}
+
 int find_lease_by_uid (struct lease **lp, const unsigned char *uid,
 		       unsigned len, const char *file, int line)
 {
@@ -2539,7 +3322,7 @@ int write_leases ()
 #if !defined (BINARY_LEASES)
 /* Unlink all the leases in the queue. */
 void lease_remove_all(struct lease **lq) {
-	struct lease *lp, *ln = NULL;
+	struct lease *lp = NULL, *ln = NULL;
 
 	/* nothing to do */
 	if (*lq == NULL)
@@ -2691,6 +3474,10 @@ int lease_enqueue (struct lease *comp)
 		} else {
 			lq = &comp->pool->free;
 			comp->pool->free_leases++;
+#if defined (FAILOVER_PROTOCOL)
+			if (comp->pool->failover_peer)
+				dhcp_failover_pool_track(comp->pool);
+#endif
 		}
 		comp -> sort_time = comp -> ends;
 		break;
@@ -2738,6 +3525,10 @@ int lease_enqueue (struct lease *comp)
 		} else {
 			lq = &comp->pool->backup;
 			comp->pool->backup_leases++;
+#if defined (FAILOVER_PROTOCOL)
+			if (comp->pool->failover_peer)
+				dhcp_failover_pool_track(comp->pool);
+#endif
 		}
 		comp -> sort_time = comp -> ends;
 		break;
@@ -2826,12 +3617,10 @@ lease_instantiate(const void *key, unsigned len, void *object)
 	return ISC_R_SUCCESS;
 }
 
-/* Run expiry events on every pool.   This is called on startup so that
-   any expiry events that occurred after the server stopped and before it
-   was restarted can be run.   At the same time, if failover support is
-   compiled in, we compute the balance of leases for the pool. */
+/* Run expiry on each pool and count its leases, once they've all been
+   put on their queues. */
 
-void expire_all_pools ()
+static void start_all_pools ()
 {
 	struct shared_network *s;
 	struct pool *p;
@@ -2839,44 +3628,6 @@ void expire_all_pools ()
 	struct lease *l;
 	LEASE_STRUCT_PTR lptr[RESERVED_LEASES+1];
 
-	/* Indicate that we are in the startup phase */
-	server_starting = SS_NOSYNC | SS_QFOLLOW;
-
-#if defined (BINARY_LEASES)
-	/* set up the growth factors for the binary leases.
-	 * We use 100% for free, 50% for active and backup
-	 * 20% for expired, abandoned and reserved
-	 * but no less than 100, 50, and 20.
-	 */
-	for (s = shared_networks; s; s = s -> next) {
-	    for (p = s -> pools; p != NULL; p = p -> next) {
-		size_t num_f = 100, num_a = 50, num_e = 20;
-		if (p->lease_count > 100) {
-		    num_f = p->lease_count;
-		    num_a = num_f / 2;
-		    num_e = num_f / 5;
-		}
-		lc_init_growth(&p->free, num_f);
-		lc_init_growth(&p->active, num_a);
-		lc_init_growth(&p->expired, num_a);
-		lc_init_growth(&p->abandoned, num_e);
-		lc_init_growth(&p->backup, num_e);
-		lc_init_growth(&p->reserved, num_e);
-	    }
-	}
-#endif
-
-	/* First, go over the hash list and actually put all the leases
-	   on the appropriate lists. */
-	lease_ip_hash_foreach(lease_ip_addr_hash, lease_instantiate);
-
-	/* Loop through each pool in each shared network and call the
-	 * expiry routine on the pool.  It is no longer safe to follow
-	 * the queue insertion point, as expiration of a lease can move
-	 * it between queues (and this may be the lease that function
-	 * points at).
-	 */
-	server_starting &= ~SS_QFOLLOW;
 	for (s = shared_networks; s; s = s -> next) {
 	    for (p = s -> pools; p; p = p -> next) {
 		pool_timer (p);
@@ -2922,13 +3673,381 @@ void expire_all_pools ()
 #endif
 		    }
 		}
+
+		/* Addresses of sparse ranges with no lease are free. */
+		p->lease_count += p->sparse_leases;
+		p->free_leases += p->sparse_leases;
 	    }
 	}
+}
+
+/* Run expiry events on every pool.   This is called on startup so that
+   any expiry events that occurred after the server stopped and before it
+   was restarted can be run.   At the same time, if failover support is
+   compiled in, we compute the balance of leases for the pool. */
+
+void expire_all_pools ()
+{
+	/* Indicate that we are in the startup phase */
+	server_starting = SS_NOSYNC | SS_QFOLLOW;
+
+	/* First, go over the hash list and actually put all the leases
+	   on the appropriate lists. */
+	lease_ip_hash_foreach(lease_ip_addr_hash, lease_instantiate);
+	sparse_ranges_queued = 1;
+
+	/* Loop through each pool in each shared network and call the
+	 * expiry routine on the pool.  It is no longer safe to follow
+	 * the queue insertion point, as expiration of a lease can move
+	 * it between queues (and this may be the lease that function
+	 * points at).
+	 */
+	server_starting &= ~SS_QFOLLOW;
+	start_all_pools ();
 
 	/* turn off startup phase */
 	server_starting = 0;
 }
 
+/* Exchange the running configuration with the one in *cs. */
+
+void config_state_swap (struct config_state *cs)
+{
+	struct config_state tmp;
+
+	tmp.root_group = root_group;
+	tmp.shared_networks = shared_networks;
+	tmp.subnets = subnets;
+	tmp.classes = default_collection.classes;
+	tmp.host_hw_addr_hash = host_hw_addr_hash;
+	tmp.host_uid_hash = host_uid_hash;
+	tmp.host_name_hash = host_name_hash;
+	tmp.host_id_info = host_id_info;
+	tmp.lease_ip_addr_hash = lease_ip_addr_hash;
+	tmp.sparse_ranges = sparse_ranges;
+	tmp.sparse_ranges_queued = sparse_ranges_queued;
+
+	root_group = cs -> root_group;
+	shared_networks = cs -> shared_networks;
+	subnets = cs -> subnets;
+	default_collection.classes = cs -> classes;
+	host_hw_addr_hash = cs -> host_hw_addr_hash;
+	host_uid_hash = cs -> host_uid_hash;
+	host_name_hash = cs -> host_name_hash;
+	host_id_info = cs -> host_id_info;
+	lease_ip_addr_hash = cs -> lease_ip_addr_hash;
+	sparse_ranges = cs -> sparse_ranges;
+	sparse_ranges_queued = cs -> sparse_ranges_queued;
+	sparse_index_stale = 1;
+	host_key_stale = 1;
+	host_key_disabled = 0;
+
+	*cs = tmp;
+}
+
+/* The configuration being replaced, while config_state_merge() moves its
+   leases into the new one, and what happened to them. */
+static struct config_state *merge_from;
+static int merge_kept, merge_fresh, merge_dropped;
+
+/* Find the class a lease billed to the given class of the old configuration
+   is to be billed to in the new one. */
+
+static int rebill_class (struct class **cp, struct class *old)
+{
+	struct class *super = (struct class *)0;
+	int found;
+
+	if (!old -> superclass) {
+		if (!old -> name)
+			return 0;
+		return find_class (cp, old -> name, MDL) == ISC_R_SUCCESS;
+	}
+
+	if (!old -> superclass -> name)
+		return 0;
+	if (find_class (&super, old -> superclass -> name, MDL) !=
+	    ISC_R_SUCCESS)
+		return 0;
+	found = super -> hash &&
+		class_hash_lookup (cp, super -> hash,
+				   (const char *)old -> hash_string.data,
+				   old -> hash_string.len, MDL);
+	if (!found && super -> spawning)
+		found = spawn_subclass (cp, super, &old -> hash_string);
+	class_dereference (&super, MDL);
+	return found;
+}
+
+/* Put a lease of the old configuration that has been given its new pool
+   and subnet on the right queue, and move its billing to the new classes.
+   It is already in the uid and hardware address hashes. */
+
+static void lease_reattach (struct lease *lease)
+{
+	struct class *class = (struct class *)0;
+
+	if (!lease_enqueue (lease))
+		return;
+
+	if (!lease -> billing_class)
+		return;
+	rebill_class (&class, lease -> billing_class);
+	unbill_class (lease);
+	if (class && (lease -> binding_state == FTS_ACTIVE ||
+		      lease -> binding_state == FTS_EXPIRED ||
+		      lease -> binding_state == FTS_RELEASED ||
+		      lease -> binding_state == FTS_RESET))
+		bill_class (lease, class);
+	if (class)
+		class_dereference (&class, MDL);
+}
+
+/* For each lease of the new configuration, use the lease the old one has
+   for the same address if there is one, in the new lease's pool. */
+
+static isc_result_t lease_reparent (const void *key, unsigned len,
+				    void *object)
+{
+	struct lease *lp = (struct lease *)0;
+	struct lease *lt = (struct lease *)0;
+
+	if (!lease_ip_hash_lookup (&lt, merge_from -> lease_ip_addr_hash,
+				   key, len, MDL) ||
+	    !((struct lease *)object) -> pool) {
+		if (lt)
+			lease_dereference (&lt, MDL);
+		merge_fresh++;
+		return lease_instantiate (key, len, object);
+	}
+
+	lease_reference (&lp, object, MDL);
+	if (lt -> pool)
+		pool_dereference (&lt -> pool, MDL);
+	pool_reference (&lt -> pool, lp -> pool, MDL);
+	if (lt -> subnet)
+		subnet_dereference (&lt -> subnet, MDL);
+	if (lp -> subnet)
+		subnet_reference (&lt -> subnet, lp -> subnet, MDL);
+
+	lease_ip_hash_delete (merge_from -> lease_ip_addr_hash,
+			      lt -> ip_addr.iabuf, lt -> ip_addr.len, MDL);
+	lease_ip_hash_delete (lease_ip_addr_hash,
+			      lp -> ip_addr.iabuf, lp -> ip_addr.len, MDL);
+	lease_ip_hash_add (lease_ip_addr_hash,
+			   lt -> ip_addr.iabuf, lt -> ip_addr.len, lt, MDL);
+	lease_dereference (&lp, MDL);
+
+	lease_reattach (lt);
+	lease_dereference (&lt, MDL);
+	merge_kept++;
+	return ISC_R_SUCCESS;
+}
+
+/* An old lease whose address has no lease in the new configuration is
+   kept if a sparse range of the new configuration covers the address, and
+   otherwise forgotten, just as it would be on a restart. */
+
+static isc_result_t lease_orphan (const void *key, unsigned len, void *object)
+{
+	struct lease *lt = object;
+	struct sparse_range *range;
+	unsigned host, bit;
+
+	range = find_sparse_range (lt -> ip_addr, &host);
+	if (range) {
+		bit = host - range -> min;
+		range -> used [bit / 8] |= 1 << (bit % 8);
+		range -> left--;
+		range -> pool -> sparse_leases--;
+
+		if (lt -> pool)
+			pool_dereference (&lt -> pool, MDL);
+		pool_reference (&lt -> pool, range -> pool, MDL);
+		if (lt -> subnet)
+			subnet_dereference (&lt -> subnet, MDL);
+		subnet_reference (&lt -> subnet, range -> subnet, MDL);
+		lease_ip_hash_add (lease_ip_addr_hash, lt -> ip_addr.iabuf,
+				   lt -> ip_addr.len, lt, MDL);
+		lease_reattach (lt);
+		merge_kept++;
+		return ISC_R_SUCCESS;
+	}
+
+	if (lt -> binding_state == FTS_ACTIVE)
+		log_info ("Lease %s is no longer in any pool: forgotten.",
+			  piaddr (lt -> ip_addr));
+	uid_hash_delete (lt);
+	hw_hash_delete (lt);
+	unbill_class (lt);
+	merge_dropped++;
+	return ISC_R_SUCCESS;
+}
+
+/* Move the leases of the configuration in *old into the running one, which
+   has just been read from the config file: a lease of the old configuration
+   replaces the new configuration's lease for the same address, keeping its
+   state, its place in the uid and hardware address hashes and its billing,
+   and goes on a queue of its new pool.  Then the new pools are started as
+   they would be by expire_all_pools(). */
+
+void config_state_merge (struct config_state *old,
+			 int *kept, int *fresh, int *dropped)
+{
+	struct shared_network *s;
+	struct pool *p;
+
+	/* Empty the old pools' queues so the leases can be queued again. */
+	for (s = old -> shared_networks; s; s = s -> next) {
+		for (p = s -> pools; p; p = p -> next) {
+			cancel_timeout (pool_timer, p);
+			POOL_DESTROYP(&p -> active);
+			POOL_DESTROYP(&p -> expired);
+			POOL_DESTROYP(&p -> free);
+			POOL_DESTROYP(&p -> backup);
+			POOL_DESTROYP(&p -> abandoned);
+			POOL_DESTROYP(&p -> reserved);
+		}
+	}
+
+	merge_from = old;
+	merge_kept = merge_fresh = merge_dropped = 0;
+
+	/* The queue insertion point isn't followed: it may be left over
+	   from a queue of a configuration that has since been freed. */
+	server_starting = SS_NOSYNC;
+	lease_ip_hash_foreach (lease_ip_addr_hash, lease_reparent);
+	lease_ip_hash_foreach (old -> lease_ip_addr_hash, lease_orphan);
+	sparse_ranges_queued = 1;
+
+	start_all_pools ();
+	server_starting = 0;
+
+	merge_from = (struct config_state *)0;
+	*kept = merge_kept;
+	*fresh = merge_fresh;
+	*dropped = merge_dropped;
+}
+
+/* Free a configuration that is no longer running.  The structures that
+   refer to each other are taken apart first; anything still holding a
+   reference (a lease being pinged, say) keeps what it refers to. */
+
+void config_state_release (struct config_state *cs)
+{
+	struct shared_network *s = (struct shared_network *)0;
+	struct shared_network *sn = (struct shared_network *)0;
+	struct subnet *n = (struct subnet *)0, *nn = (struct subnet *)0;
+	struct pool *p = (struct pool *)0, *pn = (struct pool *)0;
+	struct class *c = (struct class *)0, *cn = (struct class *)0;
+	struct sparse_range *range;
+	host_id_info_t *tmp;
+
+	if (cs -> host_hw_addr_hash)
+		host_free_hash_table (&cs -> host_hw_addr_hash, MDL);
+	if (cs -> host_uid_hash)
+		host_free_hash_table (&cs -> host_uid_hash, MDL);
+	if (cs -> host_name_hash)
+		host_free_hash_table (&cs -> host_name_hash, MDL);
+	while (cs -> host_id_info != NULL) {
+		option_dereference (&cs -> host_id_info -> option, MDL);
+		host_free_hash_table (&cs -> host_id_info -> values_hash, MDL);
+		tmp = cs -> host_id_info -> next;
+		dfree (cs -> host_id_info, MDL);
+		cs -> host_id_info = tmp;
+	}
+
+	while ((range = cs -> sparse_ranges) != NULL) {
+		cs -> sparse_ranges = range -> next;
+		subnet_dereference (&range -> subnet, MDL);
+		pool_dereference (&range -> pool, MDL);
+		dfree (range -> used, MDL);
+		dfree (range, MDL);
+	}
+	if (cs -> lease_ip_addr_hash)
+		lease_ip_free_hash_table (&cs -> lease_ip_addr_hash, MDL);
+
+	if (cs -> classes) {
+		class_reference (&cn, cs -> classes, MDL);
+		class_dereference (&cs -> classes, MDL);
+		while (cn) {
+			class_reference (&c, cn, MDL);
+			class_dereference (&cn, MDL);
+			if (c -> nic) {
+				class_reference (&cn, c -> nic, MDL);
+				class_dereference (&c -> nic, MDL);
+			}
+			if (c -> hash)
+				class_free_hash_table (&c -> hash, MDL);
+			class_dereference (&c, MDL);
+		}
+	}
+
+	if (cs -> subnets) {
+		subnet_reference (&nn, cs -> subnets, MDL);
+		subnet_dereference (&cs -> subnets, MDL);
+		while (nn) {
+			subnet_reference (&n, nn, MDL);
+			subnet_dereference (&nn, MDL);
+			if (n -> next_subnet) {
+				subnet_reference (&nn, n -> next_subnet, MDL);
+				subnet_dereference (&n -> next_subnet, MDL);
+			}
+			if (n -> next_sibling)
+				subnet_dereference (&n -> next_sibling, MDL);
+			if (n -> shared_network)
+				shared_network_dereference
+					(&n -> shared_network, MDL);
+			if (n -> interface)
+				interface_dereference (&n -> interface, MDL);
+			if (n -> group && n -> group -> subnet == n)
+				subnet_dereference (&n -> group -> subnet,
+						    MDL);
+			subnet_dereference (&n, MDL);
+		}
+	}
+
+	if (cs -> shared_networks) {
+		shared_network_reference (&sn, cs -> shared_networks, MDL);
+		shared_network_dereference (&cs -> shared_networks, MDL);
+		while (sn) {
+			shared_network_reference (&s, sn, MDL);
+			shared_network_dereference (&sn, MDL);
+			if (s -> next) {
+				shared_network_reference (&sn, s -> next, MDL);
+				shared_network_dereference (&s -> next, MDL);
+			}
+			if (s -> pools) {
+				pool_reference (&pn, s -> pools, MDL);
+				pool_dereference (&s -> pools, MDL);
+			}
+			while (pn) {
+				pool_reference (&p, pn, MDL);
+				pool_dereference (&pn, MDL);
+				if (p -> next) {
+					pool_reference (&pn, p -> next, MDL);
+					pool_dereference (&p -> next, MDL);
+				}
+				if (p -> shared_network)
+					shared_network_dereference
+						(&p -> shared_network, MDL);
+				pool_dereference (&p, MDL);
+			}
+			if (s -> subnets)
+				subnet_dereference (&s -> subnets, MDL);
+			if (s -> interface)
+				interface_dereference (&s -> interface, MDL);
+			if (s -> group && s -> group -> shared_network == s)
+				shared_network_dereference
+					(&s -> group -> shared_network, MDL);
+			shared_network_dereference (&s, MDL);
+		}
+	}
+
+	if (cs -> root_group)
+		group_dereference (&cs -> root_group, MDL);
+}
+
 void dump_subnets ()
 {
 	struct lease *l;
@@ -3028,7 +4147,13 @@ void free_everything(void)
 	if (dns_zone_hash)
 		dns_zone_free_hash_table (&dns_zone_hash, MDL);
 	dns_zone_hash = 0;
+	dns_zone_trie_free ();
 
+	if (host_key_bits != NULL)
+		dfree(host_key_bits, MDL);
+	host_key_bits = NULL;
+	host_key_stale = 1;
+	host_key_disabled = 0;
 	while (host_id_info != NULL) {
 		host_id_info_t *tmp;
 		option_dereference(&host_id_info->option, MDL);
@@ -3269,11 +4394,13 @@ void free_everything(void)
 	relinquish_free_expressions ();
 	relinquish_free_binding_values ();
 	relinquish_free_option_caches ();
+	relinquish_free_option_tables ();
 	relinquish_free_packets ();
 #if defined(COMPACT_LEASES)
 	relinquish_lease_hunks ();
 #endif
 	relinquish_hash_bucket_hunks ();
+	omapi_buffer_relinquish ();
 	omapi_type_relinquish ();
 }
 #endif /* DEBUG_MEMORY_LEAKAGE_ON_EXIT */
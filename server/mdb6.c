@@ -177,9 +177,6 @@
 #include "omapip/hash.h"
 #include <isc/md5.h>
 
-HASH_FUNCTIONS(ia, unsigned char *, struct ia_xx, ia_hash_t,
-	       ia_reference, ia_dereference, do_string_hash)
-
 ia_hash_t *ia_na_active;
 ia_hash_t *ia_ta_active;
 ia_hash_t *ia_pd_active;
@@ -340,6 +337,7 @@ ia_allocate(struct ia_xx **ia, u_int32_t iaid,
 	    const char *duid, unsigned int duid_len,
 	    const char *file, int line) {
 	struct ia_xx *tmp;
+	struct ia_key key;
 
 	if (ia == NULL) {
 		log_error("%s(%d): NULL pointer reference", file, line);
@@ -360,6 +358,8 @@ ia_allocate(struct ia_xx **ia, u_int32_t iaid,
 		dfree(tmp, file, line);
 		return ISC_R_NOMEMORY;
 	}
+	ia_key_init(&key, iaid, duid, duid_len);
+	tmp->hash = key.hash;
 
 	tmp->refcnt = 1;
 
@@ -582,6 +582,254 @@ ia_equal(const struct ia_xx *a, const struct ia_xx *b)
 	return ISC_TRUE;
 }
 
+/*
+ * IA tables.
+ *
+ * The active IAs of each type are kept in a chained hash table of
+ * their own rather than a generic omapip hash.  The table links the
+ * IAs themselves, and each IA carries the hash of its IAID and DUID,
+ * so a lookup compares hashes before it looks at any key bytes and
+ * nothing is allocated to add, find or remove one.
+ */
+
+#define IA_TABLE_MIN_SIZE	1024
+
+/*
+ * Hash an IAID and DUID.  The DUID is taken eight bytes at a time;
+ * the IAID is used as stored in iaid_duid, in host byte order.
+ */
+static isc_uint64_t
+ia_hash_bytes(u_int32_t iaid, const unsigned char *duid, unsigned len) {
+	isc_uint64_t h, w;
+
+	h = (0x9e3779b97f4a7c15ULL ^ len) + iaid;
+	while (len >= 8) {
+		memcpy(&w, duid, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 29;
+		duid += 8;
+		len -= 8;
+	}
+	w = 0;
+	memcpy(&w, duid, len);
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 32;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 29;
+	return h;
+}
+
+/*
+ * Make the key for an IAID and DUID.  The key points at the DUID,
+ * which must stay put for as long as the key is used.
+ */
+void
+ia_key_init(struct ia_key *key, u_int32_t iaid,
+	    const char *duid, unsigned int duid_len) {
+	key->iaid = iaid;
+	key->duid = (const unsigned char *)duid;
+	key->duid_len = duid_len;
+	key->hash = ia_hash_bytes(iaid, key->duid, duid_len);
+}
+
+int
+ia_new_hash(ia_hash_t **table, unsigned size, const char *file, int line) {
+	ia_hash_t *tmp;
+	unsigned n;
+
+	for (n = IA_TABLE_MIN_SIZE; n < size; n <<= 1)
+		;
+	tmp = dmalloc(sizeof(*tmp), file, line);
+	if (tmp == NULL) {
+		return 0;
+	}
+	tmp->buckets = dmalloc(n * sizeof(*tmp->buckets), file, line);
+	if (tmp->buckets == NULL) {
+		dfree(tmp, file, line);
+		return 0;
+	}
+	tmp->size = n;
+	tmp->count = 0;
+	*table = tmp;
+	return 1;
+}
+
+void
+ia_free_hash_table(ia_hash_t **table, const char *file, int line) {
+	struct ia_xx *ia, *next;
+	unsigned i;
+
+	for (i = 0; i < (*table)->size; i++) {
+		for (ia = (*table)->buckets[i]; ia != NULL; ia = next) {
+			next = ia->hash_next;
+			ia->hash_next = NULL;
+			ia->table = NULL;
+			ia_dereference(&ia, file, line);
+		}
+	}
+	dfree((*table)->buckets, file, line);
+	dfree(*table, file, line);
+	*table = NULL;
+}
+
+/*
+ * Double the number of buckets.  The IAs' own hashes say where they
+ * go, so this is only a matter of relinking them.
+ */
+static void
+ia_table_grow(ia_hash_t *table, const char *file, int line) {
+	struct ia_xx **buckets, *ia, *next;
+	unsigned i, size;
+
+	size = table->size << 1;
+	buckets = dmalloc(size * sizeof(*buckets), file, line);
+	if (buckets == NULL) {
+		/* Longer chains are slower, but still work. */
+		return;
+	}
+	for (i = 0; i < table->size; i++) {
+		for (ia = table->buckets[i]; ia != NULL; ia = next) {
+			next = ia->hash_next;
+			ia->hash_next = buckets[ia->hash & (size - 1)];
+			buckets[ia->hash & (size - 1)] = ia;
+		}
+	}
+	dfree(table->buckets, file, line);
+	table->buckets = buckets;
+	table->size = size;
+}
+
+/*
+ * Find the IA with the given key, and return a reference to it.
+ */
+int
+ia_key_lookup(struct ia_xx **ia, ia_hash_t *table, const struct ia_key *key,
+	      const char *file, int line) {
+	struct ia_xx *tmp;
+
+	if (table == NULL) {
+		return 0;
+	}
+	for (tmp = table->buckets[key->hash & (table->size - 1)];
+	     tmp != NULL; tmp = tmp->hash_next) {
+		if ((tmp->hash == key->hash) &&
+		    (tmp->iaid_duid.len == key->duid_len + sizeof(key->iaid)) &&
+		    (memcmp(tmp->iaid_duid.data, &key->iaid,
+			    sizeof(key->iaid)) == 0) &&
+		    (memcmp(tmp->iaid_duid.data + sizeof(key->iaid), key->duid,
+			    key->duid_len) == 0)) {
+			ia_reference(ia, tmp, file, line);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find an IA by the IAID and DUID as they are kept in iaid_duid.
+ */
+int
+ia_hash_lookup(struct ia_xx **ia, ia_hash_t *table,
+	       const unsigned char *iaid_duid, unsigned len,
+	       const char *file, int line) {
+	struct ia_key key;
+	u_int32_t iaid;
+
+	if (len < sizeof(iaid)) {
+		return 0;
+	}
+	memcpy(&iaid, iaid_duid, sizeof(iaid));
+	ia_key_init(&key, iaid, (const char *)iaid_duid + sizeof(iaid),
+		    len - sizeof(iaid));
+	return ia_key_lookup(ia, table, &key, file, line);
+}
+
+/*
+ * Add an IA to a table.  The table holds a reference to it.
+ */
+void
+ia_hash_add(ia_hash_t *table, struct ia_xx *ia, const char *file, int line) {
+	struct ia_xx **bucket;
+
+	if (ia->table != NULL) {
+		log_error("%s(%d): IA is already in a table", file, line);
+		return;
+	}
+	if (table->count >= table->size) {
+		ia_table_grow(table, file, line);
+	}
+
+	bucket = &table->buckets[ia->hash & (table->size - 1)];
+	ia->hash_next = *bucket;
+	*bucket = NULL;
+	ia_reference(bucket, ia, file, line);
+	ia->table = table;
+	table->count++;
+}
+
+/*
+ * Take an IA out of a table, if it's in it.
+ */
+void
+ia_hash_remove(ia_hash_t *table, struct ia_xx *ia,
+	       const char *file, int line) {
+	struct ia_xx **prev;
+
+	if ((table == NULL) || (ia->table != table)) {
+		return;
+	}
+	for (prev = &table->buckets[ia->hash & (table->size - 1)];
+	     *prev != NULL; prev = &(*prev)->hash_next) {
+		if (*prev == ia) {
+			*prev = ia->hash_next;
+			ia->hash_next = NULL;
+			ia->table = NULL;
+			table->count--;
+			ia_dereference(&ia, file, line);
+			return;
+		}
+	}
+}
+
+/*
+ * Take whichever IA has this IAID and DUID out of a table.
+ */
+void
+ia_hash_delete(ia_hash_t *table, const unsigned char *iaid_duid,
+	       unsigned len, const char *file, int line) {
+	struct ia_xx *ia = NULL;
+
+	if (ia_hash_lookup(&ia, table, iaid_duid, len, file, line)) {
+		ia_hash_remove(table, ia, file, line);
+		ia_dereference(&ia, file, line);
+	}
+}
+
+/*
+ * Call func for each IA in a table, as hash_foreach() does.
+ */
+int
+ia_hash_foreach(ia_hash_t *table, hash_foreach_func func) {
+	struct ia_xx *ia, *next;
+	unsigned i;
+	int count = 0;
+
+	if (table == NULL) {
+		return 0;
+	}
+	for (i = 0; i < table->size; i++) {
+		for (ia = table->buckets[i]; ia != NULL; ia = next) {
+			next = ia->hash_next;
+			if ((*func)(ia->iaid_duid.data, ia->iaid_duid.len,
+				    ia) != ISC_R_SUCCESS) {
+				return count;
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
 /*
  * Helper function for lease heaps.
  * Makes the top of the heap the oldest lease.
@@ -2042,12 +2290,15 @@ add_ipv6_pool(struct ipv6_pool *pool) {
 	return ISC_R_SUCCESS;
 }
 
-static void
-cleanup_old_expired(struct ipv6_pool *pool) {
+/*
+ * Remove expired leases that have been kept long enough.  Returns
+ * ISC_TRUE if the expiry slice ran out before all of them were gone,
+ * and *due is when the first one left over fell due.
+ */
+static isc_boolean_t
+cleanup_old_expired(struct ipv6_pool *pool, time_t *due) {
 	struct iasubopt *tmp;
 	struct ia_xx *ia;
-	struct ia_xx *ia_active;
-	unsigned char *tmpd;
 	time_t timeout;
 	
 	while (pool->num_inactive > 0) {
@@ -2062,6 +2313,10 @@ cleanup_old_expired(struct ipv6_pool *pool) {
 		if (cur_time < timeout) {
 			break;
 		}
+		if (expiry_slice_over()) {
+			*due = timeout;
+			return ISC_TRUE;
+		}
 
 		isc_heap_delete(pool->inactive_timeouts, tmp->inactive_index);
 		pool->num_inactive--;
@@ -2075,44 +2330,39 @@ cleanup_old_expired(struct ipv6_pool *pool) {
 			ia = NULL;
 			ia_reference(&ia, tmp->ia, MDL);
 			ia_remove_iasubopt(ia, tmp, MDL);
-			ia_active = NULL;
-			tmpd = (unsigned char *)ia->iaid_duid.data;
-			if ((ia->ia_type == D6O_IA_NA) &&
-			    (ia->num_iasubopt <= 0) &&
-			    (ia_hash_lookup(&ia_active, ia_na_active, tmpd,
-					    ia->iaid_duid.len, MDL) == 0) &&
-			    (ia_active == ia)) {
-				ia_hash_delete(ia_na_active, tmpd, 
-					       ia->iaid_duid.len, MDL);
-			}
-			if ((ia->ia_type == D6O_IA_TA) &&
-			    (ia->num_iasubopt <= 0) &&
-			    (ia_hash_lookup(&ia_active, ia_ta_active, tmpd,
-					    ia->iaid_duid.len, MDL) == 0) &&
-			    (ia_active == ia)) {
-				ia_hash_delete(ia_ta_active, tmpd, 
-					       ia->iaid_duid.len, MDL);
-			}
-			if ((ia->ia_type == D6O_IA_PD) &&
-			    (ia->num_iasubopt <= 0) &&
-			    (ia_hash_lookup(&ia_active, ia_pd_active, tmpd,
-					    ia->iaid_duid.len, MDL) == 0) &&
-			    (ia_active == ia)) {
-				ia_hash_delete(ia_pd_active, tmpd, 
-					       ia->iaid_duid.len, MDL);
+			if (ia->num_iasubopt <= 0) {
+				ia_hash_remove(ia->table, ia, MDL);
 			}
 			ia_dereference(&ia, MDL);
 		}
 		iasubopt_dereference(&tmp, MDL);
 	}
+	return ISC_FALSE;
+}
+
+/*
+ * Addresses or prefixes in use in a pool's pond, per mille, for
+ * ordering the expiry backlog.
+ */
+static int
+ipv6_pool_pressure(struct ipv6_pool *pool) {
+	struct ipv6_pond *pond = pool->ipv6_pond;
+
+	if ((pond == NULL) || (pond->num_total == 0)) {
+		return 0;
+	}
+	return (int)(((double)pond->num_active * 1000) / pond->num_total);
 }
 
 static void
 lease_timeout_support(void *vpool) {
 	struct ipv6_pool *pool;
 	struct iasubopt *lease;
+	time_t due = MAX_TIME;
+	isc_boolean_t backlog = ISC_FALSE;
 	
 	pool = (struct ipv6_pool *)vpool;
+	expiry_slice_begin();
 	for (;;) {
 		/*
 		 * Get the next lease scheduled to expire.
@@ -2137,6 +2387,20 @@ lease_timeout_support(void *vpool) {
 		write_ia(lease->ia);
 
 		iasubopt_dereference(&lease, MDL);
+
+		/*
+		 * If this slice is used up and more leases are due,
+		 * leave them for the next one.
+		 */
+		if (expiry_slice_over() && (pool->num_active > 0)) {
+			lease = (struct iasubopt *)
+				isc_heap_element(pool->active_timeouts, 1);
+			if (lease->hard_lifetime_end_time < cur_time) {
+				due = lease->hard_lifetime_end_time;
+				backlog = ISC_TRUE;
+				break;
+			}
+		}
 	}
 
 	/*
@@ -2149,12 +2413,22 @@ lease_timeout_support(void *vpool) {
 	/*
 	 * Do some cleanup of our expired leases.
 	 */
-	cleanup_old_expired(pool);
+	if (!backlog) {
+		backlog = cleanup_old_expired(pool, &due);
+	}
 
 	/*
-	 * Schedule next round of expirations.
+	 * Schedule next round of expirations, straight away if this
+	 * slice ran out.
 	 */
-	schedule_lease_timeout(pool);
+	if (backlog) {
+		expiry_backlog_add(lease_timeout_support, pool,
+				   (tvref_t)ipv6_pool_reference,
+				   (tvunref_t)ipv6_pool_dereference,
+				   ipv6_pool_pressure(pool), due);
+	} else {
+		schedule_lease_timeout(pool);
+	}
 }
 
 /*
@@ -43,11 +43,49 @@ static isc_result_t class_lookup (omapi_object_t **,
 static isc_result_t update_lease_flags(struct lease* lease,
 				       omapi_typed_data_t *value);
 
+/* See dhcp_cursor_stuff_values() and friends below. */
+#define CURSOR_LEASES		1
+#define CURSOR_HOSTS		2
+#define CURSOR_POOLS		3
+
+#define CURSOR_BATCH_DEFAULT	1024
+#define CURSOR_BATCH_MAX	16384
+#define CURSOR_BUFFER_SIZE	(1024 * 1024)
+#define CURSOR_MAX_OPEN		8	/* On any one connection. */
+#define CURSOR_IDLE_SECS	300	/* Let go of if not refreshed. */
+#define CURSOR_SWEEP_SECS	10
+
+struct dhcp_cursor {
+	OMAPI_OBJECT_PREAMBLE;
+	int object;			/* What we're walking. */
+	int started;			/* Nonzero once the snapshot is taken. */
+
+	/* Filters; zero or null if not set. */
+	int state;
+	struct subnet *subnet;
+	struct pool *pool;
+	TIME ends_before;
+
+	unsigned batch_size;
+
+	omapi_object_t **items;		/* Snapshot of matching objects. */
+	unsigned count, max;
+	unsigned next;			/* Next item to send. */
+
+	struct omapi_record batch;	/* Batch being encoded. */
+
+	omapi_object_t *conn;		/* Connection it's being sent on. */
+	TIME last_used;			/* When a batch was last sent. */
+	int expired;			/* Let go of before it was done. */
+	struct dhcp_cursor *next_open;	/* On the open_cursors list. */
+};
+
 omapi_object_type_t *dhcp_type_lease;
 omapi_object_type_t *dhcp_type_pool;
 omapi_object_type_t *dhcp_type_class;
 omapi_object_type_t *dhcp_type_subclass;
 omapi_object_type_t *dhcp_type_host;
+omapi_object_type_t *dhcp_type_cursor;
 #if defined (FAILOVER_PROTOCOL)
 omapi_object_type_t *dhcp_type_failover_state;
 omapi_object_type_t *dhcp_type_failover_link;
@@ -145,6 +183,23 @@ void dhcp_db_objects_setup ()
 		log_fatal ("Can't register host object type: %s",
 			   isc_result_totext (status));
 
+	status = omapi_object_type_register (&dhcp_type_cursor,
+					     "cursor",
+					     dhcp_cursor_set_value,
+					     dhcp_cursor_get_value,
+					     dhcp_cursor_destroy,
+					     dhcp_cursor_signal_handler,
+					     dhcp_cursor_stuff_values,
+					     dhcp_cursor_lookup,
+					     dhcp_cursor_create,
+					     dhcp_cursor_remove, 0, 0, 0,
+					     sizeof (struct dhcp_cursor),
+					     0, RC_MISC);
+
+	if (status != ISC_R_SUCCESS)
+		log_fatal ("Can't register cursor object type: %s",
+			   isc_result_totext (status));
+
 #if defined (FAILOVER_PROTOCOL)
 	status = omapi_object_type_register (&dhcp_type_failover_state,
 					     "failover-state",
@@ -509,12 +564,11 @@ isc_result_t dhcp_lease_destroy (omapi_object_t *h, const char *file, int line)
 	if (lease->pool)
 		pool_dereference (&lease->pool, file, line);
 
+	/* A ping check holds a reference to its lease, so there can't
+	   be one outstanding for a lease that's being destroyed. */
 	if (lease->state) {
 		free_lease_state (lease->state, file, line);
 		lease->state = (struct lease_state *)0;
-
-		cancel_timeout (lease_ping_timeout, lease);
-		--outstanding_pings; /* XXX */
 	}
 
 	if (lease->billing_class)
@@ -532,8 +586,13 @@ isc_result_t dhcp_lease_destroy (omapi_object_t *h, const char *file, int line)
 		lease_dereference (&lease->n_hw, file, line);
 	if (lease->n_uid)
 		lease_dereference (&lease->n_uid, file, line);
-	if (lease->next_pending)
-		lease_dereference (&lease->next_pending, file, line);
+	if (lease->cold) {
+		if (lease->cold->next_pending)
+			lease_dereference (&lease->cold->next_pending,
+					   file, line);
+		dfree (lease->cold, file, line);
+		lease->cold = NULL;
+	}
 
 	return ISC_R_SUCCESS;
 }
@@ -1677,6 +1736,8 @@ isc_result_t dhcp_pool_destroy (omapi_object_t *h, const char *file, int line)
 	if (pool -> failover_peer)
 		dhcp_failover_state_dereference (&pool -> failover_peer,
 						 file, line);
+	if (pool -> balance_next)
+		pool_dereference (&pool -> balance_next, file, line);
 #endif
 
 	for (pc = pool -> permit_list; pc; pc = pn) {
@@ -1786,6 +1847,775 @@ isc_result_t dhcp_pool_remove (omapi_object_t *lp,
 	return ISC_R_NOTIMPLEMENTED;
 }
 
+/* A cursor walks the server's leases, hosts or pools so that a client
+   can read all of them, or all of them that match a few simple filters,
+   without opening each object in turn.   The set of matching objects
+   is taken when the first batch is asked for; each update the server
+   sends for the cursor (the reply to the open, then the reply to each
+   refresh) carries the next batch.   The client pulls batches one at a
+   time, so the server never has more than one queued on a connection.
+
+   Each batch is a single "records" value.   It holds one record per
+   object, each a list of values encoded as on the wire (a 16-bit name
+   length, the name, a 32-bit value length and the value), ended by a
+   zero name length.   The values are those the object itself would
+   send, less any that refer to other objects by handle. */
+
+static isc_result_t cursor_add (struct dhcp_cursor *cursor,
+				omapi_object_t *item)
+{
+	omapi_object_t **items;
+	unsigned max;
+
+	if (cursor -> count == cursor -> max) {
+		max = cursor -> max ? cursor -> max * 2 : 1024;
+		items = dmalloc (max * sizeof *items, MDL);
+		if (!items)
+			return ISC_R_NOMEMORY;
+		if (cursor -> items) {
+			memcpy (items, cursor -> items,
+				cursor -> count * sizeof *items);
+			dfree (cursor -> items, MDL);
+		}
+		cursor -> items = items;
+		cursor -> max = max;
+	}
+
+	cursor -> items [cursor -> count] = (omapi_object_t *)0;
+	omapi_object_reference (&cursor -> items [cursor -> count++],
+				item, MDL);
+	return ISC_R_SUCCESS;
+}
+
+/* Cursors that hold a snapshot, so that those whose connection has
+   closed, or that haven't been refreshed for a while, can be let go of.
+   A cursor is taken off the list when it's released or destroyed, so
+   the list doesn't hold references to them. */
+static struct dhcp_cursor *open_cursors;
+static int cursor_sweep_set;
+
+static void cursor_sweep (void *);
+
+static void cursor_release (struct dhcp_cursor *cursor)
+{
+	struct dhcp_cursor **cp;
+	unsigned i;
+
+	for (cp = &open_cursors; *cp; cp = &(*cp) -> next_open) {
+		if (*cp == cursor) {
+			*cp = cursor -> next_open;
+			break;
+		}
+	}
+	cursor -> next_open = (struct dhcp_cursor *)0;
+	if (cursor -> conn)
+		omapi_object_dereference (&cursor -> conn, MDL);
+
+	for (i = 0; i < cursor -> count; i++)
+		omapi_object_dereference (&cursor -> items [i], MDL);
+	if (cursor -> items)
+		dfree (cursor -> items, MDL);
+	cursor -> items = (omapi_object_t **)0;
+	cursor -> count = cursor -> max = cursor -> next = 0;
+
+	if (cursor -> batch.buf)
+		dfree (cursor -> batch.buf, MDL);
+	memset (&cursor -> batch, 0, sizeof cursor -> batch);
+}
+
+static int cursor_conn_closed (struct dhcp_cursor *cursor)
+{
+	return (((omapi_connection_object_t *)cursor -> conn) -> state !=
+		omapi_connection_connected);
+}
+
+static void cursor_sweep_schedule (void)
+{
+	struct timeval tv;
+
+	tv.tv_sec = cur_tv.tv_sec + CURSOR_SWEEP_SECS;
+	tv.tv_usec = cur_tv.tv_usec;
+	add_timeout (&tv, cursor_sweep, (void *)0, 0, 0);
+	cursor_sweep_set = 1;
+}
+
+/* Let go of the snapshot and batch buffer of each cursor whose
+   connection has gone away, or that the client has stopped refreshing.
+   Only the cursor itself is left, in the handle table. */
+static void cursor_sweep (void *vp)
+{
+	struct dhcp_cursor *cursor, *next;
+
+	cursor_sweep_set = 0;
+	for (cursor = open_cursors; cursor; cursor = next) {
+		next = cursor -> next_open;
+		if (cursor_conn_closed (cursor)) {
+			cursor_release (cursor);
+		} else if (cur_time - cursor -> last_used >= CURSOR_IDLE_SECS) {
+			log_info ("OMAPI cursor: not refreshed in %d seconds, "
+				  "%u objects unsent.", CURSOR_IDLE_SECS,
+				  cursor -> count - cursor -> next);
+			cursor_release (cursor);
+			cursor -> expired = 1;
+		}
+	}
+
+	if (open_cursors)
+		cursor_sweep_schedule ();
+}
+
+/* Put a cursor that's just taken its snapshot on the open list, unless
+   the connection already has as many open as it's allowed. */
+static isc_result_t cursor_open (struct dhcp_cursor *cursor,
+				 omapi_object_t *c)
+{
+	struct dhcp_cursor *cp;
+	int n;
+
+	n = 0;
+	for (cp = open_cursors; cp; cp = cp -> next_open) {
+		if (cp -> conn == c)
+			n++;
+	}
+	if (n >= CURSOR_MAX_OPEN) {
+		log_error ("OMAPI cursor: more than %d open on one connection.",
+			   CURSOR_MAX_OPEN);
+		return ISC_R_QUOTA;
+	}
+
+	omapi_object_reference (&cursor -> conn, c, MDL);
+	cursor -> last_used = cur_time;
+	cursor -> next_open = open_cursors;
+	open_cursors = cursor;
+
+	if (!cursor_sweep_set)
+		cursor_sweep_schedule ();
+	return ISC_R_SUCCESS;
+}
+
+static int cursor_lease_matches (struct dhcp_cursor *cursor,
+				 struct lease *lease)
+{
+	if (cursor -> state && lease -> binding_state != cursor -> state)
+		return 0;
+	if (cursor -> subnet && lease -> subnet != cursor -> subnet)
+		return 0;
+	if (cursor -> pool && lease -> pool != cursor -> pool)
+		return 0;
+	if (cursor -> ends_before && lease -> ends >= cursor -> ends_before)
+		return 0;
+	return 1;
+}
+
+/* host_hash_foreach() doesn't pass a context pointer, so the
+   cursor being filled is left here. */
+static struct dhcp_cursor *host_snapshot_cursor;
+
+static isc_result_t cursor_add_host (const void *name, unsigned len,
+				     void *object)
+{
+	struct host_decl *host = object;
+
+	if (host -> flags & HOST_DECL_DELETED)
+		return ISC_R_SUCCESS;
+	return cursor_add (host_snapshot_cursor, (omapi_object_t *)host);
+}
+
+static isc_result_t cursor_snapshot (struct dhcp_cursor *cursor)
+{
+	struct shared_network *s;
+	struct pool *p;
+	struct lease *l;
+#define FREE_LEASES 0
+#define ACTIVE_LEASES 1
+#define EXPIRED_LEASES 2
+#define ABANDONED_LEASES 3
+#define BACKUP_LEASES 4
+#define RESERVED_LEASES 5
+	LEASE_STRUCT_PTR lptr[RESERVED_LEASES+1];
+	isc_result_t status = ISC_R_SUCCESS;
+	int i;
+
+	switch (cursor -> object) {
+	      case CURSOR_LEASES:
+		for (s = shared_networks; s; s = s -> next) {
+		    if (cursor -> subnet &&
+			cursor -> subnet -> shared_network != s)
+			    continue;
+		    for (p = s -> pools; p; p = p -> next) {
+			if (cursor -> pool && cursor -> pool != p)
+				continue;
+
+			lptr[FREE_LEASES] = &p->free;
+			lptr[ACTIVE_LEASES] = &p->active;
+			lptr[EXPIRED_LEASES] = &p->expired;
+			lptr[ABANDONED_LEASES] = &p->abandoned;
+			lptr[BACKUP_LEASES] = &p->backup;
+			lptr[RESERVED_LEASES] = &p->reserved;
+
+			for (i = FREE_LEASES; i <= RESERVED_LEASES; i++) {
+			    for (l = LEASE_GET_FIRSTP(lptr[i]);
+				 l != NULL;
+				 l = LEASE_GET_NEXTP(lptr[i], l)) {
+				if (!cursor_lease_matches (cursor, l))
+					continue;
+				status = cursor_add (cursor,
+						     (omapi_object_t *)l);
+				if (status != ISC_R_SUCCESS)
+					return status;
+			    }
+			}
+		    }
+		}
+		break;
+
+	      case CURSOR_HOSTS:
+		host_snapshot_cursor = cursor;
+		host_hash_foreach (host_name_hash, cursor_add_host);
+		host_snapshot_cursor = (struct dhcp_cursor *)0;
+		break;
+
+	      case CURSOR_POOLS:
+		for (s = shared_networks; s; s = s -> next) {
+		    if (cursor -> subnet &&
+			cursor -> subnet -> shared_network != s)
+			    continue;
+		    for (p = s -> pools; p; p = p -> next) {
+			status = cursor_add (cursor, (omapi_object_t *)p);
+			if (status != ISC_R_SUCCESS)
+				return status;
+		    }
+		}
+		break;
+
+	      default:
+		return DHCP_R_INVALIDARG;
+	}
+	return status;
+}
+
+/* Append one value to a record being encoded.   Returns zero if it
+   doesn't fit. */
+int omapi_record_put (struct omapi_record *rec, const char *name,
+		      const void *data, unsigned len)
+{
+	unsigned nlen = strlen (name);
+	unsigned char *bp;
+
+	if (rec -> len + 2 + nlen + 4 + len > rec -> max)
+		return 0;
+
+	bp = rec -> buf + rec -> len;
+	putUShort (bp, nlen);
+	memcpy (bp + 2, name, nlen);
+	putULong (bp + 2 + nlen, len);
+	if (len)
+		memcpy (bp + 2 + nlen + 4, data, len);
+	rec -> len += 2 + nlen + 4 + len;
+	return 1;
+}
+
+int omapi_record_put_uint32 (struct omapi_record *rec, const char *name,
+			     u_int32_t value)
+{
+	unsigned char buf [4];
+
+	putULong (buf, value);
+	return omapi_record_put (rec, name, buf, sizeof buf);
+}
+
+int omapi_record_end (struct omapi_record *rec)
+{
+	if (rec -> len + 2 > rec -> max)
+		return 0;
+	putUShort (rec -> buf + rec -> len, 0);
+	rec -> len += 2;
+	return 1;
+}
+
+/* The record encoders return 1 if the record was added, 0 if it didn't
+   fit and -1 if the object should be skipped.   They're also used by the
+   query thread (see omapiquery.c) to take its copy of each lease and host. */
+
+int omapi_record_lease (struct omapi_record *rec, struct lease *lease)
+{
+	u_int8_t flagbuf;
+
+	if (!omapi_record_put_uint32 (rec, "state", lease -> binding_state) ||
+	    !omapi_record_put (rec, "ip-address",
+			       lease -> ip_addr.iabuf, lease -> ip_addr.len))
+		return 0;
+	if (lease -> uid_len &&
+	    !omapi_record_put (rec, "dhcp-client-identifier",
+			       lease -> uid, lease -> uid_len))
+		return 0;
+	if (lease -> client_hostname &&
+	    !omapi_record_put (rec, "client-hostname",
+			       lease -> client_hostname,
+			       strlen (lease -> client_hostname)))
+		return 0;
+	if (lease -> hardware_addr.hlen &&
+	    (!omapi_record_put (rec, "hardware-address",
+				&lease -> hardware_addr.hbuf [1],
+				(unsigned)(lease -> hardware_addr.hlen - 1)) ||
+	     !omapi_record_put_uint32 (rec, "hardware-type",
+				       lease -> hardware_addr.hbuf [0])))
+		return 0;
+
+	/* See dhcp_lease_stuff_values() about 32-bit times. */
+	if (!omapi_record_put_uint32 (rec, "ends", (u_int32_t)lease -> ends) ||
+	    !omapi_record_put_uint32 (rec, "starts",
+				      (u_int32_t)lease -> starts) ||
+	    !omapi_record_put_uint32 (rec, "tstp", (u_int32_t)lease -> tstp) ||
+	    !omapi_record_put_uint32 (rec, "tsfp", (u_int32_t)lease -> tsfp) ||
+	    !omapi_record_put_uint32 (rec, "atsfp",
+				      (u_int32_t)lease -> atsfp) ||
+	    !omapi_record_put_uint32 (rec, "cltt", (u_int32_t)lease -> cltt))
+		return 0;
+
+	flagbuf = lease -> flags & EPHEMERAL_FLAGS;
+	if (!omapi_record_put (rec, "flags", &flagbuf, sizeof flagbuf))
+		return 0;
+
+	return omapi_record_end (rec);
+}
+
+int omapi_record_host (struct omapi_record *rec, struct host_decl *host)
+{
+	struct data_string ip_addrs;
+	int ok;
+
+	if (host -> flags & HOST_DECL_DELETED)
+		return -1;
+
+	if (host -> name &&
+	    !omapi_record_put (rec, "name", host -> name,
+			       strlen (host -> name)))
+		return 0;
+
+	memset (&ip_addrs, 0, sizeof ip_addrs);
+	if (host -> fixed_addr &&
+	    evaluate_option_cache (&ip_addrs, (struct packet *)0,
+				   (struct lease *)0,
+				   (struct client_state *)0,
+				   (struct option_state *)0,
+				   (struct option_state *)0,
+				   &global_scope,
+				   host -> fixed_addr, MDL)) {
+		ok = omapi_record_put (rec, "ip-address",
+				       ip_addrs.data, ip_addrs.len);
+		data_string_forget (&ip_addrs, MDL);
+		if (!ok)
+			return 0;
+	}
+
+	if (host -> client_identifier.len &&
+	    !omapi_record_put (rec, "dhcp-client-identifier",
+			       host -> client_identifier.data,
+			       host -> client_identifier.len))
+		return 0;
+	if (host -> interface.hlen &&
+	    (!omapi_record_put (rec, "hardware-address",
+				&host -> interface.hbuf [1],
+				(unsigned)(host -> interface.hlen - 1)) ||
+	     !omapi_record_put_uint32 (rec, "hardware-type",
+				       host -> interface.hbuf [0])))
+		return 0;
+
+	return omapi_record_end (rec);
+}
+
+static int cursor_put_pool (struct omapi_record *rec, struct pool *pool)
+{
+	if (pool -> shared_network && pool -> shared_network -> name &&
+	    !omapi_record_put (rec, "shared-network",
+			       pool -> shared_network -> name,
+			       strlen (pool -> shared_network -> name)))
+		return 0;
+	if (!omapi_record_put_uint32 (rec, "lease-count",
+				      (u_int32_t)pool -> lease_count) ||
+	    !omapi_record_put_uint32 (rec, "free-leases",
+				      (u_int32_t)pool -> free_leases) ||
+	    !omapi_record_put_uint32 (rec, "backup-leases",
+				      (u_int32_t)pool -> backup_leases))
+		return 0;
+
+	return omapi_record_end (rec);
+}
+
+/* Encode the next batch of records into the cursor's buffer, and
+   return the number encoded. */
+static unsigned cursor_fill (struct dhcp_cursor *cursor)
+{
+	omapi_object_t *item;
+	unsigned n = 0, mark;
+	int rv;
+
+	cursor -> batch.len = 0;
+	while (cursor -> next < cursor -> count && n < cursor -> batch_size) {
+		item = cursor -> items [cursor -> next];
+		mark = cursor -> batch.len;
+
+		/* A lease may have changed since the snapshot was taken. */
+		if (item -> type == dhcp_type_lease)
+			rv = (cursor_lease_matches (cursor, (struct lease *)item)
+			      ? omapi_record_lease (&cursor -> batch,
+						    (struct lease *)item)
+			      : -1);
+		else if (item -> type == dhcp_type_host)
+			rv = omapi_record_host (&cursor -> batch,
+						(struct host_decl *)item);
+		else
+			rv = cursor_put_pool (&cursor -> batch,
+					      (struct pool *)item);
+
+		if (rv == 0) {
+			cursor -> batch.len = mark;
+			/* Leave it for the next batch, unless even an
+			   empty batch can't hold it. */
+			if (n)
+				break;
+			log_error ("OMAPI cursor: record too large, skipped.");
+			rv = -1;
+		}
+
+		omapi_object_dereference (&cursor -> items [cursor -> next],
+					  MDL);
+		cursor -> next++;
+		if (rv > 0)
+			n++;
+	}
+	return n;
+}
+
+isc_result_t dhcp_cursor_set_value  (omapi_object_t *h,
+				     omapi_object_t *id,
+				     omapi_data_string_t *name,
+				     omapi_typed_data_t *value)
+{
+	struct dhcp_cursor *cursor;
+	struct subnet *subnet;
+	struct lease *lease;
+	struct pool *pool;
+	struct iaddr addr;
+	unsigned long tmp;
+	isc_result_t status;
+
+	if (h -> type != dhcp_type_cursor)
+		return DHCP_R_INVALIDARG;
+	cursor = (struct dhcp_cursor *)h;
+
+	if (!omapi_ds_strcmp (name, "batch-size")) {
+		status = omapi_get_int_value (&tmp, value);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		if (tmp < 1 || tmp > CURSOR_BATCH_MAX)
+			return DHCP_R_INVALIDARG;
+		cursor -> batch_size = tmp;
+		return ISC_R_SUCCESS;
+	}
+
+	/* The rest select what we walk, so they can't change once we've
+	   started. */
+	if (!omapi_ds_strcmp (name, "object-type") ||
+	    !omapi_ds_strcmp (name, "state") ||
+	    !omapi_ds_strcmp (name, "subnet") ||
+	    !omapi_ds_strcmp (name, "pool") ||
+	    !omapi_ds_strcmp (name, "ends-before")) {
+		if (cursor -> started)
+			return DHCP_R_INVALIDARG;
+		if (!value)
+			return DHCP_R_INVALIDARG;
+	}
+
+	if (!omapi_ds_strcmp (name, "object-type")) {
+		if (value -> type != omapi_datatype_data &&
+		    value -> type != omapi_datatype_string)
+			return DHCP_R_INVALIDARG;
+		if (!omapi_td_strcmp (value, "lease"))
+			cursor -> object = CURSOR_LEASES;
+		else if (!omapi_td_strcmp (value, "host"))
+			cursor -> object = CURSOR_HOSTS;
+		else if (!omapi_td_strcmp (value, "pool"))
+			cursor -> object = CURSOR_POOLS;
+		else
+			return DHCP_R_INVALIDARG;
+		return ISC_R_SUCCESS;
+	}
+
+	if (!omapi_ds_strcmp (name, "state")) {
+		status = omapi_get_int_value (&tmp, value);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		if (tmp < 1 || tmp > FTS_LAST)
+			return DHCP_R_INVALIDARG;
+		cursor -> state = tmp;
+		return ISC_R_SUCCESS;
+	}
+
+	if (!omapi_ds_strcmp (name, "ends-before")) {
+		status = omapi_get_int_value (&tmp, value);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		cursor -> ends_before = (TIME)tmp;
+		return ISC_R_SUCCESS;
+	}
+
+	/* The subnet and pool are named by an address within them. */
+	if (!omapi_ds_strcmp (name, "subnet") ||
+	    !omapi_ds_strcmp (name, "pool")) {
+		if (value -> type != omapi_datatype_data ||
+		    value -> u.buffer.len > sizeof addr.iabuf)
+			return DHCP_R_INVALIDARG;
+		addr.len = value -> u.buffer.len;
+		memcpy (addr.iabuf, value -> u.buffer.value, addr.len);
+
+		if (!omapi_ds_strcmp (name, "subnet")) {
+			subnet = (struct subnet *)0;
+			if (!find_subnet (&subnet, addr, MDL))
+				return ISC_R_NOTFOUND;
+			if (cursor -> subnet)
+				subnet_dereference (&cursor -> subnet, MDL);
+			subnet_reference (&cursor -> subnet, subnet, MDL);
+			subnet_dereference (&subnet, MDL);
+			return ISC_R_SUCCESS;
+		}
+
+		/* A never used address of a sparse range has no lease, but
+		   still names its pool. */
+		lease = (struct lease *)0;
+		pool = (struct pool *)0;
+		if (find_lease_by_ip_addr (&lease, addr, MDL)) {
+			pool = lease -> pool;
+			lease_dereference (&lease, MDL);
+		} else
+			pool = sparse_range_pool (addr);
+		if (!pool)
+			return ISC_R_NOTFOUND;
+		if (cursor -> pool)
+			pool_dereference (&cursor -> pool, MDL);
+		pool_reference (&cursor -> pool, pool, MDL);
+		return ISC_R_SUCCESS;
+	}
+
+	/* Try to find some inner object that can take the value. */
+	if (h -> inner && h -> inner -> type -> set_value) {
+		status = ((*(h -> inner -> type -> set_value))
+			  (h -> inner, id, name, value));
+		if (status == ISC_R_SUCCESS || status == DHCP_R_UNCHANGED)
+			return status;
+	}
+
+	return DHCP_R_UNKNOWNATTRIBUTE;
+}
+
+isc_result_t dhcp_cursor_get_value (omapi_object_t *h, omapi_object_t *id,
+				    omapi_data_string_t *name,
+				    omapi_value_t **value)
+{
+	struct dhcp_cursor *cursor;
+	isc_result_t status;
+
+	if (h -> type != dhcp_type_cursor)
+		return DHCP_R_INVALIDARG;
+	cursor = (struct dhcp_cursor *)h;
+
+	if (!omapi_ds_strcmp (name, "remaining"))
+		return omapi_make_int_value (value, name,
+					     (int)(cursor -> count -
+						   cursor -> next), MDL);
+	if (!omapi_ds_strcmp (name, "batch-size"))
+		return omapi_make_int_value (value, name,
+					     (int)cursor -> batch_size, MDL);
+
+	/* Try to find some inner object that can provide the value. */
+	if (h -> inner && h -> inner -> type -> get_value) {
+		status = ((*(h -> inner -> type -> get_value))
+			  (h -> inner, id, name, value));
+		if (status == ISC_R_SUCCESS)
+			return status;
+	}
+	return DHCP_R_UNKNOWNATTRIBUTE;
+}
+
+isc_result_t dhcp_cursor_destroy (omapi_object_t *h,
+				  const char *file, int line)
+{
+	struct dhcp_cursor *cursor;
+
+	if (h -> type != dhcp_type_cursor)
+		return DHCP_R_INVALIDARG;
+	cursor = (struct dhcp_cursor *)h;
+
+	cursor_release (cursor);
+	if (cursor -> subnet)
+		subnet_dereference (&cursor -> subnet, file, line);
+	if (cursor -> pool)
+		pool_dereference (&cursor -> pool, file, line);
+	return ISC_R_SUCCESS;
+}
+
+isc_result_t dhcp_cursor_signal_handler (omapi_object_t *h,
+					 const char *name, va_list ap)
+{
+	isc_result_t status;
+
+	if (h -> type != dhcp_type_cursor)
+		return DHCP_R_INVALIDARG;
+
+	if (!strcmp (name, "updated"))
+		return ISC_R_SUCCESS;
+
+	/* Try to find some inner object that can take the value. */
+	if (h -> inner && h -> inner -> type -> signal_handler) {
+		status = ((*(h -> inner -> type -> signal_handler))
+			  (h -> inner, name, ap));
+		if (status == ISC_R_SUCCESS)
+			return status;
+	}
+	return ISC_R_NOTFOUND;
+}
+
+/* Send the next batch.   This is called for the reply to the open that
+   created the cursor and for the reply to each refresh after that. */
+
+isc_result_t dhcp_cursor_stuff_values (omapi_object_t *c,
+				       omapi_object_t *id,
+				       omapi_object_t *h)
+{
+	struct dhcp_cursor *cursor;
+	isc_result_t status;
+	unsigned n;
+
+	if (h -> type != dhcp_type_cursor)
+		return DHCP_R_INVALIDARG;
+	cursor = (struct dhcp_cursor *)h;
+
+	/* The client is told by losing the connection; if it were sent an
+	   empty batch instead it would take it for the end. */
+	if (cursor -> expired)
+		return ISC_R_TIMEDOUT;
+
+	if (!cursor -> started) {
+		if (!cursor -> object || c -> type != omapi_type_connection)
+			return DHCP_R_INVALIDARG;
+		cursor -> started = 1;
+		status = cursor_open (cursor, c);
+		if (status != ISC_R_SUCCESS)
+			return status;
+		status = cursor_snapshot (cursor);
+		if (status != ISC_R_SUCCESS) {
+			cursor_release (cursor);
+			return status;
+		}
+	}
+	cursor -> last_used = cur_time;
+
+	n = 0;
+	if (cursor -> next < cursor -> count) {
+		if (!cursor -> batch.buf) {
+			cursor -> batch.buf = dmalloc (CURSOR_BUFFER_SIZE,
+						       MDL);
+			if (!cursor -> batch.buf)
+				return ISC_R_NOMEMORY;
+			cursor -> batch.max = CURSOR_BUFFER_SIZE;
+		}
+		n = cursor_fill (cursor);
+	} else
+		cursor -> batch.len = 0;
+
+	status = omapi_connection_put_named_uint32 (c, "count", n);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "remaining",
+						    cursor -> count -
+						    cursor -> next);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	status = omapi_connection_put_name (c, "records");
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_uint32 (c, cursor -> batch.len);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	if (cursor -> batch.len) {
+		status = omapi_connection_copyin (c, cursor -> batch.buf,
+						  cursor -> batch.len);
+		if (status != ISC_R_SUCCESS)
+			return status;
+	}
+
+	/* Once the last batch is out there's nothing left to hold on to. */
+	if (cursor -> next == cursor -> count)
+		cursor_release (cursor);
+
+	/* Write out the inner object, if any. */
+	if (h -> inner && h -> inner -> type -> stuff_values) {
+		status = ((*(h -> inner -> type -> stuff_values))
+			  (c, id, h -> inner));
+		if (status == ISC_R_SUCCESS)
+			return status;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+isc_result_t dhcp_cursor_lookup (omapi_object_t **lp,
+				 omapi_object_t *id, omapi_object_t *ref)
+{
+	omapi_value_t *tv = (omapi_value_t *)0;
+	isc_result_t status;
+
+	if (!ref)
+		return DHCP_R_NOKEYS;
+
+	/* A cursor can only be found again by its handle. */
+	status = omapi_get_value_str (ref, id, "handle", &tv);
+	if (status != ISC_R_SUCCESS)
+		return DHCP_R_NOKEYS;
+
+	status = omapi_handle_td_lookup (lp, tv -> value);
+	omapi_value_dereference (&tv, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	if ((*lp) -> type != dhcp_type_cursor) {
+		omapi_object_dereference (lp, MDL);
+		return DHCP_R_INVALIDARG;
+	}
+	return ISC_R_SUCCESS;
+}
+
+isc_result_t dhcp_cursor_create (omapi_object_t **lp,
+				 omapi_object_t *id)
+{
+	struct dhcp_cursor *cursor = (struct dhcp_cursor *)0;
+	isc_result_t status;
+
+	status = omapi_object_allocate ((omapi_object_t **)&cursor,
+					dhcp_type_cursor, 0, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	cursor -> batch_size = CURSOR_BATCH_DEFAULT;
+
+	status = omapi_object_reference (lp, (omapi_object_t *)cursor, MDL);
+	omapi_object_dereference ((omapi_object_t **)&cursor, MDL);
+	return status;
+}
+
+/* Removing a cursor lets go of whatever it had left to send. */
+
+isc_result_t dhcp_cursor_remove (omapi_object_t *lp,
+				 omapi_object_t *id)
+{
+	if (lp -> type != dhcp_type_cursor)
+		return DHCP_R_INVALIDARG;
+
+	cursor_release ((struct dhcp_cursor *)lp);
+	return ISC_R_SUCCESS;
+}
+
 static isc_result_t
 class_set_value (omapi_object_t *h,
 		 omapi_object_t *id,
@@ -0,0 +1,1342 @@
+/* omapiquery.c
+
+   Read-only OMAPI lookups on a thread of their own. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/omapiquery.c
+ *
+ * \page omapiquery OMAPI query thread
+ *
+ * With --enable-omapi-query-thread and an omapi-query-port statement the
+ * server answers OMAPI lease and host lookups on that port from a thread
+ * of its own, so that monitoring and provisioning tools that read the
+ * database don't take time from the thread that answers clients.  The
+ * port speaks the same protocol as omapi-port, but only for opening
+ * leases and hosts by the keys dhcp_lease_lookup() and dhcp_host_lookup()
+ * take, and refreshing them by handle.  Anything that would change the
+ * database (an open with the create or update flag, an update or a
+ * delete) is refused with ISC_R_NOPERM: those still go to omapi-port, on
+ * the main thread.
+ *
+ * The thread doesn't look at the server's leases and hosts.  They are
+ * reference counted without atomic operations and changed in place all
+ * over the server, so there is no point at which another thread could
+ * safely read one.  Instead the thread keeps a copy of each lease and
+ * host as the values an OMAPI client would get for it, encoded by
+ * omapi_record_lease() and omapi_record_host(), in hashes of its own.
+ * The main thread encodes a lease each time supersede_lease() moves it,
+ * and a host each time one is entered or deleted, and queues the record
+ * for the thread.  After startup and after a configuration reload it
+ * queues every lease and host, bracketed so that the thread can drop the
+ * ones that are no longer there.  The thread takes everything queued
+ * before it answers anything, so what it answers is the database as it
+ * was at a single point.
+ *
+ * Values that refer to other objects by handle (the lease's host, pool
+ * and subnet, a host's group) aren't in the copies, just as they aren't
+ * in a cursor's records.  The handles the thread gives out are its own
+ * and only good on this port.  There's no authentication on the port,
+ * so it isn't started if omapi-key is set.
+ *
+ * Leasequery stays on the main thread: answering one means evaluating
+ * the configuration against the query packet.
+ *
+ * The thread allocates with dmalloc(), which is only safe without the
+ * memory debugging options, so those turn it off.  It doesn't log, as
+ * log_error() and friends share a buffer.
+ */
+
+#include "dhcpd.h"
+
+int omapi_query_port = -1;
+
+#if defined (OMAPI_QUERY_THREAD) && \
+    !(defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL) || \
+      defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT) || defined (DEBUG_RC_HISTORY))
+
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+#if !defined (MSG_NOSIGNAL)
+# define MSG_NOSIGNAL 0
+#endif
+
+/* Changes are queued for the thread in chunks of this size; a single
+   lease or host record can be up to QUERY_RECORD_MAX bytes. */
+#define QUERY_CHUNK_SIZE	(64 * 1024)
+#define QUERY_RECORD_MAX	(16 * 1024)
+#define QUERY_FREE_CHUNKS	4
+
+#define QUERY_MAX_CONNECTIONS	256
+#define QUERY_MAX_MESSAGE	(64 * 1024)	/* the most a client may send */
+#define QUERY_OUTPUT_HIGH	(256 * 1024)	/* stop reading past this */
+#define QUERY_POLL_MSECS	100
+#define QUERY_HASH_SIZE		1024
+
+/* The kinds of change the main thread queues. */
+#define QC_LEASE	1	/* a lease record */
+#define QC_HOST		2	/* a host record */
+#define QC_HOST_GONE	3	/* the name of a deleted host */
+#define QC_RESYNC	4	/* every lease and host follows... */
+#define QC_RESYNC_DONE	5	/* ...up to here */
+
+struct query_chunk {
+	struct query_chunk *next;
+	unsigned len;
+	unsigned char data [QUERY_CHUNK_SIZE];
+};
+
+/* The queue, and the chunks the thread has finished with, are shared
+   under query_lock. */
+static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct query_chunk *query_head, *query_tail;
+static struct query_chunk *query_free;
+
+/* Main thread only. */
+static int query_running;
+static int query_listener = -1;
+static unsigned char query_scratch [QUERY_RECORD_MAX];
+
+/* Query thread only, from here down to query_append(). */
+
+#define QO_LEASE	0
+#define QO_HOST		1
+
+#define QK_PRIMARY	0	/* a lease's address, a host's name */
+#define QK_UID		1
+#define QK_HW		2
+#define QK_COUNT	3
+
+struct query_object;
+
+struct query_key {
+	struct query_key *next;		/* in its bucket */
+	struct query_object *object;
+	const unsigned char *data;	/* null if the object has no such key */
+	unsigned len;
+	u_int32_t hash;
+};
+
+struct query_table {
+	struct query_key **buckets;
+	unsigned size, count;
+};
+
+struct query_object {
+	int type;
+	int stale;			/* not seen since a resync started */
+	u_int32_t handle;
+	struct query_key keys [QK_COUNT];
+	unsigned char hw [HARDWARE_ADDR_LEN + 1];
+	unsigned char *values;		/* the record, ended by a zero name */
+	unsigned len;
+};
+
+static struct query_table query_tables [2][QK_COUNT];
+
+/* Handle n is query_handles [n - 1]; handles aren't reused. */
+static struct query_object **query_handles;
+static unsigned query_handle_count, query_handle_max;
+
+struct query_conn {
+	int fd;
+	int intro;			/* the client's introduction is in */
+	unsigned header_size;
+	u_int32_t next_id;
+	unsigned char *in;
+	unsigned in_len;
+	unsigned char *out;
+	unsigned out_len, out_sent, out_max;
+};
+
+/* A message from a client, pointing into its connection's input. */
+struct query_message {
+	u_int32_t authid, authlen, op, handle, id, rid;
+	const unsigned char *message;	/* the message's values */
+	unsigned message_len;
+	const unsigned char *object;	/* the object's values */
+	unsigned object_len;
+};
+
+static u_int32_t query_hash (const unsigned char *data, unsigned len)
+{
+	u_int32_t hash = 2166136261U;
+
+	while (len--)
+		hash = (hash ^ *data++) * 16777619U;
+	return hash;
+}
+
+static int query_table_grow (struct query_table *table)
+{
+	struct query_key **buckets, *key, *next, **tail;
+	unsigned size, i;
+
+	size = table -> size ? table -> size * 2 : QUERY_HASH_SIZE;
+	buckets = dmalloc (size * sizeof *buckets, MDL);
+	if (!buckets)
+		return 0;
+
+	/* Keep keys that are equal in the order they were added. */
+	for (i = 0; i < table -> size; i++) {
+		for (key = table -> buckets [i]; key; key = next) {
+			next = key -> next;
+			key -> next = (struct query_key *)0;
+			for (tail = &buckets [key -> hash & (size - 1)];
+			     *tail; tail = &(*tail) -> next)
+				;
+			*tail = key;
+		}
+	}
+	if (table -> buckets)
+		dfree (table -> buckets, MDL);
+	table -> buckets = buckets;
+	table -> size = size;
+	return 1;
+}
+
+static void query_table_add (struct query_table *table, struct query_key *key)
+{
+	struct query_key **tail;
+
+	if (table -> count >= table -> size && !query_table_grow (table) &&
+	    !table -> size)
+		return;
+
+	key -> hash = query_hash (key -> data, key -> len);
+	key -> next = (struct query_key *)0;
+	for (tail = &table -> buckets [key -> hash & (table -> size - 1)];
+	     *tail; tail = &(*tail) -> next)
+		;
+	*tail = key;
+	table -> count++;
+}
+
+static void query_table_remove (struct query_table *table,
+				struct query_key *key)
+{
+	struct query_key **kp;
+
+	if (!table -> size)
+		return;
+	for (kp = &table -> buckets [key -> hash & (table -> size - 1)];
+	     *kp; kp = &(*kp) -> next) {
+		if (*kp == key) {
+			*kp = key -> next;
+			table -> count--;
+			return;
+		}
+	}
+}
+
+/* Find the first object added under a key, and count (up to two) how
+   many there are. */
+static struct query_object *query_find (int type, int which,
+					const unsigned char *data,
+					unsigned len, unsigned *count)
+{
+	struct query_table *table = &query_tables [type][which];
+	struct query_object *found = (struct query_object *)0;
+	struct query_key *key;
+	u_int32_t hash;
+	unsigned n = 0;
+
+	if (table -> size) {
+		hash = query_hash (data, len);
+		for (key = table -> buckets [hash & (table -> size - 1)];
+		     key && n < 2; key = key -> next) {
+			if (key -> hash != hash || key -> len != len ||
+			    memcmp (key -> data, data, len))
+				continue;
+			if (!found)
+				found = key -> object;
+			n++;
+		}
+	}
+	if (count)
+		*count = n;
+	return found;
+}
+
+/* Find a value in a list of values encoded as on the wire.   A value
+   of zero length counts as not being there. */
+static const unsigned char *query_value (const unsigned char *values,
+					 unsigned len, const char *name,
+					 unsigned *vlen)
+{
+	const unsigned char *p = values, *end = values + len;
+	unsigned nlen, want = strlen (name);
+
+	while (end - p >= 2) {
+		nlen = getUShort (p);
+		p += 2;
+		if (!nlen || (unsigned)(end - p) < nlen + 4)
+			break;
+		*vlen = getULong (p + nlen);
+		if ((unsigned)(end - p) - nlen - 4 < *vlen)
+			break;
+		if (nlen == want && !memcmp (p, name, nlen) && *vlen)
+			return p + nlen + 4;
+		p += nlen + 4 + *vlen;
+	}
+	return (const unsigned char *)0;
+}
+
+/* Set up an object's keys from its record. */
+static void query_object_keys (struct query_object *obj)
+{
+	const unsigned char *v, *hw;
+	unsigned vlen, hwlen;
+	int i;
+
+	for (i = 0; i < QK_COUNT; i++) {
+		obj -> keys [i].object = obj;
+		obj -> keys [i].data = (const unsigned char *)0;
+		obj -> keys [i].len = 0;
+	}
+
+	v = query_value (obj -> values, obj -> len,
+			 obj -> type == QO_LEASE ? "ip-address" : "name",
+			 &vlen);
+	if (v) {
+		obj -> keys [QK_PRIMARY].data = v;
+		obj -> keys [QK_PRIMARY].len = vlen;
+	}
+
+	v = query_value (obj -> values, obj -> len,
+			 "dhcp-client-identifier", &vlen);
+	if (v) {
+		obj -> keys [QK_UID].data = v;
+		obj -> keys [QK_UID].len = vlen;
+	}
+
+	/* The hardware address is keyed with its type in front, as in
+	   struct hardware. */
+	hw = query_value (obj -> values, obj -> len,
+			  "hardware-address", &hwlen);
+	v = query_value (obj -> values, obj -> len, "hardware-type", &vlen);
+	if (hw && hwlen < sizeof obj -> hw && v && vlen == 4) {
+		obj -> hw [0] = getULong (v);
+		memcpy (&obj -> hw [1], hw, hwlen);
+		obj -> keys [QK_HW].data = obj -> hw;
+		obj -> keys [QK_HW].len = hwlen + 1;
+	}
+}
+
+static void query_object_link (struct query_object *obj)
+{
+	int i;
+
+	for (i = 0; i < QK_COUNT; i++)
+		if (obj -> keys [i].data)
+			query_table_add (&query_tables [obj -> type][i],
+					 &obj -> keys [i]);
+}
+
+static void query_object_unlink (struct query_object *obj)
+{
+	int i;
+
+	for (i = 0; i < QK_COUNT; i++)
+		if (obj -> keys [i].data)
+			query_table_remove (&query_tables [obj -> type][i],
+					    &obj -> keys [i]);
+}
+
+static void query_object_forget (struct query_object *obj)
+{
+	query_object_unlink (obj);
+	query_handles [obj -> handle - 1] = (struct query_object *)0;
+	dfree (obj -> values, MDL);
+	dfree (obj, MDL);
+}
+
+static int query_object_handle (struct query_object *obj)
+{
+	struct query_object **handles;
+	unsigned max;
+
+	if (query_handle_count == query_handle_max) {
+		max = query_handle_max ? query_handle_max * 2 : 1024;
+		handles = dmalloc (max * sizeof *handles, MDL);
+		if (!handles)
+			return 0;
+		if (query_handles) {
+			memcpy (handles, query_handles,
+				query_handle_count * sizeof *handles);
+			dfree (query_handles, MDL);
+		}
+		query_handles = handles;
+		query_handle_max = max;
+	}
+	query_handles [query_handle_count++] = obj;
+	obj -> handle = query_handle_count;
+	return 1;
+}
+
+/* Take a new record for a lease or host, replacing the one with the
+   same address or name if there is one. */
+static void query_object_update (int type, const unsigned char *data,
+				 unsigned len)
+{
+	struct query_object *obj;
+	const unsigned char *key;
+	unsigned char *values;
+	unsigned klen;
+
+	key = query_value (data, len,
+			   type == QO_LEASE ? "ip-address" : "name", &klen);
+	if (!key)
+		return;
+
+	values = dmalloc (len, MDL);
+	if (!values)
+		return;
+	memcpy (values, data, len);
+
+	obj = query_find (type, QK_PRIMARY, key, klen, (unsigned *)0);
+	if (obj) {
+		query_object_unlink (obj);
+		dfree (obj -> values, MDL);
+	} else {
+		obj = dmalloc (sizeof *obj, MDL);
+		if (!obj || !query_object_handle (obj)) {
+			if (obj)
+				dfree (obj, MDL);
+			dfree (values, MDL);
+			return;
+		}
+		obj -> type = type;
+	}
+	obj -> stale = 0;
+	obj -> values = values;
+	obj -> len = len;
+	query_object_keys (obj);
+	query_object_link (obj);
+}
+
+static void query_apply (int kind, const unsigned char *data, unsigned len)
+{
+	struct query_object *obj;
+	unsigned i;
+
+	switch (kind) {
+	      case QC_LEASE:
+		query_object_update (QO_LEASE, data, len);
+		break;
+
+	      case QC_HOST:
+		query_object_update (QO_HOST, data, len);
+		break;
+
+	      case QC_HOST_GONE:
+		obj = query_find (QO_HOST, QK_PRIMARY, data, len,
+				  (unsigned *)0);
+		if (obj)
+			query_object_forget (obj);
+		break;
+
+	      case QC_RESYNC:
+		for (i = 0; i < query_handle_count; i++)
+			if (query_handles [i])
+				query_handles [i] -> stale = 1;
+		break;
+
+	      case QC_RESYNC_DONE:
+		for (i = 0; i < query_handle_count; i++)
+			if (query_handles [i] && query_handles [i] -> stale)
+				query_object_forget (query_handles [i]);
+		break;
+	}
+}
+
+/* Take everything the main thread has queued. */
+static void query_drain ()
+{
+	struct query_chunk *chunk, *next, *cp;
+	unsigned ofs, len, n;
+
+	pthread_mutex_lock (&query_lock);
+	chunk = query_head;
+	query_head = query_tail = (struct query_chunk *)0;
+	pthread_mutex_unlock (&query_lock);
+
+	for (; chunk; chunk = next) {
+		next = chunk -> next;
+		for (ofs = 0; ofs < chunk -> len; ofs += 5 + len) {
+			len = getULong (chunk -> data + ofs + 1);
+			query_apply (chunk -> data [ofs],
+				     chunk -> data + ofs + 5, len);
+		}
+
+		/* Keep a few chunks for the main thread to use again. */
+		pthread_mutex_lock (&query_lock);
+		for (n = 0, cp = query_free; cp; cp = cp -> next)
+			n++;
+		if (n < QUERY_FREE_CHUNKS) {
+			chunk -> next = query_free;
+			query_free = chunk;
+			chunk = (struct query_chunk *)0;
+		}
+		pthread_mutex_unlock (&query_lock);
+		if (chunk)
+			dfree (chunk, MDL);
+	}
+}
+
+static isc_result_t query_handle_lookup (struct query_object **op,
+					 u_int32_t handle)
+{
+	if (handle < 1 || handle > query_handle_count ||
+	    !query_handles [handle - 1])
+		return ISC_R_NOTFOUND;
+	*op = query_handles [handle - 1];
+	return ISC_R_SUCCESS;
+}
+
+/* Make up a hardware address key from the hardware-address and
+   hardware-type values, as dhcp_lease_lookup() does. */
+static isc_result_t query_hw_key (unsigned char *haddr, unsigned *len,
+				  const struct query_message *m,
+				  const unsigned char *hw, unsigned hwlen)
+{
+	const unsigned char *v;
+	unsigned vlen;
+
+	if (hwlen > HARDWARE_ADDR_LEN)
+		return ISC_R_NOTFOUND;
+
+	v = query_value (m -> object, m -> object_len, "hardware-type", &vlen);
+	if (v) {
+		if (vlen != 4 || v [0] || v [1] || v [2])
+			return DHCP_R_INVALIDARG;
+		haddr [0] = v [3];
+	} else
+		haddr [0] = HTYPE_ETHER;
+	memcpy (haddr + 1, hw, hwlen);
+	*len = hwlen + 1;
+	return ISC_R_SUCCESS;
+}
+
+/* Find the handle an object was asked for by, if it was. */
+static isc_result_t query_lookup_handle (struct query_object **op, int type,
+					 const struct query_message *m)
+{
+	const unsigned char *v;
+	unsigned vlen;
+	isc_result_t status;
+
+	v = query_value (m -> object, m -> object_len, "handle", &vlen);
+	if (!v)
+		return ISC_R_SUCCESS;
+	if (vlen != 4)
+		return DHCP_R_INVALIDARG;
+	status = query_handle_lookup (op, getULong (v));
+	if (status != ISC_R_SUCCESS)
+		return status;
+	if ((*op) -> type != type) {
+		*op = (struct query_object *)0;
+		return DHCP_R_INVALIDARG;
+	}
+	return ISC_R_SUCCESS;
+}
+
+/* The same lookup as dhcp_lease_lookup(), with the same results. */
+static isc_result_t query_lease_lookup (struct query_object **op,
+					const struct query_message *m)
+{
+	struct query_object *obj = (struct query_object *)0, *found;
+	unsigned char haddr [HARDWARE_ADDR_LEN + 1];
+	const unsigned char *v;
+	unsigned vlen, count;
+	isc_result_t status;
+
+	status = query_lookup_handle (&obj, QO_LEASE, m);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	v = query_value (m -> object, m -> object_len, "ip-address", &vlen);
+	if (v) {
+		found = query_find (QO_LEASE, QK_PRIMARY, v, vlen,
+				    (unsigned *)0);
+		if (obj && obj != found)
+			return DHCP_R_KEYCONFLICT;
+		if (!found)
+			return ISC_R_NOTFOUND;
+		obj = found;
+	}
+
+	v = query_value (m -> object, m -> object_len,
+			 "dhcp-client-identifier", &vlen);
+	if (v) {
+		found = query_find (QO_LEASE, QK_UID, v, vlen, &count);
+		if (obj && obj != found)
+			return DHCP_R_KEYCONFLICT;
+		if (!found)
+			return ISC_R_NOTFOUND;
+		if (count > 1)
+			return DHCP_R_MULTIPLE;
+		obj = found;
+	}
+
+	v = query_value (m -> object, m -> object_len,
+			 "hardware-address", &vlen);
+	if (v) {
+		status = query_hw_key (haddr, &vlen, m, v, vlen);
+		if (status == DHCP_R_INVALIDARG)
+			return status;
+		found = (status == ISC_R_SUCCESS
+			 ? query_find (QO_LEASE, QK_HW, haddr, vlen, &count)
+			 : (struct query_object *)0);
+		if (obj && obj != found)
+			return DHCP_R_KEYCONFLICT;
+		if (!found)
+			return ISC_R_NOTFOUND;
+		if (count > 1)
+			return DHCP_R_MULTIPLE;
+		obj = found;
+	}
+
+	if (!obj)
+		return DHCP_R_NOKEYS;
+	*op = obj;
+	return ISC_R_SUCCESS;
+}
+
+/* The same lookup as dhcp_host_lookup(), with the same results. */
+static isc_result_t query_host_lookup (struct query_object **op,
+				       const struct query_message *m)
+{
+	struct query_object *obj = (struct query_object *)0, *found, *lease;
+	unsigned char haddr [HARDWARE_ADDR_LEN + 1];
+	const unsigned char *v;
+	unsigned vlen;
+	isc_result_t status;
+
+	status = query_lookup_handle (&obj, QO_HOST, m);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	v = query_value (m -> object, m -> object_len,
+			 "dhcp-client-identifier", &vlen);
+	if (v) {
+		found = query_find (QO_HOST, QK_UID, v, vlen, (unsigned *)0);
+		if (obj && obj != found)
+			return DHCP_R_KEYCONFLICT;
+		if (!found)
+			return ISC_R_NOTFOUND;
+		obj = found;
+	}
+
+	v = query_value (m -> object, m -> object_len,
+			 "hardware-address", &vlen);
+	if (v) {
+		status = query_hw_key (haddr, &vlen, m, v, vlen);
+		if (status == DHCP_R_INVALIDARG)
+			return status;
+		found = (status == ISC_R_SUCCESS
+			 ? query_find (QO_HOST, QK_HW, haddr, vlen,
+				       (unsigned *)0)
+			 : (struct query_object *)0);
+		if (obj && obj != found)
+			return DHCP_R_KEYCONFLICT;
+		if (!found)
+			return ISC_R_NOTFOUND;
+		obj = found;
+	}
+
+	/* By address means the host with the hardware address of the
+	   lease on that address. */
+	v = query_value (m -> object, m -> object_len, "ip-address", &vlen);
+	if (v) {
+		lease = query_find (QO_LEASE, QK_PRIMARY, v, vlen,
+				    (unsigned *)0);
+		if (!lease && !obj)
+			return ISC_R_NOTFOUND;
+		if (lease) {
+			found = (lease -> keys [QK_HW].data
+				 ? query_find (QO_HOST, QK_HW,
+					       lease -> keys [QK_HW].data,
+					       lease -> keys [QK_HW].len,
+					       (unsigned *)0)
+				 : (struct query_object *)0);
+			if (found && obj && obj != found)
+				return DHCP_R_KEYCONFLICT;
+			if (!found && !obj)
+				return ISC_R_NOTFOUND;
+			if (!obj)
+				obj = found;
+		}
+	}
+
+	v = query_value (m -> object, m -> object_len, "name", &vlen);
+	if (v) {
+		found = query_find (QO_HOST, QK_PRIMARY, v, vlen,
+				    (unsigned *)0);
+		if (obj && obj != found)
+			return DHCP_R_KEYCONFLICT;
+		if (!found)
+			return ISC_R_NOTFOUND;
+		obj = found;
+	}
+
+	if (!obj)
+		return DHCP_R_NOKEYS;
+	*op = obj;
+	return ISC_R_SUCCESS;
+}
+
+static int query_output (struct query_conn *c, const void *data, unsigned len)
+{
+	unsigned char *out;
+	unsigned max;
+
+	if (c -> out_sent) {
+		memmove (c -> out, c -> out + c -> out_sent,
+			 c -> out_len - c -> out_sent);
+		c -> out_len -= c -> out_sent;
+		c -> out_sent = 0;
+	}
+	if (c -> out_len + len > c -> out_max) {
+		for (max = c -> out_max ? c -> out_max : 16384;
+		     max < c -> out_len + len; max *= 2)
+			;
+		out = dmalloc (max, MDL);
+		if (!out)
+			return 0;
+		if (c -> out) {
+			memcpy (out, c -> out, c -> out_len);
+			dfree (c -> out, MDL);
+		}
+		c -> out = out;
+		c -> out_max = max;
+	}
+	memcpy (c -> out + c -> out_len, data, len);
+	c -> out_len += len;
+	return 1;
+}
+
+/* Send a message: a header as omapi_protocol_send_message() writes one,
+   the message's values and the object's, each list with its end. */
+static int query_send (struct query_conn *c, u_int32_t op, u_int32_t handle,
+		       u_int32_t rid, const unsigned char *message,
+		       unsigned message_len, const unsigned char *object,
+		       unsigned object_len)
+{
+	unsigned char header [24];
+
+	putULong (header, 0);			/* authid */
+	putULong (header + 4, 0);		/* authlen */
+	putULong (header + 8, op);
+	putULong (header + 12, handle);
+	putULong (header + 16, c -> next_id++);
+	putULong (header + 20, rid);
+	return (query_output (c, header, sizeof header) &&
+		query_output (c, message, message_len) &&
+		query_output (c, object, object_len));
+}
+
+static int query_status (struct query_conn *c, const struct query_message *m,
+			 isc_result_t result, const char *text)
+{
+	static const unsigned char none [2] = { 0, 0 };
+	unsigned char buf [256];
+	struct omapi_record rec;
+
+	rec.buf = buf;
+	rec.len = 0;
+	rec.max = sizeof buf;
+	omapi_record_put_uint32 (&rec, "result", (u_int32_t)result);
+	if (text)
+		omapi_record_put (&rec, "message", text, strlen (text));
+	omapi_record_end (&rec);
+	return query_send (c, OMAPI_OP_STATUS, 0, m -> id,
+			   rec.buf, rec.len, none, sizeof none);
+}
+
+static int query_update (struct query_conn *c, const struct query_message *m,
+			 struct query_object *obj)
+{
+	static const unsigned char none [2] = { 0, 0 };
+
+	return query_send (c, OMAPI_OP_UPDATE, obj -> handle, m -> id,
+			   none, sizeof none, obj -> values, obj -> len);
+}
+
+/* Answer a message the way omapi_message_process() would, for what this
+   port does. */
+static int query_answer (struct query_conn *c, const struct query_message *m)
+{
+	static const char read_only [] =
+		"the query port is read-only: use omapi-port";
+	struct query_object *obj = (struct query_object *)0;
+	const unsigned char *type, *v;
+	unsigned tlen, vlen;
+	isc_result_t status;
+
+	/* Nothing is ever asked of the client, so there's nothing it can
+	   answer. */
+	if (m -> rid)
+		return 1;
+	if (m -> authid)
+		return query_status (c, m, DHCP_R_KEY_UNKNOWN,
+				     "no keys on the query port");
+
+	switch (m -> op) {
+	      case OMAPI_OP_OPEN:
+		if (((v = query_value (m -> message, m -> message_len,
+				       "create", &vlen)) &&
+		     (vlen != 4 || getULong (v))) ||
+		    ((v = query_value (m -> message, m -> message_len,
+				       "update", &vlen)) &&
+		     (vlen != 4 || getULong (v))))
+			return query_status (c, m, ISC_R_NOPERM, read_only);
+
+		type = query_value (m -> message, m -> message_len,
+				    "type", &tlen);
+		if (!type)
+			goto refresh;
+		if (tlen == 5 && !memcmp (type, "lease", 5))
+			status = query_lease_lookup (&obj, m);
+		else if (tlen == 4 && !memcmp (type, "host", 4))
+			status = query_host_lookup (&obj, m);
+		else
+			return query_status (c, m, ISC_R_NOTIMPLEMENTED,
+					     "unsearchable object type");
+
+		if (status == ISC_R_NOTFOUND)
+			return query_status (c, m, status,
+					     "no object matches specification");
+		if (status != ISC_R_SUCCESS)
+			return query_status (c, m, status,
+					     "object lookup failed");
+		return query_update (c, m, obj);
+
+	      case OMAPI_OP_REFRESH:
+	      refresh:
+		status = query_handle_lookup (&obj, m -> handle);
+		if (status != ISC_R_SUCCESS)
+			return query_status (c, m, status,
+					     "no matching handle");
+		return query_update (c, m, obj);
+
+	      case OMAPI_OP_UPDATE:
+	      case OMAPI_OP_DELETE:
+		return query_status (c, m, ISC_R_NOPERM, read_only);
+	}
+	return 1;
+}
+
+/* If there's a whole message at the start of the connection's input,
+   return its length; return zero if there isn't yet, and -1 if what's
+   there can't be a message. */
+static int query_parse (struct query_conn *c, struct query_message *m)
+{
+	const unsigned char *p = c -> in, *end = c -> in + c -> in_len;
+	const unsigned char *start;
+	unsigned nlen, vlen;
+	int section;
+
+	if (c -> in_len < c -> header_size)
+		return 0;
+	m -> authid = getULong (p);
+	m -> authlen = getULong (p + 4);
+	m -> op = getULong (p + 8);
+	m -> handle = getULong (p + 12);
+	m -> id = getULong (p + 16);
+	m -> rid = getULong (p + 20);
+	p += c -> header_size;
+
+	for (section = 0; section < 2; section++) {
+		start = p;
+		for (;;) {
+			if (end - p < 2)
+				return 0;
+			nlen = getUShort (p);
+			p += 2;
+			if (!nlen)
+				break;
+			if ((unsigned)(end - p) < nlen + 4)
+				return 0;
+			vlen = getULong (p + nlen);
+			if (vlen > QUERY_MAX_MESSAGE)
+				return -1;
+			p += nlen + 4;
+			if ((unsigned)(end - p) < vlen)
+				return 0;
+			p += vlen;
+		}
+		if (section == 0) {
+			m -> message = start;
+			m -> message_len = p - start;
+		} else {
+			m -> object = start;
+			m -> object_len = p - start;
+		}
+	}
+
+	if (m -> authlen > QUERY_MAX_MESSAGE)
+		return -1;
+	if ((unsigned)(end - p) < m -> authlen)
+		return 0;
+	return p + m -> authlen - c -> in;
+}
+
+/* Answer whatever whole messages have come in, as long as the client
+   is reading the answers.   Returns zero if the connection should be
+   closed. */
+static int query_process (struct query_conn *c)
+{
+	struct query_message m;
+	unsigned used = 0;
+	int len;
+
+	if (!c -> intro) {
+		if (c -> in_len < 8)
+			return 1;
+		if (getULong (c -> in) != OMAPI_PROTOCOL_VERSION)
+			return 0;
+		c -> header_size = getULong (c -> in + 4);
+		if (c -> header_size < 24 ||
+		    c -> header_size > QUERY_MAX_MESSAGE / 2)
+			return 0;
+		c -> intro = 1;
+		used = 8;
+	}
+
+	while (c -> out_len - c -> out_sent < QUERY_OUTPUT_HIGH) {
+		memmove (c -> in, c -> in + used, c -> in_len - used);
+		c -> in_len -= used;
+		used = 0;
+
+		len = query_parse (c, &m);
+		if (len < 0)
+			return 0;
+		if (len == 0) {
+			/* A message that won't fit is an error. */
+			return c -> in_len < QUERY_MAX_MESSAGE;
+		}
+		if (!query_answer (c, &m))
+			return 0;
+		used = len;
+	}
+	memmove (c -> in, c -> in + used, c -> in_len - used);
+	c -> in_len -= used;
+	return 1;
+}
+
+static int query_read (struct query_conn *c)
+{
+	ssize_t n;
+
+	if (c -> in_len == QUERY_MAX_MESSAGE)
+		return 1;
+	n = read (c -> fd, c -> in + c -> in_len,
+		  QUERY_MAX_MESSAGE - c -> in_len);
+	if (n == 0)
+		return 0;
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ||
+			errno == EINTR;
+	c -> in_len += n;
+	return 1;
+}
+
+static int query_write (struct query_conn *c)
+{
+	ssize_t n;
+
+	while (c -> out_sent < c -> out_len) {
+		n = send (c -> fd, c -> out + c -> out_sent,
+			  c -> out_len - c -> out_sent, MSG_NOSIGNAL);
+		if (n < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR;
+		c -> out_sent += n;
+	}
+	c -> out_len = c -> out_sent = 0;
+	return 1;
+}
+
+static struct query_conn *query_accept ()
+{
+	unsigned char intro [8];
+	struct query_conn *c;
+	int fd, flag = 1;
+
+	fd = accept (query_listener, (struct sockaddr *)0, (socklen_t *)0);
+	if (fd < 0)
+		return (struct query_conn *)0;
+	if (fcntl (fd, F_SETFL, O_NONBLOCK) < 0) {
+		close (fd);
+		return (struct query_conn *)0;
+	}
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+
+	c = dmalloc (sizeof *c, MDL);
+	if (c)
+		c -> in = dmalloc (QUERY_MAX_MESSAGE, MDL);
+	if (!c || !c -> in) {
+		if (c)
+			dfree (c, MDL);
+		close (fd);
+		return (struct query_conn *)0;
+	}
+	c -> fd = fd;
+	c -> next_id = random ();
+
+	putULong (intro, OMAPI_PROTOCOL_VERSION);
+	putULong (intro + 4, 24);
+	query_output (c, intro, sizeof intro);
+	return c;
+}
+
+static void query_close (struct query_conn *c)
+{
+	close (c -> fd);
+	dfree (c -> in, MDL);
+	if (c -> out)
+		dfree (c -> out, MDL);
+	dfree (c, MDL);
+}
+
+static void *query_main (void *arg)
+{
+	struct pollfd fds [QUERY_MAX_CONNECTIONS + 1];
+	struct query_conn *conns [QUERY_MAX_CONNECTIONS];
+	struct query_conn *c;
+	int count = 0, polled, i, j, ok;
+
+	for (;;) {
+		fds [0].fd = query_listener;
+		fds [0].events = count < QUERY_MAX_CONNECTIONS ? POLLIN : 0;
+		for (i = 0; i < count; i++) {
+			c = conns [i];
+			fds [i + 1].fd = c -> fd;
+			fds [i + 1].events = 0;
+			if (c -> out_sent < c -> out_len)
+				fds [i + 1].events |= POLLOUT;
+			if (c -> out_len - c -> out_sent < QUERY_OUTPUT_HIGH)
+				fds [i + 1].events |= POLLIN;
+		}
+		polled = count;
+
+		if (poll (fds, polled + 1, QUERY_POLL_MSECS) < 0)
+			for (i = 0; i <= polled; i++)
+				fds [i].revents = 0;
+
+		/* Answer from the database as it is now. */
+		query_drain ();
+
+		for (i = j = 0; i < polled; i++) {
+			c = conns [i];
+			ok = 1;
+			if (fds [i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+				ok = query_read (c);
+			if (ok)
+				ok = query_process (c);
+			if (ok && c -> out_sent < c -> out_len)
+				ok = query_write (c);
+			if (ok)
+				conns [j++] = c;
+			else
+				query_close (c);
+		}
+		count = j;
+
+		if (fds [0].revents & POLLIN) {
+			while (count < QUERY_MAX_CONNECTIONS &&
+			       (c = query_accept ()) != NULL) {
+				if (query_write (c))
+					conns [count++] = c;
+				else
+					query_close (c);
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Main thread from here down. */
+
+/* Add a change to the end of a list of chunks, taking a new chunk from
+   *spare if there's one there.   The caller holds query_lock if the list
+   is the shared one. */
+static int query_append (struct query_chunk **head, struct query_chunk **tail,
+			 struct query_chunk **spare, int kind,
+			 const unsigned char *data, unsigned len)
+{
+	struct query_chunk *chunk = *tail;
+
+	if (!chunk || chunk -> len + 5 + len > QUERY_CHUNK_SIZE) {
+		if (spare && *spare) {
+			chunk = *spare;
+			*spare = chunk -> next;
+		} else {
+			chunk = dmalloc (sizeof *chunk, MDL);
+			if (!chunk)
+				return 0;
+		}
+		chunk -> next = (struct query_chunk *)0;
+		chunk -> len = 0;
+		if (*tail)
+			(*tail) -> next = chunk;
+		else
+			*head = chunk;
+		*tail = chunk;
+	}
+
+	chunk -> data [chunk -> len] = kind;
+	putULong (chunk -> data + chunk -> len + 1, len);
+	if (len)
+		memcpy (chunk -> data + chunk -> len + 5, data, len);
+	chunk -> len += 5 + len;
+	return 1;
+}
+
+static void query_publish (int kind, const unsigned char *data, unsigned len)
+{
+	int ok;
+
+	pthread_mutex_lock (&query_lock);
+	ok = query_append (&query_head, &query_tail, &query_free,
+			   kind, data, len);
+	pthread_mutex_unlock (&query_lock);
+	if (!ok)
+		log_error ("OMAPI query thread: no memory for an update.");
+}
+
+/* Encode a lease or host into query_scratch, and return the length, or
+   zero if there's nothing to send. */
+static unsigned query_encode (int kind, void *object)
+{
+	struct omapi_record rec;
+	int rv;
+
+	rec.buf = query_scratch;
+	rec.len = 0;
+	rec.max = sizeof query_scratch;
+	if (kind == QC_LEASE)
+		rv = omapi_record_lease (&rec, (struct lease *)object);
+	else
+		rv = omapi_record_host (&rec, (struct host_decl *)object);
+	if (rv == 0)
+		log_error ("OMAPI query thread: record too large, skipped.");
+	return rv > 0 ? rec.len : 0;
+}
+
+void omapi_query_lease (struct lease *lease)
+{
+	unsigned len;
+
+	if (!query_running)
+		return;
+	len = query_encode (QC_LEASE, lease);
+	if (len)
+		query_publish (QC_LEASE, query_scratch, len);
+}
+
+void omapi_query_host (struct host_decl *hd)
+{
+	unsigned len;
+
+	if (!query_running || !hd -> name)
+		return;
+	if (hd -> flags & HOST_DECL_DELETED) {
+		query_publish (QC_HOST_GONE, (unsigned char *)hd -> name,
+			       strlen (hd -> name));
+		return;
+	}
+	len = query_encode (QC_HOST, hd);
+	if (len)
+		query_publish (QC_HOST, query_scratch, len);
+}
+
+/* lease_ip_hash_foreach() and host_hash_foreach() don't pass a context
+   pointer, so the list being built is kept here. */
+static struct query_chunk *resync_head, *resync_tail;
+static int resync_failed;
+
+static void resync_append (int kind, void *object)
+{
+	unsigned len;
+
+	if (resync_failed)
+		return;
+	len = object ? query_encode (kind, object) : 0;
+	if (object && !len)
+		return;
+	if (!query_append (&resync_head, &resync_tail,
+			   (struct query_chunk **)0, kind, query_scratch, len))
+		resync_failed = 1;
+}
+
+static isc_result_t resync_lease (const void *name, unsigned len,
+				  void *object)
+{
+	resync_append (QC_LEASE, object);
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t resync_host (const void *name, unsigned len,
+				 void *object)
+{
+	resync_append (QC_HOST, object);
+	return ISC_R_SUCCESS;
+}
+
+/* Send the thread every lease and host, all in one go so that it never
+   answers from part of them. */
+void omapi_query_resync ()
+{
+	struct query_chunk *chunk;
+
+	if (!query_running)
+		return;
+
+	resync_head = resync_tail = (struct query_chunk *)0;
+	resync_failed = 0;
+	resync_append (QC_RESYNC, NULL);
+	if (lease_ip_addr_hash)
+		lease_ip_hash_foreach (lease_ip_addr_hash, resync_lease);
+	if (host_name_hash)
+		host_hash_foreach (host_name_hash, resync_host);
+	resync_append (QC_RESYNC_DONE, NULL);
+
+	if (resync_failed) {
+		log_error ("OMAPI query thread: no memory to copy the "
+			   "leases and hosts.");
+		while ((chunk = resync_head) != NULL) {
+			resync_head = chunk -> next;
+			dfree (chunk, MDL);
+		}
+		resync_tail = (struct query_chunk *)0;
+		return;
+	}
+
+	pthread_mutex_lock (&query_lock);
+	if (query_tail)
+		query_tail -> next = resync_head;
+	else
+		query_head = resync_head;
+	query_tail = resync_tail;
+	pthread_mutex_unlock (&query_lock);
+	resync_head = resync_tail = (struct query_chunk *)0;
+}
+
+/* In a child process there's no thread to send anything to. */
+void omapi_query_forget ()
+{
+	query_running = 0;
+}
+
+void omapi_query_start ()
+{
+	struct sockaddr_in sin;
+	sigset_t all, old;
+	pthread_t thread;
+	int flag = 1, rv;
+
+	if (query_running)
+		return;
+
+	query_listener = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (query_listener < 0) {
+		log_error ("Can't start the OMAPI query thread: socket: %m");
+		return;
+	}
+	setsockopt (query_listener, SOL_SOCKET, SO_REUSEADDR,
+		    &flag, sizeof flag);
+	memset (&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+#ifdef HAVE_SA_LEN
+	sin.sin_len = sizeof sin;
+#endif
+	sin.sin_port = htons (omapi_query_port);
+	sin.sin_addr.s_addr = htonl (INADDR_ANY);
+	if (bind (query_listener, (struct sockaddr *)&sin, sizeof sin) < 0 ||
+	    listen (query_listener, 64) < 0 ||
+	    fcntl (query_listener, F_SETFL, O_NONBLOCK) < 0) {
+		log_error ("Can't start the OMAPI query thread on port %d: %m",
+			   omapi_query_port);
+		close (query_listener);
+		query_listener = -1;
+		return;
+	}
+
+	query_running = 1;
+	omapi_query_resync ();
+
+	/* Signals are for the main thread. */
+	sigfillset (&all);
+	pthread_sigmask (SIG_SETMASK, &all, &old);
+	rv = pthread_create (&thread, NULL, query_main, NULL);
+	pthread_sigmask (SIG_SETMASK, &old, NULL);
+	if (rv) {
+		log_error ("Can't start the OMAPI query thread: %s",
+			   strerror (rv));
+		query_running = 0;
+		close (query_listener);
+		query_listener = -1;
+		return;
+	}
+	pthread_detach (thread);
+	log_info ("OMAPI queries on port %d are answered on their own thread.",
+		  omapi_query_port);
+}
+
+#else /* !OMAPI_QUERY_THREAD ... */
+
+void omapi_query_start ()
+{
+#if defined (OMAPI_QUERY_THREAD)
+	log_error ("omapi-query-port isn't available with the memory "
+		   "debugging options.");
+#else
+	log_error ("omapi-query-port needs a server built with "
+		   "--enable-omapi-query-thread.");
+#endif
+}
+
+#if defined (OMAPI_QUERY_THREAD)
+void omapi_query_lease (struct lease *lease)
+{
+}
+
+void omapi_query_host (struct host_decl *hd)
+{
+}
+
+void omapi_query_resync ()
+{
+}
+
+void omapi_query_forget ()
+{
+}
+#endif
+#endif /* OMAPI_QUERY_THREAD */
@@ -0,0 +1,466 @@
+/* ping.c
+
+   Ping check engine for the DHCP server. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/ping.c
+ *
+ * \page ping check engine
+ *
+ * When ping-check is enabled the server sends an ICMP Echo request to an
+ * address before offering it (see do_ping_check()), and only makes the
+ * offer once the ping times out without an answer.
+ *
+ * Each outstanding ping is a probe.  Probes live in a table indexed by
+ * the ICMP sequence number we send, and the ICMP identifier carries a
+ * generation count for the table slot, so a reply is matched to its lease
+ * directly and stale or forged replies are easily discarded.  The
+ * deadlines of all the probes are kept in a heap and a single timer is
+ * set for the earliest one, rather than one timer per lease.  The echo
+ * requests themselves are queued and sent in batches by the ICMP code.
+ *
+ * An address whose ping timed out is remembered for ping-cache-secs
+ * seconds.  If the address is offered again within that time, for
+ * instance because the client repeated its DISCOVER, the offer is made
+ * without pinging it again.
+ *
+ * Counts of pings sent, answered and timed out, along with a histogram
+ * of the round trip times of the answers, are logged every
+ * PING_STATS_INTERVAL seconds while pings are being sent.
+ */
+
+#include "dhcpd.h"
+#include "netinet/ip.h"
+#include "netinet/ip_icmp.h"
+
+struct ping_probe {
+	struct lease *lease;		/* lease being probed, NULL if free */
+	struct timeval sent;
+	struct timeval deadline;
+	TIME cache_secs;		/* how long to remember silence */
+	unsigned int heap_index;
+	u_int16_t seq;			/* our slot in ping_probes */
+	u_int16_t gen;			/* sent as the ICMP identifier */
+	struct ping_probe *next;	/* next free probe */
+};
+
+/* The sequence number limits us to this many outstanding pings. */
+#define PING_MAX_PROBES 65536
+#define PING_PROBES_INCREMENT 1024
+
+static struct ping_probe **ping_probes;
+static unsigned ping_probes_max;
+static struct ping_probe *ping_free_probes;
+static isc_heap_t *ping_deadlines;
+static int ping_timer_set;
+static struct timeval ping_timer_at;
+
+/* Addresses that have recently been pinged without an answer.  This is
+   only a cache, an address that collides with another one is simply
+   forgotten and will be pinged again. */
+#define PING_CACHE_SIZE 16384
+
+struct ping_cache_entry {
+	u_int32_t addr;
+	TIME expires;
+};
+
+static struct ping_cache_entry *ping_cache;
+
+/* Round trip times are counted in buckets of <1ms, <2ms, <4ms ... */
+#define PING_RTT_BUCKETS 12
+#define PING_STATS_INTERVAL 300
+
+static struct {
+	unsigned long sent;
+	unsigned long answered;
+	unsigned long timed_out;
+	unsigned long cached;
+	unsigned long rtt [PING_RTT_BUCKETS];
+} ping_stats;
+static TIME ping_stats_next;
+
+static void ping_timeout (void *);
+
+static isc_boolean_t
+ping_earlier(void *a, void *b) {
+	struct ping_probe *pa = a, *pb = b;
+
+	if (pa->deadline.tv_sec != pb->deadline.tv_sec)
+		return (pa->deadline.tv_sec < pb->deadline.tv_sec
+			? ISC_TRUE : ISC_FALSE);
+	return (pa->deadline.tv_usec < pb->deadline.tv_usec
+		? ISC_TRUE : ISC_FALSE);
+}
+
+static void
+ping_index_changed(void *probe, unsigned int new_heap_index) {
+	((struct ping_probe *)probe)->heap_index = new_heap_index;
+}
+
+/*
+ * Get a free probe, growing the table if we have to.  Returns NULL if
+ * every sequence number is in use or we are out of memory.
+ */
+static struct ping_probe *
+ping_probe_get(void) {
+	struct ping_probe **np, *probe;
+	unsigned i, new_max;
+
+	if (ping_free_probes == NULL) {
+		if (ping_probes_max == PING_MAX_PROBES)
+			return (NULL);
+
+		new_max = ping_probes_max + PING_PROBES_INCREMENT;
+		np = dmalloc(new_max * sizeof(*np), MDL);
+		if (np == NULL)
+			return (NULL);
+		if (ping_probes != NULL) {
+			memcpy(np, ping_probes,
+			       ping_probes_max * sizeof(*np));
+			dfree(ping_probes, MDL);
+		}
+		ping_probes = np;
+
+		for (i = new_max; i > ping_probes_max; i--) {
+			probe = dmalloc(sizeof(*probe), MDL);
+			if (probe == NULL)
+				log_fatal("No memory for ping probes.");
+			probe->seq = i - 1;
+			probe->next = ping_free_probes;
+			ping_free_probes = probe;
+			ping_probes[i - 1] = probe;
+		}
+		ping_probes_max = new_max;
+	}
+
+	probe = ping_free_probes;
+	ping_free_probes = probe->next;
+	probe->next = NULL;
+	return (probe);
+}
+
+/* Return a probe to the free list.  The probe must not be in the heap. */
+static void
+ping_probe_put(struct ping_probe *probe) {
+	lease_dereference(&probe->lease, MDL);
+
+	/* Anything still in flight for this slot is now stale. */
+	probe->gen++;
+	probe->next = ping_free_probes;
+	ping_free_probes = probe;
+}
+
+/* Make sure the timer is set for the earliest outstanding deadline. */
+static void
+ping_timer_update(void) {
+	struct ping_probe *first = NULL;
+
+	if (ping_deadlines != NULL)
+		first = isc_heap_element(ping_deadlines, 1);
+
+	if (first == NULL) {
+		if (ping_timer_set) {
+			cancel_timeout(ping_timeout, NULL);
+			ping_timer_set = 0;
+		}
+		return;
+	}
+
+	if (ping_timer_set &&
+	    (ping_timer_at.tv_sec == first->deadline.tv_sec) &&
+	    (ping_timer_at.tv_usec == first->deadline.tv_usec))
+		return;
+
+	ping_timer_at = first->deadline;
+	ping_timer_set = 1;
+	add_timeout(&ping_timer_at, ping_timeout, NULL, 0, 0);
+}
+
+static unsigned
+ping_cache_slot(struct iaddr *addr) {
+	u_int32_t a;
+
+	memcpy(&a, addr->iabuf, sizeof(a));
+	a = ntohl(a);
+	return ((a ^ (a >> 14)) & (PING_CACHE_SIZE - 1));
+}
+
+/* Remember that addr didn't answer a ping, for cache_secs seconds. */
+static void
+ping_cache_add(struct iaddr *addr, TIME cache_secs) {
+	struct ping_cache_entry *entry;
+
+	if ((cache_secs <= 0) || (addr->len != 4))
+		return;
+
+	if (ping_cache == NULL) {
+		ping_cache = dmalloc(PING_CACHE_SIZE * sizeof(*ping_cache),
+				     MDL);
+		if (ping_cache == NULL)
+			return;
+	}
+
+	entry = &ping_cache[ping_cache_slot(addr)];
+	memcpy(&entry->addr, addr->iabuf, sizeof(entry->addr));
+	entry->expires = cur_time + cache_secs;
+}
+
+/*!
+ * \brief Check whether an address recently stayed silent when pinged
+ *
+ * \param addr the address to check
+ * \return 1 if the address was pinged without an answer recently
+ * enough that it doesn't need to be pinged again, 0 otherwise
+ */
+int
+ping_recently_silent(struct iaddr *addr) {
+	struct ping_cache_entry *entry;
+
+	if ((ping_cache == NULL) || (addr->len != 4))
+		return (0);
+
+	entry = &ping_cache[ping_cache_slot(addr)];
+	if ((memcmp(&entry->addr, addr->iabuf, sizeof(entry->addr)) != 0) ||
+	    (entry->expires <= cur_time))
+		return (0);
+
+	ping_stats.cached++;
+	return (1);
+}
+
+static void
+ping_stats_report(void) {
+	char buf[PING_RTT_BUCKETS * 24];
+	unsigned i, off = 0;
+
+	if (ping_stats_next == 0)
+		ping_stats_next = cur_time + PING_STATS_INTERVAL;
+	if ((cur_time < ping_stats_next) || (ping_stats.sent == 0))
+		return;
+
+	log_info("Ping checks: %lu sent, %lu answered, %lu timed out, "
+		 "%lu skipped as recently silent",
+		 ping_stats.sent, ping_stats.answered, ping_stats.timed_out,
+		 ping_stats.cached);
+
+	if (ping_stats.answered != 0) {
+		buf[0] = '\0';
+		for (i = 0; i < PING_RTT_BUCKETS; i++) {
+			if (i < PING_RTT_BUCKETS - 1)
+				off += snprintf(buf + off, sizeof(buf) - off,
+						" <%u:%lu", 1u << i,
+						ping_stats.rtt[i]);
+			else
+				off += snprintf(buf + off, sizeof(buf) - off,
+						" >=%u:%lu", 1u << (i - 1),
+						ping_stats.rtt[i]);
+		}
+		log_info("Ping check round trip times (ms):%s", buf);
+	}
+
+	memset(&ping_stats, 0, sizeof(ping_stats));
+	ping_stats_next = cur_time + PING_STATS_INTERVAL;
+}
+
+/*!
+ * \brief Start a ping check of a lease's address
+ *
+ * The echo request is queued to be sent with any others made while
+ * processing the current batch of packets.  If no answer is heard
+ * before the deadline the offer is sent with dhcp_reply().
+ *
+ * \param lease the lease being offered, its state must be set up
+ * \param deadline when to give up waiting for an answer
+ * \param cache_secs how long to remember that the address didn't answer
+ * \return 1 if the ping was started, 0 if it couldn't be
+ */
+int
+ping_start(struct lease *lease, struct timeval *deadline, TIME cache_secs) {
+	struct ping_probe *probe;
+
+	if ((ping_deadlines == NULL) &&
+	    (isc_heap_create(dhcp_gbl_ctx.mctx, ping_earlier,
+			     ping_index_changed, 0,
+			     &ping_deadlines) != ISC_R_SUCCESS)) {
+		log_error("No memory for ping deadlines.");
+		return (0);
+	}
+
+	probe = ping_probe_get();
+	if (probe == NULL) {
+		log_error("Too many outstanding pings, not pinging %s.",
+			  piaddr(lease->ip_addr));
+		return (0);
+	}
+
+	lease_reference(&probe->lease, lease, MDL);
+	probe->sent = cur_tv;
+	probe->deadline = *deadline;
+	probe->cache_secs = cache_secs;
+	if (isc_heap_insert(ping_deadlines, probe) != ISC_R_SUCCESS) {
+		log_error("No memory for ping deadline of %s.",
+			  piaddr(lease->ip_addr));
+		ping_probe_put(probe);
+		return (0);
+	}
+
+	icmp_echo_enqueue(&lease->ip_addr, probe->gen, probe->seq);
+	ping_stats.sent++;
+
+	ping_timer_update();
+	return (1);
+}
+
+/* Our single timer: offer every lease whose ping has timed out. */
+static void
+ping_timeout(void *vp) {
+	struct ping_probe *probe;
+	struct lease *lp;
+
+#if defined (DEBUG_MEMORY_LEAKAGE)
+	unsigned long previous_outstanding = dmalloc_outstanding;
+#endif
+
+	ping_timer_set = 0;
+
+	while ((probe = isc_heap_element(ping_deadlines, 1)) != NULL) {
+		if ((probe->deadline.tv_sec > cur_tv.tv_sec) ||
+		    ((probe->deadline.tv_sec == cur_tv.tv_sec) &&
+		     (probe->deadline.tv_usec > cur_tv.tv_usec)))
+			break;
+
+		isc_heap_delete(ping_deadlines, probe->heap_index);
+		ping_cache_add(&probe->lease->ip_addr, probe->cache_secs);
+		ping_stats.timed_out++;
+
+		lp = NULL;
+		lease_reference(&lp, probe->lease, MDL);
+		ping_probe_put(probe);
+
+		--outstanding_pings;
+		if (lp->state == NULL)
+			log_error("ping check for %s has gone stale",
+				  piaddr(lp->ip_addr));
+		else
+			dhcp_reply(lp);
+		lease_dereference(&lp, MDL);
+	}
+
+	ping_timer_update();
+	ping_stats_report();
+
+#if defined (DEBUG_MEMORY_LEAKAGE)
+	log_info ("generation %ld: %ld new, %ld outstanding, %ld long-term",
+		  dmalloc_generation,
+		  dmalloc_outstanding - previous_outstanding,
+		  dmalloc_outstanding, dmalloc_longterm);
+#endif
+#if defined (DEBUG_MEMORY_LEAKAGE)
+	dmalloc_dump_outstanding ();
+#endif
+}
+
+/*!
+ * \brief Handle an ICMP Echo reply
+ *
+ * Called by the ICMP code with the ICMP header of each Echo reply.  If
+ * it answers one of our pings the lease is abandoned rather than offered.
+ *
+ * \param from the address the reply came from
+ * \param packet the ICMP header and data
+ * \param length the length of packet
+ */
+void
+lease_pinged(struct iaddr from, u_int8_t *packet, int length) {
+	struct icmp icmp;
+	struct ping_probe *probe;
+	struct lease *lp;
+	long rtt;
+	unsigned i;
+
+	/* Don't try to look up a pinged lease if we aren't trying to
+	   ping one - otherwise somebody could easily make us churn by
+	   just forging repeated ICMP EchoReply packets for us to look
+	   up. */
+	if (!outstanding_pings)
+		return;
+
+	if (length < ICMP_MINLEN)
+		return;
+	memcpy(&icmp, packet, ICMP_MINLEN);
+
+	probe = NULL;
+	if (icmp.icmp_seq < ping_probes_max)
+		probe = ping_probes[icmp.icmp_seq];
+	if ((probe == NULL) || (probe->lease == NULL) ||
+	    (probe->gen != icmp.icmp_id) ||
+	    (from.len != probe->lease->ip_addr.len) ||
+	    (memcmp(from.iabuf, probe->lease->ip_addr.iabuf, from.len) != 0)) {
+		log_debug ("unexpected ICMP Echo Reply from %s",
+			   piaddr (from));
+		return;
+	}
+
+	rtt = (cur_tv.tv_sec - probe->sent.tv_sec) * 1000 +
+	      (cur_tv.tv_usec - probe->sent.tv_usec) / 1000;
+	for (i = 0; (i < PING_RTT_BUCKETS - 1) && (rtt >= (1L << i)); i++)
+		;
+	ping_stats.rtt[i]++;
+	ping_stats.answered++;
+
+	isc_heap_delete(ping_deadlines, probe->heap_index);
+	lp = NULL;
+	lease_reference(&lp, probe->lease, MDL);
+	ping_probe_put(probe);
+	--outstanding_pings;
+	ping_timer_update();
+
+	if (!lp -> state) {
+#if defined (FAILOVER_PROTOCOL)
+		if (!lp -> pool ||
+		    !lp -> pool -> failover_peer)
+#endif
+			log_debug ("ICMP Echo Reply for %s late or spurious.",
+				   piaddr (from));
+		goto out;
+	}
+
+	if (lp -> ends > cur_time) {
+		log_debug ("ICMP Echo reply while lease %s valid.",
+			   piaddr (from));
+	}
+
+	/* At this point it looks like we pinged a lease and got a
+	   response, which shouldn't have happened. */
+	data_string_forget (&lp -> state -> parameter_request_list, MDL);
+	free_lease_state (lp -> state, MDL);
+	lp -> state = (struct lease_state *)0;
+
+	abandon_lease (lp, "pinged before offer");
+      out:
+	lease_dereference (&lp, MDL);
+	ping_stats_report();
+}
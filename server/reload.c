@@ -0,0 +1,503 @@
+/* reload.c
+
+   Configuration reload for the DHCP server. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/reload.c
+ *
+ * \page reload configuration reload
+ *
+ * Setting the state of the server's control object to 5 (server_reload),
+ * for instance with omshell, makes the server read its config file again
+ * without restarting and without reading the lease file again.
+ *
+ * The new config file is first read by a child process, so that a
+ * config file with errors in it, even ones the parser gives up on, leaves
+ * the running server alone.  The child keeps a copy of every config file
+ * it reads, and if it is happy it hands the copies to the server through
+ * a temporary file.  The server then parses those copies, not the files
+ * on disk, which may have changed since, into a fresh set of groups,
+ * shared networks, subnets,
+ * pools, classes and hosts (a config_state), and then moves each of its
+ * leases over to the lease the new configuration has for the same
+ * address (see config_state_merge()).  A lease keeps its state, its
+ * place in the uid and hardware address hashes and its billing; it just
+ * gets a new pool and subnet.  Leases for addresses no longer in any
+ * range are forgotten, as they would be on a restart.  Hosts added with
+ * OMAPI are carried over unless the new config file declares a host of
+ * the same name, and the interfaces are connected to the new shared
+ * networks.  The old configuration is then freed.
+ *
+ * The reload only covers what the config file declares.  Settings read
+ * once at startup, such as the lease file name, the pid file, the ports
+ * and the server's identity, keep their startup values.  Option, key and
+ * zone declarations are added to what is already known.  Reloading isn't
+ * supported for DHCPv6 or with failover peers: failover partners would
+ * have to agree on the pools they share, which is beyond this code.
+ */
+
+#include "dhcpd.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* How often to look whether the config file check has finished. */
+#define RELOAD_WAIT_USECS 100000
+
+/* A config file as the check read it. */
+struct reload_file {
+	struct reload_file *next;
+	char *data;
+	unsigned len;
+	char name [1];
+};
+
+static pid_t reload_pid;
+static int reload_fd = -1;		/* where the check leaves the files */
+static int reload_recording;		/* set in the checking child */
+static struct reload_file *reload_files;
+static struct group *reload_old_root;
+
+static void reload_wait (void *);
+
+static struct reload_file *reload_file_new (const char *name, unsigned len)
+{
+	struct reload_file *rf;
+
+	rf = dmalloc (sizeof *rf + strlen (name) + len, MDL);
+	if (!rf)
+		return (struct reload_file *)0;
+	strcpy (rf -> name, name);
+	rf -> data = rf -> name + strlen (name) + 1;
+	rf -> len = len;
+	return rf;
+}
+
+static void reload_files_free ()
+{
+	struct reload_file *rf;
+
+	while (reload_files) {
+		rf = reload_files;
+		reload_files = rf -> next;
+		dfree (rf, MDL);
+	}
+}
+
+/* Give read_conf_file() the contents of a config file during a reload:
+   the checking child reads the file and keeps a copy, the server gets
+   the copy the child kept.  ISC_R_NOTFOUND means no reload is reading
+   files and the caller should read the file as usual. */
+
+isc_result_t reload_conf_file (const char *filename,
+			       char **buf, unsigned *len)
+{
+	struct reload_file *rf, **rp;
+	struct stat sb;
+	unsigned got;
+	ssize_t result;
+	int file;
+
+	for (rp = &reload_files; *rp; rp = &(*rp) -> next) {
+		if (!strcmp ((*rp) -> name, filename)) {
+			*buf = (*rp) -> data;
+			*len = (*rp) -> len;
+			return ISC_R_SUCCESS;
+		}
+	}
+	if (!reload_recording) {
+		if (!reload_files)
+			return ISC_R_NOTFOUND;
+		log_error ("%s wasn't read by the configuration check.",
+			   filename);
+		return ISC_R_FILENOTFOUND;
+	}
+
+	if ((file = open (filename, O_RDONLY)) < 0) {
+		log_error ("Can't open %s: %m", filename);
+		return ISC_R_FILENOTFOUND;
+	}
+	if (fstat (file, &sb) < 0 || sb.st_size > 0x7FFFFFFF) {
+		log_error ("Can't read %s: %m", filename);
+		close (file);
+		return ISC_R_IOERROR;
+	}
+	rf = reload_file_new (filename, sb.st_size);
+	if (!rf) {
+		close (file);
+		return ISC_R_NOMEMORY;
+	}
+	for (got = 0; got < rf -> len; got += result) {
+		result = read (file, rf -> data + got, rf -> len - got);
+		if (result <= 0) {
+			log_error ("Can't read %s: %m", filename);
+			dfree (rf, MDL);
+			close (file);
+			return ISC_R_IOERROR;
+		}
+	}
+	close (file);
+
+	*rp = rf;
+	*buf = rf -> data;
+	*len = rf -> len;
+	return ISC_R_SUCCESS;
+}
+
+/* In the child: write the files it read for the server, each as its
+   name, a NUL, its length and its contents. */
+
+static isc_result_t reload_files_write ()
+{
+	struct reload_file *rf;
+	u_int32_t len;
+
+	for (rf = reload_files; rf; rf = rf -> next) {
+		len = rf -> len;
+		if (write (reload_fd, rf -> name,
+			   strlen (rf -> name) + 1) < 0 ||
+		    write (reload_fd, &len, sizeof len) != sizeof len ||
+		    write (reload_fd, rf -> data, len) != len) {
+			log_error ("Can't pass the checked config on: %m");
+			return ISC_R_IOERROR;
+		}
+	}
+	return ISC_R_SUCCESS;
+}
+
+/* In the server: read back what the child wrote. */
+
+static isc_result_t reload_files_read ()
+{
+	struct reload_file *rf, **rp;
+	struct stat sb;
+	char *buf, *bp, *name;
+	unsigned got, left, nlen;
+	ssize_t result;
+	u_int32_t len;
+
+	if (fstat (reload_fd, &sb) < 0 ||
+	    lseek (reload_fd, (off_t)0, SEEK_SET) < 0) {
+		log_error ("Can't read the checked config: %m");
+		return ISC_R_IOERROR;
+	}
+	buf = dmalloc (sb.st_size + 1, MDL);
+	if (!buf)
+		return ISC_R_NOMEMORY;
+	for (got = 0; got < sb.st_size; got += result) {
+		result = read (reload_fd, buf + got, sb.st_size - got);
+		if (result <= 0) {
+			log_error ("Can't read the checked config: %m");
+			dfree (buf, MDL);
+			return ISC_R_IOERROR;
+		}
+	}
+
+	rp = &reload_files;
+	for (bp = buf, left = sb.st_size; left > 0; bp += len, left -= len) {
+		rf = (struct reload_file *)0;
+		name = bp;
+		nlen = strnlen (name, left) + 1;
+		if (nlen + sizeof len <= left) {
+			memcpy (&len, name + nlen, sizeof len);
+			bp += nlen + sizeof len;
+			left -= nlen + sizeof len;
+			if (len <= left)
+				rf = reload_file_new (name, len);
+		}
+		if (!rf) {
+			log_error ("Can't read the checked config: %s",
+				   "bad or short copy");
+			reload_files_free ();
+			dfree (buf, MDL);
+			return ISC_R_UNEXPECTEDEND;
+		}
+		memcpy (rf -> data, bp, len);
+		*rp = rf;
+		rp = &rf -> next;
+	}
+	dfree (buf, MDL);
+	return ISC_R_SUCCESS;
+}
+
+/* Connect the interfaces to the shared networks of the running config. */
+
+static void reload_interfaces ()
+{
+	struct interface_info *ip;
+	struct iaddr ia;
+	int i;
+
+	for (ip = interfaces; ip; ip = ip -> next) {
+		if (ip -> shared_network)
+			shared_network_dereference (&ip -> shared_network, MDL);
+		for (i = 0; i < ip -> address_count; i++) {
+			ia.len = 4;
+			memcpy (ia.iabuf, &ip -> addresses [i], ia.len);
+			dhcpd_interface_setup_hook (ip, &ia);
+		}
+		if (!ip -> shared_network)
+			log_error ("No subnet declaration for %s any more.",
+				   ip -> name);
+	}
+}
+
+/* Carry a host added with OMAPI over to the new config. */
+
+static isc_result_t reload_host (const void *name, unsigned len, void *object)
+{
+	struct host_decl *hd = object;
+	struct host_decl *hp = (struct host_decl *)0;
+
+	if (!(hd -> flags & HOST_DECL_DYNAMIC) ||
+	    (hd -> flags & HOST_DECL_DELETED))
+		return ISC_R_SUCCESS;
+
+	if (host_name_hash &&
+	    host_hash_lookup (&hp, host_name_hash, name, len, MDL)) {
+		log_info ("Host %s is declared in %s: dropping the one "
+			  "added with OMAPI.", hd -> name, path_dhcpd_conf);
+		host_dereference (&hp, MDL);
+		return ISC_R_SUCCESS;
+	}
+
+	/* Its group is the old root group, or a group of its own just
+	   inside it. */
+	if (hd -> group == reload_old_root) {
+		group_dereference (&hd -> group, MDL);
+		group_reference (&hd -> group, root_group, MDL);
+	} else if (hd -> group && hd -> group -> next == reload_old_root) {
+		group_dereference (&hd -> group -> next, MDL);
+		group_reference (&hd -> group -> next, root_group, MDL);
+	}
+	enter_host (hd, 1, 0);
+	return ISC_R_SUCCESS;
+}
+
+static int count_subnets (struct subnet *subnet)
+{
+	int count = 0;
+
+	for (; subnet; subnet = subnet -> next_subnet)
+		count++;
+	return count;
+}
+
+/* Read the config file again and put it in place of the running config,
+   keeping the leases.  When called from reload_wait() the files are the
+   copies the check kept.  If the file can't be read the running config
+   is left alone. */
+
+isc_result_t reload_config_apply ()
+{
+	struct config_state old;
+	struct timeval start, end;
+	isc_result_t status;
+	int kept, fresh, dropped;
+
+	gettimeofday (&start, NULL);
+
+	memset (&old, 0, sizeof old);
+	config_state_swap (&old);
+	root_group_setup ();
+	status = readconf ();
+#if defined (FAILOVER_PROTOCOL)
+	if (status == ISC_R_SUCCESS && failover_states) {
+		log_error ("Failover peers can't be added by a reload.");
+		status = ISC_R_NOTIMPLEMENTED;
+	}
+#endif
+	if (status != ISC_R_SUCCESS) {
+		config_state_swap (&old);
+		config_state_release (&old);
+		log_error ("Can't reload %s: %s; the running configuration "
+			   "is unchanged.", path_dhcpd_conf,
+			   isc_result_totext (status));
+		return status;
+	}
+
+	if (!lease_ip_addr_hash &&
+	    !lease_ip_new_hash (&lease_ip_addr_hash, LEASE_HASH_SIZE, MDL))
+		log_fatal ("No memory for lease hash");
+	config_state_merge (&old, &kept, &fresh, &dropped);
+
+	reload_old_root = old.root_group;
+	host_hash_foreach (old.host_name_hash, reload_host);
+	reload_old_root = (struct group *)0;
+
+	reload_interfaces ();
+
+	gettimeofday (&end, NULL);
+	log_info ("Reloaded %s in %ld ms: %d subnets (was %d), "
+		  "%d leases kept, %d new, %d forgotten.",
+		  path_dhcpd_conf,
+		  (long)((end.tv_sec - start.tv_sec) * 1000 +
+			 (end.tv_usec - start.tv_usec) / 1000),
+		  count_subnets (subnets), count_subnets (old.subnets),
+		  kept, fresh, dropped);
+
+	config_state_release (&old);
+#if defined (OMAPI_QUERY_THREAD)
+	omapi_query_resync ();
+#endif
+	return ISC_R_SUCCESS;
+}
+
+/* Check the config file in a child process: nothing the parser does to
+   the child's memory can hurt the server, and if the parser gives up on
+   the file it's only the child that exits.  The child has a copy of the
+   server's stdio buffers, so it must leave by _exit(): if log_fatal() or
+   anything else calls exit(), reload_child_exit() gets there first and
+   the copied buffers are never written. */
+
+static void reload_child_exit ()
+{
+	_exit (1);
+}
+
+static void reload_check ()
+{
+	struct config_state running;
+	isc_result_t status;
+
+	log_cleanup = reload_child_exit;
+	atexit (reload_child_exit);
+#if defined (OMAPI_QUERY_THREAD)
+	/* The query thread wasn't copied into the child. */
+	omapi_query_forget ();
+#endif
+	reload_recording = 1;
+	memset (&running, 0, sizeof running);
+	config_state_swap (&running);
+	root_group_setup ();
+	status = readconf ();
+#if defined (FAILOVER_PROTOCOL)
+	if (status == ISC_R_SUCCESS && failover_states) {
+		log_error ("Failover peers can't be added by a reload.");
+		status = ISC_R_NOTIMPLEMENTED;
+	}
+#endif
+	if (status == ISC_R_SUCCESS)
+		reload_interfaces ();
+	if (status == ISC_R_SUCCESS)
+		status = reload_files_write ();
+	_exit (status == ISC_R_SUCCESS ? 0 : 1);
+}
+
+/* Start a reload: check the config file, and once that's done apply it. */
+
+void reload_config ()
+{
+	struct timeval tv;
+	FILE *tmp;
+	pid_t pid;
+
+	if (reload_pid) {
+		log_info ("A reload of %s is already under way.",
+			  path_dhcpd_conf);
+		return;
+	}
+	if (local_family != AF_INET) {
+		log_error ("Configuration reload is only supported for DHCPv4.");
+		return;
+	}
+#if defined (FAILOVER_PROTOCOL)
+	if (failover_states) {
+		log_error ("Configuration reload is not supported with "
+			   "failover peers.");
+		return;
+	}
+#endif
+
+	log_info ("Reloading %s.", path_dhcpd_conf);
+	tmp = tmpfile ();
+	if (!tmp || (reload_fd = dup (fileno (tmp))) < 0) {
+		log_error ("Can't check %s: tmpfile: %m", path_dhcpd_conf);
+		if (tmp)
+			fclose (tmp);
+		return;
+	}
+	fclose (tmp);
+
+	/* Anything still buffered for the lease file would otherwise be
+	   in both processes. */
+	if (db_file && fflush (db_file) == EOF)
+		log_error ("Can't flush the lease file: %m");
+	fflush (NULL);
+	pid = fork ();
+	if (pid < 0) {
+		log_error ("Can't check %s: fork: %m", path_dhcpd_conf);
+		close (reload_fd);
+		reload_fd = -1;
+		return;
+	}
+	if (pid == 0)
+		reload_check ();
+
+	reload_pid = pid;
+	tv.tv_sec = cur_tv.tv_sec;
+	tv.tv_usec = cur_tv.tv_usec + RELOAD_WAIT_USECS;
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
+	add_timeout (&tv, reload_wait, 0, 0, 0);
+}
+
+static void reload_wait (void *foo)
+{
+	struct timeval tv;
+	pid_t pid;
+	int status;
+
+	pid = waitpid (reload_pid, &status, WNOHANG);
+	if (pid == 0) {
+		tv.tv_sec = cur_tv.tv_sec;
+		tv.tv_usec = cur_tv.tv_usec + RELOAD_WAIT_USECS;
+		if (tv.tv_usec >= 1000000) {
+			tv.tv_sec++;
+			tv.tv_usec -= 1000000;
+		}
+		add_timeout (&tv, reload_wait, 0, 0, 0);
+		return;
+	}
+	reload_pid = 0;
+
+	if (pid < 0)
+		log_error ("Can't check %s: waitpid: %m", path_dhcpd_conf);
+	else if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+		log_error ("%s has errors; the running configuration "
+			   "is unchanged.", path_dhcpd_conf);
+	else if (reload_files_read () != ISC_R_SUCCESS)
+		log_error ("Can't reload %s; the running configuration "
+			   "is unchanged.", path_dhcpd_conf);
+	else
+		reload_config_apply ();
+
+	reload_files_free ();
+	close (reload_fd);
+	reload_fd = -1;
+}
@@ -293,6 +293,11 @@ static struct option server_options[] = {
 	{ "bind-local-address6", "f",	&server_universe,  SV_BIND_LOCAL_ADDRESS6, 1 },
 	{ "ping-cltt-secs", "T",	&server_universe,  SV_PING_CLTT_SECS, 1 },
 	{ "ping-timeout-ms", "T",       &server_universe,  SV_PING_TIMEOUT_MS, 1 },
+	{ "ping-cache-secs", "T",	&server_universe,  SV_PING_CACHE_SECS, 1 },
+	{ "expiry-slice-leases", "L",	&server_universe,  SV_EXPIRY_SLICE_LEASES, 1 },
+	{ "expiry-slice-usecs", "L",	&server_universe,  SV_EXPIRY_SLICE_USECS, 1 },
+	{ "lease-load-threads", "L",	&server_universe,  SV_LEASE_LOAD_THREADS, 1 },
+	{ "omapi-query-port", "S",	&server_universe,  SV_OMAPI_QUERY_PORT, 1 },
 	{ NULL, NULL, NULL, 0, 0 }
 };
 
@@ -503,13 +508,13 @@ void initialize_server_option_spaces()
 	/* Set up the server option universe... */
 	server_universe.name = "server";
 	server_universe.concat_duplicates = 0;
-	server_universe.lookup_func = lookup_hashed_option;
+	server_universe.lookup_func = lookup_direct_option;
 	server_universe.option_state_dereference =
-		hashed_option_state_dereference;
-	server_universe.save_func = save_hashed_option;
-	server_universe.delete_func = delete_hashed_option;
-	server_universe.encapsulate = hashed_option_space_encapsulate;
-	server_universe.foreach = hashed_option_space_foreach;
+		direct_option_state_dereference;
+	server_universe.save_func = save_direct_option;
+	server_universe.delete_func = delete_direct_option;
+	server_universe.encapsulate = direct_option_space_encapsulate;
+	server_universe.foreach = direct_option_space_foreach;
 	server_universe.length_size = 1; /* Never used ... */
 	server_universe.tag_size = 4;
 	server_universe.store_tag = putUChar;
@@ -0,0 +1,1533 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#if defined (USE_LPF_SEND)
+#include <errno.h>
+#include <poll.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#endif
+
+/*
+ * Microbenchmarks of the server's hot paths, run by "make bench".
+ *
+ * The server reads a config file with one /16 subnet and 4000 host
+ * reservations, and a lease file with a lease for each of the first -n
+ * addresses (16384 by default),
+ * with client addresses, identifiers and times drawn from a generator
+ * seeded with -s, so every run works on the same data.  The clock is
+ * fixed, so leases are active or expired the same way every run.  Each
+ * benchmark is run -r times (5 by default) and the fastest run is kept;
+ * -b runs only the benchmarks whose names start with the given string.
+ *
+ * Progress goes to stderr and the results are written as JSON to
+ * stdout, or to the file named with -o, for comparing one build or
+ * release with another.
+ */
+
+static const char *conf_file = "bench.conf";
+static const char *lease_file = "bench.leases";
+
+#define BENCH_NOW	1600000000
+#define MAX_LEASES	65000
+#define HOSTS		4000
+#define OMAPI_BACKLOG	4194304
+#define PACKETS		1024
+#define MAX_RESULTS	64
+
+static unsigned nleases = 16384;
+static int repeats = 5;
+static u_int32_t seed = 1;
+static const char *only;
+
+/* The generator the data is made with: xorshift32, so that the data is
+   the same everywhere, whatever random() does. */
+static u_int32_t rng;
+
+static u_int32_t
+bench_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (rng);
+}
+
+/* The leases read from the lease file, in a random order. */
+static struct lease **leases;
+
+/* Requests from the clients that hold leases, and from new clients. */
+static struct dhcp_packet raws[PACKETS], new_raws[PACKETS];
+static struct packet packets[PACKETS], new_packets[PACKETS];
+static struct shared_network *share;
+
+static struct result {
+	const char *name;
+	const char *unit;
+	unsigned long ops;
+	double secs;
+} results[MAX_RESULTS];
+static int nresults;
+
+static void
+fail(const char *fmt, ...)
+{
+	va_list list;
+
+	va_start(list, fmt);
+	vfprintf(stderr, fmt, list);
+	va_end(list);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1000000.0);
+}
+
+/* Keep the fastest of the runs of a benchmark. */
+static void
+record(const char *name, const char *unit, unsigned long ops, double secs)
+{
+	int i;
+
+	for (i = 0; i < nresults; i++) {
+		if (strcmp(results[i].name, name) == 0)
+			break;
+	}
+	if (i == nresults) {
+		if (nresults == MAX_RESULTS)
+			fail("too many results");
+		nresults++;
+		results[i].name = name;
+		results[i].unit = unit;
+		results[i].ops = ops;
+		results[i].secs = secs;
+	} else if (secs < results[i].secs)
+		results[i].secs = secs;
+}
+
+/* A request from the client with hardware address hw, asking for addr
+   if it isn't null, and sending a client identifier if uid is set. */
+static void
+build_request(struct packet *packet, struct dhcp_packet *raw,
+	     const unsigned char *hw, const unsigned char *addr, int uid)
+{
+	static const unsigned char prl[] = {
+		55, 12, 1, 3, 6, 15, 28, 42, 44, 46, 47, 119, 121, 252
+	};
+	unsigned char *op;
+
+	memset(raw, 0, sizeof(*raw));
+	raw->op = BOOTREQUEST;
+	raw->htype = HTYPE_ETHER;
+	raw->hlen = 6;
+	memcpy(raw->chaddr, hw, 6);
+
+	op = raw->options;
+	memcpy(op, DHCP_OPTIONS_COOKIE, 4);
+	op += 4;
+	*op++ = DHO_DHCP_MESSAGE_TYPE;
+	*op++ = 1;
+	*op++ = DHCPREQUEST;
+	if (uid) {
+		*op++ = DHO_DHCP_CLIENT_IDENTIFIER;
+		*op++ = 7;
+		*op++ = HTYPE_ETHER;
+		memcpy(op, hw, 6);
+		op += 6;
+	}
+	if (addr != NULL) {
+		*op++ = DHO_DHCP_REQUESTED_ADDRESS;
+		*op++ = 4;
+		memcpy(op, addr, 4);
+		op += 4;
+	}
+	*op++ = DHO_DHCP_MAX_MESSAGE_SIZE;
+	*op++ = 2;
+	*op++ = 0x05;
+	*op++ = 0xdc;
+	*op++ = DHO_HOST_NAME;
+	*op++ = 4;
+	memcpy(op, "host", 4);
+	op += 4;
+	*op++ = DHO_VENDOR_CLASS_IDENTIFIER;
+	*op++ = 8;
+	memcpy(op, "MSFT 5.0", 8);
+	op += 8;
+	memcpy(op, prl, sizeof(prl));
+	op += sizeof(prl);
+	*op++ = DHO_END;
+
+	memset(packet, 0, sizeof(*packet));
+	packet->raw = raw;
+	packet->packet_length = DHCP_FIXED_NON_UDP + (op - raw->options);
+	packet->packet_type = DHCPREQUEST;
+	if (!option_state_allocate(&packet->options, MDL))
+		fail("can't allocate an option state");
+}
+
+static void
+parse_request(struct packet *packet)
+{
+	if (!parse_options(packet) || !packet->options_valid)
+		fail("can't parse a request");
+}
+
+/* The subnet, and hosts reserved by hardware address and client
+   identifier that none of the clients have, each with any extra
+   statements given. */
+static void
+write_conf_file(const char *extra)
+{
+	FILE *f;
+	unsigned i;
+
+	f = fopen(conf_file, "w");
+	if (f == NULL)
+		fail("can't write %s", conf_file);
+	fprintf(f, "subnet 10.0.0.0 netmask 255.255.0.0 {\n"
+		"  range 10.0.0.1 10.0.255.254;\n"
+		"  option routers 10.0.0.1;\n"
+		"  option domain-name-servers 10.0.0.2, 10.0.0.3;\n"
+		"  option domain-name \"example.com\";\n"
+		"}\n");
+	for (i = 1; i <= HOSTS; i++)
+		fprintf(f, "host h%u {\n"
+			"  hardware ethernet 0a:00:00:00:%02x:%02x;\n"
+			"  option dhcp-client-identifier 01:0e:00:00:00:%02x:%02x;\n"
+			"%s}\n", i, i >> 8, i & 255, i >> 8, i & 255, extra);
+	if (fclose(f) != 0)
+		fail("can't write %s", conf_file);
+}
+
+static void
+write_lease_file(void)
+{
+	unsigned char hw[6];
+	FILE *f;
+	unsigned i;
+
+	rng = seed;
+	f = fopen(lease_file, "w");
+	if (f == NULL)
+		fail("can't write %s", lease_file);
+	fprintf(f, "# dhcpd_bench lease file\n"
+		"authoring-byte-order little-endian;\n\n");
+
+	for (i = 1; i <= nleases; i++) {
+		/* The last three bytes keep the addresses apart. */
+		hw[0] = 0x02;
+		hw[1] = bench_random();
+		hw[2] = bench_random();
+		hw[3] = i >> 16;
+		hw[4] = i >> 8;
+		hw[5] = i;
+		fprintf(f, "lease 10.0.%u.%u {\n"
+			"  starts epoch %u;\n"
+			"  ends epoch %u;\n"
+			"  cltt epoch %u;\n"
+			"  binding state active;\n"
+			"  next binding state free;\n"
+			"  rewind binding state free;\n"
+			"  hardware ethernet %02x:%02x:%02x:%02x:%02x:%02x;\n",
+			i >> 8, i & 255,
+			BENCH_NOW - bench_random() % 86400,
+			BENCH_NOW + 3600 + bench_random() % 86400,
+			BENCH_NOW - bench_random() % 3600,
+			hw[0], hw[1], hw[2], hw[3], hw[4], hw[5]);
+		if (i & 1)
+			fprintf(f, "  uid 01:%02x:%02x:%02x:%02x:%02x:%02x;\n",
+				hw[0], hw[1], hw[2], hw[3], hw[4], hw[5]);
+		fprintf(f, "  set vendor-class-identifier = \"MSFT 5.0\";\n"
+			"  client-hostname \"host-%u\";\n"
+			"}\n", i);
+	}
+	if (fclose(f) != 0)
+		fail("can't write %s", lease_file);
+}
+
+static void
+setup(void)
+{
+	struct lease *lp, *tmp;
+	struct iaddr addr;
+	unsigned char hw[6];
+	unsigned i, j;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	cur_tv.tv_sec = BENCH_NOW;
+	cur_tv.tv_usec = 0;
+
+	root_group_setup();
+	write_conf_file("");
+	path_dhcpd_conf = conf_file;
+	if (readconf() != ISC_R_SUCCESS)
+		fail("can't read %s", conf_file);
+	write_lease_file();
+	if (read_conf_file(lease_file, root_group, ROOT_GROUP, 1) !=
+	    ISC_R_SUCCESS)
+		fail("can't read %s", lease_file);
+
+	/* Put the leases on their queues and in the client hashes, as
+	   db_startup() does in test mode, writing to /dev/null. */
+	db_file = fopen("/dev/null", "a");
+	if (db_file == NULL)
+		fail("can't open /dev/null");
+	expire_all_pools();
+
+	/* Put the leases in a random order. */
+	leases = dmalloc(nleases * sizeof(*leases), MDL);
+	if (leases == NULL)
+		fail("no memory for %u leases", nleases);
+	addr.len = 4;
+	addr.iabuf[0] = 10;
+	addr.iabuf[1] = 0;
+	for (i = 0; i < nleases; i++) {
+		addr.iabuf[2] = (i + 1) >> 8;
+		addr.iabuf[3] = (i + 1) & 255;
+		if (!find_lease_by_ip_addr(&leases[i], addr, MDL))
+			fail("no lease for %s", piaddr(addr));
+	}
+	for (i = nleases - 1; i > 0; i--) {
+		j = bench_random() % (i + 1);
+		tmp = leases[i];
+		leases[i] = leases[j];
+		leases[j] = tmp;
+	}
+	share = leases[0]->subnet->shared_network;
+
+	/* Renewals from clients with leases, and discovers from clients
+	   the server hasn't seen. */
+	for (i = 0; i < PACKETS; i++) {
+		lp = leases[i % nleases];
+		build_request(&packets[i], &raws[i], lp->hardware_addr.hbuf + 1,
+			     lp->ip_addr.iabuf, lp->uid_len != 0);
+		parse_request(&packets[i]);
+
+		hw[0] = 0x06;
+		hw[1] = bench_random();
+		hw[2] = bench_random();
+		hw[3] = 0;
+		hw[4] = i >> 8;
+		hw[5] = i;
+		build_request(&new_packets[i], &new_raws[i], hw, NULL, 0);
+		parse_request(&new_packets[i]);
+	}
+}
+
+/* Add the leases' addresses to a hash the size of the server's, look
+   each one up and then delete them. */
+static void
+bench_hash(void)
+{
+	lease_ip_hash_t *hash = NULL;
+	struct lease *lp;
+	double start;
+	unsigned i;
+
+	if (!lease_ip_new_hash(&hash, LEASE_HASH_SIZE, MDL))
+		fail("can't make a hash");
+
+	start = now();
+	for (i = 0; i < nleases; i++)
+		lease_ip_hash_add(hash, leases[i]->ip_addr.iabuf, 4,
+				  leases[i], MDL);
+	record("hash.insert", "lease", nleases, now() - start);
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		lp = NULL;
+		if (!lease_ip_hash_lookup(&lp, hash,
+					  leases[nleases - 1 - i]->ip_addr.iabuf,
+					  4, MDL))
+			fail("lease missing from the hash");
+		lease_dereference(&lp, MDL);
+	}
+	record("hash.lookup", "lease", nleases, now() - start);
+
+	start = now();
+	for (i = 0; i < nleases; i++)
+		lease_ip_hash_delete(hash, leases[i]->ip_addr.iabuf, 4, MDL);
+	record("hash.delete", "lease", nleases, now() - start);
+
+	lease_ip_free_hash_table(&hash, MDL);
+}
+
+/* Put leases with random times on a queue and take them off again in
+   another order, as when leases are allocated and renewed. */
+static void
+bench_leasechain(void)
+{
+	static struct lease **chain;
+	LEASE_STRUCT lq;
+	struct lease *tmp;
+	double start;
+	unsigned i, j;
+
+	if (chain == NULL) {
+		chain = dmalloc(nleases * sizeof(*chain), MDL);
+		if (chain == NULL)
+			fail("no memory for %u leases", nleases);
+		for (i = 0; i < nleases; i++) {
+			if (lease_allocate(&chain[i], MDL) != ISC_R_SUCCESS)
+				fail("can't allocate a lease");
+		}
+	}
+#if defined (BINARY_LEASES)
+	memset(&lq, 0, sizeof(lq));
+#else
+	lq = NULL;
+#endif
+
+	rng = seed;
+	for (i = 0; i < nleases; i++)
+		chain[i]->sort_time = BENCH_NOW + bench_random() % 86400;
+
+	start = now();
+	for (i = 0; i < nleases; i++)
+		LEASE_INSERTP(&lq, chain[i]);
+	record("leasechain.insert", "lease", nleases, now() - start);
+
+	for (i = nleases - 1; i > 0; i--) {
+		j = bench_random() % (i + 1);
+		tmp = chain[i];
+		chain[i] = chain[j];
+		chain[j] = tmp;
+	}
+
+	start = now();
+	for (i = 0; i < nleases; i++)
+		LEASE_REMOVEP(&lq, chain[i]);
+	record("leasechain.remove", "lease", nleases, now() - start);
+
+	if (LEASE_NOT_EMPTY(lq))
+		fail("leases left on the queue");
+}
+
+/* Keep the dhcp option space's options in a table, as the server does,
+   or in a hash, as they were kept before. */
+static void
+use_option_tables(int tables)
+{
+	dhcp_universe.lookup_func =
+		tables ? lookup_direct_option : lookup_hashed_option;
+	dhcp_universe.option_state_dereference =
+		tables ? direct_option_state_dereference
+		       : hashed_option_state_dereference;
+	dhcp_universe.save_func =
+		tables ? save_direct_option : save_hashed_option;
+	dhcp_universe.delete_func =
+		tables ? delete_direct_option : delete_hashed_option;
+	dhcp_universe.encapsulate =
+		tables ? direct_option_space_encapsulate
+		       : hashed_option_space_encapsulate;
+	dhcp_universe.foreach =
+		tables ? direct_option_space_foreach
+		       : hashed_option_space_foreach;
+}
+
+/* Decode requests, looking up the options the server looks at for most
+   of them, and put together the replies; with the dhcp option space in
+   a table and then in a hash. */
+static void
+bench_options(void)
+{
+	static const struct {
+		const char *parse;
+		const char *cons;
+		int tables;
+	} runs[] = {
+		{ "option.parse", "option.cons", 1 },
+		{ "option.hash_parse", "option.hash_cons", 0 },
+	};
+	static const unsigned codes[] = {
+		DHO_DHCP_MESSAGE_TYPE, DHO_DHCP_OPTION_OVERLOAD,
+		DHO_DHCP_AGENT_OPTIONS, DHO_SUBNET_SELECTION,
+		DHO_DHCP_CLIENT_IDENTIFIER, DHO_DHCP_REQUESTED_ADDRESS,
+		DHO_DHCP_SERVER_IDENTIFIER, DHO_DHCP_MAX_MESSAGE_SIZE,
+		DHO_DHCP_PARAMETER_REQUEST_LIST, DHO_HOST_NAME,
+		DHO_FQDN, DHO_VENDOR_CLASS_IDENTIFIER
+	};
+	static const struct {
+		unsigned code;
+		const char *data;
+		unsigned len;
+	} reply[] = {
+		{ DHO_SUBNET_MASK, "\xff\xff\0\0", 4 },
+		{ DHO_ROUTERS, "\x0a\0\0\x01", 4 },
+		{ DHO_DOMAIN_NAME_SERVERS, "\x0a\0\0\x02\x0a\0\0\x03", 8 },
+		{ DHO_DOMAIN_NAME, "example.com", 11 },
+		{ DHO_BROADCAST_ADDRESS, "\x0a\0\xff\xff", 4 },
+		{ DHO_NTP_SERVERS, "\x0a\0\0\x04", 4 },
+		{ DHO_NETBIOS_NAME_SERVERS, "\x0a\0\0\x05", 4 },
+		{ DHO_NETBIOS_NODE_TYPE, "\x08", 1 },
+		{ DHO_DOMAIN_SEARCH, "\x07" "example\x03" "com\0", 13 },
+		{ DHO_DHCP_LEASE_TIME, "\0\0\x0e\x10", 4 },
+		{ DHO_DHCP_RENEWAL_TIME, "\0\0\x07\x08", 4 },
+		{ DHO_DHCP_REBINDING_TIME, "\0\0\x0c\x4e", 4 },
+		{ DHO_DHCP_SERVER_IDENTIFIER, "\x0a\0\0\x01", 4 },
+		{ DHO_DHCP_MESSAGE_TYPE, "\x05", 1 },
+	};
+	static struct dhcp_packet req_raws[PACKETS];
+	static struct packet reqs[PACKETS];
+	struct option_state *cfg;
+	struct option_cache *oc;
+	struct data_string prl;
+	struct dhcp_packet raw, out;
+	struct packet packet;
+	double start;
+	unsigned i, j, r;
+
+	for (r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		use_option_tables(runs[r].tables);
+
+		start = now();
+		for (i = 0; i < nleases; i++) {
+			packet = packets[i % PACKETS];
+			raw = *packet.raw;
+			packet.raw = &raw;
+			packet.options = NULL;
+			if (!option_state_allocate(&packet.options, MDL))
+				fail("can't allocate an option state");
+			parse_request(&packet);
+			for (j = 0; j < sizeof(codes) / sizeof(codes[0]); j++)
+				lookup_option(&dhcp_universe, packet.options,
+					      codes[j]);
+			option_state_dereference(&packet.options, MDL);
+		}
+		record(runs[r].parse, "packet", nleases, now() - start);
+
+		/* The requests and the reply's options have to be kept the
+		   same way as the space's options are looked up. */
+		for (i = 0; i < PACKETS; i++) {
+			reqs[i] = packets[i];
+			req_raws[i] = *packets[i].raw;
+			reqs[i].raw = &req_raws[i];
+			reqs[i].options = NULL;
+			if (!option_state_allocate(&reqs[i].options, MDL))
+				fail("can't allocate an option state");
+			parse_request(&reqs[i]);
+		}
+		cfg = NULL;
+		if (!option_state_allocate(&cfg, MDL))
+			fail("can't allocate an option state");
+		for (i = 0; i < sizeof(reply) / sizeof(reply[0]); i++) {
+			if (!add_option(cfg, reply[i].code,
+					(void *)reply[i].data, reply[i].len))
+				fail("can't add option %u", reply[i].code);
+		}
+
+		start = now();
+		for (i = 0; i < nleases; i++) {
+			oc = lookup_option(&dhcp_universe,
+					   reqs[i % PACKETS].options,
+					   DHO_DHCP_PARAMETER_REQUEST_LIST);
+			memset(&prl, 0, sizeof(prl));
+			if (oc == NULL || !evaluate_option_cache(&prl,
+					&reqs[i % PACKETS], NULL, NULL,
+					reqs[i % PACKETS].options, NULL,
+					&global_scope, oc, MDL))
+				fail("no parameter request list");
+			if (cons_options(&reqs[i % PACKETS], &out, NULL, NULL,
+					 0, reqs[i % PACKETS].options, cfg,
+					 &global_scope, 0, 0, 0, &prl,
+					 NULL) == 0)
+				fail("can't put a reply together");
+			data_string_forget(&prl, MDL);
+		}
+		record(runs[r].cons, "packet", nleases, now() - start);
+
+		option_state_dereference(&cfg, MDL);
+		for (i = 0; i < PACKETS; i++)
+			option_state_dereference(&reqs[i].options, MDL);
+	}
+	use_option_tables(1);
+}
+
+/* Expressions like those used to sort clients into classes and to
+   make up option values. */
+static void
+bench_expressions(void)
+{
+	static const struct {
+		const char *text;
+		int boolean;
+	} exprs[] = {
+		{ "option vendor-class-identifier = \"MSFT 5.0\"", 1 },
+		{ "substring (option vendor-class-identifier, 0, 4) = "
+		  "\"PXEC\"", 1 },
+		{ "binary-to-ascii (16, 8, \":\", substring (hardware, 1, 6)) "
+		  "= \"2:0:0:0:0:1\"", 1 },
+		{ "exists agent.circuit-id or option host-name = \"host\"", 1 },
+		{ "concat (option host-name, \".\", \"example.com\")", 0 },
+		{ "pick-first-value (option dhcp-client-identifier, hardware)",
+		  0 },
+	};
+#define EXPRESSIONS (sizeof(exprs) / sizeof(exprs[0]))
+	static struct expression *parsed[EXPRESSIONS];
+	struct parse *cfile;
+	struct data_string ds;
+	struct packet *packet;
+	double start;
+	unsigned i, j;
+	int lose, ignore;
+
+	for (j = 0; j < EXPRESSIONS && parsed[j] == NULL; j++) {
+		cfile = NULL;
+		lose = 0;
+		new_parse(&cfile, -1, (char *)exprs[j].text,
+			  strlen(exprs[j].text), "bench", 0);
+		if (!(exprs[j].boolean
+		      ? parse_boolean_expression(&parsed[j], cfile, &lose)
+		      : parse_data_expression(&parsed[j], cfile, &lose)))
+			fail("can't parse %s", exprs[j].text);
+		end_parse(&cfile);
+	}
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		packet = &packets[i % PACKETS];
+		for (j = 0; j < EXPRESSIONS; j++) {
+			if (exprs[j].boolean) {
+				evaluate_boolean_expression_result
+					(&ignore, packet, NULL, NULL,
+					 packet->options, NULL, &global_scope,
+					 parsed[j]);
+				continue;
+			}
+			memset(&ds, 0, sizeof(ds));
+			if (!evaluate_data_expression(&ds, packet, NULL, NULL,
+						      packet->options, NULL,
+						      &global_scope, parsed[j],
+						      MDL))
+				fail("can't evaluate %s", exprs[j].text);
+			data_string_forget(&ds, MDL);
+		}
+	}
+	record("expression.eval", "expression", nleases * EXPRESSIONS,
+	       now() - start);
+}
+
+/* Find the leases of clients renewing, pick leases for new ones, and
+   write leases out as they would be to the lease file, which here is
+   /dev/null. */
+static void
+bench_leases(void)
+{
+	struct lease *lp;
+	double start;
+	unsigned i;
+	int ours, peer_has_leases;
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		lp = NULL;
+		ours = peer_has_leases = 0;
+		if (!find_lease(&lp, &packets[i % PACKETS], share, &ours,
+				&peer_has_leases, NULL, MDL))
+			fail("no lease found for a client that has one");
+		lease_dereference(&lp, MDL);
+	}
+	record("lease.find", "packet", nleases, now() - start);
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		lp = NULL;
+		peer_has_leases = 0;
+		if (!allocate_lease(&lp, &new_packets[i % PACKETS],
+				    share->pools, &peer_has_leases))
+			fail("no free lease for a new client");
+		lease_dereference(&lp, MDL);
+	}
+	record("lease.allocate", "packet", nleases, now() - start);
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		if (!write_lease(leases[i]))
+			fail("can't write a lease");
+	}
+	if (fflush(db_file) == EOF)
+		fail("can't write a lease");
+	record("lease.write", "lease", nleases, now() - start);
+}
+
+/* The DHCPv6 IA table, used the way the server uses it for each IA in
+   a SOLICIT (a miss for a new client), a REQUEST (the new IA is added)
+   and a RENEW (the IA is found and replaced with a new one). */
+static void
+bench_ia(void)
+{
+	static const unsigned char llt[8] = {
+		0, 1, 0, 1, 0x2a, 0x6b, 0x1c, 0x5e
+	};
+	ia_hash_t *table = NULL;
+	struct ia_xx *ia, *old;
+	struct ia_key key;
+	unsigned char duid[14];
+	double start;
+	unsigned i;
+
+	if (!ia_new_hash(&table, DEFAULT_HASH_SIZE, MDL))
+		fail("can't make an IA table");
+
+	/* DUID-LLTs with the clients' hardware addresses. */
+	memcpy(duid, llt, sizeof(llt));
+#define IA_DUID(i)	memcpy(duid + 8, leases[i]->hardware_addr.hbuf + 1, 6)
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		IA_DUID(i);
+		ia_key_init(&key, 1, (char *)duid, sizeof(duid));
+		ia = NULL;
+		if (ia_key_lookup(&ia, table, &key, MDL))
+			fail("found an IA before it was added");
+	}
+	record("ia.solicit", "IA", nleases, now() - start);
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		IA_DUID(i);
+		ia = NULL;
+		if (ia_allocate(&ia, 1, (char *)duid, sizeof(duid),
+				MDL) != ISC_R_SUCCESS)
+			fail("can't allocate an IA");
+		ia_hash_add(table, ia, MDL);
+		ia_dereference(&ia, MDL);
+	}
+	record("ia.request", "IA", nleases, now() - start);
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		IA_DUID(nleases - 1 - i);
+		ia = NULL;
+		if (ia_allocate(&ia, 1, (char *)duid, sizeof(duid),
+				MDL) != ISC_R_SUCCESS)
+			fail("can't allocate an IA");
+		old = NULL;
+		if (!ia_hash_lookup(&old, table, ia->iaid_duid.data,
+				    ia->iaid_duid.len, MDL))
+			fail("IA missing from the table");
+		ia_hash_remove(table, old, MDL);
+		ia_dereference(&old, MDL);
+		ia_hash_add(table, ia, MDL);
+		ia_dereference(&ia, MDL);
+	}
+	record("ia.renew", "IA", nleases, now() - start);
+#undef IA_DUID
+
+	ia_free_hash_table(&table, MDL);
+}
+
+/* Look up clients that have no reservation, by hardware address and by
+   client identifier, as is done for most requests. */
+static void
+bench_hosts(void)
+{
+	struct host_decl *hp = NULL;
+	struct dhcp_packet *raw;
+	double start;
+	unsigned i;
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		raw = &new_raws[i % PACKETS];
+		if (find_hosts_by_haddr(&hp, HTYPE_ETHER, raw->chaddr, 6, MDL) ||
+		    find_hosts_by_uid(&hp, raw->chaddr, 6, MDL))
+			fail("found a host that isn't there");
+	}
+	record("host.miss", "lookup", 2 * nleases, now() - start);
+}
+
+/* Split the lease file into tokens, as the parser does when it reads
+   it. */
+static void
+bench_lexer(void)
+{
+	struct parse *cfile = NULL;
+	const char *val;
+	unsigned long tokens = 0;
+	double start;
+	int fd;
+
+	fd = open(lease_file, O_RDONLY);
+	if ((fd < 0) ||
+	    (new_parse(&cfile, fd, NULL, 0, lease_file, 0) != ISC_R_SUCCESS))
+		fail("can't read %s", lease_file);
+
+	start = now();
+	while (next_token(&val, NULL, cfile) != END_OF_FILE)
+		tokens++;
+	record("lexer.token", "token", tokens, now() - start);
+	end_parse(&cfile);
+}
+
+/* Read the lease file again, each lease replacing the one read before;
+   with --enable-parallel-lease-load, on one thread and then on more. */
+static void
+bench_lease_file(void)
+{
+	static const struct {
+		const char *name;
+		int threads;
+	} runs[] = {
+		{ "leasefile.parse", 1 },
+#if defined (PARALLEL_LEASE_LOAD)
+		{ "leasefile.parse_2_threads", 2 },
+		{ "leasefile.parse_4_threads", 4 },
+		{ "leasefile.parse_8_threads", 8 },
+#endif
+	};
+	int saved = lease_load_threads;
+	double start;
+	unsigned i;
+
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		lease_load_threads = runs[i].threads;
+		start = now();
+		authoring_byte_order = 0;
+		if (read_conf_file(lease_file, root_group, ROOT_GROUP, 1) !=
+		    ISC_R_SUCCESS)
+			fail("can't read %s", lease_file);
+		record(runs[i].name, "lease", nleases, now() - start);
+	}
+	lease_load_threads = saved;
+}
+
+/* Reload the config file, keeping all the leases: once as it was read,
+   and once with options added to each host. */
+static void
+bench_reload(void)
+{
+	static const struct {
+		const char *name;
+		const char *extra;
+	} runs[] = {
+		{ "reload.config", "" },
+		{ "reload.host_options", "  option host-name \"host\";\n"
+		  "  option domain-name \"example.org\";\n" },
+	};
+	double start;
+	unsigned i;
+
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		write_conf_file(runs[i].extra);
+		start = now();
+		if (reload_config_apply() != ISC_R_SUCCESS)
+			fail("can't reload %s", conf_file);
+		record(runs[i].name, "lease", nleases, now() - start);
+	}
+
+	/* The old shared network went with the old config. */
+	share = leases[0]->subnet->shared_network;
+}
+
+/* Queue 1KB of OMAPI output for each lease in 64 byte messages, 4MB at a
+   time, behind a peer at the other end of a socket pair that isn't
+   reading, then write it all out; once with normal sized buffers and
+   once with bulk ones. */
+static void
+bench_omapi(void)
+{
+	static const struct {
+		const char *queue;
+		const char *write;
+		int bulk;
+	} runs[] = {
+		{ "omapi.queue", "omapi.write", 0 },
+		{ "omapi.bulk_queue", "omapi.bulk_write", 1 },
+	};
+	static unsigned char buf[65536];
+	unsigned char msg[64];
+	omapi_connection_object_t *conn;
+	unsigned long total, n, queued, got;
+	double qsecs, wsecs, start;
+	isc_result_t status;
+	ssize_t len;
+	int sv[2];
+	unsigned i;
+
+	total = nleases * 1024UL;
+	memset(msg, 0x5a, sizeof(msg));
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+		    fcntl(sv[0], F_SETFL, O_NONBLOCK) < 0 ||
+		    fcntl(sv[1], F_SETFL, O_NONBLOCK) < 0)
+			fail("can't make a socket pair");
+		conn = NULL;
+		if (omapi_connection_allocate(&conn, MDL) != ISC_R_SUCCESS)
+			fail("can't allocate a connection");
+		conn->socket = sv[0];
+		conn->state = omapi_connection_connected;
+		if (runs[i].bulk &&
+		    omapi_connection_set_bulk((omapi_object_t *)conn) !=
+		    ISC_R_SUCCESS)
+			fail("can't make the connection bulk");
+
+		qsecs = wsecs = 0;
+		for (n = 0; n < total; n += queued) {
+			start = now();
+			for (queued = 0; queued < OMAPI_BACKLOG &&
+				     n + queued < total; queued += sizeof(msg)) {
+				if (omapi_connection_copyin
+				    ((omapi_object_t *)conn, msg,
+				     sizeof(msg)) != ISC_R_SUCCESS)
+					fail("can't queue output");
+			}
+			qsecs += now() - start;
+
+			start = now();
+			for (got = 0; got < queued; ) {
+				status = omapi_connection_writer
+					((omapi_object_t *)conn);
+				if (status != ISC_R_SUCCESS &&
+				    status != ISC_R_INPROGRESS)
+					fail("can't write to the peer");
+				while ((len = read(sv[1], buf,
+						   sizeof(buf))) > 0)
+					got += len;
+			}
+			wsecs += now() - start;
+		}
+		record(runs[i].queue, "message", total / sizeof(msg), qsecs);
+		record(runs[i].write, "KB", total / 1024, wsecs);
+
+		if (conn->outbufs != NULL)
+			omapi_buffer_dereference(&conn->outbufs, MDL);
+		conn->outbufs_tail = NULL;
+		close(sv[0]);
+		close(sv[1]);
+		omapi_connection_dereference(&conn, MDL);
+	}
+}
+
+/* Sum a 1500 byte packet sixteen times for each lease, with each way of
+   working out checksums this CPU can do. */
+static void
+bench_checksum(void)
+{
+	static const struct {
+		const char *name;
+		const char *kernel;
+	} runs[] = {
+		{ "checksum.pairs", "pairs" },
+		{ "checksum.words", "words" },
+		{ "checksum.avx2", "avx2" },
+	};
+	static unsigned char data[1500];
+	volatile u_int32_t sink = 0;
+	double start;
+	unsigned i, n;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 131 + 7;
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		if (!checksum_select(runs[i].kernel))
+			continue;
+		start = now();
+		for (n = 0; n < 16 * nleases; n++)
+			sink += checksum(data, sizeof(data), n);
+		record(runs[i].name, "packet", 16 * nleases, now() - start);
+	}
+	checksum_select(NULL);
+}
+
+#if defined (PACKET_ASSEMBLY)
+/* Put together the link, IP and UDP headers of a 300 byte reply sixteen
+   times for each lease: field by field, as send_packet() used to, and
+   from the interface's template. */
+static void
+bench_headers(void)
+{
+	static unsigned char data[300];
+	unsigned char buf[1600], hh[32];
+	struct interface_info *ip = NULL;
+	u_int16_t saved = local_port;
+	unsigned bufix, hbufp, n;
+	volatile unsigned sink = 0;
+	double start;
+
+	if (interface_allocate(&ip, MDL) != ISC_R_SUCCESS)
+		fail("can't allocate an interface");
+	strcpy(ip->name, "bench0");
+	ip->hw_address.hlen = 7;
+	ip->hw_address.hbuf[0] = HTYPE_ETHER;
+	memcpy(&ip->hw_address.hbuf[1], "\x02\x00\x00\x00\x00\x01", 6);
+	local_port = htons(67);
+
+	start = now();
+	for (n = 0; n < 16 * nleases; n++) {
+		hbufp = 0;
+		assemble_hw_header(ip, hh, &hbufp, NULL);
+		memcpy(buf + hbufp % 4, hh, hbufp);
+		bufix = hbufp + hbufp % 4;
+		assemble_udp_ip_header(ip, buf, &bufix, n, ~n, htons(68),
+				       data, sizeof(data));
+		sink += bufix;
+	}
+	record("headers.fields", "packet", 16 * nleases, now() - start);
+
+	start = now();
+	for (n = 0; n < 16 * nleases; n++)
+		sink += assemble_headers(ip, buf, &bufix, NULL, n, ~n,
+					 htons(68), data, sizeof(data));
+	record("headers.template", "packet", 16 * nleases, now() - start);
+
+	interface_dereference(&ip, MDL);
+	local_port = saved;
+}
+#endif /* PACKET_ASSEMBLY */
+
+#if defined (FAILOVER_PROTOCOL)
+/* Send a BNDUPD for each lease to a peer at the other end of a socket
+   pair, writing after every one (as when updates trickle out) and after
+   every 64 (as when a run of queued updates is sent at once).  The
+   failover link's connection has one end of the pair, and the benchmark
+   calls the connection's writer itself, as the socket code would.
+
+   The leases sent are copies, already in the state the peer was last
+   told of, so that sending them doesn't commit them to the lease file
+   or change the leases the other benchmarks use. */
+
+static dhcp_failover_state_t *fo_state;
+static struct lease **fo_leases;
+static int fo_peer = -1;
+
+static void
+failover_setup(void)
+{
+	dhcp_failover_link_t *link = NULL;
+	omapi_connection_object_t *conn = NULL;
+	struct lease *lp;
+	int sv[2];
+	unsigned i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+	    fcntl(sv[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(sv[1], F_SETFL, O_NONBLOCK) < 0)
+		fail("can't make a socket pair");
+	fo_peer = sv[1];
+
+	if (dhcp_failover_state_allocate(&fo_state, MDL) != ISC_R_SUCCESS ||
+	    dhcp_failover_link_allocate(&link, MDL) != ISC_R_SUCCESS ||
+	    omapi_connection_allocate(&conn, MDL) != ISC_R_SUCCESS)
+		fail("can't allocate the failover objects");
+	conn->socket = sv[0];
+	conn->state = omapi_connection_connected;
+	omapi_object_reference(&link->outer, (omapi_object_t *)conn, MDL);
+	dhcp_failover_link_reference(&fo_state->link_to_peer, link, MDL);
+	fo_state->i_am = primary;
+	dhcp_failover_link_dereference(&link, MDL);
+	omapi_connection_dereference(&conn, MDL);
+
+	fo_leases = dmalloc(nleases * sizeof(*fo_leases), MDL);
+	if (fo_leases == NULL)
+		fail("no memory for %u leases", nleases);
+	for (i = 0; i < nleases; i++) {
+		lp = NULL;
+		if (lease_allocate(&lp, MDL) != ISC_R_SUCCESS)
+			fail("can't allocate a lease");
+		lp->ip_addr = leases[i]->ip_addr;
+		lp->binding_state = lp->rewind_binding_state =
+			lp->desired_binding_state = FTS_ACTIVE;
+		lp->hardware_addr = leases[i]->hardware_addr;
+		if (leases[i]->uid_len != 0) {
+			lp->uid = lp->uid_buf;
+			lp->uid_len = leases[i]->uid_len;
+			memcpy(lp->uid_buf, leases[i]->uid, lp->uid_len);
+		}
+		lp->starts = leases[i]->starts;
+		lp->ends = leases[i]->ends;
+		lp->tstp = leases[i]->ends + 1800;
+		lp->cltt = leases[i]->cltt;
+		fo_leases[i] = lp;
+	}
+}
+
+/* Write out whatever the connection has, and read it at the other end. */
+static void
+failover_flush(void)
+{
+	unsigned char buf[65536];
+
+	if (omapi_connection_writer(fo_state->link_to_peer->outer) !=
+	    ISC_R_SUCCESS)
+		fail("can't write to the peer");
+	while (read(fo_peer, buf, sizeof(buf)) > 0)
+		continue;
+}
+
+static void
+bench_failover(void)
+{
+	static const struct {
+		const char *name;
+		unsigned per_write;
+	} runs[] = {
+		{ "failover.bndupd", 1 },
+		{ "failover.bndupd64", 64 },
+	};
+	double start;
+	unsigned i, n;
+
+	if (fo_state == NULL)
+		failover_setup();
+
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		start = now();
+		for (n = 0; n < nleases; n++) {
+			if (dhcp_failover_send_bind_update(fo_state,
+							   fo_leases[n]) !=
+			    ISC_R_SUCCESS)
+				fail("can't send a BNDUPD");
+			if ((n + 1) % runs[i].per_write == 0)
+				failover_flush();
+		}
+		failover_flush();
+		record(runs[i].name, "message", nleases, now() - start);
+	}
+}
+#endif /* FAILOVER_PROTOCOL */
+
+#if defined (USE_LPF_SEND)
+/* The benchmarks that send packets do so across a veth pair.  Making
+   it needs root and the ip command; without them they are skipped. */
+
+#define VETH_SERVER_IF	"dbench0"
+#define VETH_CLIENT_IF	"dbench1"
+
+static void
+veth_down(void)
+{
+	if (system("ip link del " VETH_SERVER_IF " 2>/dev/null")) {
+		/* It may not have been there. */
+	}
+}
+
+/* Makes the pair, or returns zero if we can't. */
+static int
+veth_up(void)
+{
+	veth_down();
+	if (geteuid() != 0)
+		return (0);
+	local_port = htons(67);
+	remote_port = htons(68);
+	quiet_interface_discovery = 1;
+	return (system("ip link add " VETH_SERVER_IF " type veth peer name "
+		       VETH_CLIENT_IF " && ip link set " VETH_SERVER_IF
+		       " up && ip link set " VETH_CLIENT_IF " up") == 0);
+}
+
+static struct interface_info *
+veth_interface(const char *name, u_int32_t flags)
+{
+	struct interface_info *ip = NULL;
+
+	if (interface_allocate(&ip, MDL) != ISC_R_SUCCESS)
+		fail("can't allocate an interface");
+	strcpy(ip->name, name);
+	ip->ifp = dmalloc(sizeof(struct ifreq), MDL);
+	if (ip->ifp == NULL)
+		fail("can't allocate an ifreq");
+	strcpy(ip->ifp->ifr_name, name);
+	ip->rfdesc = ip->wfdesc = -1;
+	ip->flags = INTERFACE_REQUESTED | flags;
+	return (ip);
+}
+#endif /* USE_LPF_SEND */
+
+#if defined (USE_AF_XDP)
+/* Send DHCPDISCOVERs to an interface listening with LPF, and then with
+   AF_XDP; without AF_XDP on the pair, the benchmark is skipped. */
+
+#define XDP_BURST	64
+
+/* Send the frame nleases times from sfd, reading each one at the
+   server end. */
+static void
+xdp_run(const char *name, struct interface_info *server, int sfd,
+	const unsigned char *frame, unsigned len)
+{
+	unsigned char buf[1536];
+	struct sockaddr_in from;
+	struct hardware hfrom;
+	struct pollfd pfd;
+	unsigned sent, got, i;
+	ssize_t result;
+	double start;
+
+	start = now();
+	for (sent = got = 0; sent < nleases; ) {
+		for (i = 0; i < XDP_BURST && sent < nleases; i++, sent++) {
+			if (write(sfd, frame, len) != len)
+				fail("can't send a packet: %s",
+				     strerror(errno));
+		}
+		while (got < sent) {
+			if (server->rbuf_offset == server->rbuf_len) {
+				pfd.fd = server->rfdesc;
+				pfd.events = POLLIN;
+				if (poll(&pfd, 1, 1000) != 1)
+					fail("timed out waiting for packets");
+			}
+			result = receive_packet(server, buf, sizeof(buf),
+						&from, &hfrom);
+			if (result < 0)
+				fail("receive_packet: %s", strerror(errno));
+			if (result > 0)
+				got++;
+		}
+	}
+	record(name, "packet", nleases, now() - start);
+}
+
+static void
+bench_xdp(void)
+{
+	static int skipped;
+	struct interface_info *server, *client;
+	struct dhcp_packet raw;
+	struct sockaddr_ll sll;
+	unsigned char frame[1536];
+	unsigned bufix = 0, len;
+	int sfd;
+
+	if (skipped)
+		return;
+	if (!veth_up()) {
+		fprintf(stderr, "xdp: can't make a veth pair, skipped\n");
+		skipped = 1;
+		return;
+	}
+
+	client = veth_interface(VETH_CLIENT_IF, 0);
+	get_hw_addr(VETH_CLIENT_IF, &client->hw_address);
+	sfd = socket(PF_PACKET, SOCK_RAW, 0);
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = if_nametoindex(VETH_CLIENT_IF);
+	if ((sfd < 0) || (bind(sfd, (struct sockaddr *)&sll, sizeof(sll)) < 0))
+		fail("can't open a packet socket: %s", strerror(errno));
+
+	/* A DHCPDISCOVER from the client end. */
+	memset(&raw, 0, sizeof(raw));
+	raw.op = BOOTREQUEST;
+	raw.htype = HTYPE_ETHER;
+	raw.hlen = 6;
+	raw.xid = htonl(0x12345678);
+	memcpy(raw.chaddr, &client->hw_address.hbuf[1], 6);
+	memcpy(raw.options, DHCP_OPTIONS_COOKIE, 4);
+	raw.options[4] = DHO_DHCP_MESSAGE_TYPE;
+	raw.options[5] = 1;
+	raw.options[6] = DHCPDISCOVER;
+	raw.options[7] = DHO_END;
+	len = DHCP_FIXED_NON_UDP + 8;
+	assemble_hw_header(client, frame, &bufix, NULL);
+	assemble_udp_ip_header(client, frame, &bufix, INADDR_ANY,
+			       INADDR_BROADCAST, htons(67),
+			       (unsigned char *)&raw, len);
+	memcpy(frame + bufix, &raw, len);
+	len += bufix;
+
+	server = veth_interface(VETH_SERVER_IF, 0);
+	if_register_receive(server);
+	if_register_send(server);
+	xdp_run("xdp.lpf", server, sfd, frame, len);
+	if_deregister_send(server);
+	if_deregister_receive(server);
+
+	server->flags |= INTERFACE_XDP;
+	if_register_receive(server);
+	if_register_send(server);
+	if (server->xdp != NULL)
+		xdp_run("xdp.afxdp", server, sfd, frame, len);
+	else {
+		fprintf(stderr, "xdp: can't set up AF_XDP on "
+			VETH_SERVER_IF ", skipped\n");
+		skipped = 1;
+	}
+	if_deregister_send(server);
+	if_deregister_receive(server);
+
+	close(sfd);
+	interface_dereference(&server, MDL);
+	interface_dereference(&client, MDL);
+	veth_down();
+}
+#endif /* USE_AF_XDP */
+
+#if defined (USE_SEND_BATCH) && defined (USE_LPF_SEND)
+/* Send DHCPACKs the way delayed_acks_timer() does with delayed-ack
+   enabled, a group of them at a time once the leases are committed:
+   once one by one, and once inside a send batch. */
+
+#define ACK_GROUP	28	/* The default delayed-ack. */
+
+static void
+ack_run(const char *name, struct interface_info *server, int batch)
+{
+	struct dhcp_packet raw;
+	struct sockaddr_in to;
+	struct in_addr from;
+	unsigned len, sent, i;
+	double start;
+
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = INADDR_BROADCAST;
+	to.sin_port = htons(68);
+	from.s_addr = htonl(0x0a000001);
+
+	memset(&raw, 0, sizeof(raw));
+	raw.op = BOOTREPLY;
+	raw.htype = HTYPE_ETHER;
+	raw.hlen = 6;
+	memcpy(raw.options, DHCP_OPTIONS_COOKIE, 4);
+	raw.options[4] = DHO_DHCP_MESSAGE_TYPE;
+	raw.options[5] = 1;
+	raw.options[6] = DHCPACK;
+	raw.options[7] = DHO_END;
+	len = DHCP_FIXED_NON_UDP + 8;
+
+	start = now();
+	for (sent = 0; sent < nleases; ) {
+		if (batch)
+			send_batch_begin();
+		for (i = 0; i < ACK_GROUP && sent < nleases; i++, sent++) {
+			raw.xid = htonl(sent);
+			memcpy(&raw.yiaddr, leases[sent]->ip_addr.iabuf, 4);
+			if (send_packet(server, NULL, &raw, len, from,
+					&to, NULL) < 0)
+				fail("send_packet: %s", strerror(errno));
+		}
+		if (batch)
+			send_batch_end();
+	}
+	record(name, "packet", nleases, now() - start);
+}
+
+static void
+bench_acks(void)
+{
+	static int skipped;
+	struct interface_info *server;
+
+	if (skipped)
+		return;
+	if (!veth_up()) {
+		fprintf(stderr, "ack: can't make a veth pair, skipped\n");
+		skipped = 1;
+		return;
+	}
+
+	/* send_batch_end() flushes the interfaces on the list. */
+	server = veth_interface(VETH_SERVER_IF, 0);
+	interface_reference(&interfaces, server, MDL);
+	if_register_receive(server);
+	if_register_send(server);
+
+	ack_run("ack.single", server, 0);
+	ack_run("ack.batch", server, 1);
+	if (server->tbuf_len != 0 || send_batching != 0)
+		fail("ACKs left queued after the batch");
+
+	if_deregister_send(server);
+	if_deregister_receive(server);
+	interface_dereference(&interfaces, MDL);
+	interface_dereference(&server, MDL);
+	veth_down();
+}
+#endif /* USE_SEND_BATCH && USE_LPF_SEND */
+
+static struct {
+	const char *name;
+	void (*func)(void);
+} benchmarks[] = {
+	{ "hash", bench_hash },
+	{ "leasechain", bench_leasechain },
+	{ "option", bench_options },
+	{ "expression", bench_expressions },
+	{ "host", bench_hosts },
+	{ "ia", bench_ia },
+	{ "lease", bench_leases },
+	{ "lexer", bench_lexer },
+	{ "leasefile", bench_lease_file },
+	{ "reload", bench_reload },
+	{ "omapi", bench_omapi },
+	{ "checksum", bench_checksum },
+#if defined (PACKET_ASSEMBLY)
+	{ "headers", bench_headers },
+#endif
+#if defined (FAILOVER_PROTOCOL)
+	{ "failover", bench_failover },
+#endif
+#if defined (USE_SEND_BATCH) && defined (USE_LPF_SEND)
+	{ "ack", bench_acks },
+#endif
+#if defined (USE_AF_XDP)
+	{ "xdp", bench_xdp },
+#endif
+};
+
+/* Run the benchmarks whose names start with only, and the ones that
+   record the result it names, if it names one. */
+static int
+selected(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (only == NULL)
+		return (1);
+	return ((strncmp(name, only, strlen(only)) == 0) ||
+		((strncmp(only, name, len) == 0) && (only[len] == '.')));
+}
+
+static void
+write_results(FILE *f)
+{
+	int i;
+
+	fprintf(f, "{\n"
+		"  \"program\": \"dhcpd_bench\",\n"
+		"  \"version\": \"%s\",\n"
+		"  \"leases\": %u,\n"
+		"  \"seed\": %u,\n"
+		"  \"repeats\": %d,\n"
+		"  \"binary_leases\": %s,\n"
+		"  \"failover\": %s,\n"
+		"  \"results\": [\n",
+		PACKAGE_VERSION, nleases, (unsigned)seed, repeats,
+#if defined (BINARY_LEASES)
+		"true",
+#else
+		"false",
+#endif
+#if defined (FAILOVER_PROTOCOL)
+		"true"
+#else
+		"false"
+#endif
+		);
+	for (i = 0; i < nresults; i++) {
+		fprintf(f, "    { \"name\": \"%s\", \"unit\": \"%s\", "
+			"\"ops\": %lu, \"ns_per_op\": %.1f, "
+			"\"ops_per_sec\": %.0f }%s\n",
+			results[i].name, results[i].unit, results[i].ops,
+			results[i].secs * 1e9 / results[i].ops,
+			results[i].secs > 0 ? results[i].ops / results[i].secs
+					    : 0.0,
+			i + 1 < nresults ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: dhcpd_bench [-n leases] [-r repeats] "
+		"[-s seed] [-b benchmark] [-o file]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *out = NULL;
+	FILE *f;
+	unsigned b;
+	int ch, r, i;
+
+	while ((ch = getopt(argc, argv, "n:r:s:b:o:")) != -1) {
+		switch (ch) {
+		      case 'n':
+			nleases = atoi(optarg);
+			break;
+		      case 'r':
+			repeats = atoi(optarg);
+			break;
+		      case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		      case 'b':
+			only = optarg;
+			break;
+		      case 'o':
+			out = optarg;
+			break;
+		      default:
+			usage();
+		}
+	}
+	if (optind != argc || nleases < 1 || nleases > MAX_LEASES ||
+	    repeats < 1 || seed == 0)
+		usage();
+
+	/* The server logs to syslog as usual, but not to stderr. */
+	log_perror = 0;
+	setup();
+
+	for (b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+		if (!selected(benchmarks[b].name))
+			continue;
+		i = nresults;
+		for (r = 0; r < repeats; r++)
+			(*benchmarks[b].func)();
+		for (; i < nresults; i++)
+			fprintf(stderr, "%-26s %10.1f ns/%s\n", results[i].name,
+				results[i].secs * 1e9 / results[i].ops,
+				results[i].unit);
+	}
+
+	if (out != NULL) {
+		f = fopen(out, "w");
+		if (f == NULL)
+			fail("can't write %s", out);
+		write_results(f);
+		if (fclose(f) != 0)
+			fail("can't write %s", out);
+	} else
+		write_results(stdout);
+
+	unlink(conf_file);
+	unlink(lease_file);
+	return (0);
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Test that OMAPI cursors left unfinished are let go of when their
+ * connection closes or they aren't refreshed, and that a connection
+ * can only have so many open.  Batches are sent the way the protocol
+ * code would send them, into a connection that's never written out.
+ */
+
+static const char *conf_file = "cursor_test.conf";
+
+#define LEASES	1000
+#define BATCH	100
+
+static void
+setup(void)
+{
+	FILE *f;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	gettimeofday(&cur_tv, NULL);
+	cur_time = cur_tv.tv_sec;
+
+	f = fopen(conf_file, "w");
+	if ((f == NULL) ||
+	    (fprintf(f, "subnet 10.0.0.0 netmask 255.255.0.0 {\n"
+		     "  range 10.0.0.1 10.0.%d.%d;\n}\n",
+		     LEASES >> 8, LEASES & 255) < 0) ||
+	    (fclose(f) != 0))
+		atf_tc_fail("can't write %s", conf_file);
+
+	root_group_setup();
+	path_dhcpd_conf = conf_file;
+	if (readconf() != ISC_R_SUCCESS)
+		atf_tc_fail("can't read the config file");
+
+	/* as main() does at startup */
+	expire_all_pools();
+}
+
+static omapi_object_t *
+make_conn(void)
+{
+	omapi_connection_object_t *conn = NULL;
+
+	if (omapi_connection_allocate(&conn, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate a connection");
+	conn->socket = -1;
+	conn->state = omapi_connection_connected;
+	return (omapi_object_t *)conn;
+}
+
+static omapi_object_t *
+make_cursor(void)
+{
+	omapi_object_t *cursor = NULL;
+
+	if ((dhcp_cursor_create(&cursor, NULL) != ISC_R_SUCCESS) ||
+	    (omapi_set_string_value(cursor, NULL, "object-type",
+				    "lease") != ISC_R_SUCCESS) ||
+	    (omapi_set_int_value(cursor, NULL, "batch-size",
+				 BATCH) != ISC_R_SUCCESS))
+		atf_tc_fail("can't make a cursor");
+	return cursor;
+}
+
+static unsigned long
+remaining(omapi_object_t *cursor)
+{
+	omapi_value_t *tv = NULL;
+	unsigned long n;
+
+	if ((omapi_get_value_str(cursor, NULL, "remaining",
+				 &tv) != ISC_R_SUCCESS) ||
+	    (omapi_get_int_value(&n, tv->value) != ISC_R_SUCCESS))
+		atf_tc_fail("can't get the number remaining");
+	omapi_value_dereference(&tv, MDL);
+	return n;
+}
+
+/* Send a batch, as the reply to the open or to a refresh would. */
+static isc_result_t
+send_batch(omapi_object_t *conn, omapi_object_t *cursor)
+{
+	return dhcp_cursor_stuff_values(conn, NULL, cursor);
+}
+
+/* Move the clock on and run any timeouts that are due. */
+static void
+wait_secs(int secs)
+{
+	cur_tv.tv_sec += secs;
+	cur_time = cur_tv.tv_sec;
+	process_outstanding_timeouts(NULL);
+}
+
+ATF_TC(cursor_closed);
+ATF_TC_HEAD(cursor_closed, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "An unfinished cursor lets go of "
+			  "its objects when its connection closes");
+}
+
+ATF_TC_BODY(cursor_closed, tc)
+{
+	omapi_object_t *conn, *other, *cursor, *kept;
+
+	setup();
+	conn = make_conn();
+	other = make_conn();
+	cursor = make_cursor();
+	kept = make_cursor();
+
+	if (send_batch(conn, cursor) != ISC_R_SUCCESS ||
+	    send_batch(other, kept) != ISC_R_SUCCESS)
+		atf_tc_fail("can't send the first batches");
+	if (remaining(cursor) != LEASES - BATCH)
+		atf_tc_fail("%lu left after the first batch",
+			    remaining(cursor));
+
+	((omapi_connection_object_t *)conn)->state = omapi_connection_closed;
+	wait_secs(20);
+	if (remaining(cursor) != 0)
+		atf_tc_fail("%lu left after the connection closed",
+			    remaining(cursor));
+	if (remaining(kept) != LEASES - BATCH)
+		atf_tc_fail("cursor on an open connection let go of");
+
+	omapi_object_dereference(&cursor, MDL);
+	omapi_object_dereference(&kept, MDL);
+}
+
+ATF_TC(cursor_idle);
+ATF_TC_HEAD(cursor_idle, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A cursor that isn't refreshed is "
+			  "let go of, and refreshing it afterwards fails");
+}
+
+ATF_TC_BODY(cursor_idle, tc)
+{
+	omapi_object_t *conn, *cursor, *busy;
+	int i;
+
+	setup();
+	conn = make_conn();
+	cursor = make_cursor();
+	busy = make_cursor();
+
+	if (send_batch(conn, cursor) != ISC_R_SUCCESS ||
+	    send_batch(conn, busy) != ISC_R_SUCCESS)
+		atf_tc_fail("can't send the first batches");
+
+	/* One is refreshed now and then, the other is left alone. */
+	for (i = 0; i < 7; i++) {
+		wait_secs(60);
+		if (send_batch(conn, busy) != ISC_R_SUCCESS)
+			atf_tc_fail("can't refresh a cursor in use");
+	}
+	if (remaining(cursor) != 0)
+		atf_tc_fail("%lu left in an idle cursor", remaining(cursor));
+	if (remaining(busy) != LEASES - 8 * BATCH)
+		atf_tc_fail("%lu left in a cursor in use", remaining(busy));
+	if (send_batch(conn, cursor) != ISC_R_TIMEDOUT)
+		atf_tc_fail("refreshing an idle cursor didn't fail");
+
+	omapi_object_dereference(&cursor, MDL);
+	omapi_object_dereference(&busy, MDL);
+}
+
+ATF_TC(cursor_limit);
+ATF_TC_HEAD(cursor_limit, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A connection can only have so many "
+			  "cursors open, but finished ones don't count");
+}
+
+ATF_TC_BODY(cursor_limit, tc)
+{
+	omapi_object_t *conn, *other, *cursors[9];
+	int i;
+
+	setup();
+	conn = make_conn();
+	other = make_conn();
+	for (i = 0; i < 9; i++)
+		cursors[i] = make_cursor();
+
+	for (i = 0; i < 8; i++)
+		if (send_batch(conn, cursors[i]) != ISC_R_SUCCESS)
+			atf_tc_fail("can't open cursor %d", i);
+	if (send_batch(conn, cursors[8]) != ISC_R_QUOTA)
+		atf_tc_fail("ninth cursor opened on one connection");
+
+	/* Finishing one makes room. */
+	while (remaining(cursors[0]) != 0)
+		if (send_batch(conn, cursors[0]) != ISC_R_SUCCESS)
+			atf_tc_fail("can't finish a cursor");
+	omapi_object_dereference(&cursors[8], MDL);
+	cursors[8] = make_cursor();
+	if (send_batch(conn, cursors[8]) != ISC_R_SUCCESS)
+		atf_tc_fail("no room after a cursor finished");
+
+	/* Other connections have their own. */
+	omapi_object_dereference(&cursors[0], MDL);
+	cursors[0] = make_cursor();
+	if (send_batch(other, cursors[0]) != ISC_R_SUCCESS)
+		atf_tc_fail("cursor refused on another connection");
+
+	for (i = 0; i < 9; i++)
+		omapi_object_dereference(&cursors[i], MDL);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, cursor_closed);
+	ATF_TP_ADD_TC(tp, cursor_idle);
+	ATF_TP_ADD_TC(tp, cursor_limit);
+
+	return (atf_no_error());
+}
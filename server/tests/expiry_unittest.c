@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atf-c.h>
+
+/*
+ * Test the expiry slices and the expiry backlog.  The backlog entries
+ * here are for stand-in pools: the expire routine records the order
+ * it's called in and the reference routines count references.
+ */
+
+static int refs;
+static int runs;
+static void *ran[4];
+
+static void
+stand_in_ref(void *ptr, void *pool, const char *file, int line)
+{
+	*(void **)ptr = pool;
+	refs++;
+}
+
+static void
+stand_in_unref(void *ptr, const char *file, int line)
+{
+	*(void **)ptr = NULL;
+	refs--;
+}
+
+static void
+stand_in_expire(void *pool)
+{
+	if (runs < 4)
+		ran[runs] = pool;
+	runs++;
+}
+
+ATF_TC(slice_leases);
+ATF_TC_HEAD(slice_leases, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "An expiry slice ends after "
+			  "expiry-slice-leases leases");
+}
+
+ATF_TC_BODY(slice_leases, tc)
+{
+	int i;
+
+	expiry_slice_leases = 10;
+	expiry_slice_usecs = 0;
+	expiry_slice_begin();
+	for (i = 1; i < 10; i++) {
+		if (expiry_slice_over())
+			atf_tc_fail("slice over after %d leases", i);
+	}
+	if (!expiry_slice_over())
+		atf_tc_fail("slice not over after 10 leases");
+
+	/* no limit at all */
+	expiry_slice_leases = 0;
+	expiry_slice_begin();
+	for (i = 0; i < 100000; i++) {
+		if (expiry_slice_over())
+			atf_tc_fail("unlimited slice over after %d leases", i);
+	}
+}
+
+ATF_TC(slice_usecs);
+ATF_TC_HEAD(slice_usecs, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "An expiry slice ends after "
+			  "expiry-slice-usecs microseconds");
+}
+
+ATF_TC_BODY(slice_usecs, tc)
+{
+	int i;
+
+	expiry_slice_leases = 0;
+	expiry_slice_usecs = 1000;
+	expiry_slice_begin();
+	if (expiry_slice_over())
+		atf_tc_fail("slice over straight away");
+
+	/* The clock is looked at every 16 leases */
+	usleep(2000);
+	for (i = 0; i < 16; i++) {
+		if (expiry_slice_over())
+			break;
+	}
+	if (i == 16)
+		atf_tc_fail("slice not over after its time");
+}
+
+ATF_TC(backlog_order);
+ATF_TC_HEAD(backlog_order, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The expiry backlog runs the pool "
+			  "under the most pressure first");
+}
+
+ATF_TC_BODY(backlog_order, tc)
+{
+	static int a, b, c;
+	TIME oldest = 0;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	gettimeofday(&cur_tv, NULL);
+
+	expiry_backlog_add(stand_in_expire, &a, stand_in_ref, stand_in_unref,
+			   100, 50);
+	expiry_backlog_add(stand_in_expire, &b, stand_in_ref, stand_in_unref,
+			   900, 60);
+	expiry_backlog_add(stand_in_expire, &c, stand_in_ref, stand_in_unref,
+			   900, 40);
+
+	/* A pool that's already waiting isn't added twice */
+	expiry_backlog_add(stand_in_expire, &a, stand_in_ref, stand_in_unref,
+			   950, 70);
+	if (refs != 3)
+		atf_tc_fail("%d references, expected 3", refs);
+	if (expiry_backlog_gauge(&oldest) != 3)
+		atf_tc_fail("backlog doesn't have 3 pools");
+	if (oldest != 40)
+		atf_tc_fail("oldest due at %ld, expected 40", (long)oldest);
+
+	/* Most pressure first, then the longest waiting */
+	expiry_backlog_run(NULL);
+	expiry_backlog_run(NULL);
+	expiry_backlog_run(NULL);
+	if ((runs != 3) || (ran[0] != &a) || (ran[1] != &c) || (ran[2] != &b))
+		atf_tc_fail("backlog ran in the wrong order");
+	if (expiry_backlog_gauge(NULL) != 0)
+		atf_tc_fail("backlog not empty");
+	if (refs != 0)
+		atf_tc_fail("%d references left", refs);
+
+	/* Nothing to do on an empty backlog */
+	expiry_backlog_run(NULL);
+	if (runs != 3)
+		atf_tc_fail("empty backlog ran something");
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, slice_leases);
+	ATF_TP_ADD_TC(tp, slice_usecs);
+	ATF_TP_ADD_TC(tp, backlog_order);
+	return (atf_no_error());
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Check that the BNDUPD and BNDACK messages put together in place are
+ * byte for byte the ones dhcp_failover_make_option() and
+ * dhcp_failover_put_message() make, sent to a peer at the other end of
+ * a socket pair.   The failover link's connection is given one end of
+ * the pair; the test calls the connection's writer itself, as the
+ * socket code would.
+ */
+
+#if defined (FAILOVER_PROTOCOL)
+
+#define LEASES	1000
+
+static dhcp_failover_state_t *state;
+static dhcp_failover_link_t *flink;
+static omapi_connection_object_t *conn;
+static struct lease *leases [LEASES];
+static int peer = -1;
+
+static void
+setup(void)
+{
+	struct lease *lp;
+	int sv[2], i;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	gettimeofday(&cur_tv, NULL);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+	    fcntl(sv[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(sv[1], F_SETFL, O_NONBLOCK) < 0)
+		atf_tc_fail("can't make a socket pair");
+	peer = sv[1];
+
+	if (dhcp_failover_state_allocate(&state, MDL) != ISC_R_SUCCESS ||
+	    dhcp_failover_link_allocate(&flink, MDL) != ISC_R_SUCCESS ||
+	    omapi_connection_allocate(&conn, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate the failover objects");
+	conn->socket = sv[0];
+	conn->state = omapi_connection_connected;
+	omapi_object_reference(&flink->outer, (omapi_object_t *)conn, MDL);
+	dhcp_failover_link_reference(&state->link_to_peer, flink, MDL);
+	state->i_am = primary;
+
+	for (i = 0; i < LEASES; i++) {
+		lp = NULL;
+		if (lease_allocate(&lp, MDL) != ISC_R_SUCCESS)
+			atf_tc_fail("can't allocate a lease");
+		lp->ip_addr.len = 4;
+		lp->ip_addr.iabuf[0] = 10;
+		lp->ip_addr.iabuf[2] = i >> 8;
+		lp->ip_addr.iabuf[3] = i & 255;
+		lp->binding_state = lp->rewind_binding_state = FTS_ACTIVE;
+		lp->desired_binding_state = i % 3 ? FTS_ACTIVE : FTS_FREE;
+		lp->hardware_addr.hlen = 7;
+		lp->hardware_addr.hbuf[0] = HTYPE_ETHER;
+		lp->hardware_addr.hbuf[5] = i >> 8;
+		lp->hardware_addr.hbuf[6] = i & 255;
+		if (i % 2) {
+			lp->uid = lp->uid_buf;
+			lp->uid_len = 7;
+			memcpy(lp->uid_buf, lp->hardware_addr.hbuf, 7);
+		}
+		lp->starts = cur_time - i;
+		lp->ends = cur_time + 3600 + i;
+		lp->tstp = cur_time + 5400 + i;
+		lp->cltt = i % 5 ? cur_time - i : 0;
+		if (i % 7 == 0)
+			lp->flags |= RESERVED_LEASE;
+		if (i % 11 == 0)
+			lp->flags |= BOOTP_LEASE;
+		leases[i] = lp;
+	}
+}
+
+/* Write out whatever the connection has, and read it at the other end. */
+static unsigned
+flush(unsigned char *buf, unsigned max)
+{
+	unsigned len = 0;
+	ssize_t n;
+
+	if (omapi_connection_writer((omapi_object_t *)conn) != ISC_R_SUCCESS)
+		atf_tc_fail("can't write to the peer");
+	while ((n = read(peer, buf + len, max - len)) > 0)
+		len += n;
+	return len;
+}
+
+/* Send a BNDUPD the way dhcp_failover_send_bind_update() used to. */
+static isc_result_t
+old_bind_update(struct lease *lease)
+{
+	int flags = 0;
+
+	if (lease->flags & RESERVED_LEASE)
+		flags |= FTF_IP_FLAG_RESERVE;
+	if (lease->flags & BOOTP_LEASE)
+		flags |= FTF_IP_FLAG_BOOTP;
+
+# define FMA (char *)0, (unsigned *)0, 0
+	return (dhcp_failover_put_message
+		(flink, flink->outer, FTM_BNDUPD, lease->last_xid,
+		 dhcp_failover_make_option(FTO_ASSIGNED_IP_ADDRESS, FMA,
+					   lease->ip_addr.len,
+					   lease->ip_addr.iabuf),
+		 dhcp_failover_make_option(FTO_BINDING_STATUS, FMA,
+					   lease->desired_binding_state),
+		 lease->uid_len
+		 ? dhcp_failover_make_option(FTO_CLIENT_IDENTIFIER, FMA,
+					     lease->uid_len, lease->uid)
+		 : &skip_failover_option,
+		 lease->hardware_addr.hlen
+		 ? dhcp_failover_make_option(FTO_CHADDR, FMA,
+					     lease->hardware_addr.hlen,
+					     lease->hardware_addr.hbuf)
+		 : &skip_failover_option,
+		 dhcp_failover_make_option(FTO_LEASE_EXPIRY, FMA,
+					   lease->ends),
+		 dhcp_failover_make_option(FTO_POTENTIAL_EXPIRY, FMA,
+					   lease->tstp),
+		 dhcp_failover_make_option(FTO_STOS, FMA, lease->starts),
+		 lease->cltt
+		 ? dhcp_failover_make_option(FTO_CLTT, FMA, lease->cltt)
+		 : &skip_failover_option,
+		 flags
+		 ? dhcp_failover_make_option(FTO_IP_FLAGS, FMA, flags)
+		 : &skip_failover_option,
+		 (failover_option_t *)0));
+}
+
+ATF_TC(failover_encoding);
+
+ATF_TC_HEAD(failover_encoding, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Check that BNDUPDs and BNDACKs are "
+			  "the same as the ones made option by option.");
+}
+
+ATF_TC_BODY(failover_encoding, tc)
+{
+	static const char *message = "the reason why";
+	const char *text;
+	unsigned char want[2048], got[2048];
+	unsigned wlen, glen;
+	failover_message_t msg;
+	int i;
+
+	setup();
+
+	for (i = 0; i < LEASES; i++) {
+		if (dhcp_failover_send_bind_update(state, leases[i]) !=
+		    ISC_R_SUCCESS)
+			atf_tc_fail("can't send BNDUPD %d", i);
+		glen = flush(got, sizeof got);
+		if (old_bind_update(leases[i]) != ISC_R_SUCCESS)
+			atf_tc_fail("can't send the old BNDUPD %d", i);
+		wlen = flush(want, sizeof want);
+		if (wlen == 0 || wlen != glen || memcmp(want, got, wlen))
+			atf_tc_fail("BNDUPD %d is different", i);
+	}
+
+	/* A reason without a message is sent with the reason's name. */
+	memset(&msg, 0, sizeof msg);
+	for (i = 0; i < 4; i++) {
+		msg.xid = 1000 + i;
+		memcpy(&msg.assigned_addr, leases[i]->ip_addr.iabuf, 4);
+		if (dhcp_failover_send_bind_ack(state, &msg, i & 1 ? 5 : 0,
+						i & 2 ? message : NULL) !=
+		    ISC_R_SUCCESS)
+			atf_tc_fail("can't send BNDACK %d", i);
+		glen = flush(got, sizeof got);
+		text = i & 2 ? message : dhcp_failover_reject_reason_print(5);
+		if (dhcp_failover_put_message
+		    (flink, flink->outer, FTM_BNDACK, msg.xid,
+		     dhcp_failover_make_option(FTO_ASSIGNED_IP_ADDRESS, FMA,
+					       sizeof msg.assigned_addr,
+					       &msg.assigned_addr),
+		     i & 1
+		     ? dhcp_failover_make_option(FTO_REJECT_REASON, FMA, 5)
+		     : &skip_failover_option,
+		     i & 1
+		     ? dhcp_failover_make_option(FTO_MESSAGE, FMA,
+						 strlen(text), text)
+		     : &skip_failover_option,
+		     (failover_option_t *)0) != ISC_R_SUCCESS)
+			atf_tc_fail("can't send the old BNDACK %d", i);
+		wlen = flush(want, sizeof want);
+		if (wlen == 0 || wlen != glen || memcmp(want, got, wlen))
+			atf_tc_fail("BNDACK %d is different", i);
+	}
+}
+
+ATF_TC(failover_reserve_fails);
+
+ATF_TC_HEAD(failover_reserve_fails, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Check that a message that can't be "
+			  "given room on the connection drops the link.");
+}
+
+ATF_TC_BODY(failover_reserve_fails, tc)
+{
+	setup();
+
+	/* The connection is on its way down, so there's no room on it. */
+	conn->state = omapi_connection_disconnecting;
+	if (dhcp_failover_send_bind_update(state, leases[0]) == ISC_R_SUCCESS)
+		atf_tc_fail("BNDUPD sent on a closing connection");
+	if (conn->state != omapi_connection_closed)
+		atf_tc_fail("connection wasn't closed");
+}
+
+#endif /* FAILOVER_PROTOCOL */
+
+ATF_TP_ADD_TCS(tp)
+{
+#if defined (FAILOVER_PROTOCOL)
+	ATF_TP_ADD_TC(tp, failover_encoding);
+	ATF_TP_ADD_TC(tp, failover_reserve_fails);
+#endif
+
+	return (atf_no_error());
+}
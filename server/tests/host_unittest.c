@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Test finding hosts by hardware address, client identifier and
+ * host-identifier option, before and after some of them are deleted.
+ * Every host has all three keys, made from its number.
+ */
+
+static const char *conf_file = "host_test.conf";
+
+#define HOSTS	4000
+#define MISSES	10000
+
+static void
+setup(void)
+{
+	FILE *f;
+	int i;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	gettimeofday(&cur_tv, NULL);
+
+	f = fopen(conf_file, "w");
+	if (f == NULL)
+		atf_tc_fail("can't write %s", conf_file);
+	fprintf(f, "subnet 10.0.0.0 netmask 255.255.0.0 {\n}\n");
+	for (i = 1; i <= HOSTS; i++) {
+		fprintf(f, "host h%d {\n"
+			"  hardware ethernet 00:00:0b:00:%02x:%02x;\n"
+			"  option dhcp-client-identifier 01:00:00:0c:00:%02x:%02x;\n"
+			"  host-identifier option vendor-class-identifier \"%d\";\n"
+			"  fixed-address 10.0.%d.%d;\n"
+			"}\n", i, i >> 8, i & 255, i >> 8, i & 255, i,
+			i >> 8, i & 255);
+	}
+	if (fclose(f) != 0)
+		atf_tc_fail("can't write %s", conf_file);
+
+	root_group_setup();
+	path_dhcpd_conf = conf_file;
+	if (readconf() != ISC_R_SUCCESS)
+		atf_tc_fail("can't read the config file");
+}
+
+static int
+by_haddr(struct host_decl **hp, int i)
+{
+	unsigned char haddr[6] = { 0, 0, 11, 0, i >> 8, i & 255 };
+
+	return find_hosts_by_haddr(hp, HTYPE_ETHER, haddr, 6, MDL);
+}
+
+static int
+by_uid(struct host_decl **hp, int i)
+{
+	unsigned char uid[7] = { 1, 0, 0, 12, 0, i >> 8, i & 255 };
+
+	return find_hosts_by_uid(hp, uid, 7, MDL);
+}
+
+static int
+by_option(struct host_decl **hp, int i)
+{
+	struct packet *packet = NULL;
+	char vci[16];
+	int found;
+
+	if (!packet_allocate(&packet, MDL) ||
+	    !option_state_allocate(&packet->options, MDL))
+		atf_tc_fail("can't allocate a packet");
+	snprintf(vci, sizeof(vci), "%d", i);
+	if (!add_option(packet->options, DHO_VENDOR_CLASS_IDENTIFIER,
+			vci, strlen(vci)))
+		atf_tc_fail("can't add the option");
+	found = find_hosts_by_option(hp, packet, packet->options, MDL);
+	packet_dereference(&packet, MDL);
+	return found;
+}
+
+/* Check that host i is found, or not, by each of its keys.  Deleting
+   a host doesn't take its host-identifier out of the option's hash, so
+   a deleted host is only looked for by the other two. */
+static void
+check_host(int i, int present)
+{
+	struct host_decl *hp = NULL;
+	char name[16];
+	int (*find[])(struct host_decl **, int) =
+		{ by_haddr, by_uid, by_option };
+	unsigned j;
+
+	snprintf(name, sizeof(name), "h%d", i);
+	for (j = 0; j < (present ? 3 : 2); j++) {
+		if (!(*find[j])(&hp, i)) {
+			if (present)
+				atf_tc_fail("%s not found by key %u", name, j);
+			continue;
+		}
+		if (!present)
+			atf_tc_fail("deleted %s found by key %u", name, j);
+		if (strcmp(hp->name, name))
+			atf_tc_fail("%s found %s by key %u", name, hp->name, j);
+		host_dereference(&hp, MDL);
+	}
+}
+
+ATF_TC(host_lookup);
+ATF_TC_HEAD(host_lookup, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Hosts are found by each of their "
+			  "keys until they are deleted");
+}
+
+ATF_TC_BODY(host_lookup, tc)
+{
+	struct host_decl *hp = NULL;
+	unsigned char uid[7] = { 1, 0, 0, 11, 0, 0, 1 };
+	int i;
+
+	setup();
+	for (i = 1; i <= HOSTS; i++)
+		check_host(i, 1);
+	for (i = HOSTS + 1; i <= HOSTS + 100; i++)
+		check_host(i, 0);
+
+	/* The key h1 is found by as a hardware address isn't a uid. */
+	if (find_hosts_by_uid(&hp, uid, 7, MDL))
+		atf_tc_fail("hardware address found as a uid");
+
+	/* Delete every other host, which is enough to make the lookups
+	   rebuild what they know. */
+	for (i = 1; i <= HOSTS; i += 2) {
+		if (!by_haddr(&hp, i) || (delete_host(hp, 0) != ISC_R_SUCCESS))
+			atf_tc_fail("can't delete h%d", i);
+		host_dereference(&hp, MDL);
+	}
+	for (i = 1; i <= HOSTS; i++)
+		check_host(i, i & 1 ? 0 : 1);
+
+	/* Keys added afterwards are found straight away. */
+	uid[0] = 255;
+	if (!by_haddr(&hp, 2))
+		atf_tc_fail("h2 went missing");
+	change_host_uid(hp, (char *)uid, 7);
+	host_dereference(&hp, MDL);
+	if (!find_hosts_by_uid(&hp, uid, 7, MDL) || strcmp(hp->name, "h2"))
+		atf_tc_fail("h2 not found by its new uid");
+	host_dereference(&hp, MDL);
+}
+
+ATF_TC(host_lookup_misses);
+ATF_TC_HEAD(host_lookup_misses, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Clients without a reservation "
+			  "aren't found");
+}
+
+ATF_TC_BODY(host_lookup_misses, tc)
+{
+	struct host_decl *hp = NULL;
+	unsigned char haddr[6] = { 0, 0, 12, 0, 0, 0 };
+	int i;
+
+	setup();
+	for (i = 0; i < MISSES; i++) {
+		haddr[3] = i >> 16;
+		haddr[4] = i >> 8;
+		haddr[5] = i;
+		if (find_hosts_by_haddr(&hp, HTYPE_ETHER, haddr, 6, MDL) ||
+		    find_hosts_by_uid(&hp, haddr, 6, MDL))
+			atf_tc_fail("found a host that isn't there");
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, host_lookup);
+	ATF_TP_ADD_TC(tp, host_lookup_misses);
+	return (atf_no_error());
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Test reading a lease file on several threads.  The lease file has two
+ * declarations for each address in a /16, the second one replacing the
+ * first, a few leases only the serial parser can read and a last word on
+ * one address at the end.  It's read with different numbers of threads,
+ * and every lease is checked each time.  dhcpd_bench times the reads.
+ */
+
+static const char *conf_file = "leaseload_test.conf";
+static const char *lease_file = "leaseload_test.leases";
+
+#define LEASES	65534
+#define BASE	1600000000
+
+static void
+write_file(const char *name, const char *text)
+{
+	FILE *f;
+
+	f = fopen(name, "w");
+	if ((f == NULL) || (fputs(text, f) == EOF) || (fclose(f) != 0))
+		atf_tc_fail("can't write %s", name);
+}
+
+static void
+write_lease_file(void)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(lease_file, "w");
+	if (f == NULL)
+		atf_tc_fail("can't write %s", lease_file);
+	fprintf(f, "# test lease file\nauthoring-byte-order little-endian;\n\n");
+
+	for (i = 1; i <= LEASES; i++) {
+		fprintf(f, "lease 10.0.%d.%d {\n"
+			"  starts epoch %d;\n"
+			"  ends epoch %d;\n"
+			"  binding state free;\n"
+			"}\n", i >> 8, i & 255, BASE, BASE);
+	}
+
+	for (i = 1; i <= LEASES; i++) {
+		fprintf(f, "lease 10.0.%d.%d {\n"
+			"  starts epoch %d;\n"
+			"  ends epoch %d;\n"
+			"  cltt epoch %d;\n"
+			"  binding state active;\n"
+			"  next binding state free;\n"
+			"  rewind binding state free;\n"
+			"  hardware ethernet 00:00:0a:00:%02x:%02x;\n",
+			i >> 8, i & 255, BASE, BASE + i, BASE,
+			i >> 8, i & 255);
+		if (i & 1)
+			fprintf(f, "  uid \"\\001\\000\\000\\012\\000\\%03o\\%03o\";\n",
+				i >> 8, i & 255);
+		else
+			fprintf(f, "  uid 01:00:00:0a:00:%02x:%02x;\n",
+				i >> 8, i & 255);
+		fprintf(f, "  set vendor-class-identifier = \"class-%d\";\n"
+			"  client-hostname \"host-%d\";\n", i, i);
+		if ((i % 1000) == 0)
+			fprintf(f, "  on expiry {\n"
+				"    log (info, \"expired\");\n"
+				"  }\n");
+		fprintf(f, "}\n");
+	}
+
+	fprintf(f, "lease 10.0.0.1 {\n"
+		"  starts epoch %d;\n"
+		"  ends epoch %d;\n"
+		"  binding state backup;\n"
+		"}\n", BASE, BASE);
+	if (fclose(f) != 0)
+		atf_tc_fail("can't write %s", lease_file);
+}
+
+static void
+setup(void)
+{
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	gettimeofday(&cur_tv, NULL);
+
+	root_group_setup();
+	write_file(conf_file, "subnet 10.0.0.0 netmask 255.255.0.0 {\n"
+		   "  range 10.0.0.1 10.0.255.254;\n"
+		   "}\n");
+	path_dhcpd_conf = conf_file;
+	if (readconf() != ISC_R_SUCCESS)
+		atf_tc_fail("can't read the config file");
+	write_lease_file();
+}
+
+static void
+check_lease(int i)
+{
+	struct lease *lp = NULL;
+	struct binding *binding;
+	struct iaddr addr;
+	char name[32];
+
+	addr.len = 4;
+	addr.iabuf[0] = 10;
+	addr.iabuf[1] = 0;
+	addr.iabuf[2] = i >> 8;
+	addr.iabuf[3] = i & 255;
+	if (!find_lease_by_ip_addr(&lp, addr, MDL))
+		atf_tc_fail("no lease for %s", piaddr(addr));
+
+	if (i == 1) {
+		if ((lp->binding_state != FTS_BACKUP) ||
+		    (lp->next_binding_state != FTS_BACKUP) ||
+		    (lp->hardware_addr.hlen != 0))
+			atf_tc_fail("last lease for %s didn't win",
+				    piaddr(addr));
+		lease_dereference(&lp, MDL);
+		return;
+	}
+
+	if ((lp->binding_state != FTS_ACTIVE) ||
+	    (lp->next_binding_state != FTS_FREE) ||
+	    (lp->rewind_binding_state != FTS_FREE))
+		atf_tc_fail("%s has the wrong states", piaddr(addr));
+	if ((lp->starts != BASE) || (lp->ends != BASE + i) ||
+	    (lp->tstp != lp->ends) || (lp->cltt != BASE))
+		atf_tc_fail("%s has the wrong times", piaddr(addr));
+	if ((lp->hardware_addr.hlen != 7) ||
+	    (lp->hardware_addr.hbuf[0] != HTYPE_ETHER) ||
+	    (lp->hardware_addr.hbuf[5] != (i >> 8)) ||
+	    (lp->hardware_addr.hbuf[6] != (i & 255)))
+		atf_tc_fail("%s has the wrong hardware address", piaddr(addr));
+	if ((lp->uid_len != 7) || (lp->uid[0] != 1) ||
+	    (lp->uid[5] != (i >> 8)) || (lp->uid[6] != (i & 255)))
+		atf_tc_fail("%s has the wrong uid", piaddr(addr));
+
+	snprintf(name, sizeof(name), "host-%d", i);
+	if ((lp->client_hostname == NULL) ||
+	    strcmp(lp->client_hostname, name))
+		atf_tc_fail("%s has the wrong client hostname", piaddr(addr));
+	snprintf(name, sizeof(name), "class-%d", i);
+	binding = NULL;
+	if (lp->scope)
+		binding = find_binding(lp->scope, "vendor-class-identifier");
+	if ((binding == NULL) || (binding->value == NULL) ||
+	    (binding->value->type != binding_data) ||
+	    (binding->value->value.data.len != strlen(name)) ||
+	    memcmp(binding->value->value.data.data, name, strlen(name)))
+		atf_tc_fail("%s has the wrong binding", piaddr(addr));
+
+	if (((i % 1000) == 0) != (lp->on_star.on_expiry != NULL))
+		atf_tc_fail("%s has the wrong on expiry", piaddr(addr));
+	lease_dereference(&lp, MDL);
+}
+
+ATF_TC(lease_load_threads);
+ATF_TC_HEAD(lease_load_threads, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The lease file reads the same on "
+			  "any number of threads");
+}
+
+ATF_TC_BODY(lease_load_threads, tc)
+{
+	static int threads[] = { 1, 2, 4, 8 };
+	unsigned i;
+	int j;
+
+	setup();
+#if !defined (PARALLEL_LEASE_LOAD)
+	printf("built without --enable-parallel-lease-load, "
+	       "all reads are serial\n");
+#endif
+
+	/* Reading the file again replaces each lease in the hash, so every
+	   read has to get it all right.  The file says its byte order, which
+	   may only be said before any lease has been read. */
+	for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		lease_load_threads = threads[i];
+		authoring_byte_order = 0;
+		if (read_conf_file(lease_file, root_group, ROOT_GROUP, 1) !=
+		    ISC_R_SUCCESS)
+			atf_tc_fail("can't read the lease file on %d threads",
+				    threads[i]);
+
+		for (j = 1; j <= LEASES; j++)
+			check_lease(j);
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, lease_load_threads);
+	return (atf_no_error());
+}
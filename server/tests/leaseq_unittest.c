@@ -355,10 +355,9 @@ ATF_TC_BODY(leaseq_cycle, tc)
 		atf_tc_fail("leases don't match, 9");
 }
 
-/* Test what happens if we set the growth factor to a smallish number
- * and add enough leases to require it to grow multiple times
- * Mostly this is for the binary leases case but we can most of the
- * test for both.
+/* Test what happens if we add and remove enough leases to reshape
+ * the queue several times.  Mostly this is for the binary leases case
+ * but we can use the test for both.
  */
 
 ATF_TC(leaseq_long);
@@ -374,9 +373,6 @@ ATF_TC_BODY(leaseq_long, tc)
 	int i;
 
 	INIT_LQ(lq);
-#if defined (BINARY_LEASES)
-	lc_init_growth(&lq, 5);
-#endif
 
 	/* create and add 10 leases */
 	for (i = 0; i < 10; i++) {
@@ -490,6 +486,75 @@ ATF_TC_BODY(leaseq_same_time, tc)
 
 }
 
+/* Fill growing queues with leases in random order and then move leases
+ * around in them the way lease state changes do, removing them and
+ * re-inserting them with a new sort time, and check the final ordering.
+ * dhcpd_bench times the queue operations.
+ */
+ATF_TC(leaseq_scale);
+ATF_TC_HEAD(leaseq_scale, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Large queues stay in order");
+}
+
+ATF_TC_BODY(leaseq_scale, tc)
+{
+#if defined (BINARY_LEASES)
+	static const int sizes[] = { 10000, 40000, 160000 };
+#else
+	/* insertion is a linear walk, keep it reasonable */
+	static const int sizes[] = { 1000, 2000, 4000 };
+#endif
+	LEASE_STRUCT lq;
+	struct lease *leases, *check_lease, *prev_lease;
+	int i, n, count, s;
+
+	srandom(1);
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		n = sizes[s];
+		leases = calloc(n, sizeof(struct lease));
+		if (leases == NULL)
+			atf_tc_fail("unable to allocate %d leases", n);
+		INIT_LQ(lq);
+
+		for (i = 0; i < n; i++) {
+			leases[i].sort_time = random() % (n * 4);
+			check_lease = NULL;
+			lease_reference(&check_lease, &leases[i], MDL);
+			LEASE_INSERTP(&lq, &leases[i]);
+		}
+
+		for (i = 0; i < n; i++) {
+			check_lease = &leases[random() % n];
+			LEASE_REMOVEP(&lq, check_lease);
+			check_lease->sort_time = random() % (n * 4);
+			LEASE_INSERTP(&lq, check_lease);
+		}
+
+		/* check ordering of leases */
+		count = 0;
+		prev_lease = NULL;
+		for (check_lease = LEASE_GET_FIRST(lq);
+		     check_lease != NULL;
+		     check_lease = LEASE_GET_NEXT(lq, check_lease)) {
+			if ((prev_lease != NULL) &&
+			    (prev_lease->sort_time > check_lease->sort_time))
+				atf_tc_fail("leases out of order at %d", count);
+			prev_lease = check_lease;
+			count++;
+		}
+		if (count != n)
+			atf_tc_fail("found %d leases, expected %d", count, n);
+
+		for (i = 0; i < n; i++) {
+			LEASE_REMOVEP(&lq, &leases[i]);
+		}
+		if (LEASE_NOT_EMPTY(lq))
+			atf_tc_fail("queue not empty");
+		free(leases);
+	}
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, leaseq_basic);
@@ -499,5 +564,6 @@ ATF_TP_ADD_TCS(tp)
 	ATF_TP_ADD_TC(tp, leaseq_cycle);
 	ATF_TP_ADD_TC(tp, leaseq_long);
 	ATF_TP_ADD_TC(tp, leaseq_same_time);
+	ATF_TP_ADD_TC(tp, leaseq_scale);
 	return (atf_no_error());
 }
@@ -17,6 +17,7 @@
 #include <config.h>
 
 #include "dhcpd.h"
+#include <sys/time.h>
 
 #include <atf-c.h>
 
@@ -185,11 +186,97 @@ ATF_TC_BODY(load_balance_swap, tc)
 #endif
 }
 
+ATF_TC(pool_balance_queue);
+
+ATF_TC_HEAD(pool_balance_queue, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that only "
+			  "pools that are out of balance are queued for "
+			  "pool balancing.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+static struct pool *
+balance_pool(dhcp_failover_state_t *state, int free, int backup)
+{
+	struct pool *pool = NULL;
+
+	if (pool_allocate(&pool, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate a pool");
+	pool->failover_peer = state;
+	pool->free_leases = free;
+	pool->backup_leases = backup;
+	return (pool);
+}
+#endif
+
+ATF_TC_BODY(pool_balance_queue, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	struct pool *even, *over, *under, *within;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	gettimeofday(&cur_tv, NULL);
+
+	memset(&state, 0, sizeof(state));
+	state.i_am = primary;
+	state.me.state = normal;
+	state.max_lease_misbalance = 15;
+	state.max_lease_ownership = 10;
+
+	even = balance_pool(&state, 100, 100);
+	over = balance_pool(&state, 200, 0);	/* 100 to send, 30 allowed */
+	under = balance_pool(&state, 0, 100);	/* 50 short, panic at 30 */
+	within = balance_pool(&state, 120, 80);	/* 20 to send, 30 allowed */
+
+	dhcp_failover_pool_track(even);
+	dhcp_failover_pool_track(over);
+	dhcp_failover_pool_track(under);
+	dhcp_failover_pool_track(within);
+	dhcp_failover_pool_track(over);
+
+	if (state.balance_pending != 2)
+		atf_tc_fail("%d pools queued, expected 2",
+			    state.balance_pending);
+	if ((state.balance_head != over) || (over->balance_next != under) ||
+	    (state.balance_tail != under) || (under->balance_next != NULL))
+		atf_tc_fail("the queue isn't over, under");
+	if (even->balance_queued || within->balance_queued)
+		atf_tc_fail("a pool in balance is queued");
+
+	/* Leaving the normal state drops the queue at the next run. */
+	state.me.state = communications_interrupted;
+	dhcp_failover_pool_track(within);
+	within->free_leases = 200;
+	within->backup_leases = 0;
+	dhcp_failover_pool_track(within);
+	dhcp_failover_pool_rebalance(&state);
+	if (state.balance_head || state.balance_tail ||
+	    state.balance_pending || over->balance_queued ||
+	    under->balance_queued || within->balance_queued)
+		atf_tc_fail("the queue wasn't dropped");
+
+	even->failover_peer = over->failover_peer = NULL;
+	under->failover_peer = within->failover_peer = NULL;
+	pool_dereference(&even, MDL);
+	pool_dereference(&over, MDL);
+	pool_dereference(&under, MDL);
+	pool_dereference(&within, MDL);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
 
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, load_balance);
 	ATF_TP_ADD_TC(tp, load_balance_swap);
+	ATF_TP_ADD_TC(tp, pool_balance_queue);
 
 	return (atf_no_error());
 }
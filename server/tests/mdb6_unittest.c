@@ -955,6 +955,121 @@ ATF_TC_BODY(many_pools, tc)
     }
 }
 
+/*
+ * IA table lookups the way the server makes them for each IA in a
+ * SOLICIT (a miss for a new client), a REQUEST (the new IA is added)
+ * and a RENEW (the IA is found and replaced with a new one), for enough
+ * IAs that the table grows a few times.  dhcpd_bench times them.
+ */
+
+#define IA_TABLE_COUNT 20000
+
+static void
+ia_table_duid(unsigned char *duid, int i)
+{
+    /* DUID-LLT with an Ethernet address */
+    static const unsigned char llt[8] = { 0, 1, 0, 1, 0x2a, 0x6b, 0x1c, 0x5e };
+
+    memcpy(duid, llt, sizeof(llt));
+    duid[8] = 0x00;
+    duid[9] = 0x16;
+    duid[10] = 0x3e;
+    duid[11] = i >> 16;
+    duid[12] = i >> 8;
+    duid[13] = i;
+}
+
+ATF_TC(ia_table);
+ATF_TC_HEAD(ia_table, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "This test case checks IA table "
+                      "lookups for SOLICIT, REQUEST and RENEW.");
+}
+ATF_TC_BODY(ia_table, tc)
+{
+    ia_hash_t *table = NULL;
+    struct ia_xx *ia, *old;
+    struct ia_key key;
+    unsigned char duid[14];
+    int count, i, renewed;
+
+    dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			NULL, NULL);
+
+    count = IA_TABLE_COUNT;
+    if (!ia_new_hash(&table, DEFAULT_HASH_SIZE, MDL)) {
+        atf_tc_fail("ERROR: ia_new_hash() %s:%d", MDL);
+    }
+
+    /* SOLICIT: nobody has an IA yet. */
+    for (i = 0; i < count; i++) {
+        ia_table_duid(duid, i);
+        ia_key_init(&key, 1, (char *)duid, sizeof(duid));
+        ia = NULL;
+        if (ia_key_lookup(&ia, table, &key, MDL)) {
+            atf_tc_fail("ERROR: found IA %d before it was added", i);
+        }
+    }
+
+    /* REQUEST: each client gets an IA. */
+    for (i = 0; i < count; i++) {
+        ia_table_duid(duid, i);
+        ia = NULL;
+        if (ia_allocate(&ia, 1, (char *)duid, sizeof(duid),
+                        MDL) != ISC_R_SUCCESS) {
+            atf_tc_fail("ERROR: ia_allocate() %s:%d", MDL);
+        }
+        ia_hash_add(table, ia, MDL);
+        ia_dereference(&ia, MDL);
+    }
+
+    /* RENEW: find the IA and replace it with the new one. */
+    for (i = 0; i < count; i++) {
+        ia_table_duid(duid, i);
+        ia = NULL;
+        if (ia_allocate(&ia, 1, (char *)duid, sizeof(duid),
+                        MDL) != ISC_R_SUCCESS) {
+            atf_tc_fail("ERROR: ia_allocate() %s:%d", MDL);
+        }
+        old = NULL;
+        if (!ia_hash_lookup(&old, table, ia->iaid_duid.data,
+                            ia->iaid_duid.len, MDL)) {
+            atf_tc_fail("ERROR: IA %d not found", i);
+        }
+        ia_hash_remove(table, old, MDL);
+        ia_dereference(&old, MDL);
+        ia->cltt = 1;
+        ia_hash_add(table, ia, MDL);
+        ia_dereference(&ia, MDL);
+    }
+
+    /* Every IA is there once, and it's the renewed one. */
+    if (table->count != count) {
+        atf_tc_fail("ERROR: %u IAs in the table, not %d", table->count,
+                    count);
+    }
+    renewed = 0;
+    for (i = 0; i < count; i++) {
+        ia_table_duid(duid, i);
+        ia_key_init(&key, 1, (char *)duid, sizeof(duid));
+        ia = NULL;
+        if (ia_key_lookup(&ia, table, &key, MDL)) {
+            renewed += ia->cltt;
+            ia_dereference(&ia, MDL);
+        }
+        /* A different IAID is a different IA. */
+        ia_key_init(&key, 2, (char *)duid, sizeof(duid));
+        if (ia_key_lookup(&ia, table, &key, MDL)) {
+            atf_tc_fail("ERROR: IA %d found with the wrong IAID", i);
+        }
+    }
+    if (renewed != count) {
+        atf_tc_fail("ERROR: %d of %d IAs renewed", renewed, count);
+    }
+
+    ia_free_hash_table(&table, MDL);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
     ATF_TP_ADD_TC(tp, iaaddr_basic);
@@ -968,6 +1083,7 @@ ATF_TP_ADD_TCS(tp)
     ATF_TP_ADD_TC(tp, expire_order_reduce);
     ATF_TP_ADD_TC(tp, small_pool);
     ATF_TP_ADD_TC(tp, many_pools);
+    ATF_TP_ADD_TC(tp, ia_table);
 
     return (atf_no_error());
 }
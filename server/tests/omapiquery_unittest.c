@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+
+#include <stdio.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include <atf-c.h>
+
+/*
+ * Check that the OMAPI query thread answers the way the main thread's
+ * lookups do.  Each query is put to dhcp_lease_lookup() or
+ * dhcp_host_lookup() and, over a connection to the query port, to the
+ * thread; the thread must send the record omapi_record_lease() or
+ * omapi_record_host() makes of the object the lookup found, or the
+ * status the lookup returned.  This is checked after startup, after
+ * leases are superseded, after a host is deleted and after a reload.
+ */
+
+#if defined (OMAPI_QUERY_THREAD)
+
+static const char *conf_file = "omapiquery_test.conf";
+static int query_fd = -1;
+static u_int32_t query_id = 1;
+
+/* A lookup key: a value name and its data. */
+struct key {
+	const char *name;
+	const void *data;
+	unsigned len;
+};
+
+#define KEYS_END	{ NULL, NULL, 0 }
+
+static const unsigned char hw1[] = { 0, 0, 0, 0, 0, 1 };
+static const unsigned char hw2[] = { 0, 0, 0, 0, 0, 2 };
+static const unsigned char hw3[] = { 0, 0, 0, 0, 0, 3 };
+static const unsigned char hw4[] = { 0, 0, 0, 0, 0, 4 };
+static const unsigned char ether[] = { 0, 0, 0, HTYPE_ETHER };
+
+static struct iaddr
+make_addr(const char *str)
+{
+	struct iaddr addr;
+
+	addr.len = 4;
+	if (inet_pton(AF_INET, str, addr.iabuf) != 1)
+		atf_tc_fail("bad address %s", str);
+	return addr;
+}
+
+static void
+write_conf(const char *conf)
+{
+	FILE *f;
+
+	f = fopen(conf_file, "w");
+	if ((f == NULL) || (fputs(conf, f) == EOF) || (fclose(f) != 0))
+		atf_tc_fail("can't write %s", conf_file);
+	path_dhcpd_conf = conf_file;
+}
+
+/* Give the lease on an address a client, the way a DHCPACK would:
+   through supersede_lease(). */
+static void
+activate(const char *str, const unsigned char *hw, const char *uid)
+{
+	struct lease *lp = NULL, *lt = NULL;
+
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr(str), MDL))
+		atf_tc_fail("no lease for %s", str);
+	if (!lease_copy(&lt, lp, MDL))
+		atf_tc_fail("can't copy lease %s", str);
+	lt->binding_state = FTS_ACTIVE;
+	lt->next_binding_state = FTS_ACTIVE;
+	lt->starts = lt->cltt = cur_time;
+	lt->ends = cur_time + 3600;
+	lt->hardware_addr.hlen = 7;
+	lt->hardware_addr.hbuf[0] = HTYPE_ETHER;
+	memcpy(&lt->hardware_addr.hbuf[1], hw, 6);
+	if (lt->uid && lt->uid != lt->uid_buf)
+		dfree(lt->uid, MDL);
+	lt->uid = NULL;
+	lt->uid_len = 0;
+	if (uid != NULL) {
+		lt->uid = lt->uid_buf;
+		lt->uid_len = strlen(uid);
+		memcpy(lt->uid_buf, uid, lt->uid_len);
+	}
+	if (!supersede_lease(lp, lt, 0, 0, 0, 0))
+		atf_tc_fail("can't supersede lease %s", str);
+	lease_dereference(&lt, MDL);
+	lease_dereference(&lp, MDL);
+}
+
+static void
+setup(void)
+{
+	struct sockaddr_in sin;
+	socklen_t len;
+	unsigned char intro[8];
+	struct pollfd pfd;
+	unsigned got;
+	ssize_t n;
+	int fd;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	gettimeofday(&cur_tv, NULL);
+	cur_time = cur_tv.tv_sec;
+
+	root_group_setup();
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.0.10 10.0.0.20;\n"
+		   "}\n"
+		   "host one {\n"
+		   "	hardware ethernet 00:00:00:00:00:01;\n"
+		   "	fixed-address 10.0.0.201;\n"
+		   "}\n"
+		   "host two {\n"
+		   "	option dhcp-client-identifier \"two\";\n"
+		   "}\n"
+		   "host three {\n"
+		   "	hardware ethernet 00:00:00:00:00:03;\n"
+		   "}\n");
+	if (readconf() != ISC_R_SUCCESS)
+		atf_tc_fail("can't read the config file");
+	expire_all_pools();
+
+	activate("10.0.0.10", hw1, "one");
+	activate("10.0.0.11", hw2, NULL);
+	activate("10.0.0.12", hw2, "twelve");
+
+	/* Find a free port for the thread to listen on. */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	len = sizeof(sin);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ((fd < 0) ||
+	    (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+	    (getsockname(fd, (struct sockaddr *)&sin, &len) < 0))
+		atf_tc_fail("can't find a free port");
+	close(fd);
+	omapi_query_port = ntohs(sin.sin_port);
+
+	omapi_query_start();
+
+	query_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ((query_fd < 0) ||
+	    (connect(query_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0))
+		atf_tc_fail("can't connect to the query port");
+
+	/* Its introduction, then ours. */
+	for (got = 0; got < sizeof(intro); got += n) {
+		pfd.fd = query_fd;
+		pfd.events = POLLIN;
+		if ((poll(&pfd, 1, 5000) != 1) ||
+		    ((n = read(query_fd, intro + got,
+			       sizeof(intro) - got)) <= 0))
+			atf_tc_fail("no introduction from the query port");
+	}
+	if (getULong(intro) != OMAPI_PROTOCOL_VERSION)
+		atf_tc_fail("wrong protocol version %u", getULong(intro));
+	putULong(intro, OMAPI_PROTOCOL_VERSION);
+	putULong(intro + 4, 24);
+	if (write(query_fd, intro, sizeof(intro)) != sizeof(intro))
+		atf_tc_fail("can't introduce ourselves");
+}
+
+static void
+put_value(struct omapi_record *rec, const char *name,
+	  const void *data, unsigned len)
+{
+	if (!omapi_record_put(rec, name, data, len))
+		atf_tc_fail("query too long");
+}
+
+/* Skip over a list of values; return its length, or zero if it isn't
+   all there. */
+static unsigned
+values_len(const unsigned char *p, unsigned len)
+{
+	unsigned ofs = 0, nlen;
+
+	for (;;) {
+		if (len - ofs < 2)
+			return 0;
+		nlen = getUShort(p + ofs);
+		ofs += 2;
+		if (nlen == 0)
+			return ofs;
+		if (len - ofs < nlen + 4)
+			return 0;
+		ofs += nlen + 4 + getULong(p + ofs + nlen);
+		if (ofs > len)
+			return 0;
+	}
+}
+
+/* Ask the query thread for the object with the given keys.  Returns the
+   op of the answer, with the object's values in *values or the result
+   of a status in *result. */
+static u_int32_t
+ask(const char *type, const struct key *keys, unsigned char *buf,
+    unsigned max, const unsigned char **values, unsigned *values_lenp,
+    u_int32_t *result)
+{
+	unsigned char msg[1024];
+	struct omapi_record rec;
+	struct pollfd pfd;
+	unsigned got = 0, mlen, olen;
+	ssize_t n;
+
+	rec.buf = msg;
+	rec.max = sizeof(msg);
+	putULong(msg, 0);			/* authid */
+	putULong(msg + 4, 0);			/* authlen */
+	putULong(msg + 8, OMAPI_OP_OPEN);
+	putULong(msg + 12, 0);			/* handle */
+	putULong(msg + 16, query_id++);
+	putULong(msg + 20, 0);			/* rid */
+	rec.len = 24;
+	put_value(&rec, "type", type, strlen(type));
+	omapi_record_end(&rec);
+	for (; keys->name != NULL; keys++)
+		put_value(&rec, keys->name, keys->data, keys->len);
+	omapi_record_end(&rec);
+	if (write(query_fd, msg, rec.len) != rec.len)
+		atf_tc_fail("can't send a query");
+
+	for (;;) {
+		if ((got >= 24) &&
+		    ((mlen = values_len(buf + 24, got - 24)) != 0) &&
+		    ((olen = values_len(buf + 24 + mlen,
+					got - 24 - mlen)) != 0))
+			break;
+		if (got == max)
+			atf_tc_fail("answer too long");
+		pfd.fd = query_fd;
+		pfd.events = POLLIN;
+		if ((poll(&pfd, 1, 5000) != 1) ||
+		    ((n = read(query_fd, buf + got, max - got)) <= 0))
+			atf_tc_fail("no answer from the query port");
+		got += n;
+	}
+	if (got != 24 + mlen + olen)
+		atf_tc_fail("more than one answer");
+	if (getULong(buf + 20) != query_id - 1)
+		atf_tc_fail("answer to the wrong message");
+
+	*values = buf + 24 + mlen;
+	*values_lenp = olen;
+	*result = ISC_R_SUCCESS;
+	if (getULong(buf + 8) == OMAPI_OP_STATUS) {
+		/* The result is the first value of the message. */
+		if ((getUShort(buf + 24) != 6) ||
+		    memcmp(buf + 26, "result", 6) ||
+		    (getULong(buf + 32) != 4))
+			atf_tc_fail("status without a result");
+		*result = getULong(buf + 36);
+	}
+	return getULong(buf + 8);
+}
+
+/* Put the keys to the main thread's lookup and to the query thread, and
+   check that both find the same thing. */
+static void
+check(const char *type, const struct key *keys, isc_result_t want)
+{
+	omapi_object_t *ref = NULL, *found = NULL;
+	omapi_typed_data_t *td;
+	const struct key *k;
+	unsigned char buf[16384], rbuf[16384];
+	const unsigned char *values;
+	struct omapi_record rec;
+	unsigned values_len;
+	u_int32_t op, result;
+	isc_result_t status;
+	int is_lease = !strcmp(type, "lease");
+
+	if (omapi_generic_new(&ref, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't make a generic object");
+	for (k = keys; k->name != NULL; k++) {
+		td = NULL;
+		if ((omapi_typed_data_new(MDL, &td, omapi_datatype_data,
+					  k->len) != ISC_R_SUCCESS))
+			atf_tc_fail("can't make a value");
+		memcpy(td->u.buffer.value, k->data, k->len);
+		if (omapi_set_value_str(ref, NULL, k->name,
+					td) != ISC_R_SUCCESS)
+			atf_tc_fail("can't set %s", k->name);
+		omapi_typed_data_dereference(&td, MDL);
+	}
+	status = (is_lease ? dhcp_lease_lookup(&found, NULL, ref)
+		  : dhcp_host_lookup(&found, NULL, ref));
+	omapi_object_dereference(&ref, MDL);
+	if (status != want)
+		atf_tc_fail("%s lookup by %s: %s, expected %s", type,
+			    keys->name, isc_result_totext(status),
+			    isc_result_totext(want));
+
+	op = ask(type, keys, buf, sizeof(buf), &values, &values_len,
+		 &result);
+	if (status != ISC_R_SUCCESS) {
+		if ((op != OMAPI_OP_STATUS) || (result != status))
+			atf_tc_fail("%s query by %s: op %u result %s, "
+				    "expected %s", type, keys->name, op,
+				    isc_result_totext(result),
+				    isc_result_totext(status));
+		return;
+	}
+
+	rec.buf = rbuf;
+	rec.len = 0;
+	rec.max = sizeof(rbuf);
+	if ((is_lease
+	     ? omapi_record_lease(&rec, (struct lease *)found)
+	     : omapi_record_host(&rec, (struct host_decl *)found)) <= 0)
+		atf_tc_fail("can't encode the %s found", type);
+	omapi_object_dereference(&found, MDL);
+	if (op != OMAPI_OP_UPDATE)
+		atf_tc_fail("%s query by %s: result %s, expected an object",
+			    type, keys->name, isc_result_totext(result));
+	if ((values_len != rec.len) || memcmp(values, rbuf, rec.len))
+		atf_tc_fail("%s query by %s: the object is different",
+			    type, keys->name);
+}
+
+static void
+check_leases(void)
+{
+	static const unsigned char addr10[] = { 10, 0, 0, 10 };
+	static const unsigned char addr11[] = { 10, 0, 0, 11 };
+	static const unsigned char addr15[] = { 10, 0, 0, 15 };
+	static const unsigned char addr99[] = { 10, 0, 0, 99 };
+	const struct key by_addr10[] = {
+		{ "ip-address", addr10, 4 }, KEYS_END };
+	const struct key by_addr15[] = {
+		{ "ip-address", addr15, 4 }, KEYS_END };
+	const struct key by_addr99[] = {
+		{ "ip-address", addr99, 4 }, KEYS_END };
+	const struct key by_uid[] = {
+		{ "dhcp-client-identifier", "one", 3 }, KEYS_END };
+	const struct key by_hw1[] = {
+		{ "hardware-address", hw1, 6 },
+		{ "hardware-type", ether, 4 }, KEYS_END };
+	const struct key by_hw2[] = {
+		{ "hardware-address", hw2, 6 }, KEYS_END };
+	const struct key conflict[] = {
+		{ "ip-address", addr11, 4 },
+		{ "dhcp-client-identifier", "one", 3 }, KEYS_END };
+
+	check("lease", by_addr10, ISC_R_SUCCESS);
+	check("lease", by_addr15, ISC_R_SUCCESS);
+	check("lease", by_addr99, ISC_R_NOTFOUND);
+	check("lease", by_uid, ISC_R_SUCCESS);
+	check("lease", by_hw1, ISC_R_SUCCESS);
+	check("lease", by_hw2, DHCP_R_MULTIPLE);
+	check("lease", conflict, DHCP_R_KEYCONFLICT);
+}
+
+ATF_TC(query_startup);
+ATF_TC_HEAD(query_startup, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The query thread finds what the "
+			  "lookups find after startup");
+}
+
+ATF_TC_BODY(query_startup, tc)
+{
+	static const unsigned char addr10[] = { 10, 0, 0, 10 };
+	const struct key by_name[] = { { "name", "one", 3 }, KEYS_END };
+	const struct key by_nobody[] = { { "name", "four", 4 }, KEYS_END };
+	const struct key by_uid[] = {
+		{ "dhcp-client-identifier", "two", 3 }, KEYS_END };
+	const struct key by_hw3[] = {
+		{ "hardware-address", hw3, 6 }, KEYS_END };
+	const struct key by_lease[] = {
+		{ "ip-address", addr10, 4 }, KEYS_END };
+	const struct key none[] = { KEYS_END };
+
+	setup();
+	check_leases();
+	check("lease", none, DHCP_R_NOKEYS);
+
+	check("host", by_name, ISC_R_SUCCESS);
+	check("host", by_nobody, ISC_R_NOTFOUND);
+	check("host", by_uid, ISC_R_SUCCESS);
+	check("host", by_hw3, ISC_R_SUCCESS);
+	check("host", by_lease, ISC_R_SUCCESS);
+}
+
+ATF_TC(query_supersede);
+ATF_TC_HEAD(query_supersede, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The query thread follows leases "
+			  "superseded on the main thread");
+}
+
+ATF_TC_BODY(query_supersede, tc)
+{
+	static const unsigned char addr12[] = { 10, 0, 0, 12 };
+	static const unsigned char addr15[] = { 10, 0, 0, 15 };
+	const struct key by_addr12[] = {
+		{ "ip-address", addr12, 4 }, KEYS_END };
+	const struct key by_addr15[] = {
+		{ "ip-address", addr15, 4 }, KEYS_END };
+	const struct key by_hw2[] = {
+		{ "hardware-address", hw2, 6 }, KEYS_END };
+	const struct key by_hw3[] = {
+		{ "hardware-address", hw3, 6 }, KEYS_END };
+	const struct key by_uid[] = {
+		{ "dhcp-client-identifier", "twelve", 6 }, KEYS_END };
+	const struct key by_new_uid[] = {
+		{ "dhcp-client-identifier", "fifteen", 7 }, KEYS_END };
+
+	setup();
+	check("lease", by_hw2, DHCP_R_MULTIPLE);
+
+	/* Move 10.0.0.12 to another client, and give 10.0.0.15 one. */
+	activate("10.0.0.12", hw3, NULL);
+	activate("10.0.0.15", hw4, "fifteen");
+
+	check("lease", by_addr12, ISC_R_SUCCESS);
+	check("lease", by_addr15, ISC_R_SUCCESS);
+	check("lease", by_hw2, ISC_R_SUCCESS);
+	check("lease", by_hw3, ISC_R_SUCCESS);
+	check("lease", by_uid, ISC_R_NOTFOUND);
+	check("lease", by_new_uid, ISC_R_SUCCESS);
+}
+
+ATF_TC(query_delete_host);
+ATF_TC_HEAD(query_delete_host, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The query thread forgets hosts "
+			  "deleted on the main thread");
+}
+
+ATF_TC_BODY(query_delete_host, tc)
+{
+	struct host_decl *hd = NULL;
+	const struct key by_name[] = { { "name", "two", 3 }, KEYS_END };
+	const struct key by_uid[] = {
+		{ "dhcp-client-identifier", "two", 3 }, KEYS_END };
+	const struct key by_other[] = { { "name", "three", 5 }, KEYS_END };
+
+	setup();
+
+	if (!host_hash_lookup(&hd, host_name_hash,
+			      (const unsigned char *)"two", 3, MDL))
+		atf_tc_fail("no host two");
+	if (delete_host(hd, 0) != ISC_R_SUCCESS)
+		atf_tc_fail("can't delete host two");
+	host_dereference(&hd, MDL);
+
+	check("host", by_name, ISC_R_NOTFOUND);
+	check("host", by_uid, ISC_R_NOTFOUND);
+	check("host", by_other, ISC_R_SUCCESS);
+}
+
+ATF_TC(query_resync);
+ATF_TC_HEAD(query_resync, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The query thread has the leases "
+			  "and hosts of a reloaded config");
+}
+
+ATF_TC_BODY(query_resync, tc)
+{
+	static const unsigned char addr15[] = { 10, 0, 0, 15 };
+	static const unsigned char addr25[] = { 10, 0, 0, 25 };
+	const struct key by_addr15[] = {
+		{ "ip-address", addr15, 4 }, KEYS_END };
+	const struct key by_addr25[] = {
+		{ "ip-address", addr25, 4 }, KEYS_END };
+	const struct key by_one[] = { { "name", "one", 3 }, KEYS_END };
+	const struct key by_two[] = { { "name", "two", 3 }, KEYS_END };
+	const struct key by_four[] = { { "name", "four", 4 }, KEYS_END };
+
+	setup();
+
+	/* 10.0.0.15 goes and 10.0.0.25 comes; host two goes, and host
+	   four comes. */
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.0.10 10.0.0.12;\n"
+		   "	range 10.0.0.21 10.0.0.30;\n"
+		   "}\n"
+		   "host one {\n"
+		   "	hardware ethernet 00:00:00:00:00:01;\n"
+		   "	fixed-address 10.0.0.202;\n"
+		   "}\n"
+		   "host four {\n"
+		   "	hardware ethernet 00:00:00:00:00:04;\n"
+		   "}\n");
+	if (reload_config_apply() != ISC_R_SUCCESS)
+		atf_tc_fail("reload failed");
+
+	check("lease", by_addr15, ISC_R_NOTFOUND);
+	check("lease", by_addr25, ISC_R_SUCCESS);
+	check("host", by_one, ISC_R_SUCCESS);
+	check("host", by_two, ISC_R_NOTFOUND);
+	check("host", by_four, ISC_R_SUCCESS);
+}
+
+#endif /* OMAPI_QUERY_THREAD */
+
+ATF_TP_ADD_TCS(tp)
+{
+#if defined (OMAPI_QUERY_THREAD)
+	ATF_TP_ADD_TC(tp, query_startup);
+	ATF_TP_ADD_TC(tp, query_supersede);
+	ATF_TP_ADD_TC(tp, query_delete_host);
+	ATF_TP_ADD_TC(tp, query_resync);
+#endif
+
+	return (atf_no_error());
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atf-c.h>
+
+/*
+ * Test ping checks of leases being offered for the first time, with
+ * ping-cache-secs set.  The address is from TEST-NET-1 so nothing
+ * answers, whether or not the test may open an ICMP socket.
+ */
+
+static const char *conf_file = "ping_test.conf";
+
+static struct option_state *options;
+static struct packet *packet;
+
+static void
+setup(void)
+{
+	struct binding_scope *scope = NULL;
+	FILE *f;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	gettimeofday(&cur_tv, NULL);
+	cur_time = cur_tv.tv_sec;
+
+	f = fopen(conf_file, "w");
+	if ((f == NULL) ||
+	    (fputs("ping-check true;\n"
+		   "ping-timeout 1;\n"
+		   "ping-cache-secs 60;\n"
+		   "subnet 192.0.2.0 netmask 255.255.255.0 {\n}\n",
+		   f) == EOF) ||
+	    (fclose(f) != 0))
+		atf_tc_fail("can't write %s", conf_file);
+
+	root_group_setup();
+	path_dhcpd_conf = conf_file;
+	if (readconf() != ISC_R_SUCCESS)
+		atf_tc_fail("can't read the config file");
+	icmp_startup(1, lease_pinged);
+
+	/* The options a lease state would have for an offer. */
+	if (!option_state_allocate(&options, MDL) ||
+	    !packet_allocate(&packet, MDL) ||
+	    !option_state_allocate(&packet->options, MDL))
+		atf_tc_fail("can't allocate the options");
+	execute_statements_in_scope(NULL, packet, NULL, NULL, packet->options,
+				    options, &scope, root_group, NULL, NULL);
+}
+
+static struct lease *
+make_lease(const char *str)
+{
+	struct lease *lease = NULL;
+
+	if (lease_allocate(&lease, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("can't allocate a lease");
+	lease->ip_addr.len = 4;
+	if (inet_pton(AF_INET, str, lease->ip_addr.iabuf) != 1)
+		atf_tc_fail("bad address %s", str);
+	lease->binding_state = FTS_FREE;
+	return lease;
+}
+
+/* Leave junk where do_ping_check()'s locals will be, so that one used
+   without being set up doesn't happen to look empty. */
+static void __attribute__((noinline))
+scribble(void)
+{
+	volatile unsigned char junk[8192];
+	unsigned i;
+
+	for (i = 0; i < sizeof(junk); i++)
+		junk[i] = 0xa5;
+}
+
+/* Run a ping check of a lease being offered for the first time.  The
+   allocation routines complain about a data string that isn't empty
+   rather than failing, so anything logged is a failure. */
+static int
+ping_check(struct lease *lease)
+{
+	struct lease_state state;
+	char logged[256];
+	FILE *log;
+	int saved, result;
+	size_t len;
+
+	memset(&state, 0, sizeof(state));
+	state.options = options;
+
+	log = tmpfile();
+	saved = dup(STDERR_FILENO);
+	if ((log == NULL) || (saved < 0) ||
+	    (dup2(fileno(log), STDERR_FILENO) < 0))
+		atf_tc_fail("can't catch the log");
+	scribble();
+	result = do_ping_check(packet, &state, lease, 0, 0);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+
+	rewind(log);
+	len = fread(logged, 1, sizeof(logged) - 1, log);
+	fclose(log);
+	if (len != 0) {
+		logged[len] = '\0';
+		atf_tc_fail("ping check of %s logged: %s",
+			    piaddr(lease->ip_addr), logged);
+	}
+	return result;
+}
+
+ATF_TC(ping_cache_first_offer);
+ATF_TC_HEAD(ping_cache_first_offer, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A lease offered for the first time "
+			  "is pinged with ping-cache-secs set, and not pinged "
+			  "again while its silence is remembered");
+}
+
+ATF_TC_BODY(ping_cache_first_offer, tc)
+{
+	struct lease *lease, *other;
+
+	setup();
+	lease = make_lease("192.0.2.10");
+	other = make_lease("192.0.2.11");
+
+	if (ping_check(lease) != 1)
+		atf_tc_fail("first offer not pinged");
+	if (ping_check(other) != 1)
+		atf_tc_fail("second lease not pinged");
+
+	/* Let the pings time out, as the dispatch loop would. */
+	cur_tv.tv_sec += 2;
+	cur_time = cur_tv.tv_sec;
+	process_outstanding_timeouts(NULL);
+
+	if (!ping_recently_silent(&lease->ip_addr))
+		atf_tc_fail("silent address not remembered");
+	if (ping_check(lease) != 0)
+		atf_tc_fail("recently silent address pinged again");
+
+	/* Once ping-cache-secs has passed it's pinged again. */
+	cur_tv.tv_sec += 60;
+	cur_time = cur_tv.tv_sec;
+	if (ping_check(lease) != 1)
+		atf_tc_fail("address not pinged after its cache time");
+
+	lease_dereference(&lease, MDL);
+	lease_dereference(&other, MDL);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, ping_cache_first_offer);
+
+	return (atf_no_error());
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the address range code, mostly sparse ranges: a sparse range
+ * has no lease for an address until the address is allocated, or a
+ * binding is recorded for it.  Only looking it up doesn't make one.
+ *
+ * Each test builds a shared network with one subnet, 10.0.0.0/16,
+ * and one pool, then declares ranges in the pool the way the config
+ * file parser would.
+ */
+
+static struct parse *cfile;
+static struct subnet *subnet;
+static struct pool *pool;
+
+static struct iaddr
+make_addr(const char *str)
+{
+	struct iaddr addr;
+
+	addr.len = 4;
+	if (inet_pton(AF_INET, str, addr.iabuf) != 1)
+		atf_tc_fail("bad address %s", str);
+	return addr;
+}
+
+static void
+setup(void)
+{
+	struct shared_network *share = NULL;
+	static char conf[] = "";
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	if (new_parse(&cfile, -1, conf, 0, "range test", 0) != ISC_R_SUCCESS)
+		atf_tc_fail("unable to create parse context");
+
+	if ((shared_network_allocate(&share, MDL) != ISC_R_SUCCESS) ||
+	    (subnet_allocate(&subnet, MDL) != ISC_R_SUCCESS) ||
+	    (pool_allocate(&pool, MDL) != ISC_R_SUCCESS))
+		atf_tc_fail("unable to allocate the network");
+	share->name = "range test";
+	subnet->net = make_addr("10.0.0.0");
+	subnet->netmask = make_addr("255.255.0.0");
+	shared_network_reference(&subnet->shared_network, share, MDL);
+	subnet_reference(&share->subnets, subnet, MDL);
+	shared_network_reference(&pool->shared_network, share, MDL);
+	pool_reference(&share->pools, pool, MDL);
+	shared_network_dereference(&share, MDL);
+}
+
+static void
+check_lease(struct lease *lp, const char *str)
+{
+	if (!addr_eq(lp->ip_addr, make_addr(str)))
+		atf_tc_fail("got lease %s, expected %s",
+			    piaddr(lp->ip_addr), str);
+	if (lp->binding_state != FTS_FREE)
+		atf_tc_fail("lease %s isn't free", str);
+	if ((lp->pool != pool) || (lp->subnet != subnet))
+		atf_tc_fail("lease %s isn't in the range's pool", str);
+}
+
+ATF_TC(sparse_lookup);
+ATF_TC_HEAD(sparse_lookup, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Look up addresses of a sparse range");
+}
+
+ATF_TC_BODY(sparse_lookup, tc)
+{
+	struct lease *lp = NULL, *lt = NULL;
+
+	setup();
+	new_address_range(cfile, make_addr("10.0.0.1"),
+			  make_addr("10.0.255.254"), subnet, pool, 1, NULL);
+	if (pool->sparse_leases != 65534)
+		atf_tc_fail("%d sparse leases, expected 65534",
+			    pool->sparse_leases);
+
+	/* Looking an address up doesn't make its lease... */
+	if (find_lease_by_ip_addr(&lp, make_addr("10.0.1.5"), MDL))
+		atf_tc_fail("lookup made a lease for 10.0.1.5");
+	if (pool->sparse_leases != 65534)
+		atf_tc_fail("%d sparse leases after lookup",
+			    pool->sparse_leases);
+	if (sparse_range_pool(make_addr("10.0.1.5")) != pool)
+		atf_tc_fail("10.0.1.5 isn't in the range's pool");
+
+	/* ... getting it to use does... */
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.1.5"), MDL))
+		atf_tc_fail("no lease for 10.0.1.5");
+	check_lease(lp, "10.0.1.5");
+	if (pool->sparse_leases != 65533)
+		atf_tc_fail("%d sparse leases after making one",
+			    pool->sparse_leases);
+	if (sparse_range_pool(make_addr("10.0.1.5")) != NULL)
+		atf_tc_fail("10.0.1.5 still has no lease");
+
+	/* ... and then both find it */
+	if (!find_lease_by_ip_addr(&lt, make_addr("10.0.1.5"), MDL) ||
+	    (lt != lp))
+		atf_tc_fail("lookup didn't find the same lease");
+	lease_dereference(&lt, MDL);
+	if (!find_or_make_lease_by_ip_addr(&lt, make_addr("10.0.1.5"), MDL) ||
+	    (lt != lp))
+		atf_tc_fail("second use didn't find the same lease");
+	if (pool->sparse_leases != 65533)
+		atf_tc_fail("%d sparse leases after second use",
+			    pool->sparse_leases);
+	lease_dereference(&lt, MDL);
+	lease_dereference(&lp, MDL);
+
+	/* Addresses outside the range have no lease */
+	if (find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.0.0"), MDL) ||
+	    find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.255.255"),
+					  MDL) ||
+	    find_or_make_lease_by_ip_addr(&lp, make_addr("10.1.0.1"), MDL) ||
+	    (sparse_range_pool(make_addr("10.1.0.1")) != NULL))
+		atf_tc_fail("found a lease outside the range");
+}
+
+ATF_TC(sparse_allocate);
+ATF_TC_HEAD(sparse_allocate, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Allocate from a sparse range");
+}
+
+ATF_TC_BODY(sparse_allocate, tc)
+{
+	struct lease *lp = NULL;
+	int i;
+
+	setup();
+	new_address_range(cfile, make_addr("10.0.0.1"),
+			  make_addr("10.0.0.20"), subnet, pool, 1, NULL);
+
+	/* Addresses come out lowest first */
+	if (!sparse_range_allocate(&lp, pool, MDL))
+		atf_tc_fail("no address allocated");
+	check_lease(lp, "10.0.0.1");
+	lease_dereference(&lp, MDL);
+
+	/* skipping over any that were made otherwise */
+	for (i = 2; i <= 12; i++) {
+		char str[16];
+
+		snprintf(str, sizeof(str), "10.0.0.%d", i);
+		if (!find_or_make_lease_by_ip_addr(&lp, make_addr(str), MDL))
+			atf_tc_fail("no lease for %s", str);
+		lease_dereference(&lp, MDL);
+	}
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.0.14"), MDL))
+		atf_tc_fail("no lease for 10.0.0.14");
+	lease_dereference(&lp, MDL);
+
+	if (!sparse_range_allocate(&lp, pool, MDL))
+		atf_tc_fail("no address allocated");
+	check_lease(lp, "10.0.0.13");
+	lease_dereference(&lp, MDL);
+
+	/* and the range runs out */
+	for (i = 15; i <= 20; i++) {
+		if (!sparse_range_allocate(&lp, pool, MDL))
+			atf_tc_fail("range ran out at %d", i);
+		lease_dereference(&lp, MDL);
+	}
+	if (sparse_range_allocate(&lp, pool, MDL))
+		atf_tc_fail("allocated %s past the end of the range",
+			    piaddr(lp->ip_addr));
+	if (pool->sparse_leases != 0)
+		atf_tc_fail("%d sparse leases left", pool->sparse_leases);
+}
+
+ATF_TC(sparse_overlap);
+ATF_TC_HEAD(sparse_overlap, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Overlapping ranges");
+}
+
+ATF_TC_BODY(sparse_overlap, tc)
+{
+	struct lease *lp = NULL;
+
+	setup();
+
+	/* An address declared by an earlier range keeps its lease */
+	new_address_range(cfile, make_addr("10.0.0.1"),
+			  make_addr("10.0.0.10"), subnet, pool, 0, NULL);
+	new_address_range(cfile, make_addr("10.0.0.1"),
+			  make_addr("10.0.0.20"), subnet, pool, 1, NULL);
+	if (pool->sparse_leases != 10)
+		atf_tc_fail("%d sparse leases, expected 10",
+			    pool->sparse_leases);
+
+	/* as does one of an earlier sparse range */
+	new_address_range(cfile, make_addr("10.0.0.15"),
+			  make_addr("10.0.0.30"), subnet, pool, 1, NULL);
+	if (pool->sparse_leases != 20)
+		atf_tc_fail("%d sparse leases, expected 20",
+			    pool->sparse_leases);
+
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.0.5"), MDL))
+		atf_tc_fail("no lease for 10.0.0.5");
+	lease_dereference(&lp, MDL);
+	if (pool->sparse_leases != 20)
+		atf_tc_fail("lookup of a declared address used a sparse one");
+
+	/* Where sparse ranges overlap, the earlier one has the address */
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.0.17"), MDL))
+		atf_tc_fail("no lease for 10.0.0.17");
+	lease_dereference(&lp, MDL);
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr("10.0.0.25"), MDL))
+		atf_tc_fail("no lease for 10.0.0.25");
+	lease_dereference(&lp, MDL);
+	if (pool->sparse_leases != 18)
+		atf_tc_fail("%d sparse leases, expected 18",
+			    pool->sparse_leases);
+}
+
+ATF_TC(sparse_many);
+ATF_TC_HEAD(sparse_many, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Find addresses among many sparse "
+			  "ranges, some declared over others");
+}
+
+ATF_TC_BODY(sparse_many, tc)
+{
+	struct lease *lp = NULL;
+	char low[16], high[16], str[16];
+	int i, j;
+
+	setup();
+
+	/* 10.0.i.10 to 10.0.i.20 in a scattered order, and a wide range
+	   under the first hundred of them that also covers the gaps. */
+	for (i = 0; i < 256; i++) {
+		j = (i * 97) & 255;
+		snprintf(low, sizeof(low), "10.0.%d.10", j);
+		snprintf(high, sizeof(high), "10.0.%d.20", j);
+		new_address_range(cfile, make_addr(low), make_addr(high),
+				  subnet, pool, 1, NULL);
+		if (i == 128)
+			new_address_range(cfile, make_addr("10.0.0.1"),
+					  make_addr("10.0.99.254"), subnet,
+					  pool, 1, NULL);
+	}
+
+	for (i = 0; i < 256; i++) {
+		snprintf(str, sizeof(str), "10.0.%d.15", i);
+		if (!find_or_make_lease_by_ip_addr(&lp, make_addr(str), MDL))
+			atf_tc_fail("no lease for %s", str);
+		check_lease(lp, str);
+		lease_dereference(&lp, MDL);
+
+		snprintf(str, sizeof(str), "10.0.%d.30", i);
+		if ((sparse_range_pool(make_addr(str)) != NULL) != (i < 100))
+			atf_tc_fail("%s %s in a range", str,
+				    i < 100 ? "isn't" : "is");
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, sparse_lookup);
+	ATF_TP_ADD_TC(tp, sparse_allocate);
+	ATF_TP_ADD_TC(tp, sparse_overlap);
+	ATF_TP_ADD_TC(tp, sparse_many);
+	return (atf_no_error());
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <atf-c.h>
+
+/*
+ * Test configuration reload.  Each test reads a config file the way the
+ * server does at startup, gives some of the leases a state, writes a
+ * different config file and reloads it.  dhcpd_bench times the reload.
+ */
+
+static const char *conf_file = "reload_test.conf";
+static const char *include_file = "reload_test.inc";
+
+static struct iaddr
+make_addr(const char *str)
+{
+	struct iaddr addr;
+
+	addr.len = 4;
+	if (inet_pton(AF_INET, str, addr.iabuf) != 1)
+		atf_tc_fail("bad address %s", str);
+	return addr;
+}
+
+static void
+write_conf(const char *conf)
+{
+	FILE *f;
+
+	f = fopen(conf_file, "w");
+	if ((f == NULL) || (fputs(conf, f) == EOF) || (fclose(f) != 0))
+		atf_tc_fail("can't write %s", conf_file);
+	path_dhcpd_conf = conf_file;
+}
+
+static void
+setup(const char *conf)
+{
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	if (omapi_init() != ISC_R_SUCCESS)
+		atf_tc_fail("omapi_init failed");
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	gettimeofday(&cur_tv, NULL);
+
+	/* as main() does at startup */
+	root_group_setup();
+	write_conf(conf);
+	if (readconf() != ISC_R_SUCCESS)
+		atf_tc_fail("can't read the config file");
+	expire_all_pools();
+}
+
+/* Give a lease a client and make it active. */
+static struct lease *
+make_active(const char *str, unsigned char mac)
+{
+	struct lease *lp = NULL;
+
+	if (!find_or_make_lease_by_ip_addr(&lp, make_addr(str), MDL))
+		atf_tc_fail("no lease for %s", str);
+	LEASE_REMOVEP(&lp->pool->free, lp);
+	lp->binding_state = FTS_ACTIVE;
+	lp->next_binding_state = FTS_ACTIVE;
+	lp->ends = cur_time + 3600;
+	lp->hardware_addr.hlen = 7;
+	memset(lp->hardware_addr.hbuf, 0, sizeof(lp->hardware_addr.hbuf));
+	lp->hardware_addr.hbuf[0] = HTYPE_ETHER;
+	lp->hardware_addr.hbuf[6] = mac;
+	if (!lease_enqueue(lp))
+		atf_tc_fail("can't queue lease %s", str);
+	hw_hash_add(lp);
+	return lp;
+}
+
+/* Check that a lease is active, is the one found for its address and its
+   hardware address, and is in the pool of the running config that covers
+   its address. */
+static void
+check_kept(struct lease *lp)
+{
+	struct lease *lt = NULL;
+	struct subnet *subnet = NULL;
+
+	if (!find_lease_by_ip_addr(&lt, lp->ip_addr, MDL) || (lt != lp))
+		atf_tc_fail("lease %s wasn't kept", piaddr(lp->ip_addr));
+	lease_dereference(&lt, MDL);
+	if (!find_lease_by_hw_addr(&lt, lp->hardware_addr.hbuf,
+				   lp->hardware_addr.hlen, MDL) || (lt != lp))
+		atf_tc_fail("lease %s not found by hardware address",
+			    piaddr(lp->ip_addr));
+	lease_dereference(&lt, MDL);
+
+	if (lp->binding_state != FTS_ACTIVE)
+		atf_tc_fail("lease %s isn't active", piaddr(lp->ip_addr));
+	if (!find_subnet(&subnet, lp->ip_addr, MDL) || (lp->subnet != subnet))
+		atf_tc_fail("lease %s isn't in the new subnet",
+			    piaddr(lp->ip_addr));
+	if ((lp->pool == NULL) ||
+	    (lp->pool->shared_network != subnet->shared_network))
+		atf_tc_fail("lease %s isn't in the new pool",
+			    piaddr(lp->ip_addr));
+	subnet_dereference(&subnet, MDL);
+
+	for (lt = LEASE_GET_FIRSTP(&lp->pool->active); lt != NULL;
+	     lt = LEASE_GET_NEXTP(&lp->pool->active, lt)) {
+		if (lt == lp)
+			break;
+	}
+	if (lt == NULL)
+		atf_tc_fail("lease %s isn't on the active queue",
+			    piaddr(lp->ip_addr));
+}
+
+ATF_TC(reload_keeps_leases);
+ATF_TC_HEAD(reload_keeps_leases, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A reload keeps the leases of "
+			  "addresses that are still in a range");
+}
+
+ATF_TC_BODY(reload_keeps_leases, tc)
+{
+	struct lease *kept, *gone, *lp = NULL;
+	struct pool *old_pool = NULL;
+
+	setup("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+	      "	range 10.0.0.10 10.0.0.20;\n"
+	      "}\n"
+	      "subnet 10.0.1.0 netmask 255.255.255.0 {\n"
+	      "	range 10.0.1.10 10.0.1.20;\n"
+	      "}\n");
+	kept = make_active("10.0.0.15", 1);
+	gone = make_active("10.0.1.12", 2);
+	pool_reference(&old_pool, kept->pool, MDL);
+
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	option routers 10.0.0.1;\n"
+		   "	range 10.0.0.10 10.0.0.30;\n"
+		   "}\n"
+		   "subnet 10.0.2.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.2.10 10.0.2.20;\n"
+		   "}\n");
+	if (reload_config_apply() != ISC_R_SUCCESS)
+		atf_tc_fail("reload failed");
+
+	check_kept(kept);
+	if (kept->pool == old_pool)
+		atf_tc_fail("lease is still in the old pool");
+	if ((kept->pool->lease_count != 21) || (kept->pool->free_leases != 20))
+		atf_tc_fail("pool has %d leases, %d free; expected 21, 20",
+			    kept->pool->lease_count, kept->pool->free_leases);
+
+	/* The old pool has nothing left on its queues */
+	if (LEASE_NOT_EMPTY(old_pool->active) ||
+	    LEASE_NOT_EMPTY(old_pool->free))
+		atf_tc_fail("old pool still has leases");
+
+	/* A lease whose address is in no range any more is forgotten */
+	if (find_lease_by_ip_addr(&lp, gone->ip_addr, MDL))
+		atf_tc_fail("lease %s wasn't forgotten", piaddr(gone->ip_addr));
+	if (find_lease_by_hw_addr(&lp, gone->hardware_addr.hbuf,
+				  gone->hardware_addr.hlen, MDL))
+		atf_tc_fail("forgotten lease still found by hardware address");
+
+	/* and a new range has free leases */
+	if (!find_lease_by_ip_addr(&lp, make_addr("10.0.2.15"), MDL) ||
+	    (lp->binding_state != FTS_FREE))
+		atf_tc_fail("no free lease for 10.0.2.15");
+	lease_dereference(&lp, MDL);
+
+	pool_dereference(&old_pool, MDL);
+	lease_dereference(&kept, MDL);
+	lease_dereference(&gone, MDL);
+}
+
+ATF_TC(reload_bad_config);
+ATF_TC_HEAD(reload_bad_config, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A config file with errors leaves "
+			  "the running config alone");
+}
+
+ATF_TC_BODY(reload_bad_config, tc)
+{
+	struct lease *kept;
+	struct pool *pool = NULL;
+	struct subnet *subnet = NULL;
+
+	setup("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+	      "	range 10.0.0.10 10.0.0.20;\n"
+	      "}\n");
+	kept = make_active("10.0.0.15", 1);
+	pool_reference(&pool, kept->pool, MDL);
+	subnet_reference(&subnet, subnets, MDL);
+
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.0.10 10.0.0.30\n"
+		   "}\n");
+	if (reload_config_apply() == ISC_R_SUCCESS)
+		atf_tc_fail("reload of a bad config file succeeded");
+
+	if ((subnets != subnet) || (kept->pool != pool))
+		atf_tc_fail("running config changed");
+	check_kept(kept);
+
+	subnet_dereference(&subnet, MDL);
+	pool_dereference(&pool, MDL);
+	lease_dereference(&kept, MDL);
+}
+
+ATF_TC(reload_checked_copy);
+ATF_TC_HEAD(reload_checked_copy, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A reload applies the config files "
+			  "the check read, even if they change after it");
+}
+
+ATF_TC_BODY(reload_checked_copy, tc)
+{
+	struct lease *kept, *lp = NULL;
+	siginfo_t info;
+	FILE *f;
+
+	setup("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+	      "	range 10.0.0.10 10.0.0.20;\n"
+	      "}\n");
+	kept = make_active("10.0.0.15", 1);
+
+	f = fopen(include_file, "w");
+	if ((f == NULL) ||
+	    (fputs("subnet 10.0.5.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.5.10 10.0.5.20;\n"
+		   "}\n", f) == EOF) ||
+	    (fclose(f) != 0))
+		atf_tc_fail("can't write %s", include_file);
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.0.10 10.0.0.30;\n"
+		   "}\n"
+		   "include \"reload_test.inc\";\n");
+	reload_config();
+
+	/* Once the check is done, break the config file and remove the
+	   included one before the server gets to apply them. */
+	memset(&info, 0, sizeof(info));
+	if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) != 0)
+		atf_tc_fail("no config check was started");
+	if ((info.si_code != CLD_EXITED) || (info.si_status != 0))
+		atf_tc_fail("the config check failed");
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	range 10.0.0.10 10.0.0.40\n");
+	unlink(include_file);
+
+	cur_tv.tv_sec += 1;
+	cur_time = cur_tv.tv_sec;
+	process_outstanding_timeouts(NULL);
+
+	check_kept(kept);
+	if ((kept->pool->lease_count != 21) || (kept->pool->free_leases != 20))
+		atf_tc_fail("pool has %d leases, %d free; expected 21, 20",
+			    kept->pool->lease_count, kept->pool->free_leases);
+	if (!find_lease_by_ip_addr(&lp, make_addr("10.0.5.15"), MDL))
+		atf_tc_fail("the included subnet wasn't loaded");
+	lease_dereference(&lp, MDL);
+	lease_dereference(&kept, MDL);
+}
+
+ATF_TC(reload_sparse);
+ATF_TC_HEAD(reload_sparse, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A reload keeps leases of sparse "
+			  "ranges");
+}
+
+ATF_TC_BODY(reload_sparse, tc)
+{
+	struct lease *kept;
+
+	setup("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+	      "	range sparse 10.0.0.10 10.0.0.100;\n"
+	      "}\n");
+	kept = make_active("10.0.0.50", 1);
+
+	/* The address is in a sparse range again, so the new config has no
+	   lease for it until the old one is moved over. */
+	write_conf("subnet 10.0.0.0 netmask 255.255.255.0 {\n"
+		   "	range sparse 10.0.0.1 10.0.0.254;\n"
+		   "}\n");
+	if (reload_config_apply() != ISC_R_SUCCESS)
+		atf_tc_fail("reload failed");
+
+	check_kept(kept);
+	if (kept->pool->sparse_leases != 253)
+		atf_tc_fail("%d sparse leases, expected 253",
+			    kept->pool->sparse_leases);
+	if ((kept->pool->lease_count != 254) ||
+	    (kept->pool->free_leases != 253))
+		atf_tc_fail("pool has %d leases, %d free; expected 254, 253",
+			    kept->pool->lease_count, kept->pool->free_leases);
+	lease_dereference(&kept, MDL);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, reload_keeps_leases);
+	ATF_TP_ADD_TC(tp, reload_bad_config);
+	ATF_TP_ADD_TC(tp, reload_checked_copy);
+	ATF_TP_ADD_TC(tp, reload_sparse);
+	return (atf_no_error());
+}